@@ -32,8 +32,10 @@ struct animation_hook : public wf::custom_data_t
     wayfire_view view;
     wf::output_t *output;
 
+    wf::option_wrapper_t<double> snapshot_max_scale{"animate/snapshot_max_scale"};
+
     /* Update animation right before each frame */
-    wf::effect_hook_t update_animation_hook = [=] ()
+    wf::animation_hook_t update_animation_hook = [=] (uint32_t, wf::region_t&)
     {
         view->damage();
         bool result = animation->step();
@@ -41,6 +43,8 @@ struct animation_hook : public wf::custom_data_t
 
         if (!result)
             stop_hook(false);
+
+        return result;
     };
 
     /* If the view changes outputs, we need to stop animating, because our animations,
@@ -59,14 +63,16 @@ struct animation_hook : public wf::custom_data_t
 
         if (type == ANIMATION_TYPE_UNMAP)
         {
+            /* The contents of a closing view are only seen for a moment, so
+             * they don't need the full resolution of HiDPI outputs */
             view->take_ref();
-            view->take_snapshot();
+            view->take_final_snapshot(snapshot_max_scale);
         }
 
         animation = std::make_unique<animation_t> ();
         animation->init(view, duration, type);
 
-        output->render->add_effect(&update_animation_hook, wf::OUTPUT_EFFECT_PRE);
+        output->render->add_animation(&update_animation_hook);
 
         /* We listen for just the detach-view signal. If the state changes in
          * some other way (i.e view unmapped while map animation), the hook
@@ -89,7 +95,7 @@ struct animation_hook : public wf::custom_data_t
         if (type == ANIMATION_TYPE_UNMAP)
             view->unref();
 
-        output->render->rem_effect(&update_animation_hook);
+        output->render->rem_animation(&update_animation_hook);
         output->disconnect_signal("detach-view", &view_detached);
     }
 };
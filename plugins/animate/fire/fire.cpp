@@ -8,6 +8,7 @@
 
 static wf::option_wrapper_t<int> fire_particles{"animate/fire_particles"};
 static wf::option_wrapper_t<double> fire_particle_size{"animate/fire_particle_size"};
+static wf::option_wrapper_t<bool> fire_gpu_particles{"animate/fire_gpu_particles"};
 
 // generate a random float between s and e
 static float random(float s, float e)
@@ -32,7 +33,7 @@ class FireTransformer : public wf::view_transformer_t
 
     FireTransformer(wayfire_view view) :
         ps(fire_particles,
-           [=] (Particle& p) {init_particle(p); })
+           [=] (Particle& p) {init_particle(p); }, fire_gpu_particles)
     {
         last_boundingbox = view->get_bounding_box();
         ps.resize(particle_count_for_width(last_boundingbox.width));
@@ -143,10 +144,8 @@ void FireAnimation::init(wayfire_view view, int dur, wf_animation_type type)
 bool FireAnimation::step()
 {
     transformer->set_progress_line(this->progression);
-    if (this->progression.running())
-        transformer->ps.spawn(transformer->ps.size() / 10);
-
-    transformer->ps.update();
+    transformer->ps.update(this->progression.running() ?
+        transformer->ps.size() / 10 : 0);
     return this->progression.running() || transformer->ps.statistic();
 }
 
@@ -1,41 +1,42 @@
 #include "particle.hpp"
 #include "shaders.hpp"
 #include <wayfire/core.hpp>
-#include <thread>
 #include <wayfire/debug.hpp>
-
-void Particle::update(float time)
+#include <wayfire/thread-pool.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/* How many particles a worker thread updates at once */
+static const size_t PARTICLES_PER_TASK = 1024;
+
+/* The length of an update, and the most updates run for one frame */
+static const double STEP_MSEC = 16;
+static const int MAX_STEPS_PER_FRAME = 4;
+
+/* How much the particles move, accelerate and fade per update. The update
+ * shader for the GPU uses the same values. */
+static const float SLOWDOWN   = 0.8;
+static const float MOVE_STEP  = 0.2f * SLOWDOWN;
+static const float ACCEL_STEP = 0.3f * SLOWDOWN;
+static const float FADE_STEP  = 0.3f * SLOWDOWN;
+
+/* The state of a particle on the GPU, in the layout of the inputs and the
+ * outputs of the update shader */
+struct GpuParticle
 {
-    if (life <= 0) // ignore
-        return;
-
-    const float slowdown = 0.8;
-
-    pos += speed * 0.2f * slowdown;
-    speed += g * 0.3f * slowdown;
-
-    if (life != 0)
-        color.a /= life;
-
-    life -= fade * 0.3 * slowdown;
-    radius = base_radius * std::pow(life, 0.5);
-    color.a *= life;
-
-    if (start_pos.x < pos.x)
-        g.x = -1;
-    else
-        g.x = 1;
-
-    if (life <= 0)
-    {
-        /* move outside */
-        pos = {-10000, -10000};
-    }
-}
-
-ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func)
+    float life, fade, base_radius, radius;
+    float pos[2], speed[2];
+    float g[2], start_x, unused;
+    float color[4];
+};
+
+ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func,
+    bool on_gpu) : timestep(STEP_MSEC, MAX_STEPS_PER_FRAME)
 {
     this->pinit_func = init_func;
+    this->on_gpu = on_gpu;
 
     resize(particles);
     last_update_msec = wf::get_current_time();
@@ -48,21 +49,43 @@ ParticleSystem::~ParticleSystem()
 {
     OpenGL::render_begin();
     program.free_resources();
+    update_program.free_resources();
+    gpu_state[0].release();
+    gpu_state[1].release();
     OpenGL::render_end();
 }
 
 int ParticleSystem::spawn(int num)
 {
+    if (on_gpu)
+        return spawn_on_gpu(num);
+
     // TODO: multithread this
     int spawned = 0;
-    for (size_t i = 0; i < ps.size() && spawned < num; i++)
+    for (size_t i = 0; i < life.size() && spawned < num; i++)
     {
-        if (ps[i].life <= 0)
-        {
-            pinit_func(ps[i]);
-            ++spawned;
-            ++particles_alive;
-        }
+        if (life[i] > 0)
+            continue;
+
+        Particle p;
+        pinit_func(p);
+
+        life[i] = p.life;
+        fade[i] = p.fade;
+        base_radius[i] = p.base_radius;
+        radius[i] = p.radius;
+        speed[2 * i] = p.speed.x;
+        speed[2 * i + 1] = p.speed.y;
+        g_x[i] = p.g.x;
+        g_y[i] = p.g.y;
+        start_x[i] = p.start_pos.x;
+        center[2 * i] = p.pos.x;
+        center[2 * i + 1] = p.pos.y;
+        for (int j = 0; j < 4; j++)
+            color[4 * i + j] = p.color[j];
+
+        ++spawned;
+        ++particles_alive;
     }
 
     return spawned;
@@ -70,87 +93,96 @@ int ParticleSystem::spawn(int num)
 
 void ParticleSystem::resize(int num)
 {
-    if (num == (int)ps.size())
+    if (num == size())
         return;
 
+    if (on_gpu)
+        return resize_on_gpu(num);
+
     // TODO: multithread this
-    for (int i = num; i < (int)ps.size(); i++)
+    for (int i = num; i < size(); i++)
     {
-        if (ps[i].life >= 0)
+        if (life[i] > 0)
             --particles_alive;
     }
 
-    ps.resize(num);
+    life.resize(num, -1);
+    fade.resize(num);
+    base_radius.resize(num);
+    g_x.resize(num);
+    g_y.resize(num);
+    start_x.resize(num);
 
     color.resize(color_per_particle * num);
-    dark_color.resize(color_per_particle * num);
     radius.resize(radius_per_particle * num);
     center.resize(center_per_particle * num);
+    speed.resize(speed_per_particle * num);
 }
 
 int ParticleSystem::size()
 {
-    return ps.size();
+    return on_gpu ? dies_at.size() : life.size();
 }
 
-void ParticleSystem::update_worker(float time, int start, int end)
+void ParticleSystem::update_worker(int start, int end)
 {
-    end = std::min(end, (int)ps.size());
+    float *life = this->life.data();
+    float *center = this->center.data();
+    float *color = this->color.data();
+    float *speed = this->speed.data();
+
+    /* The loop has no branches, dead particles are left as they are by
+     * selecting their old values, so that the compiler can vectorize it */
+    int died = 0;
     for (int i = start; i < end; ++i)
     {
-        if (ps[i].life <= 0)
-            continue;
+        float old_life = life[i];
+        bool alive = old_life > 0;
+        float new_life = old_life - fade[i] * FADE_STEP;
+        bool dies = alive && new_life <= 0;
+        died += dies;
 
-    //    printf("%d\n", i);
-        ps[i].update(time);
+        float x = center[2 * i] + speed[2 * i] * MOVE_STEP;
+        float y = center[2 * i + 1] + speed[2 * i + 1] * MOVE_STEP;
+        speed[2 * i] += alive ? g_x[i] * ACCEL_STEP : 0;
+        speed[2 * i + 1] += alive ? g_y[i] * ACCEL_STEP : 0;
+        g_x[i] = alive ? (start_x[i] < x ? -1 : 1) : g_x[i];
 
-        if (ps[i].life <= 0)
-            --particles_alive;
+        /* Dead particles are moved outside */
+        center[2 * i] = dies ? -10000 : (alive ? x : center[2 * i]);
+        center[2 * i + 1] = dies ? -10000 : (alive ? y : center[2 * i + 1]);
 
-        for (int j = 0; j < 4; j++) // maybe use memcpy?
-        {
-            color[4 * i + j] = ps[i].color[j];
-            dark_color[4 * i + j] = ps[i].color[j] * 0.5;
-        }
+        radius[i] = alive ?
+            base_radius[i] * std::sqrt(std::max(new_life, 0.0f)) : radius[i];
 
-     //   printf("center %d gets %f", 2 * i, ps[i].pos[0]);
-        center[2 * i] = ps[i].pos[0];
-        center[2 * i + 1] = ps[i].pos[1];
+        float alpha = color[4 * i + 3] * new_life / (alive ? old_life : 1);
+        color[4 * i + 3] = alive ? alpha : color[4 * i + 3];
 
-        radius[i] = ps[i].radius;
+        life[i] = alive ? new_life : old_life;
     }
+
+    particles_alive -= died;
 }
 
-void ParticleSystem::exec_worker_threads(std::function<void(int, int)> spawn_worker)
+void ParticleSystem::update(int spawn_per_step)
 {
-//    return spawn_worker(0, ps.size());
-
-    const int num_threads = std::thread::hardware_concurrency();
-    const int worker_load = (ps.size() + num_threads - 1) / num_threads;
+    int steps = timestep.advance(wf::get_current_time() - last_update_msec);
+    last_update_msec = wf::get_current_time();
 
-    std::thread workers[num_threads];
-    for (int i = 0; i < num_threads; i++)
+    for (int i = 0; i < steps; i++)
     {
-        int thread_start = i * worker_load;
-        int thread_end = (i + 1) * worker_load;
-        thread_end = std::min(thread_end, (int)ps.size());
+        spawn(spawn_per_step);
+        if (on_gpu)
+        {
+            update_on_gpu();
+            continue;
+        }
 
-        workers[i] = std::thread([=] () { spawn_worker(thread_start, thread_end); });
+        /* Small systems are updated inline, where waking up the workers
+         * would cost more than the update itself */
+        wf::thread_pool_t::get().parallel_for(size(), PARTICLES_PER_TASK,
+            [=] (size_t start, size_t end) { update_worker(start, end); });
     }
-
-    for (auto& w : workers)
-        w.join();
-}
-
-void ParticleSystem::update()
-{
-    // FIXME: don't hardcode 60FPS
-    float time = (wf::get_current_time() - last_update_msec) / 16.0;
-    last_update_msec = wf::get_current_time();
-
-    exec_worker_threads([=] (int start, int end) {
-        update_worker(time, start, end);
-    });
 }
 
 int ParticleSystem::statistic()
@@ -164,7 +196,197 @@ void ParticleSystem::create_program()
     OpenGL::render_begin();
     program.set_simple(OpenGL::compile_program(particle_vert_source,
         particle_frag_source));
+
+    position_attrib = program.get_attrib("position");
+    radius_attrib = program.get_attrib("radius");
+    center_attrib = program.get_attrib("center");
+    speed_attrib = program.get_attrib("speed");
+    color_attrib = program.get_attrib("color");
+    matrix_uniform = program.get_uniform("matrix");
+    smoothing_uniform = program.get_uniform("smoothing");
+    color_scale_uniform = program.get_uniform("color_scale");
+    extrapolate_uniform = program.get_uniform("extrapolate");
+
+    if (on_gpu)
+    {
+        auto vertex = OpenGL::compile_shader(particle_update_vert_source,
+            GL_VERTEX_SHADER);
+        auto fragment = OpenGL::compile_shader(particle_update_frag_source,
+            GL_FRAGMENT_SHADER);
+
+        auto id = GL_CALL(glCreateProgram());
+        GL_CALL(glAttachShader(id, vertex));
+        GL_CALL(glAttachShader(id, fragment));
+
+        const char *varyings[] = {
+            "out_state", "out_motion", "out_gravity", "out_color"
+        };
+        GL_CALL(glTransformFeedbackVaryings(id, 4, varyings,
+            GL_INTERLEAVED_ATTRIBS));
+        GL_CALL(glLinkProgram(id));
+        GL_CALL(glDeleteShader(vertex));
+        GL_CALL(glDeleteShader(fragment));
+        update_program.set_simple(id);
+
+        state_attribs[0] = update_program.get_attrib("state");
+        state_attribs[1] = update_program.get_attrib("motion");
+        state_attribs[2] = update_program.get_attrib("gravity");
+        state_attribs[3] = update_program.get_attrib("color");
+    }
+
+    OpenGL::render_end();
+}
+
+/* @return The number of updates until the particle dies, the same as in the
+ * update shader */
+static uint64_t updates_until_death(const Particle& p)
+{
+    if (p.fade <= 0)
+        return UINT64_MAX;
+
+    uint64_t updates = 0;
+    for (float life = p.life; life > 0; life -= p.fade * FADE_STEP)
+        ++updates;
+
+    return updates;
+}
+
+int ParticleSystem::spawn_on_gpu(int num)
+{
+    /* The new particles are uploaded in runs of consecutive slots */
+    std::vector<GpuParticle> run;
+    size_t run_start = 0;
+    auto upload_run = [&] ()
+    {
+        if (run.empty())
+            return;
+
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, gpu_state[gpu_current].buffer));
+        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER,
+            run_start * sizeof(GpuParticle),
+            run.size() * sizeof(GpuParticle), run.data()));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+        run.clear();
+    };
+
+    OpenGL::render_begin();
+    int spawned = 0;
+    for (size_t i = 0; i < dies_at.size() && spawned < num; i++)
+    {
+        if (dies_at[i] > update_count)
+        {
+            upload_run();
+            continue;
+        }
+
+        Particle p;
+        pinit_func(p);
+
+        if (run.empty())
+            run_start = i;
+
+        run.push_back({
+            p.life, p.fade, p.base_radius, p.radius,
+            {p.pos.x, p.pos.y}, {p.speed.x, p.speed.y},
+            {p.g.x, p.g.y}, p.start_pos.x, 0,
+            {p.color.r, p.color.g, p.color.b, p.color.a}
+        });
+
+        uint64_t updates = updates_until_death(p);
+        dies_at[i] = updates == UINT64_MAX ? updates : update_count + updates;
+        deaths.insert(dies_at[i]);
+
+        ++spawned;
+        ++particles_alive;
+    }
+
+    upload_run();
     OpenGL::render_end();
+
+    return spawned;
+}
+
+void ParticleSystem::resize_on_gpu(int num)
+{
+    for (int i = num; i < size(); i++)
+    {
+        if (dies_at[i] > update_count)
+        {
+            deaths.erase(deaths.find(dies_at[i]));
+            --particles_alive;
+        }
+    }
+
+    /* New buffers are created with dead particles, and the particles which
+     * are kept are copied there from the current buffer */
+    GpuParticle dead = {};
+    dead.life = -1;
+    std::vector<GpuParticle> initial(num, dead);
+    size_t kept = std::min(num, size()) * sizeof(GpuParticle);
+
+    OpenGL::render_begin();
+    for (int i = 0; i < 2; i++)
+    {
+        wf::vertex_buffer_t buffer;
+        if (num > 0)
+            buffer.upload(initial.data(), num * sizeof(GpuParticle));
+
+        if ((i == gpu_current) && (kept > 0))
+        {
+            GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, gpu_state[i].buffer));
+            GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.buffer));
+            GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                GL_COPY_WRITE_BUFFER, 0, 0, kept));
+            GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+            GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+        }
+
+        gpu_state[i].release();
+        std::swap(gpu_state[i].buffer, buffer.buffer);
+        std::swap(gpu_state[i].size, buffer.size);
+    }
+
+    OpenGL::render_end();
+
+    dies_at.resize(num, 0);
+}
+
+void ParticleSystem::update_on_gpu()
+{
+    if (size() > 0)
+    {
+        auto& src = gpu_state[gpu_current];
+        auto& dst = gpu_state[1 - gpu_current];
+        const int stride = sizeof(GpuParticle);
+
+        OpenGL::render_begin();
+        update_program.use(wf::TEXTURE_TYPE_RGBA);
+        for (int i = 0; i < 4; i++)
+        {
+            update_program.attrib_buffer(state_attribs[i], 4, stride,
+                src.at(4 * i * sizeof(float)));
+        }
+
+        GL_CALL(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, dst.buffer));
+        GL_CALL(glEnable(GL_RASTERIZER_DISCARD));
+        GL_CALL(glBeginTransformFeedback(GL_POINTS));
+        GL_CALL(glDrawArrays(GL_POINTS, 0, size()));
+        GL_CALL(glEndTransformFeedback());
+        GL_CALL(glDisable(GL_RASTERIZER_DISCARD));
+        GL_CALL(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+
+        update_program.deactivate();
+        OpenGL::render_end();
+
+        gpu_current = 1 - gpu_current;
+    }
+
+    ++update_count;
+    while (!deaths.empty() && (*deaths.begin() <= update_count))
+    {
+        deaths.erase(deaths.begin());
+        --particles_alive;
+    }
 }
 
 void ParticleSystem::render(glm::mat4 matrix)
@@ -177,37 +399,63 @@ void ParticleSystem::render(glm::mat4 matrix)
         -1,  1
     };
 
-    program.attrib_pointer("position", 2, 0, vertex_data);
-    program.attrib_divisor("position", 0);
+    program.attrib_buffer(position_attrib, 2, 0,
+        OpenGL::stream_vertex_data(vertex_data, sizeof(vertex_data)));
+    program.attrib_divisor(position_attrib, 0);
 
-    program.attrib_pointer("radius", 1, 0, radius.data());
-    program.attrib_divisor("radius", 1);
+    if (on_gpu)
+    {
+        /* The particles are drawn straight from the updated state */
+        auto& state = gpu_state[gpu_current];
+        const int stride = sizeof(GpuParticle);
+        program.attrib_buffer(radius_attrib, 1, stride,
+            state.at(offsetof(GpuParticle, radius)));
+        program.attrib_buffer(center_attrib, 2, stride,
+            state.at(offsetof(GpuParticle, pos)));
+        program.attrib_buffer(speed_attrib, 2, stride,
+            state.at(offsetof(GpuParticle, speed)));
+        program.attrib_buffer(color_attrib, 4, stride,
+            state.at(offsetof(GpuParticle, color)));
+    } else
+    {
+        program.attrib_buffer(radius_attrib, 1, 0, OpenGL::stream_vertex_data(
+            radius.data(), radius.size() * sizeof(radius[0])));
+        program.attrib_buffer(center_attrib, 2, 0, OpenGL::stream_vertex_data(
+            center.data(), center.size() * sizeof(center[0])));
+        program.attrib_buffer(speed_attrib, 2, 0, OpenGL::stream_vertex_data(
+            speed.data(), speed.size() * sizeof(speed[0])));
+        program.attrib_buffer(color_attrib, 4, 0, OpenGL::stream_vertex_data(
+            color.data(), color.size() * sizeof(color[0])));
+    }
 
-    program.attrib_pointer("center", 2, 0, center.data());
-    program.attrib_divisor("center", 1);
+    program.attrib_divisor(radius_attrib, 1);
+    program.attrib_divisor(center_attrib, 1);
+    program.attrib_divisor(speed_attrib, 1);
+    program.attrib_divisor(color_attrib, 1);
 
     // matrix
-    program.uniformMatrix4f("matrix", matrix);
+    program.uniformMatrix4f(matrix_uniform, matrix);
+    program.uniform1f(extrapolate_uniform,
+        MOVE_STEP * timestep.get_progress());
 
     /* Darken the background */
-    program.attrib_pointer("color", 4, 0, dark_color.data());
-    program.attrib_divisor("color", 1);
+    program.uniform1f(color_scale_uniform, 0.5);
 
-    GL_CALL(glEnable(GL_BLEND));
-    GL_CALL(glBlendFunc(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA));
-    program.uniform1f("smoothing", 0.7);
+    OpenGL::get_state_cache().set_blend(true);
+    OpenGL::get_state_cache().blend_func(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    program.uniform1f(smoothing_uniform, 0.7);
 
     // TODO: optimize shaders for this case
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, size()));
 
     // particle color
-    program.attrib_pointer("color", 4, 0, color.data());
-    GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE));
-    program.uniform1f("smoothing", 0.5);
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    program.uniform1f(color_scale_uniform, 1.0);
+    OpenGL::get_state_cache().blend_func(GL_SRC_ALPHA, GL_ONE);
+    program.uniform1f(smoothing_uniform, 0.5);
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, size()));
 
-    GL_CALL(glDisable(GL_BLEND));
-    GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    OpenGL::get_state_cache().set_blend(false);
+    OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
     program.deactivate();
 }
@@ -2,8 +2,10 @@
 #define ANIMATION_FIRE_PARTICLE_HPP
 
 #include <wayfire/opengl.hpp>
+#include <wayfire/fixed-timestep.hpp>
 #include <functional>
 #include <atomic>
+#include <set>
 #include <vector>
 
 struct Particle
@@ -17,23 +19,22 @@ struct Particle
     glm::vec2 start_pos;
 
     glm::vec4 color{1.0, 1.0, 1.0, 1.0};
-
-    /* update the given particle
-     * time is the percentage of the frame which has elapsed
-     * must be thread-safe */
-    void update(float time);
 };
 
-/* a function to initialize a particle */
+/* a function to initialize a particle. The particle system copies the
+ * initial state into its arrays, the Particle itself isn't kept */
 using ParticleIniter = std::function<void(Particle&)>;
 
 class ParticleSystem
 {
     public:
         /* the user of this class has to set up a proper GL context
-         * before creating the ParticleSystem */
+         * before creating the ParticleSystem
+         *
+         * With on_gpu, the particles are updated by the GPU with transform
+         * feedback, and only the newly spawned particles are uploaded */
         ParticleSystem(int num_part,
-                       ParticleIniter part_init_func);
+                       ParticleIniter part_init_func, bool on_gpu = false);
         ~ParticleSystem();
 
         /* spawn at most num new particles.
@@ -47,8 +48,10 @@ class ParticleSystem
         // return the maximal number of particles
         int size();
 
-        /* update all particles */
-        void update();
+        /* update all particles by the time which has elapsed since the
+         * last update, in steps of a fixed length. Before each step,
+         * spawn_per_step new particles are spawned */
+        void update(int spawn_per_step = 0);
 
         // number of particles alive
         int statistic();
@@ -63,12 +66,19 @@ class ParticleSystem
 
         ParticleIniter pinit_func;
         uint32_t last_update_msec;
+        wf::fixed_timestep_t timestep;
 
         std::atomic<int> particles_alive;
-        std::vector<Particle> ps;
+
+        /* The state of the particles, as a structure of arrays so that the
+         * update loop can be vectorized. color, radius and center are also
+         * the per-instance attributes used for rendering, so they are updated
+         * in place. They are empty when the particles are on the GPU. */
+        std::vector<float> life, fade, base_radius;
+        std::vector<float> g_x, g_y, start_x;
 
         static constexpr int color_per_particle = 4;
-        std::vector<float> color, dark_color;
+        std::vector<float> color;
 
         static constexpr int radius_per_particle = 1;
         std::vector<float> radius;
@@ -76,10 +86,37 @@ class ParticleSystem
         static constexpr int center_per_particle = 2;
         std::vector<float> center;
 
+        /* The speed is also used for rendering, to move the particles by
+         * the part of the next step which has elapsed */
+        static constexpr int speed_per_particle = 2;
+        std::vector<float> speed;
+
         OpenGL::program_t program;
-        void exec_worker_threads(std::function<void(int, int)> spawn_worker);
-        void update_worker(float time, int start, int end);
+        OpenGL::attrib_handle_t position_attrib, radius_attrib,
+            center_attrib, speed_attrib, color_attrib;
+        OpenGL::uniform_handle_t matrix_uniform, smoothing_uniform,
+            color_scale_uniform, extrapolate_uniform;
+
+        /* On the GPU, the state of the particles is in gpu_state[gpu_current],
+         * and the update writes it to the other buffer. The CPU only keeps
+         * the number of the update after which each particle dies, which is
+         * known when it is spawned, so nothing is ever read back. */
+        bool on_gpu;
+        int gpu_current = 0;
+        wf::vertex_buffer_t gpu_state[2];
+        OpenGL::program_t update_program;
+        OpenGL::attrib_handle_t state_attribs[4];
+
+        uint64_t update_count = 0;
+        std::vector<uint64_t> dies_at;
+        std::multiset<uint64_t> deaths;
+
+        void update_worker(int start, int end);
         void create_program();
+
+        int spawn_on_gpu(int num);
+        void resize_on_gpu(int num);
+        void update_on_gpu();
 };
 
 
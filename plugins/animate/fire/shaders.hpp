@@ -8,9 +8,14 @@ R"(
 attribute mediump float radius;
 attribute mediump vec2 position;
 attribute mediump vec2 center;
+attribute mediump vec2 speed;
 attribute mediump vec4 color;
 
 uniform mat4 matrix;
+uniform mediump float color_scale;
+/* How far the particles move from their last position, by the part of the
+ * next update which has elapsed */
+uniform mediump float extrapolate;
 
 varying mediump vec2 uv;
 varying mediump vec4 out_color;
@@ -18,10 +23,11 @@ varying mediump float R;
 
 void main() {
     uv = position * radius;
-    gl_Position = matrix * vec4(center.x + uv.x * 0.75, center.y + uv.y, 0.0, 1.0);
+    vec2 pos = center + speed * extrapolate;
+    gl_Position = matrix * vec4(pos.x + uv.x * 0.75, pos.y + uv.y, 0.0, 1.0);
 
     R = radius;
-    out_color = color;
+    out_color = color * color_scale;
 }
 )";
 
@@ -50,4 +56,64 @@ void main()
 }
 )";
 
+/* Updates the particles on the GPU, the inputs are read from one buffer and
+ * the outputs written to another one with transform feedback */
+static const char *particle_update_vert_source =
+R"(
+#version 300 es
+
+/* life, fade, base radius, radius */
+in highp vec4 state;
+/* position, speed */
+in highp vec4 motion;
+/* gravity, start x */
+in highp vec4 gravity;
+in highp vec4 color;
+
+out highp vec4 out_state;
+out highp vec4 out_motion;
+out highp vec4 out_gravity;
+out highp vec4 out_color;
+
+/* The same as MOVE_STEP, ACCEL_STEP and FADE_STEP in particle.cpp */
+const highp float move_step = 0.16;
+const highp float accel_step = 0.24;
+const highp float fade_step = 0.24;
+
+void main()
+{
+    out_state = state;
+    out_motion = motion;
+    out_gravity = gravity;
+    out_color = color;
+    if (state.x <= 0.0)
+        return;
+
+    highp float life = state.x - state.y * fade_step;
+    highp vec2 pos = motion.xy + motion.zw * move_step;
+
+    out_state.x = life;
+    out_state.w = state.z * sqrt(max(life, 0.0));
+    out_motion.zw = motion.zw + gravity.xy * accel_step;
+    out_gravity.x = gravity.z < pos.x ? -1.0 : 1.0;
+    out_color.a = color.a * life / state.x;
+
+    /* Dead particles are moved outside */
+    out_motion.xy = life <= 0.0 ? vec2(-10000.0, -10000.0) : pos;
+}
+)";
+
+static const char *particle_update_frag_source =
+R"(
+#version 300 es
+precision mediump float;
+
+out vec4 frag_color;
+
+void main()
+{
+    frag_color = vec4(0.0);
+}
+)";
+
 #endif /* end of include guard: PARTICLE_ANIMATION_SHADER */
@@ -14,21 +14,24 @@ class wf_system_fade
 
     wf::output_t *output;
 
-    wf::effect_hook_t damage_hook, render_hook;
+    wf::animation_hook_t damage_hook;
+    wf::effect_hook_t render_hook;
 
     public:
         wf_system_fade(wf::output_t *out, int dur) :
             progression(wf::create_option<int>(dur)), output(out)
         {
-            damage_hook = [=] ()
-            { output->render->damage_whole(); };
+            damage_hook = [=] (uint32_t, wf::region_t& damage)
+            {
+                damage |= output->get_relative_geometry();
+                return true;
+            };
 
             render_hook = [=] ()
             { render(); };
 
-            output->render->add_effect(&damage_hook, wf::OUTPUT_EFFECT_PRE);
+            output->render->add_animation(&damage_hook);
             output->render->add_effect(&render_hook, wf::OUTPUT_EFFECT_OVERLAY);
-            output->render->set_redraw_always();
             this->progression.animate(1, 0);
         }
 
@@ -49,9 +52,8 @@ class wf_system_fade
 
         void finish()
         {
-            output->render->rem_effect(&damage_hook);
+            output->render->rem_animation(&damage_hook);
             output->render->rem_effect(&render_hook);
-            output->render->set_redraw_always(false);
 
             delete this;
         }
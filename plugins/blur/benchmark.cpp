@@ -0,0 +1,403 @@
+#include "blur.hpp"
+#include "blur-benchmark-signal.hpp"
+#include <wayfire/output.hpp>
+#include <wayfire/util/log.hpp>
+
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+/**
+ * Sets an option of the blur plugin until it goes out of scope, when the
+ * value from the config is restored.
+ */
+class option_override_t
+{
+    std::shared_ptr<wf::config::option_base_t> option;
+    std::string saved;
+
+  public:
+    option_override_t(const std::string& name)
+    {
+        option = wf::get_core().config.get_option(name);
+        if (option)
+            saved = option->get_value_str();
+    }
+
+    ~option_override_t()
+    {
+        if (option)
+            option->set_value_str(saved);
+    }
+
+    void set(const std::string& value)
+    {
+        if (option)
+            option->set_value_str(value);
+    }
+};
+
+/**
+ * Measures the GPU time of the commands between begin() and end(), with
+ * GL_EXT_disjoint_timer_query if available, or else with glFinish() and the
+ * CPU clock.
+ */
+class gpu_timer_t
+{
+    PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_result = nullptr;
+    GLuint query = 0;
+    timespec cpu_start;
+
+    static int64_t nsec(const timespec& ts)
+    {
+        return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+    }
+
+  public:
+    /* Must be called with a current GL context */
+    gpu_timer_t()
+    {
+        auto ext = reinterpret_cast<const char*> (glGetString(GL_EXTENSIONS));
+        if (ext && std::string(ext).find("GL_EXT_disjoint_timer_query") !=
+            std::string::npos)
+        {
+            get_query_result = reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC> (
+                eglGetProcAddress("glGetQueryObjectui64vEXT"));
+        }
+
+        if (get_query_result)
+            GL_CALL(glGenQueries(1, &query));
+    }
+
+    void free_resources()
+    {
+        if (query)
+            GL_CALL(glDeleteQueries(1, &query));
+    }
+
+    bool uses_queries() const { return query != 0; }
+
+    void begin()
+    {
+        if (query)
+        {
+            /* Reset the disjoint flag */
+            GLint disjoint;
+            GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+            GL_CALL(glBeginQuery(GL_TIME_ELAPSED_EXT, query));
+        } else
+        {
+            GL_CALL(glFinish());
+            clock_gettime(CLOCK_MONOTONIC, &cpu_start);
+        }
+    }
+
+    /** @return The elapsed time in nanoseconds, or -1 if it is unknown */
+    int64_t end()
+    {
+        if (query)
+        {
+            GL_CALL(glEndQuery(GL_TIME_ELAPSED_EXT));
+            GLuint64 elapsed = 0;
+            get_query_result(query, GL_QUERY_RESULT_EXT, &elapsed);
+
+            GLint disjoint;
+            GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+            return disjoint ? -1 : (int64_t)elapsed;
+        }
+
+        GL_CALL(glFinish());
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return nsec(now) - nsec(cpu_start);
+    }
+};
+
+/* An RGBA image with float channels, rows from the bottom as in GL */
+struct image_t
+{
+    int width, height;
+    std::vector<float> pixels;
+
+    image_t(int width, int height) : width(width), height(height),
+        pixels(4 * width * height, 0.0) {}
+
+    float *at(int x, int y) { return &pixels[4 * (y * width + x)]; }
+};
+
+/* Colored squares crossed by thin lines, so that the blur has both low and
+ * high frequencies to smooth */
+image_t create_test_image(int width, int height)
+{
+    image_t image{width, height};
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float *px = image.at(x, y);
+            bool odd = ((x / 16) + (y / 16)) % 2;
+            bool line = (x % 37 == 0) || (y % 29 == 0);
+
+            px[0] = line ? 255 : (odd ? 230 : 20);
+            px[1] = line ? 255 : (255.0 * x / width);
+            px[2] = line ? 255 : (255.0 * y / height);
+            px[3] = 255;
+        }
+    }
+
+    return image;
+}
+
+/* Box blur of the given radius along rows or columns, with clamping at the
+ * edges */
+void box_blur_pass(image_t& image, int radius, bool horizontal)
+{
+    int lines  = horizontal ? image.height : image.width;
+    int length = horizontal ? image.width : image.height;
+    std::vector<float> line(4 * length);
+
+    auto pixel = [&] (int line_idx, int pos) {
+        pos = std::clamp(pos, 0, length - 1);
+        return horizontal ? image.at(pos, line_idx) : image.at(line_idx, pos);
+    };
+
+    for (int l = 0; l < lines; l++)
+    {
+        float sum[4] = {0, 0, 0, 0};
+        for (int i = -radius; i <= radius; i++)
+        {
+            for (int c = 0; c < 4; c++)
+                sum[c] += pixel(l, i)[c];
+        }
+
+        for (int i = 0; i < length; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                line[4 * i + c] = sum[c] / (2 * radius + 1);
+                sum[c] += pixel(l, i + radius + 1)[c] - pixel(l, i - radius)[c];
+            }
+        }
+
+        for (int i = 0; i < length; i++)
+            std::copy_n(&line[4 * i], 4, pixel(l, i));
+    }
+}
+
+/* A gaussian blur whose kernel reaches radius pixels (3 sigma), computed
+ * as three successive box blurs */
+image_t create_reference(image_t image, int radius)
+{
+    double sigma = radius / 3.0;
+    if (sigma < 0.5)
+        return image;
+
+    const int n = 3;
+    int lower = std::sqrt(12 * sigma * sigma / n + 1);
+    if (lower % 2 == 0)
+        --lower;
+
+    int upper = lower + 2;
+    int lower_count = std::round((12 * sigma * sigma - n * lower * lower -
+        4 * n * lower - 3 * n) / (-4 * lower - 4));
+
+    for (int i = 0; i < n; i++)
+    {
+        int size = i < lower_count ? lower : upper;
+        box_blur_pass(image, (size - 1) / 2, true);
+        box_blur_pass(image, (size - 1) / 2, false);
+    }
+
+    return image;
+}
+
+struct comparison_t
+{
+    double mean_abs_error = 0;
+    double psnr = INFINITY;
+};
+
+/* Compare the color channels, leaving out the borders of radius pixels,
+ * where the methods handle the edges differently */
+comparison_t compare(const std::vector<uint8_t>& result, image_t& reference,
+    int radius)
+{
+    int margin = radius;
+    if (2 * margin >= std::min(reference.width, reference.height))
+        margin = 0;
+
+    double abs_sum = 0, square_sum = 0;
+    int64_t samples = 0;
+    for (int y = margin; y < reference.height - margin; y++)
+    {
+        for (int x = margin; x < reference.width - margin; x++)
+        {
+            const uint8_t *px = &result[4 * (y * reference.width + x)];
+            float *ref = reference.at(x, y);
+            for (int c = 0; c < 3; c++)
+            {
+                double diff = px[c] - ref[c];
+                abs_sum += std::abs(diff);
+                square_sum += diff * diff;
+                ++samples;
+            }
+        }
+    }
+
+    comparison_t comparison;
+    if (samples == 0)
+        return comparison;
+
+    comparison.mean_abs_error = abs_sum / samples;
+    double mse = square_sum / samples;
+    if (mse > 0)
+        comparison.psnr = 10 * std::log10(255.0 * 255.0 / mse);
+
+    return comparison;
+}
+
+std::string format_double(double value)
+{
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+}
+
+std::string run_blur_benchmark(wf::output_t *output,
+    const blur_benchmark_signal& params)
+{
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3);
+
+    OpenGL::render_begin();
+    gpu_timer_t timer;
+    OpenGL::render_end();
+
+    report << "blur benchmark on " << output->to_string() << ", "
+           << (timer.uses_queries() ? "GPU time from timer queries" :
+        "time until glFinish()") << "\n";
+    report << std::setw(18) << "method" << std::setw(11) << "size"
+           << std::setw(8) << "offset" << std::setw(6) << "iter"
+           << std::setw(8) << "degrade" << std::setw(8) << "radius"
+           << std::setw(10) << "mean ms" << std::setw(10) << "min ms"
+           << std::setw(8) << "error" << std::setw(9) << "psnr dB" << "\n";
+
+    for (auto& size : params.sizes)
+    {
+        auto source = create_test_image(size.width, size.height);
+        std::vector<uint8_t> upload(source.pixels.begin(), source.pixels.end());
+
+        wf::framebuffer_t target;
+        target.geometry = {0, 0, size.width, size.height};
+
+        OpenGL::render_begin();
+        target.allocate(size.width, size.height);
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, target.tex));
+        GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.width, size.height,
+            GL_RGBA, GL_UNSIGNED_BYTE, upload.data()));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        OpenGL::render_end();
+
+        wlr_box box = {0, 0, size.width, size.height};
+        wf::region_t damage{box};
+        std::vector<uint8_t> result(4 * size.width * size.height);
+
+        for (auto& method : params.methods)
+        {
+            /* The compute variants use the options of their kernel */
+            std::string prefix = "blur/" + method.substr(0, method.find('_'));
+            option_override_t offset_opt{prefix + "_offset"};
+            option_override_t iterations_opt{prefix + "_iterations"};
+            option_override_t degrade_opt{prefix + "_degrade"};
+            auto algorithm = create_blur_from_name(output, method);
+
+            for (auto offset : params.offsets)
+            {
+                for (auto iterations : params.iterations)
+                {
+                    for (auto degrade : params.degrades)
+                    {
+                        offset_opt.set(format_double(offset));
+                        iterations_opt.set(std::to_string(iterations));
+                        degrade_opt.set(std::to_string(degrade));
+
+                        int radius = algorithm->calculate_blur_radius();
+                        wf_blur_backdrop_t backdrop;
+
+                        int64_t total = 0, best = -1;
+                        int measured = 0;
+                        /* The first run is a warm up */
+                        for (int i = 0; i <= std::max(params.repeat, 1); i++)
+                        {
+                            backdrop.valid.clear();
+                            OpenGL::render_begin();
+                            timer.begin();
+                            OpenGL::render_end();
+
+                            algorithm->pre_render(wf::texture_t{target.tex},
+                                box, damage, target, backdrop);
+
+                            OpenGL::render_begin();
+                            int64_t elapsed = timer.end();
+                            OpenGL::render_end();
+
+                            if ((i == 0) || (elapsed < 0))
+                                continue;
+
+                            total += elapsed;
+                            best = best < 0 ? elapsed : std::min(best, elapsed);
+                            ++measured;
+                        }
+
+                        OpenGL::render_begin();
+                        OpenGL::get_state_cache().bind_framebuffer(
+                            GL_READ_FRAMEBUFFER, backdrop.fb.fb);
+                        GL_CALL(glReadPixels(0, 0, size.width, size.height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, result.data()));
+                        OpenGL::render_end();
+
+                        auto reference = create_reference(source, radius);
+                        auto comparison = compare(result, reference, radius);
+
+                        std::string size_str = std::to_string(size.width) +
+                            "x" + std::to_string(size.height);
+                        report << std::setw(18) << method
+                               << std::setw(11) << size_str
+                               << std::setw(8) << format_double(offset)
+                               << std::setw(6) << iterations
+                               << std::setw(8) << degrade
+                               << std::setw(8) << radius;
+                        if (measured > 0)
+                        {
+                            report << std::setw(10) << total / measured / 1e6
+                                   << std::setw(10) << best / 1e6;
+                        } else
+                        {
+                            report << std::setw(10) << "-" << std::setw(10) << "-";
+                        }
+
+                        report << std::setw(8) << comparison.mean_abs_error
+                               << std::setw(9) << comparison.psnr << "\n";
+                    }
+                }
+            }
+        }
+
+        OpenGL::render_begin();
+        target.release();
+        OpenGL::render_end();
+    }
+
+    OpenGL::render_begin();
+    timer.free_resources();
+    OpenGL::render_end();
+
+    return report.str();
+}
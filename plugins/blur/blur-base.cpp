@@ -51,9 +51,13 @@ wf_blur_base::wf_blur_base(wf::output_t *output,
     this->offset_opt.set_callback(options_changed);
     this->degrade_opt.set_callback(options_changed);
     this->iterations_opt.set_callback(options_changed);
+    this->low_precision_opt.set_callback(options_changed);
 
     OpenGL::render_begin();
     blend_program.compile(blur_blend_vertex_shader, blur_blend_fragment_shader);
+    blend_position = blend_program.get_attrib("position");
+    blend_mvp = blend_program.get_uniform("mvp");
+    blend_bg_texture = blend_program.get_uniform("bg_texture");
     OpenGL::render_end();
 }
 
@@ -68,6 +72,12 @@ wf_blur_base::~wf_blur_base()
     OpenGL::render_end();
 }
 
+wf::framebuffer_format_t wf_blur_base::get_intermediate_format()
+{
+    return low_precision_opt ?
+        wf::FRAMEBUFFER_FORMAT_RGB565 : wf::FRAMEBUFFER_FORMAT_RGBA8;
+}
+
 int wf_blur_base::calculate_blur_radius()
 {
     return offset_opt * degrade_opt * iterations_opt;
@@ -75,15 +85,8 @@ int wf_blur_base::calculate_blur_radius()
 
 void wf_blur_base::damage_all_workspaces()
 {
-    auto wsize = output->workspace->get_workspace_grid_size();
-    for (int vx = 0; vx < wsize.width; vx++)
-    {
-        for (int vy = 0; vy < wsize.height; vy++)
-        {
-            output->render->damage(
-                output->render->get_ws_box({vx, vy}));
-        }
-    }
+    /* The other workspaces are damaged lazily, only when they are rendered */
+    output->render->damage_whole();
 }
 
 void wf_blur_base::render_iteration(wf::framebuffer_base_t& in,
@@ -121,8 +124,8 @@ wlr_box wf_blur_base::copy_region(wf::framebuffer_base_t& result,
     OpenGL::render_begin(source);
     result.allocate(rounded_width, rounded_height);
 
-    GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, source.fb));
-    GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, result.fb));
+    OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, source.fb);
+    OpenGL::get_state_cache().bind_framebuffer(GL_DRAW_FRAMEBUFFER, result.fb);
     GL_CALL(glBlitFramebuffer(
             subbox.x, source_box.height - subbox.y - subbox.height,
             subbox.x + subbox.width, source_box.height - subbox.y,
@@ -133,17 +136,61 @@ wlr_box wf_blur_base::copy_region(wf::framebuffer_base_t& result,
     return subbox;
 }
 
+void wf_blur_backdrop_t::invalidate(const wf::region_t& region, int radius)
+{
+    if (valid.empty())
+        return;
+
+    /* Blurred pixels depend on all pixels up to the radius around them */
+    auto outdated = region;
+    outdated.expand_edges(radius);
+    valid ^= outdated;
+}
+
+wf_blur_backdrop_t::~wf_blur_backdrop_t()
+{
+    OpenGL::render_begin();
+    fb.release();
+    OpenGL::render_end();
+}
+
 void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
-    const wf::region_t& damage, const wf::framebuffer_t& target_fb)
+    const wf::region_t& damage, const wf::framebuffer_t& target_fb,
+    wf_blur_backdrop_t& backdrop)
 {
+    if (backdrop.target_fb != target_fb.fb ||
+        backdrop.target_geometry != target_fb.geometry ||
+        backdrop.view_box != src_box)
+    {
+        backdrop.valid.clear();
+        backdrop.target_fb = target_fb.fb;
+        backdrop.target_geometry = target_fb.geometry;
+        backdrop.view_box = src_box;
+    }
+
+    wf::region_t missing = damage ^ backdrop.valid;
+    if (missing.empty())
+        return;
+
+    /* Blur the missing parts, together with the pixels they are blurred
+     * with */
+    int radius = calculate_blur_radius();
+    missing.expand_edges(radius);
+    wf::region_t blur_region = missing & damage;
+
+    /* The backdrop stays RGBA8, it is sampled at full resolution when the
+     * view is drawn */
+    fb[0].format = fb[1].format = get_intermediate_format();
+
     int degrade = degrade_opt;
-    auto damage_box = copy_region(fb[0], target_fb, damage);
+    auto damage_box = copy_region(fb[0], target_fb, blur_region);
     int scaled_width = std::max(1, damage_box.width / degrade);
     int scaled_height = std::max(1, damage_box.height / degrade);
 
     int r = blur_fb0(scaled_width, scaled_height);
 
-    /* Make sure the result is always fb[1], because that's what is used in render() */
+    /* Make sure the result is always fb[1], because that's what is copied
+     * to the backdrop */
     if (r != 0)
         std::swap(fb[0], fb[1]);
 
@@ -155,7 +202,7 @@ void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
         OpenGL::render_begin();
         fb[1].allocate(scaled_width, scaled_height);
         fb[1].bind();
-        GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, fb[0].fb));
+        OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, fb[0].fb);
         GL_CALL(glBlitFramebuffer(0, 0, rounded_width, rounded_height,
                 0, 0, scaled_width, scaled_height,
                 GL_COLOR_BUFFER_BIT, GL_LINEAR));
@@ -165,32 +212,53 @@ void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
 
     /* we subtract target_fb's position to so that
      * view box is relative to framebuffer */
-    auto view_box = target_fb.framebuffer_box_from_geometry_box(
-        src_box + wf::point_t{-target_fb.geometry.x, -target_fb.geometry.y});
+    auto view_geometry =
+        src_box + wf::point_t{-target_fb.geometry.x, -target_fb.geometry.y};
+    auto view_box = target_fb.framebuffer_box_from_geometry_box(view_geometry);
 
     OpenGL::render_begin();
-    fb[1].allocate(view_box.width, view_box.height);
-    fb[1].bind();
-    GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, fb[0].fb));
+    if (backdrop.fb.allocate(view_box.width, view_box.height))
+        backdrop.valid.clear();
+
+    backdrop.fb.bind();
+    OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, fb[0].fb);
 
-    /* Blit the blurred texture into an fb which has the size of the view,
-     * so that the view texture and the blurred background can be combined
-     * together in render()
+    /* Blit the blurred texture into the backdrop, which has the size of the
+     * view, so that the view texture and the blurred background can be
+     * combined together in render(). Only the blurred region is written,
+     * the rest of the backdrop may still be valid.
      *
      * local_geometry is damage_box relative to view box */
     wlr_box local_box = damage_box + wf::point_t{-view_box.x, -view_box.y};
-    GL_CALL(glBlitFramebuffer(0, 0, scaled_width, scaled_height,
-            local_box.x,
-            view_box.height - local_box.y - local_box.height,
-            local_box.x + local_box.width,
-            view_box.height - local_box.y,
-            GL_COLOR_BUFFER_BIT, GL_LINEAR));
+    for (const auto& rect : blur_region)
+    {
+        auto box = target_fb.framebuffer_box_from_damage_box(
+            wlr_box_from_pixman_box(rect));
+        backdrop.fb.scissor(box + wf::point_t{-view_box.x, -view_box.y});
+
+        GL_CALL(glBlitFramebuffer(0, 0, scaled_width, scaled_height,
+                local_box.x,
+                view_box.height - local_box.y - local_box.height,
+                local_box.x + local_box.width,
+                view_box.height - local_box.y,
+                GL_COLOR_BUFFER_BIT, GL_LINEAR));
+    }
+
+    OpenGL::get_state_cache().set_scissor_test(false);
     GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
     OpenGL::render_end();
+
+    /* The pixels which were blurred only with pixels from the blurred region
+     * are up to date */
+    wf::region_t view_region{target_fb.damage_box_from_geometry_box(view_geometry)};
+    auto outdated = view_region ^ blur_region;
+    outdated.expand_edges(radius);
+    backdrop.valid |= view_region ^ outdated;
 }
 
 void wf_blur_base::render(wf::texture_t src_tex, wlr_box src_box,
-    wlr_box scissor_box, const wf::framebuffer_t& target_fb)
+    wlr_box scissor_box, const wf::framebuffer_t& target_fb,
+    wf_blur_backdrop_t& backdrop)
 {
     wlr_box fb_geom = target_fb.framebuffer_box_from_geometry_box(target_fb.geometry);
     auto view_box = target_fb.framebuffer_box_from_geometry_box(src_box);
@@ -208,20 +276,21 @@ void wf_blur_base::render(wf::texture_t src_tex, wlr_box src_box,
         -1.0f,  1.0f
     };
 
-    blend_program.attrib_pointer("position", 2, 0, vertexData);
+    blend_program.attrib_pointer(blend_position, 2, 0, vertexData);
 
     /* Blend blurred background with window texture src_tex */
-    blend_program.uniformMatrix4f("mvp", glm::inverse(target_fb.transform));
+    blend_program.uniformMatrix4f(blend_mvp, glm::inverse(target_fb.transform));
     /* XXX: core should give us the number of texture units used */
-    blend_program.uniform1i("bg_texture", 1);
+    blend_program.uniform1i(blend_bg_texture, 1);
 
     blend_program.set_active_texture(src_tex);
-    GL_CALL(glActiveTexture(GL_TEXTURE0 + 1));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, fb[1].tex));
+    OpenGL::get_state_cache().active_texture(GL_TEXTURE0 + 1);
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, backdrop.fb.tex));
     /* Render it to target_fb */
     target_fb.bind();
-    GL_CALL(glViewport(view_box.x, fb_geom.height - view_box.y - view_box.height,
-            view_box.width, view_box.height));
+    OpenGL::get_state_cache().viewport(view_box.x,
+        fb_geom.height - view_box.y - view_box.height,
+        view_box.width, view_box.height);
     target_fb.scissor(scissor_box);
 
     GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
@@ -229,7 +298,7 @@ void wf_blur_base::render(wf::texture_t src_tex, wlr_box src_box,
     /* Disable stuff */
     /* GL_CALL(glActiveTexture(GL_TEXTURE0 + 1)); */
     GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    OpenGL::get_state_cache().active_texture(GL_TEXTURE0);
     GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
     blend_program.deactivate();
     OpenGL::render_end();
@@ -246,6 +315,17 @@ std::unique_ptr<wf_blur_base> create_blur_from_name(wf::output_t *output,
         return create_kawase_blur(output);
     if (algorithm_name == "gaussian")
         return create_gaussian_blur(output);
+    if (algorithm_name == "dual")
+        return create_dual_blur(output);
+    if (algorithm_name == "box_compute" || algorithm_name == "gaussian_compute")
+    {
+        auto kernel = algorithm_name.substr(0, algorithm_name.find('_'));
+        if (auto blur = create_compute_blur(output, kernel))
+            return blur;
+
+        return kernel == "box" ? create_box_blur(output) :
+               create_gaussian_blur(output);
+    }
 
     LOGE ("Unrecognized blur algorithm %s. Using default kawase blur.",
         algorithm_name.c_str());
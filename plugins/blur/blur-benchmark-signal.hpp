@@ -0,0 +1,30 @@
+#ifndef BLUR_BENCHMARK_SIGNAL
+#define BLUR_BENCHMARK_SIGNAL
+
+#include <string>
+#include <vector>
+#include <wayfire/object.hpp>
+#include <wayfire/geometry.hpp>
+
+/* A private signal, currently shared by bench & blur
+ *
+ * It is emitted on an output to measure the blur methods. The blur plugin of
+ * the output blurs a test image with each combination of the parameters, and
+ * writes the GPU time and the difference to a reference gaussian blur of the
+ * same radius to the report.
+ */
+struct blur_benchmark_signal : public wf::signal_data_t
+{
+    std::vector<std::string> methods;
+    std::vector<wf::dimensions_t> sizes;
+    std::vector<double> offsets;
+    std::vector<int> iterations;
+    std::vector<int> degrades;
+    /* How many times each combination is measured */
+    int repeat = 10;
+
+    bool carried_out = false; // false if blur is disabled
+    std::string report;
+};
+
+#endif /* end of include guard: BLUR_BENCHMARK_SIGNAL */
@@ -7,18 +7,55 @@
 #include <wayfire/signal-definitions.hpp>
 
 #include "blur.hpp"
+#include "blur-benchmark-signal.hpp"
+#include <algorithm>
+#include <unordered_map>
 
 using blur_algorithm_provider = std::function<nonstd::observer_ptr<wf_blur_base>()>;
 class wf_blur_transformer : public wf::view_transformer_t
 {
     blur_algorithm_provider provider;
+    std::function<void()> update_backdrops;
     wf::output_t *output;
+    wf::view_interface_t *view;
   public:
+    /* The blurred background of the view */
+    wf_blur_backdrop_t backdrop;
+
+    /**
+     * @param update_backdrops Called before rendering, to invalidate the
+     *   backdrops of views behind which damage happened.
+     */
     wf_blur_transformer(blur_algorithm_provider blur_algorithm_provider,
-        wf::output_t *output)
+        std::function<void()> update_backdrops, wf::output_t *output,
+        wf::view_interface_t *view)
     {
         provider = blur_algorithm_provider;
+        this->update_backdrops = update_backdrops;
         this->output = output;
+        this->view = view;
+    }
+
+    /**
+     * @return The part of src_box which is blurred. This is the whole box,
+     *   unless the client of the view has set a blur region.
+     */
+    wf::region_t get_blur_region(wlr_box src_box)
+    {
+        auto hint = view->get_data<wf::blur_region_hint_t>();
+        if (!hint || hint->whole_view)
+            return src_box;
+
+        /* The region is relative to the main surface, which has the same
+         * offset in src_box as in the untransformed bounding box */
+        auto surface = view->get_output_geometry();
+        auto bbox = view->get_untransformed_bounding_box();
+        wf::point_t offset = {
+            src_box.x + surface.x - bbox.x,
+            src_box.y + surface.y - bbox.y,
+        };
+
+        return (hint->region + offset) & src_box;
     }
 
     wf::pointf_t transform_point(wf::geometry_t view,
@@ -55,14 +92,48 @@ class wf_blur_transformer : public wf::view_transformer_t
         box = target_fb.damage_box_from_geometry_box(box);
         wf::region_t clip_damage = damage & box;
 
-        provider()->pre_render(src_tex, src_box, clip_damage, target_fb);
-        wf::view_transformer_t::render_with_damage(src_tex, src_box, clip_damage, target_fb);
+        wf::region_t blur_damage;
+        for (const auto& rect : get_blur_region(src_box))
+        {
+            auto blurred = wlr_box_from_pixman_box(rect);
+            blurred.x -= target_fb.geometry.x;
+            blurred.y -= target_fb.geometry.y;
+            blur_damage |= target_fb.damage_box_from_geometry_box(blurred);
+        }
+
+        blur_damage &= clip_damage;
+
+        update_backdrops();
+        if (!blur_damage.empty())
+        {
+            provider()->pre_render(src_tex, src_box, blur_damage, target_fb,
+                backdrop);
+        }
+
+        wf::view_transformer_t::render_with_damage(src_tex, src_box, blur_damage, target_fb);
+
+        /* Outside of the blur region, the view is rendered as it is */
+        wf::region_t plain_damage = clip_damage ^ blur_damage;
+        if (plain_damage.empty())
+            return;
+
+        float x = src_box.x, y = src_box.y, w = src_box.width, h = src_box.height;
+        OpenGL::render_begin(target_fb);
+        for (const auto& rect : plain_damage)
+        {
+            target_fb.scissor(target_fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+            OpenGL::render_transformed_texture(src_tex, {x, y, x + w, y + h},
+                {}, target_fb.get_orthographic_projection());
+        }
+
+        OpenGL::render_end();
     }
 
     void render_box(wf::texture_t src_tex, wlr_box src_box, wlr_box scissor_box,
         const wf::framebuffer_t& target_fb) override
     {
-        provider()->render(src_tex, src_box, scissor_box, target_fb);
+        provider()->render(src_tex, src_box, scissor_box, target_fb, backdrop);
     }
 };
 
@@ -72,7 +143,7 @@ class wayfire_blur : public wf::plugin_interface_t
 
     wf::effect_hook_t frame_pre_paint;
     wf::signal_callback_t workspace_stream_pre, workspace_stream_post,
-        view_attached, view_detached;
+        view_attached, view_detached, view_damaged, benchmark;
 
     const std::string normal_mode = "normal";
     std::string last_mode;
@@ -88,6 +159,148 @@ class wayfire_blur : public wf::plugin_interface_t
     wf::framebuffer_base_t saved_pixels;
     wf::region_t padded_region;
 
+    /* The damage of each view since the backdrops were last updated */
+    std::unordered_map<wf::view_interface_t*, wf::region_t> view_damage;
+    /* All views of the output, from top to bottom */
+    std::vector<wayfire_view> stacking;
+
+    /**
+     * Invalidate the parts of the backdrops of blurred views which are
+     * affected by the damage of views behind them.
+     *
+     * @param unattributed Damage which doesn't come from any view, and is
+     *   considered to be behind all views.
+     */
+    void invalidate_backdrops(wf::region_t unattributed)
+    {
+        if (view_damage.empty() && unattributed.empty())
+            return;
+
+        stacking.clear();
+        output->workspace->for_each_view(wf::ALL_LAYERS, [&] (wayfire_view view)
+        {
+            view->for_each_view([&] (wayfire_view child)
+            {
+                stacking.push_back(child);
+            });
+        });
+
+        /* Damage of views which aren't in the layers, for ex. views in their
+         * unmap animation, is considered to be behind all views */
+        for (auto& [view, damage] : view_damage)
+        {
+            if (std::find(stacking.begin(), stacking.end(),
+                nonstd::make_observer(view)) == stacking.end())
+            {
+                unattributed |= damage;
+            }
+        }
+
+        int radius = blur_algorithm->calculate_blur_radius();
+        wf::region_t behind = unattributed;
+        for (auto it = stacking.rbegin(); it != stacking.rend(); ++it)
+        {
+            auto view = *it;
+            auto transformer = dynamic_cast<wf_blur_transformer*> (
+                view->get_transformer(transformer_name).get());
+            if (transformer)
+                transformer->backdrop.invalidate(behind, radius);
+
+            auto damage = view_damage.find(view.get());
+            if (damage != view_damage.end())
+                behind |= damage->second;
+        }
+
+        view_damage.clear();
+    }
+
+    /** @return The region expanded by padding in each direction */
+    static wf::region_t pad_region(const wf::region_t& region, int padding)
+    {
+        wf::region_t padded;
+        for (const auto& rect : region)
+        {
+            padded |= wlr_box{
+                rect.x1 - padding,
+                rect.y1 - padding,
+                (rect.x2 - rect.x1) + 2 * padding,
+                (rect.y2 - rect.y1) + 2 * padding
+            };
+        }
+
+        return padded;
+    }
+
+    /**
+     * @return The blurred parts of the views expanded by radius, in the
+     *   damage coordinates of target_fb. Damage outside of it doesn't
+     *   reach the background of any blurred view, so it doesn't need padding.
+     */
+    wf::region_t get_blurred_region(const wf::framebuffer_t& target_fb,
+        int radius)
+    {
+        auto screen = output->get_screen_size();
+        auto grid = output->workspace->get_workspace_grid_size();
+        auto cws  = output->workspace->get_current_workspace();
+
+        wf::region_t blurred;
+        auto add_region = [&] (const wf::region_t& region)
+        {
+            for (const auto& rect : region)
+            {
+                auto box = wlr_box_from_pixman_box(rect);
+                box.x -= target_fb.geometry.x;
+                box.y -= target_fb.geometry.y;
+                blurred |= target_fb.damage_box_from_geometry_box(box);
+            }
+        };
+
+        output->workspace->for_each_view(wf::ALL_LAYERS, [&] (wayfire_view view)
+        {
+            view->for_each_view([&] (wayfire_view child)
+            {
+                auto transformer = dynamic_cast<wf_blur_transformer*> (
+                    child->get_transformer(transformer_name).get());
+                if (!transformer)
+                    return;
+
+                auto region =
+                    transformer->get_blur_region(child->get_bounding_box());
+                if (child->role != wf::VIEW_ROLE_DESKTOP_ENVIRONMENT)
+                    return add_region(region);
+
+                /* Shell views are visible on all workspaces */
+                for (int i = 0; i < grid.width; i++)
+                {
+                    for (int j = 0; j < grid.height; j++)
+                    {
+                        add_region(region + wf::point_t{
+                            (i - cws.x) * screen.width,
+                            (j - cws.y) * screen.height});
+                    }
+                }
+            });
+        });
+
+        return pad_region(blurred, radius);
+    }
+
+    /** @return The damage expanded by padding near blurred views */
+    wf::region_t pad_damage(const wf::region_t& damage,
+        const wf::framebuffer_t& target_fb, int padding)
+    {
+        auto blurred = get_blurred_region(target_fb, padding);
+        wf::region_t padded = damage;
+        for (const auto& rect : damage)
+        {
+            auto box = wlr_box_from_pixman_box(rect);
+            if (!(blurred & box).empty())
+                padded |= pad_region(box, padding);
+        }
+
+        return padded;
+    }
+
     void add_transformer(wayfire_view view)
     {
         if (view->get_transformer(transformer_name))
@@ -95,7 +308,8 @@ class wayfire_blur : public wf::plugin_interface_t
 
         view->add_transformer(std::make_unique<wf_blur_transformer> (
                 [=] () {return nonstd::make_observer(blur_algorithm.get()); },
-                output),
+                [=] () { invalidate_backdrops({}); },
+                output, view.get()),
             transformer_name);
     }
 
@@ -204,8 +418,23 @@ class wayfire_blur : public wf::plugin_interface_t
         output->connect_signal("map-view", &view_attached);
         output->connect_signal("detach-view", &view_detached);
 
+        view_damaged = [=] (wf::signal_data_t *data)
+        {
+            auto ev = static_cast<view_damaged_signal*> (data);
+            view_damage[ev->view.get()] |= *ev->region;
+        };
+        output->connect_signal("view-damaged", &view_damaged);
+
+        benchmark = [=] (wf::signal_data_t *data)
+        {
+            auto ev = static_cast<blur_benchmark_signal*> (data);
+            ev->report = run_blur_benchmark(output, *ev);
+            ev->carried_out = true;
+        };
+        output->connect_signal("blur-benchmark", &benchmark);
+
         /* frame_pre_paint is called before each frame has started.
-         * It expands the damage by the blur radius.
+         * It expands the damage near blurred views by the blur radius.
          * This is needed, because when blurring, the pixels that changed
          * affect a larger area than the really damaged region, e.g the region
          * that comes from client damage */
@@ -215,16 +444,17 @@ class wayfire_blur : public wf::plugin_interface_t
             wf::surface_interface_t::set_opaque_shrink_constraint("blur",
                 padding);
 
+            /* Damage which no view reported, for ex. when a plugin damages
+             * the whole output, may be behind any view */
             auto damage = output->render->get_scheduled_damage();
-            for (const auto& rect : damage)
-            {
-                output->render->damage(wlr_box{
-                        rect.x1 - padding,
-                        rect.y1 - padding,
-                        (rect.x2 - rect.x1) + 2 * padding,
-                        (rect.y2 - rect.y1) + 2 * padding
-                });
-            }
+            wf::region_t unattributed = damage;
+            for (auto& [view, view_region] : view_damage)
+                unattributed ^= view_region;
+
+            invalidate_backdrops(unattributed);
+
+            auto target_fb = output->render->get_target_framebuffer();
+            output->render->damage(pad_damage(damage, target_fb, padding));
         };
         output->render->add_effect(&frame_pre_paint, wf::OUTPUT_EFFECT_PRE);
 
@@ -244,22 +474,15 @@ class wayfire_blur : public wf::plugin_interface_t
              * be no visual artifacts. */
             int padding = blur_algorithm->calculate_blur_radius();
 
-            wf::region_t expanded_damage;
-            for (const auto& rect : damage)
-            {
-                expanded_damage |= {
-                    rect.x1 - padding,
-                    rect.y1 - padding,
-                    (rect.x2 - rect.x1) + 2 * padding,
-                    (rect.y2 - rect.y1) + 2 * padding
-                };
-            }
+            wf::region_t expanded_damage = pad_damage(damage, target_fb, padding);
 
             /* Keep rects on screen */
             expanded_damage &= output->render->get_damage_box();
 
             /* Compute padded region and store result in padded_region. */
             padded_region = expanded_damage ^ damage;
+            if (padded_region.empty())
+                return;
 
             OpenGL::render_begin(target_fb);
             /* Initialize a place to store padded region pixels. */
@@ -270,7 +493,7 @@ class wayfire_blur : public wf::plugin_interface_t
              * from last frame at this point. We are writing them
              * to saved_pixels, bound as GL_DRAW_FRAMEBUFFER */
             saved_pixels.bind();
-            GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, target_fb.fb));
+            OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, target_fb.fb);
 
             /* Copy pixels in padded_region from target_fb to saved_pixels. */
             for (const auto& rect : padded_region)
@@ -300,13 +523,16 @@ class wayfire_blur : public wf::plugin_interface_t
          * workspace_stream_pre. */
         workspace_stream_post = [=] (wf::signal_data_t *data)
         {
+            if (padded_region.empty())
+                return;
+
             const auto& target_fb = static_cast<wf::stream_signal_t*>(data)->fb;
             OpenGL::render_begin(target_fb);
             /* Setup framebuffer I/O. target_fb contains the frame
              * rendered with expanded damage and artifacts on the edges.
              * saved_pixels has the the padded region of pixels to overwrite the
              * artifacts that blurring has left behind. */
-            GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, saved_pixels.fb));
+            OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, saved_pixels.fb);
 
             /* Copy pixels back from saved_pixels to target_fb. */
             for (const auto& rect : padded_region)
@@ -338,6 +564,8 @@ class wayfire_blur : public wf::plugin_interface_t
         output->disconnect_signal("attach-view", &view_attached);
         output->disconnect_signal("map-view", &view_attached);
         output->disconnect_signal("detach-view", &view_detached);
+        output->disconnect_signal("view-damaged", &view_damaged);
+        output->disconnect_signal("blur-benchmark", &benchmark);
         output->render->rem_effect(&frame_pre_paint);
         output->render->disconnect_signal("workspace-stream-pre", &workspace_stream_pre);
         output->render->disconnect_signal("workspace-stream-post", &workspace_stream_post);
@@ -90,6 +90,37 @@ struct wf_blur_default_option_values
     std::string offset, degrade, iterations;
 };
 
+/**
+ * The blurred background of a view, kept between frames, so that it isn't
+ * blurred again when only the view itself changes, for ex. the text of a
+ * terminal over a static wallpaper.
+ */
+struct wf_blur_backdrop_t
+{
+    /* The blurred background, with the size of the view on the target */
+    wf::framebuffer_base_t fb;
+    /* The parts of fb which are up to date, in the damage coordinates of
+     * the target framebuffer */
+    wf::region_t valid;
+
+    /* The target framebuffer and view geometry valid was computed for */
+    uint32_t target_fb = 0;
+    wf::geometry_t target_geometry = {0, 0, 0, 0};
+    wlr_box view_box = {0, 0, 0, 0};
+
+    /**
+     * Mark the parts of the backdrop which depend on the pixels in region
+     * as outdated.
+     *
+     * @param region The changed part of the scene behind the view, in the
+     *   damage coordinates of the output's target framebuffer.
+     * @param radius The blur radius.
+     */
+    void invalidate(const wf::region_t& region, int radius);
+
+    ~wf_blur_backdrop_t();
+};
+
 class wf_blur_base
 {
     protected:
@@ -101,6 +132,8 @@ class wf_blur_base
     /* the program used by wf_blur_base to combine the blurred, unblurred and
      * view texture */
     OpenGL::program_t blend_program;
+    OpenGL::attrib_handle_t blend_position;
+    OpenGL::uniform_handle_t blend_mvp, blend_bg_texture;
 
     /* used to get individual algorithm options from config
      * should be set by the constructor */
@@ -108,8 +141,12 @@ class wf_blur_base
 
     wf::option_wrapper_t<double> offset_opt;
     wf::option_wrapper_t<int> degrade_opt, iterations_opt;
+    wf::option_wrapper_t<bool> low_precision_opt{"blur/low_precision"};
     wf::config::option_base_t::updated_callback_t options_changed;
 
+    /* the format of the intermediate buffers, depending on blur/low_precision */
+    wf::framebuffer_format_t get_intermediate_format();
+
     wf::output_t *output;
 
     /* renders the in texture to the out framebuffer.
@@ -135,17 +172,34 @@ class wf_blur_base
     virtual int calculate_blur_radius();
     void damage_all_workspaces();
 
+    /* blur the parts of the background of the view in damage which aren't
+     * valid in the backdrop yet, storing them in the backdrop */
     virtual void pre_render(wf::texture_t src_tex, wlr_box src_box,
-        const wf::region_t& damage, const wf::framebuffer_t& target_fb);
+        const wf::region_t& damage, const wf::framebuffer_t& target_fb,
+        wf_blur_backdrop_t& backdrop);
 
     virtual void render(wf::texture_t src_tex, wlr_box src_box,
-        wlr_box scissor_box, const wf::framebuffer_t& target_fb);
+        wlr_box scissor_box, const wf::framebuffer_t& target_fb,
+        wf_blur_backdrop_t& backdrop);
 };
 
 std::unique_ptr<wf_blur_base> create_box_blur(wf::output_t *output);
 std::unique_ptr<wf_blur_base> create_bokeh_blur(wf::output_t *output);
 std::unique_ptr<wf_blur_base> create_kawase_blur(wf::output_t *output);
 std::unique_ptr<wf_blur_base> create_gaussian_blur(wf::output_t *output);
+std::unique_ptr<wf_blur_base> create_dual_blur(wf::output_t *output);
+
+/* Box or gaussian blur (kernel is "box" or "gaussian") with compute shaders,
+ * using the options of the corresponding method.
+ * Returns nullptr if compute shaders are not available. */
+std::unique_ptr<wf_blur_base> create_compute_blur(wf::output_t *output,
+    const std::string& kernel);
 
 std::unique_ptr<wf_blur_base> create_blur_from_name(wf::output_t *output,
     std::string algorithm_name);
+
+struct blur_benchmark_signal;
+/* Measure the blur methods with the parameters from the signal, see
+ * blur-benchmark-signal.hpp. Returns the report. */
+std::string run_blur_benchmark(wf::output_t *output,
+    const blur_benchmark_signal& params);
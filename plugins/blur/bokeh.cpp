@@ -93,12 +93,12 @@ class wf_bokeh_blur : public wf_blur_base
         program[0].uniform1i("iterations", iterations);
 
         program[0].attrib_pointer("position", 2, 0, vertexData);
-        GL_CALL(glDisable(GL_BLEND));
+        OpenGL::get_state_cache().set_blend(false);
         render_iteration(fb[0], fb[1], width, height);
 
         /* Reset gl state */
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        OpenGL::get_state_cache().set_blend(true);
+        OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
         program[0].deactivate();
         GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
@@ -123,7 +123,7 @@ class wf_box_blur : public wf_blur_base
         int i, iterations = iterations_opt;
 
         OpenGL::render_begin();
-        GL_CALL(glDisable(GL_BLEND));
+        OpenGL::get_state_cache().set_blend(false);
         /* Enable our shader and pass some data to it. The shader
          * does box blur on the background texture in two passes,
          * one horizontal and one vertical */
@@ -139,8 +139,8 @@ class wf_box_blur : public wf_blur_base
         }
 
         /* Reset gl state */
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        OpenGL::get_state_cache().set_blend(true);
+        OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
         program[0].deactivate();
         GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
@@ -0,0 +1,294 @@
+#include "blur.hpp"
+#include <config.h>
+#include <wayfire/util/log.hpp>
+
+#ifdef USE_GLES32
+#include <GLES3/gl32.h>
+#include <algorithm>
+#include <cstdio>
+
+/* Separable box and gaussian blur with compute shaders.
+ *
+ * Each pass blurs along rows or columns. A work group handles a segment of
+ * one line: it loads the segment and the pixels up to the reach of the
+ * kernel around it into shared memory once, and then each invocation sums
+ * its taps from there, instead of fetching every tap from the texture. The
+ * results are written to an image, so no framebuffer is bound per pass. */
+static const char* compute_blur_shader = R"(
+#version 310 es
+precision mediump float;
+
+#define TILE 128
+/* 4 taps with the largest offset of the options */
+#define MAX_REACH 100
+
+layout(local_size_x = TILE, local_size_y = 1) in;
+
+uniform mediump sampler2D src;
+layout(rgba8, binding = 0) writeonly uniform mediump image2D dst;
+
+uniform int width;
+uniform int height;
+uniform int horizontal;
+uniform float offset;
+/* Scale from pixel to texture coordinates of src */
+uniform vec2 src_scale;
+
+@weights@
+
+shared vec4 tile[TILE + 2 * MAX_REACH];
+
+ivec2 line_coord(int pos)
+{
+    int line = int(gl_WorkGroupID.y);
+    return horizontal == 1 ? ivec2(pos, line) : ivec2(line, pos);
+}
+
+void main()
+{
+    int line_length = horizontal == 1 ? width : height;
+    int reach = min(int(ceil(4.0 * offset)), MAX_REACH);
+    int start = int(gl_WorkGroupID.x) * TILE - reach;
+
+    for (int i = int(gl_LocalInvocationID.x); i < TILE + 2 * reach; i += TILE)
+    {
+        vec2 coord = vec2(line_coord(clamp(start + i, 0, line_length - 1)));
+        tile[i] = textureLod(src, (coord + 0.5) * src_scale, 0.0);
+    }
+
+    barrier();
+
+    int x = int(gl_LocalInvocationID.x);
+    int pos = int(gl_WorkGroupID.x) * TILE + x;
+    if (pos >= line_length)
+        return;
+
+    int center = x + reach;
+    vec4 sum = tile[center] * weights[0];
+    for (int k = 1; k < 5; k++)
+    {
+        /* Taps between pixels are interpolated, like with linear filtering */
+        float d = float(k) * offset;
+        int i0 = int(floor(d));
+        int i1 = min(i0 + 1, reach);
+        float f = d - float(i0);
+
+        sum += mix(tile[center + i0], tile[center + i1], f) * weights[k];
+        sum += mix(tile[center - i0], tile[center - i1], f) * weights[k];
+    }
+
+    imageStore(dst, line_coord(pos), sum);
+})";
+
+static const char* box_weights =
+    "const float weights[5] = float[5](1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0, "
+    "1.0 / 9.0, 1.0 / 9.0);";
+static const char* gaussian_weights =
+    "const float weights[5] = float[5](0.2270270270, 0.1945945946, "
+    "0.1216216216, 0.0540540541, 0.0162162162);";
+
+static const int COMPUTE_TILE = 128;
+
+static const wf_blur_default_option_values compute_box_defaults = {
+    .algorithm_name = "box",
+    .offset = "2",
+    .degrade = "1",
+    .iterations = "2"
+};
+
+static const wf_blur_default_option_values compute_gaussian_defaults = {
+    .algorithm_name = "gaussian",
+    .offset = "2",
+    .degrade = "1",
+    .iterations = "2"
+};
+
+/** @return Whether the current context is GLES 3.1 or newer */
+static bool compute_shaders_supported()
+{
+    auto version = reinterpret_cast<const char*> (glGetString(GL_VERSION));
+    int major = 0, minor = 0;
+    if (!version || (sscanf(version, "OpenGL ES %d.%d", &major, &minor) != 2))
+        return false;
+
+    return major > 3 || (major == 3 && minor >= 1);
+}
+
+/**
+ * A texture which compute shaders can write to. Such textures have to be
+ * immutable, so they are recreated instead of resized, and only when they
+ * are too small for the blurred region.
+ */
+struct storage_image_t
+{
+    GLuint tex = 0, fb = 0;
+    int width = 0, height = 0;
+
+    void reserve(int w, int h)
+    {
+        if (tex && w <= width && h <= height)
+            return;
+
+        w = std::max(w, width);
+        h = std::max(h, height);
+        release();
+
+        GL_CALL(glGenTextures(1, &tex));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+        GL_CALL(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+
+        GL_CALL(glGenFramebuffers(1, &fb));
+        OpenGL::get_state_cache().bind_framebuffer(GL_FRAMEBUFFER, fb);
+        GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_TEXTURE_2D, tex, 0));
+        OpenGL::get_state_cache().bind_framebuffer(GL_FRAMEBUFFER, 0);
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+
+        width = w;
+        height = h;
+    }
+
+    void release()
+    {
+        if (!tex)
+            return;
+
+        GL_CALL(glDeleteFramebuffers(1, &fb));
+        GL_CALL(glDeleteTextures(1, &tex));
+        tex = fb = 0;
+        width = height = 0;
+    }
+};
+
+class wf_compute_blur : public wf_blur_base
+{
+    storage_image_t images[2];
+
+  public:
+    wf_compute_blur(wf::output_t *output,
+        const wf_blur_default_option_values& defaults, std::string weights)
+        : wf_blur_base(output, defaults)
+    {
+        std::string source = compute_blur_shader;
+        source.replace(source.find("@weights@"), 9, weights);
+
+        OpenGL::render_begin();
+        auto shader = OpenGL::compile_shader(source, GL_COMPUTE_SHADER);
+        auto id = GL_CALL(glCreateProgram());
+        GL_CALL(glAttachShader(id, shader));
+        GL_CALL(glLinkProgram(id));
+        GL_CALL(glDeleteShader(shader));
+        program[0].set_simple(id);
+        OpenGL::render_end();
+    }
+
+    ~wf_compute_blur()
+    {
+        OpenGL::render_begin();
+        images[0].release();
+        images[1].release();
+        OpenGL::render_end();
+    }
+
+    /* Blur src into images[dst] along rows or columns */
+    void dispatch(GLuint src, float src_width, float src_height, int dst,
+        int width, int height, bool horizontal)
+    {
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, src));
+        GL_CALL(glBindImageTexture(0, images[dst].tex, 0, GL_FALSE, 0,
+            GL_WRITE_ONLY, GL_RGBA8));
+
+        program[0].uniform1i("horizontal", horizontal);
+        program[0].uniform2f("src_scale", 1.0f / src_width, 1.0f / src_height);
+
+        int length = horizontal ? width : height;
+        int lines  = horizontal ? height : width;
+        GL_CALL(glDispatchCompute(
+            (length + COMPUTE_TILE - 1) / COMPUTE_TILE, lines, 1));
+        GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+            GL_FRAMEBUFFER_BARRIER_BIT));
+    }
+
+    int blur_fb0(int width, int height) override
+    {
+        int iterations = iterations_opt;
+        if (iterations <= 0)
+            return 0;
+
+        OpenGL::render_begin();
+        images[0].reserve(width, height);
+        images[1].reserve(width, height);
+
+        program[0].use(wf::TEXTURE_TYPE_RGBA);
+        program[0].uniform1i("src", 0);
+        program[0].uniform1i("width", width);
+        program[0].uniform1i("height", height);
+        program[0].uniform1f("offset", offset_opt);
+        OpenGL::get_state_cache().active_texture(GL_TEXTURE0);
+
+        /* The first pass also scales fb[0] down by the degrade factor */
+        dispatch(fb[0].tex, width, height, 0, width, height, true);
+        int current = 0;
+        for (int i = 0; i < 2 * iterations - 1; i++)
+        {
+            auto& src = images[current];
+            dispatch(src.tex, src.width, src.height, !current, width, height,
+                i % 2 == 1);
+            current = !current;
+        }
+
+        GL_CALL(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+            GL_RGBA8));
+        program[0].deactivate();
+
+        /* The blurred region is copied out of the image, because the rest
+         * of the blur plugin works with framebuffers */
+        fb[1].allocate(width, height);
+        OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER,
+            images[current].fb);
+        OpenGL::get_state_cache().bind_framebuffer(GL_DRAW_FRAMEBUFFER, fb[1].fb);
+        GL_CALL(glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST));
+
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        OpenGL::render_end();
+
+        return 1;
+    }
+
+    int calculate_blur_radius() override
+    {
+        return 4 * wf_blur_base::calculate_blur_radius();
+    }
+};
+#endif
+
+std::unique_ptr<wf_blur_base> create_compute_blur(wf::output_t *output,
+    const std::string& kernel)
+{
+#ifdef USE_GLES32
+    OpenGL::render_begin();
+    bool supported = compute_shaders_supported();
+    OpenGL::render_end();
+
+    if (supported)
+    {
+        if (kernel == "gaussian")
+        {
+            return std::make_unique<wf_compute_blur> (output,
+                compute_gaussian_defaults, gaussian_weights);
+        }
+
+        return std::make_unique<wf_compute_blur> (output,
+            compute_box_defaults, box_weights);
+    }
+#endif
+
+    LOGE("Compute shaders are not available, using the ", kernel,
+        " blur with fragment shaders instead.");
+    return nullptr;
+}
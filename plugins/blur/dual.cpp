@@ -0,0 +1,190 @@
+#include "blur.hpp"
+#include <vector>
+
+/* Dual filter blur: the image is downsampled to half of its size on each
+ * iteration, and then upsampled back level by level. Each level samples
+ * four times fewer pixels than the previous one, so large radii are cheap
+ * compared to running all iterations at the same resolution. */
+static const char* dual_vertex_shader = R"(
+#version 100
+attribute mediump vec2 position;
+
+varying mediump vec2 uv;
+
+void main() {
+    gl_Position = vec4(position.xy, 0.0, 1.0);
+    uv = (position.xy + vec2(1.0, 1.0)) / 2.0;
+})";
+
+static const char* dual_fragment_shader_down = R"(
+#version 100
+precision mediump float;
+
+uniform float offset;
+uniform vec2 halfpixel;
+uniform sampler2D bg_texture;
+
+varying mediump vec2 uv;
+
+void main()
+{
+    vec4 sum = texture2D(bg_texture, uv) * 4.0;
+    sum += texture2D(bg_texture, uv - halfpixel.xy * offset);
+    sum += texture2D(bg_texture, uv + halfpixel.xy * offset);
+    sum += texture2D(bg_texture, uv + vec2(halfpixel.x, -halfpixel.y) * offset);
+    sum += texture2D(bg_texture, uv - vec2(halfpixel.x, -halfpixel.y) * offset);
+    gl_FragColor = sum / 8.0;
+})";
+
+static const char* dual_fragment_shader_up = R"(
+#version 100
+precision mediump float;
+
+uniform float offset;
+uniform vec2 halfpixel;
+uniform sampler2D bg_texture;
+
+varying mediump vec2 uv;
+
+void main()
+{
+    vec4 sum = texture2D(bg_texture, uv + vec2(-halfpixel.x * 2.0, 0.0) * offset);
+    sum += texture2D(bg_texture, uv + vec2(-halfpixel.x, halfpixel.y) * offset) * 2.0;
+    sum += texture2D(bg_texture, uv + vec2(0.0, halfpixel.y * 2.0) * offset);
+    sum += texture2D(bg_texture, uv + vec2(halfpixel.x, halfpixel.y) * offset) * 2.0;
+    sum += texture2D(bg_texture, uv + vec2(halfpixel.x * 2.0, 0.0) * offset);
+    sum += texture2D(bg_texture, uv + vec2(halfpixel.x, -halfpixel.y) * offset) * 2.0;
+    sum += texture2D(bg_texture, uv + vec2(0.0, -halfpixel.y * 2.0) * offset);
+    sum += texture2D(bg_texture, uv + vec2(-halfpixel.x, -halfpixel.y) * offset) * 2.0;
+    gl_FragColor = sum / 12.0;
+})";
+
+static const wf_blur_default_option_values dual_defaults = {
+    .algorithm_name = "dual",
+    .offset = "3",
+    .degrade = "1",
+    .iterations = "3"
+};
+
+class wf_dual_blur : public wf_blur_base
+{
+    OpenGL::attrib_handle_t position[2];
+    OpenGL::uniform_handle_t offset_uniform[2], halfpixel[2];
+
+    /* The downsampled levels, pyramid[i] has 1 / 2^(i + 1) of the size of
+     * fb[0]. They are kept between frames, so they are reallocated only
+     * when the size of the blurred region changes. */
+    std::vector<wf::framebuffer_base_t> pyramid;
+
+  public:
+    wf_dual_blur(wf::output_t *output)
+        : wf_blur_base(output, dual_defaults)
+    {
+        OpenGL::render_begin();
+        program[0].set_simple(OpenGL::compile_program(dual_vertex_shader,
+            dual_fragment_shader_down));
+        program[1].set_simple(OpenGL::compile_program(dual_vertex_shader,
+            dual_fragment_shader_up));
+
+        for (int i = 0; i < 2; i++)
+        {
+            position[i] = program[i].get_attrib("position");
+            offset_uniform[i] = program[i].get_uniform("offset");
+            halfpixel[i] = program[i].get_uniform("halfpixel");
+        }
+
+        OpenGL::render_end();
+    }
+
+    ~wf_dual_blur()
+    {
+        OpenGL::render_begin();
+        for (auto& level : pyramid)
+            level.release();
+        OpenGL::render_end();
+    }
+
+    int blur_fb0(int width, int height) override
+    {
+        int iterations = iterations_opt;
+        if (iterations <= 0)
+            return 0;
+
+        float offset = offset_opt;
+
+        /* Levels which are no longer used go back to the pool */
+        OpenGL::render_begin();
+        while ((int)pyramid.size() > iterations)
+        {
+            pyramid.back().release();
+            pyramid.pop_back();
+        }
+
+        pyramid.resize(iterations);
+        for (auto& level : pyramid)
+            level.format = fb[0].format;
+
+        auto level_width = [=] (int level) {
+            return std::max(1, width >> level);
+        };
+        auto level_height = [=] (int level) {
+            return std::max(1, height >> level);
+        };
+
+        /* Upload data to shader */
+        static const float vertexData[] = {
+            -1.0f, -1.0f,
+             1.0f, -1.0f,
+             1.0f,  1.0f,
+            -1.0f,  1.0f
+        };
+
+        /* Disable blending, because we may have transparent background, which
+         * we want to render on uncleared framebuffer */
+        OpenGL::get_state_cache().set_blend(false);
+
+        /* Downsample fb[0] into each level of the pyramid */
+        program[0].use(wf::TEXTURE_TYPE_RGBA);
+        program[0].attrib_pointer(position[0], 2, 0, vertexData);
+        program[0].uniform1f(offset_uniform[0], offset);
+        for (int i = 0; i < iterations; i++)
+        {
+            int w = level_width(i + 1), h = level_height(i + 1);
+            program[0].uniform2f(halfpixel[0], 0.5f / w, 0.5f / h);
+            render_iteration(i == 0 ? fb[0] : pyramid[i - 1], pyramid[i], w, h);
+        }
+
+        program[0].deactivate();
+
+        /* Upsample back to the size of fb[0], the result is in fb[1] */
+        program[1].use(wf::TEXTURE_TYPE_RGBA);
+        program[1].attrib_pointer(position[1], 2, 0, vertexData);
+        program[1].uniform1f(offset_uniform[1], offset);
+        for (int i = iterations - 1; i >= 0; i--)
+        {
+            int w = level_width(i), h = level_height(i);
+            program[1].uniform2f(halfpixel[1], 0.5f / w, 0.5f / h);
+            render_iteration(pyramid[i], i == 0 ? fb[1] : pyramid[i - 1], w, h);
+        }
+
+        /* Reset gl state */
+        OpenGL::get_state_cache().set_blend(true);
+        OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+        program[1].deactivate();
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        OpenGL::render_end();
+
+        return 1;
+    }
+
+    int calculate_blur_radius() override
+    {
+        return pow(2, iterations_opt + 1) * offset_opt * degrade_opt;
+    }
+};
+
+std::unique_ptr<wf_blur_base> create_dual_blur(wf::output_t *output)
+{
+    return std::make_unique<wf_dual_blur> (output);
+}
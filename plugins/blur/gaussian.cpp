@@ -126,7 +126,7 @@ class wf_gaussian_blur : public wf_blur_base
         int i, iterations = iterations_opt;
 
         OpenGL::render_begin();
-        GL_CALL(glDisable(GL_BLEND));
+        OpenGL::get_state_cache().set_blend(false);
         /* Enable our shader and pass some data to it. The shader
          * does gaussian blur on the background texture in two passes,
          * one horizontal and one vertical */
@@ -142,8 +142,8 @@ class wf_gaussian_blur : public wf_blur_base
         }
 
         /* Reset gl state */
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        OpenGL::get_state_cache().set_blend(true);
+        OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
         GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
         program[1].deactivate();
@@ -63,6 +63,9 @@ static const wf_blur_default_option_values kawase_defaults = {
 
 class wf_kawase_blur : public wf_blur_base
 {
+    OpenGL::attrib_handle_t position[2];
+    OpenGL::uniform_handle_t offset_uniform[2], halfpixel[2];
+
   public:
     wf_kawase_blur(wf::output_t *output)
         : wf_blur_base(output, kawase_defaults)
@@ -72,6 +75,14 @@ class wf_kawase_blur : public wf_blur_base
             kawase_fragment_shader_down));
         program[1].set_simple(OpenGL::compile_program(kawase_vertex_shader,
             kawase_fragment_shader_down_up));
+
+        for (int i = 0; i < 2; i++)
+        {
+            position[i] = program[i].get_attrib("position");
+            offset_uniform[i] = program[i].get_uniform("offset");
+            halfpixel[i] = program[i].get_uniform("halfpixel");
+        }
+
         OpenGL::render_end();
     }
 
@@ -93,18 +104,18 @@ class wf_kawase_blur : public wf_blur_base
         program[0].use(wf::TEXTURE_TYPE_RGBA);
 
         /* Downsample */
-        program[0].attrib_pointer("position", 2, 0, vertexData);
+        program[0].attrib_pointer(position[0], 2, 0, vertexData);
         /* Disable blending, because we may have transparent background, which
          * we want to render on uncleared framebuffer */
-        GL_CALL(glDisable(GL_BLEND));
-        program[0].uniform1f("offset", offset);
+        OpenGL::get_state_cache().set_blend(false);
+        program[0].uniform1f(offset_uniform[0], offset);
 
         for (int i = 0; i < iterations; i++)
         {
             sampleWidth = width / (1 << i);
             sampleHeight = height / (1 << i);
 
-            program[0].uniform2f("halfpixel",
+            program[0].uniform2f(halfpixel[0],
                 0.5f / sampleWidth, 0.5f / sampleHeight);
             render_iteration(fb[i % 2], fb[1 - i % 2], sampleWidth, sampleHeight);
         }
@@ -113,21 +124,21 @@ class wf_kawase_blur : public wf_blur_base
 
         /* Upsample */
         program[1].use(wf::TEXTURE_TYPE_RGBA);
-        program[1].attrib_pointer("position", 2, 0, vertexData);
-        program[1].uniform1f("offset", offset);
+        program[1].attrib_pointer(position[1], 2, 0, vertexData);
+        program[1].uniform1f(offset_uniform[1], offset);
         for (int i = iterations - 1; i >= 0; i--)
         {
             sampleWidth = width / (1 << i);
             sampleHeight = height / (1 << i);
 
-            program[1].uniform2f("halfpixel",
+            program[1].uniform2f(halfpixel[1],
                 0.5f / sampleWidth, 0.5f / sampleHeight);
             render_iteration(fb[1 - i % 2], fb[i % 2], sampleWidth, sampleHeight);
         }
 
         /* Reset gl state */
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        OpenGL::get_state_cache().set_blend(true);
+        OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
         program[1].deactivate();
         GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
@@ -1,4 +1,7 @@
 #include <wayfire/geometry.hpp>
+#include <wayfire/opengl.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/region.hpp>
 #include <wayfire/render-manager.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/compositor-view.hpp>
@@ -126,4 +129,170 @@ class preview_indication_view_t : public wf::color_rect_view_t
             close();
     }
 };
+
+/**
+ * The same preview as preview_indication_view_t, but drawn on top of the
+ * output from an overlay hook with a render batch, instead of being a mapped
+ * view with its own surface, stacking and damage tracking.
+ *
+ * The overlay can be reused: it animates from wherever it currently is to
+ * each new target, and it is hidden at the end of an animation started with
+ * close set.
+ */
+class preview_indication_overlay_t
+{
+    wf::output_t *output;
+    wf::effect_hook_t overlay_hook;
+    wf::animation_hook_t animation_hook;
+
+    const wf::color_t base_color = {0.5, 0.5, 1, 0.5};
+    const wf::color_t base_border = {0.25, 0.25, 0.5, 0.8};
+    const int base_border_w = 3;
+
+    preview_indication_animation_t animation;
+    bool should_close = false;
+    bool shown = false;
+    bool animating = false;
+
+    /* The box drawn in the last frame, in output-local coordinates */
+    wf::geometry_t drawn_box = {0, 0, 0, 0};
+
+    /* A single white pixel, the quads are colored with their color */
+    wf::framebuffer_base_t white;
+    OpenGL::render_batch_t batch;
+
+  public:
+    preview_indication_overlay_t(wf::output_t *output)
+        : output(output), animation(wf::create_option<int>(200))
+    {
+        overlay_hook = [=] () { render(); };
+        animation_hook = [=] (uint32_t, wf::region_t& damage)
+        {
+            damage |= drawn_box;
+            drawn_box = animation;
+            damage |= drawn_box;
+
+            if (animation.running())
+                return true;
+
+            animating = false;
+            if (should_close)
+                hide_now();
+
+            return false;
+        };
+    }
+
+    ~preview_indication_overlay_t()
+    {
+        if (animating)
+            output->render->rem_animation(&animation_hook);
+
+        hide_now();
+        OpenGL::render_begin();
+        white.release();
+        OpenGL::render_end();
+    }
+
+    /**
+     * Animate the preview to the given target geometry and alpha.
+     *
+     * @param start The geometry to start from if the preview isn't shown yet.
+     * @param close Whether the preview should be hidden when the target is
+     *              reached.
+     */
+    void set_target_geometry(wf::geometry_t start, wf::geometry_t target,
+        float alpha, bool close = false)
+    {
+        if (!shown)
+        {
+            shown = true;
+            animation.set_start(start);
+            animation.set_end(start);
+            animation.alpha.set(0, 0);
+            drawn_box = start;
+            output->render->add_effect(&overlay_hook, wf::OUTPUT_EFFECT_OVERLAY);
+        }
+
+        animation.x.restart_with_end(target.x);
+        animation.y.restart_with_end(target.y);
+        animation.width.restart_with_end(target.width);
+        animation.height.restart_with_end(target.height);
+        animation.alpha.restart_with_end(alpha);
+        animation.start();
+        should_close = close;
+
+        if (!animating)
+        {
+            animating = true;
+            output->render->add_animation(&animation_hook);
+        }
+    }
+
+    /** Animate to a single pixel at the given point, and hide the preview */
+    void hide(wf::point_t point)
+    {
+        if (shown)
+            set_target_geometry({0, 0, 0, 0}, {point.x, point.y, 1, 1}, 0, true);
+    }
+
+  private:
+    void hide_now()
+    {
+        if (!shown)
+            return;
+
+        output->render->rem_effect(&overlay_hook);
+        output->render->damage(drawn_box);
+        shown = false;
+    }
+
+    void render()
+    {
+        auto fb = output->render->get_target_framebuffer();
+        wf::region_t damage = output->render->get_swap_damage() &
+            fb.damage_box_from_geometry_box(drawn_box);
+        if (damage.empty())
+            return;
+
+        std::vector<wlr_box> boxes;
+        for (const auto& rect : damage)
+        {
+            boxes.push_back(
+                fb.framebuffer_box_from_damage_box(wlr_box_from_pixman_box(rect)));
+        }
+
+        double alpha = animation.alpha;
+        auto quad = [&] (wf::geometry_t box, wf::color_t color)
+        {
+            OpenGL::textured_quad_t q;
+            q.texture = wf::texture_t{white.tex};
+            q.geometry = {1.0f * box.x, 1.0f * box.y,
+                1.0f * box.x + box.width, 1.0f * box.y + box.height};
+            q.transform = fb.get_orthographic_projection();
+            q.color = glm::vec4(color.r, color.g, color.b, color.a * alpha);
+            batch.add(q);
+        };
+
+        OpenGL::render_begin(fb);
+        if (white.allocate(1, 1))
+        {
+            white.bind();
+            OpenGL::clear({1, 1, 1, 1});
+            fb.bind();
+        }
+
+        auto b = drawn_box;
+        int bw = std::min({base_border_w, b.width / 2, b.height / 2});
+        batch.set_scissor(fb, boxes);
+        quad({b.x + bw, b.y + bw, b.width - 2 * bw, b.height - 2 * bw},
+            base_color);
+        quad({b.x, b.y, b.width, bw}, base_border);
+        quad({b.x, b.y + b.height - bw, b.width, bw}, base_border);
+        quad({b.x, b.y + bw, bw, b.height - 2 * bw}, base_border);
+        quad({b.x + b.width - bw, b.y + bw, bw, b.height - 2 * bw}, base_border);
+        batch.flush();
+        OpenGL::render_end();
+    }
+};
 }
@@ -0,0 +1,163 @@
+#include "background-cache.hpp"
+#include <wayfire/img.hpp>
+#include <wayfire/util/log.hpp>
+#include <sys/stat.h>
+
+cube_background_cache_t& cube_background_cache_t::get()
+{
+    static cube_background_cache_t cache;
+    return cache;
+}
+
+static bool get_mtime(const std::string& path, timespec& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    mtime = st.st_mtim;
+    return true;
+}
+
+static void set_texture_params(GLenum target, bool mipmaps)
+{
+    if (mipmaps)
+    {
+        /* The background is usually drawn much smaller than the image, which
+         * aliases badly without mipmaps */
+        GL_CALL(glGenerateMipmap(target));
+        GL_CALL(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+    } else
+    {
+        GL_CALL(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    }
+
+    GL_CALL(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    if (target == GL_TEXTURE_CUBE_MAP)
+    {
+        GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    }
+}
+
+/* A dark gray pixel, shown until the image is loaded */
+static GLuint create_placeholder(GLenum target)
+{
+    const uint8_t pixel[] = {32, 32, 32, 255};
+
+    GLuint tex;
+    GL_CALL(glGenTextures(1, &tex));
+    GL_CALL(glBindTexture(target, tex));
+    int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+    for (int i = 0; i < faces; i++)
+    {
+        GLenum face = (target == GL_TEXTURE_CUBE_MAP) ?
+            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : target;
+        GL_CALL(glTexImage2D(face, 0, GL_RGBA, 1, 1, 0, GL_RGBA,
+            GL_UNSIGNED_BYTE, pixel));
+    }
+
+    set_texture_params(target, false);
+    GL_CALL(glBindTexture(target, 0));
+    return tex;
+}
+
+/**
+ * A texture which shows the placeholder until the image is decoded on the
+ * worker thread and uploaded, and then switches to the image. Dropping the
+ * last reference cancels the load.
+ */
+struct cube_background_cache_t::loading_texture_t
+{
+    GLuint tex;
+    GLenum target;
+    std::string path;
+
+    GLuint pending_tex = 0;
+    std::unique_ptr<image_io::async_decode_t> decode;
+    std::unique_ptr<image_io::chunked_upload_t> upload;
+
+    void on_decoded(std::shared_ptr<image_io::image_t> image)
+    {
+        decode.reset();
+        if (!image)
+        {
+            LOGE("cube: failed to load background image ", path);
+            return;
+        }
+
+        OpenGL::render_begin();
+        GL_CALL(glGenTextures(1, &pending_tex));
+        OpenGL::render_end();
+
+        upload = std::make_unique<image_io::chunked_upload_t>(image,
+            pending_tex, target, [=] () { on_uploaded(); });
+    }
+
+    void on_uploaded()
+    {
+        OpenGL::render_begin();
+        GL_CALL(glBindTexture(target, pending_tex));
+        set_texture_params(target, true);
+        GL_CALL(glBindTexture(target, 0));
+
+        GL_CALL(glDeleteTextures(1, &tex));
+        OpenGL::render_end();
+
+        tex = pending_tex;
+        pending_tex = 0;
+        upload.reset();
+    }
+
+    /* Must be called with a current GL context */
+    ~loading_texture_t()
+    {
+        decode.reset();
+        upload.reset();
+        GL_CALL(glDeleteTextures(1, &tex));
+        if (pending_tex)
+            GL_CALL(glDeleteTextures(1, &pending_tex));
+    }
+};
+
+std::shared_ptr<GLuint> cube_background_cache_t::get_texture(
+    const std::string& path, GLenum target)
+{
+    timespec mtime = {0, 0};
+    if (!get_mtime(path, mtime))
+        return nullptr;
+
+    auto key = std::make_pair(path, target);
+    auto it = textures.find(key);
+    if (it != textures.end())
+    {
+        auto texture = it->second.texture.lock();
+        if (texture && (it->second.mtime.tv_sec == mtime.tv_sec) &&
+            (it->second.mtime.tv_nsec == mtime.tv_nsec))
+        {
+            return texture;
+        }
+
+        /* The instances still using the old image keep it until they reload */
+        textures.erase(it);
+    }
+
+    auto loading = std::make_shared<loading_texture_t>();
+    loading->tex = create_placeholder(target);
+    loading->target = target;
+    loading->path = path;
+
+    auto raw = loading.get();
+    loading->decode = std::make_unique<image_io::async_decode_t>(path,
+        [raw] (std::shared_ptr<image_io::image_t> image)
+    {
+        raw->on_decoded(image);
+    });
+
+    /* The users see only the texture id, which is switched to the image
+     * once it is loaded */
+    std::shared_ptr<GLuint> texture{loading, &loading->tex};
+    textures[key] = {texture, mtime};
+    return texture;
+}
@@ -0,0 +1,55 @@
+#ifndef WF_CUBE_BACKGROUND_CACHE_HPP
+#define WF_CUBE_BACKGROUND_CACHE_HPP
+
+#include <wayfire/opengl.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <ctime>
+
+/**
+ * The background images are the same on all outputs, so the cube instances
+ * share their textures instead of decoding and uploading the images for
+ * each output, and again each time the background mode is switched back.
+ *
+ * A texture is deleted when the last instance using it drops it, so the
+ * textures must be acquired and dropped with a current GL context.
+ */
+class cube_background_cache_t
+{
+  public:
+    static cube_background_cache_t& get();
+
+    /**
+     * Get the texture with the image from the given file, loading it if it
+     * isn't in use yet or if the file was modified since it was loaded.
+     *
+     * @param target GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP for a cubemap with
+     *   the image on each face.
+     *
+     * The image is decoded on a worker thread and uploaded in parts, and
+     * until then the texture is a dark gray placeholder. The value of the
+     * texture id changes once the image is loaded, so it should be read
+     * again each time the texture is drawn. If the image turns out to be
+     * invalid, the placeholder stays.
+     *
+     * @return The texture, with mipmaps once loaded, or nullptr if the file
+     *   doesn't exist.
+     */
+    std::shared_ptr<GLuint> get_texture(const std::string& path, GLenum target);
+
+  private:
+    cube_background_cache_t() = default;
+
+    struct loading_texture_t;
+
+    struct entry_t
+    {
+        std::weak_ptr<GLuint> texture;
+        timespec mtime;
+    };
+
+    std::map<std::pair<std::string, GLenum>, entry_t> textures;
+};
+
+#endif /* end of include guard: WF_CUBE_BACKGROUND_CACHE_HPP */
@@ -6,6 +6,7 @@
 #include <wayfire/render-manager.hpp>
 #include <wayfire/workspace-manager.hpp>
 
+#include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <wayfire/img.hpp>
 
@@ -21,6 +22,10 @@
 #define ZOOM_MAX 10.0f
 #define ZOOM_MIN 0.1f
 
+/* Sides covering a small part of the output are rendered from streams with
+ * a lower resolution, down to this scale */
+#define MIN_STREAM_SCALE 0.25f
+
 #ifdef USE_GLES32
 #include <GLES3/gl32.h>
 #endif
@@ -32,12 +37,15 @@ class wayfire_cube : public wf::plugin_interface_t
 {
     wf::button_callback activate_binding;
     wf::activator_callback rotate_left, rotate_right;
-    wf::render_hook_t renderer;
+    wf::damage_render_hook_t renderer;
 
     /* Used to restore the pointer where the grab started */
     wf::pointf_t saved_pointer_position;
 
-    std::vector<wf::workspace_stream_t> streams;
+    /* Shared with other plugins showing the same workspaces */
+    std::vector<std::shared_ptr<wf::workspace_stream_t>> streams;
+    /* The scale of each stream, 0 for workspaces whose side isn't visible */
+    std::vector<float> stream_scales;
 
     wf::option_wrapper_t<double> XVelocity{"cube/speed_spin_horiz"}, YVelocity{"cube/speed_spin_vert"}, ZVelocity{"cube/speed_zoom"};
     wf::option_wrapper_t<double> zoom_opt{"cube/zoom"};
@@ -47,6 +55,18 @@ class wayfire_cube : public wf::plugin_interface_t
     float identity_z_offset;
 
     OpenGL::program_t program;
+    /* The quad of a single cube side, it never changes */
+    wf::vertex_buffer_t vertex_buffer, coord_buffer, index_buffer;
+    OpenGL::attrib_handle_t position_attrib, uv_attrib;
+    OpenGL::uniform_handle_t model_uniform, vp_uniform,
+        deform_uniform, light_uniform, ease_uniform,
+        tess_level_uniform, edge_tess_level_uniform;
+
+    /* With tessellation support, draws the sides as plain triangles while
+     * they are neither deformed nor lit */
+    OpenGL::program_t flat_program;
+    OpenGL::attrib_handle_t flat_position_attrib, flat_uv_attrib;
+    OpenGL::uniform_handle_t flat_model_uniform, flat_vp_uniform;
 
     wf_cube_animation_attribs animation;
     wf::option_wrapper_t<bool> use_light{"cube/light"};
@@ -98,8 +118,6 @@ class wayfire_cube : public wf::plugin_interface_t
 
         animation.cube_animation.start();
 
-        reload_background();
-
         activate_binding = [=] (uint32_t, int, int) {
             return input_grabbed();
         };
@@ -144,7 +162,17 @@ class wayfire_cube : public wf::plugin_interface_t
         animation.cube_animation.offset_z.set(identity_z_offset + Z_OFFSET_NEAR,
             identity_z_offset + Z_OFFSET_NEAR);
 
-        renderer = [=] (const wf::framebuffer_t& dest) {render(dest);};
+        renderer = [=] (const wf::framebuffer_t& dest, const wf::region_t& damage)
+        {
+            return render(dest, damage);
+        };
+    }
+
+    /* The shaders and the background textures are needed only while the
+     * cube is shown */
+    void init_resources() override
+    {
+        reload_background();
 
         OpenGL::render_begin(output->render->get_target_framebuffer());
         load_program();
@@ -183,7 +211,7 @@ class wayfire_cube : public wf::plugin_interface_t
             GL_CALL(glAttachShader(id, fss));
 
             GL_CALL(glLinkProgram(id));
-            GL_CALL(glUseProgram(id));
+            OpenGL::get_state_cache().use_program(id);
 
             GL_CALL(glDeleteShader(vss));
             GL_CALL(glDeleteShader(fss));
@@ -194,8 +222,50 @@ class wayfire_cube : public wf::plugin_interface_t
 #endif
         }
 
+        position_attrib = program.get_attrib("position");
+        uv_attrib = program.get_attrib("uvPosition");
+        model_uniform = program.get_uniform("model");
+        vp_uniform = program.get_uniform("VP");
+        deform_uniform = program.get_uniform("deform");
+        light_uniform = program.get_uniform("light");
+        ease_uniform = program.get_uniform("ease");
+        tess_level_uniform = program.get_uniform("tessLevel");
+        edge_tess_level_uniform = program.get_uniform("edgeTessLevel");
+
+        if (tessellation_support)
+        {
+            flat_program.set_simple(OpenGL::compile_program(
+                cube_vertex_2_0, cube_fragment_2_0));
+            flat_position_attrib = flat_program.get_attrib("position");
+            flat_uv_attrib = flat_program.get_attrib("uvPosition");
+            flat_model_uniform = flat_program.get_uniform("model");
+            flat_vp_uniform = flat_program.get_uniform("VP");
+        }
+
+        static const GLfloat vertex_data[] = {
+            -0.5,  0.5,
+            0.5,  0.5,
+            0.5, -0.5,
+            -0.5, -0.5
+        };
+
+        static const GLfloat coord_data[] = {
+            0.0f, 1.0f,
+            1.0f, 1.0f,
+            1.0f, 0.0f,
+            0.0f, 0.0f
+        };
+
+        static const GLuint index_data[] = { 0, 1, 2, 0, 2, 3 };
+
+        vertex_buffer.upload(vertex_data, sizeof(vertex_data));
+        coord_buffer.upload(coord_data, sizeof(coord_data));
+        index_buffer.upload(index_data, sizeof(index_data),
+            GL_ELEMENT_ARRAY_BUFFER);
+
         auto wsize = output->workspace->get_workspace_grid_size();
         streams.resize(wsize.width);
+        stream_scales.resize(wsize.width, 1.0);
         animation.projection = glm::perspective(45.0f, 1.f, 0.1f, 100.f);
     }
 
@@ -214,7 +284,8 @@ class wayfire_cube : public wf::plugin_interface_t
             return;
         }
 
-        if (!activate())
+        /* The frames are driven by the controlling plugin */
+        if (!activate(false))
             return;
 
         float offset_z = identity_z_offset + Z_OFFSET_NEAR;
@@ -228,11 +299,18 @@ class wayfire_cube : public wf::plugin_interface_t
 
         animation.cube_animation.start();
         update_view_matrix();
-        output->render->schedule_redraw();
+        output->render->damage_whole();
     }
 
-    /* Tries to initialize renderer, activate plugin, etc. */
-    bool activate()
+    /* Whether activate() enabled constant redrawing */
+    bool redraw_always = false;
+
+    /**
+     * Tries to initialize renderer, activate plugin, etc.
+     *
+     * @param constant_redraw Whether to redraw the output on each frame.
+     */
+    bool activate(bool constant_redraw = true)
     {
         if (output->is_plugin_active(grab_interface->name))
             return true;
@@ -240,8 +318,12 @@ class wayfire_cube : public wf::plugin_interface_t
         if (!output->activate_plugin(grab_interface))
             return false;
 
-        output->render->set_renderer(renderer);
-        output->render->set_redraw_always(true);
+        ensure_resources();
+        output->render->set_damage_renderer(renderer);
+        if (constant_redraw)
+            output->render->set_redraw_always(true);
+
+        redraw_always = constant_redraw;
         grab_interface->grab();
         return true;
     }
@@ -259,8 +341,10 @@ class wayfire_cube : public wf::plugin_interface_t
             return;
 
         output->render->set_renderer(nullptr);
-        output->render->set_redraw_always(false);
+        if (redraw_always)
+            output->render->set_redraw_always(false);
 
+        redraw_always = false;
         grab_interface->ungrab();
         output->deactivate_plugin(grab_interface);
 
@@ -276,8 +360,9 @@ class wayfire_cube : public wf::plugin_interface_t
          * it is properly reset */
         animation.cube_animation.rotation.set(0, 0);
 
+        /* Dropping the handles stops the streams */
         for (auto& stream : streams)
-            output->render->workspace_stream_stop(stream);
+            stream = nullptr;
     }
 
     /* Sets attributes target to such values that the cube effect isn't visible,
@@ -386,29 +471,122 @@ class wayfire_cube : public wf::plugin_interface_t
         animation.view = zoom_translate * rotation * view;
     }
 
-    void update_workspace_streams()
+    glm::mat4 calculate_zoom_matrix()
     {
-        auto cws = output->workspace->get_current_workspace();
-        for(size_t i = 0; i < streams.size(); i++)
+        float zoom_factor = animation.cube_animation.zoom;
+        return glm::scale(glm::mat4(1.0),
+            glm::vec3(1. / zoom_factor, 1. / zoom_factor, 1. / zoom_factor));
+    }
+
+    glm::mat4 calculate_vp_matrix(const wf::framebuffer_t& dest)
+    {
+        return dest.transform * animation.projection * animation.view *
+               calculate_zoom_matrix();
+    }
+
+    /**
+     * Calculate the scale of the stream needed for the i-th side of the cube.
+     *
+     * @param camera The position of the camera, in the coordinates of the
+     *   model matrices.
+     * @param inside Whether the camera is inside the cube.
+     * @param current The current scale of the stream.
+     * @return The scale, or 0 if the side isn't visible.
+     */
+    float calculate_stream_scale(int i, const glm::mat4& vp,
+        const glm::mat4& fb_transform, glm::vec3 camera, bool inside,
+        float current)
+    {
+        /* Deformed sides leave their plane */
+        if (tessellation_support && use_deform)
+            return 1.0;
+
+        auto base = calculate_model_matrix(i, glm::mat4(1.0));
+        auto center = glm::vec3(base * glm::vec4(0, 0, 0, 1));
+        auto normal = glm::vec3(base * glm::vec4(0, 0, 1, 0));
+
+        /* The cube has no top and bottom, so sides facing away from the
+         * camera can only be seen from inside, or from above or below */
+        bool facing = glm::dot(camera - center, normal) > 0;
+        if (!facing && !inside && std::abs(camera.y) <= 0.5)
+            return 0;
+
+        auto mvp = vp * calculate_model_matrix(i, fb_transform);
+        glm::vec2 min{1e9, 1e9}, max{-1e9, -1e9};
+        for (float x : {-0.5f, 0.5f})
         {
-            if (!streams[i].running)
-            {
-                streams[i].ws = {(int)i, cws.y};
-                output->render->workspace_stream_start(streams[i]);
-            } else
+            for (float y : {-0.5f, 0.5f})
             {
-                output->render->workspace_stream_update(streams[i]);
+                auto corner = mvp * glm::vec4(x, y, 0, 1);
+                /* The side crosses the plane of the camera */
+                if (corner.w <= 0)
+                    return 1.0;
+
+                glm::vec2 ndc = glm::vec2(corner) / corner.w;
+                min = glm::min(min, ndc);
+                max = glm::max(max, ndc);
             }
         }
+
+        if ((max.x < -1) || (min.x > 1) || (max.y < -1) || (min.y > 1))
+            return 0;
+
+        /* Changing the scale redraws the whole workspace, so going below the
+         * current scale needs some margin, to avoid switching back and forth
+         * when the side is near a threshold */
+        float extent = std::max(max.x - min.x, max.y - min.y) / 2;
+        float scale = 1.0;
+        while (scale / 2 >= MIN_STREAM_SCALE &&
+               extent * (scale / 2 < current ? 1.2 : 1.0) <= scale / 2)
+        {
+            scale /= 2;
+        }
+
+        return scale;
     }
 
-    glm::mat4 calculate_vp_matrix(const wf::framebuffer_t& dest)
+    /**
+     * Update the streams of the visible sides of the cube. Streams of hidden
+     * sides are dropped, they are restarted and fully redrawn when they
+     * become visible again.
+     */
+    void update_workspace_streams(const glm::mat4& vp,
+        const glm::mat4& fb_transform)
     {
-        float zoom_factor = animation.cube_animation.zoom;
-        auto scale_matrix = glm::scale(glm::mat4(1.0),
-            glm::vec3(1. / zoom_factor, 1. / zoom_factor, 1. / zoom_factor));
+        auto camera = glm::vec3(glm::inverse(animation.view *
+            calculate_zoom_matrix()) * glm::vec4(0, 0, 0, 1));
 
-        return dest.transform * animation.projection * animation.view * scale_matrix;
+        bool inside = true;
+        for (size_t i = 0; i < streams.size(); i++)
+        {
+            auto base = calculate_model_matrix(i, glm::mat4(1.0));
+            auto center = glm::vec3(base * glm::vec4(0, 0, 0, 1));
+            auto normal = glm::vec3(base * glm::vec4(0, 0, 1, 0));
+            inside &= glm::dot(camera - center, normal) <= 0;
+        }
+
+        auto cws = output->workspace->get_current_workspace();
+        for (size_t i = 0; i < streams.size(); i++)
+        {
+            int index = (cws.x + i) % streams.size();
+            float scale = calculate_stream_scale(i, vp, fb_transform,
+                camera, inside, stream_scales[index]);
+
+            if (scale != stream_scales[index])
+                streams[index] = nullptr;
+
+            stream_scales[index] = scale;
+            if (scale == 0)
+                continue;
+
+            if (!streams[index])
+            {
+                streams[index] = output->render->get_shared_workspace_stream(
+                    {index, cws.y}, scale, scale);
+            }
+
+            output->render->workspace_stream_update(*streams[index]);
+        }
     }
 
     /* Calculate the base model matrix for the i-th side of the cube */
@@ -422,44 +600,117 @@ class wayfire_cube : public wf::plugin_interface_t
         return rotation * translation * glm::inverse(fb_transform);
     }
 
+    /* On-screen pixels per segment of a tessellated side */
+    static constexpr float TESS_PIXELS_PER_SEGMENT = 16;
+
+    /** @return The highest tessellation level, which is used for the sides
+     * filling the screen */
+    float get_max_tess_level()
+    {
+        /* Lighting needs smaller triangles than deformation to look smooth */
+        return use_light ? 50 : 30;
+    }
+
+    /**
+     * Calculate the tessellation level of a side from the length of its
+     * longest edge on the screen, and how much it is deformed.
+     */
+    float calculate_tess_level(const glm::mat4& mvp,
+        const wf::framebuffer_t& dest)
+    {
+        const float max_level = get_max_tess_level();
+        glm::vec2 corners[4];
+        const glm::vec2 quad[4] = {{-0.5, 0.5}, {0.5, 0.5}, {0.5, -0.5},
+            {-0.5, -0.5}};
+        for (int i = 0; i < 4; i++)
+        {
+            auto clip = mvp * glm::vec4(quad[i], 0, 1);
+            /* Partly behind the camera, the projection is meaningless */
+            if (clip.w <= 0)
+                return max_level;
+
+            corners[i] = glm::vec2(clip) / clip.w;
+        }
+
+        float longest = 0;
+        glm::vec2 viewport{dest.viewport_width / 2.0, dest.viewport_height / 2.0};
+        for (int i = 0; i < 4; i++)
+        {
+            auto edge = (corners[(i + 1) % 4] - corners[i]) * viewport;
+            longest = std::max(longest, glm::length(edge));
+        }
+
+        float level = longest / TESS_PIXELS_PER_SEGMENT;
+        if (!use_light)
+        {
+            /* Only deformation bends the sides */
+            level *= wf::clamp(
+                (double)animation.cube_animation.ease_deformation, 0.0, 1.0);
+        }
+
+        return wf::clamp(level, 1.0f, max_level);
+    }
+
+    /**
+     * @return Whether the sides need the tessellated program, i.e they are
+     * deformed or lit
+     */
+    bool needs_tessellation()
+    {
+        return tessellation_support && (use_light ||
+            (use_deform && (animation.cube_animation.ease_deformation > 0)));
+    }
+
     /* Render the sides of the cube, using the given culling mode - cw or ccw */
-    void render_cube(GLuint front_face, glm::mat4 fb_transform)
+    void render_cube(GLuint front_face, const wf::framebuffer_t& dest,
+        const glm::mat4& vp, bool tessellate)
     {
+        auto fb_transform = dest.transform;
         GL_CALL(glFrontFace(front_face));
-        static const GLuint indexData[] = { 0, 1, 2, 0, 2, 3 };
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.buffer));
 
         auto cws = output->workspace->get_current_workspace();
         for(size_t i = 0; i < streams.size(); i++)
         {
             int index = (cws.x + i) % streams.size();
-            GL_CALL(glBindTexture(GL_TEXTURE_2D, streams[index].buffer.tex));
+            if (!streams[index])
+                continue;
 
-            auto model = calculate_model_matrix(i, fb_transform);
-            program.uniformMatrix4f("model", model);
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, streams[index]->buffer.tex));
 
-            if (tessellation_support) {
+            auto model = calculate_model_matrix(i, fb_transform);
+            if (tessellate) {
 #ifdef USE_GLES32
-                GL_CALL(glDrawElements(GL_PATCHES, 6, GL_UNSIGNED_INT, &indexData));
+                program.uniformMatrix4f(model_uniform, model);
+                program.uniform1f(tess_level_uniform,
+                    calculate_tess_level(vp * model, dest));
+                GL_CALL(glDrawElements(GL_PATCHES, 6, GL_UNSIGNED_INT, 0));
 #endif
             } else {
-                GL_CALL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, &indexData));
+                auto& flat = tessellation_support ? flat_program : program;
+                flat.uniformMatrix4f(tessellation_support ?
+                    flat_model_uniform : model_uniform, model);
+                GL_CALL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0));
             }
         }
+
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
     }
 
-    void render(const wf::framebuffer_t& dest)
+    /** @return The repainted region, see wf::damage_render_hook_t */
+    wf::region_t render(const wf::framebuffer_t& dest, const wf::region_t& damage)
     {
-        if (!animation.cube_animation.running() &&
-            output->render->get_scheduled_damage().empty())
+        if (!animation.cube_animation.running() && damage.empty())
         {
             /*
              * No workspace was updated, and no animation is running. We can skip
-             * repainting.
+             * repainting, the frame is dropped.
              */
-            return;
+            return {};
         }
 
-        update_workspace_streams();
+        auto vp = calculate_vp_matrix(dest);
+        update_workspace_streams(vp, dest.transform);
         if (program.get_program_id(wf::TEXTURE_TYPE_RGBA) == 0)
             load_program();
 
@@ -470,36 +721,35 @@ class wayfire_cube : public wf::plugin_interface_t
         reload_background();
         background->render_frame(dest, animation);
 
-        auto vp = calculate_vp_matrix(dest);
+        bool tessellate = needs_tessellation();
+        bool flat = tessellation_support && !tessellate;
+        auto& used_program = flat ? flat_program : program;
 
         OpenGL::render_begin(dest);
-        program.use(wf::TEXTURE_TYPE_RGBA);
+        used_program.use(wf::TEXTURE_TYPE_RGBA);
         GL_CALL(glEnable(GL_DEPTH_TEST));
         GL_CALL(glDepthFunc(GL_LESS));
 
-        static GLfloat vertexData[] = {
-            -0.5,  0.5,
-            0.5,  0.5,
-            0.5, -0.5,
-            -0.5, -0.5
-        };
-
-        static GLfloat coordData[] = {
-            0.0f, 1.0f,
-            1.0f, 1.0f,
-            1.0f, 0.0f,
-            0.0f, 0.0f
-        };
+        if (flat)
+        {
+            flat_program.attrib_buffer(flat_position_attrib, 2, 0,
+                vertex_buffer.at());
+            flat_program.attrib_buffer(flat_uv_attrib, 2, 0, coord_buffer.at());
+            flat_program.uniformMatrix4f(flat_vp_uniform, vp);
+        } else
+        {
+            program.attrib_buffer(position_attrib, 2, 0, vertex_buffer.at());
+            program.attrib_buffer(uv_attrib, 2, 0, coord_buffer.at());
+            program.uniformMatrix4f(vp_uniform, vp);
+        }
 
-        program.attrib_pointer("position", 2, 0, vertexData);
-        program.attrib_pointer("uvPosition", 2, 0, coordData);
-        program.uniformMatrix4f("VP", vp);
-        if (tessellation_support)
+        if (tessellate)
         {
-            program.uniform1i("deform", use_deform);
-            program.uniform1i("light", use_light);
-            program.uniform1f("ease",
+            program.uniform1i(deform_uniform, use_deform);
+            program.uniform1i(light_uniform, use_light);
+            program.uniform1f(ease_uniform,
                 animation.cube_animation.ease_deformation);
+            program.uniform1f(edge_tess_level_uniform, get_max_tess_level());
         }
 
         /* We render the cube in two stages, based on winding.
@@ -507,12 +757,12 @@ class wayfire_cube : public wf::plugin_interface_t
          * that are on the back, and then we render those at the front, so we
          * don't have to use depth testing and we also can support alpha cube. */
         GL_CALL(glEnable(GL_CULL_FACE));
-        render_cube(GL_CCW, dest.transform);
-        render_cube(GL_CW, dest.transform);
+        render_cube(GL_CCW, dest, vp, tessellate);
+        render_cube(GL_CW, dest, vp, tessellate);
         GL_CALL(glDisable(GL_CULL_FACE));
 
         GL_CALL(glDisable(GL_DEPTH_TEST));
-        program.deactivate();
+        used_program.deactivate();
         OpenGL::render_end();
 
         update_view_matrix();
@@ -521,6 +771,10 @@ class wayfire_cube : public wf::plugin_interface_t
 
         if (animation.in_exit && !animation.cube_animation.running())
             deactivate();
+
+        /* The faces are drawn in perspective, so any change may show
+         * anywhere on the output */
+        return output->render->get_damage_box();
     }
 
     void pointer_moved(wlr_event_pointer_motion* ev)
@@ -574,11 +828,14 @@ class wayfire_cube : public wf::plugin_interface_t
     {
         if (output->is_plugin_active(grab_interface->name))
             deactivate();
+        streams.clear();
 
         OpenGL::render_begin();
-        for (size_t i = 0; i < streams.size(); i++)
-            streams[i].buffer.release();
         program.free_resources();
+        flat_program.free_resources();
+        vertex_buffer.release();
+        coord_buffer.release();
+        index_buffer.release();
         OpenGL::render_end();
 
         output->rem_binding(&activate_binding);
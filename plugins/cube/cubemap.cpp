@@ -5,9 +5,9 @@
 #include <wayfire/debug.hpp>
 #include <config.h>
 #include <wayfire/core.hpp>
-#include <wayfire/img.hpp>
 
 #include "cubemap-shaders.tpp"
+#include "background-cache.hpp"
 
 wf_cube_background_cubemap::wf_cube_background_cubemap()
 {
@@ -19,14 +19,34 @@ wf_cube_background_cubemap::~wf_cube_background_cubemap()
 {
     OpenGL::render_begin();
     program.free_resources();
+    vertex_buffer.reset();
+    tex.reset();
     OpenGL::render_end();
 }
 
+#include "cubemap-vertex-data.hpp"
+
 void wf_cube_background_cubemap::create_program()
 {
     OpenGL::render_begin();
     program.set_simple(
         OpenGL::compile_program(cubemap_vertex, cubemap_fragment));
+
+    static std::weak_ptr<wf::vertex_buffer_t> shared_buffer;
+    vertex_buffer = shared_buffer.lock();
+    if (!vertex_buffer)
+    {
+        vertex_buffer = std::shared_ptr<wf::vertex_buffer_t>(
+            new wf::vertex_buffer_t, [] (wf::vertex_buffer_t *buffer)
+        {
+            buffer->release();
+            delete buffer;
+        });
+
+        vertex_buffer->upload(skyboxVertices, sizeof(skyboxVertices));
+        shared_buffer = vertex_buffer;
+    }
+
     OpenGL::render_end();
 }
 
@@ -38,57 +58,35 @@ void wf_cube_background_cubemap::reload_texture()
     last_background_image = background_image;
 
     OpenGL::render_begin();
-    if (tex == (uint32_t)-1)
-    {
-        GL_CALL(glGenTextures(1, &tex));
-    }
-
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, tex));
-    for (int i = 0; i < 6; i++)
-    {
-        if (!image_io::load_from_file(last_background_image, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i))
-        {
-            LOGE("Failed to load cubemap background image from \"%s\".",
-                last_background_image.c_str());
-
-            GL_CALL(glDeleteTextures(1, &tex));
-            tex = -1;
-            break;
-        }
-    }
+    tex = cube_background_cache_t::get().get_texture(last_background_image,
+        GL_TEXTURE_CUBE_MAP);
+    OpenGL::render_end();
 
-    if (tex != (uint32_t)-1)
+    if (!tex)
     {
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+        LOGE("Failed to load cubemap background image from \"%s\".",
+            last_background_image.c_str());
     }
-
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, 0));
-    OpenGL::render_end();
 }
 
-#include "cubemap-vertex-data.hpp"
-
 void wf_cube_background_cubemap::render_frame(const wf::framebuffer_t& fb,
     wf_cube_animation_attribs& attribs)
 {
     reload_texture();
 
     OpenGL::render_begin(fb);
-    if (tex == (uint32_t)-1)
+    if (!tex)
     {
         GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
         GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+        OpenGL::render_end();
         return;
     }
     program.use(wf::TEXTURE_TYPE_RGBA);
     GL_CALL(glDepthMask(GL_FALSE));
 
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, tex));
-    program.attrib_pointer("position", 3, 0, skyboxVertices);
+    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, *tex));
+    program.attrib_buffer("position", 3, 0, vertex_buffer->at());
 
     auto model = glm::rotate(glm::mat4(1.0),
         float(attribs.cube_animation.rotation * 0.7f),
@@ -2,6 +2,7 @@
 #define WF_CUBE_CUBEMAP_HPP
 
 #include "cube-background.hpp"
+#include <memory>
 
 class wf_cube_background_cubemap : public wf_cube_background_base
 {
@@ -17,7 +18,9 @@ class wf_cube_background_cubemap : public wf_cube_background_base
     void create_program();
 
     OpenGL::program_t program;
-    GLuint tex = -1;
+    /* Shared by the instances on all outputs */
+    std::shared_ptr<wf::vertex_buffer_t> vertex_buffer;
+    std::shared_ptr<GLuint> tex;
 
     std::string last_background_image;
     wf::option_wrapper_t<std::string> background_image{"cube/cubemap_image"};
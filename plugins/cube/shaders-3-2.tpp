@@ -23,28 +23,25 @@ out vec2 uv[];
 
 #define ID gl_InvocationID
 
-uniform int deform;
-uniform int light;
+/* The level for the side, from its size on the screen, and the level for the
+   vertical edges, which are shared with the neighbouring sides and must be
+   split the same way on both to avoid cracks */
+uniform float tessLevel;
+uniform float edgeTessLevel;
+
+float outerLevel(int a, int b) {
+    return vPos[a].x == vPos[b].x ? edgeTessLevel : tessLevel;
+}
 
 void main() {
     tcPosition[ID] = vPos[ID];
     uv[ID] = uvpos[ID];
 
     if(ID == 0){
-        /* deformation requires tesselation
-           and lighting even higher degree to
-           make lighting smoother */
-
-        float tessLevel = 1.0f;
-        if(deform > 0)
-            tessLevel = 30.0f;
-        if(light > 0)
-            tessLevel = 50.0f;
-
         gl_TessLevelInner[0] = tessLevel;
-        gl_TessLevelOuter[0] = tessLevel;
-        gl_TessLevelOuter[1] = tessLevel;
-        gl_TessLevelOuter[2] = tessLevel;
+        gl_TessLevelOuter[0] = outerLevel(1, 2);
+        gl_TessLevelOuter[1] = outerLevel(2, 0);
+        gl_TessLevelOuter[2] = outerLevel(0, 1);
     }
 })";
 
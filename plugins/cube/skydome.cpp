@@ -1,7 +1,6 @@
 #include "skydome.hpp"
 #include <wayfire/debug.hpp>
 #include <wayfire/core.hpp>
-#include <wayfire/img.hpp>
 
 #include <wayfire/output.hpp>
 #include <wayfire/workspace-manager.hpp>
@@ -9,6 +8,8 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 #include "shaders.tpp"
+#include "background-cache.hpp"
+#include <vector>
 
 #define SKYDOME_GRID_WIDTH 128
 #define SKYDOME_GRID_HEIGHT 128
@@ -23,7 +24,9 @@ wf_cube_background_skydome::wf_cube_background_skydome(wf::output_t *output)
 wf_cube_background_skydome::~wf_cube_background_skydome()
 {
     OpenGL::render_begin();
-    program.deactivate();
+    program.free_resources();
+    mesh.reset();
+    tex.reset();
     OpenGL::render_end();
 }
 
@@ -41,33 +44,29 @@ void wf_cube_background_skydome::reload_texture()
 
     last_background_image = background_image;
     OpenGL::render_begin();
+    tex = cube_background_cache_t::get().get_texture(last_background_image,
+        GL_TEXTURE_2D);
+    OpenGL::render_end();
 
-    if (tex == (uint32_t)-1)
-    {
-        GL_CALL(glGenTextures(1, &tex));
-    }
-
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
-
-    if (image_io::load_from_file(last_background_image, GL_TEXTURE_2D))
-    {
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    }
-    else
+    if (!tex)
     {
         LOGE("Failed to load skydome image from \"%s\".",
             last_background_image.c_str());
-        GL_CALL(glDeleteTextures(1, &tex));
-        tex = -1;
     }
+}
 
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+struct wf_cube_background_skydome::mesh_t
+{
+    wf::vertex_buffer_t vertex_buffer, coord_buffer, index_buffer;
 
-    OpenGL::render_end();
-}
+    /* Must be called with a current GL context */
+    ~mesh_t()
+    {
+        vertex_buffer.release();
+        coord_buffer.release();
+        index_buffer.release();
+    }
+};
 
 void wf_cube_background_skydome::fill_vertices()
 {
@@ -76,13 +75,21 @@ void wf_cube_background_skydome::fill_vertices()
 
     last_mirror = mirror_opt;
 
+    /* The meshes currently in use, for each value of mirror */
+    static std::weak_ptr<mesh_t> shared_meshes[2];
+    OpenGL::render_begin();
+    mesh = shared_meshes[last_mirror].lock();
+    OpenGL::render_end();
+    if (mesh)
+        return;
+
     float scale = 75.0;
     int gw = SKYDOME_GRID_WIDTH + 1;
     int gh = SKYDOME_GRID_HEIGHT;
 
-    vertices.clear();
-    indices.clear();
-    coords.clear();
+    std::vector<GLfloat> vertices;
+    std::vector<GLfloat> coords;
+    std::vector<GLuint> indices;
 
     for (int i = 1; i < gh; i++)
     {
@@ -121,6 +128,16 @@ void wf_cube_background_skydome::fill_vertices()
             indices.push_back((i - 1) * gw + j + gw + 1);
         }
     }
+
+    OpenGL::render_begin();
+    mesh = std::make_shared<mesh_t>();
+    mesh->vertex_buffer.upload(vertices.data(), vertices.size() * sizeof(GLfloat));
+    mesh->coord_buffer.upload(coords.data(), coords.size() * sizeof(GLfloat));
+    mesh->index_buffer.upload(indices.data(), indices.size() * sizeof(GLuint),
+        GL_ELEMENT_ARRAY_BUFFER);
+    OpenGL::render_end();
+
+    shared_meshes[last_mirror] = mesh;
 }
 
 void wf_cube_background_skydome::render_frame(const wf::framebuffer_t& fb,
@@ -129,7 +146,7 @@ void wf_cube_background_skydome::render_frame(const wf::framebuffer_t& fb,
     fill_vertices();
     reload_texture();
 
-    if (tex == (uint32_t)-1)
+    if (!tex)
     {
         GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
         GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
@@ -150,8 +167,8 @@ void wf_cube_background_skydome::render_frame(const wf::framebuffer_t& fb,
     auto vp = fb.transform * attribs.projection * view * rotation;
     program.uniformMatrix4f("VP", vp);
 
-    program.attrib_pointer("position", 3, 0, vertices.data());
-    program.attrib_pointer("uvPosition", 2, 0, coords.data());
+    program.attrib_buffer("position", 3, 0, mesh->vertex_buffer.at());
+    program.attrib_buffer("uvPosition", 2, 0, mesh->coord_buffer.at());
 
     auto cws = output->workspace->get_current_workspace();
     auto model = glm::rotate(glm::mat4(1.0),
@@ -160,12 +177,14 @@ void wf_cube_background_skydome::render_frame(const wf::framebuffer_t& fb,
 
     program.uniformMatrix4f("model", model);
 
-    GL_CALL(glActiveTexture(GL_TEXTURE0));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+    OpenGL::get_state_cache().active_texture(GL_TEXTURE0);
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, *tex));
 
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_buffer.buffer));
     GL_CALL(glDrawElements(GL_TRIANGLES,
             6 * SKYDOME_GRID_WIDTH * (SKYDOME_GRID_HEIGHT - 2),
-            GL_UNSIGNED_INT, indices.data()));
+            GL_UNSIGNED_INT, 0));
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 
     program.deactivate();
     OpenGL::render_end();
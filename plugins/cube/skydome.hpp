@@ -3,7 +3,7 @@
 
 #include "cube-background.hpp"
 #include "wayfire/output.hpp"
-#include <vector>
+#include <memory>
 
 class wf_cube_background_skydome : public wf_cube_background_base
 {
@@ -22,11 +22,12 @@ class wf_cube_background_skydome : public wf_cube_background_base
     void reload_texture();
 
     OpenGL::program_t program;
-    GLuint tex = -1;
+    std::shared_ptr<GLuint> tex;
 
-    std::vector<GLfloat> vertices;
-    std::vector<GLfloat> coords;
-    std::vector<GLuint> indices;
+    struct mesh_t;
+    /* The mesh doesn't depend on the output, so it is built once for all
+     * outputs, and again only if mirroring changes */
+    std::shared_ptr<mesh_t> mesh;
 
     std::string last_background_image;
     int last_mirror = -1;
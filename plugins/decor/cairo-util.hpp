@@ -28,18 +28,26 @@ static void cairo_surface_upload_to_texture(
 }
 
 /**
- * Render the given texture at the given geometry.
+ * Add the given texture at the given geometry to the batch.
+ *
+ * @param clip The boxes to clip the texture to, in the coordinates of the
+ *   quads, see OpenGL::render_batch_t::add_clipped().
+ * @param tex_width The part of the texture's width which is shown.
  */
-static void render_gl_texture(const wf::framebuffer_t& fb,
-    wf::geometry_t geometry, GLuint texture)
+static void render_gl_texture(OpenGL::render_batch_t& batch,
+    const wf::framebuffer_t& fb, wf::geometry_t geometry, GLuint texture,
+    const std::vector<gl_geometry>& clip, float tex_width = 1.0)
 {
-    gl_geometry gg;
-    gg.x1 = geometry.x + fb.geometry.x;
-    gg.y1 = geometry.y + fb.geometry.y;
-    gg.x2 = gg.x1 + geometry.width;
-    gg.y2 = gg.y1 + geometry.height;
+    OpenGL::textured_quad_t quad;
+    quad.texture = texture;
+    quad.geometry.x1 = geometry.x + fb.geometry.x;
+    quad.geometry.y1 = geometry.y + fb.geometry.y;
+    quad.geometry.x2 = quad.geometry.x1 + geometry.width;
+    quad.geometry.y2 = quad.geometry.y1 + geometry.height;
+    quad.tex_geometry.x2 = tex_width;
+    quad.transform = fb.get_orthographic_projection();
+    quad.bits = TEXTURE_TRANSFORM_INVERT_Y;
 
-    OpenGL::render_transformed_texture(texture, gg, {},
-        fb.get_orthographic_projection(), {1, 1, 1, 1},
-        TEXTURE_TRANSFORM_INVERT_Y);
+    for (auto& box : clip)
+        batch.add_clipped(quad, box);
 }
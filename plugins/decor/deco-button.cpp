@@ -16,6 +16,13 @@ button_t::button_t(const decoration_theme_t& t, std::function<void()> damage)
     : theme(t), damage_callback(damage)
 { }
 
+button_t::~button_t()
+{
+    OpenGL::render_begin();
+    button_texture.reset();
+    OpenGL::render_end();
+}
+
 void button_t::set_button_type(button_type_t type)
 {
     this->type = type;
@@ -60,24 +67,10 @@ void button_t::set_pressed(bool is_pressed)
 }
 
 void button_t::render(const wf::framebuffer_t& fb, wf::geometry_t geometry,
-    wf::geometry_t scissor)
+    OpenGL::render_batch_t& batch, const std::vector<gl_geometry>& clip)
 {
-    assert(this->button_texture != uint32_t(-1));
-
-    OpenGL::render_begin(fb);
-    fb.scissor(scissor);
-
-    gl_geometry gg;
-    gg.x1 = geometry.x + fb.geometry.x;
-    gg.y1 = geometry.y + fb.geometry.y;
-    gg.x2 = gg.x1 + geometry.width;
-    gg.y2 = gg.y1 + geometry.height;
-
-    OpenGL::render_transformed_texture(button_texture, gg, {},
-        fb.get_orthographic_projection(), {1, 1, 1, 1},
-        TEXTURE_TRANSFORM_INVERT_Y);
-
-    OpenGL::render_end();
+    assert(this->button_texture);
+    render_gl_texture(batch, fb, geometry, button_texture->tex, clip);
 
     if (this->hover.running())
         add_idle_damage();
@@ -98,9 +91,8 @@ void button_t::update_texture()
         .hover_progress = hover,
     };
 
-    auto surface = theme.get_button_surface(type, state);
     OpenGL::render_begin();
-    cairo_surface_upload_to_texture(surface, this->button_texture);
+    this->button_texture = theme.get_button_texture(type, state);
     OpenGL::render_end();
 }
 
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <wayfire/util.hpp>
 #include <wayfire/surface.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/opengl.hpp>
 #include <wayfire/nonstd/noncopyable.hpp>
 #include <wayfire/util/duration.hpp>
 
@@ -15,6 +17,19 @@ namespace decor
 {
 class decoration_theme_t;
 
+/**
+ * A texture rendered by the theme. The texture is deleted with the last
+ * reference, which has to be dropped with a current GL context.
+ */
+struct cached_texture_t : public noncopyable_t
+{
+    GLuint tex = -1;
+    int width = 0;
+    int height = 0;
+
+    ~cached_texture_t();
+};
+
 enum button_type_t
 {
     BUTTON_CLOSE,
@@ -33,6 +48,7 @@ class button_t : public noncopyable_t
      */
     button_t(const decoration_theme_t& theme,
         std::function<void()> damage_callback);
+    ~button_t();
 
     /**
      * Set the type of the button. This will affect the displayed icon and
@@ -61,17 +77,19 @@ class button_t : public noncopyable_t
      *
      * @param buffer The target framebuffer
      * @param geometry The geometry of the button, in logical coordinates
-     * @param scissor The scissor rectangle to render.
+     * @param batch The batch to add the button to. It is drawn when the
+     *   batch is flushed.
+     * @param clip The damaged boxes to draw, see render_gl_texture().
      */
     void render(const wf::framebuffer_t& buffer, wf::geometry_t geometry,
-        wf::geometry_t scissor);
+        OpenGL::render_batch_t& batch, const std::vector<gl_geometry>& clip);
 
   private:
     const decoration_theme_t& theme;
 
     /* Whether the button needs repaint */
     button_type_t type;
-    uint32_t button_texture = -1;
+    std::shared_ptr<cached_texture_t> button_texture;
 
     /* Whether the button is currently being hovered */
     bool is_hovered = false;
@@ -3,6 +3,9 @@
 #include <wayfire/core.hpp>
 #include <wayfire/nonstd/reverse.hpp>
 
+#include <algorithm>
+#include <climits>
+
 extern "C"
 {
 #include <wlr/types/wlr_xcursor_manager.h>
@@ -111,6 +114,7 @@ wf::geometry_t decoration_layout_t::create_buttons(int width, int)
 /** Regenerate layout using the new size */
 void decoration_layout_t::resize(int width, int height)
 {
+    reset_hit_state();
     this->layout_areas.clear();
     auto button_geometry_expanded = create_buttons(width, height);
 
@@ -177,26 +181,70 @@ wf::region_t decoration_layout_t::calculate_region() const
     return r;
 }
 
-void decoration_layout_t::unset_hover(wf::point_t position)
+void decoration_layout_t::reset_hit_state()
 {
-    auto area = find_area_at(position);
-    if (area && area->get_type() == DECORATION_AREA_BUTTON)
-        area->as_button().set_hover(false);
+    this->hit_area = nullptr;
+    this->hit_edges = 0;
+    this->hit_box = {0, 0, 0, 0};
+}
+
+void decoration_layout_t::ensure_hit_state()
+{
+    if (hit_box & current_input)
+        return;
+
+    /* The areas are few rectangles, so the box is found by cutting off each
+     * area which doesn't contain the point on the side facing the point */
+    hit_box = {INT_MIN / 2, INT_MIN / 2, INT_MAX, INT_MAX};
+    hit_area = nullptr;
+    hit_edges = 0;
+    for (auto& area : layout_areas)
+    {
+        auto g = area->get_geometry();
+        if (g & current_input)
+        {
+            hit_box = wf::geometry_intersection(hit_box, g);
+            if (!hit_area)
+                hit_area = {area};
+            if (area->get_type() & DECORATION_AREA_RESIZE_BIT)
+                hit_edges |= (area->get_type() & ~DECORATION_AREA_RESIZE_BIT);
+
+            continue;
+        }
+
+        int x1 = hit_box.x, y1 = hit_box.y;
+        int x2 = hit_box.x + hit_box.width, y2 = hit_box.y + hit_box.height;
+        if (g.x + g.width <= current_input.x)
+            x1 = std::max(x1, g.x + g.width);
+        else if (g.x > current_input.x)
+            x2 = std::min(x2, g.x);
+        else if (g.y + g.height <= current_input.y)
+            y1 = std::max(y1, g.y + g.height);
+        else
+            y2 = std::min(y2, g.y);
+
+        hit_box = {x1, y1, x2 - x1, y2 - y1};
+    }
 }
 
 /** Handle motion event to (x, y) relative to the decoration */
 void decoration_layout_t::handle_motion(int x, int y)
 {
-    auto previous_area = find_area_at(current_input);
-    auto current_area = find_area_at({x, y});
-    if (previous_area != current_area)
+    this->current_input = {x, y};
+    /* Nothing changes until the input leaves the box */
+    if (hit_box & current_input)
+        return;
+
+    auto previous_area = hit_area;
+    ensure_hit_state();
+    if (previous_area != hit_area)
     {
-        unset_hover(current_input);
-        if (current_area && current_area->get_type() == DECORATION_AREA_BUTTON)
-            current_area->as_button().set_hover(true);
+        if (previous_area && previous_area->get_type() == DECORATION_AREA_BUTTON)
+            previous_area->as_button().set_hover(false);
+        if (hit_area && hit_area->get_type() == DECORATION_AREA_BUTTON)
+            hit_area->as_button().set_hover(true);
     }
 
-    this->current_input = {x, y};
     update_cursor();
 }
 
@@ -212,11 +260,12 @@ decoration_layout_t::handle_press_event(bool pressed)
 {
     if (pressed)
     {
-        auto area = find_area_at(current_input);
+        ensure_hit_state();
+        auto area = hit_area;
         if (area && (area->get_type() & DECORATION_AREA_MOVE_BIT))
             return {DECORATION_ACTION_MOVE, 0};
         if (area && (area->get_type() & DECORATION_AREA_RESIZE_BIT))
-            return {DECORATION_ACTION_RESIZE, calculate_resize_edges()};
+            return {DECORATION_ACTION_RESIZE, hit_edges};
 
         if (area && area->get_type() == DECORATION_AREA_BUTTON)
             area->as_button().set_pressed(true);
@@ -269,28 +318,11 @@ decoration_layout_t::find_area_at(wf::point_t point)
     return nullptr;
 }
 
-/** Calculate resize edges based on @current_input */
-uint32_t decoration_layout_t::calculate_resize_edges() const
-{
-    uint32_t edges = 0;
-    for (auto& area : layout_areas)
-    {
-        if (area->get_geometry() & this->current_input)
-        {
-            if (area->get_type() & DECORATION_AREA_RESIZE_BIT)
-                edges |= (area->get_type() & ~DECORATION_AREA_RESIZE_BIT);
-        }
-    }
-
-    return edges;
-}
-
-/** Update the cursor based on @current_input */
+/** Update the cursor based on the edges at @current_input */
 void decoration_layout_t::update_cursor() const
 {
-    uint32_t edges = calculate_resize_edges();
-    auto cursor_name = edges > 0 ?
-        wlr_xcursor_get_resize_name((wlr_edges) edges) : "default";
+    auto cursor_name = hit_edges > 0 ?
+        wlr_xcursor_get_resize_name((wlr_edges) hit_edges) : "default";
     wf::get_core().set_cursor(cursor_name);
 }
 
@@ -304,7 +336,10 @@ void decoration_layout_t::handle_focus_lost()
             area->as_button().set_pressed(false);
     }
 
-    this->unset_hover(current_input);
+    if (hit_area && hit_area->get_type() == DECORATION_AREA_BUTTON)
+        hit_area->as_button().set_hover(false);
+
+    reset_hit_state();
 }
 
 }
@@ -161,12 +161,21 @@ class decoration_layout_t
     /* Last position of the input */
     wf::point_t current_input;
 
+    /* The first area at current_input and the resize edges there. They are
+     * the same for all points in hit_box, so motion inside of it isn't
+     * processed. The box is empty when they aren't known. */
+    nonstd::observer_ptr<decoration_area_t> hit_area;
+    uint32_t hit_edges = 0;
+    wf::geometry_t hit_box = {0, 0, 0, 0};
+
     /** Create buttons in the layout, and return their total geometry */
     wf::geometry_t create_buttons(int width, int height);
 
-    /** Calculate resize edges based on @current_input */
-    uint32_t calculate_resize_edges() const;
-    /** Update the cursor based on @current_input */
+    /** Find the hit area, edges and box of @current_input, if not known */
+    void ensure_hit_state();
+    /** Forget the hit state, for ex. when the areas change */
+    void reset_hit_state();
+    /** Update the cursor based on the edges at @current_input */
     void update_cursor() const;
 
     /**
@@ -175,8 +184,6 @@ class decoration_layout_t
      */
     nonstd::observer_ptr<decoration_area_t> find_area_at(wf::point_t point);
 
-    /** Unset hover state of hovered button at @position, if any */
-    void unset_hover(wf::point_t position);
     wf::option_wrapper_t<std::string> button_order{"decoration/button_order"};
 };
 }
@@ -9,6 +9,8 @@
 #include <wayfire/core.hpp>
 #include <wayfire/debug.hpp>
 #include <wayfire/decorator.hpp>
+#include <wayfire/accounting.hpp>
+#include <wayfire/coalesced-signal.hpp>
 #include <wayfire/view-transform.hpp>
 #include <wayfire/signal-definitions.hpp>
 #include "deco-subsurface.hpp"
@@ -16,6 +18,8 @@
 #include "deco-theme.hpp"
 #include "cairo-util.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cairo.h>
 
 extern "C"
@@ -41,38 +45,73 @@ class simple_decoration_surface : public wf::surface_interface_t,
             view->damage(); // trigger re-render
     };
 
-    void update_title(int width, int height, double scale)
+    /* The texture only depends on the text and the height, so resizing the
+     * view horizontally doesn't render the title again */
+    void update_title(int height, double scale)
     {
-        int target_width = width * scale;
         int target_height = height * scale;
-
-        if (title_texture.width != target_width ||
-            title_texture.height != target_height ||
-            title_texture.current_text != view->get_title())
+        if (!title_texture || (title_texture->height != target_height) ||
+            (current_title != view->get_title()))
         {
-            auto surface = theme.render_text(view->get_title(),
-                target_width, target_height);
-            cairo_surface_upload_to_texture(surface, title_texture.tex);
-
-            title_texture.width = target_width;
-            title_texture.height = target_height;
-            title_texture.current_text = view->get_title();
+            current_title = view->get_title();
+            title_texture = theme.get_title_texture(current_title,
+                target_height);
+
+            /* Views with the same title share the texture, each of them
+             * reports it */
+            wf::accounting::set_memory_usage(view.get(), "decoration title",
+                wf::accounting::MEMORY_GPU,
+                (size_t)title_texture->width * title_texture->height * 4);
         }
     }
 
     int width = 100, height = 100;
 
     bool active = true; // when views are mapped, they are usually activated
-    struct {
-        GLuint tex = -1;
-        int width = 0;
-        int height = 0;
-        std::string current_text = "";
-    } title_texture;
+    std::shared_ptr<wf::decor::cached_texture_t> title_texture;
+    std::string current_title;
 
     wf::decor::decoration_theme_t theme;
     wf::decor::decoration_layout_t layout;
     wf::region_t cached_region;
+    /* The size for which the layout was last generated */
+    wf::dimensions_t layout_size = {0, 0};
+
+    /**
+     * Generate the layout again if the view was resized since the last time.
+     * This creates the buttons and renders their textures, so it is done
+     * once per frame while resizing, and before the layout is used.
+     *
+     * @param damage Whether to damage the view. Not needed while rendering,
+     *   when the frame being drawn already repaints the decoration.
+     */
+    void update_layout(bool damage = true)
+    {
+        if ((layout_size.width == width) && (layout_size.height == height))
+            return;
+
+        layout_size = {width, height};
+        layout.resize(width, height);
+        if (!view->fullscreen)
+            this->cached_region = layout.calculate_region();
+
+        if (damage)
+            view->damage();
+    }
+
+    /* The view is resized by each commit of the client, possibly many times
+     * per frame during an interactive resize */
+    wf::coalesced_connection_t<wf::view_geometry_changed_signal>
+    on_geometry_changed{[=] (wf::view_geometry_changed_signal*)
+        {
+            update_layout();
+        }
+    };
+
+    wf::signal_connection_t on_output_changed = [=] (wf::signal_data_t*)
+    {
+        on_geometry_changed.set_output(view->get_output().get());
+    };
 
   public:
     simple_decoration_surface(wayfire_view view) :
@@ -82,6 +121,9 @@ class simple_decoration_surface : public wf::surface_interface_t,
     {
         this->view = view;
         view->connect_signal("title-changed", &title_set);
+        on_geometry_changed.connect(view.get(),
+            wf::signal_id_t{"geometry-changed"}, view->get_output().get());
+        view->connect_signal("set-output", &on_output_changed);
 
         // make sure to hide frame if the view is fullscreen
         update_decoration_size();
@@ -92,6 +134,14 @@ class simple_decoration_surface : public wf::surface_interface_t,
         _mapped = false;
         wf::emit_map_state_change(this);
         view->disconnect_signal("title-changed", &title_set);
+        on_geometry_changed.disconnect();
+        on_output_changed.disconnect();
+
+        OpenGL::render_begin();
+        title_texture.reset();
+        OpenGL::render_end();
+        wf::accounting::set_memory_usage(view.get(), "decoration title",
+            wf::accounting::MEMORY_GPU, 0);
     }
 
     /* wf::surface_interface_t implementation */
@@ -110,53 +160,66 @@ class simple_decoration_surface : public wf::surface_interface_t,
         return {width, height};
     }
 
-    void render_title(const wf::framebuffer_t& fb,
-        wf::geometry_t geometry)
+    void render_title(const wf::framebuffer_t& fb, wf::geometry_t geometry,
+        OpenGL::render_batch_t& batch, const std::vector<gl_geometry>& clip)
     {
-        update_title(geometry.width, geometry.height, fb.scale);
-        render_gl_texture(fb, geometry, title_texture.tex);
-    }
-
-    void render_scissor_box(const wf::framebuffer_t& fb, wf::point_t origin,
-        const wlr_box& scissor)
-    {
-        /* Clear background */
-        wlr_box geometry {origin.x, origin.y, width, height};
-        theme.render_background(fb, geometry, scissor, active);
+        update_title(geometry.height, fb.scale);
 
-        /* Draw title & buttons */
-        auto renderables = layout.get_renderable_areas();
-        for (auto item : renderables)
-        {
-            if (item->get_type() == wf::decor::DECORATION_AREA_TITLE) {
-                OpenGL::render_begin(fb);
-                fb.scissor(scissor);
-                render_title(fb, item->get_geometry() + origin);
-                OpenGL::render_end();
-            } else { // button
-                item->as_button().render(fb,
-                    item->get_geometry() + origin, scissor);
-            }
-        }
+        /* The part of the text which doesn't fit in the title area is cut */
+        float text_width = title_texture->width / fb.scale;
+        float shown = std::min(1.0f, geometry.width / text_width);
+        geometry.width = std::ceil(text_width * shown);
+        render_gl_texture(batch, fb, geometry, title_texture->tex, clip, shown);
     }
 
     virtual void simple_render(const wf::framebuffer_t& fb, int x, int y,
         const wf::region_t& damage) override
     {
+        update_layout(false);
         wf::region_t frame = this->cached_region + wf::point_t{x, y};
         frame *= fb.scale;
         frame &= damage;
+        if (frame.empty())
+            return;
 
+        /* The damaged parts of the frame, in the coordinates of the quads.
+         * Everything is clipped to them on the CPU instead of scissored, so
+         * that each texture is drawn once for all of them. */
+        std::vector<gl_geometry> clip;
         for (const auto& box : frame)
         {
-            auto sbox = fb.framebuffer_box_from_damage_box(
-                wlr_box_from_pixman_box(box));
-            render_scissor_box(fb, {x, y}, sbox);
+            clip.push_back({
+                box.x1 / fb.scale + fb.geometry.x,
+                box.y1 / fb.scale + fb.geometry.y,
+                box.x2 / fb.scale + fb.geometry.x,
+                box.y2 / fb.scale + fb.geometry.y,
+            });
         }
+
+        /* Background, title & buttons, in a single batch */
+        OpenGL::render_begin(fb);
+        OpenGL::render_batch_t batch;
+        theme.render_background(batch, fb, {x, y, width, height}, clip, active);
+
+        auto renderables = layout.get_renderable_areas();
+        for (auto item : renderables)
+        {
+            if (item->get_type() == wf::decor::DECORATION_AREA_TITLE) {
+                render_title(fb, item->get_geometry() + wf::point_t{x, y},
+                    batch, clip);
+            } else { // button
+                item->as_button().render(fb,
+                    item->get_geometry() + wf::point_t{x, y}, batch, clip);
+            }
+        }
+
+        batch.flush();
+        OpenGL::render_end();
     }
 
     bool accepts_input(int32_t sx, int32_t sy) override
     {
+        update_layout();
         return pixman_region32_contains_point(cached_region.to_pixman(),
             sx, sy, NULL);
     }
@@ -266,15 +329,10 @@ class simple_decoration_surface : public wf::surface_interface_t,
 
     virtual void notify_view_resized(wf::geometry_t view_geometry) override
     {
+        /* The layout is updated on the next frame, see update_layout() */
         view->damage();
         width = view_geometry.width;
         height = view_geometry.height;
-
-        layout.resize(width, height);
-        if (!view->fullscreen)
-            this->cached_region = layout.calculate_region();
-
-        view->damage();
     };
 
     virtual void notify_view_tiled() override
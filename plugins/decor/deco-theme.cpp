@@ -1,16 +1,13 @@
 #include "deco-theme.hpp"
+#include "cairo-util.hpp"
 #include <wayfire/core.hpp>
 #include <wayfire/opengl.hpp>
 #include <config.h>
+#include <algorithm>
+#include <cmath>
+#include <list>
 #include <map>
-
-extern "C"
-{
-#define static
-#include <wlr/render/wlr_renderer.h>
-#include <wlr/types/wlr_matrix.h>
-#undef static
-}
+#include <tuple>
 
 namespace wf
 {
@@ -33,38 +30,49 @@ int decoration_theme_t::get_border_size() const
 }
 
 /**
- * Fill the given rectange with the background color(s).
- *
- * @param fb The target framebuffer, must have been bound already
- * @param rectangle The rectangle to redraw.
- * @param scissor The GL scissor rectangle to use.
- * @param active Whether to use active or inactive colors
+ * A white pixel, tinted with the color of the quads to draw solid rectangles
+ * in the same batch as the textures. It lives as long as the GL context.
  */
-void decoration_theme_t::render_background(const wf::framebuffer_t& fb,
-    wf::geometry_t rectangle, const wf::geometry_t& scissor, bool active) const
+static GLuint get_solid_texture()
 {
-    /* Prepare matrices */
-    rectangle = fb.damage_box_from_geometry_box(rectangle);
+    static GLuint tex = -1;
+    if (tex == (GLuint)-1)
+    {
+        const uint32_t white = 0xffffffff;
+        GL_CALL(glGenTextures(1, &tex));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, &white));
+    }
 
-    float projection[9];
-    wlr_matrix_projection(projection,
-        fb.viewport_width, fb.viewport_height,
-        (wl_output_transform)fb.wl_transform);
+    return tex;
+}
 
-    float matrix[9];
-    wlr_matrix_project_box(matrix, &rectangle,
-        WL_OUTPUT_TRANSFORM_NORMAL, 0, projection);
+/**
+ * Fill the given rectange with the background color(s).
+ *
+ * The rectangle is a single quad clipped to the damaged boxes of the frame,
+ * so the borders and the titlebar of a view are one draw call together.
+ */
+void decoration_theme_t::render_background(OpenGL::render_batch_t& batch,
+    const wf::framebuffer_t& fb, wf::geometry_t rectangle,
+    const std::vector<gl_geometry>& clip, bool active) const
+{
+    OpenGL::textured_quad_t quad;
+    quad.texture = get_solid_texture();
+    quad.geometry.x1 = rectangle.x + fb.geometry.x;
+    quad.geometry.y1 = rectangle.y + fb.geometry.y;
+    quad.geometry.x2 = quad.geometry.x1 + rectangle.width;
+    quad.geometry.y2 = quad.geometry.y1 + rectangle.height;
+    quad.transform = fb.get_orthographic_projection();
 
-    /* Calculate color */
     wf::color_t color = active ? active_color : inactive_color;
-    float color4f[] = {
-        (float)color.r, (float)color.g, (float)color.b, (float)color.a};
-
-    /* Actual rendering */
-    OpenGL::render_begin(fb);
-    fb.scissor(scissor);
-    wlr_render_quad_with_matrix(wf::get_core().renderer, color4f, matrix);
-    OpenGL::render_end();
+    quad.color = glm::vec4(color.r, color.g, color.b, color.a);
+
+    for (auto& box : clip)
+        batch.add_clipped(quad, box);
 }
 
 /**
@@ -97,6 +105,62 @@ cairo_surface_t *decoration_theme_t::render_text(std::string text,
     return surface;
 }
 
+cached_texture_t::~cached_texture_t()
+{
+    if (tex != (GLuint)-1)
+        GL_CALL(glDeleteTextures(1, &tex));
+}
+
+/* The rendered titles, by text, font and height */
+static std::map<std::tuple<std::string, std::string, int>,
+    std::weak_ptr<cached_texture_t>> title_cache;
+
+std::shared_ptr<cached_texture_t> decoration_theme_t::get_title_texture(
+    const std::string& text, int height) const
+{
+    auto key = std::make_tuple(text, (std::string)font, height);
+    if (auto cached = title_cache[key].lock())
+        return cached;
+
+    /* Forget the titles which are no longer shown */
+    for (auto it = title_cache.begin(); it != title_cache.end();)
+    {
+        if (it->second.expired() && (it->first != key))
+            it = title_cache.erase(it);
+        else
+            ++it;
+    }
+
+    /* Measure the text with the same font as render_text() */
+    auto measure_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    auto cr = cairo_create(measure_surface);
+    cairo_select_font_face(cr, ((std::string)font).c_str(),
+        CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, height * 0.8);
+
+    cairo_text_extents_t ext;
+    cairo_text_extents(cr, text.c_str(), &ext);
+    cairo_destroy(cr);
+    cairo_surface_destroy(measure_surface);
+
+    static GLint max_size = 0;
+    if (max_size == 0)
+        GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+
+    auto title = std::make_shared<cached_texture_t>();
+    title->width = std::clamp((int)std::ceil(
+        std::max(ext.x_advance, ext.x_bearing + ext.width)), 1, (int)max_size);
+    title->height = std::max(height, 1);
+
+    auto surface = render_text(text, title->width, title->height);
+    cairo_surface_upload_to_texture(surface, title->tex);
+    cairo_surface_destroy(surface);
+
+    title_cache[key] = title;
+    return title;
+}
+
+/* The icons of the buttons, loaded once per type */
 static struct icon_cache_t : public noncopyable_t
 {
     ~icon_cache_t()
@@ -135,28 +199,106 @@ static struct icon_cache_t : public noncopyable_t
     }
 } cache;
 
-cairo_surface_t *decoration_theme_t::get_button_surface(button_type_t button,
-    const button_state_t& state) const
+/**
+ * The rendered buttons, as textures. The least recently used ones are
+ * dropped when they use more than the budget. Textures which are still shown
+ * by a button stay alive until the button stops using them.
+ */
+static struct button_texture_cache_t
 {
-    cairo_surface_t *button_icon = cache.load_icon(button);
-    std::string resource_path =
-        INSTALL_PREFIX "/share/wayfire/decoration/resources/";
-    switch (button)
+    /* Button type, width, height, border and rounded hover progress */
+    using key_t = std::tuple<int, int, int, int, int>;
+
+    struct entry_t
+    {
+        std::shared_ptr<cached_texture_t> texture;
+        std::list<key_t>::iterator lru_position;
+    };
+
+    std::map<key_t, entry_t> entries;
+    /* Most recently used first */
+    std::list<key_t> lru;
+    size_t total_bytes = 0;
+
+    static size_t get_bytes(const cached_texture_t& texture)
+    {
+        return size_t(texture.width) * texture.height * 4;
+    }
+
+    std::shared_ptr<cached_texture_t> find(const key_t& key)
+    {
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return nullptr;
+
+        lru.splice(lru.begin(), lru, it->second.lru_position);
+        return it->second.texture;
+    }
+
+    void insert(const key_t& key, std::shared_ptr<cached_texture_t> texture,
+        size_t budget)
+    {
+        lru.push_front(key);
+        entries[key] = {texture, lru.begin()};
+        total_bytes += get_bytes(*texture);
+
+        /* The newest texture is kept even if it alone is over the budget */
+        while (total_bytes > budget && lru.size() > 1)
+        {
+            auto& evicted = entries[lru.back()];
+            total_bytes -= get_bytes(*evicted.texture);
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+
+        OpenGL::set_texture_memory_usage("decoration icons", total_bytes);
+    }
+
+    void clear()
     {
-        case BUTTON_CLOSE:
-            resource_path += "close.png";
-            break;
-        case BUTTON_TOGGLE_MAXIMIZE:
-            resource_path += "maximize.png";
-            break;
-        case BUTTON_MINIMIZE:
-            resource_path += "minimize.png";
-            break;
-        default:
-            assert(false);
+        entries.clear();
+        lru.clear();
+        total_bytes = 0;
+        OpenGL::set_texture_memory_usage("decoration icons", 0);
     }
+} button_textures;
+
+/* Steps of the hover progress for which the buttons are rendered */
+static const int HOVER_STEPS = 32;
+
+std::shared_ptr<cached_texture_t> decoration_theme_t::get_button_texture(
+    button_type_t button, const button_state_t& state) const
+{
+    int hover = std::round(state.hover_progress * HOVER_STEPS);
+    button_texture_cache_t::key_t key{button, state.width, state.height,
+        state.border, hover};
+    if (auto cached = button_textures.find(key))
+        return cached;
+
+    auto rounded_state = state;
+    rounded_state.hover_progress = 1.0 * hover / HOVER_STEPS;
+
+    auto texture = std::make_shared<cached_texture_t>();
+    auto surface = get_button_surface(button, rounded_state);
+    cairo_surface_upload_to_texture(surface, texture->tex);
+    texture->width  = cairo_image_surface_get_width(surface);
+    texture->height = cairo_image_surface_get_height(surface);
+    cairo_surface_destroy(surface);
 
-    button_icon = cairo_image_surface_create_from_png(resource_path.c_str());
+    size_t budget = std::max((int)icon_cache_size, 0) * 1024ull;
+    button_textures.insert(key, texture, budget);
+    return texture;
+}
+
+void decoration_theme_t::release_cached_textures()
+{
+    button_textures.clear();
+}
+
+cairo_surface_t *decoration_theme_t::get_button_surface(button_type_t button,
+    const button_state_t& state) const
+{
+    cairo_surface_t *button_icon = cache.load_icon(button);
     cairo_surface_t *button_surface = cairo_image_surface_create(
         CAIRO_FORMAT_ARGB32, state.width, state.height);
     auto cr = cairo_create(button_surface);
@@ -195,7 +337,6 @@ cairo_surface_t *decoration_theme_t::get_button_surface(button_type_t button,
     cairo_fill(cr);
 
     cairo_destroy(cr);
-    cairo_surface_destroy(button_icon);
 
     return button_surface;
 }
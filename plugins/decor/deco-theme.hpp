@@ -1,5 +1,6 @@
 #pragma once
 #include <wayfire/render-manager.hpp>
+#include <memory>
 #include "deco-button.hpp"
 
 namespace wf
@@ -24,13 +25,15 @@ class decoration_theme_t
     /**
      * Fill the given rectange with the background color(s).
      *
-     * @param fb The target framebuffer, must have been bound already.
+     * @param batch The batch to add the background to.
+     * @param fb The target framebuffer.
      * @param rectangle The rectangle to redraw.
-     * @param scissor The GL scissor rectangle to use.
+     * @param clip The damaged boxes to draw, see render_gl_texture().
      * @param active Whether to use active or inactive colors
      */
-    void render_background(const wf::framebuffer_t& fb, wf::geometry_t rectangle,
-        const wf::geometry_t& scissor, bool active) const;
+    void render_background(OpenGL::render_batch_t& batch,
+        const wf::framebuffer_t& fb, wf::geometry_t rectangle,
+        const std::vector<gl_geometry>& clip, bool active) const;
 
     /**
      * Render the given text on a cairo_surface_t with the given size.
@@ -38,6 +41,17 @@ class decoration_theme_t
      */
     cairo_surface_t *render_text(std::string text, int width, int height) const;
 
+    /**
+     * Get the given text rendered on a texture with the given height in
+     * pixels. The textures are cached and shared by all decorations which
+     * show the same text with the same font and height, so they are rendered
+     * again only when the title or the size of the text changes.
+     *
+     * Must be called with a current GL context.
+     */
+    std::shared_ptr<cached_texture_t> get_title_texture(
+        const std::string& text, int height) const;
+
     struct button_state_t
     {
         /** Button width */
@@ -61,12 +75,30 @@ class decoration_theme_t
     cairo_surface_t *get_button_surface(button_type_t button,
         const button_state_t& state) const;
 
+    /**
+     * Get the icon for the given button as a texture. The textures are kept
+     * in a cache shared by all decorations, which holds the least recently
+     * used ones up to decoration/icon_cache_size. The hover progress is
+     * rounded, so that the icons of an animated button can be cached too.
+     *
+     * Must be called with a current GL context.
+     */
+    std::shared_ptr<cached_texture_t> get_button_texture(button_type_t button,
+        const button_state_t& state) const;
+
+    /**
+     * Drop the cached button textures. Textures still used by buttons are
+     * deleted with them. Must be called with a current GL context.
+     */
+    static void release_cached_textures();
+
   private:
     wf::option_wrapper_t<std::string> font{"decoration/font"};
     wf::option_wrapper_t<int> title_height{"decoration/title_height"};
     wf::option_wrapper_t<int> border_size{"decoration/border_size"};
     wf::option_wrapper_t<wf::color_t> active_color{"decoration/active_color"};
     wf::option_wrapper_t<wf::color_t> inactive_color{"decoration/inactive_color"};
+    wf::option_wrapper_t<int> icon_cache_size{"decoration/icon_cache_size"};
 };
 }
 }
@@ -6,6 +6,7 @@
 #include <wayfire/signal-definitions.hpp>
 
 #include "deco-subsurface.hpp"
+#include "deco-theme.hpp"
 class wayfire_decoration : public wf::plugin_interface_t
 {
     wf::signal_connection_t view_updated {
@@ -46,6 +47,10 @@ class wayfire_decoration : public wf::plugin_interface_t
     {
         for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
             view->set_decoration(nullptr);
+
+        OpenGL::render_begin();
+        wf::decor::decoration_theme_t::release_cached_textures();
+        OpenGL::render_end();
     }
 };
 
@@ -61,56 +61,128 @@ namespace wf
 
         }
 
-        namespace matchers
+        /* How the pattern of a single expression is matched */
+        enum match_mode
         {
-            using func_t = std::function<bool(string, string)>;
-            func_t exact = [] (string text, string pattern)
+            MODE_IS,
+            MODE_CONTAINS,
+        };
+
+        std::map<string, match_mode> match_modes = {
+            {"is", MODE_IS},
+            {"contains", MODE_CONTAINS},
+        };
+
+        std::map<string, match_field> match_fields = {
+            {"title", FIELD_TITLE},
+            {"app-id", FIELD_APP_ID},
+            {"type", FIELD_TYPE},
+            {"focuseable", FIELD_FOCUSEABLE},
+        };
+
+        bool pattern_t::matches(const view_t& view) const
+        {
+            const string *data = nullptr;
+            switch (this->field)
             {
-                if (pattern == "any")
-                    return true;
+                case FIELD_TITLE:
+                    data = &view.title;
+                    break;
+                case FIELD_APP_ID:
+                    data = &view.app_id;
+                    break;
+                case FIELD_TYPE:
+                    data = &view.type;
+                    break;
+                case FIELD_FOCUSEABLE:
+                    data = &view.focuseable;
+            }
 
-                bool result = false;
-                try {
-                    result = std::regex_match(text, std::regex(pattern));
-                } catch (const std::exception& e) {
-                    LOGE ("Invalid regular expression: %s", pattern.c_str());
-                }
+            switch (this->mode)
+            {
+                case MATCH_ALWAYS:
+                    return true;
+                case MATCH_NEVER:
+                    return false;
+                case MATCH_EQUAL:
+                    return *data == text;
+                case MATCH_REGEX:
+                    return std::regex_match(*data, regex);
+                case MATCH_CONTAINS:
+                    return data->find(text) != string::npos;
+            }
 
-                return result;
-            };
+            return false;
+        }
 
-            func_t contains = [] (string text, string pattern)
+        bool program_t::evaluate(const view_t& view) const
+        {
+            bool value = false;
+            for (size_t pc = 0; pc < code.size(); pc++)
             {
-                return text.find(pattern) != text.npos;
-            };
+                auto& instruction = code[pc];
+                switch (instruction.op)
+                {
+                    case OP_MATCH:
+                        value = patterns[instruction.arg].matches(view);
+                        break;
+                    case OP_CONST:
+                        value = instruction.arg;
+                        break;
+                    case OP_NOT:
+                        value = !value;
+                        break;
+                    case OP_JUMP_IF_FALSE:
+                        if (!value)
+                            pc = instruction.arg - 1;
+                        break;
+                    case OP_JUMP_IF_TRUE:
+                        if (value)
+                            pc = instruction.arg - 1;
+                        break;
+                }
+            }
 
-            std::map<string, func_t> matchers = {
-                {"is", exact},
-                {"contains", contains},
-            };
+            return value;
         }
 
-        /* Which attribute of the view we want to match against */
-        enum match_field
+        /* Prepare the pattern of "<field> <mode> <pattern>" */
+        pattern_t compile_pattern(match_field field, match_mode mode,
+            const string& text)
         {
-            FIELD_TITLE,
-            FIELD_APP_ID,
-            FIELD_TYPE,
-            FIELD_FOCUSEABLE,
-        };
+            pattern_t pattern;
+            pattern.field = field;
+            pattern.text = text;
 
-        std::map<string, match_field> match_fields = {
-            {"title", FIELD_TITLE},
-            {"app-id", FIELD_APP_ID},
-            {"type", FIELD_TYPE},
-            {"focuseable", FIELD_FOCUSEABLE},
-        };
+            if (mode == MODE_CONTAINS)
+            {
+                pattern.mode = pattern_t::MATCH_CONTAINS;
+            } else if (text == "any")
+            {
+                pattern.mode = pattern_t::MATCH_ALWAYS;
+            } else if (text.find_first_of(".[]{}()\\*+?^$|") == string::npos)
+            {
+                /* Matches only itself, no need for a regex */
+                pattern.mode = pattern_t::MATCH_EQUAL;
+            } else
+            {
+                try {
+                    pattern.regex = std::regex(text, std::regex::optimize);
+                    pattern.mode = pattern_t::MATCH_REGEX;
+                } catch (const std::exception& e) {
+                    LOGE("Invalid regular expression: ", text);
+                    pattern.mode = pattern_t::MATCH_NEVER;
+                }
+            }
+
+            return pattern;
+        }
 
         /* Represents the lowest-level criterium to match against (i.e no logic operators) */
         struct single_expression_t : public expression_t
         {
             match_field field;
-            matchers::func_t matcher;
+            match_mode mode;
             string matcher_arg;
 
             single_expression_t(string expr)
@@ -124,33 +196,20 @@ namespace wf
                 if (!match_fields.count(tokens[0]))
                     throw std::invalid_argument("Invalid match field: " + tokens[0]);
 
-                if (!matchers::matchers.count(tokens[1]))
+                if (!match_modes.count(tokens[1]))
                     throw std::invalid_argument("Invalid match mode: " + tokens[1]);
 
                 this->field = match_fields[tokens[0]];
-                this->matcher = matchers::matchers[tokens[1]];
+                this->mode = match_modes[tokens[1]];
                 this->matcher_arg = tokens[2];
             }
 
-            bool evaluate(const view_t& view) override
+            void compile(program_t& program) const override
             {
-                string view_field_data;
-                switch (this->field)
-                {
-                    case FIELD_TITLE:
-                        view_field_data = view.title;
-                        break;
-                    case FIELD_APP_ID:
-                        view_field_data = view.app_id;
-                        break;
-                    case FIELD_TYPE:
-                        view_field_data = view.type;
-                        break;
-                    case FIELD_FOCUSEABLE:
-                        view_field_data = view.focuseable;
-                }
-
-                return this->matcher(view_field_data, this->matcher_arg);
+                program.code.push_back({program_t::OP_MATCH,
+                    (uint32_t)program.patterns.size()});
+                program.patterns.push_back(
+                    compile_pattern(field, mode, matcher_arg));
             }
         };
 
@@ -245,19 +304,22 @@ namespace wf
                 }
             }
 
-            bool evaluate(const view_t& view) override
+            void compile(program_t& program) const override
             {
-                switch (this->op)
+                arg0->compile(program);
+                if (this->op == LOGIC_NOT)
                 {
-                    case LOGIC_NOT:
-                        return !arg0->evaluate(view);
-                    case LOGIC_OR:
-                        return arg0->evaluate(view) || arg1->evaluate(view);
-                    case LOGIC_AND:
-                        return arg0->evaluate(view) && arg1->evaluate(view);
+                    program.code.push_back({program_t::OP_NOT, 0});
+                    return;
                 }
 
-                return false;
+                /* The value of the first operand is the result if it is false
+                 * for &&, or true for || */
+                size_t jump = program.code.size();
+                program.code.push_back({this->op == LOGIC_AND ?
+                    program_t::OP_JUMP_IF_FALSE : program_t::OP_JUMP_IF_TRUE, 0});
+                arg1->compile(program);
+                program.code[jump].arg = program.code.size();
             }
         };
 
@@ -279,9 +341,9 @@ namespace wf
                 }
             }
 
-            bool evaluate(const view_t& view) override
+            void compile(program_t& program) const override
             {
-                return true;
+                program.code.push_back({program_t::OP_CONST, 1});
             }
         };
 
@@ -301,9 +363,9 @@ namespace wf
                 }
             }
 
-            bool evaluate(const view_t& view) override
+            void compile(program_t& program) const override
             {
-                return false;
+                program.code.push_back({program_t::OP_CONST, 0});
             }
         };
 
@@ -340,5 +402,12 @@ namespace wf
 
             return final_result;
         }
+
+        program_t compile_expression(const expression_t& expression)
+        {
+            program_t program;
+            expression.compile(program);
+            return program;
+        }
     }
 }
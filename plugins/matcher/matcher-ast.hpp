@@ -3,7 +3,9 @@
 
 #include <string>
 #include <memory>
+#include <regex>
 #include <utility>
+#include <vector>
 
 namespace wf
 {
@@ -17,15 +19,83 @@ namespace wf
             std::string focuseable;
         };
 
+        /* Which attribute of the view we want to match against */
+        enum match_field
+        {
+            FIELD_TITLE,
+            FIELD_APP_ID,
+            FIELD_TYPE,
+            FIELD_FOCUSEABLE,
+        };
+
+        /* A single criterium, with its pattern prepared for matching */
+        struct pattern_t
+        {
+            enum mode_t
+            {
+                /* "is any" */
+                MATCH_ALWAYS,
+                /* A pattern which failed to compile */
+                MATCH_NEVER,
+                /* "is" with a pattern without special characters */
+                MATCH_EQUAL,
+                MATCH_REGEX,
+                MATCH_CONTAINS,
+            };
+
+            match_field field;
+            mode_t mode;
+            std::string text;
+            std::regex regex;
+
+            bool matches(const view_t& view) const;
+        };
+
+        /**
+         * An expression compiled to a flat list of instructions. They work on
+         * a single boolean register, which holds the value of the expression
+         * at the end. && and || jump over their second operand when the first
+         * one decides the result.
+         */
+        struct program_t
+        {
+            enum opcode_t
+            {
+                /* value = the result of patterns[arg] */
+                OP_MATCH,
+                /* value = arg */
+                OP_CONST,
+                OP_NOT,
+                /* Continue at the instruction arg if value is false/true */
+                OP_JUMP_IF_FALSE,
+                OP_JUMP_IF_TRUE,
+            };
+
+            struct instruction_t
+            {
+                opcode_t op;
+                uint32_t arg;
+            };
+
+            std::vector<instruction_t> code;
+            std::vector<pattern_t> patterns;
+
+            bool evaluate(const view_t& view) const;
+        };
+
         /* A base class for expressions */
         struct expression_t
         {
-            virtual bool evaluate(const view_t& view) = 0;
+            /* Append the instructions which evaluate the expression */
+            virtual void compile(program_t& program) const = 0;
             virtual ~expression_t() = default;
         };
 
         using parse_result_t = std::pair<std::unique_ptr<expression_t>, std::string>;
         parse_result_t parse_expression(std::string expression);
+
+        /** Compile the given expression to a program */
+        program_t compile_expression(const expression_t& expression);
     }
 }
 
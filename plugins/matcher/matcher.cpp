@@ -8,6 +8,9 @@
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/util/log.hpp>
 
+#include <optional>
+#include <unordered_map>
+
 extern "C"
 {
 #define static
@@ -23,7 +26,7 @@ namespace wf
 {
     namespace matcher
     {
-        std::string get_view_type(wayfire_view view)
+        const char *get_view_type(wayfire_view view)
         {
             if (view->role == VIEW_ROLE_TOPLEVEL)
                 return "toplevel";
@@ -52,21 +55,60 @@ namespace wf
             return "unknown";
         };
 
+        /**
+         * The results of the matchers for a view. The title and the app-id
+         * are the expensive parts to compare, so the results are kept until
+         * one of them changes. The type and focuseable state are cheap to
+         * get, and are checked on each lookup.
+         */
+        struct match_cache_t : public custom_data_t
+        {
+            struct entry_t
+            {
+                const char *type;
+                bool focuseable;
+                bool result;
+            };
+
+            /* By the id of the matcher */
+            std::unordered_map<uint64_t, entry_t> results;
+
+            wf::signal_connection_t on_changed = [=] (signal_data_t*)
+            {
+                results.clear();
+            };
+
+            match_cache_t(wayfire_view view)
+            {
+                view->connect_signal("title-changed", &on_changed);
+                view->connect_signal("app-id-changed", &on_changed);
+            }
+        };
+
         class default_view_matcher : public view_matcher
         {
-            std::unique_ptr<expression_t> expr;
+            std::optional<program_t> program;
             wf::option_sptr_t<std::string> match_option;
 
+            /* Identifies the cached results of the current expression. It is
+             * unique, so results of destroyed matchers are never reused. */
+            uint64_t id;
+
             wf::config::option_base_t::updated_callback_t on_match_string_updated = [=] ()
             {
+                static uint64_t last_id = 0;
+                this->id = ++last_id;
+
                 auto result = parse_expression(match_option->get_value_str());
                 if (!result.first)
                 {
-                    LOGE("Failed to load match expression %s:\n%s",
-                        match_option->get_value_str().c_str(), result.second.c_str());
+                    LOGE("Failed to load match expression ",
+                        match_option->get_value_str(), ":\n", result.second);
+                    this->program.reset();
+                    return;
                 }
 
-                this->expr = std::move(result.first);
+                this->program = compile_expression(*result.first);
             };
 
             public:
@@ -84,16 +126,35 @@ namespace wf
 
             virtual bool matches(wayfire_view view) const
             {
-                if (!expr || !view->is_mapped())
+                if (!program || !view->is_mapped())
                     return false;
 
+                const char *type = get_view_type(view);
+                bool focuseable = view->is_focuseable();
+
+                if (!view->has_data<match_cache_t>())
+                {
+                    view->store_data(std::make_unique<match_cache_t> (view));
+                }
+
+                auto cache = view->get_data<match_cache_t>();
+                auto it = cache->results.find(id);
+                if ((it != cache->results.end()) &&
+                    (it->second.type == type) &&
+                    (it->second.focuseable == focuseable))
+                {
+                    return it->second.result;
+                }
+
                 view_t data;
                 data.title = view->get_title();
                 data.app_id = view->get_app_id();
-                data.type = get_view_type(view);
-                data.focuseable = view->is_focuseable() ?  "true" : "false";
+                data.type = type;
+                data.focuseable = focuseable ?  "true" : "false";
 
-                return expr->evaluate(data);
+                bool result = program->evaluate(data);
+                cache->results[id] = {type, focuseable, result};
+                return result;
             }
         };
 
@@ -25,7 +25,7 @@ namespace wf
 
         /* Tries to create a view matcher on the given domain (usually the output
          * of the plugin) with the given expression. May return null */
-        std::unique_ptr<view_matcher> get_matcher(wf::option_sptr_t<std::string> expression)
+        inline std::unique_ptr<view_matcher> get_matcher(wf::option_sptr_t<std::string> expression)
         {
             match_signal data;
             data.expression = expression;
@@ -41,7 +41,7 @@ namespace wf
         };
 
 #define WF_MATCHER_EVALUATE_SIGNAL "matcher-evaluate-match"
-        bool evaluate(const std::unique_ptr<view_matcher>& matcher,
+        inline bool evaluate(const std::unique_ptr<view_matcher>& matcher,
             wayfire_view view)
         {
             match_evaluate_signal data;
@@ -26,7 +26,6 @@
 #include <wayfire/view.hpp>
 #include <wayfire/plugin.hpp>
 #include <wayfire/output.hpp>
-#include "wayfire/view-transform.hpp"
 #include "wayfire/workspace-manager.hpp"
 
 class wayfire_alpha : public wf::plugin_interface_t
@@ -46,29 +45,11 @@ class wayfire_alpha : public wf::plugin_interface_t
 
     void update_alpha(wayfire_view view, float delta)
     {
-        wf::view_2D *transformer;
-        float alpha;
-
-        if (!view->get_transformer("alpha"))
-            view->add_transformer(std::make_unique<wf::view_2D> (view), "alpha");
-
-        transformer = dynamic_cast<wf::view_2D*> (view->get_transformer("alpha").get());
-        alpha = transformer->alpha;
-
+        float alpha = view->get_alpha();
         alpha -= delta * 0.003;
+        alpha = wf::clamp(alpha, (float)min_value, 1.0f);
 
-        if (alpha > 1.0)
-            alpha = 1.0;
-
-        if (alpha == 1.0)
-            return view->pop_transformer("alpha");
-
-        alpha = std::max(alpha, (float)min_value);
-        if (transformer->alpha != alpha)
-        {
-            transformer->alpha = alpha;
-            view->damage();
-        }
+        view->set_alpha(alpha);
     }
 
     wf::axis_callback axis_cb = [=] (wlr_event_pointer_axis* ev)
@@ -99,27 +80,15 @@ class wayfire_alpha : public wf::plugin_interface_t
     {
         for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
         {
-            if (!view->get_transformer("alpha"))
-                continue;
-
-            wf::view_2D *transformer = dynamic_cast<wf::view_2D*> (view->get_transformer("alpha").get());
-
-            if (transformer->alpha < min_value)
-            {
-                transformer->alpha = min_value;
-                view->damage();
-            }
-
+            if (view->get_alpha() < min_value)
+                view->set_alpha(min_value);
         }
     };
 
     void fini() override
     {
         for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
-        {
-            if (view->get_transformer("alpha"))
-                view->pop_transformer("alpha");
-        }
+            view->set_alpha(1.0);
 
         output->rem_binding(&axis_cb);
     }
@@ -1,26 +1,272 @@
 #include <wayfire/singleton-plugin.hpp>
 #include <wayfire/core.hpp>
+#include <wayfire/view.hpp>
+#include <wayfire/signal-definitions.hpp>
+#include <wayfire/util.hpp>
 #include <wayfire/util/log.hpp>
 #include <wayfire/option-wrapper.hpp>
 #include <config.h>
 
+#include <wayland-server.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/**
+ * The autostart entries are launched one per idle callback, so that starting
+ * them doesn't delay the first frames. An entry can wait for other entries
+ * with an option named <entry>_after, which lists the names of the entries
+ * it depends on. A dependency is satisfied once it has mapped its first view,
+ * or once dependency_timeout has passed since it was launched, because not
+ * every client maps a view.
+ *
+ * The time from launching each entry to its first mapped view is logged, to
+ * find which part of the startup is slow.
+ */
 class wayfire_autostart
 {
     wf::option_wrapper_t<bool> autostart_wf_shell{"autostart/autostart_wf_shell"};
+    wf::option_wrapper_t<int> dependency_timeout{"autostart/dependency_timeout"};
+
+    static constexpr const char *after_suffix = "_after";
+
+    struct autostart_entry_t
+    {
+        std::string name;
+        std::string command;
+        std::vector<std::string> after;
+
+        pid_t pid = -1;
+        uint32_t launch_time = 0;
+        bool launched = false;
+        bool mapped = false;
+    };
+
+    std::vector<autostart_entry_t> entries;
+    uint32_t start_time;
+
+    wf::wl_idle_call idle_launch;
+    wf::wl_timer timeout_launch;
+
+    static bool ends_with(const std::string& str, const std::string& suffix)
+    {
+        return str.size() > suffix.size() &&
+               str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    autostart_entry_t *find_entry(const std::string& name)
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.name == name)
+                return &entry;
+        }
+
+        return nullptr;
+    }
+
+    bool dependency_satisfied(const std::string& name, uint32_t now)
+    {
+        auto dep = find_entry(name);
+        /* Unknown entries can't be waited for */
+        if (!dep)
+            return true;
+
+        return dep->launched && (dep->mapped ||
+            (int)(now - dep->launch_time) >= dependency_timeout);
+    }
+
+    bool is_ready(const autostart_entry_t& entry, uint32_t now)
+    {
+        for (auto& dep : entry.after)
+        {
+            if (!dependency_satisfied(dep, now))
+                return false;
+        }
+
+        return true;
+    }
+
+    void launch(autostart_entry_t& entry)
+    {
+        entry.pid = wf::get_core().run(entry.command);
+        entry.launch_time = wf::get_current_time();
+        entry.launched = true;
+        LOGI("autostart: launched ", entry.name, " (pid ", entry.pid, ") at +",
+            entry.launch_time - start_time, "ms");
+    }
+
+    /** Launch the next entry which is ready, and schedule the one after it */
+    void launch_next()
+    {
+        uint32_t now = wf::get_current_time();
+        bool any_pending = false;
+        for (auto& entry : entries)
+        {
+            if (entry.launched)
+                continue;
+
+            any_pending = true;
+            if (is_ready(entry, now))
+            {
+                launch(entry);
+                schedule_launch();
+                return;
+            }
+        }
+
+        if (!any_pending)
+            return;
+
+        /* Wait until the earliest dependency times out, a mapped view
+         * reschedules earlier */
+        const uint32_t timeout = std::max((int)dependency_timeout, 0);
+        uint32_t wait = timeout;
+        bool waiting = false;
+        for (auto& entry : entries)
+        {
+            if (!entry.launched || entry.mapped)
+                continue;
+
+            uint32_t elapsed = now - entry.launch_time;
+            if (elapsed < timeout)
+            {
+                wait = std::min(wait, timeout - elapsed);
+                waiting = true;
+            }
+        }
+
+        if (waiting)
+        {
+            timeout_launch.set_timeout(std::max(wait, 1u), [=] ()
+            {
+                launch_next();
+            });
+
+            return;
+        }
+
+        /* Nothing can become ready, so the dependencies form a cycle */
+        for (auto& entry : entries)
+        {
+            if (!entry.launched)
+            {
+                LOGE("autostart: cyclic dependencies, starting ", entry.name);
+                launch(entry);
+                schedule_launch();
+                return;
+            }
+        }
+    }
+
+    void schedule_launch()
+    {
+        timeout_launch.disconnect();
+        idle_launch.run_once();
+    }
+
+    /** @return The parent of the given process, or -1 if it is not known */
+    static pid_t get_parent_pid(pid_t pid)
+    {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        if (!std::getline(stat, line))
+            return -1;
+
+        /* The process name is in parentheses and may contain spaces */
+        auto name_end = line.rfind(')');
+        if (name_end == std::string::npos)
+            return -1;
+
+        std::istringstream fields{line.substr(name_end + 1)};
+        std::string state;
+        pid_t ppid = -1;
+        fields >> state >> ppid;
+        return ppid;
+    }
+
+    /** @return The entry which started the given process, directly or from
+     * a shell or a launcher script */
+    autostart_entry_t *find_entry_for_pid(pid_t pid)
+    {
+        const int max_depth = 4;
+        for (int i = 0; i < max_depth && pid > 1; i++)
+        {
+            for (auto& entry : entries)
+            {
+                if (entry.launched && entry.pid == pid)
+                    return &entry;
+            }
+
+            pid = get_parent_pid(pid);
+        }
+
+        return nullptr;
+    }
+
+    wf::signal_callback_t on_view_mapped = [=] (wf::signal_data_t *data)
+    {
+        auto view = wf::get_signaled_view(data);
+        auto client = view->get_client();
+        if (!client)
+            return;
+
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+        wl_client_get_credentials(client, &pid, &uid, &gid);
+
+        auto entry = find_entry_for_pid(pid);
+        if (!entry || entry->mapped)
+            return;
+
+        entry->mapped = true;
+        uint32_t now = wf::get_current_time();
+        LOGI("autostart: ", entry->name, " mapped its first view at +",
+            now - start_time, "ms, ", now - entry->launch_time,
+            "ms after its launch");
+
+        bool all_mapped = true;
+        for (auto& e : entries)
+            all_mapped &= e.mapped;
+
+        if (all_mapped)
+            wf::get_core().disconnect_signal("view-mapped", &on_view_mapped);
+
+        /* Entries waiting for this one can start now */
+        if (!idle_launch.is_connected())
+            schedule_launch();
+    };
 
   public:
     wayfire_autostart()
     {
         /* Run only once, at startup */
+        start_time = wf::get_current_time();
         auto section = wf::get_core().config.get_section("autostart");
 
         bool panel_manually_started = false;
         bool background_manually_started = false;
 
+        std::vector<std::pair<std::string, std::string>> dependencies;
         for (const auto& command : section->get_registered_options())
         {
-            auto cmd = command->get_value_str();
-            wf::get_core().run(cmd);
+            auto name = command->get_name();
+            auto cmd  = command->get_value_str();
+            /* The plugin's own options are in the same section */
+            if ((name == "autostart_wf_shell") || (name == "dependency_timeout"))
+                continue;
+
+            if (ends_with(name, after_suffix))
+            {
+                name.resize(name.size() - std::string(after_suffix).size());
+                dependencies.push_back({name, cmd});
+                continue;
+            }
+
+            entries.push_back({name, cmd});
 
             if (cmd.find("wf-panel") != std::string::npos)
                 panel_manually_started = true;
@@ -28,10 +274,41 @@ class wayfire_autostart
                 background_manually_started = true;
         }
 
+        for (auto& [name, list] : dependencies)
+        {
+            auto entry = find_entry(name);
+            if (!entry)
+            {
+                LOGE("autostart: dependencies for unknown entry ", name);
+                continue;
+            }
+
+            std::istringstream deps{list};
+            std::string dep;
+            while (deps >> dep)
+            {
+                if (!find_entry(dep))
+                    LOGE("autostart: ", name, " depends on unknown entry ", dep);
+                entry->after.push_back(dep);
+            }
+        }
+
         if (autostart_wf_shell && !panel_manually_started)
-            wf::get_core().run(INSTALL_PREFIX "/bin/wf-panel");
+            entries.push_back({"wf-panel", INSTALL_PREFIX "/bin/wf-panel"});
         if (autostart_wf_shell && !background_manually_started)
-            wf::get_core().run(INSTALL_PREFIX "/bin/wf-background");
+            entries.push_back({"wf-background", INSTALL_PREFIX "/bin/wf-background"});
+
+        if (entries.empty())
+            return;
+
+        wf::get_core().connect_signal("view-mapped", &on_view_mapped);
+        idle_launch.set_callback([=] () { launch_next(); });
+        idle_launch.run_once();
+    }
+
+    ~wayfire_autostart()
+    {
+        wf::get_core().disconnect_signal("view-mapped", &on_view_mapped);
     }
 };
 
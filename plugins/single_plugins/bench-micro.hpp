@@ -0,0 +1,267 @@
+#pragma once
+
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/geometry.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/nonstd/safe-list.hpp>
+#include "../matcher/matcher.hpp"
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <vector>
+
+/**
+ * Micro-benchmarks of the data structures on the hot paths of the core. They
+ * run inside the compositor, so they measure the real implementations with
+ * the build flags of the compositor.
+ *
+ * Each case runs for at least min_msec, and its average time per call is
+ * reported.
+ */
+namespace bench_micro
+{
+class runner_t
+{
+    std::ostringstream report;
+    int min_msec;
+
+  public:
+    runner_t(int min_msec) : min_msec(min_msec) {}
+
+    /* Results of the benchmarked calls are written here, so that the
+     * compiler can't drop the calls */
+    volatile int64_t sink = 0;
+
+    /** Call func repeatedly and report the average time of a call */
+    void run(const std::string& name, const std::function<void()>& func)
+    {
+        using clock = std::chrono::steady_clock;
+        auto deadline = std::chrono::milliseconds(std::max(min_msec, 1));
+
+        /* Warm up the caches first */
+        func();
+
+        int64_t iterations = 0;
+        auto start = clock::now();
+        auto elapsed = clock::duration::zero();
+        int64_t batch = 1;
+        while (elapsed < deadline)
+        {
+            for (int64_t i = 0; i < batch; i++)
+                func();
+
+            iterations += batch;
+            batch *= 2;
+            elapsed = clock::now() - start;
+        }
+
+        double nsec = std::chrono::duration<double, std::nano>(elapsed).count();
+        report << "  " << name << ": " << nsec / iterations << " ns\n";
+    }
+
+    /** Add a line to the report */
+    void note(const std::string& text)
+    {
+        report << "  " << text << "\n";
+    }
+
+    std::string get_report() const
+    {
+        return report.str();
+    }
+};
+
+/** @return A list of random boxes inside a 1920x1080 output */
+inline std::vector<wf::geometry_t> random_boxes(int count, int max_size,
+    std::mt19937& random)
+{
+    std::uniform_int_distribution<int> size(1, max_size);
+    std::uniform_int_distribution<int> x(0, 1920 - max_size);
+    std::uniform_int_distribution<int> y(0, 1080 - max_size);
+
+    std::vector<wf::geometry_t> boxes;
+    for (int i = 0; i < count; i++)
+        boxes.push_back({x(random), y(random), size(random), size(random)});
+
+    return boxes;
+}
+
+inline void bench_geometry(runner_t& runner, std::mt19937& random)
+{
+    auto boxes = random_boxes(256, 400, random);
+    runner.run("geometry_intersection x256", [&] ()
+    {
+        int64_t area = 0;
+        for (size_t i = 1; i < boxes.size(); i++)
+        {
+            auto r = wf::geometry_intersection(boxes[i - 1], boxes[i]);
+            area += r.width * r.height;
+        }
+
+        runner.sink = area;
+    });
+
+    runner.run("geometry & geometry x256", [&] ()
+    {
+        int64_t count = 0;
+        for (size_t i = 1; i < boxes.size(); i++)
+            count += boxes[i - 1] & boxes[i];
+
+        runner.sink = count;
+    });
+}
+
+inline void bench_region(runner_t& runner, std::mt19937& random)
+{
+    for (int count : {1, 16, 256})
+    {
+        auto boxes = random_boxes(count, 200, random);
+        wf::region_t region;
+        for (auto& box : boxes)
+            region |= box;
+
+        wf::region_t other;
+        for (auto& box : random_boxes(count, 200, random))
+            other |= box;
+
+        std::string suffix = " (" + std::to_string(count) + " boxes)";
+        runner.run("region |= box" + suffix, [&] ()
+        {
+            wf::region_t result;
+            for (auto& box : boxes)
+                result |= box;
+
+            runner.sink = result.empty();
+        });
+
+        runner.run("region & region" + suffix, [&] ()
+        {
+            runner.sink = (region & other).empty();
+        });
+
+        runner.run("region ^ region" + suffix, [&] ()
+        {
+            runner.sink = (region ^ other).empty();
+        });
+
+        runner.run("region iteration" + suffix, [&] ()
+        {
+            int64_t area = 0;
+            for (const auto& box : region)
+                area += (box.x2 - box.x1) * (box.y2 - box.y1);
+
+            runner.sink = area;
+        });
+    }
+}
+
+inline void bench_safe_list(runner_t& runner)
+{
+    for (int count : {16, 1024})
+    {
+        std::string suffix = " (" + std::to_string(count) + " elements)";
+        wf::safe_list_t<int> list;
+        for (int i = 0; i < count; i++)
+            list.push_back(i);
+
+        runner.run("safe_list_t::for_each" + suffix, [&] ()
+        {
+            int64_t sum = 0;
+            list.for_each([&] (int value) { sum += value; });
+            runner.sink = sum;
+        });
+
+        /* Every other element is removed while the list is iterated, and
+         * added back afterwards */
+        runner.run("safe_list_t::for_each + remove" + suffix, [&] ()
+        {
+            list.for_each([&] (int value)
+            {
+                if (value % 2)
+                    list.remove_all(value);
+            });
+
+            for (int i = 1; i < count; i += 2)
+                list.push_back(i);
+        });
+    }
+}
+
+inline void bench_signals(runner_t& runner)
+{
+    for (int count : {1, 16, 256})
+    {
+        wf::signal_provider_t provider;
+        int64_t calls = 0;
+        std::vector<wf::signal_callback_t> callbacks(count,
+            [&] (wf::signal_data_t*) { ++calls; });
+        for (auto& callback : callbacks)
+            provider.connect_signal("bench", &callback);
+
+        runner.run("emit_signal (" + std::to_string(count) + " connections)",
+            [&] () { provider.emit_signal("bench", nullptr); });
+        runner.sink = calls;
+
+        for (auto& callback : callbacks)
+            provider.disconnect_signal("bench", &callback);
+    }
+}
+
+/**
+ * @param create_view Creates a mapped view in the workspace layer of the
+ *   output with the given geometry.
+ */
+inline void bench_views(runner_t& runner, wf::output_t *output,
+    const std::vector<int>& view_counts, std::mt19937& random,
+    const std::function<wayfire_view(wf::geometry_t)>& create_view)
+{
+    /* The default of animate/enabled_for */
+    auto matcher_option =
+        std::make_shared<wf::config::option_t<std::string>>("bench_matcher",
+            "(type is toplevel || (type is x-or && focuseable is true))");
+    auto matcher = wf::matcher::get_matcher(matcher_option);
+
+    for (int count : view_counts)
+    {
+        std::vector<wayfire_view> views;
+        for (auto& box : random_boxes(count, 400, random))
+            views.push_back(create_view(box));
+
+        std::string suffix = " (" + std::to_string(count) + " views)";
+        auto ws = output->workspace->get_current_workspace();
+        runner.run("get_views_in_layer" + suffix, [&] ()
+        {
+            runner.sink = output->workspace->get_views_in_layer(
+                wf::ALL_LAYERS).size();
+        });
+
+        runner.run("get_views_on_workspace" + suffix, [&] ()
+        {
+            runner.sink = output->workspace->get_views_on_workspace(ws,
+                wf::MIDDLE_LAYERS, true).size();
+        });
+
+        if (matcher)
+        {
+            runner.run("matcher evaluate" + suffix, [&] ()
+            {
+                int64_t matched = 0;
+                for (auto& view : views)
+                    matched += wf::matcher::evaluate(matcher, view);
+
+                runner.sink = matched;
+            });
+        }
+
+        for (auto& view : views)
+            view->close();
+    }
+
+    if (!matcher)
+        runner.note("matcher evaluate: skipped, the matcher plugin is not loaded");
+}
+}
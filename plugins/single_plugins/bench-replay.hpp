@@ -0,0 +1,334 @@
+#pragma once
+
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/view.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/util/log.hpp>
+#include "session-trace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <vector>
+
+extern "C"
+{
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_pointer.h>
+}
+
+/**
+ * Replays a trace recorded by the recorder plugin, see session-trace.hpp.
+ *
+ * The views of the trace are replaced by windows created by the bench
+ * plugin, which are moved, resized, damaged and closed at the recorded times.
+ * The input events are sent through virtual devices of the headless backend,
+ * so they go through the same paths in the core as real input.
+ */
+namespace bench_replay
+{
+/** Virtual input devices, shared by all replays */
+struct devices_t
+{
+    wlr_input_device *pointer = nullptr;
+    wlr_input_device *keyboard = nullptr;
+
+    static devices_t& get()
+    {
+        static devices_t devices;
+        return devices;
+    }
+
+    /** @return Whether the devices exist, i.e the headless backend is used */
+    bool ensure()
+    {
+        if (pointer && keyboard)
+            return true;
+
+        auto backend = find_headless(wf::get_core().backend);
+        if (!backend)
+            return false;
+
+        pointer = wlr_headless_add_input_device(backend, WLR_INPUT_DEVICE_POINTER);
+        keyboard = wlr_headless_add_input_device(backend,
+            WLR_INPUT_DEVICE_KEYBOARD);
+        return pointer && keyboard;
+    }
+
+  private:
+    static wlr_backend *find_headless(wlr_backend *backend)
+    {
+        if (wlr_backend_is_headless(backend))
+            return backend;
+
+        wlr_backend *found = nullptr;
+        if (wlr_backend_is_multi(backend))
+        {
+            wlr_multi_for_each_backend(backend, [] (wlr_backend *b, void *data)
+            {
+                if (wlr_backend_is_headless(b))
+                    *static_cast<wlr_backend**>(data) = b;
+            }, &found);
+        }
+
+        return found;
+    }
+};
+
+class player_t
+{
+  public:
+    using create_view_t = std::function<wayfire_view(wf::geometry_t)>;
+
+    player_t(create_view_t create_view) : create_view(create_view) {}
+
+    ~player_t()
+    {
+        stop();
+    }
+
+    /**
+     * Load the events of the trace which concern the given output.
+     *
+     * @param output The name of the output to replay on.
+     * @param primary Whether this is the first output of the layout. Its
+     *   player also replays the input, and the first output of the trace if
+     *   no output of the trace has its name.
+     *
+     * @return false if the trace can't be read.
+     */
+    bool load(const std::string& path, const std::string& output, bool primary)
+    {
+        std::ifstream in{path};
+        if (!in)
+        {
+            LOGE("bench: failed to open the trace ", path);
+            return false;
+        }
+
+        std::vector<session_trace::event_t> all;
+        std::vector<std::string> trace_outputs;
+        std::string line;
+        session_trace::event_t event;
+        while (std::getline(in, line))
+        {
+            if (!session_trace::parse(line, event))
+                continue;
+
+            if (!event.output.empty() &&
+                (std::find(trace_outputs.begin(), trace_outputs.end(),
+                    event.output) == trace_outputs.end()))
+            {
+                trace_outputs.push_back(event.output);
+            }
+
+            all.push_back(event);
+        }
+
+        std::string target = output;
+        if (primary && !trace_outputs.empty() &&
+            (std::find(trace_outputs.begin(), trace_outputs.end(), output) ==
+             trace_outputs.end()))
+        {
+            target = trace_outputs.front();
+        }
+
+        replay_input = primary;
+        for (auto& e : all)
+        {
+            if (e.output.empty() ? replay_input : (e.output == target))
+                events.push_back(std::move(e));
+        }
+
+        return true;
+    }
+
+    /** Start replaying, done is called after the last event */
+    void start(std::function<void()> done)
+    {
+        this->done = done;
+        if (replay_input && !devices_t::get().ensure())
+        {
+            LOGE("bench: the input of the trace can only be replayed on the "
+                 "headless backend");
+            replay_input = false;
+        }
+
+        start_time = wf::get_current_time();
+        next = 0;
+        schedule();
+    }
+
+    /** Stop replaying and close the views */
+    void stop()
+    {
+        timer.disconnect();
+        for (auto& [id, view] : views)
+            view->close();
+
+        views.clear();
+    }
+
+    /** @return A summary of the frame times of the recording */
+    std::string get_report() const
+    {
+        std::ostringstream out;
+        out << "recorded: " << recorded_frames.size() << " frames";
+        if (recorded_frames.empty())
+            return out.str() + "\n";
+
+        auto sorted = recorded_frames;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (auto& usec : sorted)
+            sum += usec;
+
+        out << ", total mean " << sum / sorted.size() / 1000.0
+            << " ms p50 " << sorted[sorted.size() / 2] / 1000.0
+            << " ms p99 " << sorted[sorted.size() * 99 / 100] / 1000.0
+            << " ms max " << sorted.back() / 1000.0 << " ms\n";
+        return out.str();
+    }
+
+  private:
+    create_view_t create_view;
+    std::function<void()> done;
+
+    std::vector<session_trace::event_t> events;
+    bool replay_input = false;
+    size_t next = 0;
+    uint32_t start_time = 0;
+    wf::wl_timer timer;
+
+    /* The views of the trace, by their id in the trace */
+    std::map<uint32_t, wayfire_view> views;
+    std::vector<double> recorded_frames;
+
+    void schedule()
+    {
+        if (next >= events.size())
+        {
+            stop();
+            done();
+            return;
+        }
+
+        uint32_t elapsed = wf::get_current_time() - start_time;
+        uint32_t due = events[next].time;
+        timer.set_timeout(due > elapsed ? due - elapsed : 0, [=] ()
+        {
+            /* Everything which is due by now */
+            uint32_t elapsed = wf::get_current_time() - start_time;
+            while ((next < events.size()) && (events[next].time <= elapsed))
+                play(events[next++]);
+
+            schedule();
+        });
+    }
+
+    void play(const session_trace::event_t& event)
+    {
+        auto& a = event.args;
+        uint32_t id = a.empty() ? 0 : a[0];
+        if (event.type == "view")
+        {
+            auto it = views.find(id);
+            if (it == views.end())
+                views[id] = create_view(event.get_box(1));
+            else
+                it->second->set_geometry(event.get_box(1));
+        } else if (event.type == "damage")
+        {
+            auto it = views.find(id);
+            if (it != views.end())
+                it->second->damage_surface_box(event.get_box(1));
+        } else if (event.type == "close")
+        {
+            auto it = views.find(id);
+            if (it != views.end())
+            {
+                it->second->close();
+                views.erase(it);
+            }
+        } else if (event.type == "frame")
+        {
+            recorded_frames.push_back(a[0]);
+        } else
+        {
+            play_input(event);
+        }
+    }
+
+    void play_input(const session_trace::event_t& event)
+    {
+        if (!replay_input)
+            return;
+
+        auto& devices = devices_t::get();
+        auto& a = event.args;
+        uint32_t time = wf::get_current_time();
+        auto pointer = devices.pointer->pointer;
+
+        if (event.type == "key")
+        {
+            wlr_event_keyboard_key ev;
+            ev.time_msec = time;
+            ev.keycode = a[0];
+            ev.update_state = true;
+            ev.state = (wlr_key_state)a[1];
+            wlr_keyboard_notify_key(devices.keyboard->keyboard, &ev);
+            return;
+        }
+
+        if (event.type == "button")
+        {
+            wlr_event_pointer_button ev;
+            ev.device = devices.pointer;
+            ev.time_msec = time;
+            ev.button = a[0];
+            ev.state = (wlr_button_state)a[1];
+            wl_signal_emit(&pointer->events.button, &ev);
+        } else if (event.type == "motion")
+        {
+            wlr_event_pointer_motion ev;
+            ev.device = devices.pointer;
+            ev.time_msec = time;
+            ev.delta_x = ev.unaccel_dx = a[0];
+            ev.delta_y = ev.unaccel_dy = a[1];
+            wl_signal_emit(&pointer->events.motion, &ev);
+        } else if (event.type == "motion_absolute")
+        {
+            wlr_event_pointer_motion_absolute ev;
+            ev.device = devices.pointer;
+            ev.time_msec = time;
+            ev.x = a[0];
+            ev.y = a[1];
+            wl_signal_emit(&pointer->events.motion_absolute, &ev);
+        } else if (event.type == "axis")
+        {
+            wlr_event_pointer_axis ev;
+            ev.device = devices.pointer;
+            ev.time_msec = time;
+            ev.orientation = (wlr_axis_orientation)a[0];
+            ev.delta = a[1];
+            ev.delta_discrete = a[2];
+            ev.source = (wlr_axis_source)a[3];
+            wl_signal_emit(&pointer->events.axis, &ev);
+        } else
+        {
+            return;
+        }
+
+        /* Each recorded pointer event is a frame of its own */
+        wl_signal_emit(&pointer->events.frame, pointer);
+    }
+};
+}
@@ -0,0 +1,369 @@
+#include <wayfire/plugin.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/compositor-view.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/frame-stats.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/util/log.hpp>
+#include "../blur/blur-benchmark-signal.hpp"
+#include "bench-micro.hpp"
+#include "bench-replay.hpp"
+
+#include <cmath>
+#include <memory>
+#include <sstream>
+
+/**
+ * A colored window which looks like a regular toplevel to the other plugins:
+ * it is in the workspace layer and emits the map signal, so that open and
+ * close animations, blur, decorations etc. apply to it.
+ */
+class bench_view_t : public wf::color_rect_view_t
+{
+  public:
+    bench_view_t(wf::output_t *output, wf::geometry_t geometry, wf::color_t color)
+        : wf::color_rect_view_t()
+    {
+        set_output(output);
+        set_geometry(geometry);
+        set_color(color);
+        set_border_color({0, 0, 0, 1});
+        set_border(2);
+    }
+
+    void initialize() override
+    {
+        wf::color_rect_view_t::initialize();
+        emit_view_map();
+    }
+};
+
+/**
+ * Runs scripted rendering scenarios and prints the frame statistics of the
+ * output after each of them. Meant to be used in a headless session, for ex.
+ * WLR_BACKENDS=headless wayfire -c bench.ini, with bench and the plugins to
+ * measure in core/plugins.
+ *
+ * Available scenarios:
+ * damage - all windows are damaged on each frame
+ * move - all windows move on each frame
+ * close - the windows are closed one after another
+ * blur - the blur plugin measures its methods on a test image, see the
+ *   bench/blur_* options
+ * micro - micro-benchmarks of regions, geometry helpers, safe lists,
+ *   signals, view lists and the matcher, see bench-micro.hpp
+ * replay - replays bench/replay_file, a trace recorded by the recorder
+ *   plugin, see bench-replay.hpp
+ */
+class wayfire_bench : public wf::plugin_interface_t
+{
+    wf::option_wrapper_t<int> window_count{"bench/windows"};
+    wf::option_wrapper_t<std::string> scenarios{"bench/scenarios"};
+    wf::option_wrapper_t<int> duration{"bench/duration"};
+    wf::option_wrapper_t<bool> exit_when_done{"bench/exit_when_done"};
+
+    wf::option_wrapper_t<std::string> blur_methods{"bench/blur_methods"};
+    wf::option_wrapper_t<std::string> blur_sizes{"bench/blur_sizes"};
+    wf::option_wrapper_t<std::string> blur_offsets{"bench/blur_offsets"};
+    wf::option_wrapper_t<std::string> blur_iterations{"bench/blur_iterations"};
+    wf::option_wrapper_t<std::string> blur_degrades{"bench/blur_degrades"};
+    wf::option_wrapper_t<int> blur_repeat{"bench/blur_repeat"};
+
+    wf::option_wrapper_t<std::string> micro_view_counts{"bench/micro_view_counts"};
+    wf::option_wrapper_t<int> micro_min_time{"bench/micro_min_time"};
+    wf::option_wrapper_t<std::string> replay_file{"bench/replay_file"};
+
+    std::vector<std::string> pending;
+    std::string current;
+    bool running = false;
+
+    std::vector<wayfire_view> views;
+    std::vector<wf::geometry_t> base_geometry;
+    std::unique_ptr<bench_replay::player_t> player;
+    uint32_t frame = 0;
+    uint32_t last_close = 0;
+
+    wf::wl_idle_call idle_start;
+    wf::wl_timer scenario_timer;
+    wf::effect_hook_t pre_hook;
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "bench";
+        grab_interface->capabilities = 0;
+
+        std::istringstream stream{(std::string)scenarios};
+        std::string name;
+        while (stream >> name)
+            pending.push_back(name);
+
+        pre_hook = [=] () { step(); };
+
+        /* Start once the event loop runs, so that all plugins are loaded */
+        idle_start.run_once([=] () { next_scenario(); });
+    }
+
+    void next_scenario()
+    {
+        if (pending.empty())
+        {
+            LOGI("bench: finished on ", output->to_string());
+            if (exit_when_done)
+                wf::get_core().shutdown();
+
+            return;
+        }
+
+        current = pending.front();
+        pending.erase(pending.begin());
+        if (current == "blur")
+        {
+            run_blur_benchmark();
+            return next_scenario();
+        }
+
+        if (current == "micro")
+        {
+            run_micro_benchmarks();
+            return next_scenario();
+        }
+
+        if (current == "replay")
+        {
+            if (!start_replay())
+                return next_scenario();
+
+            return;
+        }
+
+        if (current != "damage" && current != "move" && current != "close")
+        {
+            LOGE("bench: unknown scenario ", current);
+            return next_scenario();
+        }
+
+        create_views();
+        frame = 0;
+        last_close = wf::get_current_time();
+
+        output->render->reset_frame_stats();
+        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+        output->render->set_redraw_always();
+        running = true;
+
+        scenario_timer.set_timeout(std::max((int)duration, 1),
+            [=] () { end_scenario(); });
+    }
+
+    /** @return The values in the space-separated list */
+    template<class T>
+    static std::vector<T> parse_list(const std::string& list)
+    {
+        std::istringstream stream{list};
+        std::vector<T> values;
+        T value;
+        while (stream >> value)
+            values.push_back(value);
+
+        return values;
+    }
+
+    void run_blur_benchmark()
+    {
+        blur_benchmark_signal data;
+        data.methods = parse_list<std::string>(blur_methods);
+        data.offsets = parse_list<double>(blur_offsets);
+        data.iterations = parse_list<int>(blur_iterations);
+        data.degrades = parse_list<int>(blur_degrades);
+        data.repeat = blur_repeat;
+        for (auto& size : parse_list<std::string>(blur_sizes))
+        {
+            wf::dimensions_t dims;
+            char x;
+            std::istringstream stream{size};
+            if ((stream >> dims.width >> x >> dims.height) && (x == 'x') &&
+                (dims.width > 0) && (dims.height > 0))
+            {
+                data.sizes.push_back(dims);
+            } else
+            {
+                LOGE("bench: invalid blur size ", size);
+            }
+        }
+
+        output->emit_signal("blur-benchmark", &data);
+        if (!data.carried_out)
+        {
+            LOGE("bench: the blur plugin is not enabled on ",
+                output->to_string());
+            return;
+        }
+
+        LOGI("bench: scenario blur:\n", data.report);
+    }
+
+    void run_micro_benchmarks()
+    {
+        bench_micro::runner_t runner{micro_min_time};
+        /* Fixed, so that runs can be compared */
+        std::mt19937 random{1};
+
+        bench_micro::bench_geometry(runner, random);
+        bench_micro::bench_region(runner, random);
+        bench_micro::bench_safe_list(runner);
+        bench_micro::bench_signals(runner);
+        bench_micro::bench_views(runner, output,
+            parse_list<int>(micro_view_counts), random,
+            [=] (wf::geometry_t geometry)
+        {
+            auto view = new bench_view_t(output, geometry, {0.5, 0.5, 0.5, 1});
+            wf::get_core().add_view(std::unique_ptr<wf::view_interface_t>(view));
+            return view->self();
+        });
+
+        LOGI("bench: scenario micro:\n", runner.get_report());
+    }
+
+    bool start_replay()
+    {
+        player = std::make_unique<bench_replay::player_t>(
+            [=] (wf::geometry_t geometry)
+        {
+            auto view = new bench_view_t(output, geometry, {0.5, 0.5, 0.5, 1});
+            wf::get_core().add_view(std::unique_ptr<wf::view_interface_t>(view));
+            return view->self();
+        });
+
+        auto outputs = wf::get_core().output_layout->get_outputs();
+        if (!player->load(replay_file, output->handle->name,
+            !outputs.empty() && (outputs.front() == output)))
+        {
+            player.reset();
+            return false;
+        }
+
+        /* The frames are driven by the recorded damage only */
+        output->render->reset_frame_stats();
+        player->start([=] ()
+        {
+            /* Not from within the player */
+            idle_start.run_once([=] () { end_replay(); });
+        });
+
+        return true;
+    }
+
+    void end_replay()
+    {
+        LOGI("bench: scenario replay on ", output->to_string(), ":\n",
+            output->render->get_frame_stats().to_string(),
+            player->get_report());
+        player.reset();
+        next_scenario();
+    }
+
+    void end_scenario()
+    {
+        stop();
+        LOGI("bench: scenario ", current, " with ", (int)window_count,
+            " windows on ", output->to_string(), ":\n",
+            output->render->get_frame_stats().to_string());
+
+        next_scenario();
+    }
+
+    void stop()
+    {
+        if (!running)
+            return;
+
+        output->render->rem_effect(&pre_hook);
+        output->render->set_redraw_always(false);
+        running = false;
+
+        for (auto& view : views)
+            view->close();
+
+        views.clear();
+        base_geometry.clear();
+    }
+
+    /** Create the windows in a grid covering the workarea */
+    void create_views()
+    {
+        int count = std::max((int)window_count, 1);
+        int columns = std::ceil(std::sqrt(count));
+        int rows = (count + columns - 1) / columns;
+
+        auto workarea = output->workspace->get_workarea();
+        int cell_width = workarea.width / columns;
+        int cell_height = workarea.height / rows;
+
+        for (int i = 0; i < count; i++)
+        {
+            wf::geometry_t geometry = {
+                workarea.x + (i % columns) * cell_width + cell_width / 8,
+                workarea.y + (i / columns) * cell_height + cell_height / 8,
+                cell_width * 3 / 4,
+                cell_height * 3 / 4,
+            };
+
+            double hue = 1.0 * i / count;
+            wf::color_t color = {
+                0.5 + 0.5 * std::cos(2 * M_PI * hue),
+                0.5 + 0.5 * std::cos(2 * M_PI * (hue - 1.0 / 3)),
+                0.5 + 0.5 * std::cos(2 * M_PI * (hue - 2.0 / 3)),
+                1.0,
+            };
+
+            auto view = new bench_view_t(output, geometry, color);
+            views.push_back(view->self());
+            base_geometry.push_back(geometry);
+            wf::get_core().add_view(std::unique_ptr<wf::view_interface_t>(view));
+        }
+    }
+
+    /** Update the scene for the next frame */
+    void step()
+    {
+        if (current == "damage")
+        {
+            for (auto& view : views)
+                view->damage();
+        } else if (current == "move")
+        {
+            for (size_t i = 0; i < views.size(); i++)
+            {
+                double t = 0.05 * frame + i;
+                views[i]->move(base_geometry[i].x + 50 * std::sin(t),
+                    base_geometry[i].y + 50 * std::cos(t));
+            }
+        } else if (current == "close")
+        {
+            uint32_t interval = duration / (base_geometry.size() + 1);
+            uint32_t now = wf::get_current_time();
+            if (!views.empty() && now - last_close >= interval)
+            {
+                views.back()->close();
+                views.pop_back();
+                last_close = now;
+            }
+        }
+
+        ++frame;
+    }
+
+    void fini() override
+    {
+        stop();
+        player.reset();
+        scenario_timer.disconnect();
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_bench);
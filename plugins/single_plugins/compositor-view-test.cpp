@@ -1,73 +1,312 @@
-#include "wayfire/compositor-view.hpp"
-#include "wayfire/render-manager.hpp"
-#include "wayfire/output.hpp"
-#include "wayfire/core.hpp"
-#include "wayfire/debug.hpp"
+#include <wayfire/plugin.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/compositor-view.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/view-transform.hpp>
+#include <wayfire/frame-stats.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/util/log.hpp>
 
-extern "C"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <random>
+
+/**
+ * A colored window in the workspace layer, which lets other plugins treat it
+ * as a regular toplevel.
+ */
+class cvtest_view_t : public wf::color_rect_view_t
 {
-#define static
-#include <wlr/render/wlr_renderer.h>
-#include <wlr/types/wlr_matrix.h>
-#include <wlr/types/wlr_xcursor_manager.h>
-#undef static
-}
-
-class test_view : public wayfire_compositor_view_t, public wayfire_compositor_interactive_view
+  public:
+    cvtest_view_t(wf::output_t *output, wf::geometry_t geometry, wf::color_t color)
+        : wf::color_rect_view_t()
+    {
+        set_output(output);
+        set_geometry(geometry);
+        set_color(color);
+        set_border_color({0, 0, 0, 1});
+        set_border(2);
+    }
+
+    void initialize() override
+    {
+        wf::color_rect_view_t::initialize();
+        emit_view_map();
+    }
+};
+
+/**
+ * Fills the output with synthetic compositor views, to reproduce heavy scenes
+ * without real clients. The scene is toggled with cvtest/toggle, or created
+ * on startup with cvtest/start_on_load, and rebuilt whenever one of its
+ * options changes, so it can be scripted by editing the config file. While
+ * the scene is shown, the frame statistics of the output are logged every
+ * cvtest/report_interval milliseconds.
+ *
+ * Damage patterns:
+ * none - the views are only damaged when they move
+ * full - each view is damaged as a whole on every frame
+ * rects - a few random small rectangles of each view are damaged
+ * scroll - a band of a quarter of each view moves down the view, like a
+ *   scrolled list
+ */
+class wayfire_cvtest : public wf::plugin_interface_t
 {
-    public:
-        virtual void _wlr_render_box(const wf::framebuffer_t& fb, int x, int y, const wlr_box& scissor)
+    wf::option_wrapper_t<wf::activatorbinding_t> toggle_key{"cvtest/toggle"};
+    wf::option_wrapper_t<int> view_count{"cvtest/views"};
+    wf::option_wrapper_t<int> min_size{"cvtest/min_size"};
+    wf::option_wrapper_t<int> max_size{"cvtest/max_size"};
+    wf::option_wrapper_t<std::string> damage_pattern{"cvtest/damage"};
+    wf::option_wrapper_t<int> damage_rects{"cvtest/damage_rects"};
+    wf::option_wrapper_t<double> alpha{"cvtest/alpha"};
+    wf::option_wrapper_t<std::string> transformer{"cvtest/transformer"};
+    wf::option_wrapper_t<bool> movement{"cvtest/movement"};
+    wf::option_wrapper_t<int> report_interval{"cvtest/report_interval"};
+    wf::option_wrapper_t<int> seed{"cvtest/seed"};
+    wf::option_wrapper_t<bool> start_on_load{"cvtest/start_on_load"};
+
+    static constexpr const char *transformer_name = "cvtest";
+
+    struct test_view_t
+    {
+        wayfire_view view;
+        wf::geometry_t base;
+        double phase;
+    };
+
+    std::vector<test_view_t> views;
+    std::mt19937 random;
+    uint32_t frame = 0;
+    bool active = false;
+
+    wf::activator_callback toggle_cb;
+    wf::effect_hook_t pre_hook;
+    wf::wl_idle_call idle_start;
+    wf::wl_timer report_timer;
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "cvtest";
+        grab_interface->capabilities = 0;
+
+        toggle_cb = [=] (wf::activator_source_t, uint32_t)
+        {
+            if (active)
+                stop();
+            else
+                start();
+
+            return true;
+        };
+        output->add_activator(toggle_key, &toggle_cb);
+
+        pre_hook = [=] () { step(); };
+
+        auto restart = [=] ()
+        {
+            if (active)
+            {
+                stop();
+                start();
+            }
+        };
+
+        view_count.set_callback(restart);
+        min_size.set_callback(restart);
+        max_size.set_callback(restart);
+        alpha.set_callback(restart);
+        transformer.set_callback(restart);
+        seed.set_callback(restart);
+
+        /* Start once the event loop runs, so that all plugins are loaded */
+        if (start_on_load)
+            idle_start.run_once([=] () { start(); });
+    }
+
+    void start()
+    {
+        if (active)
+            return;
+
+        random.seed(seed);
+        create_views();
+        frame = 0;
+
+        output->render->reset_frame_stats();
+        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+        output->render->set_redraw_always();
+        active = true;
+        schedule_report();
+
+        LOGI("cvtest: showing ", views.size(), " views on ", output->to_string());
+    }
+
+    void stop()
+    {
+        if (!active)
+            return;
+
+        report();
+        report_timer.disconnect();
+        output->render->rem_effect(&pre_hook);
+        output->render->set_redraw_always(false);
+        active = false;
+
+        for (auto& v : views)
+            v.view->close();
+
+        views.clear();
+    }
+
+    void schedule_report()
+    {
+        if (report_interval <= 0)
+            return;
+
+        report_timer.set_timeout(report_interval, [=] ()
         {
-            wlr_box g {x, y, geometry.width, geometry.height};
-            geometry = fb.damage_box_from_geometry_box(g);
+            report();
+            output->render->reset_frame_stats();
+            schedule_report();
+        });
+    }
 
-            float projection[9];
-            wlr_matrix_projection(projection, fb.viewport_width, fb.viewport_height,
-                (wl_output_transform)fb.wl_transform);
+    void report()
+    {
+        LOGI("cvtest: ", views.size(), " views, damage ",
+            (std::string)damage_pattern, ", transformer ",
+            (std::string)transformer, " on ", output->to_string(), ":\n",
+            output->render->get_frame_stats().to_string());
+    }
 
-            float matrix[9];
-            wlr_matrix_project_box(matrix, &g, WL_OUTPUT_TRANSFORM_NORMAL, 0, projection);
+    int random_int(int min, int max)
+    {
+        return std::uniform_int_distribution<int>(min, std::max(min, max))(random);
+    }
+
+    void create_views()
+    {
+        auto workarea = output->workspace->get_workarea();
+        int smallest = std::max((int)min_size, 1);
+        int largest = std::max((int)max_size, smallest);
+        std::string transformer_type = transformer;
 
-            OpenGL::render_begin(fb);
-            auto sbox = scissor; wlr_renderer_scissor(wf::get_core().renderer, &sbox);
+        int count = std::max((int)view_count, 0);
+        for (int i = 0; i < count; i++)
+        {
+            wf::geometry_t geometry;
+            geometry.width = std::min(random_int(smallest, largest),
+                workarea.width);
+            geometry.height = std::min(random_int(smallest, largest),
+                workarea.height);
+            geometry.x = workarea.x +
+                random_int(0, workarea.width - geometry.width);
+            geometry.y = workarea.y +
+                random_int(0, workarea.height - geometry.height);
+
+            double hue = 1.0 * i / count;
+            wf::color_t color = {
+                0.5 + 0.5 * std::cos(2 * M_PI * hue),
+                0.5 + 0.5 * std::cos(2 * M_PI * (hue - 1.0 / 3)),
+                0.5 + 0.5 * std::cos(2 * M_PI * (hue - 2.0 / 3)),
+                alpha,
+            };
 
-            float color[] = {1.0f, 0.0, 1.0f, 1.0f};
+            auto view = new cvtest_view_t(output, geometry, color);
+            views.push_back({view->self(), geometry, 2 * M_PI * hue});
+            wf::get_core().add_view(std::unique_ptr<wf::view_interface_t>(view));
 
-            wlr_render_quad_with_matrix(wf::get_core().renderer, color, matrix);
-            OpenGL::render_end();
+            if (transformer_type == "2d")
+            {
+                view->add_transformer(
+                    std::make_unique<wf::view_2D>(view->self()), transformer_name);
+            } else if (transformer_type == "3d")
+            {
+                view->add_transformer(
+                    std::make_unique<wf::view_3D>(view->self()), transformer_name);
+            } else if (transformer_type != "none")
+            {
+                LOGE("cvtest: unknown transformer ", transformer_type);
+            }
         }
+    }
 
-        virtual bool accepts_input(int sx, int sy)
+    void update_transformer(const test_view_t& v)
+    {
+        auto tr = v.view->get_transformer(transformer_name).get();
+        float angle = 0.02 * frame + v.phase;
+        if (auto tr2d = dynamic_cast<wf::view_2D*>(tr))
         {
-            return 0 <= sx && sx < geometry.width &&
-                0 <= sy && sy < geometry.height;
+            tr2d->angle = angle;
+            tr2d->scale_x = tr2d->scale_y = 0.9 + 0.1 * std::sin(angle);
+        } else if (auto tr3d = dynamic_cast<wf::view_3D*>(tr))
+        {
+            tr3d->rotation = glm::rotate(glm::mat4(1.0), angle,
+                glm::vec3(0.0, 1.0, 0.0));
         }
-};
+    }
 
-class wayfire_cvtest : public wayfire_plugin_t
-{
-    wf::key_callback binding;
-    public:
-        void init(wayfire_config *config)
+    void damage_view(const test_view_t& v, const std::string& pattern)
+    {
+        auto size = v.view->get_wm_geometry();
+        if (pattern == "full")
+        {
+            v.view->damage();
+        } else if (pattern == "rects")
         {
-            binding = [=] (uint32_t) {test();};
-            output->add_key(new_static_option("<shift> <super> KEY_T"), &binding);
+            for (int i = 0; i < damage_rects; i++)
+            {
+                wlr_box box;
+                box.width = random_int(1, std::min(size.width, 32));
+                box.height = random_int(1, std::min(size.height, 32));
+                box.x = random_int(0, size.width - box.width);
+                box.y = random_int(0, size.height - box.height);
+                v.view->damage_surface_box(box);
+            }
+        } else if (pattern == "scroll")
+        {
+            int band = std::max(size.height / 4, 1);
+            int y = (frame * 8) % std::max(size.height - band, 1);
+            v.view->damage_surface_box({0, y, size.width, band});
         }
+    }
 
-        void test()
+    /** Update the scene for the next frame */
+    void step()
+    {
+        std::string pattern = damage_pattern;
+        for (auto& v : views)
         {
-            auto cv = new wayfire_mirror_view_t(output->get_top_view());
+            if (movement)
+            {
+                double t = 0.05 * frame + v.phase;
+                v.view->move(v.base.x + 50 * std::sin(t),
+                    v.base.y + 50 * std::cos(t));
+            }
+
+            if (v.view->get_transformer(transformer_name))
+            {
+                /* The old and the new bounding box */
+                v.view->damage();
+                update_transformer(v);
+                v.view->damage();
+            }
 
-            auto v = std::unique_ptr<wayfire_view_t>{cv};
-            wf::get_core().add_view(std::move(v));
-            cv->map();
+            damage_view(v, pattern);
         }
-};
 
-extern "C"
-{
-    wayfire_plugin_t* newInstance()
+        ++frame;
+    }
+
+    void fini() override
     {
-        return new wayfire_cvtest;
+        stop();
+        output->rem_binding(&toggle_cb);
     }
-}
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_cvtest);
@@ -8,6 +8,7 @@
 #include <wayfire/workspace-manager.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
 #include <wayfire/util/duration.hpp>
 
 /* TODO: this file should be included in some header maybe(plugin.hpp) */
@@ -73,7 +74,7 @@ class wayfire_expo : public wf::plugin_interface_t
     std::vector<wf::activator_callback> keyboard_select_cbs;
     std::vector<wf::option_sptr_t<wf::activatorbinding_t>> keyboard_select_options;
 
-    wf::render_hook_t renderer;
+    wf::damage_render_hook_t renderer;
     wf::signal_callback_t view_removed = [=] (wf::signal_data_t *event)
     {
         if (get_signaled_view(event) == moving_view)
@@ -84,10 +85,17 @@ class wayfire_expo : public wf::plugin_interface_t
         bool active = false;
         bool button_pressed = false;
         bool zoom_in = false;
+        /* Set while the zoom animation runs. Otherwise, the output is
+         * repainted only when a workspace is damaged. */
+        bool redraw_always = false;
+        /* Whether the last frame was drawn zoomed out, with the animation
+         * finished, so the next one can repaint only what changed */
+        bool at_rest = false;
     } state;
 
     int target_vx, target_vy;
-    std::vector<std::vector<wf::workspace_stream_t>> streams;
+    /* Shared with other plugins showing the same workspaces */
+    std::vector<std::vector<std::shared_ptr<wf::workspace_stream_t>>> streams;
 
   public:
     void setup_workspace_bindings_from_config()
@@ -147,11 +155,7 @@ class wayfire_expo : public wf::plugin_interface_t
         auto wsize = output->workspace->get_workspace_grid_size();
         streams.resize(wsize.width);
         for (int i = 0; i < wsize.width; i++)
-        {
             streams[i].resize(wsize.height);
-            for (int j = 0; j < wsize.height; j++)
-                streams[i][j].ws = {i, j};
-        }
 
         output->add_activator(toggle_binding, &toggle_cb);
         grab_interface->callbacks.pointer.button = [=] (uint32_t button, uint32_t state)
@@ -192,7 +196,10 @@ class wayfire_expo : public wf::plugin_interface_t
             finalize_and_exit();
         };
 
-        renderer = [=] (const wf::framebuffer_t& buffer) { render(buffer); };
+        renderer = [=] (const wf::framebuffer_t& buffer, const wf::region_t& damage)
+        {
+            return render(buffer, damage);
+        };
 
         output->connect_signal("detach-view", &view_removed);
         output->connect_signal("view-disappeared", &view_removed);
@@ -214,8 +221,9 @@ class wayfire_expo : public wf::plugin_interface_t
         target_vy = cws.y;
         calculate_zoom(true);
 
-        output->render->set_renderer(renderer);
-        output->render->set_redraw_always();
+        state.at_rest = false;
+        output->render->set_damage_renderer(renderer);
+        set_redraw_always(true);
 
         for (size_t i = 0; i < keyboard_select_cbs.size(); i++)
         {
@@ -231,6 +239,7 @@ class wayfire_expo : public wf::plugin_interface_t
         animation.start();
         output->workspace->set_workspace({target_vx, target_vy});
         calculate_zoom(false);
+        set_redraw_always(true);
 
         for (size_t i = 0; i < keyboard_select_cbs.size(); i++)
         {
@@ -238,6 +247,15 @@ class wayfire_expo : public wf::plugin_interface_t
         }
     }
 
+    void set_redraw_always(bool always)
+    {
+        if (state.redraw_always == always)
+            return;
+
+        state.redraw_always = always;
+        output->render->set_redraw_always(always);
+    }
+
     wf::geometry_t get_grid_geometry()
     {
         auto wsize = output->workspace->get_workspace_grid_size();
@@ -426,21 +444,56 @@ class wayfire_expo : public wf::plugin_interface_t
         target_vy = y / og.height;
     }
 
+    /**
+     * @return Whether the workspace has an up to date stream with the scale
+     *   used once zoomed out, for ex. kept by the prewarm plugin. When
+     *   zooming out, the other workspaces start from it instead of being
+     *   rendered at full size in the first frames.
+     */
+    bool has_thumbnail(const std::shared_ptr<wf::workspace_stream_t>& stream,
+        wf::point_t ws, float scale)
+    {
+        if (stream && (stream->scale_x == scale) && (stream->scale_y == scale))
+            return true;
+
+        return output->render->get_shared_workspace_stream(ws, scale, scale)->running;
+    }
+
     void update_streams()
     {
         auto wsize = output->workspace->get_workspace_grid_size();
+
+        /* Once zoomed out, each workspace takes 1 / max(width, height) of the
+         * output, so the streams don't need more pixels than that. While
+         * zooming, full size buffers are used, so that the streams aren't
+         * redrawn at a new size each frame, except for the other workspaces
+         * when zooming out from existing thumbnails. */
+        float rest_scale = 1.f / std::max(wsize.width, wsize.height);
+        auto cws = output->workspace->get_current_workspace();
+
         for(int j = 0; j < wsize.height; j++)
         {
             for(int i = 0; i < wsize.width; i++)
             {
-                if (!streams[i][j].running)
+                auto& stream = streams[i][j];
+                float scale_x = rest_scale, scale_y = rest_scale;
+                if (animation.running() &&
+                    !(state.zoom_in && !(cws == wf::point_t{i, j}) &&
+                      has_thumbnail(stream, {i, j}, rest_scale)))
                 {
-                    output->render->workspace_stream_start(streams[i][j]);
-                } else
+                    scale_x = scale_y = 1;
+                }
+
+                if (!stream || stream->scale_x != scale_x ||
+                    stream->scale_y != scale_y)
                 {
-                    output->render->workspace_stream_update(streams[i][j],
-                        animation.scale_x, animation.scale_y);
+                    stream = output->render->get_shared_workspace_stream(
+                        {i, j}, scale_x, scale_y);
                 }
+
+                /* Streams repaint only their damaged parts, so the
+                 * workspaces which didn't change cost nothing here */
+                output->render->workspace_stream_update(*stream);
             }
         }
     }
@@ -449,9 +502,13 @@ class wayfire_expo : public wf::plugin_interface_t
      * in their correct place/size, then scales+translates the whole scene so
      * that all of the workspaces become visible.
      *
-     * The scale+translate part is calculated in zoom_target */
-    void render(const wf::framebuffer_t &fb)
+     * The scale+translate part is calculated in zoom_target
+     *
+     * @return The repainted region, see wf::damage_render_hook_t */
+    wf::region_t render(const wf::framebuffer_t &fb, const wf::region_t& damage)
     {
+        bool was_at_rest = state.at_rest;
+        state.at_rest = !animation.running() && state.zoom_in;
         update_streams();
 
         auto wsize = output->workspace->get_workspace_grid_size();
@@ -464,8 +521,12 @@ class wayfire_expo : public wf::plugin_interface_t
 
         OpenGL::render_begin(fb);
         OpenGL::clear(background_color);
+
         fb.scissor(fb.framebuffer_box_from_geometry_box(fb.geometry));
 
+        /* All workspaces are drawn together, usually with a single draw call */
+        std::vector<wf::workspace_stream_instance_t> instances;
+
         /* Space between adjacent workspaces */
         float hspacing = 1.0 * animation.delimiter_offset / screen_size.width;
         float vspacing = 1.0 * animation.delimiter_offset / screen_size.height;
@@ -494,16 +555,79 @@ class wayfire_expo : public wf::plugin_interface_t
                 /* Undo rotation of the workspace */
                 workspace_transform = workspace_transform * glm::inverse(fb.transform);
 
-                OpenGL::render_transformed_texture(streams[i][j].buffer.tex,
-                    out_geometry, {}, workspace_transform);
+                instances.push_back({streams[i][j].get(), out_geometry,
+                    workspace_transform});
             }
         }
 
-        GL_CALL(glUseProgram(0));
+        output->render->render_workspace_streams(instances);
         OpenGL::render_end();
 
-        if (!animation.running() && !state.zoom_in)
-            finalize_and_exit();
+        if (!animation.running())
+        {
+            if (state.zoom_in)
+                set_redraw_always(false);
+            else
+                finalize_and_exit();
+        }
+
+        if (!was_at_rest || !state.at_rest)
+            return output->render->get_damage_box();
+
+        return get_zoomed_out_damage(damage);
+    }
+
+    /**
+     * @return Where the damage of the workspaces is shown while zoomed out,
+     * in the damage coordinates of the output
+     */
+    wf::region_t get_zoomed_out_damage(const wf::region_t& damage)
+    {
+        auto wsize = output->workspace->get_workspace_grid_size();
+        auto cws = output->workspace->get_current_workspace();
+        auto screen_size = output->get_screen_size();
+        auto output_box = output->render->get_damage_box();
+
+        /* Matches the transformation in render(), without the rotation of the
+         * output, in normalized device coordinates */
+        double hspacing = 1.0 * animation.delimiter_offset / screen_size.width;
+        double vspacing = 1.0 * animation.delimiter_offset / screen_size.height;
+        double sx = animation.scale_x, sy = animation.scale_y;
+
+        wf::region_t result;
+        for (int j = 0; j < wsize.height; j++)
+        {
+            for (int i = 0; i < wsize.width; i++)
+            {
+                auto ws_box = output->render->get_ws_box({i, j});
+                auto ws_damage = damage & ws_box;
+                if (ws_damage.empty())
+                    continue;
+
+                double left = animation.off_x + sx * ((i - cws.x) * 2 - 1 + hspacing);
+                double top = animation.off_y + sy * ((cws.y - j) * 2 + 1 - vspacing);
+                double origin_x = (left + 1) / 2 * output_box.width;
+                double origin_y = (1 - top) / 2 * output_box.height;
+                double scale_x = sx * (1 - hspacing);
+                double scale_y = sy * (1 - vspacing);
+
+                for (const auto& rect : ws_damage)
+                {
+                    auto box = wlr_box_from_pixman_box(rect);
+                    int x1 = std::floor(origin_x + (box.x - ws_box.x) * scale_x);
+                    int y1 = std::floor(origin_y + (box.y - ws_box.y) * scale_y);
+                    int x2 = std::ceil(origin_x +
+                        (box.x + box.width - ws_box.x) * scale_x);
+                    int y2 = std::ceil(origin_y +
+                        (box.y + box.height - ws_box.y) * scale_y);
+
+                    /* One more pixel for the filtering of the scaled streams */
+                    result |= wlr_box{x1 - 1, y1 - 1, x2 - x1 + 2, y2 - y1 + 2};
+                }
+            }
+        }
+
+        return result & output_box;
     }
     void calculate_zoom(bool zoom_in)
     {
@@ -544,15 +668,15 @@ class wayfire_expo : public wf::plugin_interface_t
         output->deactivate_plugin(grab_interface);
         grab_interface->ungrab();
 
-        auto wsize = output->workspace->get_workspace_grid_size();
-        for (int i = 0; i < wsize.width; i++) {
-            for (int j = 0; j < wsize.height; j++) {
-                output->render->workspace_stream_stop(streams[i][j]);
-            }
+        /* Dropping the handles stops the streams */
+        for (auto& row : streams)
+        {
+            for (auto& stream : row)
+                stream = nullptr;
         }
 
         output->render->set_renderer(nullptr);
-        output->render->set_redraw_always(false);
+        set_redraw_always(false);
     }
 
     void fini() override
@@ -563,14 +687,6 @@ class wayfire_expo : public wf::plugin_interface_t
         if (state.active)
             finalize_and_exit();
 
-        OpenGL::render_begin();
-        for (auto& row : streams)
-        {
-            for (auto& stream: row)
-                stream.buffer.release();
-        }
-        OpenGL::render_end();
-
         output->rem_binding(&toggle_cb);
     }
 };
@@ -1,9 +1,9 @@
 #include <wayfire/plugin.hpp>
 #include <wayfire/signal-definitions.hpp>
-#include <wayfire/view-transform.hpp>
 #include <wayfire/view.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <linux/input-event-codes.h>
+#include <map>
 
 /*
  * This plugin provides abilities to switch between views.
@@ -15,6 +15,8 @@ class wayfire_fast_switcher : public wf::plugin_interface_t
     wf::option_wrapper_t<wf::keybinding_t> activate_key{"fast-switcher/activate"};
     size_t current_view_index;
     std::vector<wayfire_view> views; // all views on current viewport
+    /* The opacity of the views before the switcher started */
+    std::map<wayfire_view, float> saved_alpha;
 
     bool active = false;
 
@@ -90,6 +92,7 @@ class wayfire_fast_switcher : public wf::plugin_interface_t
             return;
 
         views.erase(views.begin() + i);
+        saved_alpha.erase(view);
 
         if (views.empty())
         {
@@ -105,20 +108,18 @@ class wayfire_fast_switcher : public wf::plugin_interface_t
         }
     };
 
-    const std::string transformer_name = "fast-switcher";
-
+    /**
+     * Set the opacity of the view relative to its opacity before the
+     * switcher started. The opacity is applied while the view's surfaces are
+     * drawn, so dimming doesn't need a transformer and an offscreen buffer
+     * for each view.
+     */
     void set_view_alpha(wayfire_view view, float alpha)
     {
-        if (!view->get_transformer(transformer_name))
-        {
-            view->add_transformer(
-                std::make_unique<wf::view_2D>(view), transformer_name);
-        }
+        if (!saved_alpha.count(view))
+            saved_alpha[view] = view->get_alpha();
 
-        auto tr = dynamic_cast<wf::view_2D*> (
-            view->get_transformer(transformer_name).get());
-        tr->alpha = alpha;
-        view->damage();
+        view->set_alpha(saved_alpha[view] * alpha);
     }
 
     wf::key_callback fast_switch_start = [=] (uint32_t)
@@ -155,8 +156,10 @@ class wayfire_fast_switcher : public wf::plugin_interface_t
 
     void switch_terminate()
     {
-        for (auto view : views)
-            view->pop_transformer(transformer_name);
+        for (auto& [view, alpha] : saved_alpha)
+            view->set_alpha(alpha);
+
+        saved_alpha.clear();
 
         grab_interface->ungrab();
         output->deactivate_plugin(grab_interface);
@@ -24,6 +24,7 @@
 
 #include <wayfire/plugin.hpp>
 #include <wayfire/output.hpp>
+#include <wayfire/core.hpp>
 #include <wayfire/opengl.hpp>
 #include <wayfire/util/duration.hpp>
 #include <wayfire/render-manager.hpp>
@@ -102,6 +103,11 @@ class wayfire_fisheye : public wf::plugin_interface_t
 
     float target_zoom;
     bool active, hook_set;
+    bool animating = false;
+
+    /* The part of the output changed by the lens in the last frame, in
+     * damage coordinates */
+    wlr_box last_lens = {0, 0, 0, 0};
 
     wf::option_wrapper_t<double> radius{"fisheye/radius"};
     wf::option_wrapper_t<double> zoom{"fisheye/zoom"};
@@ -121,7 +127,7 @@ class wayfire_fisheye : public wf::plugin_interface_t
             target_zoom = zoom;
             zoom.set_callback([=] () {
                 if (active)
-                    this->progression.animate(zoom);
+                    animate(zoom);
             });
 
             OpenGL::render_begin();
@@ -138,22 +144,93 @@ class wayfire_fisheye : public wf::plugin_interface_t
             if (active)
             {
                 active = false;
-                progression.animate(0);
+                animate(0);
             } else
             {
                 active = true;
-                progression.animate(zoom);
+                animate(zoom);
                 if (!hook_set)
                 {
                     hook_set = true;
-                    output->render->add_post(&render_hook);
-                    output->render->set_redraw_always();
+                    last_lens = get_lens_box();
+                    /* Outside of the lens, the input is left as it is, so
+                     * the hook runs only on the damaged parts of the output.
+                     * The pre hook makes sure that the lens is redrawn as a
+                     * whole whenever a part of it changes. */
+                    output->render->add_post(&render_hook, true);
+                    output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+                    for (auto& signal : motion_signals)
+                        wf::get_core().connect_signal(signal, &on_motion);
                 }
             }
 
             return true;
         };
 
+        void animate(double target)
+        {
+            progression.animate(target);
+            if (!animating)
+            {
+                animating = true;
+                output->render->add_animation(&animation_hook);
+            }
+        }
+
+        /** @return The box around the lens, in damage coordinates */
+        wlr_box get_lens_box()
+        {
+            auto oc = output->get_cursor_position();
+            float scale = output->render->get_target_framebuffer().scale;
+            int r = std::ceil((double)radius) + 1;
+
+            return {(int)(oc.x * scale) - r, (int)(oc.y * scale) - r,
+                2 * r, 2 * r};
+        }
+
+        const std::vector<std::string> motion_signals = {
+            "pointer_motion", "pointer_motion_abs", "tablet_axis",
+        };
+
+        /* Request a frame, the pre hook then damages the moved lens */
+        wf::signal_callback_t on_motion = [=] (wf::signal_data_t*)
+        {
+            output->render->damage(last_lens);
+        };
+
+        wf::animation_hook_t animation_hook = [=] (uint32_t,
+            wf::region_t& damage)
+        {
+            damage |= last_lens;
+            animating = progression.running();
+            return animating;
+        };
+
+        /**
+         * The lens samples its input from anywhere inside of it, so damage
+         * in a part of the lens means that all of it has to be redrawn. When
+         * it moves, the pixels it covered before are restored as well.
+         */
+        wf::effect_hook_t pre_hook = [=] ()
+        {
+            auto lens = get_lens_box();
+            auto damage = output->render->get_scheduled_damage();
+
+            wf::region_t lens_damage;
+            if (!(lens == last_lens))
+            {
+                lens_damage |= last_lens;
+                lens_damage |= lens;
+            } else if (progression.running() || !(damage & lens).empty())
+            {
+                lens_damage |= lens;
+            }
+
+            last_lens = lens;
+            if (!lens_damage.empty())
+                output->render->damage(lens_damage);
+        };
+
         wf::post_hook_t render_hook = [=](const wf::framebuffer_base_t& source,
             const wf::framebuffer_base_t& dest)
         {
@@ -174,7 +251,7 @@ class wayfire_fisheye : public wf::plugin_interface_t
             OpenGL::render_begin(dest);
             program.use(wf::TEXTURE_TYPE_RGBA);
             GL_CALL(glBindTexture(GL_TEXTURE_2D, source.tex));
-            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            OpenGL::get_state_cache().active_texture(GL_TEXTURE0);
 
             program.uniform2f("u_mouse", oc.x, oc.y);
             program.uniform2f("u_resolution", dest.viewport_width, dest.viewport_height);
@@ -196,12 +273,18 @@ class wayfire_fisheye : public wf::plugin_interface_t
         void finalize()
         {
             output->render->rem_post(&render_hook);
-            output->render->set_redraw_always(false);
+            output->render->rem_effect(&pre_hook);
+            for (auto& signal : motion_signals)
+                wf::get_core().disconnect_signal(signal, &on_motion);
+
             hook_set = false;
         }
 
         void fini() override
         {
+            if (animating)
+                output->render->rem_animation(&animation_hook);
+
             if (hook_set)
                 finalize();
 
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <wayfire/geometry.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace wf
+{
+/**
+ * An index of the free space in an area, kept as the list of its maximal
+ * empty rectangles, i.e the rectangles which don't intersect any obstacle and
+ * can't be extended in any direction without intersecting one.
+ *
+ * Adding an obstacle updates the list incrementally, by splitting only the
+ * rectangles the obstacle intersects. Obstacles can't be removed, instead the
+ * index is reset and the remaining obstacles are added again.
+ */
+class free_space_index_t
+{
+    wf::geometry_t area = {0, 0, 0, 0};
+    std::vector<wf::geometry_t> free;
+    std::vector<wf::geometry_t> obstacles;
+
+    static bool contains(const wf::geometry_t& outer, const wf::geometry_t& inner)
+    {
+        return inner.x >= outer.x && inner.y >= outer.y &&
+               inner.x + inner.width <= outer.x + outer.width &&
+               inner.y + inner.height <= outer.y + outer.height;
+    }
+
+    static int64_t area_of(const wf::geometry_t& box)
+    {
+        return (int64_t)box.width * box.height;
+    }
+
+  public:
+    /** Remove all obstacles and index the given area */
+    void reset(wf::geometry_t area)
+    {
+        this->area = area;
+        obstacles.clear();
+        free.clear();
+        if (area.width > 0 && area.height > 0)
+            free.push_back(area);
+    }
+
+    /** Mark the given box as occupied */
+    void add_obstacle(wf::geometry_t box)
+    {
+        box = wf::geometry_intersection(box, area);
+        if (box.width <= 0 || box.height <= 0)
+            return;
+
+        obstacles.push_back(box);
+
+        std::vector<wf::geometry_t> kept, split;
+        for (auto& rect : free)
+        {
+            if (!(rect & box))
+            {
+                kept.push_back(rect);
+                continue;
+            }
+
+            /* The parts of the rectangle on each side of the obstacle */
+            int rect_x2 = rect.x + rect.width, rect_y2 = rect.y + rect.height;
+            int box_x2 = box.x + box.width, box_y2 = box.y + box.height;
+            if (box.x > rect.x)
+                split.push_back({rect.x, rect.y, box.x - rect.x, rect.height});
+            if (box_x2 < rect_x2)
+                split.push_back({box_x2, rect.y, rect_x2 - box_x2, rect.height});
+            if (box.y > rect.y)
+                split.push_back({rect.x, rect.y, rect.width, box.y - rect.y});
+            if (box_y2 < rect_y2)
+                split.push_back({rect.x, box_y2, rect.width, rect_y2 - box_y2});
+        }
+
+        /* The new parts are maximal unless another rectangle contains them.
+         * The untouched rectangles were maximal already, and can't be
+         * contained in a part of a rectangle which was split. */
+        free = std::move(kept);
+        size_t untouched = free.size();
+        for (size_t i = 0; i < split.size(); i++)
+        {
+            bool contained = false;
+            for (size_t j = 0; j < split.size() && !contained; j++)
+            {
+                if (i == j || !contains(split[j], split[i]))
+                    continue;
+
+                /* Of two equal rectangles, keep the first */
+                contained = !(split[i] == split[j]) || j < i;
+            }
+
+            for (size_t j = 0; j < untouched && !contained; j++)
+                contained = contains(free[j], split[i]);
+
+            if (!contained)
+                free.push_back(split[i]);
+        }
+    }
+
+    /** @return The maximal empty rectangles */
+    const std::vector<wf::geometry_t>& get_free_rectangles() const
+    {
+        return free;
+    }
+
+    /** @return The total area of the obstacles covered by the box */
+    int64_t get_overlap(const wf::geometry_t& box) const
+    {
+        int64_t overlap = 0;
+        for (auto& obstacle : obstacles)
+        {
+            auto intersection = wf::geometry_intersection(box, obstacle);
+            if (intersection.width > 0 && intersection.height > 0)
+                overlap += area_of(intersection);
+        }
+
+        return overlap;
+    }
+
+    /**
+     * Find a position for a box of the given size inside the area. If it
+     * fits in the free space, it is put in the smallest free rectangle it
+     * fits in. Otherwise, it is put so that it covers the least of the
+     * obstacles, with its corner at the corner of a free rectangle.
+     *
+     * @return The position of the top-left corner of the box.
+     */
+    wf::point_t find_position(wf::dimensions_t size) const
+    {
+        const wf::geometry_t *best_fit = nullptr;
+        for (auto& rect : free)
+        {
+            if (rect.width < size.width || rect.height < size.height)
+                continue;
+
+            if (!best_fit || area_of(rect) < area_of(*best_fit) ||
+                (area_of(rect) == area_of(*best_fit) &&
+                 std::make_pair(rect.y, rect.x) <
+                 std::make_pair(best_fit->y, best_fit->x)))
+            {
+                best_fit = &rect;
+            }
+        }
+
+        if (best_fit)
+            return {best_fit->x, best_fit->y};
+
+        /* Boxes larger than the area start at its top-left corner */
+        int max_x = std::max(area.x, area.x + area.width - size.width);
+        int max_y = std::max(area.y, area.y + area.height - size.height);
+        auto candidate = [&] (int x, int y) -> wf::geometry_t {
+            return {std::clamp(x, area.x, max_x), std::clamp(y, area.y, max_y),
+                size.width, size.height};
+        };
+
+        wf::geometry_t best = candidate(area.x, area.y);
+        int64_t best_overlap = get_overlap(best);
+        for (auto& rect : free)
+        {
+            /* Align the box to each corner of the free rectangle */
+            for (int x : {rect.x, rect.x + rect.width - size.width})
+            {
+                for (int y : {rect.y, rect.y + rect.height - size.height})
+                {
+                    auto box = candidate(x, y);
+                    int64_t overlap = get_overlap(box);
+                    if (overlap < best_overlap)
+                    {
+                        best = box;
+                        best_overlap = overlap;
+                    }
+                }
+            }
+        }
+
+        return {best.x, best.y};
+    }
+};
+}
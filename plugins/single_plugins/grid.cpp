@@ -5,6 +5,7 @@
 #include <wayfire/view.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/view-transform.hpp>
 #include <algorithm>
 #include <cmath>
 #include <linux/input-event-codes.h>
@@ -20,6 +21,104 @@ extern "C"
 }
 
 const std::string grid_view_id = "grid-view";
+const std::string grid_crossfade_id = "grid-crossfade";
+
+/**
+ * Shows the view at the animated geometry, by scaling its live contents and
+ * blending a snapshot of how it looked when the animation started on top.
+ * The client is resized to the final geometry only once, when the animation
+ * starts, so it doesn't have to redraw at every intermediate size.
+ */
+class grid_crossfade_t : public wf::view_2D
+{
+    /* The view when the animation started */
+    wf::framebuffer_t original;
+    /* The opacity of the original on top of the live view */
+    float original_alpha = 1.0;
+
+  public:
+    /* The geometry at which the view is shown */
+    wf::geometry_t displayed;
+
+    grid_crossfade_t(wayfire_view view) : wf::view_2D(view)
+    {
+        displayed = view->get_wm_geometry();
+
+        /* Taken before the transformer is added, so it shows the view with
+         * its other transformers */
+        auto box = view->get_bounding_box();
+        original.geometry = box;
+        original.scale = view->get_output()->handle->scale;
+
+        OpenGL::render_begin();
+        original.allocate(box.width * original.scale, box.height * original.scale);
+        original.bind();
+        OpenGL::clear({0, 0, 0, 0});
+        OpenGL::render_end();
+
+        view->render_transformed(original, original.get_damage_region());
+    }
+
+    ~grid_crossfade_t()
+    {
+        OpenGL::render_begin();
+        original.release();
+        OpenGL::render_end();
+    }
+
+    uint32_t get_z_order() override { return wf::TRANSFORMER_HIGHLEVEL; }
+
+    /** Show the view at the given geometry, with the original blended on top */
+    void set_displayed(wf::geometry_t geometry, float alpha)
+    {
+        displayed = geometry;
+        original_alpha = alpha;
+
+        /* The client may not have resized yet */
+        auto wm = view->get_wm_geometry();
+        scale_x = 1.0 * geometry.width / std::max(wm.width, 1);
+        scale_y = 1.0 * geometry.height / std::max(wm.height, 1);
+        translation_x = (geometry.x + geometry.width / 2.0) -
+            (wm.x + wm.width / 2.0);
+        translation_y = (geometry.y + geometry.height / 2.0) -
+            (wm.y + wm.height / 2.0);
+    }
+
+    /* Two textures can't be expressed as a matrix */
+    bool get_composable_transform(wf::geometry_t, glm::mat4&, glm::vec4&) override
+    {
+        return false;
+    }
+
+    void render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+        const wf::region_t& damage, const wf::framebuffer_t& fb) override
+    {
+        std::vector<wlr_box> boxes;
+        for (const auto& rect : damage)
+        {
+            boxes.push_back(fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+        }
+
+        if (boxes.empty())
+            return;
+
+        /* The original is stretched over the same area as the live view */
+        auto live = get_quad(src_tex, src_box, fb);
+        auto overlay = live;
+        overlay.texture = wf::texture_t{original.tex};
+        overlay.color = {1.0f, 1.0f, 1.0f, original_alpha};
+
+        OpenGL::render_batch_t batch;
+        batch.set_scissor(fb, boxes);
+        batch.add(live);
+        batch.add(overlay);
+
+        OpenGL::render_begin(fb);
+        batch.flush();
+        OpenGL::render_end();
+    }
+};
 
 class wayfire_grid_view_cdata : public wf::custom_data_t
 {
@@ -27,7 +126,7 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
 
     wayfire_view view;
     wf::output_t *output;
-    wf::effect_hook_t pre_hook;
+    wf::animation_hook_t pre_hook;
     wf::signal_callback_t unmapped;
 
     int32_t tiled_edges = -1;
@@ -53,10 +152,13 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
             return;
         }
 
-        pre_hook = [=] () {
+        pre_hook = [=] (uint32_t, wf::region_t&)
+        {
+            /* Removed by the destructor once the view reaches its geometry */
             adjust_geometry();
+            return true;
         };
-        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+        output->render->add_animation(&pre_hook);
 
         unmapped = [=] (wf::signal_data_t *data)
         {
@@ -64,7 +166,6 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
                 destroy();
         };
 
-        output->render->set_redraw_always(true);
         output->connect_signal("view-disappeared", &unmapped);
         output->connect_signal("detach-view", &unmapped);
     }
@@ -74,9 +175,18 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
         view->erase_data<wayfire_grid_view_cdata>();
     }
 
+    nonstd::observer_ptr<grid_crossfade_t> get_crossfade()
+    {
+        return nonstd::make_observer(dynamic_cast<grid_crossfade_t*> (
+            view->get_transformer(grid_crossfade_id).get()));
+    }
+
     void adjust_target_geometry(wf::geometry_t geometry, int32_t target_edges)
     {
-        animation.set_start(view->get_wm_geometry());
+        /* A running crossfade continues from where the view is shown */
+        auto crossfade = get_crossfade();
+        animation.set_start(crossfade ?
+            crossfade->displayed : view->get_wm_geometry());
         animation.set_end(geometry);
 
         /* Restore tiled edges if we don't need to set something special when
@@ -97,6 +207,19 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
             return destroy();
         }
 
+        if (type == "crossfade")
+        {
+            if (!crossfade)
+            {
+                view->add_transformer(std::make_unique<grid_crossfade_t> (view),
+                    grid_crossfade_id);
+            }
+
+            set_end_state(geometry, tiled_edges);
+            animation.start();
+            return;
+        }
+
         if (type == "wobbly")
         {
             /* Order is important here: first we set the view geometry, and
@@ -123,6 +246,21 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
 
     void adjust_geometry()
     {
+        auto crossfade = get_crossfade();
+        if (crossfade)
+        {
+            view->damage();
+            if (!animation.running())
+            {
+                view->pop_transformer(grid_crossfade_id);
+                return destroy();
+            }
+
+            crossfade->set_displayed(animation, 1.0 - animation.progress());
+            view->damage();
+            return;
+        }
+
         if (!animation.running())
         {
             set_end_state(animation, tiled_edges);
@@ -140,9 +278,11 @@ class wayfire_grid_view_cdata : public wf::custom_data_t
         if (!is_active)
             return;
 
-        output->render->rem_effect(&pre_hook);
+        if (get_crossfade())
+            view->pop_transformer(grid_crossfade_id);
+
+        output->render->rem_animation(&pre_hook);
         output->deactivate_plugin(iface);
-        output->render->set_redraw_always(false);
         output->disconnect_signal("view-disappeared", &unmapped);
         output->disconnect_signal("detach-view", &unmapped);
     }
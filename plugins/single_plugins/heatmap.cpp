@@ -0,0 +1,410 @@
+#include <wayfire/plugin.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/signal-definitions.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/opengl.hpp>
+#include <wayfire/util.hpp>
+#include "../decor/cairo-util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+/**
+ * Shows how often each part of the output was repainted recently, as a color
+ * ramp over the output from blue for rarely repainted parts to red for parts
+ * repainted every frame, and a table of the views which damaged the largest
+ * area per second.
+ *
+ * Repaints are counted in cells of cell_size pixels. The counts decay
+ * exponentially with the time constant window, so the map is a sliding
+ * average over about the last window milliseconds. Damage which doesn't come
+ * from a view, for ex. a plugin which damages the whole output, shows in the
+ * map and in the total of the table, but not in the rows of the views.
+ *
+ * The overlay is updated every update_interval milliseconds, which damages
+ * the whole output. The repaint caused by the update isn't counted.
+ */
+class wayfire_heatmap : public wf::plugin_interface_t
+{
+    wf::option_wrapper_t<wf::activatorbinding_t> toggle_key{"heatmap/toggle"};
+    wf::option_wrapper_t<int> cell_size_opt{"heatmap/cell_size"};
+    wf::option_wrapper_t<int> window{"heatmap/window"};
+    wf::option_wrapper_t<int> update_interval{"heatmap/update_interval"};
+
+    static constexpr int table_width = 360;
+    static constexpr int table_rows = 10;
+    static constexpr int table_height = 40 + 15 * table_rows;
+    static constexpr int margin = 16;
+
+    /* The decayed repaint counts of the cells, in the damage coordinates of
+     * the output, row by row */
+    int cell_size = 16;
+    int columns = 0, rows = 0;
+    std::vector<float> heat;
+
+    struct view_damage_t
+    {
+        std::string name;
+        /* Decayed damaged area, like the heat of the cells */
+        double area = 0;
+    };
+
+    std::map<uint32_t, view_damage_t> view_damage;
+    /* Decayed repainted area of the whole output */
+    double total_area = 0;
+
+    uint32_t last_decay = 0;
+    /* The next repaint is the one caused by the update of the overlay */
+    bool skip_next_frame = false;
+
+    bool active = false;
+    GLuint heat_texture = -1, table_texture = -1;
+    cairo_surface_t *surface = nullptr;
+    cairo_t *cr = nullptr;
+    wf::geometry_t table_box = {0, 0, table_width, table_height};
+
+    wf::activator_callback toggle_cb;
+    wf::effect_hook_t overlay_hook;
+    wf::wl_timer update_timer;
+
+    wf::signal_callback_t on_view_damaged = [=] (wf::signal_data_t *data)
+    {
+        auto ev = static_cast<wf::view_damaged_signal*>(data);
+        auto visible = *ev->region &
+            output->render->get_target_framebuffer().get_damage_region();
+
+        auto& entry = view_damage[ev->view->get_id()];
+        entry.name = ev->view->get_app_id() + " " + ev->view->get_title();
+        entry.area += region_area(visible);
+    };
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "heatmap";
+        grab_interface->capabilities = 0;
+
+        toggle_cb = [=] (wf::activator_source_t, uint32_t)
+        {
+            if (active)
+                hide();
+            else
+                show();
+
+            return true;
+        };
+        output->add_activator(toggle_key, &toggle_cb);
+
+        overlay_hook = [=] () { render(); };
+    }
+
+    static int64_t region_area(const wf::region_t& region)
+    {
+        int64_t area = 0;
+        for (const auto& rect : region)
+            area += int64_t(rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+
+        return area;
+    }
+
+    void show()
+    {
+        active = true;
+        heat.clear();
+        view_damage.clear();
+        total_area = 0;
+        last_decay = wf::get_current_time();
+
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            table_box.width, table_box.height);
+        cr = cairo_create(surface);
+
+        output->connect_signal("view-damaged", &on_view_damaged);
+        output->render->add_effect(&overlay_hook, wf::OUTPUT_EFFECT_OVERLAY);
+        update();
+    }
+
+    void hide()
+    {
+        active = false;
+        update_timer.disconnect();
+        output->disconnect_signal("view-damaged", &on_view_damaged);
+        output->render->rem_effect(&overlay_hook);
+        output->render->damage_whole();
+
+        cairo_destroy(cr);
+        cairo_surface_destroy(surface);
+        cr = nullptr;
+        surface = nullptr;
+
+        OpenGL::render_begin();
+        GL_CALL(glDeleteTextures(1, &heat_texture));
+        GL_CALL(glDeleteTextures(1, &table_texture));
+        OpenGL::render_end();
+        heat_texture = table_texture = -1;
+        heat.clear();
+    }
+
+    /** Decay the counts for the time since the last decay */
+    void decay()
+    {
+        uint32_t now = wf::get_current_time();
+        float factor = std::exp(-float(now - last_decay) /
+            std::max((int)window, 1));
+        last_decay = now;
+
+        for (auto& value : heat)
+            value *= factor;
+
+        for (auto& [id, entry] : view_damage)
+            entry.area *= factor;
+
+        total_area *= factor;
+    }
+
+    /** Count a repaint of the given region, in damage coordinates */
+    void add_repaint(const wf::framebuffer_t& fb, const wf::region_t& damage)
+    {
+        auto extents = wlr_box_from_pixman_box(fb.get_damage_region().get_extents());
+        int size = std::max((int)cell_size_opt, 1);
+        int new_columns = (extents.width + size - 1) / size;
+        int new_rows = (extents.height + size - 1) / size;
+        if ((new_columns != columns) || (new_rows != rows) || (size != cell_size))
+        {
+            /* The output or the cell size changed, start over */
+            cell_size = size;
+            columns = new_columns;
+            rows = new_rows;
+            heat.assign(columns * rows, 0);
+        }
+
+        decay();
+        total_area += region_area(damage);
+
+        /* Each cell is counted once per repaint, even if several rectangles
+         * of the damage touch it */
+        std::vector<bool> touched(heat.size());
+        for (const auto& rect : damage)
+        {
+            int x1 = std::max(rect.x1 / cell_size, 0);
+            int y1 = std::max(rect.y1 / cell_size, 0);
+            int x2 = std::min((rect.x2 - 1) / cell_size, columns - 1);
+            int y2 = std::min((rect.y2 - 1) / cell_size, rows - 1);
+            for (int y = y1; y <= y2; y++)
+            {
+                for (int x = x1; x <= x2; x++)
+                    touched[y * columns + x] = true;
+            }
+        }
+
+        for (size_t i = 0; i < heat.size(); i++)
+            heat[i] += touched[i];
+    }
+
+    /** @return The refresh rate of the output, the highest repaint rate */
+    float get_max_rate()
+    {
+        float rate = output->handle->refresh / 1000.0;
+        return rate > 0 ? rate : 60;
+    }
+
+    /** Map 0..1 to blue, green, yellow and red, more opaque towards red */
+    static void color_ramp(float t, uint8_t *pixel)
+    {
+        if (t <= 0)
+        {
+            std::fill(pixel, pixel + 4, 0);
+            return;
+        }
+
+        t = std::min(t, 1.0f);
+        float r = std::clamp(3 * t - 1, 0.0f, 1.0f);
+        float g = t < 2.0 / 3 ? std::clamp(3 * t, 0.0f, 1.0f) :
+            std::clamp(3 - 3 * t, 0.0f, 1.0f);
+        float b = std::clamp(1 - 3 * t, 0.0f, 1.0f);
+        float a = 0.2 + 0.4 * t;
+
+        /* Premultiplied alpha */
+        pixel[0] = 255 * r * a;
+        pixel[1] = 255 * g * a;
+        pixel[2] = 255 * b * a;
+        pixel[3] = 255 * a;
+    }
+
+    void upload_heat()
+    {
+        float window_sec = std::max((int)window, 1) / 1000.0;
+        float max_rate = get_max_rate();
+        std::vector<uint8_t> pixels(heat.size() * 4);
+        for (size_t i = 0; i < heat.size(); i++)
+            color_ramp(heat[i] / window_sec / max_rate, &pixels[i * 4]);
+
+        if (heat_texture == (uint32_t)-1)
+        {
+            GL_CALL(glGenTextures(1, &heat_texture));
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, heat_texture));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                GL_CLAMP_TO_EDGE));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                GL_CLAMP_TO_EDGE));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                GL_NEAREST));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                GL_NEAREST));
+        }
+
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, heat_texture));
+        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, columns, rows,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data()));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+    }
+
+    /**
+     * The pixels of cairo are BGRA in memory, but they are uploaded as RGBA,
+     * so red and blue are swapped here.
+     */
+    void set_color(double r, double g, double b, double a)
+    {
+        cairo_set_source_rgba(cr, b, g, r, a);
+    }
+
+    /** Draw a line of text below the previous one */
+    void draw_line(double& y, const char *format, ...)
+    {
+        char text[256];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        y += 15;
+        cairo_move_to(cr, 8, y);
+        cairo_show_text(cr, text);
+    }
+
+    /** Draw the views which damaged the largest area per second */
+    void draw_table()
+    {
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        set_color(0, 0, 0, 0.7);
+        cairo_paint(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+        set_color(1, 1, 1, 1);
+        cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+            CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, 12);
+
+        /* Views which haven't damaged anything for a while are dropped */
+        for (auto it = view_damage.begin(); it != view_damage.end();)
+        {
+            if (it->second.area < 1)
+                it = view_damage.erase(it);
+            else
+                ++it;
+        }
+
+        std::vector<const view_damage_t*> sorted;
+        for (auto& [id, entry] : view_damage)
+            sorted.push_back(&entry);
+
+        std::sort(sorted.begin(), sorted.end(),
+            [] (const view_damage_t *a, const view_damage_t *b)
+        {
+            return a->area > b->area;
+        });
+
+        const double mpx = 1e6 * std::max((int)window, 1) / 1000.0;
+        double y = 4;
+        draw_line(y, "damage per second, Mpx/s");
+        draw_line(y, "  %8.2f  repainted in total", total_area / mpx);
+        for (size_t i = 0; i < sorted.size() && (int)i < table_rows; i++)
+        {
+            draw_line(y, "  %8.2f  %.40s", sorted[i]->area / mpx,
+                sorted[i]->name.c_str());
+        }
+
+        cairo_surface_flush(surface);
+    }
+
+    /** Redraw the overlay with the counts so far */
+    void update()
+    {
+        decay();
+        draw_table();
+
+        OpenGL::render_begin();
+        cairo_surface_upload_to_texture(surface, table_texture);
+        if (!heat.empty())
+            upload_heat();
+
+        OpenGL::render_end();
+
+        auto size = output->get_screen_size();
+        table_box.x = size.width - table_box.width - margin;
+        table_box.y = margin;
+
+        skip_next_frame = true;
+        output->render->damage_whole();
+
+        update_timer.set_timeout(std::max((int)update_interval, 16),
+            [=] () { update(); });
+    }
+
+    void render()
+    {
+        auto fb = output->render->get_target_framebuffer();
+        auto damage = output->render->get_scheduled_damage() &
+            fb.get_damage_region();
+
+        if (!skip_next_frame)
+            add_repaint(fb, damage);
+
+        skip_next_frame = false;
+        if (damage.empty() || heat.empty() || (heat_texture == (uint32_t)-1))
+            return;
+
+        /* The cells may extend past the output at the right and bottom */
+        float x = fb.geometry.x, y = fb.geometry.y;
+        gl_geometry heat_geometry = {x, y,
+            x + float(columns * cell_size) / fb.scale,
+            y + float(rows * cell_size) / fb.scale,
+        };
+
+        gl_geometry table_geometry = {
+            x + table_box.x, y + table_box.y,
+            x + table_box.x + table_box.width,
+            y + table_box.y + table_box.height,
+        };
+
+        OpenGL::render_begin(fb);
+        for (const auto& rect : damage)
+        {
+            fb.scissor(fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+            OpenGL::render_transformed_texture(heat_texture, heat_geometry, {},
+                fb.get_orthographic_projection(), glm::vec4(1.0),
+                TEXTURE_TRANSFORM_INVERT_Y);
+            OpenGL::render_transformed_texture(table_texture, table_geometry, {},
+                fb.get_orthographic_projection(), glm::vec4(1.0),
+                TEXTURE_TRANSFORM_INVERT_Y);
+        }
+
+        OpenGL::render_end();
+    }
+
+    void fini() override
+    {
+        if (active)
+            hide();
+
+        output->rem_binding(&toggle_cb);
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_heatmap);
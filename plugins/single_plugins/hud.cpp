@@ -0,0 +1,313 @@
+#include <wayfire/plugin.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/view.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/frame-stats.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/opengl.hpp>
+#include <wayfire/util.hpp>
+#include "../decor/cairo-util.hpp"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+
+/**
+ * Shows the frame statistics of the output in a corner: the frame rate, a
+ * graph of the recent repaint times, the phases of the repaints, the damaged
+ * part of the output, the number of drawn surfaces and GL state changes, the
+ * texture memory reported by the core, and the views which commit most often.
+ *
+ * The overlay is redrawn only every update_interval milliseconds, and only
+ * its box is damaged, so that it changes the measured repaints as little as
+ * possible. An overlay hook disables direct scanout, so fullscreen views are
+ * composited while the HUD is shown.
+ */
+class wayfire_hud : public wf::plugin_interface_t
+{
+    wf::option_wrapper_t<wf::activatorbinding_t> toggle_key{"hud/toggle"};
+    wf::option_wrapper_t<int> update_interval{"hud/update_interval"};
+
+    static constexpr int width = 320;
+    static constexpr int text_height = 265;
+    static constexpr int graph_height = 60;
+    static constexpr int margin = 16;
+    /* Number of repaints in the graph */
+    static constexpr size_t graph_frames = width / 2;
+
+    struct frame_t
+    {
+        uint32_t time;
+        int64_t total_usec;
+    };
+
+    /* The recent repaints which weren't skipped, oldest first */
+    std::deque<frame_t> frames;
+
+    /* Accumulated since the last update of the overlay */
+    wf::frame_timings_t sum;
+    uint32_t summed_frames = 0;
+
+    bool active = false;
+    cairo_surface_t *surface = nullptr;
+    cairo_t *cr = nullptr;
+    GLuint texture = -1;
+    wf::geometry_t box = {margin, margin, width, text_height + graph_height};
+
+    wf::activator_callback toggle_cb;
+    wf::effect_hook_t overlay_hook;
+    wf::wl_timer update_timer;
+
+    wf::signal_callback_t on_frame_timings = [=] (wf::signal_data_t *data)
+    {
+        auto& timings = static_cast<wf::frame_timings_signal*>(data)->timings;
+        frames.push_back({wf::get_current_time(),
+            timings.phase_usec[wf::FRAME_PHASE_TOTAL]});
+        if (frames.size() > graph_frames)
+            frames.pop_front();
+
+        for (int i = 0; i < wf::FRAME_PHASE_COUNT; i++)
+            sum.phase_usec[i] += timings.phase_usec[i];
+
+        sum.surfaces_rendered += timings.surfaces_rendered;
+        sum.damage_area += timings.damage_area;
+        sum.gl_state_changes += timings.gl_state_changes;
+        sum.gl_state_changes_skipped += timings.gl_state_changes_skipped;
+        ++summed_frames;
+    };
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "hud";
+        grab_interface->capabilities = 0;
+
+        toggle_cb = [=] (wf::activator_source_t, uint32_t)
+        {
+            if (active)
+                hide();
+            else
+                show();
+
+            return true;
+        };
+        output->add_activator(toggle_key, &toggle_cb);
+
+        overlay_hook = [=] () { render(); };
+    }
+
+    void show()
+    {
+        active = true;
+        frames.clear();
+        sum = {};
+        summed_frames = 0;
+
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            box.width, box.height);
+        cr = cairo_create(surface);
+
+        output->render->connect_signal("frame-timings", &on_frame_timings);
+        output->render->add_effect(&overlay_hook, wf::OUTPUT_EFFECT_OVERLAY);
+        update();
+    }
+
+    void hide()
+    {
+        active = false;
+        update_timer.disconnect();
+        output->render->disconnect_signal("frame-timings", &on_frame_timings);
+        output->render->rem_effect(&overlay_hook);
+        output->render->damage(box);
+
+        cairo_destroy(cr);
+        cairo_surface_destroy(surface);
+        cr = nullptr;
+        surface = nullptr;
+
+        OpenGL::render_begin();
+        GL_CALL(glDeleteTextures(1, &texture));
+        OpenGL::render_end();
+        texture = -1;
+    }
+
+    /**
+     * The pixels of cairo are BGRA in memory, but they are uploaded as RGBA,
+     * so red and blue are swapped here.
+     */
+    void set_color(double r, double g, double b, double a)
+    {
+        cairo_set_source_rgba(cr, b, g, r, a);
+    }
+
+    /** Draw a line of text below the previous one */
+    void draw_line(double& y, const char *format, ...)
+    {
+        char text[256];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        y += 15;
+        cairo_move_to(cr, 8, y);
+        cairo_show_text(cr, text);
+    }
+
+    void draw_text()
+    {
+        uint32_t now = wf::get_current_time();
+        int fps = 0;
+        for (auto& frame : frames)
+            fps += (now - frame.time) < 1000;
+
+        double n = std::max(summed_frames, 1u);
+        auto avg_msec = [&] (wf::frame_phase_t phase)
+        {
+            return sum.phase_usec[phase] / n / 1000.0;
+        };
+
+        auto size = output->get_screen_size();
+        double output_area = std::max(1.0, 1.0 * size.width * size.height);
+        size_t memory = 0;
+        for (auto& [owner, bytes] : OpenGL::get_texture_memory_usage())
+            memory += bytes;
+
+        set_color(1, 1, 1, 1);
+        cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+            CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, 12);
+
+        double y = 4;
+        draw_line(y, "%s  %d fps", output->to_string().c_str(), fps);
+        draw_line(y, "repaint %.2f ms", avg_msec(wf::FRAME_PHASE_TOTAL));
+        for (int i = 0; i < wf::FRAME_PHASE_TOTAL; i++)
+        {
+            auto phase = (wf::frame_phase_t)i;
+            draw_line(y, "  %-14s %.2f ms", wf::frame_phase_name(phase),
+                avg_msec(phase));
+        }
+
+        draw_line(y, "damage %.1f%%",
+            100.0 * sum.damage_area / n / output_area);
+        draw_line(y, "surfaces %.1f  GL state %.1f (%.1f skipped)",
+            sum.surfaces_rendered / n, sum.gl_state_changes / n,
+            sum.gl_state_changes_skipped / n);
+        draw_line(y, "texture memory %.1f MiB", memory / (1024.0 * 1024.0));
+        draw_views(y);
+    }
+
+    /** The views of the output with the highest commit rates */
+    void draw_views(double& y)
+    {
+        static constexpr size_t max_views = 3;
+        std::vector<std::pair<wayfire_view, wf::surface_commit_stats_t>> views;
+        for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
+            views.push_back({view, view->get_commit_stats()});
+
+        std::sort(views.begin(), views.end(), [] (auto& a, auto& b)
+        {
+            return a.second.commit_rate > b.second.commit_rate;
+        });
+
+        draw_line(y, "commits/s  unpaced  missed  view");
+        for (size_t i = 0; i < std::min(views.size(), max_views); i++)
+        {
+            auto& [view, stats] = views[i];
+            double unpaced = 100.0 * stats.unthrottled_commits /
+                std::max<uint64_t>(stats.commits, 1);
+            draw_line(y, "%9.1f  %6.0f%%  %6llu  %.14s", stats.commit_rate, unpaced,
+                (unsigned long long)stats.missed_frames,
+                view->get_app_id().c_str());
+        }
+    }
+
+    /** Draw the repaint times as bars, with a line at 16.7ms */
+    void draw_graph()
+    {
+        const double max_msec = 33.3;
+        const double bottom = box.height - 4;
+        const double scale = (graph_height - 8) / max_msec;
+
+        double x = width - 2.0 * frames.size();
+        for (auto& frame : frames)
+        {
+            double msec = std::min(frame.total_usec / 1000.0, max_msec);
+            if (msec > 16.7)
+                set_color(1.0, 0.3, 0.3, 1.0);
+            else
+                set_color(0.3, 1.0, 0.3, 1.0);
+
+            cairo_rectangle(cr, x, bottom - msec * scale, 2, msec * scale);
+            cairo_fill(cr);
+            x += 2;
+        }
+
+        set_color(1, 1, 1, 0.5);
+        cairo_rectangle(cr, 0, bottom - 16.7 * scale, width, 1);
+        cairo_fill(cr);
+    }
+
+    /** Redraw the overlay with the statistics since the last update */
+    void update()
+    {
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        set_color(0, 0, 0, 0.7);
+        cairo_paint(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+        draw_text();
+        draw_graph();
+        cairo_surface_flush(surface);
+
+        OpenGL::render_begin();
+        cairo_surface_upload_to_texture(surface, texture);
+        OpenGL::render_end();
+
+        sum = {};
+        summed_frames = 0;
+        output->render->damage(box);
+
+        update_timer.set_timeout(std::max((int)update_interval, 16),
+            [=] () { update(); });
+    }
+
+    void render()
+    {
+        auto fb = output->render->get_target_framebuffer();
+        wf::region_t damage = output->render->get_scheduled_damage() &
+            fb.damage_box_from_geometry_box(box);
+        if (damage.empty())
+            return;
+
+        gl_geometry geometry = {
+            (float)(box.x + fb.geometry.x), (float)(box.y + fb.geometry.y),
+            (float)(box.x + fb.geometry.x + box.width),
+            (float)(box.y + fb.geometry.y + box.height),
+        };
+
+        OpenGL::render_begin(fb);
+        for (const auto& rect : damage)
+        {
+            fb.scissor(fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+            OpenGL::render_transformed_texture(texture, geometry, {},
+                fb.get_orthographic_projection(), glm::vec4(1.0),
+                TEXTURE_TRANSFORM_INVERT_Y);
+        }
+
+        OpenGL::render_end();
+    }
+
+    void fini() override
+    {
+        if (active)
+            hide();
+
+        output->rem_binding(&toggle_cb);
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_hud);
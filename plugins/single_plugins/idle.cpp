@@ -12,6 +12,7 @@ extern "C"
 #include "wayfire/signal-definitions.hpp"
 #include "../cube/cube-control-signal.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <wayfire/util/duration.hpp>
 #include <wayfire/util/log.hpp>
@@ -46,12 +47,15 @@ class wayfire_idle
     wf::option_wrapper_t<int> screensaver_timeout{"idle/screensaver_timeout"};
     wf::option_wrapper_t<double> cube_rotate_speed{"idle/cube_rotate_speed"};
     wf::option_wrapper_t<double> cube_max_zoom{"idle/cube_max_zoom"};
+    wf::option_wrapper_t<int> cube_max_fps{"idle/cube_max_fps"};
     wf::option_wrapper_t<bool> disable_on_fullscreen{"idle/disable_on_fullscreen"};
 
     wf::config::option_base_t::updated_callback_t disable_on_fullscreen_changed;
 
     screensaver_state state = SCREENSAVER_DISABLED;
-    std::map<wf::output_t*, bool> screensaver_hook_set;
+    /* The screensaver frames are driven by a timer instead of an animation
+     * hook, so that it draws at most cube_max_fps frames per second */
+    wf::wl_timer screensaver_timer;
     bool outputs_inhibited = false;
     bool idle_enabled = true;
     int idle_inhibit_ref = 0;
@@ -126,11 +130,18 @@ class wayfire_idle
         on_idle_dpms.set_callback([&] (void*)
         {
             set_state(wf::OUTPUT_IMAGE_SOURCE_SELF, wf::OUTPUT_IMAGE_SOURCE_DPMS);
+            /* Nothing is shown, so the screensaver pauses */
+            screensaver_timer.disconnect();
         });
         on_idle_dpms.connect(&timeout_dpms->events.idle);
 
         on_resume_dpms.set_callback([&] (void*) {
             set_state(wf::OUTPUT_IMAGE_SOURCE_DPMS, wf::OUTPUT_IMAGE_SOURCE_SELF);
+            if (state != SCREENSAVER_DISABLED)
+            {
+                last_time = wf::get_current_time();
+                schedule_screensaver_frame();
+            }
         });
         on_resume_dpms.connect(&timeout_dpms->events.resume);
     }
@@ -159,17 +170,13 @@ class wayfire_idle
         if (state == SCREENSAVER_DISABLED || outputs_inhibited)
             return;
 
+        screensaver_timer.disconnect();
         for (auto& output : wf::get_core().output_layout->get_outputs())
         {
-            if (screensaver_hook_set[output])
-            {
-                output->render->rem_effect(&screensaver_frame);
-                screensaver_hook_set[output] = false;
-            }
             output->render->add_inhibit(true);
             output->render->damage_whole();
         }
-        screensaver_hook_set.clear();
+
         state = SCREENSAVER_DISABLED;
         outputs_inhibited = true;
     }
@@ -181,14 +188,10 @@ class wayfire_idle
         data.zoom = ZOOM_BASE;
         data.ease = 0.0;
         data.last_frame = true;
+        screensaver_timer.disconnect();
         for (auto& output : wf::get_core().output_layout->get_outputs())
         {
             output->emit_signal("cube-control", &data);
-            if (screensaver_hook_set[output])
-            {
-                output->render->rem_effect(&screensaver_frame);
-                screensaver_hook_set[output] = false;
-            }
             if (state == SCREENSAVER_DISABLED && outputs_inhibited)
             {
                 output->render->add_inhibit(false);
@@ -199,19 +202,28 @@ class wayfire_idle
         state = SCREENSAVER_DISABLED;
     }
 
-    wf::effect_hook_t screensaver_frame = [=]()
+    void schedule_screensaver_frame()
+    {
+        int fps = std::max((int)cube_max_fps, 1);
+        screensaver_timer.set_timeout(std::max(1000 / fps, 1), [=] ()
+        {
+            if (screensaver_frame(wf::get_current_time()))
+                schedule_screensaver_frame();
+        });
+    }
+
+    /** @return Whether the screensaver continues */
+    bool screensaver_frame(uint32_t frame_time)
     {
         cube_control_signal data;
         bool all_outputs_active = true;
-        uint32_t current = wf::get_current_time();
-        uint32_t elapsed = current - last_time;
-
-        last_time = current;
+        uint32_t elapsed = frame_time - last_time;
+        last_time = frame_time;
 
         if (state == SCREENSAVER_STOPPING && !screensaver_animation.running())
         {
             screensaver_terminate();
-            return;
+            return false;
         }
 
         if (state == SCREENSAVER_STOPPING) {
@@ -242,7 +254,7 @@ class wayfire_idle
         {
             inhibit_outputs();
             state = SCREENSAVER_DISABLED;
-            return;
+            return false;
         }
 
         if (state == SCREENSAVER_STOPPING)
@@ -250,7 +262,9 @@ class wayfire_idle
             wlr_idle_notify_activity(wf::get_core().protocols.idle,
                 wf::get_core().get_current_seat());
         }
-    };
+
+        return true;
+    }
 
     void start_screensaver()
     {
@@ -260,26 +274,20 @@ class wayfire_idle
         data.ease = 0.0;
         data.last_frame = false;
         bool all_outputs_active = true;
-        bool hook_set = false;
+        bool any_output_active = false;
 
         for (auto& output : wf::get_core().output_layout->get_outputs())
         {
             output->emit_signal("cube-control", &data);
             if (data.carried_out)
-            {
-                if (!screensaver_hook_set[output] && !hook_set)
-                {
-                    output->render->add_effect(
-                        &screensaver_frame, wf::OUTPUT_EFFECT_PRE);
-                    hook_set = screensaver_hook_set[output] = true;
-                }
-            }
+                any_output_active = true;
             else
-            {
                 all_outputs_active = false;
-            }
         }
 
+        if (any_output_active && !screensaver_timer.is_connected())
+            schedule_screensaver_frame();
+
         state = SCREENSAVER_RUNNING;
 
         if (!all_outputs_active)
@@ -0,0 +1,449 @@
+#include <wayfire/singleton-plugin.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/view.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/frame-stats.hpp>
+#include <wayfire/opengl.hpp>
+#include <wayfire/accounting.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util/log.hpp>
+
+#include <wayland-server.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Serves the performance counters of the compositor in the Prometheus text
+ * format on a UNIX socket: each connection gets the current counters and is
+ * closed, so for ex. `socat - UNIX-CONNECT:<socket>` scrapes them. GPU time
+ * is included when core/gpu_timing is enabled, and the time of the callbacks
+ * of each plugin when core/plugin_accounting is enabled.
+ *
+ * The counters are the frame statistics of the outputs and the commit
+ * statistics of the views, which are collected anyway, so nothing is measured
+ * for the plugin and an idle socket costs nothing.
+ */
+class wayfire_metrics
+{
+    wf::option_wrapper_t<std::string> socket_path{"metrics/socket"};
+
+    int listen_fd = -1;
+    std::string bound_path;
+    wl_event_source *listen_source = nullptr;
+
+    struct client_t
+    {
+        int fd;
+        std::string data;
+        size_t written = 0;
+        wl_event_source *source = nullptr;
+    };
+
+    std::map<int, std::unique_ptr<client_t>> clients;
+
+    static std::string get_default_path()
+    {
+        const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+        const char *display = std::getenv("WAYLAND_DISPLAY");
+
+        return std::string(runtime_dir ? runtime_dir : "/tmp") +
+               "/wayfire-metrics-" + (display ? display : "wayland-0") + ".sock";
+    }
+
+    void start_listening()
+    {
+        std::string path = socket_path;
+        if (path.empty())
+            path = get_default_path();
+
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            LOGE("metrics: socket path too long: ", path);
+            return;
+        }
+
+        std::strcpy(addr.sun_path, path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (listen_fd < 0)
+        {
+            LOGE("metrics: failed to create a socket: ", std::strerror(errno));
+            return;
+        }
+
+        /* A stale socket from a previous session */
+        unlink(path.c_str());
+        if ((bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) ||
+            (listen(listen_fd, 16) < 0))
+        {
+            LOGE("metrics: failed to listen on ", path, ": ", std::strerror(errno));
+            close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+
+        bound_path = path;
+        listen_source = wl_event_loop_add_fd(wf::get_core().ev_loop, listen_fd,
+            WL_EVENT_READABLE, handle_accept, this);
+        LOGI("metrics: serving on ", path);
+    }
+
+    void stop_listening()
+    {
+        for (auto& [fd, client] : clients)
+        {
+            wl_event_source_remove(client->source);
+            close(fd);
+        }
+
+        clients.clear();
+        if (listen_fd < 0)
+            return;
+
+        wl_event_source_remove(listen_source);
+        close(listen_fd);
+        unlink(bound_path.c_str());
+        listen_fd = -1;
+        listen_source = nullptr;
+    }
+
+    static int handle_accept(int fd, uint32_t mask, void *data)
+    {
+        auto self = static_cast<wayfire_metrics*>(data);
+        int client_fd;
+        while ((client_fd = accept4(fd, nullptr, nullptr,
+            SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+        {
+            auto client = std::make_unique<client_t>();
+            client->fd = client_fd;
+            client->data = self->collect();
+            client->source = wl_event_loop_add_fd(wf::get_core().ev_loop,
+                client_fd, WL_EVENT_WRITABLE, handle_writable, self);
+            self->clients[client_fd] = std::move(client);
+        }
+
+        return 0;
+    }
+
+    static int handle_writable(int fd, uint32_t mask, void *data)
+    {
+        auto self = static_cast<wayfire_metrics*>(data);
+        auto it = self->clients.find(fd);
+        if (it == self->clients.end())
+            return 0;
+
+        auto& client = *it->second;
+        while (client.written < client.data.size())
+        {
+            ssize_t n = send(fd, client.data.data() + client.written,
+                client.data.size() - client.written, MSG_NOSIGNAL);
+            if ((n < 0) && (errno == EAGAIN))
+                return 0;
+
+            if (n <= 0)
+                break;
+
+            client.written += n;
+        }
+
+        wl_event_source_remove(client.source);
+        close(fd);
+        self->clients.erase(it);
+        return 0;
+    }
+
+    /** Escape a label value of the text format */
+    static std::string escape(const std::string& value)
+    {
+        std::string result;
+        for (char c : value)
+        {
+            if ((c == '\\') || (c == '"'))
+                result += '\\';
+
+            if (c == '\n')
+                result += "\\n";
+            else
+                result += c;
+        }
+
+        return result;
+    }
+
+    struct writer_t
+    {
+        std::ostringstream out;
+
+        void header(const std::string& name, const std::string& type,
+            const std::string& help)
+        {
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " " << type << "\n";
+        }
+
+        void value(const std::string& name, const std::string& labels,
+            double value)
+        {
+            out << name << "{" << labels << "} " << value << "\n";
+        }
+
+        /** Write the histogram as a summary in seconds */
+        void summary(const std::string& name, const std::string& labels,
+            const wf::duration_histogram_t& histogram)
+        {
+            for (double q : {0.5, 0.9, 0.99})
+            {
+                value(name, labels + ",quantile=\"" + std::to_string(q) + "\"",
+                    histogram.get_percentile(q * 100) / 1e6);
+            }
+
+            value(name + "_sum", labels,
+                histogram.get_mean() * histogram.get_count() / 1e6);
+            value(name + "_count", labels, histogram.get_count());
+        }
+    };
+
+    std::string collect()
+    {
+        writer_t w;
+        w.out.precision(9);
+
+        auto outputs = wf::get_core().output_layout->get_outputs();
+        auto for_each_output = [&] (auto func)
+        {
+            for (auto output : outputs)
+            {
+                func("output=\"" + escape(output->to_string()) + "\"",
+                    output->render->get_frame_stats());
+            }
+        };
+
+        w.header("wayfire_frames_total", "counter",
+            "Repaints by result: rendered, skipped without damage, scanned out");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            w.value("wayfire_frames_total", l + ",kind=\"rendered\"",
+                s.get_rendered_frames());
+            w.value("wayfire_frames_total", l + ",kind=\"skipped\"",
+                s.get_skipped_frames());
+            w.value("wayfire_frames_total", l + ",kind=\"scanout\"",
+                s.get_scanout_frames());
+        });
+
+        w.header("wayfire_frame_phase_seconds", "summary",
+            "Duration of each repaint phase, including the effect hooks");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            for (int i = 0; i < wf::FRAME_PHASE_COUNT; i++)
+            {
+                auto phase = (wf::frame_phase_t)i;
+                w.summary("wayfire_frame_phase_seconds",
+                    l + ",phase=\"" + wf::frame_phase_name(phase) + "\"",
+                    s.get_phase(phase));
+            }
+        });
+
+        w.header("wayfire_present_latency_seconds", "summary",
+            "Time from the commit of a frame until it was shown");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            w.summary("wayfire_present_latency_seconds", l,
+                s.get_present_latency());
+        });
+
+        w.header("wayfire_present_interval_seconds", "summary",
+            "Time between presented frames");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            w.summary("wayfire_present_interval_seconds", l,
+                s.get_present_interval());
+        });
+
+        w.header("wayfire_missed_vblanks_total", "counter",
+            "Vblanks which passed between a commit and its presentation");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            w.value("wayfire_missed_vblanks_total", l, s.get_missed_vblanks());
+        });
+
+        w.header("wayfire_input_latency_seconds", "summary",
+            "Time from an input event until the frame showing it was presented");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            for (auto& [device, histogram] : s.get_input_latency())
+            {
+                w.summary("wayfire_input_latency_seconds",
+                    l + ",device=\"" + escape(device) + "\"", histogram);
+            }
+        });
+
+        w.header("wayfire_surfaces_rendered_total", "counter",
+            "Surfaces drawn by the renderer");
+        w.header("wayfire_views_culled_total", "counter",
+            "Views skipped because they were covered");
+        w.header("wayfire_damage_pixels_total", "counter",
+            "Damaged area, and the part added by effects");
+        w.header("wayfire_gl_state_changes_total", "counter",
+            "GL state changes, issued or skipped because they were redundant");
+        w.header("wayfire_render_targets_total", "counter",
+            "Framebuffers taken from the pool or created");
+        w.header("wayfire_repaint_list_allocations_total", "counter",
+            "Times the render lists had to grow");
+        w.header("wayfire_frame_events_total", "counter",
+            "Frame events sent, throttled for hidden surfaces or deferred by pacing");
+        for_each_output([&] (const std::string& l, const wf::frame_stats_t& s)
+        {
+            w.value("wayfire_surfaces_rendered_total", l,
+                s.get_total_surfaces_rendered());
+            w.value("wayfire_views_culled_total", l, s.get_total_views_culled());
+            w.value("wayfire_damage_pixels_total", l + ",kind=\"damage\"",
+                s.get_total_damage_area());
+            w.value("wayfire_damage_pixels_total", l + ",kind=\"inflated\"",
+                s.get_total_damage_area_inflated());
+            w.value("wayfire_gl_state_changes_total", l + ",result=\"issued\"",
+                s.get_total_gl_state_changes());
+            w.value("wayfire_gl_state_changes_total", l + ",result=\"skipped\"",
+                s.get_total_gl_state_changes_skipped());
+            w.value("wayfire_render_targets_total", l + ",result=\"reused\"",
+                s.get_total_render_target_hits());
+            w.value("wayfire_render_targets_total", l + ",result=\"created\"",
+                s.get_total_render_target_misses());
+            w.value("wayfire_repaint_list_allocations_total", l,
+                s.get_total_repaint_allocations());
+            w.value("wayfire_frame_events_total", l + ",kind=\"sent\"",
+                s.get_total_frame_done_sent());
+            w.value("wayfire_frame_events_total", l + ",kind=\"throttled\"",
+                s.get_total_frame_done_throttled());
+            w.value("wayfire_frame_events_total", l + ",kind=\"deferred\"",
+                s.get_total_frame_done_deferred());
+        });
+
+        w.header("wayfire_view_commits_total", "counter",
+            "Commits of the main surface of each view, by whether they followed "
+            "a frame event, and after how long");
+        w.header("wayfire_view_commit_rate", "gauge",
+            "Commits per second of the main surface of each view");
+        w.header("wayfire_view_damage_pixels_total", "counter",
+            "Area damaged by the commits of each view, in surface pixels");
+        w.header("wayfire_view_frame_events_total", "counter",
+            "Frame events sent to each view while it was waiting for one");
+        w.header("wayfire_view_missed_frames_total", "counter",
+            "Refresh cycles which passed between a frame event and the commit");
+        w.header("wayfire_view_frame_to_commit_seconds_total", "counter",
+            "Time from a frame event until the next paced commit of each view");
+        for (auto output : outputs)
+        {
+            for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
+            {
+                auto stats = view->get_commit_stats();
+                std::string l = "view=\"" + std::to_string(view->get_id()) +
+                    "\",app_id=\"" + escape(view->get_app_id()) + "\"";
+                w.value("wayfire_view_commits_total", l + ",kind=\"paced\"",
+                    stats.commits - stats.unthrottled_commits -
+                    stats.idle_commits);
+                w.value("wayfire_view_commits_total", l + ",kind=\"idle\"",
+                    stats.idle_commits);
+                w.value("wayfire_view_commits_total", l + ",kind=\"unthrottled\"",
+                    stats.unthrottled_commits);
+                w.value("wayfire_view_commit_rate", l, stats.commit_rate);
+                w.value("wayfire_view_damage_pixels_total", l, stats.damage_area);
+                w.value("wayfire_view_frame_events_total", l, stats.frame_events);
+                w.value("wayfire_view_missed_frames_total", l,
+                    stats.missed_frames);
+                w.value("wayfire_view_frame_to_commit_seconds_total", l,
+                    stats.frame_to_commit_usec / 1e6);
+            }
+        }
+
+        auto& loop_stats = wf::get_event_loop_stats();
+        w.header("wayfire_event_loop_iterations_total", "counter",
+            "Event loop iterations, each client is flushed at most once per "
+            "iteration");
+        w.value("wayfire_event_loop_iterations_total", "", loop_stats.iterations);
+        w.header("wayfire_client_flush_seconds_total", "counter",
+            "Time spent flushing the buffered events to clients");
+        w.value("wayfire_client_flush_seconds_total", "",
+            loop_stats.flush_nsec / 1e9);
+
+        w.header("wayfire_texture_memory_bytes", "gauge",
+            "GPU memory used by textures, by owner");
+        for (auto& [owner, bytes] : OpenGL::get_texture_memory_usage())
+        {
+            w.value("wayfire_texture_memory_bytes",
+                "owner=\"" + escape(owner) + "\"", bytes);
+        }
+
+        w.header("wayfire_object_memory_bytes", "gauge",
+            "Memory held for each view and output, by subsystem");
+        for (auto& usage : wf::accounting::get_memory_usage())
+        {
+            w.value("wayfire_object_memory_bytes",
+                "owner=\"" + escape(usage.owner) + "\",subsystem=\"" +
+                escape(usage.subsystem) + "\",kind=\"" +
+                (usage.kind == wf::accounting::MEMORY_GPU ? "gpu" : "cpu") + "\"",
+                usage.bytes);
+        }
+
+        w.header("wayfire_gpu_seconds_total", "counter",
+            "GPU time with core/gpu_timing, by plugin and kind of work");
+        w.header("wayfire_gpu_blocks_total", "counter",
+            "Blocks of GPU work measured with core/gpu_timing");
+        for (auto& [owner, time] : OpenGL::get_gpu_times())
+        {
+            /* Owners are plugin:kind */
+            auto split = owner.find(':');
+            std::string labels = "plugin=\"" + escape(owner.substr(0, split)) +
+                "\",kind=\"" + escape(owner.substr(split + 1)) + "\"";
+            w.value("wayfire_gpu_seconds_total", labels, time.total_nsec / 1e9);
+            w.value("wayfire_gpu_blocks_total", labels, time.count);
+        }
+
+        w.header("wayfire_plugin_cpu_seconds_total", "counter",
+            "Time in the callbacks of each plugin with core/plugin_accounting, "
+            "without the callbacks they ran");
+        w.header("wayfire_plugin_calls_total", "counter",
+            "Callbacks run with core/plugin_accounting");
+        for (auto& [owner, time] : wf::accounting::get_cpu_times())
+        {
+            std::string labels = "plugin=\"" + escape(owner.first) +
+                "\",source=\"" + escape(owner.second) + "\"";
+            w.value("wayfire_plugin_cpu_seconds_total", labels,
+                time.self_nsec / 1e9);
+            w.value("wayfire_plugin_calls_total", labels, time.count);
+        }
+
+        return w.out.str();
+    }
+
+  public:
+    wayfire_metrics()
+    {
+        start_listening();
+        socket_path.set_callback([=] ()
+        {
+            stop_listening();
+            start_listening();
+        });
+    }
+
+    ~wayfire_metrics()
+    {
+        stop_listening();
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN((wf::singleton_plugin_t<wayfire_metrics>));
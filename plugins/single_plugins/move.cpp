@@ -71,10 +71,23 @@ class wayfire_move : public wf::plugin_interface_t
     bool was_client_request;
 
     struct {
-        nonstd::observer_ptr<wf::preview_indication_view_t> preview;
+        std::unique_ptr<wf::preview_indication_overlay_t> preview;
         int slot_id = 0;
     } slot;
 
+    /* Input motion is applied at most once per frame, in a pre hook, so
+     * that the view is moved and the slot is recalculated only as often as
+     * the output can show it */
+    bool motion_pending = false;
+    wf::effect_hook_t pre_hook = [=] ()
+    {
+        if (!motion_pending)
+            return;
+
+        motion_pending = false;
+        apply_input_motion();
+    };
+
 #define MOVE_HELPER view->get_data<wf::move_snap_helper_t>()
 
     public:
@@ -83,6 +96,8 @@ class wayfire_move : public wf::plugin_interface_t
             grab_interface->name = "move";
             grab_interface->capabilities =
                 wf::CAPABILITY_GRAB_INPUT | wf::CAPABILITY_MANAGE_DESKTOP;
+            slot.preview =
+                std::make_unique<wf::preview_indication_overlay_t>(output);
 
             activate_binding = [=] (uint32_t, int, int)
             {
@@ -214,7 +229,8 @@ class wayfire_move : public wf::plugin_interface_t
                 slot.slot_id = 0;
 
             this->view = view;
-            output->render->set_redraw_always();
+            motion_pending = false;
+            output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
             update_multi_output();
 
             return true;
@@ -227,17 +243,28 @@ class wayfire_move : public wf::plugin_interface_t
 
             grab_interface->ungrab();
             output->deactivate_plugin(grab_interface);
-            output->render->set_redraw_always(false);
+            output->render->rem_effect(&pre_hook);
 
             /* The view was moved to another output or was destroyed,
              * we don't have to do anything more */
             if (view_destroyed)
             {
+                motion_pending = false;
                 view->erase_data<wf::move_snap_helper_t>();
                 this->view = nullptr;
                 return;
             }
 
+            /* Apply the last motion, but without changing the output */
+            if (motion_pending)
+            {
+                motion_pending = false;
+                auto input = get_input_coords();
+                MOVE_HELPER->handle_motion(input);
+                if (enable_snap && !MOVE_HELPER->is_view_fixed())
+                    update_slot(calc_slot(input.x, input.y));
+            }
+
             MOVE_HELPER->handle_input_released();
             view->erase_data<wf::move_snap_helper_t>();
 
@@ -312,18 +339,11 @@ class wayfire_move : public wf::plugin_interface_t
             if (slot.slot_id == new_slot_id)
                 return;
 
-            /* Destroy previous preview */
-            if (slot.preview)
-            {
-                auto input = get_input_coords();
-                slot.preview->set_target_geometry(
-                    {input.x, input.y, 1, 1}, 0, true);
-                slot.preview = nullptr;
-            }
-
             slot.slot_id = new_slot_id;
+            auto input = get_input_coords();
 
-            /* Show a preview overlay */
+            /* Show a preview overlay, or move the existing one to the new
+             * slot */
             if (new_slot_id)
             {
                 snap_query_signal query;
@@ -331,21 +351,16 @@ class wayfire_move : public wf::plugin_interface_t
                 query.out_geometry = {0, 0, -1, -1};
                 output->emit_signal("query-snap-geometry", &query);
 
-                /* Unknown slot geometry, can't show a preview */
-                if (query.out_geometry.width <= 0 || query.out_geometry.height <= 0)
+                /* Known slot geometry, show a preview */
+                if (query.out_geometry.width > 0 && query.out_geometry.height > 0)
+                {
+                    slot.preview->set_target_geometry({input.x, input.y, 1, 1},
+                        query.out_geometry, 1);
                     return;
-
-                auto input = get_input_coords();
-                auto preview = new wf::preview_indication_view_t(output,
-                    {input.x, input.y, 1, 1});
-
-                wf::get_core().add_view(
-                    std::unique_ptr<wf::view_interface_t> (preview));
-
-                preview->set_output(output);
-                preview->set_target_geometry(query.out_geometry, 1);
-                slot.preview = nonstd::make_observer(preview);
+                }
             }
+
+            slot.preview->hide(input);
         }
 
         /* Returns the currently used input coordinates in global compositor space */
@@ -519,6 +534,15 @@ class wayfire_move : public wf::plugin_interface_t
         }
 
         void handle_input_motion()
+        {
+            if (!motion_pending)
+            {
+                motion_pending = true;
+                output->render->schedule_redraw();
+            }
+        }
+
+        void apply_input_motion()
         {
             auto input = get_input_coords();
             MOVE_HELPER->handle_motion(get_input_coords());
@@ -546,6 +570,7 @@ class wayfire_move : public wf::plugin_interface_t
             output->disconnect_signal("move-request", &move_request);
             output->disconnect_signal("detach-view", &view_destroyed);
             output->disconnect_signal("view-disappeared", &view_destroyed);
+            slot.preview = nullptr;
         }
 };
 
@@ -3,6 +3,7 @@
 #include <wayfire/core.hpp>
 #include <wayfire/view.hpp>
 #include <wayfire/output-layout.hpp>
+#include <wayfire/workspace-manager.hpp>
 #include <linux/input-event-codes.h>
 
 class wayfire_output_manager : public wf::plugin_interface_t
@@ -41,7 +42,8 @@ class wayfire_output_manager : public wf::plugin_interface_t
             return true;
         }
 
-        wf::get_core().move_view_to_output(view, next);
+        next->workspace->transfer_views({view});
+        next->focus_view(view);
         idle_next_output.run_once([=] () {
             wf::get_core().focus_output(next);
         });
@@ -4,6 +4,9 @@
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/signal-definitions.hpp>
 
+#include <map>
+#include "free-space-index.hpp"
+
 class wayfire_place_window : public wf::plugin_interface_t
 {
     wf::signal_callback_t created_cb;
@@ -12,6 +15,14 @@ class wayfire_place_window : public wf::plugin_interface_t
 
     int cascade_x, cascade_y;
 
+    /* The free space of the workarea on the current workspace, used by the
+     * smart mode */
+    wf::free_space_index_t free_space;
+    /* The views indexed as obstacles, with the geometry they had then.
+     * Only compared, never dereferenced. */
+    std::map<wf::view_interface_t*, wf::geometry_t> indexed_views;
+    wf::geometry_t indexed_workarea = {0, 0, 0, 0};
+
     public:
     void init() override
     {
@@ -36,6 +47,8 @@ class wayfire_place_window : public wf::plugin_interface_t
             std::string mode = placement_mode;
             if (mode == "cascade")
                 cascade(view, workarea);
+            else if (mode == "smart")
+                smart(view, workarea);
             else if (mode == "random")
                 random(view, workarea);
             else
@@ -72,6 +85,77 @@ class wayfire_place_window : public wf::plugin_interface_t
         cascade_y += workarea.height * .03;
     }
 
+    /** @return The views which the smart mode avoids covering */
+    std::vector<wayfire_view> get_obstacle_views(wayfire_view placed)
+    {
+        std::vector<wayfire_view> views;
+        auto ws = output->workspace->get_current_workspace();
+        for (auto& view : output->workspace->get_views_on_workspace(ws,
+            wf::LAYER_WORKSPACE, true))
+        {
+            if ((view != placed) && view->is_mapped() && !view->minimized)
+                views.push_back(view);
+        }
+
+        return views;
+    }
+
+    /**
+     * Make sure the free space index matches the views on the workspace.
+     * Views mapped since the last placement are added incrementally, the
+     * index is rebuilt only if a view was unmapped, moved or resized.
+     */
+    void update_free_space(wayfire_view placed, wf::geometry_t workarea)
+    {
+        auto views = get_obstacle_views(placed);
+        bool valid = (workarea == indexed_workarea);
+
+        size_t matched = 0;
+        std::vector<wayfire_view> added;
+        for (auto& view : views)
+        {
+            auto it = indexed_views.find(view.get());
+            if (it == indexed_views.end())
+            {
+                added.push_back(view);
+                continue;
+            }
+
+            valid &= (it->second == view->get_wm_geometry());
+            ++matched;
+        }
+
+        if (!valid || (matched != indexed_views.size()))
+        {
+            free_space.reset(workarea);
+            indexed_views.clear();
+            indexed_workarea = workarea;
+            added = views;
+        }
+
+        for (auto& view : added)
+            index_view(view);
+    }
+
+    void index_view(wayfire_view view)
+    {
+        free_space.add_obstacle(view->get_wm_geometry());
+        indexed_views[view.get()] = view->get_wm_geometry();
+    }
+
+    void smart(wayfire_view &view, wf::geometry_t workarea)
+    {
+        update_free_space(view, workarea);
+
+        wf::geometry_t window = view->get_wm_geometry();
+        auto pos = free_space.find_position({window.width, window.height});
+        view->move(pos.x, pos.y);
+
+        /* The placed view is indexed right away, so that windows mapped
+         * together don't land on each other */
+        index_view(view);
+    }
+
     void random(wayfire_view &view, wf::geometry_t workarea)
     {
         wf::geometry_t window = view->get_wm_geometry();
@@ -0,0 +1,151 @@
+#include <wayfire/plugin.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/workspace-stream.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+extern "C"
+{
+#include <wlr/types/wlr_output.h>
+}
+
+/**
+ * Keeps thumbnails of all workspaces of the output up to date while the
+ * session is idle, so that expo shows them as soon as it is activated,
+ * instead of rendering every workspace in its first frames.
+ *
+ * The thumbnails are the shared workspace streams with the scale which expo
+ * uses once zoomed out, 1 / max(grid width, grid height), so together they
+ * have about as many pixels as the output itself. Expo also starts its
+ * zoom-out animation from them.
+ *
+ * The output is idle when there was no input and no frame was painted for
+ * prewarm/idle_timeout milliseconds. Then one thumbnail is updated on each
+ * tick, so that the updates never delay the frames of clients for long.
+ * Streams repaint only their damaged parts, so the thumbnails of workspaces
+ * which didn't change cost nothing.
+ */
+class wayfire_prewarm : public wf::plugin_interface_t
+{
+    wf::option_wrapper_t<int> idle_timeout{"prewarm/idle_timeout"};
+
+    /* The time between the updates of two thumbnails */
+    static constexpr uint32_t update_interval = 20;
+
+    std::vector<std::shared_ptr<wf::workspace_stream_t>> streams;
+    wf::dimensions_t grid = {0, 0};
+    /* The thumbnails before it were updated since the last activity */
+    size_t next_stream = 0;
+
+    uint32_t last_activity = 0;
+    wf::wl_timer timer;
+
+    void create_streams()
+    {
+        grid = output->workspace->get_workspace_grid_size();
+        float scale = 1.f / std::max(grid.width, grid.height);
+
+        streams.clear();
+        for (int j = 0; j < grid.height; j++)
+        {
+            for (int i = 0; i < grid.width; i++)
+            {
+                streams.push_back(output->render->get_shared_workspace_stream(
+                    {i, j}, scale, scale));
+            }
+        }
+
+        next_stream = 0;
+    }
+
+    void schedule(uint32_t delay)
+    {
+        timer.set_timeout(std::max(delay, 1u), [=] () { update_next(); });
+    }
+
+    void update_next()
+    {
+        uint32_t timeout = std::max(0, (int)idle_timeout);
+        uint32_t idle = wf::get_current_time() - last_activity;
+        if (idle < timeout)
+            return schedule(timeout - idle);
+
+        /* Nothing is shown on a disabled output, and pending damage means
+         * that a frame follows, which counts as activity again */
+        if (!output->handle->enabled ||
+            !output->render->get_scheduled_damage().empty())
+        {
+            return;
+        }
+
+        auto current_grid = output->workspace->get_workspace_grid_size();
+        if ((current_grid.width != grid.width) ||
+            (current_grid.height != grid.height))
+        {
+            create_streams();
+        }
+
+        output->render->workspace_stream_update(*streams[next_stream]);
+        if (++next_stream < streams.size())
+            schedule(update_interval);
+
+        /* Otherwise, everything is up to date until the next activity */
+    }
+
+    void on_activity()
+    {
+        last_activity = wf::get_current_time();
+        next_stream = 0;
+        if (!timer.is_connected())
+            schedule(std::max(0, (int)idle_timeout));
+    }
+
+    wf::signal_connection_t on_input = [=] (wf::signal_data_t*)
+    {
+        on_activity();
+    };
+
+    wf::signal_connection_t on_frame = [=] (wf::signal_data_t*)
+    {
+        on_activity();
+    };
+
+    const std::vector<std::string> input_signals = {
+        "pointer_motion", "pointer_motion_absolute", "pointer_button",
+        "pointer_axis", "keyboard_key", "touch_down", "touch_motion",
+    };
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "prewarm";
+        grab_interface->capabilities = 0;
+
+        create_streams();
+        for (auto& signal : input_signals)
+            wf::get_core().connect_signal(signal, &on_input);
+
+        output->render->connect_signal("frame-timings", &on_frame);
+        on_activity();
+    }
+
+    void fini() override
+    {
+        timer.disconnect();
+        on_input.disconnect();
+        on_frame.disconnect();
+
+        /* Dropping the handles releases the streams which no other plugin
+         * uses */
+        streams.clear();
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_prewarm);
@@ -0,0 +1,198 @@
+#include <wayfire/singleton-plugin.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/frame-stats.hpp>
+#include <wayfire/signal-definitions.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util/log.hpp>
+#include "session-trace.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+
+extern "C"
+{
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_keyboard.h>
+}
+
+/**
+ * Records the input events, the frame timings of the outputs and the damage
+ * of the views to a trace, see session-trace.hpp. The trace can be replayed
+ * on the headless backend with the replay scenario of the bench plugin, so
+ * that the frame times of different builds can be compared on the same
+ * workload.
+ *
+ * Only metadata is recorded, no contents, so the clients are replaced by
+ * colored windows when replaying.
+ */
+class wayfire_recorder
+{
+    wf::option_wrapper_t<std::string> file_opt{"recorder/file"};
+
+    std::ofstream out;
+    uint32_t start_time = wf::get_current_time();
+
+    void write(std::string type, std::vector<double> args,
+        wf::output_t *output = nullptr)
+    {
+        session_trace::event_t event;
+        event.time = wf::get_current_time() - start_time;
+        event.type = std::move(type);
+        event.args = std::move(args);
+        if (output)
+            event.output = output->handle->name;
+
+        out << session_trace::format(event) << "\n";
+    }
+
+    /** The connections to the signals of one output */
+    struct output_recorder_t
+    {
+        wf::output_t *output;
+        /* The last recorded geometry of each view */
+        std::map<uint32_t, wf::geometry_t> views;
+
+        wf::signal_connection_t on_view_damaged, on_view_disappeared;
+        wf::signal_connection_t on_frame_timings;
+    };
+
+    std::map<wf::output_t*, std::unique_ptr<output_recorder_t>> outputs;
+
+    void add_output(wf::output_t *output)
+    {
+        auto rec = std::make_unique<output_recorder_t>();
+        auto r = rec.get();
+        r->output = output;
+
+        r->on_view_damaged.set_callback([=] (wf::signal_data_t *data)
+        {
+            auto ev = static_cast<wf::view_damaged_signal*>(data);
+            auto id = ev->view->get_id();
+            auto geometry = ev->view->get_wm_geometry();
+
+            auto it = r->views.find(id);
+            if ((it == r->views.end()) || !(it->second == geometry))
+            {
+                r->views[id] = geometry;
+                write("view", {(double)id, (double)geometry.x,
+                    (double)geometry.y, (double)geometry.width,
+                    (double)geometry.height}, output);
+            }
+
+            /* The box is in damage coordinates, i.e scaled */
+            double scale = output->handle->scale;
+            write("damage", {(double)id,
+                std::floor(ev->box.x / scale) - geometry.x,
+                std::floor(ev->box.y / scale) - geometry.y,
+                std::ceil(ev->box.width / scale),
+                std::ceil(ev->box.height / scale)}, output);
+        });
+
+        r->on_view_disappeared.set_callback([=] (wf::signal_data_t *data)
+        {
+            auto id = get_signaled_view(data)->get_id();
+            if (r->views.erase(id))
+                write("close", {(double)id}, output);
+        });
+
+        r->on_frame_timings.set_callback([=] (wf::signal_data_t *data)
+        {
+            auto& timings = static_cast<wf::frame_timings_signal*>(data)->timings;
+            write("frame", {(double)timings.phase_usec[wf::FRAME_PHASE_TOTAL],
+                (double)timings.phase_usec[wf::FRAME_PHASE_RENDER]}, output);
+        });
+
+        output->connect_signal("view-damaged", &r->on_view_damaged);
+        output->connect_signal("view-disappeared", &r->on_view_disappeared);
+        output->render->connect_signal("frame-timings", &r->on_frame_timings);
+        outputs[output] = std::move(rec);
+    }
+
+    wf::signal_connection_t on_output_added = [=] (wf::signal_data_t *data)
+    {
+        add_output(get_signaled_output(data));
+    };
+
+    wf::signal_connection_t on_output_removed = [=] (wf::signal_data_t *data)
+    {
+        outputs.erase(get_signaled_output(data));
+    };
+
+    template<class wlr_event_t>
+    static wlr_event_t *get_event(wf::signal_data_t *data)
+    {
+        return static_cast<wf::input_event_signal<wlr_event_t>*>(data)->event;
+    }
+
+    wf::signal_connection_t on_key = [=] (wf::signal_data_t *data)
+    {
+        auto ev = get_event<wlr_event_keyboard_key>(data);
+        write("key", {(double)ev->keycode, (double)ev->state});
+    };
+
+    wf::signal_connection_t on_button = [=] (wf::signal_data_t *data)
+    {
+        auto ev = get_event<wlr_event_pointer_button>(data);
+        write("button", {(double)ev->button, (double)ev->state});
+    };
+
+    wf::signal_connection_t on_motion = [=] (wf::signal_data_t *data)
+    {
+        auto ev = get_event<wlr_event_pointer_motion>(data);
+        write("motion", {ev->delta_x, ev->delta_y});
+    };
+
+    wf::signal_connection_t on_motion_absolute = [=] (wf::signal_data_t *data)
+    {
+        auto ev = get_event<wlr_event_pointer_motion_absolute>(data);
+        write("motion_absolute", {ev->x, ev->y});
+    };
+
+    wf::signal_connection_t on_axis = [=] (wf::signal_data_t *data)
+    {
+        auto ev = get_event<wlr_event_pointer_axis>(data);
+        write("axis", {(double)ev->orientation, ev->delta,
+            (double)ev->delta_discrete, (double)ev->source});
+    };
+
+  public:
+    wayfire_recorder()
+    {
+        std::string path = file_opt;
+        if (path.empty())
+        {
+            const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+            path = std::string(runtime_dir ? runtime_dir : "/tmp") +
+                "/wayfire-session.trace";
+        }
+
+        out.open(path);
+        if (!out)
+        {
+            LOGE("recorder: failed to open ", path);
+            return;
+        }
+
+        LOGI("recorder: recording to ", path);
+        auto& core = wf::get_core();
+        core.connect_signal("keyboard_key", &on_key);
+        core.connect_signal("pointer_button", &on_button);
+        core.connect_signal("pointer_motion", &on_motion);
+        core.connect_signal("pointer_motion_absolute", &on_motion_absolute);
+        core.connect_signal("pointer_axis", &on_axis);
+
+        core.output_layout->connect_signal("output-added", &on_output_added);
+        core.output_layout->connect_signal("output-removed", &on_output_removed);
+        for (auto& output : core.output_layout->get_outputs())
+            add_output(output);
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN((wf::singleton_plugin_t<wayfire_recorder>));
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <optional>
 #include <wayfire/plugin.hpp>
 #include <wayfire/debug.hpp>
 #include <wayfire/output.hpp>
@@ -11,10 +12,88 @@
 extern "C"
 {
 #include <wlr/types/wlr_xcursor_manager.h>
+#include <wlr/types/wlr_surface.h>
 }
 
 #include "../wobbly/wobbly-signal.hpp"
 
+/**
+ * Paces the resizing of a view: a new size is sent only when the client has
+ * committed since the previous one, and the sizes requested in between are
+ * coalesced into the last one. Slow clients then get as many configures as
+ * they can draw, instead of one per motion event.
+ */
+class resize_pacer_t
+{
+    /* How long to wait for a commit, for ex. when the client doesn't redraw
+     * because it can't take the requested size */
+    static constexpr uint32_t COMMIT_TIMEOUT_MS = 100;
+
+    wayfire_view view;
+    bool outstanding = false;
+    std::optional<wf::dimensions_t> pending;
+
+    wf::wl_listener_wrapper on_commit;
+    wf::wl_timer timeout;
+
+    void send_pending()
+    {
+        timeout.disconnect();
+        outstanding = false;
+        if (!pending)
+            return;
+
+        view->resize(pending->width, pending->height);
+        pending.reset();
+
+        outstanding = true;
+        timeout.set_timeout(COMMIT_TIMEOUT_MS, [=] () { send_pending(); });
+    }
+
+  public:
+    resize_pacer_t()
+    {
+        on_commit.set_callback([=] (void*) { send_pending(); });
+    }
+
+    void start(wayfire_view view)
+    {
+        cancel();
+        this->view = view;
+        if (view->get_wlr_surface())
+            on_commit.connect(&view->get_wlr_surface()->events.commit);
+    }
+
+    void resize(int width, int height)
+    {
+        if (!view)
+            return;
+
+        pending = wf::dimensions_t{width, height};
+        if (!outstanding)
+            send_pending();
+    }
+
+    /** Send the last requested size right away and stop pacing */
+    void finish()
+    {
+        if (view && pending)
+            view->resize(pending->width, pending->height);
+
+        cancel();
+    }
+
+    /** Stop pacing, dropping the size which wasn't sent yet */
+    void cancel()
+    {
+        on_commit.disconnect();
+        timeout.disconnect();
+        pending.reset();
+        outstanding = false;
+        view = nullptr;
+    }
+};
+
 class wayfire_resize : public wf::plugin_interface_t
 {
     wf::signal_callback_t resize_request, view_destroyed;
@@ -31,6 +110,8 @@ class wayfire_resize : public wf::plugin_interface_t
     uint32_t edges;
     wf::option_wrapper_t<wf::buttonbinding_t> button{"resize/activate"};
 
+    resize_pacer_t pacer;
+
     public:
     void init() override
     {
@@ -109,6 +190,7 @@ class wayfire_resize : public wf::plugin_interface_t
         {
             if (get_signaled_view(data) == view)
             {
+                pacer.cancel();
                 view = nullptr;
                 input_pressed(WLR_BUTTON_RELEASED);
             }
@@ -219,6 +301,7 @@ class wayfire_resize : public wf::plugin_interface_t
             input_pressed(WL_POINTER_BUTTON_STATE_RELEASED);
 
         this->view = view;
+        pacer.start(view);
 
         auto og = view->get_output_geometry();
         int anchor_x = og.x;
@@ -245,6 +328,7 @@ class wayfire_resize : public wf::plugin_interface_t
 
         if (view)
         {
+            pacer.finish();
             if ((edges & WLR_EDGE_LEFT) ||
                 (edges & WLR_EDGE_TOP))
                 view->set_moving(false);
@@ -273,7 +357,7 @@ class wayfire_resize : public wf::plugin_interface_t
 
         height = std::max(height, 1);
         width  = std::max(width,  1);
-        view->resize(width, height);
+        pacer.resize(width, height);
     }
 
     void fini() override
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <wayfire/geometry.hpp>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * The trace of a session written by the recorder plugin and replayed by the
+ * replay scenario of the bench plugin.
+ *
+ * A trace is a text file with one event per line: the time in milliseconds
+ * since the start of the recording, the type of the event, the name of the
+ * output for the events of an output, and the numeric arguments:
+ *
+ * key <keycode> <state>
+ * button <button> <state>
+ * motion <dx> <dy>
+ * motion_absolute <x> <y>
+ * axis <orientation> <delta> <delta_discrete> <source>
+ * view <output> <id> <x> <y> <width> <height>
+ * damage <output> <id> <x> <y> <width> <height>
+ * close <output> <id>
+ * frame <output> <total usec> <render usec>
+ *
+ * Views are identified by a number which is only unique in the trace. A view
+ * line is written when a view is damaged for the first time and whenever its
+ * geometry changes, in the layout coordinates of its output. Damage boxes are
+ * relative to the geometry of their view.
+ */
+namespace session_trace
+{
+struct event_t
+{
+    uint32_t time = 0;
+    std::string type;
+    /* Empty for input events */
+    std::string output;
+    std::vector<double> args;
+
+    wf::geometry_t get_box(size_t first) const
+    {
+        return {(int)args[first], (int)args[first + 1],
+            (int)args[first + 2], (int)args[first + 3]};
+    }
+};
+
+inline bool is_output_event(const std::string& type)
+{
+    return type == "view" || type == "damage" || type == "close" ||
+           type == "frame";
+}
+
+/** @return The number of arguments of the given type, -1 if it is unknown */
+inline int get_arg_count(const std::string& type)
+{
+    if (type == "key" || type == "button" || type == "motion" ||
+        type == "motion_absolute")
+    {
+        return 2;
+    }
+
+    if (type == "axis")
+        return 4;
+    if (type == "view" || type == "damage")
+        return 5;
+    if (type == "close")
+        return 1;
+    if (type == "frame")
+        return 2;
+
+    return -1;
+}
+
+inline std::string format(const event_t& event)
+{
+    std::ostringstream out;
+    out << event.time << " " << event.type;
+    if (is_output_event(event.type))
+        out << " " << event.output;
+
+    for (auto& arg : event.args)
+        out << " " << arg;
+
+    return out.str();
+}
+
+/** @return Whether the line is a valid event */
+inline bool parse(const std::string& line, event_t& event)
+{
+    std::istringstream in{line};
+    event = {};
+    if (!(in >> event.time >> event.type))
+        return false;
+
+    if (is_output_event(event.type) && !(in >> event.output))
+        return false;
+
+    int count = get_arg_count(event.type);
+    double arg;
+    while (in >> arg)
+        event.args.push_back(arg);
+
+    return (count >= 0) && ((int)event.args.size() == count);
+}
+}
@@ -16,7 +16,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <algorithm>
+#include <cmath>
 #include <exception>
+#include <map>
 #include <set>
 
 constexpr const char* switcher_transformer = "switcher-3d";
@@ -84,6 +86,21 @@ struct SwitcherView
     }
 };
 
+/**
+ * A copy of a view's contents, at the size the view has in the switcher.
+ * The views are drawn from their snapshots, so that the whole carousel is a
+ * single batch instead of one pass through the transformers per view.
+ */
+struct SwitcherSnapshot
+{
+    wf::framebuffer_t fb;
+    /* The scale of the view in the switcher which fb was made for */
+    float scale = 0;
+    /* Set when the view is damaged, the snapshot is redone before the
+     * next frame */
+    bool dirty = true;
+};
+
 class WayfireSwitcher : public wf::plugin_interface_t
 {
     wf::option_wrapper_t<double> view_thumbnail_scale{
@@ -97,6 +114,7 @@ class WayfireSwitcher : public wf::plugin_interface_t
 
     /* If a view comes before another in this list, it is on top of it */
     std::vector<SwitcherView> views;
+    std::map<wf::view_interface_t*, SwitcherSnapshot> snapshots;
 
     // the modifiers which were used to activate switcher
     uint32_t activating_modifiers = 0;
@@ -174,12 +192,22 @@ class WayfireSwitcher : public wf::plugin_interface_t
         handle_view_removed(get_signaled_view(data));
     };
 
+    wf::signal_callback_t view_damaged = [=] (wf::signal_data_t *data)
+    {
+        auto it = snapshots.find(get_signaled_view(data).get());
+        if (it != snapshots.end())
+            it->second.dirty = true;
+    };
+
     void handle_view_removed(wayfire_view view)
     {
         // not running at all, don't care
         if (!output->is_plugin_active(grab_interface->name))
             return;
 
+        /* Another view may get the same address later */
+        release_snapshots([=] (wf::view_interface_t *v) { return v == view.get(); });
+
         bool need_action = false;
         for (auto& sv : views)
             need_action |= (sv.view == view);
@@ -274,6 +302,7 @@ class WayfireSwitcher : public wf::plugin_interface_t
         output->render->add_effect(&damage, wf::OUTPUT_EFFECT_PRE);
         output->render->set_renderer(switcher_renderer);
         output->render->set_redraw_always();
+        output->connect_signal("view-damaged", &view_damaged);
         return true;
     }
 
@@ -285,6 +314,8 @@ class WayfireSwitcher : public wf::plugin_interface_t
         output->render->rem_effect(&damage);
         output->render->set_renderer(nullptr);
         output->render->set_redraw_always(false);
+        output->disconnect_signal("view-damaged", &view_damaged);
+        release_snapshots([] (wf::view_interface_t*) { return true; });
 
         for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
         {
@@ -570,7 +601,8 @@ class WayfireSwitcher : public wf::plugin_interface_t
         return sw;
     }
 
-    void render_view(const SwitcherView& sv, const wf::framebuffer_t& buffer)
+    /** Set the transformer of the view to the current animation state */
+    wf::view_3D *prepare_transformer(const SwitcherView& sv)
     {
         auto transform = dynamic_cast<wf::view_3D*> (
             sv.view->get_transformer(switcher_transformer).get());
@@ -587,15 +619,148 @@ class WayfireSwitcher : public wf::plugin_interface_t
             (float)sv.attribs.rotation, {0.0, 1.0, 0.0});
 
         transform->color[3] = sv.attribs.alpha;
-        sv.view->render_transformed(output->render->get_target_framebuffer(),
-            output->render->get_target_framebuffer().get_damage_region());
+        return transform;
+    }
 
+    /** Reset the transformer, so that it doesn't change the view's geometry
+     * outside of rendering */
+    void reset_transformer(wf::view_3D *transform)
+    {
         transform->translation = glm::mat4();
         transform->scaling = glm::mat4();
         transform->rotation = glm::mat4();
         transform->color[3] = 1.0;
     }
 
+    void render_view(const SwitcherView& sv, const wf::framebuffer_t& buffer)
+    {
+        auto transform = prepare_transformer(sv);
+        sv.view->render_transformed(output->render->get_target_framebuffer(),
+            output->render->get_target_framebuffer().get_damage_region());
+        reset_transformer(transform);
+    }
+
+    /** Release the snapshots of the views matching the given criteria */
+    void release_snapshots(std::function<bool(wf::view_interface_t*)> criteria)
+    {
+        OpenGL::render_begin();
+        for (auto it = snapshots.begin(); it != snapshots.end();)
+        {
+            if (criteria(it->first))
+            {
+                it->second.fb.release();
+                it = snapshots.erase(it);
+            } else
+            {
+                ++it;
+            }
+        }
+
+        OpenGL::render_end();
+    }
+
+    /**
+     * The largest scale which the view reaches in the current animation.
+     * Rounded up to steps of 1/8, so that small changes don't redo the
+     * snapshot.
+     */
+    float get_snapshot_scale(wayfire_view view)
+    {
+        float scale = 0;
+        for (auto& sv : views)
+        {
+            if (sv.view != view)
+                continue;
+
+            scale = std::max({scale,
+                (float)sv.attribs.scale_x.start, (float)sv.attribs.scale_x.end,
+                (float)sv.attribs.scale_y.start, (float)sv.attribs.scale_y.end});
+        }
+
+        return std::max(std::ceil(scale * 8) / 8, 0.125f);
+    }
+
+    /**
+     * Redo the snapshot of the view if it was damaged, resized, or if the view
+     * is shown at a different scale.
+     *
+     * @return The snapshot, or nullptr if the view can't be snapshotted.
+     */
+    SwitcherSnapshot *update_snapshot(wayfire_view view)
+    {
+        if (!view->is_mapped())
+            return nullptr;
+
+        auto& snapshot = snapshots[view.get()];
+        auto bbox = view->get_untransformed_bounding_box();
+        float scale = get_snapshot_scale(view);
+        if (!snapshot.dirty && (snapshot.scale == scale) &&
+            (snapshot.fb.geometry == bbox))
+        {
+            return &snapshot;
+        }
+
+        float fb_scale = scale * output->handle->scale;
+        int width = std::max(1, (int)std::ceil(bbox.width * fb_scale));
+        int height = std::max(1, (int)std::ceil(bbox.height * fb_scale));
+
+        OpenGL::render_begin();
+        snapshot.fb.allocate(width, height);
+        snapshot.fb.geometry = bbox;
+        snapshot.fb.scale = fb_scale;
+        snapshot.fb.bind();
+        OpenGL::clear({0, 0, 0, 0});
+        OpenGL::render_end();
+
+        /* Like the view's own snapshot, but at the scale of the switcher */
+        wf::region_t damage{wlr_box{0, 0, width, height}};
+        auto og = view->get_output_geometry();
+        auto children = view->enumerate_surfaces({og.x - bbox.x, og.y - bbox.y});
+        for (auto& child : wf::reverse(children))
+        {
+            child.surface->simple_render(snapshot.fb,
+                child.position.x, child.position.y, damage);
+        }
+
+        snapshot.scale = scale;
+        snapshot.dirty = false;
+        return &snapshot;
+    }
+
+    /** Render the carousel, in the reverse order because we don't use depth
+     * testing */
+    void render_views(const wf::framebuffer_t& fb)
+    {
+        std::vector<OpenGL::textured_quad_t> quads;
+        auto flush = [&] ()
+        {
+            OpenGL::render_begin(fb);
+            fb.scissor(fb.framebuffer_box_from_geometry_box(fb.geometry));
+            OpenGL::render_textured_quads(quads);
+            OpenGL::render_end();
+            quads.clear();
+        };
+
+        for (auto& sv : wf::reverse(views))
+        {
+            auto snapshot = update_snapshot(sv.view);
+            if (!snapshot)
+            {
+                /* Keep the order of the views */
+                flush();
+                render_view(sv, fb);
+                continue;
+            }
+
+            auto transform = prepare_transformer(sv);
+            quads.push_back(transform->get_quad(wf::texture_t{snapshot->fb.tex},
+                snapshot->fb.geometry, fb));
+            reset_transformer(transform);
+        }
+
+        flush();
+    }
+
     wf::render_hook_t switcher_renderer = [=] (const wf::framebuffer_t& fb)
     {
         OpenGL::render_begin(fb);
@@ -606,9 +771,7 @@ class WayfireSwitcher : public wf::plugin_interface_t
         for (auto view : get_background_views())
             view->render_transformed(fb, fb.get_damage_region());
 
-        /* Render in the reverse order because we don't use depth testing */
-        for (auto& view : wf::reverse(views))
-            render_view(view, fb);
+        render_views(fb);
 
         for (auto view : get_overlay_views())
             view->render_transformed(fb, fb.get_damage_region());
@@ -634,6 +797,12 @@ class WayfireSwitcher : public wf::plugin_interface_t
                 ++it;
             }
         }
+
+        release_snapshots([=] (wf::view_interface_t *v)
+        {
+            return std::none_of(views.begin(), views.end(),
+                [=] (const SwitcherView& sv) { return sv.view.get() == v; });
+        });
     }
 
     /* Removes all expired views from the list */
@@ -20,10 +20,17 @@ class vswipe : public wf::plugin_interface_t
 {
     private:
         struct {
-            /* When the workspace is set to (-1, -1), means no such workspace */
-            wf::workspace_stream_t prev, curr, next;
+            /* Shared with other plugins showing the same workspaces.
+             * prev and next are null until the swipe reveals them */
+            std::shared_ptr<wf::workspace_stream_t> prev, curr, next;
         } streams;
 
+        /* The neighbouring workspaces in the swipe direction, if any */
+        struct {
+            bool has_prev = false, has_next = false;
+            wf::point_t prev, next;
+        } neighbours;
+
         enum swipe_direction_t
         {
             HORIZONTAL = 0,
@@ -42,13 +49,19 @@ class vswipe : public wf::plugin_interface_t
             double delta_prev = 0.0;
             double delta_last = 0.0;
 
+            /* Whether the neighbours are rendered at full resolution, which
+             * is the case only for the final animation */
+            bool full_resolution = false;
+
             int vx = 0;
             int vy = 0;
             int vw = 0;
             int vh = 0;
         } state;
 
-        wf::render_hook_t renderer;
+        wf::damage_render_hook_t renderer;
+        /* The workspaces shown in the last frame */
+        std::vector<wf::sliding_workspace_t> last_shown;
         wf::option_wrapper_t<bool> enable_horizontal{"vswipe/enable_horizontal"};
         wf::option_wrapper_t<bool> enable_vertical{"vswipe/enable_vertical"};
         wf::option_wrapper_t<bool> smooth_transition{"vswipe/enable_smooth_transition"};
@@ -63,6 +76,7 @@ class vswipe : public wf::plugin_interface_t
         wf::option_wrapper_t<double> delta_threshold{"vswipe/delta_threshold"};
         wf::option_wrapper_t<double> speed_factor{"vswipe/speed_factor"};
         wf::option_wrapper_t<double> speed_cap{"vswipe/speed_cap"};
+        wf::option_wrapper_t<double> motion_scale{"vswipe/motion_scale"};
 
     public:
 
@@ -75,7 +89,11 @@ class vswipe : public wf::plugin_interface_t
         wf::get_core().connect_signal("pointer_swipe_begin", &on_swipe_begin);
         wf::get_core().connect_signal("pointer_swipe_update", &on_swipe_update);
         wf::get_core().connect_signal("pointer_swipe_end", &on_swipe_end);
-        renderer = [=] (const wf::framebuffer_t& buffer) { render(buffer); };
+        renderer = [=] (const wf::framebuffer_t& buffer,
+            const wf::region_t& damage)
+        {
+            return render(buffer, damage);
+        };
     }
 
     /**
@@ -99,11 +117,13 @@ class vswipe : public wf::plugin_interface_t
         assert(false); // not reached
     }
 
-    void render(const wf::framebuffer_t &fb)
+    /** @return The repainted region, see wf::damage_render_hook_t */
+    wf::region_t render(const wf::framebuffer_t &fb, const wf::region_t& damage)
     {
         if (!smooth_delta.running() && !state.swiping)
             finalize_and_exit();
 
+        start_revealed_streams();
         update_stream(streams.prev);
         update_stream(streams.curr);
         update_stream(streams.next);
@@ -124,36 +144,63 @@ class vswipe : public wf::plugin_interface_t
         auto workspace_transform = glm::inverse(fb.transform);
         swipe = swipe * workspace_transform;
 
-        if (streams.prev.ws.x >= 0)
+        std::vector<wf::workspace_stream_instance_t> instances;
+        if (streams.prev)
         {
             auto prev = get_translation(-2.0 - state.gap * 2.0);
-            OpenGL::render_transformed_texture(streams.prev.buffer.tex,
-                out_geometry, {}, fb.transform * prev * swipe);
+            instances.push_back({streams.prev.get(), out_geometry,
+                fb.transform * prev * swipe});
         }
 
-        OpenGL::render_transformed_texture(streams.curr.buffer.tex,
-            out_geometry, {}, fb.transform * swipe);
+        instances.push_back({streams.curr.get(), out_geometry,
+            fb.transform * swipe});
 
-        if (streams.next.ws.x >= 0)
+        if (streams.next)
         {
             auto next = get_translation(2.0 + state.gap * 2.0);
-            OpenGL::render_transformed_texture(streams.next.buffer.tex,
-                out_geometry, {}, fb.transform * next * swipe);
+            instances.push_back({streams.next.get(), out_geometry,
+                fb.transform * next * swipe});
         }
 
-        GL_CALL(glUseProgram(0));
+        output->render->render_workspace_streams(instances);
         OpenGL::render_end();
+
+        return output->render->get_sliding_damage(damage, get_shown(),
+            last_shown);
     }
 
-    inline void update_stream(wf::workspace_stream_t& s)
+    /** @return The shown workspaces and their positions, as in render() */
+    std::vector<wf::sliding_workspace_t> get_shown()
     {
-        if (s.ws.x < 0 || s.ws.y < 0)
-            return;
+        auto box = output->render->get_damage_box();
+        wf::pointf_t step = {0, 0};
+        if (state.direction == HORIZONTAL)
+            step.x = box.width;
+        else if (state.direction == VERTICAL)
+            step.y = box.height;
+
+        double delta = smooth_delta;
+        std::vector<wf::sliding_workspace_t> shown;
+        if (streams.prev)
+        {
+            shown.push_back({neighbours.prev, {step.x * (delta - 1 - state.gap),
+                step.y * (delta - 1 - state.gap)}});
+        }
+
+        shown.push_back({{state.vx, state.vy}, {step.x * delta, step.y * delta}});
+        if (streams.next)
+        {
+            shown.push_back({neighbours.next, {step.x * (delta + 1 + state.gap),
+                step.y * (delta + 1 + state.gap)}});
+        }
 
-        if (!s.running)
-            output->render->workspace_stream_start(s);
-        else
-            output->render->workspace_stream_update(s);
+        return shown;
+    }
+
+    inline void update_stream(const std::shared_ptr<wf::workspace_stream_t>& s)
+    {
+        if (s)
+            output->render->workspace_stream_update(*s);
     }
 
     template<class wlr_event> using event = wf::input_event_signal<wlr_event>;
@@ -182,6 +229,7 @@ class vswipe : public wf::plugin_interface_t
 
         state.delta_last = 0;
         state.delta_prev = 0;
+        state.full_resolution = false;
 
         state.gap = gap / output->get_screen_size().width;
 
@@ -197,11 +245,32 @@ class vswipe : public wf::plugin_interface_t
 
         /* Invalid in the beginning, because we want a few swipe events to
          * determine whether swipe is horizontal or vertical */
-        streams.prev.ws = {-1, -1};
-        streams.next.ws = {-1, -1};
-        streams.curr.ws = wf::point_t {ws.x, ws.y};
+        neighbours.has_prev = neighbours.has_next = false;
+        streams.prev = nullptr;
+        streams.next = nullptr;
+        streams.curr = output->render->get_shared_workspace_stream(ws);
     };
 
+    std::shared_ptr<wf::workspace_stream_t> get_stream(wf::point_t ws)
+    {
+        float scale = state.full_resolution ?
+            1.0 : wf::clamp((double)motion_scale, 0.1, 1.0);
+        return output->render->get_shared_workspace_stream(ws, scale, scale);
+    }
+
+    /**
+     * Start the stream of a neighbouring workspace only once the swipe
+     * moves towards it, so that a swipe updates at most two streams.
+     * Swiping with a positive delta reveals the previous workspace.
+     */
+    void start_revealed_streams()
+    {
+        if (neighbours.has_prev && !streams.prev && smooth_delta > 0)
+            streams.prev = get_stream(neighbours.prev);
+        if (neighbours.has_next && !streams.next && smooth_delta < 0)
+            streams.next = get_stream(neighbours.next);
+    }
+
     void start_swipe(swipe_direction_t direction)
     {
         assert(direction != UNKNOWN);
@@ -214,7 +283,8 @@ class vswipe : public wf::plugin_interface_t
         grab_interface->grab();
         wf::get_core().focus_output(output);
 
-        output->render->set_renderer(renderer);
+        last_shown.clear();
+        output->render->set_damage_renderer(renderer);
         if (!was_active)
             output->render->set_redraw_always();
 
@@ -222,16 +292,16 @@ class vswipe : public wf::plugin_interface_t
         auto grid = output->workspace->get_workspace_grid_size();
         if (direction == HORIZONTAL)
         {
-            if (ws.x > 0)
-                streams.prev.ws = wf::point_t{ws.x - 1, ws.y};
-            if (ws.x < grid.width - 1)
-                streams.next.ws = wf::point_t{ws.x + 1, ws.y};
+            neighbours.has_prev = ws.x > 0;
+            neighbours.has_next = ws.x < grid.width - 1;
+            neighbours.prev = {ws.x - 1, ws.y};
+            neighbours.next = {ws.x + 1, ws.y};
         } else //if (direction == VERTICAL)
         {
-            if (ws.y > 0)
-                streams.prev.ws = wf::point_t{ws.x, ws.y - 1};
-            if (ws.y < grid.height - 1)
-                streams.next.ws = wf::point_t{ws.x, ws.y + 1};
+            neighbours.has_prev = ws.y > 0;
+            neighbours.has_next = ws.y < grid.height - 1;
+            neighbours.prev = {ws.x, ws.y - 1};
+            neighbours.next = {ws.x, ws.y + 1};
         }
     }
 
@@ -331,6 +401,13 @@ class vswipe : public wf::plugin_interface_t
                 break;
         }
 
+        /* The final animation shows the neighbours at full resolution */
+        state.full_resolution = true;
+        if (streams.prev)
+            streams.prev = get_stream(neighbours.prev);
+        if (streams.next)
+            streams.next = get_stream(neighbours.next);
+
         smooth_delta.animate(target_delta + state.gap * target_delta);
         output->workspace->set_workspace(target_workspace);
         state.animating = true;
@@ -346,11 +423,10 @@ class vswipe : public wf::plugin_interface_t
 
         output->deactivate_plugin(grab_interface);
 
-        if (streams.prev.running)
-            output->render->workspace_stream_stop(streams.prev);
-        output->render->workspace_stream_stop(streams.curr);
-        if (streams.next.running)
-            output->render->workspace_stream_stop(streams.next);
+        /* Dropping the handles stops the streams */
+        streams.prev = nullptr;
+        streams.curr = nullptr;
+        streams.next = nullptr;
 
         output->render->set_renderer(nullptr);
         state.animating = false;
@@ -361,11 +437,9 @@ class vswipe : public wf::plugin_interface_t
         if (state.swiping)
             finalize_and_exit();
 
-        OpenGL::render_begin();
-        streams.prev.buffer.release();
-        streams.curr.buffer.release();
-        streams.next.buffer.release();
-        OpenGL::render_end();
+        streams.prev = nullptr;
+        streams.curr = nullptr;
+        streams.next = nullptr;
 
         wf::get_core().disconnect_signal("pointer_swipe_begin", &on_swipe_begin);
         wf::get_core().disconnect_signal("pointer_swipe_update", &on_swipe_update);
@@ -5,7 +5,9 @@
 #include <wayfire/view.hpp>
 #include <wayfire/view-transform.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-stream.hpp>
 #include <wayfire/workspace-manager.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include <queue>
 #include <linux/input.h>
@@ -43,6 +45,18 @@ class vswitch : public wf::plugin_interface_t
         vswitch_animation_t animation;
         wayfire_view grabbed_view = nullptr;
 
+        wf::option_wrapper_t<bool> use_streams{"vswitch/use_streams"};
+        /* Whether the current switch slides the workspace streams instead of
+         * moving the views */
+        bool streaming = false;
+        wf::damage_render_hook_t renderer;
+        /* The workspaces shown in the last frame */
+        std::vector<wf::sliding_workspace_t> last_shown;
+        /* The streams of the workspaces the switch passes, shared with other
+         * plugins showing the same workspaces */
+        std::vector<std::pair<wf::point_t,
+            std::shared_ptr<wf::workspace_stream_t>>> streams;
+
     public:
     wayfire_view get_top_view()
     {
@@ -91,6 +105,10 @@ class vswitch : public wf::plugin_interface_t
 
         animation = vswitch_animation_t{
             wf::option_wrapper_t<int> {"vswitch/duration"}};
+        renderer = [=] (const wf::framebuffer_t& fb, const wf::region_t& damage)
+        {
+            return render(fb, damage);
+        };
         output->connect_signal("set-workspace-request", &on_set_workspace_request);
     }
 
@@ -104,10 +122,15 @@ class vswitch : public wf::plugin_interface_t
         if (!x && !y)
             return false;
 
-        if (!is_active() && !start_switch())
+        if (view && view->role != wf::VIEW_ROLE_TOPLEVEL)
+            view = nullptr;
+
+        /* A view moving with the switch stays in place, which the streams
+         * can't show */
+        if (!is_active() && !start_switch(view == nullptr))
             return false;
 
-        if (view && view->role != wf::VIEW_ROLE_TOPLEVEL)
+        if (streaming)
             view = nullptr;
 
         if (view && !grabbed_view)
@@ -159,13 +182,27 @@ class vswitch : public wf::plugin_interface_t
         }
     }
 
-    bool start_switch()
+    /**
+     * @param allow_streams Whether the switch may slide workspace streams,
+     *   if enabled in the config.
+     */
+    bool start_switch(bool allow_streams)
     {
+        streaming = use_streams && allow_streams;
+        grab_interface->capabilities = wf::CAPABILITY_MANAGE_DESKTOP;
+        if (streaming)
+            grab_interface->capabilities |= wf::CAPABILITY_CUSTOM_RENDERER;
+
         if (!output->activate_plugin(grab_interface))
             return false;
 
-        output->render->add_effect(&update_animation, wf::OUTPUT_EFFECT_PRE);
-        output->render->set_redraw_always();
+        if (streaming)
+        {
+            last_shown.clear();
+            output->render->set_damage_renderer(renderer);
+        }
+
+        output->render->add_animation(&update_animation);
 
         animation.dx.set(0, 0);
         animation.dy.set(0, 0);
@@ -173,10 +210,19 @@ class vswitch : public wf::plugin_interface_t
         return true;
     }
 
-    wf::effect_hook_t update_animation = [=] ()
+    wf::animation_hook_t update_animation = [=] (uint32_t, wf::region_t& damage)
     {
         if (!animation.running())
-            return stop_switch();
+        {
+            stop_switch();
+            return false;
+        }
+
+        if (streaming)
+        {
+            damage |= output->get_relative_geometry();
+            return true;
+        }
 
         auto screen_size = output->get_screen_size();
         for (auto view : get_ws_views())
@@ -190,8 +236,63 @@ class vswitch : public wf::plugin_interface_t
             tr->translation_y = -animation.dy * screen_size.height;
             view->damage();
         }
+
+        return true;
     };
 
+    /**
+     * Draw the workspaces between the current and the target one from their
+     * streams, so that the cost of the switch doesn't depend on the number
+     * of views on them.
+     *
+     * @return The repainted region, see wf::damage_render_hook_t
+     */
+    wf::region_t render(const wf::framebuffer_t& fb, const wf::region_t& damage)
+    {
+        auto cws = output->workspace->get_current_workspace();
+        int tx = cws.x + animation.dx.end;
+        int ty = cws.y + animation.dy.end;
+
+        decltype(streams) shown;
+        for (int x = std::min(cws.x, tx); x <= std::max(cws.x, tx); x++)
+        {
+            for (int y = std::min(cws.y, ty); y <= std::max(cws.y, ty); y++)
+            {
+                shown.push_back({{x, y},
+                    output->render->get_shared_workspace_stream({x, y})});
+            }
+        }
+
+        streams = std::move(shown);
+        for (auto& stream : streams)
+            output->render->workspace_stream_update(*stream.second);
+
+        /* Undo the rotation of the workspaces, so that they can be moved in
+         * the output's coordinates */
+        auto to_output = glm::inverse(fb.transform);
+        auto box = output->render->get_damage_box();
+        std::vector<wf::workspace_stream_instance_t> instances;
+        std::vector<wf::sliding_workspace_t> shown;
+        for (auto& stream : streams)
+        {
+            double dx = stream.first.x - cws.x - animation.dx;
+            double dy = stream.first.y - cws.y - animation.dy;
+            shown.push_back({stream.first, {dx * box.width, dy * box.height}});
+            auto translation = glm::translate(glm::mat4(1.0),
+                glm::vec3(2.0 * dx, -2.0 * dy, 0.0));
+
+            instances.push_back({stream.second.get(), {-1, 1, 1, -1},
+                fb.transform * translation * to_output});
+        }
+
+        OpenGL::render_begin(fb);
+        fb.scissor(fb.framebuffer_box_from_geometry_box(fb.geometry));
+        output->render->render_workspace_streams(instances);
+        OpenGL::render_end();
+
+        return output->render->get_sliding_damage(damage, shown, last_shown);
+    }
+
     void slide_done()
     {
         auto cws = output->workspace->get_current_workspace();
@@ -228,9 +329,16 @@ class vswitch : public wf::plugin_interface_t
         for (auto view : get_ws_views())
             view->pop_transformer(vswitch_view_transformer::name);
 
+        if (streaming)
+        {
+            output->render->set_renderer(nullptr);
+            /* Dropping the handles stops the streams */
+            streams.clear();
+            streaming = false;
+        }
+
         output->deactivate_plugin(grab_interface);
-        output->render->rem_effect(&update_animation);
-        output->render->set_redraw_always(false);
+        output->render->rem_animation(&update_animation);
     }
 
     void fini()
@@ -1,11 +1,14 @@
 #include <wayfire/plugin.hpp>
 #include <wayfire/output.hpp>
 #include <wayfire/view.hpp>
+#include <wayfire/render-manager.hpp>
 #include <cwctype>
 #include <cstdio>
 #include <wayfire/signal-definitions.hpp>
 #include <assert.h>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <cfloat>
 #include "wayfire/view-transform.hpp"
 
@@ -15,7 +18,8 @@ using std::string;
 rules syntax:
 
 title (T) / title contains (T) / app-id (T) / app-id contains (T) (created/destroyed/maximized/fullscreened) ->
-    move X Y | resize W H | (un)set fullscreen | (un)set maximized | set alpha A
+    move X Y | resize W H | (un)set fullscreen | (un)set maximized | set alpha A |
+    (un)set vrr | (un)set tearing
 
 where (T) is a text surrounded by parenthesis, for ex. (tilix)
 contains (T) means that (T) can be found anywhere in the title/app-id string
@@ -23,6 +27,11 @@ contains (T) means that (T) can be found anywhere in the title/app-id string
 X Y W H are simply integers indicating the position where the view
 should be placed and W H are positive integers indicating size
 
+set vrr enables adaptive sync while the view is focused, on outputs whose
+vrr option is auto, and set tearing presents the frames of the view as soon
+as they are committed while it is scanned out directly, on outputs with
+allow_tearing
+
 examples:
 
 title contains Chrome created -> set maximized
@@ -53,72 +62,126 @@ static bool ends_with(string x, string y)
 }
 
 
-class wayfire_window_rules : public wf::plugin_interface_t
+template<class T> static void set_hint(wayfire_view view, bool set)
+{
+    if (set)
+        view->store_data(std::make_unique<T>());
+    else
+        view->erase_data<T>();
+}
+
+enum rule_event_t
+{
+    EVENT_CREATED,
+    EVENT_MAXIMIZED,
+    EVENT_FULLSCREENED,
+    EVENT_COUNT,
+};
+
+enum rule_match_t
+{
+    MATCH_TITLE,
+    MATCH_TITLE_CONTAINS,
+    MATCH_APP_ID,
+    MATCH_APP_ID_CONTAINS,
+};
+
+using action_func = std::function<void(wayfire_view view)>;
+
+struct rule_t
+{
+    rule_event_t event;
+    rule_match_t match;
+    std::string match_string;
+    action_func action;
+};
+
+/**
+ * The rules of one event. Rules which compare the whole title or app-id are
+ * found by a hash lookup, so only the rules with "contains" are checked one
+ * by one for each view.
+ */
+class rule_index_t
 {
-    using verification_func = std::function<bool(wayfire_view, std::string)>;
+    /* In the order of the config */
+    std::vector<rule_t> rules;
 
-    struct verificator
+    std::unordered_map<std::string, std::vector<size_t>> by_title;
+    std::unordered_map<std::string, std::vector<size_t>> by_app_id;
+    std::vector<size_t> contains_rules;
+
+  public:
+    void add(rule_t rule)
     {
-        verification_func func;
-        std::string atom;
-    };
+        size_t idx = rules.size();
+        switch (rule.match)
+        {
+            case MATCH_TITLE:
+                by_title[rule.match_string].push_back(idx);
+                break;
+            case MATCH_APP_ID:
+                by_app_id[rule.match_string].push_back(idx);
+                break;
+            default:
+                contains_rules.push_back(idx);
+        }
 
-    std::vector<verificator> verficators =
+        rules.push_back(std::move(rule));
+    }
+
+    /* Run the actions of the matching rules, in the order of the config */
+    void apply(wayfire_view view) const
     {
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto title = view->get_title();
-                return title.find(match) != std::string::npos;
-            },
-            "title contains"
-        },
-        { [] (wayfire_view view, std::string match) -> bool
-            {
-                auto title = view->get_title();
-                return title == match;
-            },
-            "title"
-        },
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto app_id = view->get_app_id();
-                return app_id.find(match) != std::string::npos;
-            },
-            "app-id contains"
-        },
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto app_id = view->get_app_id();
-                return app_id == match;
-            },
-            "app-id"
-        },
-    };
+        if (rules.empty())
+            return;
 
-    std::vector<std::string> events = {
-        "created", "maximized", "fullscreened"
-    };
+        auto title  = view->get_title();
+        auto app_id = view->get_app_id();
 
-    using action_func = std::function<void(wayfire_view view)>;
+        std::vector<size_t> matching;
+        auto add_exact = [&] (auto& index, const std::string& key)
+        {
+            auto it = index.find(key);
+            if (it != index.end())
+                matching.insert(matching.end(), it->second.begin(), it->second.end());
+        };
 
-    struct lambda_executor
-    {
-        verification_func verify;
-        std::string verification_string;
-        action_func action;
+        add_exact(by_title, title);
+        add_exact(by_app_id, app_id);
+        for (auto idx : contains_rules)
+        {
+            auto& rule = rules[idx];
+            auto& text = (rule.match == MATCH_TITLE_CONTAINS) ? title : app_id;
+            if (text.find(rule.match_string) != std::string::npos)
+                matching.push_back(idx);
+        }
+
+        std::sort(matching.begin(), matching.end());
+        for (auto idx : matching)
+            rules[idx].action(view);
+    }
+};
+
+class wayfire_window_rules : public wf::plugin_interface_t
+{
+    /* "title contains" has to be checked before "title" */
+    const std::vector<std::pair<std::string, rule_match_t>> match_atoms = {
+        {"title contains", MATCH_TITLE_CONTAINS},
+        {"title", MATCH_TITLE},
+        {"app-id contains", MATCH_APP_ID_CONTAINS},
+        {"app-id", MATCH_APP_ID},
     };
 
-    using rule_func = std::function<void(wayfire_view)>;
-    struct rule
-    {
-        std::string signal;
-        std::function<void(wayfire_view)> func;
+    const std::vector<std::pair<std::string, rule_event_t>> events = {
+        {"created", EVENT_CREATED},
+        {"maximized", EVENT_MAXIMIZED},
+        {"fullscreened", EVENT_FULLSCREENED},
     };
 
-    rule parse_add_rule(std::string rule)
+    /** @return Whether the rule is valid */
+    bool parse_rule(std::string rule, rule_t& result)
     {
         std::string predicate, action;
-        struct rule result;
 
         size_t pos = 0;
         for (; pos < rule.size() - 2; ++pos)
@@ -129,40 +192,41 @@ class wayfire_window_rules : public wf::plugin_interface_t
 
         /* first condition is so that there is no underflow in unsigned arithmetic */
         if (rule.size() <= 5 || pos >= rule.size() - 2 || pos < 1)
-            return result;
+            return false;
 
         predicate = trim(rule.substr(0, pos));
-        std::string event;
+        bool has_event = false;
         action = trim(rule.substr(pos + 2, rule.size() - pos - 1));
 
-        for (auto ev : events)
+        for (auto& [name, event] : events)
         {
-            if (ends_with(predicate, ev))
+            if (ends_with(predicate, name))
             {
-                event = ev;
-                predicate = trim(predicate.substr(0, predicate.length() - ev.length()));
+                has_event = true;
+                result.event = event;
+                predicate = trim(predicate.substr(0, predicate.length() - name.length()));
                 break;
             }
         }
 
-        lambda_executor exec;
-        exec.verify = nullptr;
-        exec.action = nullptr;
-
-        for (const auto& pred : verficators)
+        bool has_match = false;
+        for (auto& [atom, match] : match_atoms)
         {
-            if (starts_with(predicate, pred.atom))
+            if (starts_with(predicate, atom))
             {
-                exec.verify = pred.func;
-                exec.verification_string =
-                    trim(predicate.substr(pred.atom.length(),
-                                          predicate.length() - pred.atom.length()));
+                has_match = true;
+                result.match = match;
+                result.match_string =
+                    trim(predicate.substr(atom.length(),
+                                          predicate.length() - atom.length()));
                 break;
             }
         }
 
-        if (!exec.verify || !event.length())
-            return result;
+        if (!has_match || !has_event)
+            return false;
+
+        auto& exec = result;
 
         if (starts_with(action, "move"))
         {
@@ -170,7 +234,7 @@ class wayfire_window_rules : public wf::plugin_interface_t
             int t = std::sscanf(action.c_str(), "move %d %d", &x, &y);
 
             if (t != 2)
-                return result;
+                return false;
 
             exec.action = [x,y] (wayfire_view view) {
                 auto og = view->get_output()->get_relative_geometry();
@@ -182,7 +246,7 @@ class wayfire_window_rules : public wf::plugin_interface_t
             int t = std::sscanf(action.c_str(), "resize %d %d", &w, &h);
 
             if (t != 2 || w <= 0 || h <= 0)
-                return result;
+                return false;
 
             exec.action = [w,h] (wayfire_view view) mutable {
                 auto screen_size = view->get_output()->get_screen_size();
@@ -209,12 +273,30 @@ class wayfire_window_rules : public wf::plugin_interface_t
                 data.state = starts_with(action, "set");
                 view->get_output()->emit_signal("view-fullscreen-request", &data);
             };
+        } else if (ends_with(action, "set vrr"))
+        {
+            exec.action = [action] (wayfire_view view)
+            {
+                set_hint<wf::adaptive_sync_hint_t>(view, starts_with(action, "set"));
+                if (view->get_output())
+                {
+                    _view_signal data;
+                    data.view = view;
+                    view->get_output()->emit_signal("view-adaptive-sync", &data);
+                }
+            };
+        } else if (ends_with(action, "set tearing"))
+        {
+            exec.action = [action] (wayfire_view view)
+            {
+                set_hint<wf::tearing_hint_t>(view, starts_with(action, "set"));
+            };
         } else if (starts_with(action, "set alpha"))
         {
             float a;
             int t = std::sscanf(action.c_str(), "set alpha %f", &a);
             if (t != 1)
-                return result;
+                return false;
             a = std::max(std::min(1.0f, a), 0.1f); /* clamp a in range [0.1f, 1.0f] */
 
             exec.action = [a] (wayfire_view view)
@@ -234,22 +316,12 @@ class wayfire_window_rules : public wf::plugin_interface_t
         }
 
 
-        if (!exec.action)
-            return result;
-
-        result.signal = event;
-        result.func = [exec] (wayfire_view view)
-        {
-            if (exec.verify(view, exec.verification_string))
-                exec.action(view);
-        };
-
-        return result;
+        return exec.action != nullptr;
     }
 
     wf::signal_callback_t created, maximized, fullscreened;
 
-    std::map<std::string, std::vector<rule_func>> rules_list;
+    rule_index_t rules[EVENT_COUNT];
 
     public:
     void init()
@@ -257,14 +329,14 @@ class wayfire_window_rules : public wf::plugin_interface_t
         auto section = wf::get_core().config.get_section("window-rules");
         for (auto opt : section->get_registered_options())
         {
-            auto rule = parse_add_rule(opt->get_value_str());
-            rules_list[rule.signal].push_back(rule.func);
+            rule_t rule;
+            if (parse_rule(opt->get_value_str(), rule))
+                rules[rule.event].add(std::move(rule));
         }
 
         created = [=] (wf::signal_data_t *data)
         {
-            for (const auto& rule : rules_list["created"])
-                rule(get_signaled_view(data));
+            rules[EVENT_CREATED].apply(get_signaled_view(data));
         };
         output->connect_signal("map-view", &created);
 
@@ -276,8 +348,7 @@ class wayfire_window_rules : public wf::plugin_interface_t
             if (conv->edges != wf::TILED_EDGES_ALL)
                 return;
 
-            for (const auto& rule : rules_list["maximized"])
-                rule(conv->view);
+            rules[EVENT_MAXIMIZED].apply(conv->view);
         };
         output->connect_signal("view-maximized", &maximized);
 
@@ -289,8 +360,7 @@ class wayfire_window_rules : public wf::plugin_interface_t
             if (!conv->state || conv->carried_out)
                 return;
 
-            for (const auto& rule : rules_list["fullscreened"])
-                rule(conv->view);
+            rules[EVENT_FULLSCREENED].apply(conv->view);
             conv->carried_out = true;
         };
         output->connect_signal("view-fullscreen", &fullscreened);
@@ -1,10 +1,21 @@
 #include <wayfire/plugin.hpp>
 #include <wayfire/output.hpp>
+#include <wayfire/core.hpp>
 #include <wayfire/opengl.hpp>
 #include <wayfire/debug.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-stream.hpp>
+#include <wayfire/workspace-manager.hpp>
 #include <wayfire/util/duration.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
+/**
+ * The zoomed output is drawn with a custom renderer, which renders only the
+ * magnified part of the workspace, at the zoomed resolution, to a cropped
+ * workspace stream. While another plugin has its own renderer, for ex. expo,
+ * its output is zoomed instead with a post hook, which scales up a part of
+ * the fully rendered output.
+ */
 class wayfire_zoom_screen : public wf::plugin_interface_t
 {
     wf::option_wrapper_t<wf::keybinding_t> modifier{"zoom/modifier"};
@@ -12,6 +23,24 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
     wf::option_wrapper_t<int> smoothing_duration{"zoom/smoothing_duration"};
     wf::animation::simple_animation_t progression{smoothing_duration};
     bool hook_set = false;
+    bool animating = false;
+
+    /* Which of the two ways of zooming is in use */
+    bool renderer_set = false;
+    bool post_set = false;
+    /* Whether the zoom renderer drew the current frame */
+    bool rendered_zoomed = false;
+
+    /* Never activated, used to check whether another plugin has a custom
+     * renderer */
+    wf::plugin_grab_interface_uptr renderer_interface;
+    wf::workspace_stream_t stream;
+
+    /** The zoomed part of the output, in output-local coordinates */
+    struct zoomed_rect_t
+    {
+        double x, y, width, height;
+    };
 
     public:
         void init() override
@@ -19,6 +48,11 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
             grab_interface->name = "zoom";
             grab_interface->capabilities = 0;
 
+            renderer_interface =
+                std::make_unique<wf::plugin_grab_interface_t> (output);
+            renderer_interface->name = "zoom";
+            renderer_interface->capabilities = wf::CAPABILITY_CUSTOM_RENDERER;
+
             progression.set(1, 1);
 
             output->add_axis(modifier, &axis);
@@ -37,8 +71,15 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
                 if (!hook_set)
                 {
                     hook_set = true;
-                    output->render->add_post(&render_hook);
-                    output->render->set_redraw_always();
+                    output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+                    for (auto& signal : motion_signals)
+                        wf::get_core().connect_signal(signal, &on_motion);
+                }
+
+                if (!animating)
+                {
+                    animating = true;
+                    output->render->add_animation(&animation_hook);
                 }
             }
         }
@@ -54,11 +95,147 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
             return true;
         };
 
-        wf::post_hook_t render_hook = [=] (const wf::framebuffer_base_t& source,
+        zoomed_rect_t get_zoomed_rect()
+        {
+            auto oc = output->get_cursor_position();
+            double x, y;
+            wlr_box b = output->get_relative_geometry();
+            wlr_box_closest_point(&b, oc.x, oc.y, &x, &y);
+
+            /* The point under the cursor stays in place */
+            const double scale = (progression - 1) / progression;
+            return {x * scale, y * scale,
+                b.width / progression, b.height / progression};
+        }
+
+        /**
+         * Make sure a frame is drawn. Damaging a single pixel is enough,
+         * because the zoom renderer redraws the whole zoomed part of the
+         * output anyway when it moves, and the post hook runs on every frame.
+         */
+        void request_frame(wf::region_t& damage)
+        {
+            auto oc = output->get_cursor_position();
+            damage |= wlr_box{(int)oc.x, (int)oc.y, 1, 1};
+        }
+
+        const std::vector<std::string> motion_signals = {
+            "pointer_motion", "pointer_motion_abs", "tablet_axis",
+        };
+
+        /* The zoomed part of the output follows the cursor */
+        wf::signal_callback_t on_motion = [=] (wf::signal_data_t*)
+        {
+            wf::region_t damage;
+            request_frame(damage);
+            output->render->damage(damage);
+        };
+
+        wf::animation_hook_t animation_hook = [=] (uint32_t,
+            wf::region_t& damage)
+        {
+            if (progression.running())
+            {
+                request_frame(damage);
+                return true;
+            }
+
+            animating = false;
+            if (progression - 1 <= 0.01)
+                unset_hook();
+
+            return false;
+        };
+
+        wf::effect_hook_t pre_hook = [=] ()
+        {
+            rendered_zoomed = false;
+
+            bool can_render = output->can_activate_plugin(renderer_interface, true);
+            if (can_render && !renderer_set)
+            {
+                set_post_hook(false);
+                output->render->set_renderer(render_hook);
+                renderer_set = true;
+            } else if (!can_render && !post_set)
+            {
+                /* The other plugin replaces our renderer, if it hasn't yet */
+                renderer_set = false;
+                set_post_hook(true);
+            }
+        };
+
+        wf::render_hook_t render_hook = [=] (const wf::framebuffer_t& fb)
+        {
+            auto rect = get_zoomed_rect();
+            auto og = output->get_relative_geometry();
+
+            /* The stream starts and ends at whole pixels around the zoomed
+             * part, the rest is cut off when drawing the stream */
+            int x1 = std::floor(rect.x);
+            int y1 = std::floor(rect.y);
+            int x2 = std::min<int>(og.width, std::ceil(rect.x + rect.width));
+            int y2 = std::min<int>(og.height, std::ceil(rect.y + rect.height));
+            wf::geometry_t crop = {x1, y1, x2 - x1, y2 - y1};
+            float zoom = progression;
+
+            auto cws = output->workspace->get_current_workspace();
+            if (stream.running && !(stream.ws == cws))
+                output->render->workspace_stream_stop(stream);
+
+            if (!stream.running)
+            {
+                stream.ws = cws;
+                stream.crop = crop;
+                stream.scale_x = stream.scale_y = zoom;
+                output->render->workspace_stream_start(stream);
+            } else
+            {
+                output->render->workspace_stream_update(stream, crop, zoom);
+            }
+
+            /* Map the stream buffer from its own coordinates to the crop on
+             * the output, and then zoom it around the cursor. The rotation of
+             * the output is already in the buffer, so it is undone first. */
+            auto to_crop = glm::translate(glm::mat4(1.0),
+                glm::vec3(x1, y1, 0.0)) *
+                glm::scale(glm::mat4(1.0),
+                    glm::vec3(crop.width / 2.0, -crop.height / 2.0, 1.0)) *
+                glm::translate(glm::mat4(1.0), glm::vec3(1.0, -1.0, 0.0));
+            auto to_zoomed = glm::scale(glm::mat4(1.0),
+                glm::vec3(zoom, zoom, 1.0)) *
+                glm::translate(glm::mat4(1.0), glm::vec3(-rect.x, -rect.y, 0.0));
+            auto transform = fb.get_orthographic_projection() * to_zoomed *
+                to_crop * glm::inverse(fb.transform);
+
+            OpenGL::render_begin(fb);
+            fb.scissor(fb.framebuffer_box_from_geometry_box(fb.geometry));
+            output->render->render_workspace_streams(
+                {{&stream, {-1, 1, 1, -1}, transform}});
+            OpenGL::render_end();
+
+            rendered_zoomed = true;
+        };
+
+        wf::post_hook_t post_hook = [=] (const wf::framebuffer_base_t& source,
             const wf::framebuffer_base_t& destination)
         {
             auto w = destination.viewport_width;
             auto h = destination.viewport_height;
+
+            OpenGL::render_begin(source);
+            OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, source.fb);
+            OpenGL::get_state_cache().bind_framebuffer(GL_DRAW_FRAMEBUFFER, destination.fb);
+
+            /* Our renderer was still used for this frame */
+            if (rendered_zoomed)
+            {
+                GL_CALL(glBlitFramebuffer(0, 0, w, h, 0, 0, w, h,
+                        GL_COLOR_BUFFER_BIT, GL_NEAREST));
+                OpenGL::render_end();
+                return;
+            }
+
             auto oc = output->get_cursor_position();
             double x, y;
             wlr_box b = output->get_relative_geometry();
@@ -78,28 +255,63 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
             const float x1 = x * scale;
             const float y1 = y * scale;
 
-            OpenGL::render_begin(source);
-            GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, source.fb));
-            GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination.fb));
             GL_CALL(glBlitFramebuffer(x1, y1, x1 + tw, y1 + th, 0, 0, w, h,
                     GL_COLOR_BUFFER_BIT, GL_LINEAR));
             OpenGL::render_end();
-
-            if (!progression.running() && progression - 1 <= 0.01)
-                unset_hook();
         };
 
+        void set_post_hook(bool enabled)
+        {
+            if (enabled == post_set)
+                return;
+
+            if (enabled)
+            {
+                output->render->add_post(&post_hook);
+                output->render->set_redraw_always();
+            } else
+            {
+                output->render->rem_post(&post_hook);
+                output->render->set_redraw_always(false);
+            }
+
+            post_set = enabled;
+        }
+
         void unset_hook()
         {
-            output->render->set_redraw_always(false);
-            output->render->rem_post(&render_hook);
+            output->render->rem_effect(&pre_hook);
+            for (auto& signal : motion_signals)
+                wf::get_core().disconnect_signal(signal, &on_motion);
+
+            set_post_hook(false);
+
+            /* Only reset the renderer if it is still ours */
+            if (renderer_set &&
+                output->can_activate_plugin(renderer_interface, true))
+            {
+                output->render->set_renderer(nullptr);
+            }
+
+            renderer_set = false;
+
+            if (stream.running)
+                output->render->workspace_stream_stop(stream);
+
+            OpenGL::render_begin();
+            stream.buffer.release();
+            OpenGL::render_end();
+
             hook_set = false;
         }
 
         void fini() override
         {
+            if (animating)
+                output->render->rem_animation(&animation_hook);
+
             if (hook_set)
-                output->render->rem_post(&render_hook);
+                unset_hook();
 
             output->rem_binding(&axis);
         }
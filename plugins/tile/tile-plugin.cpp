@@ -62,6 +62,7 @@ class tile_plugin_t : public wf::plugin_interface_t
     {
         auto output_geometry = output->get_relative_geometry();
         auto wsize = output->workspace->get_workspace_grid_size();
+        tile::layout_transaction_t transaction;
         for (int i = 0; i < wsize.width; i++)
         {
             for (int j = 0; j < wsize.height; j++)
@@ -213,6 +214,7 @@ class tile_plugin_t : public wf::plugin_interface_t
         stop_controller(true);
         auto wview = view->view;
 
+        tile::layout_transaction_t transaction;
         view->parent->remove_child(view);
         /* View node is invalid now */
         flatten_roots();
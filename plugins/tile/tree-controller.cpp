@@ -373,6 +373,9 @@ void move_view_controller_t::input_released()
     auto split_type = (split == INSERT_LEFT || split == INSERT_RIGHT) ?
         SPLIT_VERTICAL : SPLIT_HORIZONTAL;
 
+    /* The views are resized together when the tree is in its final shape */
+    layout_transaction_t transaction;
+
     if (dropped_at->parent->get_split_direction() == split_type)
     {
         /* We can simply add the dragged view as a sibling of the target view */
@@ -570,6 +573,7 @@ void resize_view_controller_t::input_motion(wf::point_t input)
     if (!this->grabbed_view)
         return;
 
+    layout_transaction_t transaction;
     if (horizontal_pair.first && horizontal_pair.second)
     {
         int dy = input.y - last_point.y;
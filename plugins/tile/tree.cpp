@@ -5,7 +5,10 @@
 #include <wayfire/output.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/view-transform.hpp>
+#include <wayfire/option-wrapper.hpp>
 #include <algorithm>
+#include <ctime>
+#include <set>
 
 namespace wf
 {
@@ -89,6 +92,8 @@ void split_node_t::recalculate_children(wf::geometry_t available)
     if (this->children.empty())
         return;
 
+    layout_transaction_t transaction;
+
     double old_child_sum = 0.0;
     for (auto& child : this->children)
         old_child_sum += calculate_splittable(child->geometry);
@@ -194,6 +199,156 @@ split_node_t::split_node_t(split_direction_t dir)
     this->geometry = {0, 0, 0, 0};
 }
 
+/* ------------------ layout_transaction_t implementation ------------------- */
+struct transaction_state_t
+{
+    /* Number of layout_transaction_t which currently exist */
+    int depth = 0;
+
+    /* The nodes whose geometry changed in the current transaction */
+    std::set<view_node_t*> changed;
+    /* The nodes which were configured and are shown at their old geometry,
+     * and those of them whose clients haven't committed yet */
+    std::set<view_node_t*> pending;
+    std::set<view_node_t*> waiting;
+    /* Nodes which changed again while waiting. Only one configure is sent
+     * at a time, so that slow clients aren't flooded while resizing, and the
+     * latest geometry is sent when the client commits. */
+    std::set<view_node_t*> deferred;
+    /* Changed nodes on other workspaces. They don't hold back the visible
+     * nodes, and are configured one per idle iteration, so that their
+     * clients have their new size before the workspace is shown. */
+    std::set<view_node_t*> background;
+    wf::wl_idle_call idle_background;
+
+    wf::wl_timer timeout;
+    wf::option_wrapper_t<int> timeout_ms{"simple-tile/transaction_timeout"};
+
+    static transaction_state_t& get()
+    {
+        static transaction_state_t state;
+        return state;
+    }
+
+    /** Send the configures of the changed nodes */
+    void commit()
+    {
+        auto nodes = std::move(changed);
+        changed.clear();
+        for (auto& node : nodes)
+        {
+            if (!waiting.count(node) && !node->is_visible())
+            {
+                background.insert(node);
+                continue;
+            }
+
+            background.erase(node);
+            pending.insert(node);
+            if (waiting.count(node))
+            {
+                deferred.insert(node);
+                continue;
+            }
+
+            node->send_configure();
+            if (!node->has_committed())
+                waiting.insert(node);
+        }
+
+        if (!background.empty())
+            idle_background.run_once([=] () { configure_next_background(); });
+
+        if (waiting.empty())
+            return apply();
+
+        if (!timeout.is_connected())
+            timeout.set_timeout(std::max((int)timeout_ms, 1), [=] () { apply(); });
+    }
+
+    /** Show all pending nodes at their new geometry */
+    void apply()
+    {
+        timeout.disconnect();
+        waiting.clear();
+
+        auto nodes = std::move(pending);
+        pending.clear();
+        for (auto& node : nodes)
+        {
+            node->shown_geometry = node->geometry;
+            node->update_transformer();
+        }
+
+        /* The clients which didn't commit in time get their latest geometry
+         * now, with the current transaction or in a new one */
+        if (!deferred.empty())
+        {
+            changed.insert(deferred.begin(), deferred.end());
+            deferred.clear();
+            if (depth == 0)
+                commit();
+        }
+    }
+
+    void configure_next_background()
+    {
+        if (background.empty())
+            return;
+
+        auto node = *background.begin();
+        background.erase(background.begin());
+
+        /* Nothing to keep in sync with while it is hidden */
+        node->send_configure();
+        node->shown_geometry = node->geometry;
+        node->update_transformer();
+        node->send_frame_done();
+
+        if (!background.empty())
+            idle_background.run_once();
+    }
+
+    void handle_commit(view_node_t *node)
+    {
+        if (!waiting.erase(node))
+            return;
+
+        if (deferred.erase(node))
+        {
+            node->send_configure();
+            if (!node->has_committed())
+                waiting.insert(node);
+        }
+
+        if (waiting.empty())
+            apply();
+    }
+
+    void remove(view_node_t *node)
+    {
+        changed.erase(node);
+        pending.erase(node);
+        waiting.erase(node);
+        deferred.erase(node);
+        background.erase(node);
+        if (pending.empty())
+            timeout.disconnect();
+    }
+};
+
+layout_transaction_t::layout_transaction_t()
+{
+    ++transaction_state_t::get().depth;
+}
+
+layout_transaction_t::~layout_transaction_t()
+{
+    auto& state = transaction_state_t::get();
+    if (--state.depth == 0)
+        state.commit();
+}
+
 /* -------------------- view_node_t implementation -------------------------- */
 struct view_node_custom_data_t : public custom_data_t
 {
@@ -252,7 +407,12 @@ view_node_t::view_node_t(wayfire_view view)
     this->view = view;
     view->store_data(std::make_unique<view_node_custom_data_t> (this));
 
-    this->on_geometry_changed = [=] (wf::signal_data_t*) {update_transformer(); };
+    this->on_geometry_changed = [=] (wf::signal_data_t*)
+    {
+        update_transformer();
+        if (has_committed())
+            transaction_state_t::get().handle_commit(this);
+    };
     this->on_decoration_changed = [=] (wf::signal_data_t*) {
         set_geometry(geometry);
     };
@@ -262,19 +422,21 @@ view_node_t::view_node_t(wayfire_view view)
 
 view_node_t::~view_node_t()
 {
+    transaction_state_t::get().remove(this);
     view->pop_transformer(scale_transformer_name);
     view->disconnect_signal("geometry-changed", &on_geometry_changed);
     view->disconnect_signal("decoration-changed", &on_decoration_changed);
     view->erase_data<view_node_custom_data_t>();
 }
 
-wf::geometry_t view_node_t::calculate_target_geometry()
+wf::geometry_t view_node_t::calculate_target_geometry(
+    wf::geometry_t node_geometry)
 {
     /* Calculate view geometry in coordinates local to the active workspace,
      * because tree coordinates are kept in workspace-agnostic coordinates. */
     auto output = view->get_output();
     auto local_geometry = get_output_local_coordinates(
-        view->get_output(), geometry);
+        view->get_output(), node_geometry);
 
     /* If view is maximized, we want to use the full available geometry */
     if (view->fullscreen)
@@ -282,8 +444,8 @@ wf::geometry_t view_node_t::calculate_target_geometry()
         auto vp = output->workspace->get_current_workspace();
         auto size = output->get_screen_size();
 
-        int view_vp_x = std::floor(1.0 * geometry.x / size.width);
-        int view_vp_y = std::floor(1.0 * geometry.y / size.height);
+        int view_vp_x = std::floor(1.0 * node_geometry.x / size.width);
+        int view_vp_y = std::floor(1.0 * node_geometry.y / size.height);
 
         local_geometry = {
             (view_vp_x - vp.x) * size.width,
@@ -303,13 +465,65 @@ void view_node_t::set_geometry(wf::geometry_t geometry)
     if (!view->is_mapped())
         return;
 
+    /* A new view has no old place to wait at */
+    if (!has_shown_geometry)
+    {
+        shown_geometry = geometry;
+        has_shown_geometry = true;
+    }
+
+    layout_transaction_t transaction;
+    transaction_state_t::get().changed.insert(this);
+}
+
+void view_node_t::send_configure()
+{
+    if (!view->is_mapped())
+        return;
+
+    configured_geometry = geometry;
     view->set_tiled(TILED_EDGES_ALL);
-    view->set_geometry(calculate_target_geometry());
+    view->set_geometry(calculate_target_geometry(geometry));
+}
+
+bool view_node_t::is_visible()
+{
+    auto output = view->get_output();
+    if (!output)
+        return false;
+
+    auto screen = output->get_relative_geometry();
+    auto shown = has_shown_geometry ? shown_geometry : geometry;
+    return (get_output_local_coordinates(output, geometry) & screen) ||
+           (get_output_local_coordinates(output, shown) & screen);
+}
+
+void view_node_t::send_frame_done()
+{
+    /* Hidden surfaces get frame events only rarely, so the client may wait
+     * for one before it draws at the new size */
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    view->for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t)
+    {
+        surface->send_frame_done(now);
+    });
+}
+
+bool view_node_t::has_committed()
+{
+    auto target = calculate_target_geometry(configured_geometry);
+    auto wm = view->get_wm_geometry();
+
+    return !view->is_mapped() ||
+        (wm.width == target.width && wm.height == target.height);
 }
 
 void view_node_t::update_transformer()
 {
-    auto target_geometry = calculate_target_geometry();
+    /* Until the transaction is over, the view stays where it was */
+    auto target_geometry = calculate_target_geometry(
+        has_shown_geometry ? shown_geometry : geometry);
     if (target_geometry.width <= 0 || target_geometry.height <= 0)
         return;
 
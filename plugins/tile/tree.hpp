@@ -107,6 +107,35 @@ struct split_node_t : public tree_node_t
     int32_t calculate_splittable(wf::geometry_t geometry) const;
 };
 
+/**
+ * Groups the changes to the layout, so that the views are resized together.
+ *
+ * While a transaction exists, view_node_t::set_geometry() only records the
+ * new geometry of the node. When the outermost transaction is destroyed, the
+ * configures of all changed views are sent at once. The views are still shown
+ * at their old place until all of them have committed with their new size,
+ * or until simple-tile/transaction_timeout has passed, and are moved to
+ * their new place together, in a single frame.
+ *
+ * Views which are on other workspaces don't take part in the transaction.
+ * They are configured in the background, one per idle iteration, and are
+ * up to date when their workspace is shown.
+ *
+ * Transactions may be nested, and the tree operations open one themselves,
+ * so they are only needed to group several operations.
+ */
+class layout_transaction_t
+{
+  public:
+    layout_transaction_t();
+    ~layout_transaction_t();
+
+    layout_transaction_t(const layout_transaction_t&) = delete;
+    layout_transaction_t& operator =(const layout_transaction_t&) = delete;
+};
+
+struct transaction_state_t;
+
 /**
  * Represents a leaf in the tree, contains a single view
  */
@@ -129,12 +158,31 @@ struct view_node_t : public tree_node_t
     static nonstd::observer_ptr<view_node_t> get_node(wayfire_view view);
 
   private:
+    friend struct transaction_state_t;
+
     struct scale_transformer_t;
     nonstd::observer_ptr<scale_transformer_t> transformer;
     signal_callback_t on_geometry_changed, on_decoration_changed;
 
-    wf::geometry_t calculate_target_geometry();
+    /* The geometry of the node at the end of the last transaction, where
+     * the view is shown */
+    wf::geometry_t shown_geometry;
+    bool has_shown_geometry = false;
+    /* The geometry of the node when the last configure was sent */
+    wf::geometry_t configured_geometry;
+
+    wf::geometry_t calculate_target_geometry(wf::geometry_t node_geometry);
     void update_transformer();
+
+    /** Send the configure for the current geometry of the node */
+    void send_configure();
+    /** @return Whether the view has the size of the last configure */
+    bool has_committed();
+    /** @return Whether the node is on the current workspace, now or after
+     *  the running transaction */
+    bool is_visible();
+    /** Send frame done to the surfaces of the view */
+    void send_frame_done();
 };
 
 /**
@@ -78,7 +78,6 @@ typedef struct _Model {
     Spring	 springs[MODEL_MAX_SPRINGS];
     int		 numSprings;
     Object	 *anchorObject;
-    float	 steps;
     Point	 topLeft;
     Point	 bottomRight;
 } Model;
@@ -268,7 +267,6 @@ static Model * createModel(int x, int y, int width, int height)
 
     model->anchorObject = 0;
     model->numSprings = 0;
-    model->steps = 0;
 
     modelInitObjects (model, x, y, width, height);
     modelInitSprings (model, width, height);
@@ -335,16 +333,12 @@ static float modelStepObject(Object *object, float friction, float *force)
     }
 }
 
-static int modelStep(Model *model, float friction, float k, float time)
+static int modelStep(Model *model, float friction, float k, int steps)
 {
-    int   i, j, steps, wobbly = 0;
+    int   i, j, wobbly = 0;
     float velocitySum = 0.0f;
     float force, forceSum = 0.0f;
 
-    model->steps += time / 15.0f;
-    steps = floor (model->steps);
-    model->steps -= steps;
-
     if (!steps)
         return 1;
 
@@ -370,40 +364,6 @@ static int modelStep(Model *model, float friction, float k, float time)
     return wobbly;
 }
 
-static void bezierPatchEvaluate (Model *model, float u, float v,
-        float *patchX, float *patchY)
-{
-    float coeffsU[4], coeffsV[4];
-    float x, y;
-    int   i, j;
-
-    coeffsU[0] = (1 - u) * (1 - u) * (1 - u);
-    coeffsU[1] = 3 * u * (1 - u) * (1 - u);
-    coeffsU[2] = 3 * u * u * (1 - u);
-    coeffsU[3] = u * u * u;
-
-    coeffsV[0] = (1 - v) * (1 - v) * (1 - v);
-    coeffsV[1] = 3 * v * (1 - v) * (1 - v);
-    coeffsV[2] = 3 * v * v * (1 - v);
-    coeffsV[3] = v * v * v;
-
-    x = y = 0.0f;
-
-    for (i = 0; i < 4; i++)
-    {
-        for (j = 0; j < 4; j++)
-        {
-            x += coeffsU[i] * coeffsV[j] *
-                model->objects[j * GRID_WIDTH + i].position.x;
-            y += coeffsU[i] * coeffsV[j] *
-                model->objects[j * GRID_HEIGHT + i].position.y;
-        }
-    }
-
-    *patchX = x;
-    *patchY = y;
-}
-
 static int wobblyEnsureModel(struct wobbly_surface *surface)
 {
     WobblyWindow *ww = surface->ww;
@@ -511,7 +471,7 @@ static int modelRemoveEdgeAnchors(Model *model)
     return result;
 }
 
-void wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint)
+void wobbly_prepare_paint(struct wobbly_surface *surface, int steps)
 {
     WobblyWindow *ww = surface->ww;
     float  friction, springK;
@@ -523,9 +483,7 @@ void wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint)
     {
         if (ww->wobbly & (WobblyInitial | WobblyVelocity | WobblyForce))
         {
-            ww->wobbly = modelStep(ww->model, friction, springK,
-                    (ww->wobbly & WobblyVelocity) ?
-                    msSinceLastPaint : 16);
+            ww->wobbly = modelStep(ww->model, friction, springK, steps);
 
             if (ww->wobbly) {
                 modelCalcBounds(ww->model);
@@ -548,49 +506,21 @@ void wobbly_done_paint(struct wobbly_surface *surface)
     }
 }
 
-void wobbly_add_geometry(struct wobbly_surface *surface)
+int wobbly_get_control_points(struct wobbly_surface *surface, GLfloat *points)
 {
     WobblyWindow *ww = surface->ww;
+    int i;
 
-    float    width, height;
-    float    deformedX, deformedY;
-    int      x, y, iw, ih;
-    float    cell_w, cell_h;
-    GLfloat  *v, *uv;
+    if (!ww->model)
+        return 0;
 
-    if (ww->wobbly)
+    for (i = 0; i < GRID_WIDTH * GRID_HEIGHT; i++)
     {
-        width  = surface->width;
-        height = surface->height;
-
-        cell_w = width / surface->x_cells;
-        cell_h = height / surface->y_cells;
-
-        iw = surface->x_cells + 1;
-        ih = surface->y_cells + 1;
-
-        v = realloc(surface->v, sizeof(GLfloat) * 2 * iw * ih);
-        uv = realloc(surface->uv, sizeof(GLfloat) * 2 * iw * ih);
-
-        surface->v = v;
-        surface->uv = uv;
-
-        for (y = 0; y < ih; y++)
-        {
-            for (x = 0; x < iw; x++)
-            {
-                bezierPatchEvaluate(ww->model,
-                        (x * cell_w) / width, (y * cell_h) / height,
-                        &deformedX, &deformedY);
-
-                *v++ = deformedX;
-                *v++ = deformedY;
-
-                *uv++ = (x * cell_w) / width;
-                *uv++ = 1.0 - ((y * cell_h) / height);
-            }
-        }
+        points[2 * i] = ww->model->objects[i].position.x;
+        points[2 * i + 1] = ww->model->objects[i].position.y;
     }
+
+    return 1;
 }
 
 void wobbly_resize(struct wobbly_surface *surface, int width, int height)
@@ -753,7 +683,6 @@ void wobbly_fini(struct wobbly_surface *surface)
     {
         free(ww->model->objects);
         free(ww->model);
-        free(surface->v);
     }
 
     free (ww);
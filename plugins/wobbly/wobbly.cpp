@@ -4,6 +4,9 @@
 #include <wayfire/view-transform.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/fixed-timestep.hpp>
+#include <array>
+#include <map>
 
 extern "C"
 {
@@ -16,15 +19,37 @@ namespace wobbly_graphics
 {
 namespace
 {
+/* The bezier patch of the spring model is evaluated at the texture
+ * coordinates of the static grid mesh, so only the control points change
+ * between frames. */
 const char* vertex_source = R"(
 #version 100
-attribute mediump vec2 position;
-attribute mediump vec2 uvPosition;
+attribute highp vec2 uvPosition;
 varying highp vec2 uvpos;
 uniform mat4 MVP;
+/* The control points of the model, row by row */
+uniform highp vec2 control[16];
+
+/* The weights of the control points of a cubic bezier curve at t */
+highp vec4 bezier_coefficients(highp float t)
+{
+    highp float s = 1.0 - t;
+    return vec4(s * s * s, 3.0 * t * s * s, 3.0 * t * t * s, t * t * t);
+}
 
 void main() {
-    gl_Position = MVP * vec4(position.xy, 0.0, 1.0);
+    highp vec4 cu = bezier_coefficients(uvPosition.x);
+    highp vec4 cv = bezier_coefficients(1.0 - uvPosition.y);
+
+    highp vec2 position = vec2(0.0);
+    for (int j = 0; j < 4; j++)
+    {
+        position += cv[j] * (cu.x * control[4 * j] +
+            cu.y * control[4 * j + 1] + cu.z * control[4 * j + 2] +
+            cu.w * control[4 * j + 3]);
+    }
+
+    gl_Position = MVP * vec4(position, 0.0, 1.0);
     uvpos = uvPosition;
 }
 )";
@@ -44,6 +69,8 @@ void main()
 }
 
 OpenGL::program_t program;
+OpenGL::uniform_handle_t mvp_uniform, control_uniform;
+OpenGL::attrib_handle_t uv_attrib;
 int times_loaded = 0;
 
 void load_program()
@@ -53,6 +80,9 @@ void load_program()
 
     OpenGL::render_begin();
     program.compile(vertex_source, frag_source);
+    mvp_uniform = program.get_uniform("MVP");
+    control_uniform = program.get_uniform("control");
+    uv_attrib = program.get_attrib("uvPosition");
     OpenGL::render_end();
 }
 
@@ -62,79 +92,121 @@ void destroy_program()
     {
         OpenGL::render_begin();
         program.free_resources();
+        free_grid_meshes();
         OpenGL::render_end();
     }
 }
 
 /**
- * Enumerate the needed triangles for rendering the model
+ * The static mesh of a grid resolution: the indices of the triangles and the
+ * texture coordinates of the vertices, at which the vertex shader evaluates
+ * the patch. It is shared by all wobbly views with the same resolution.
  */
-void prepare_geometry(wobbly_surface *model, wf::geometry_t src_box,
-    std::vector<float>& vert, std::vector<float>& uv)
+struct grid_mesh_t
 {
-    float x = src_box.x, y = src_box.y, w = src_box.width, h = src_box.height;
-    std::vector<int> idx;
+    wf::vertex_buffer_t indices;
+    wf::vertex_buffer_t uv;
+    int count = 0;
+};
 
-    int per_row = model->x_cells + 1;
+std::map<std::pair<int, int>, grid_mesh_t> grid_meshes;
 
-    for (int j = 0; j < model->y_cells; j++)
+/* Requires bound opengl context */
+const grid_mesh_t& get_grid_mesh(int x_cells, int y_cells)
+{
+    auto& mesh = grid_meshes[{x_cells, y_cells}];
+    if (mesh.count > 0)
+        return mesh;
+
+    /* The vertices are numbered row by row, like the control points */
+    int per_row = x_cells + 1;
+    std::vector<GLuint> idx;
+    for (int j = 0; j < y_cells; j++)
     {
-        for (int i = 0; i < model->x_cells; i++)
+        for (int i = 0; i < x_cells; i++)
         {
-            idx.push_back(i * per_row + j);
-            idx.push_back((i + 1) * per_row + j + 1);
-            idx.push_back(i * per_row + j + 1);
-
-            idx.push_back(i * per_row + j);
-            idx.push_back((i + 1) * per_row + j);
-            idx.push_back((i + 1) * per_row + j + 1);
+            GLuint v = j * per_row + i;
+            idx.push_back(v);
+            idx.push_back(v + per_row + 1);
+            idx.push_back(v + 1);
+
+            idx.push_back(v);
+            idx.push_back(v + per_row);
+            idx.push_back(v + per_row + 1);
         }
     }
 
-    if (!model->v || !model->uv)
+    std::vector<float> uv;
+    for (int j = 0; j <= y_cells; j++)
     {
-        for (auto id : idx)
+        for (int i = 0; i <= x_cells; i++)
         {
-            float tile_w = w / model->x_cells;
-            float tile_h = h / model->y_cells;
+            uv.push_back(1.0f * i / x_cells);
+            uv.push_back(1.0f - 1.0f * j / y_cells);
+        }
+    }
 
-            int i = id / per_row;
-            int j = id % per_row;
+    mesh.indices.upload(idx.data(), idx.size() * sizeof(GLuint),
+        GL_ELEMENT_ARRAY_BUFFER);
+    mesh.uv.upload(uv.data(), uv.size() * sizeof(float));
+    mesh.count = idx.size();
 
-            vert.push_back(i * tile_w + x);
-            vert.push_back(j * tile_h + y);
+    return mesh;
+}
 
-            uv.push_back(1.0f * i / model->x_cells);
-            uv.push_back(1.0f - 1.0f * j / model->y_cells);
-        }
-    } else
+void free_grid_meshes()
+{
+    for (auto& mesh : grid_meshes)
     {
-        for (auto i : idx)
-        {
-            vert.push_back(model->v[2 * i]);
-            vert.push_back(model->v[2 * i + 1]);
+        mesh.second.indices.release();
+        mesh.second.uv.release();
+    }
+
+    grid_meshes.clear();
+}
 
-            uv.push_back(model->uv[2 * i]);
-            uv.push_back(model->uv[2 * i + 1]);
+/**
+ * Get the control points of the model. If the model has no geometry yet, the
+ * control points of the undeformed rectangle src_box are returned.
+ */
+std::array<float, 2 * WOBBLY_CONTROL_POINTS> get_control_points(
+    wobbly_surface *model, wf::geometry_t src_box)
+{
+    std::array<float, 2 * WOBBLY_CONTROL_POINTS> points;
+    if (wobbly_get_control_points(model, points.data()))
+        return points;
+
+    /* Evenly spaced control points give the bilinear patch */
+    for (int j = 0; j < 4; j++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            points[2 * (4 * j + i)] = src_box.x + i * src_box.width / 3.0f;
+            points[2 * (4 * j + i) + 1] = src_box.y + j * src_box.height / 3.0f;
         }
     }
+
+    return points;
 }
 
 /* Requires bound opengl context */
-void render_triangles(wf::texture_t tex, glm::mat4 mat, float *pos, float *uv, int cnt)
+void render_mesh(wf::texture_t tex, glm::mat4 mat, const float *control_points,
+    const grid_mesh_t& mesh)
 {
     program.use(tex.type);
     program.set_active_texture(tex);
 
-    program.attrib_pointer("position", 2, 0, pos);
-    program.attrib_pointer("uvPosition", 2, 0, uv);
-    program.uniformMatrix4f("MVP", mat);
+    program.attrib_buffer(uv_attrib, 2, 0, mesh.uv.at());
+    program.uniformMatrix4f(mvp_uniform, mat);
+    program.uniform2fv(control_uniform, control_points, WOBBLY_CONTROL_POINTS);
 
-    GL_CALL(glEnable(GL_BLEND));
-    GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    OpenGL::get_state_cache().set_blend(true);
+    OpenGL::get_state_cache().blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-    GL_CALL(glDrawArrays (GL_TRIANGLES, 0, 3 * cnt));
-    GL_CALL(glDisable(GL_BLEND));
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.buffer));
+    GL_CALL(glDrawElements(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT, 0));
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    OpenGL::get_state_cache().set_blend(false);
 
     program.deactivate();
 }
@@ -238,7 +310,6 @@ class iwobbly_state_t
     virtual void translate_model(int dx, int dy)
     {
         wobbly_translate(model.get(), dx, dy);
-        wobbly_add_geometry(model.get());
 
         wm_geometry.x += dx;
         wm_geometry.y += dy;
@@ -467,7 +538,7 @@ class wobbly_state_free_t : public iwobbly_state_t
 class wf_wobbly : public wf::view_transformer_t
 {
     wayfire_view view;
-    wf::effect_hook_t pre_hook;
+    wf::animation_hook_t pre_hook;
 
     wf::signal_callback_t view_removed = [=] (wf::signal_data_t *) {
         destroy_self();
@@ -499,15 +570,18 @@ class wf_wobbly : public wf::view_transformer_t
         state->translate_model(old_geometry.x - new_geometry.x,
             old_geometry.y - new_geometry.y);
 
-        sig->output->render->rem_effect(&pre_hook);
-        view->get_output()->render->add_effect(&pre_hook,
-            wf::OUTPUT_EFFECT_PRE);
+        sig->output->render->rem_animation(&pre_hook);
+        view->get_output()->render->add_animation(&pre_hook);
     };
 
     std::unique_ptr<wobbly_surface> model;
     std::unique_ptr<wf::iwobbly_state_t> state;
     uint32_t last_frame;
 
+    /* The spring model is stepped every 15ms, independently of the refresh
+     * rate of the output */
+    wf::fixed_timestep_t timestep{15, 8};
+
     void init_model()
     {
         model = std::make_unique<wobbly_surface> ();
@@ -524,8 +598,6 @@ class wf_wobbly : public wf::view_transformer_t
         model->x_cells = wobbly_settings::resolution;
         model->y_cells = wobbly_settings::resolution;
 
-        model->v = NULL;
-        model->uv = NULL;
         wobbly_init(model.get());
     }
 
@@ -536,8 +608,13 @@ class wf_wobbly : public wf::view_transformer_t
         init_model();
         last_frame = wf::get_current_time();
 
-        pre_hook = [=] () { update_model(); };
-        view->get_output()->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+        pre_hook = [=] (uint32_t frame_time, wf::region_t&)
+        {
+            /* Removed by the destructor once the wobbling is done */
+            update_model(frame_time);
+            return true;
+        };
+        view->get_output()->render->add_animation(&pre_hook);
 
         view->connect_signal("unmap", &view_removed);
         view->connect_signal("tiled", &view_state_changed);
@@ -577,7 +654,7 @@ class wf_wobbly : public wf::view_transformer_t
         return point;
     }
 
-    void update_model()
+    void update_model(uint32_t now)
     {
         view->damage();
 
@@ -589,12 +666,9 @@ class wf_wobbly : public wf::view_transformer_t
         view->connect_signal("geometry-changed", &this->view_geometry_changed);
 
         /* Update all the wobbly model */
-        auto now = wf::get_current_time();
-        wobbly_prepare_paint(model.get(), now - last_frame);
+        wobbly_prepare_paint(model.get(), timestep.advance(now - last_frame));
 
-        /* Update wobbly geometry */
         last_frame = now;
-        wobbly_add_geometry(model.get());
         wobbly_done_paint(model.get());
         view->damage();
 
@@ -608,12 +682,15 @@ class wf_wobbly : public wf::view_transformer_t
         OpenGL::render_begin(target_fb);
         target_fb.scissor(scissor_box);
 
-        std::vector<float> vert, uv;
-        wobbly_graphics::prepare_geometry(model.get(), src_box, vert, uv);
-        wobbly_graphics::render_triangles(src_tex,
-            target_fb.get_orthographic_projection(),
-            vert.data(), uv.data(),
-            model->x_cells * model->y_cells * 2);
+        /* The mesh is static, only the control points of the model are
+         * uploaded, so the cost per frame doesn't depend on the resolution */
+        auto& mesh = wobbly_graphics::get_grid_mesh(model->x_cells,
+            model->y_cells);
+        auto control_points =
+            wobbly_graphics::get_control_points(model.get(), src_box);
+
+        wobbly_graphics::render_mesh(src_tex,
+            target_fb.get_orthographic_projection(), control_points.data(), mesh);
 
         OpenGL::render_end();
     }
@@ -731,7 +808,7 @@ class wf_wobbly : public wf::view_transformer_t
     {
         state = nullptr;
         wobbly_fini(model.get());
-        view->get_output()->render->rem_effect(&pre_hook);
+        view->get_output()->render->rem_animation(&pre_hook);
 
         view->disconnect_signal("unmap", &view_removed);
         view->disconnect_signal("tiled", &view_state_changed);
@@ -14,6 +14,8 @@
 #define MINIMAL_SPRING_K 0.1
 #define MAXIMAL_SPRING_K 10.0
 #define WOBBLY_MASS 15.0
+/* The control points of the bezier patch, GRID_WIDTH x GRID_HEIGHT */
+#define WOBBLY_CONTROL_POINTS 16
 
 double wobbly_settings_get_friction();
 double wobbly_settings_get_spring_k();
@@ -25,8 +27,6 @@ struct wobbly_surface
    int x_cells, y_cells;
    int grabbed, synced;
    int vertex_count;
-
-   GLfloat *v, *uv;
 };
 
 struct wobbly_rect
@@ -46,9 +46,15 @@ void wobbly_ungrab_notify(struct wobbly_surface *surface);
 
 void wobbly_resize(struct wobbly_surface *surface, int width, int height);
 void wobbly_move_notify(struct wobbly_surface *surface, int x, int y);
-void wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint);
+/* Run the given number of fixed steps of the spring model */
+void wobbly_prepare_paint(struct wobbly_surface *surface, int steps);
 void wobbly_done_paint(struct wobbly_surface *surface);
-void wobbly_add_geometry(struct wobbly_surface *surface);
+/**
+ * Write the positions of the control points of the bezier patch, row by row,
+ * to points, which has space for 2 * WOBBLY_CONTROL_POINTS floats.
+ * Returns 0 if there is no model yet.
+ */
+int wobbly_get_control_points(struct wobbly_surface *surface, GLfloat *points);
 struct wobbly_rect wobbly_boundingbox(struct wobbly_surface *surface);
 
 void wobbly_force_geometry(struct wobbly_surface *surface,
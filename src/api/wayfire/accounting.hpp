@@ -0,0 +1,143 @@
+#ifndef WF_ACCOUNTING_HPP
+#define WF_ACCOUNTING_HPP
+
+#include <wayfire/object.hpp>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace wf
+{
+/**
+ * Accounting of the time spent in the callbacks of plugins.
+ *
+ * When core/plugin_accounting is enabled, the core measures each signal
+ * callback and each effect, post and render hook it calls, and attributes the
+ * time to the plugin which defines the callback. The time of a callback
+ * excludes the callbacks which it runs itself, for ex. by emitting another
+ * signal, so that the times of all plugins add up to the time spent in
+ * callbacks. When accounting is disabled, callbacks only check a global flag.
+ */
+namespace accounting
+{
+/** Whether core/plugin_accounting is enabled. Checked by scope_t. */
+extern bool enabled;
+
+/** Load core/plugin_accounting. Called by the core on startup. */
+void init();
+
+struct cpu_time_t
+{
+    /* Time spent in the callbacks, without the callbacks they ran */
+    uint64_t self_nsec = 0;
+    uint64_t max_nsec = 0;
+    /* Number of calls */
+    uint64_t count = 0;
+};
+
+/**
+ * @return The time collected so far, by plugin and by source, which is the
+ *   name of the signal, or the kind of the hook, for ex. "effect pre-hook".
+ */
+std::map<std::pair<std::string, std::string>, cpu_time_t> get_cpu_times();
+
+/** Forget the time collected so far */
+void reset_cpu_times();
+
+/**
+ * Attribute the time collected for callbacks whose plugin isn't known yet.
+ * Called by the plugin loader before a plugin is unloaded, as its code
+ * addresses may then be reused by another plugin.
+ */
+void resolve_owners();
+
+/**
+ * Measures the time from its construction until its destruction and
+ * attributes it to the plugin which defines the callback.
+ */
+class scope_t : public noncopyable_t
+{
+  public:
+    /**
+     * @param callback The type of the called function object, for ex.
+     *   std::function::target_type(), which identifies its plugin.
+     * @param source The signal, or the kind of the hook.
+     */
+    scope_t(const std::type_info& callback, signal_id_t source)
+    {
+        if (enabled)
+            begin(&callback, source);
+    }
+
+    ~scope_t()
+    {
+        if (active)
+            end();
+    }
+
+  private:
+    bool active = false;
+    void begin(const void *callback, signal_id_t source);
+    void end();
+};
+
+/*
+ * Accounting of the memory held for each view and output.
+ *
+ * Subsystems which keep memory for an object report it with
+ * set_memory_usage(). Memory which is easier to compute than to track can
+ * instead be added to a report by listening for the memory-report signal on
+ * the core. The offscreen buffers of views, i.e snapshots and transformer
+ * buffers, are included automatically.
+ */
+enum memory_kind_t
+{
+    MEMORY_CPU,
+    MEMORY_GPU,
+};
+
+struct memory_usage_t
+{
+    /* The description of the view or the output */
+    std::string owner;
+    /* What the memory is used for, for ex. "decoration title" */
+    std::string subsystem;
+    memory_kind_t kind;
+    size_t bytes;
+};
+
+/**
+ * Set the memory which the subsystem holds for the object, replacing what it
+ * reported before. 0 bytes removes the entry. The entries of views and
+ * outputs are removed when they are destroyed.
+ */
+void set_memory_usage(wf::object_base_t *object, const std::string& subsystem,
+    memory_kind_t kind, size_t bytes);
+
+/** Remove all entries of the object */
+void forget_memory_usage(wf::object_base_t *object);
+
+/**
+ * memory-report is emitted on the core when a report is made, so that
+ * listeners can add the memory which they don't track.
+ */
+struct memory_report_signal : public wf::signal_data_t
+{
+    std::vector<memory_usage_t> usage;
+
+    /** Add an entry for the object, which is described like in the report */
+    void add(wf::object_base_t *object, const std::string& subsystem,
+        memory_kind_t kind, size_t bytes);
+};
+
+/**
+ * @return The memory held for each view and output, with one entry per
+ *   subsystem and kind of memory.
+ */
+std::vector<memory_usage_t> get_memory_usage();
+}
+}
+
+#endif /* end of include guard: WF_ACCOUNTING_HPP */
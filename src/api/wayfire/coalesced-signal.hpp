@@ -0,0 +1,154 @@
+#ifndef WF_COALESCED_SIGNAL_HPP
+#define WF_COALESCED_SIGNAL_HPP
+
+#include <wayfire/object.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/render-manager.hpp>
+
+#include <optional>
+
+namespace wf
+{
+/**
+ * A signal connection which delivers a signal at most once per frame of an
+ * output, for signals which are emitted many times per frame, for ex.
+ * geometry-changed while a view is moved or resized.
+ *
+ * The data of the first emission since the last delivery is copied, and the
+ * data of the following emissions is folded into it. The default fold keeps
+ * the first data, so for geometry-changed the callback receives the first
+ * old geometry, and the new geometry is the current one of the view.
+ *
+ * The pending data is delivered before the next frame of the output is
+ * painted, so the damage which the callback adds is part of that frame.
+ * Without an output, each emission is delivered immediately.
+ *
+ * @param Data The type of the signal data, which has to be copyable.
+ */
+template<class Data>
+class coalesced_connection_t : public noncopyable_t
+{
+  public:
+    using callback_t = std::function<void(Data *data)>;
+    /** Fold the data of a later emission into the pending data */
+    using fold_t = std::function<void(Data& pending, const Data& next)>;
+
+    coalesced_connection_t(callback_t callback, fold_t fold = nullptr) :
+        callback(callback), fold(fold)
+    {
+        connection.set_callback([=] (signal_data_t *data)
+        {
+            handle(*static_cast<Data*>(data));
+        });
+
+        on_frame = [=] (uint32_t, wf::region_t&)
+        {
+            deliver();
+            /* The callback may have caused the signal again, it is then
+             * delivered on the next frame */
+            scheduled = pending.has_value();
+            return scheduled;
+        };
+    }
+
+    ~coalesced_connection_t()
+    {
+        disconnect();
+    }
+
+    /**
+     * Connect to the signal of the provider, delivered on the frames of the
+     * given output. The same connection can be connected to multiple signals
+     * with the same data type.
+     */
+    void connect(signal_provider_t *provider, signal_id_t signal,
+        wf::output_t *output)
+    {
+        set_output(output);
+        provider->connect_signal(signal, &connection);
+    }
+
+    /**
+     * Deliver on the frames of another output, for ex. when the view which
+     * emits the signal is moved to it. A pending emission is kept.
+     */
+    void set_output(wf::output_t *output)
+    {
+        unschedule();
+        this->output = output;
+        if (pending)
+            schedule();
+    }
+
+    /** Disconnect from all providers and drop the pending emission */
+    void disconnect()
+    {
+        connection.disconnect();
+        unschedule();
+        pending.reset();
+    }
+
+    /**
+     * Deliver the pending emission now, if there is one, for ex. before
+     * handling input which depends on the state updated by the callback.
+     */
+    void flush()
+    {
+        unschedule();
+        deliver();
+    }
+
+  private:
+    callback_t callback;
+    fold_t fold;
+
+    signal_connection_t connection;
+    wf::animation_hook_t on_frame;
+    wf::output_t *output = nullptr;
+
+    std::optional<Data> pending;
+    bool scheduled = false;
+
+    void handle(const Data& data)
+    {
+        if (!pending)
+            pending = data;
+        else if (fold)
+            fold(*pending, data);
+
+        if (!output)
+            deliver();
+        else if (!scheduled)
+            schedule();
+    }
+
+    void schedule()
+    {
+        if (output)
+        {
+            output->render->add_animation(&on_frame);
+            scheduled = true;
+        }
+    }
+
+    void unschedule()
+    {
+        if (scheduled)
+            output->render->rem_animation(&on_frame);
+
+        scheduled = false;
+    }
+
+    void deliver()
+    {
+        if (!pending)
+            return;
+
+        Data data = std::move(*pending);
+        pending.reset();
+        callback(&data);
+    }
+};
+}
+
+#endif /* end of include guard: WF_COALESCED_SIGNAL_HPP */
@@ -88,6 +88,11 @@ class color_rect_view_t : public wf::view_interface_t, wf::compositor_surface_t
     wf::geometry_t geometry;
     bool _is_mapped;
 
+    /** Draw the rect at x, y with the given projection, damage in fb coords */
+    void render_rect(const wf::framebuffer_t& fb, int x, int y,
+        const glm::mat4& projection, const glm::vec4& multiply,
+        const wf::region_t& damage);
+
   public:
     /**
      * Create a colored rect view. The map signal is not fired by default.
@@ -113,6 +118,11 @@ class color_rect_view_t : public wf::view_interface_t, wf::compositor_surface_t
     virtual void simple_render(const wf::framebuffer_t& fb, int x, int y,
         const wf::region_t& damage) override;
 
+    /* Solid rects are drawn directly under transformers, without buffers */
+    virtual bool render_with_transform(const wf::framebuffer_t& fb,
+        const glm::mat4& matrix, const glm::vec4& color,
+        const wf::region_t& damage) override;
+
     /* required for view_interface_t */
     virtual void move(int x, int y) override;
     virtual void resize(int w, int h) override;
@@ -35,6 +35,7 @@ extern "C"
     struct wlr_relative_pointer_manager_v1;
     struct wlr_pointer_constraints_v1;
     struct wlr_tablet_manager_v2;
+    struct wlr_presentation;
 
 #include <wayland-server.h>
 }
@@ -100,6 +101,7 @@ class compositor_core_t : public wf::object_base_t
         wlr_relative_pointer_manager_v1 *relative_pointer;
         wlr_pointer_constraints_v1 *pointer_constraints;
         wlr_tablet_manager_v2 *tablet_v2;
+        wlr_presentation *presentation;
     } protocols;
 
     std::string to_string() const { return "wayfire-core"; }
@@ -171,6 +173,16 @@ class compositor_core_t : public wf::object_base_t
      */
     virtual void add_view(std::unique_ptr<wf::view_interface_t> view) = 0;
 
+    /**
+     * @return The view with the given id, see object_base_t::get_id(), or
+     *   nullptr if there is no such view. The lookup takes constant time, so
+     *   ids can be used to refer to views, for ex. over IPC.
+     */
+    virtual wayfire_view find_view(uint32_t id) = 0;
+
+    /** @return All views, including unmapped ones, in no particular order */
+    virtual std::vector<wayfire_view> get_all_views() = 0;
+
     /**
      * Set the keyboard focus view. The stacking order on the view's output
      * won't be changed.
@@ -243,6 +255,13 @@ class compositor_core_t : public wf::object_base_t
      */
     virtual pid_t run(std::string command) = 0;
 
+    /**
+     * Emit the shutdown signal and stop the event loop after the current
+     * iteration. The event loop of the compositor flushes the clients itself
+     * and doesn't check wl_display_terminate(), so this must be used instead.
+     */
+    virtual void shutdown() = 0;
+
     /**
      * Returns a reference to the only core instance.
      */
@@ -0,0 +1,83 @@
+#ifndef WF_DMABUF_EXPORT_HPP
+#define WF_DMABUF_EXPORT_HPP
+
+#include <wayfire/opengl.hpp>
+#include <wayfire/object.hpp>
+#include <wayfire/nonstd/noncopyable.hpp>
+
+extern "C"
+{
+#include <wlr/render/dmabuf.h>
+}
+
+namespace wf
+{
+class output_t;
+
+/**
+ * Shares a GL texture with other processes as a dmabuf, so that for ex.
+ * screen recorders and encoders can read it without a copy through the CPU.
+ * The texture is exported with EGL_MESA_image_dma_buf_export, so its memory
+ * is shared, and rendering to it afterwards changes what the consumers see.
+ *
+ * export_buffer() needs a current GL context, the other functions don't.
+ */
+class dmabuf_export_t : public noncopyable_t
+{
+  public:
+    dmabuf_export_t() = default;
+    ~dmabuf_export_t();
+
+    /** @return Whether the driver can export textures at all */
+    static bool is_supported();
+
+    /**
+     * Export the texture of the given framebuffer. Nothing is done if it was
+     * already exported with the same texture and size.
+     *
+     * @return Whether the texture is exported.
+     */
+    bool export_buffer(const wf::framebuffer_base_t& buffer);
+
+    /**
+     * @return The dmabuf of the exported texture, or nullptr. The file
+     *   descriptors stay owned by the export, consumers need to dup() them.
+     */
+    const wlr_dmabuf_attributes *get_attributes() const;
+
+    /** Drop the exported dmabuf */
+    void release();
+
+  private:
+    void *image = nullptr;
+    GLuint exported_tex = 0;
+    wlr_dmabuf_attributes attributes;
+};
+
+/**
+ * workspace-stream-dmabuf is emitted on the output's render manager after a
+ * workspace stream with export_dmabuf set was updated. It is emitted only
+ * when the stream buffer was damaged.
+ *
+ * frame-dmabuf is emitted on the output's render manager after each repaint
+ * with damage while render_manager::set_export_frames() is enabled, with the
+ * buffer which was just committed to the output.
+ *
+ * The attributes are valid only during the signal.
+ */
+struct dmabuf_frame_signal : public wf::signal_data_t
+{
+    wf::output_t *output;
+    /* The workspace of the stream, unused for frame-dmabuf */
+    wf::point_t ws;
+    const wlr_dmabuf_attributes& attributes;
+    /* The damaged part of the buffer, in buffer coordinates */
+    const wf::region_t& damage;
+
+    dmabuf_frame_signal(wf::output_t *output, wf::point_t ws,
+        const wlr_dmabuf_attributes& attributes, const wf::region_t& damage)
+        : output(output), ws(ws), attributes(attributes), damage(damage) { }
+};
+}
+
+#endif /* end of include guard: WF_DMABUF_EXPORT_HPP */
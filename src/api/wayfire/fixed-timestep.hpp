@@ -0,0 +1,66 @@
+#ifndef WF_FIXED_TIMESTEP_HPP
+#define WF_FIXED_TIMESTEP_HPP
+
+#include <algorithm>
+
+namespace wf
+{
+/**
+ * Splits the time which elapses between frames into steps of a fixed length,
+ * for simulations which should behave the same at any refresh rate. Their
+ * cost then depends on the elapsed time, not on the number of frames.
+ *
+ * The time left over is kept for the next frame, and get_progress() tells how
+ * far the simulation is into the next step, so that the drawing can be
+ * interpolated between steps.
+ */
+class fixed_timestep_t
+{
+    double step_ms;
+    int max_steps;
+    double accumulated = 0;
+
+  public:
+    /**
+     * @param step_ms The length of a step in milliseconds.
+     * @param max_steps The maximal number of steps for one frame. After a
+     *   stall, the rest of the time is dropped, so the simulation slows down
+     *   instead of running many steps in one frame.
+     */
+    fixed_timestep_t(double step_ms, int max_steps) :
+        step_ms(step_ms), max_steps(max_steps) {}
+
+    /**
+     * Add the time which has elapsed since the last call.
+     *
+     * @return The number of steps to run now.
+     */
+    int advance(double elapsed_ms)
+    {
+        accumulated += std::max(elapsed_ms, 0.0);
+        int steps = accumulated / step_ms;
+        if (steps > max_steps)
+        {
+            accumulated = 0;
+            return max_steps;
+        }
+
+        accumulated -= steps * step_ms;
+        return steps;
+    }
+
+    /** @return The part of the next step which has elapsed, in [0, 1) */
+    double get_progress() const
+    {
+        return accumulated / step_ms;
+    }
+
+    /** Drop the time which has been accumulated */
+    void reset()
+    {
+        accumulated = 0;
+    }
+};
+}
+
+#endif /* end of include guard: WF_FIXED_TIMESTEP_HPP */
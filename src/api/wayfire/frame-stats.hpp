@@ -0,0 +1,365 @@
+#ifndef WF_FRAME_STATS_HPP
+#define WF_FRAME_STATS_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <wayfire/object.hpp>
+
+namespace wf
+{
+class output_t;
+
+/**
+ * The different phases of an output repaint, in the order they happen.
+ */
+enum frame_phase_t
+{
+    /* Running OUTPUT_EFFECT_PRE hooks */
+    FRAME_PHASE_PRE_HOOKS    = 0,
+    /* Making the output current and querying its damage */
+    FRAME_PHASE_MAKE_CURRENT = 1,
+    /* The render hook or the default renderer */
+    FRAME_PHASE_RENDER       = 2,
+    /* Running OUTPUT_EFFECT_OVERLAY hooks */
+    FRAME_PHASE_OVERLAY      = 3,
+    /* Rendering software cursors */
+    FRAME_PHASE_SW_CURSORS   = 4,
+    /* Running post hooks */
+    FRAME_PHASE_POSTPROCESS  = 5,
+    /* Swapping buffers and committing the output */
+    FRAME_PHASE_SWAP         = 6,
+    /* OUTPUT_EFFECT_POST hooks and sending frame done to clients */
+    FRAME_PHASE_FRAME_DONE   = 7,
+    /* The whole repaint, from the start of the pre hooks until frame done */
+    FRAME_PHASE_TOTAL        = 8,
+
+    /* Number of phases, used internally */
+    FRAME_PHASE_COUNT        = 9,
+};
+
+/** @return A human-readable name of the given phase */
+const char *frame_phase_name(frame_phase_t phase);
+
+/**
+ * The timings of a single repaint.
+ */
+struct frame_timings_t
+{
+    /* Sequence number of the repaint on its output */
+    uint64_t frame_id = 0;
+    /* Whether the repaint was skipped because the output had no damage */
+    bool skipped = false;
+    /* Whether a client buffer was scanned out instead of compositing */
+    bool direct_scanout = false;
+    /* Duration of each phase, in microseconds */
+    int64_t phase_usec[FRAME_PHASE_COUNT] = {0};
+
+    /* Number of surfaces and snapshotted views drawn by the default renderer
+     * and workspace streams */
+    uint32_t surfaces_rendered = 0;
+    /* Number of views which were skipped because their damaged part was
+     * completely covered by opaque surfaces above them */
+    uint32_t views_culled = 0;
+
+    /* Number of rectangles in the visible damage of the output */
+    uint32_t damage_rects = 0;
+    /* Number of rectangles left after applying the damage simplification
+     * policy (core/damage_max_rects and core/damage_merge_ratio) */
+    uint32_t damage_rects_simplified = 0;
+
+    /* Area in pixels of the damage scheduled before the OUTPUT_EFFECT_PRE
+     * hooks ran */
+    uint64_t damage_area = 0;
+    /* Area in pixels which OUTPUT_EFFECT_PRE hooks and workspace-stream-pre
+     * handlers added to the damage, for ex. the padding of blur */
+    uint64_t damage_area_inflated = 0;
+
+    /* Number of GL state changes which were issued and which were skipped
+     * because the state was already set */
+    uint32_t gl_state_changes = 0;
+    uint32_t gl_state_changes_skipped = 0;
+
+    /* Number of framebuffer allocations which were served from the render
+     * target pool, and which had to create a new framebuffer */
+    uint32_t render_target_hits = 0;
+    uint32_t render_target_misses = 0;
+
+    /* Number of times the render lists of workspace streams had to grow.
+     * Their memory is reused between frames, so this is 0 once the lists
+     * have the size of the scene. */
+    uint32_t repaint_allocations = 0;
+
+    /* Number of frame events which were sent to surfaces, which were
+     * throttled because the surfaces were hidden (core/occluded_frame_interval)
+     * and which were held back by frame callback pacing */
+    uint32_t frame_done_sent = 0;
+    uint32_t frame_done_throttled = 0;
+    uint32_t frame_done_deferred = 0;
+};
+
+/**
+ * The presentation of a committed frame, as reported by the backend.
+ */
+struct frame_presentation_t
+{
+    /* The frame_id of the repaint which committed the frame */
+    uint64_t frame_id = 0;
+    /* Time from the commit until the frame was shown, in microseconds */
+    int64_t latency_usec = 0;
+    /* Time since the previous presentation on the output, in microseconds,
+     * or 0 for the first presentation */
+    int64_t interval_usec = 0;
+    /* Refresh period of the output in nanoseconds, 0 if unknown */
+    int64_t refresh_nsec = 0;
+    /* Number of vblanks which passed between the commit and the one at which
+     * the frame was shown */
+    uint32_t missed_vblanks = 0;
+};
+
+/**
+ * A histogram of durations in microseconds.
+ *
+ * Buckets are log-linear: values below 16us have one bucket each, after that
+ * each power of two is split into 8 buckets, so percentiles have a relative
+ * error of at most 12.5%.
+ */
+class duration_histogram_t
+{
+  public:
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int LINEAR_BUCKETS = 16;
+    /* Covers durations up to 2^28us, i.e. a bit more than 4 minutes */
+    static constexpr int NUM_BUCKETS = LINEAR_BUCKETS + (28 - 4) * SUB_BUCKETS;
+
+    /** Add a single measurement */
+    void add_sample(int64_t usec);
+
+    /** Drop all measurements */
+    void reset();
+
+    /** @return The number of measurements */
+    uint64_t get_count() const { return count; }
+    /** @return The largest measurement, or 0 if no measurements */
+    int64_t get_max() const { return max; }
+    /** @return The average of the measurements, or 0 if no measurements */
+    int64_t get_mean() const;
+
+    /**
+     * @return An upper bound for the given percentile (p in [0, 100]), or 0
+     *   if there are no measurements.
+     */
+    int64_t get_percentile(double p) const;
+
+    /** @return The number of measurements in the given bucket */
+    uint64_t get_bucket_count(int bucket) const { return buckets[bucket]; }
+    /** @return The smallest value which falls in the given bucket */
+    static int64_t get_bucket_start(int bucket);
+
+  private:
+    static int get_bucket_index(int64_t usec);
+
+    uint64_t buckets[NUM_BUCKETS] = {0};
+    uint64_t count = 0;
+    int64_t sum = 0;
+    int64_t max = 0;
+};
+
+/**
+ * Accumulated repaint statistics for an output.
+ */
+class frame_stats_t
+{
+  public:
+    /** Add the timings of a finished repaint */
+    void add_frame(const frame_timings_t& timings);
+
+    /** Add the presentation of a committed frame */
+    void add_presentation(const frame_presentation_t& presentation);
+
+    /**
+     * Add the time from an input event until the presentation of the first
+     * frame which was damaged after the event.
+     *
+     * @param device The name of the input device
+     */
+    void add_input_latency(const std::string& device, int64_t usec);
+
+    /** Drop all accumulated statistics */
+    void reset();
+
+    /** @return The histogram for the given phase */
+    const duration_histogram_t& get_phase(frame_phase_t phase) const
+    {
+        return phases[phase];
+    }
+
+    /** @return The histogram of commit-to-present latencies */
+    const duration_histogram_t& get_present_latency() const
+    {
+        return present_latency;
+    }
+
+    /** @return The histogram of intervals between presentations */
+    const duration_histogram_t& get_present_interval() const
+    {
+        return present_interval;
+    }
+
+    /** @return The histograms of input-to-present latency, by device name */
+    const std::map<std::string, duration_histogram_t>& get_input_latency() const
+    {
+        return input_latency;
+    }
+
+    /** @return The timings of the last repaint which wasn't skipped */
+    const frame_timings_t& get_last_frame() const { return last_frame; }
+
+    /** @return The number of repaints which were not skipped */
+    uint64_t get_rendered_frames() const { return rendered_frames; }
+    /** @return The number of repaints skipped because of no damage */
+    uint64_t get_skipped_frames() const { return skipped_frames; }
+    /** @return The number of rendered repaints which used direct scanout */
+    uint64_t get_scanout_frames() const { return scanout_frames; }
+
+    /** @return The number of frames which were presented */
+    uint64_t get_presented_frames() const { return presented_frames; }
+    /** @return The sum of missed_vblanks over all presented frames */
+    uint64_t get_missed_vblanks() const { return missed_vblanks; }
+
+    /** @return The sum of surfaces_rendered over all repaints */
+    uint64_t get_total_surfaces_rendered() const { return total_surfaces_rendered; }
+    /** @return The sum of views_culled over all repaints */
+    uint64_t get_total_views_culled() const { return total_views_culled; }
+    /** @return The sum of damage_rects over all repaints */
+    uint64_t get_total_damage_rects() const { return total_damage_rects; }
+    /** @return The sum of damage_rects_simplified over all repaints */
+    uint64_t get_total_damage_rects_simplified() const
+    {
+        return total_damage_rects_simplified;
+    }
+    /** @return The sum of damage_area over all repaints */
+    uint64_t get_total_damage_area() const { return total_damage_area; }
+    /** @return The sum of damage_area_inflated over all repaints */
+    uint64_t get_total_damage_area_inflated() const
+    {
+        return total_damage_area_inflated;
+    }
+    /** @return The sum of gl_state_changes over all repaints */
+    uint64_t get_total_gl_state_changes() const { return total_gl_state_changes; }
+    /** @return The sum of gl_state_changes_skipped over all repaints */
+    uint64_t get_total_gl_state_changes_skipped() const
+    {
+        return total_gl_state_changes_skipped;
+    }
+    /** @return The sum of render_target_hits over all repaints */
+    uint64_t get_total_render_target_hits() const
+    {
+        return total_render_target_hits;
+    }
+    /** @return The sum of render_target_misses over all repaints */
+    uint64_t get_total_render_target_misses() const
+    {
+        return total_render_target_misses;
+    }
+    /** @return The sum of repaint_allocations over all repaints */
+    uint64_t get_total_repaint_allocations() const
+    {
+        return total_repaint_allocations;
+    }
+
+    /** @return The sum of frame_done_sent over all repaints */
+    uint64_t get_total_frame_done_sent() const { return total_frame_done_sent; }
+    /** @return The sum of frame_done_throttled over all repaints */
+    uint64_t get_total_frame_done_throttled() const
+    {
+        return total_frame_done_throttled;
+    }
+    /** @return The sum of frame_done_deferred over all repaints */
+    uint64_t get_total_frame_done_deferred() const
+    {
+        return total_frame_done_deferred;
+    }
+
+    /**
+     * @return A multi-line summary with count, mean, p50, p99 and max for
+     *   each phase, for presentation latency and interval, and for the input
+     *   latency of each device, in milliseconds.
+     */
+    std::string to_string() const;
+
+  private:
+    duration_histogram_t phases[FRAME_PHASE_COUNT];
+    duration_histogram_t present_latency;
+    duration_histogram_t present_interval;
+    std::map<std::string, duration_histogram_t> input_latency;
+    uint64_t presented_frames = 0;
+    uint64_t missed_vblanks = 0;
+    frame_timings_t last_frame;
+    uint64_t rendered_frames = 0;
+    uint64_t skipped_frames = 0;
+    uint64_t scanout_frames = 0;
+    uint64_t total_surfaces_rendered = 0;
+    uint64_t total_views_culled = 0;
+    uint64_t total_damage_rects = 0;
+    uint64_t total_damage_rects_simplified = 0;
+    uint64_t total_damage_area = 0;
+    uint64_t total_damage_area_inflated = 0;
+    uint64_t total_gl_state_changes = 0;
+    uint64_t total_gl_state_changes_skipped = 0;
+    uint64_t total_render_target_hits = 0;
+    uint64_t total_render_target_misses = 0;
+    uint64_t total_repaint_allocations = 0;
+    uint64_t total_frame_done_sent = 0;
+    uint64_t total_frame_done_throttled = 0;
+    uint64_t total_frame_done_deferred = 0;
+};
+
+/**
+ * frame-timings is emitted by the output's render manager after each repaint
+ * which was not skipped.
+ */
+struct frame_timings_signal : public wf::signal_data_t
+{
+    wf::output_t *output;
+    const frame_timings_t& timings;
+
+    frame_timings_signal(wf::output_t *output, const frame_timings_t& timings)
+        : output(output), timings(timings) { }
+};
+
+/**
+ * frame-presented is emitted by the output's render manager when a frame
+ * committed by a repaint (or by direct scanout) is shown on the output.
+ */
+struct frame_presented_signal : public wf::signal_data_t
+{
+    wf::output_t *output;
+    const frame_presentation_t& presentation;
+
+    frame_presented_signal(wf::output_t *output,
+        const frame_presentation_t& presentation)
+        : output(output), presentation(presentation) { }
+};
+
+/**
+ * Statistics of the main event loop, which serves all outputs and clients.
+ *
+ * Events sent to clients by the handlers of one iteration are only buffered,
+ * and each client with pending events is flushed once before the loop waits
+ * again. The number of iterations is therefore also the number of times the
+ * compositor waits, and bounds the number of writes to each client.
+ */
+struct event_loop_stats_t
+{
+    /* Number of event loop iterations */
+    uint64_t iterations = 0;
+    /* Time spent flushing the buffered events to clients, in nanoseconds */
+    uint64_t flush_nsec = 0;
+};
+
+/** @return The statistics of the main event loop */
+event_loop_stats_t& get_event_loop_stats();
+}
+
+#endif /* end of include guard: WF_FRAME_STATS_HPP */
@@ -2,19 +2,129 @@
 #define IMG_HPP_
 
 #include "wayfire/debug.hpp"
+#include "wayfire/nonstd/noncopyable.hpp"
 #include <GLES2/gl2.h>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace image_io
 {
+    /** A decoded image in CPU memory, with the top row first */
+    struct image_t
+    {
+        int width = 0, height = 0;
+        /* GL_RGBA or GL_RGB, with one byte per channel */
+        GLenum format = GL_RGBA;
+        std::vector<uint8_t> pixels;
+    };
+
     /* Load the image from the given file, binding it to the given GL texture target
      * Bind the texture before you call this function
      * Guaranteed: doesn't change any GL state except pixel packing */
     bool load_from_file(std::string name, GLuint target);
 
+    /**
+     * Decode the image from the given file into CPU memory. Doesn't use GL,
+     * so it is safe to call from any thread.
+     */
+    bool decode_from_file(std::string name, image_t& image);
+
+    /**
+     * Decodes an image on a worker thread, so that large images don't block
+     * input and rendering. The callback is called on the main thread, with
+     * the image or nullptr if it couldn't be decoded. Destroying the request
+     * before that cancels it.
+     */
+    class async_decode_t : public noncopyable_t
+    {
+      public:
+        using callback_t = std::function<void(std::shared_ptr<image_t>)>;
+        async_decode_t(std::string name, callback_t callback);
+        ~async_decode_t();
+
+        struct state_t;
+
+      private:
+        std::shared_ptr<state_t> state;
+    };
+
+    /**
+     * Uploads an image to a texture a few rows at a time, each time the event
+     * loop goes idle, so that uploading a large image doesn't delay frames.
+     * The texture shouldn't be used before done is called, because its
+     * contents are incomplete. Destroying the upload before that cancels it.
+     *
+     * Mipmaps aren't generated, because they need the whole image.
+     */
+    class chunked_upload_t : public noncopyable_t
+    {
+      public:
+        /**
+         * @param tex The texture, whose storage is allocated with the size of
+         *   the image.
+         * @param target GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP for the image on
+         *   each face of a cubemap.
+         */
+        chunked_upload_t(std::shared_ptr<image_t> image, GLuint tex,
+            GLenum target, std::function<void()> done);
+        ~chunked_upload_t();
+
+      private:
+        class impl;
+        std::unique_ptr<impl> priv;
+    };
+
     /* Function that saves the given pixels(in rgba format) to a (currently) png file */
     void write_to_file(std::string name, uint8_t *pixels, int w, int h, std::string type);
 
+    /** Called on the main thread with whether the image was written */
+    using write_callback_t = std::function<void(bool)>;
+
+    /**
+     * Same as write_to_file(), but the image is encoded and written on a
+     * worker thread. Besides "png", which uses a fast compression level, the
+     * type can be "pam" for uncompressed RGBA.
+     *
+     * @param pixels The RGBA pixels, with the bottom row first as read from GL.
+     */
+    void write_to_file_async(std::string name, std::vector<uint8_t> pixels,
+        int w, int h, std::string type, write_callback_t callback = nullptr);
+
+    /** Called on the main thread with the pixels, empty if they couldn't be read */
+    using readback_callback_t = std::function<void(std::vector<uint8_t>)>;
+    /** Called on a worker thread with the pixels, for ex. to convert them */
+    using readback_process_t = std::function<void(std::vector<uint8_t>&)>;
+
+    /**
+     * Read back a part of a framebuffer without waiting for the GPU. The
+     * pixels are copied to a pixel pack buffer, which is mapped on a later
+     * iteration of the event loop, once a fence shows that the copy is done.
+     * Requires a bound GL context, see also
+     * wf::framebuffer_base_t::read_pixels_async().
+     *
+     * @param fb The GL framebuffer to read from.
+     * @param x, y, w, h The part to read, in GL coordinates.
+     * @param callback Gets the RGBA pixels, with the bottom row first, after
+     *   they were passed through process.
+     * @param process If set, runs on the worker thread before the callback.
+     */
+    void read_framebuffer_async(GLuint fb, int x, int y, int w, int h,
+        readback_callback_t callback, readback_process_t process = nullptr);
+
+    /**
+     * Read back a part of a framebuffer and write it to a file, without
+     * waiting for the GPU or for the encoder. The pixels are copied to a pixel
+     * pack buffer, which is mapped once a fence shows that the copy is done,
+     * and then passed to write_to_file_async().
+     *
+     * @param fb The GL framebuffer to read from.
+     * @param x, y, w, h The part to read, in framebuffer coordinates.
+     */
+    void write_framebuffer_async(GLuint fb, int x, int y, int w, int h,
+        std::string name, std::string type, write_callback_t callback = nullptr);
+
     /* Initializes all backends, called at startup */
     void init();
 }
@@ -1,91 +1,146 @@
 #ifndef WF_SAFE_LIST_HPP
 #define WF_SAFE_LIST_HPP
 
-#include <list>
-#include <memory>
+#include <vector>
+#include <optional>
 #include <algorithm>
 #include <functional>
-
-#include <wayland-server.h>
+#include <stdexcept>
 
 #include "reverse.hpp"
 
-/* This is a trimmed-down wrapper of std::list<T>.
+/* This is a list-like container stored contiguously in a std::vector.
  *
  * It supports safe iteration over all elements in the collection, where any
  * element can be deleted from the list at any given time (i.e even in a
- * for-each-like loop) */
+ * for-each-like loop).
+ *
+ * Erased elements are left as tombstones while the list is being iterated,
+ * and are compacted away as soon as the last iteration is done. Elements are
+ * copied before being passed to the iteration callback, so T must be cheap
+ * to copy, like the pointers and small structs this is used with. */
 namespace wf
 {
-    /* The object type depends on the safe list type, and the safe list type
-     * needs access to the event loop. However, the event loop is typically
-     * available from core.hpp. Because we can't resolve this circular dependency,
-     * we provide a link to the event loop specially for the safe list */
-    namespace _safe_list_detail
-    {
-        /* In main.cpp, and initialized there */
-        extern wl_event_loop* event_loop;
-        void idle_cleanup_func(void *data);
-    }
-
     template<class T>
     class safe_list_t
     {
-        std::list<std::unique_ptr<T>> list;
-        wl_event_source *idle_cleanup_source = NULL;
+        /* Compacting doesn't change the contents, so it is done in const
+         * methods too */
+        mutable std::vector<std::optional<T>> list;
+        /* Number of erased elements still stored in the list */
+        mutable size_t tombstones = 0;
+
+        /* The position of a running iteration. The running iterations of a
+         * list form a stack, each cursor lives in its for_each call.
+         * Positions are updated when elements are inserted before them.
+         *
+         * When going backwards, pos is one past the next element. */
+        struct cursor_t
+        {
+            size_t pos;
+            size_t end;
+            bool reverse;
+            cursor_t *prev;
+        };
+
+        mutable cursor_t *cursors = nullptr;
+
+        /* Remove all erased elements, if the list is not being iterated */
+        void try_compact() const
+        {
+            if (cursors || !tombstones)
+                return;
+
+            auto it = std::remove_if(list.begin(), list.end(),
+                [] (const std::optional<T>& el) { return !el.has_value(); });
+            list.erase(it, list.end());
+            tombstones = 0;
+        }
 
-        /* Remove all invalidated elements in the list */
-        std::function<void()> do_cleanup = [&] ()
+        /* Insert at the given index, updating running iterations */
+        void insert_at_index(size_t index, T&& value)
         {
-            auto it = list.begin();
-            while (it != list.end())
+            list.emplace(list.begin() + index, std::move(value));
+            for (auto c = cursors; c; c = c->prev)
             {
-                if (*it) {
-                    ++it;
-                } else {
-                    it = list.erase(it);
+                if (c->reverse)
+                {
+                    c->pos += (index < c->pos);
+                } else
+                {
+                    c->pos += (index <= c->pos);
+                    c->end += (index < c->end);
                 }
             }
+        }
 
-            idle_cleanup_source = NULL;
-        };
-
-        /* Return whether the list has invalidated elements */
-        bool is_dirty() const
+        template<class F>
+        void iterate(F&& func, bool reverse) const
         {
-            return idle_cleanup_source;
+            cursor_t cursor;
+            cursor.reverse = reverse;
+            cursor.prev = cursors;
+            if (reverse)
+            {
+                cursor.pos = list.size();
+                cursor.end = 0;
+            } else
+            {
+                cursor.pos = 0;
+                cursor.end = list.size();
+            }
+
+            cursors = &cursor;
+            while (reverse ? cursor.pos > cursor.end : cursor.pos < cursor.end)
+            {
+                size_t index = reverse ? --cursor.pos : cursor.pos++;
+                if (!list[index])
+                    continue;
+
+                /* The callback may push to the list and thus reallocate it,
+                 * so it gets its own copy of the element */
+                T element = *list[index];
+                func(element);
+            }
+
+            cursors = cursor.prev;
+            try_compact();
         }
 
         public:
         safe_list_t() {};
 
-        /* Copy the not-erased elements from other, but do not copy the idle source */
+        /* Copy the not-erased elements from other */
         safe_list_t(const safe_list_t& other) { *this = other; }
         safe_list_t& operator = (const safe_list_t& other)
         {
-            this->idle_cleanup_source = NULL;
+            if (this == &other)
+                return *this;
+
+            list.clear();
+            tombstones = 0;
             other.for_each([&] (auto& el) {
                 this->push_back(el);
             });
-        }
 
-        safe_list_t(safe_list_t&& other) = default;
-        safe_list_t& operator = (safe_list_t&& other) = default;
+            return *this;
+        }
 
-        ~safe_list_t()
+        /* Lists can't be moved while they are being iterated */
+        safe_list_t(safe_list_t&& other) { *this = std::move(other); }
+        safe_list_t& operator = (safe_list_t&& other)
         {
-            if (idle_cleanup_source)
-                wl_event_source_remove(idle_cleanup_source);
+            list = std::move(other.list);
+            tombstones = other.tombstones;
+            other.list.clear();
+            other.tombstones = 0;
+            return *this;
         }
 
         T& back()
         {
-            /* No invalidated elements */
-            if (!is_dirty())
-                return *list.back();
-
             auto it = list.rbegin();
-            while (it != list.rend() && (*it) == nullptr)
+            while (it != list.rend() && !it->has_value())
                 ++it;
 
             if (it == list.rend())
@@ -96,27 +151,19 @@ namespace wf
 
         size_t size() const
         {
-            if (!is_dirty())
-                return list.size();
-
-            /* Count non-null elements, because that's the real size */
-            size_t sz = 0;
-            for (auto& it : list)
-                sz += (it != nullptr);
-
-            return sz;
+            return list.size() - tombstones;
         }
 
         /* Push back by copying */
         void push_back(T value)
         {
-            list.push_back(std::make_unique<T> (std::move(value)));
+            list.emplace_back(std::move(value));
         }
 
         /* Push back by moving */
         void emplace_back(T&& value)
         {
-            list.push_back(std::make_unique<T> (value));
+            list.emplace_back(std::move(value));
         }
 
         enum insert_place_t
@@ -131,33 +178,25 @@ namespace wf
          * check indicates, or at the end of the list otherwise */
         void emplace_at(T&& value, std::function<insert_place_t(T&)> check)
         {
-            auto it = list.begin();
-            while (it != list.end())
+            for (size_t i = 0; i < list.size(); i++)
             {
                 /* Skip empty elements */
-                if (*it == nullptr)
-                {
-                    ++it;
+                if (!list[i])
                     continue;
-                }
 
-                auto place = check(**it);
-                switch (place)
+                switch (check(*list[i]))
                 {
                     case INSERT_AFTER:
-                        /* We can safely increment it, because it points to an
-                         * element in the list */
-                        ++it;
-                        // fall through
+                        insert_at_index(i + 1, std::move(value));
+                        return;
+
                     case INSERT_BEFORE:
-                        list.emplace(it, std::make_unique<T>(value));
+                        insert_at_index(i, std::move(value));
                         return;
 
                     default:
                         break;
                 }
-
-                ++it;
             }
 
             /* If no place found, insert at the end */
@@ -170,57 +209,50 @@ namespace wf
         }
 
         /* Call func for each non-erased element of the list */
-        void for_each(std::function<void(T&)> func) const
+        template<class F>
+        void for_each(F&& func) const
         {
-            /* Go through all elements currently in the list */
-            auto it = list.begin();
-            for (int size = list.size(); size > 0; size--, it++)
-            {
-                if (*it)
-                    func(**it);
-            }
+            iterate(std::forward<F>(func), false);
         }
 
         /* Call func for each non-erased element of the list in reversed order */
-        void for_each_reverse(std::function<void(T&)> func) const
+        template<class F>
+        void for_each_reverse(F&& func) const
         {
-            auto it = list.rbegin();
-            for (int size = list.size(); size > 0; size--, it++)
-            {
-                if (*it)
-                    func(**it);
-            }
+            iterate(std::forward<F>(func), true);
         }
 
         /* Safely remove all elements equal to value */
         void remove_all(const T& value)
         {
-            remove_if([=] (const T& el) { return el == value; });
+            remove_if([&] (const T& el) { return el == value; });
         }
 
         /* Remove all elements satisfying a given condition.
-         * This function resets their pointers and scheduling a cleanup operation */
-        void remove_if(std::function<bool(const T&)> predicate)
+         * The elements are destroyed immediately, and the list is compacted
+         * if it is not being iterated */
+        template<class F>
+        void remove_if(F&& predicate)
         {
-            bool actually_removed = false;
-            for (auto& it : list)
+            /* Block compacting while looping, the destructors of the removed
+             * elements may modify the list */
+            cursor_t guard{0, 0, false, cursors};
+            cursors = &guard;
+            for (size_t i = 0; i < list.size(); i++)
             {
-                if (it && predicate(*it))
+                if (list[i] && predicate(*list[i]))
                 {
-                    actually_removed = true;
-                    /* First reset the element in the list, and then free resources */
-                    auto copy = std::move(it);
-                    it = nullptr;
-                    /* Now copy goes out of scope */
+                    /* First reset the element in the list, and then free
+                     * resources */
+                    std::optional<T> removed;
+                    removed.swap(list[i]);
+                    ++tombstones;
+                    /* Now removed goes out of scope */
                 }
             }
 
-            /* Schedule a clean-up, but be careful to not schedule it twice */
-            if (!idle_cleanup_source && actually_removed)
-            {
-                idle_cleanup_source = wl_event_loop_add_idle(_safe_list_detail::event_loop,
-                    _safe_list_detail::idle_cleanup_func, &do_cleanup);
-            }
+            cursors = guard.prev;
+            try_compact();
         }
     };
 }
@@ -1,9 +1,12 @@
 #ifndef OBJECT_HPP
 #define OBJECT_HPP
 
+#include <cstdint>
+#include <functional>
 #include <typeinfo>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <wayfire/nonstd/observer_ptr.h>
 #include <wayfire/nonstd/noncopyable.hpp>
@@ -21,6 +24,35 @@ struct signal_data_t
 using signal_callback_t = std::function<void(signal_data_t*)>;
 class signal_provider_t;
 
+/**
+ * An interned signal name.
+ *
+ * Creating a signal ID looks up the name in a global table, but connecting,
+ * disconnecting and emitting with an ID doesn't hash or compare strings.
+ * Signals emitted often should use an ID created once, for ex:
+ *
+ * static const wf::signal_id_t frame_signal{"frame"};
+ * output->emit_signal(frame_signal, &data);
+ *
+ * The same name always gives the same ID, so IDs and names can be mixed.
+ */
+class signal_id_t
+{
+  public:
+    explicit signal_id_t(const std::string& name);
+
+    /** @return The numeric value of the ID, unique for each name */
+    uint32_t get() const { return id; }
+    /** @return The name of the signal */
+    const std::string& get_name() const;
+
+    bool operator ==(const signal_id_t& other) const { return id == other.id; }
+    bool operator !=(const signal_id_t& other) const { return id != other.id; }
+
+  private:
+    uint32_t id;
+};
+
 /**
  * Provides an interface to connect to signal providers.
  *
@@ -60,6 +92,7 @@ class signal_provider_t
   public:
     /** Register a connection to be called when the given signal is emitted. */
     void connect_signal(std::string name, signal_connection_t* callback);
+    void connect_signal(signal_id_t signal, signal_connection_t* callback);
     /** Unregister a connection. */
     void disconnect_signal(signal_connection_t *callback);
 
@@ -68,14 +101,17 @@ class signal_provider_t
      * Register a callback to be called whenever the given signal is emitted
      */
     void connect_signal(std::string name, signal_callback_t* callback);
+    void connect_signal(signal_id_t signal, signal_callback_t* callback);
     /**
      * Deprecated.
      * Unregister a registered callback.
      */
     void disconnect_signal(std::string name, signal_callback_t* callback);
+    void disconnect_signal(signal_id_t signal, signal_callback_t* callback);
 
     /** Emit the given signal. No type checking for data is required */
     void emit_signal(std::string name, signal_data_t *data);
+    void emit_signal(signal_id_t signal, signal_data_t *data);
 
     virtual ~signal_provider_t();
 
@@ -116,8 +152,7 @@ class object_base_t : public signal_provider_t
      * REQUIRES a default constructor
      * If your type doesn't have one, use store_data + get_data
      */
-    template<class T> nonstd::observer_ptr<T> get_data_safe(
-        std::string name = typeid(T).name())
+    template<class T> nonstd::observer_ptr<T> get_data_safe(std::string name)
     {
         if (!has_data(name))
             store_data<T>(std::make_unique<T>(), name);
@@ -127,26 +162,51 @@ class object_base_t : public signal_provider_t
 
     /* Retrieve custom data stored with the given name. If no such
      * data exists, NULL is returned */
-    template<class T> nonstd::observer_ptr<T> get_data(
-        std::string name = typeid(T).name())
+    template<class T> nonstd::observer_ptr<T> get_data(std::string name)
     {
-        if (!has_data(name))
-            return nullptr;
-
         return nonstd::make_observer(dynamic_cast<T*> (_fetch_data(name)));
     }
 
     /* Assigns the given data to the given name */
     template<class T> void store_data(std::unique_ptr<T> stored_data,
-        std::string name = typeid(T).name())
+        std::string name)
     {
         _store_data(std::move(stored_data), name);
     }
 
+    /**
+     * The same as the named versions, using the name of the type T.
+     *
+     * The data of each type is also found through a per-type index, so these
+     * don't build or hash the name, and are cheap enough to use every frame.
+     */
+    template<class T> nonstd::observer_ptr<T> get_data_safe()
+    {
+        auto data = _fetch_typed_data(_get_data_index<T>());
+        if (!data)
+        {
+            store_data<T>(std::make_unique<T>());
+            data = _fetch_typed_data(_get_data_index<T>());
+        }
+
+        return nonstd::make_observer(dynamic_cast<T*> (data));
+    }
+
+    template<class T> nonstd::observer_ptr<T> get_data()
+    {
+        auto data = _fetch_typed_data(_get_data_index<T>());
+        return nonstd::make_observer(dynamic_cast<T*> (data));
+    }
+
+    template<class T> void store_data(std::unique_ptr<T> stored_data)
+    {
+        _store_data(std::move(stored_data), typeid(T).name());
+    }
+
     /* Returns true if there is saved data under the given name */
     template<class T> bool has_data()
     {
-        return has_data(typeid(T).name());
+        return _fetch_typed_data(_get_data_index<T>()) != nullptr;
     }
 
     /** @return true if there is saved data with the given name */
@@ -162,8 +222,12 @@ class object_base_t : public signal_provider_t
     }
 
     /* Erase the saved data from the store and return the pointer */
-    template<class T> std::unique_ptr<T> release_data(
-        std::string name = typeid(T).name())
+    template<class T> std::unique_ptr<T> release_data()
+    {
+        return release_data<T>(typeid(T).name());
+    }
+
+    template<class T> std::unique_ptr<T> release_data(std::string name)
     {
         if (!has_data(name))
             return {nullptr};
@@ -187,6 +251,39 @@ class object_base_t : public signal_provider_t
     /** Store the given data under the given name */
     void _store_data(std::unique_ptr<custom_data_t> data, std::string name);
 
+    /** @return The index of the data stored under the name of the type T */
+    template<class T> static uint32_t _get_data_index()
+    {
+        static const uint32_t index = _register_data_name(typeid(T).name());
+        return index;
+    }
+
+    /**
+     * Get the index of the given name, allocating a new one if needed. The
+     * same name always gets the same index, even from different plugins.
+     */
+    static uint32_t _register_data_name(const std::string& name);
+
+    /** Just get the data under the name with the given index */
+    custom_data_t *_fetch_typed_data(uint32_t index)
+    {
+        if (index < typed_data.size())
+            return typed_data[index];
+
+        return _fill_typed_data(index);
+    }
+
+    /** Find the data of the registered names which are not in typed_data */
+    custom_data_t *_fill_typed_data(uint32_t index);
+    /** Update the entry of typed_data for the given name, if it has one */
+    void _update_typed_data(const std::string& name);
+
+    /**
+     * The data stored under each registered name, by index, or null.
+     * The data is owned by obase_priv, this is only a lookup table.
+     */
+    std::vector<custom_data_t*> typed_data;
+
     class obase_impl;
     std::unique_ptr<obase_impl> obase_priv;
 };
@@ -2,6 +2,13 @@
 #define WF_OPENGL_HPP
 
 #include <GLES3/gl3.h>
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include <wayfire/config/types.hpp>
 #include <wayfire/util.hpp>
@@ -42,11 +49,54 @@ namespace wf
  * streams.
  *
  * Resources (tex/fb) are not automatically destroyed */
+/* Storage formats of the texture of a framebuffer */
+enum framebuffer_format_t
+{
+    /* 8 bits per channel with alpha, the default */
+    FRAMEBUFFER_FORMAT_RGBA8 = 0,
+    /* Without alpha, for contents which are known to be opaque */
+    FRAMEBUFFER_FORMAT_RGB8  = 1,
+    /* Half the memory and bandwidth of RGBA8, for intermediate buffers
+     * which are heavily filtered anyway, for ex. by blur */
+    FRAMEBUFFER_FORMAT_RGB565 = 2,
+};
+
+/* The layouts of the pixels read with framebuffer_base_t::read_pixels_async() */
+enum readback_format_t
+{
+    /* RGBA bytes with the bottom row first, as GL returns them */
+    READBACK_FORMAT_RGBA_GL  = 0,
+    /* RGBA bytes with the top row first, for ex. for image_io */
+    READBACK_FORMAT_RGBA     = 1,
+    /* WL_SHM_FORMAT_ARGB8888, i.e BGRA bytes, with the top row first, for ex.
+     * for copying to shm buffers of clients */
+    READBACK_FORMAT_ARGB8888 = 2,
+};
+
+/* Pixels read back from a framebuffer */
+struct readback_t
+{
+    int width = 0, height = 0;
+    readback_format_t format = READBACK_FORMAT_RGBA_GL;
+    /* 4 bytes per pixel, without padding between the rows */
+    std::vector<uint8_t> pixels;
+};
+
+/* Called on the main thread with the pixels, or nullptr if they couldn't be
+ * read */
+using readback_callback_t = std::function<void(std::shared_ptr<readback_t>)>;
+
 struct framebuffer_base_t : public noncopyable_t
 {
     GLuint tex = -1, fb = -1;
     int32_t viewport_width = 0, viewport_height = 0;
 
+    /* The format of the texture, to be set before allocate(). A change is
+     * applied by the next allocate(), like a resize. Only RGBA8 framebuffers
+     * come from the pool, and if the driver can't render to the requested
+     * format, RGBA8 is used instead. */
+    framebuffer_format_t format = FRAMEBUFFER_FORMAT_RGBA8;
+
     framebuffer_base_t() = default;
     framebuffer_base_t(framebuffer_base_t&& other);
     framebuffer_base_t& operator = (framebuffer_base_t&& other);
@@ -56,7 +106,11 @@ struct framebuffer_base_t : public noncopyable_t
 
     /* will invalidate texture contents if width or height changes.
      * If tex and/or fb haven't been set, it creates them
-     * Return true if texture was created/invalidated */
+     * Return true if texture was created/invalidated
+     *
+     * If neither tex nor fb have been set, they are taken from a pool of
+     * released framebuffers of the same size. Such framebuffers go back to the
+     * pool when they are resized or released. */
     bool allocate(int width, int height);
 
     /* Make the framebuffer current, and adjust viewport to its size */
@@ -66,6 +120,27 @@ struct framebuffer_base_t : public noncopyable_t
      * coordinate space */
     void scissor(wlr_box box) const;
 
+    /* Get the texture for drawing it heavily downscaled, for ex. for previews.
+     * If core/minified_mipmaps is enabled, the texture is sampled from
+     * mipmaps, which are generated again if the contents changed since the
+     * last call. Changes are noticed through bind() and allocate(), the others
+     * must be reported with contents_changed(). */
+    wf::texture_t get_minified_texture() const;
+
+    /* Report that the contents changed without bind(), for ex. when they
+     * were drawn through another framebuffer object with the same fb */
+    void contents_changed() const;
+
+    /* Read back the pixels of the box, in the same coordinates as scissor(),
+     * or of the whole framebuffer if the box is empty, without stalling the
+     * pipeline like glReadPixels() into client memory does. The callback is
+     * called on a later iteration of the event loop once the GPU is done,
+     * after the pixels have been converted to the format on a worker thread.
+     * See image_io::read_framebuffer_async(). */
+    void read_pixels_async(readback_callback_t callback,
+        readback_format_t format = READBACK_FORMAT_RGBA,
+        wlr_box box = {0, 0, 0, 0}) const;
+
     /* Will destroy the texture and framebuffer
      * Warning: will destroy tex/fb even if they have been allocated outside of
      * allocate() */
@@ -76,6 +151,12 @@ struct framebuffer_base_t : public noncopyable_t
     void reset();
 
     private:
+    /* Whether fb and tex belong to the render target pool */
+    bool pooled = false;
+    /* The format tex was last allocated with */
+    framebuffer_format_t allocated_format = FRAMEBUFFER_FORMAT_RGBA8;
+    /* Whether the mipmaps of tex match its contents */
+    mutable bool mipmaps_valid = false;
     void copy_state(framebuffer_base_t&& other);
 };
 
@@ -101,6 +182,9 @@ struct framebuffer_t : public framebuffer_base_t
      * bound OpenGL context */
     /* Get the box after applying the framebuffer scale */
     wlr_box damage_box_from_geometry_box(wlr_box box) const;
+    /* Same as above, for a whole region */
+    wf::region_t damage_region_from_geometry_region(
+        const wf::region_t& region) const;
 
     /* Get the projection of the given box onto the framebuffer.
      * The given box is in output-local coordinates, i.e the same coordinate
@@ -120,6 +204,37 @@ struct framebuffer_t : public framebuffer_base_t
      * coordinates to the framebuffer coordinates. */
     glm::mat4 get_orthographic_projection() const;
 };
+
+/** A position inside an OpenGL buffer object */
+struct buffer_range_t
+{
+    GLuint buffer = 0;
+    size_t offset = 0;
+};
+
+/* A buffer object in GPU memory, for vertex or index data which doesn't
+ * change every frame, for example static meshes.
+ *
+ * Like framebuffer_base_t, resources are not automatically destroyed, and the
+ * functions below assume they are called between OpenGL::render_begin() and
+ * OpenGL::render_end() */
+struct vertex_buffer_t : public noncopyable_t
+{
+    GLuint buffer = 0;
+    size_t size = 0;
+
+    /* Replace the contents of the buffer with the given data, creating the
+     * buffer if necessary. Target is GL_ARRAY_BUFFER for vertex data or
+     * GL_ELEMENT_ARRAY_BUFFER for indices. */
+    void upload(const void *data, size_t size, GLenum target = GL_ARRAY_BUFFER);
+
+    /* Get the range starting at the given offset, for
+     * program_t::attrib_buffer() */
+    buffer_range_t at(size_t offset = 0) const { return {buffer, offset}; }
+
+    /* Destroy the buffer object */
+    void release();
+};
 }
 
 namespace wf
@@ -146,6 +261,8 @@ struct texture_t
     GLenum target = GL_TEXTURE_2D;
     /* Invert Y? */
     bool invert_y = false;
+    /* Sample from the mipmaps when minified? They must have been generated. */
+    bool mipmapped = false;
 
     /* Actual texture ID */
     GLuint tex_id;
@@ -176,6 +293,166 @@ void render_begin(int32_t viewport_width, int32_t viewport_height, uint32_t fb =
  * render_end() must be called for each render_begin() */
 void render_end();
 
+/**
+ * Tracks a small part of the GL state, so that redundant state changes made
+ * by the core rendering functions can be skipped.
+ *
+ * The cache only knows about changes made through it, so plugins should use
+ * it instead of the corresponding raw GL calls. It is reset in render_begin(),
+ * render_end() and program_t::deactivate(). Code which calls into the wlroots
+ * renderer (wlr_render_*, wlr_renderer_scissor) between render_begin() and
+ * render_end() has to call invalidate() afterwards.
+ */
+class gl_state_cache_t
+{
+  public:
+    void use_program(GLuint program);
+    void set_blend(bool enabled);
+    void blend_func(GLenum sfactor, GLenum dfactor);
+    void set_scissor_test(bool enabled);
+    void scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    /** GL_FRAMEBUFFER binds both the draw and the read framebuffer */
+    void bind_framebuffer(GLenum target, GLuint fb);
+    void active_texture(GLenum unit);
+
+    /** Forget all tracked values */
+    void invalidate();
+
+    /** Number of state changes which were passed to GL */
+    uint64_t calls_issued = 0;
+    /** Number of state changes which were skipped because they were no-ops */
+    uint64_t calls_skipped = 0;
+
+  private:
+    /** @return true if the value changed and the GL call has to be made */
+    template<class T> bool update(std::optional<T>& cached, const T& value)
+    {
+        if (cached && *cached == value)
+        {
+            ++calls_skipped;
+            return false;
+        }
+
+        ++calls_issued;
+        cached = value;
+        return true;
+    }
+
+    std::optional<GLuint> program;
+    std::optional<bool> blend;
+    std::optional<std::array<GLenum, 2>> blend_factors;
+    std::optional<bool> scissor_test;
+    std::optional<std::array<GLint, 4>> scissor_box;
+    std::optional<std::array<GLint, 4>> viewport_box;
+    std::optional<GLuint> draw_fb, read_fb;
+    std::optional<GLenum> texture_unit;
+};
+
+/** @return The state cache of the (single) GL context */
+gl_state_cache_t& get_state_cache();
+
+/** Statistics of the pool of released framebuffers */
+struct render_target_pool_stats_t
+{
+    /* Number of framebuffer allocations which reused a pooled framebuffer,
+     * and which had to create a new one */
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    /* Number of pooled framebuffers destroyed to stay within
+     * core/render_target_pool_size */
+    uint64_t evictions = 0;
+    /* Memory used by the framebuffers currently in the pool, in bytes */
+    size_t cached_bytes = 0;
+};
+
+/** @return The statistics of the framebuffer pool since startup */
+render_target_pool_stats_t get_render_target_pool_stats();
+
+/**
+ * Report the GPU memory used by textures which a plugin keeps across frames,
+ * for ex. caches, so that it shows up in the memory statistics printed on
+ * SIGUSR1.
+ *
+ * @param owner The name under which the memory is reported.
+ * @param bytes The memory currently used by the owner, replacing the last
+ *   reported value. 0 removes the owner.
+ */
+void set_texture_memory_usage(const std::string& owner, size_t bytes);
+
+/** @return The memory reported with set_texture_memory_usage(), by owner */
+std::map<std::string, size_t> get_texture_memory_usage();
+
+/** The GPU time measured for one owner, see gpu_timer_scope_t */
+struct gpu_time_t
+{
+    uint64_t total_nsec = 0;
+    uint64_t max_nsec = 0;
+    /* Number of measured blocks */
+    uint64_t count = 0;
+};
+
+/**
+ * @return Whether GPU timing is enabled with core/gpu_timing, and isn't
+ *   known to be unsupported by the driver.
+ */
+bool gpu_timing_active();
+
+/**
+ * Measures the GPU time of the GL commands issued during the lifetime of the
+ * scope, with the timestamps of GL_EXT_disjoint_timer_query. The render
+ * manager measures its render pass, each effect hook, post hook and
+ * transformer this way, and attributes them to the plugins which added them.
+ *
+ * The results are read back some frames later, when the GPU has passed the
+ * timestamps, so measuring never waits for the GPU. Scopes can be nested.
+ */
+class gpu_timer_scope_t : public noncopyable_t
+{
+  public:
+    /** @param owner The name under which the time is reported. Nothing is
+     *   measured if it is empty. */
+    gpu_timer_scope_t(const std::string& owner);
+    ~gpu_timer_scope_t();
+
+  private:
+    int64_t id = -1;
+};
+
+/** @return The GPU time collected so far, by owner */
+std::map<std::string, gpu_time_t> get_gpu_times();
+
+/** Forget the GPU time collected so far */
+void reset_gpu_times();
+
+/**
+ * Render modifiers are simple color changes which the default shaders apply
+ * while drawing, so that effects like inverting the colors or making a view
+ * translucent need neither an extra pass over the output nor a snapshot of
+ * the view. Plugins which draw with their own shaders don't apply them.
+ */
+
+/**
+ * Multiply the color of everything drawn to the given framebuffer by the
+ * default shaders with a matrix, including clear(). Draws to any other
+ * framebuffer are left as they are, so snapshots and other offscreen buffers
+ * which are then drawn to the framebuffer are modified only once.
+ *
+ * @param target_fb The framebuffer whose contents are modified.
+ * @param matrix The matrix applied to premultiplied RGBA colors. The identity
+ *   disables the modifier.
+ */
+void set_color_matrix(GLuint target_fb, const glm::mat4& matrix);
+
+/**
+ * Multiply the opacity of everything drawn by the default shaders, except
+ * for clear().
+ */
+void set_alpha_modifier(float alpha);
+
+/** @return The value last set with set_alpha_modifier() */
+float get_alpha_modifier();
+
 /* Clear the currently bound framebuffer with the given color */
 void clear(wf::color_t color, uint32_t mask = GL_COLOR_BUFFER_BIT);
 
@@ -188,12 +465,28 @@ void render_transformed_texture(wf::texture_t texture,
     glm::vec4 color = glm::vec4(1.f),
     uint32_t bits = 0);
 
+/**
+ * Copy vertex data to the streaming vertex buffer, a set of buffer objects in
+ * GPU memory which is shared by all draws and reused in a round-robin way.
+ *
+ * The data stays valid at least until a few megabytes more have been
+ * streamed, which is plenty for the current frame, but not for longer.
+ *
+ * @return Where the data was placed, to be passed to
+ *   program_t::attrib_buffer().
+ */
+wf::buffer_range_t stream_vertex_data(const void *data, size_t size);
+
 /* Compiles the given shader source */
 GLuint compile_shader(std::string source, GLuint type);
 
 /**
  * Create an OpenGL program from the given shader sources.
  *
+ * If the driver supports KHR_parallel_shader_compile, the program may still
+ * be compiling when this returns. Errors are then logged when the program is
+ * first used through program_t, or in a later render_begin().
+ *
  * @param vertex_source The source code of the vertex shader.
  * @param frag_source The source code of the fragment shader.
  */
@@ -208,6 +501,25 @@ GLuint compile_program(std::string vertex_source, std::string frag_source);
  */
 void render_rectangle(wf::geometry_t box, wf::color_t color, glm::mat4 matrix);
 
+/**
+ * A uniform or an attribute of a program_t, resolved once with
+ * program_t::get_uniform() or program_t::get_attrib(). Setting values by
+ * handle doesn't need any string lookups. The programs for texture types
+ * which are compiled later resolve it when they are compiled.
+ *
+ * Handles stay valid until the program_t is compiled again or freed.
+ */
+struct program_location_t
+{
+    /* Index in the names resolved by the program_t */
+    int index = -1;
+};
+
+/** A uniform of a program_t, see program_location_t */
+struct uniform_handle_t : public program_location_t {};
+/** An attribute of a program_t, see program_location_t */
+struct attrib_handle_t : public program_location_t {};
+
 /**
  * An OpenGL program for rendering texture_t.
  * It contains multiple programs for the different texture types.
@@ -235,6 +547,9 @@ class program_t : public noncopyable_t
      *
      * The following identifiers should not be defined in the user source:
      *   _wayfire_texture, _wayfire_y_mult, _wayfire_y_base, get_pixel
+     *
+     * The program for each texture type is compiled on its first use(), so
+     * errors in the sources are reported only then.
      */
     void compile(const std::string& vertex_source,
         const std::string& fragment_source);
@@ -259,6 +574,18 @@ class program_t : public noncopyable_t
     /** @return The program ID for the given texture type, or 0 on failure */
     int get_program_id(wf::texture_type_t type);
 
+    /**
+     * Resolve the location of the given uniform in all programs.
+     * Has to be called after compile() or set_simple().
+     */
+    uniform_handle_t get_uniform(const std::string& name);
+
+    /**
+     * Resolve the location of the given attribute in all programs.
+     * Has to be called after compile() or set_simple().
+     */
+    attrib_handle_t get_attrib(const std::string& name);
+
     /** Set the given uniform for the currently used program. */
     void uniform1i(const std::string& name, int value);
     /** Set the given uniform for the currently used program. */
@@ -270,6 +597,16 @@ class program_t : public noncopyable_t
     /** Set the given uniform for the currently used program. */
     void uniformMatrix4f(const std::string& name, const glm::mat4& value);
 
+    /* The same as the functions above, but with a pre-resolved handle */
+    void uniform1i(const uniform_handle_t& uniform, int value);
+    void uniform1f(const uniform_handle_t& uniform, float value);
+    void uniform2f(const uniform_handle_t& uniform, float x, float y);
+    /** Set count vec2 elements of an array uniform, from 2 * count floats */
+    void uniform2fv(const uniform_handle_t& uniform, const float *values,
+        int count);
+    void uniform4f(const uniform_handle_t& uniform, const glm::vec4& value);
+    void uniformMatrix4f(const uniform_handle_t& uniform, const glm::mat4& value);
+
     /*
      * Set the attribute pointer and active the attribute.
      *
@@ -280,6 +617,24 @@ class program_t : public noncopyable_t
     void attrib_pointer(const std::string& attrib,
         int size, int stride, const void *ptr, GLenum type = GL_FLOAT);
 
+    /*
+     * Set the attribute to read from a buffer object, and activate it.
+     *
+     * @param attrib The name of the attrib array.
+     * @param range The buffer and offset to read from, for example the result
+     *   of OpenGL::stream_vertex_data() or vertex_buffer_t::at()
+     * @param size, stride, type The same as the corresponding arguments of
+     *   glVertexAttribPointer()
+     */
+    void attrib_buffer(const std::string& attrib, int size, int stride,
+        const wf::buffer_range_t& range, GLenum type = GL_FLOAT);
+
+    /* The same as the functions above, but with a pre-resolved handle */
+    void attrib_pointer(const attrib_handle_t& attrib,
+        int size, int stride, const void *ptr, GLenum type = GL_FLOAT);
+    void attrib_buffer(const attrib_handle_t& attrib, int size, int stride,
+        const wf::buffer_range_t& range, GLenum type = GL_FLOAT);
+
     /*
      * Set the attrib divisor. Analoguous to glVertexAttribDivisor().
      *
@@ -287,6 +642,8 @@ class program_t : public noncopyable_t
      * @param divisor The divisor value.
      */
     void attrib_divisor(const std::string& attrib, int divisor);
+    /* The same as the function above, but with a pre-resolved handle */
+    void attrib_divisor(const attrib_handle_t& attrib, int divisor);
 
     /**
      * Set the active texture, and modify the builtin Y-inversion uniforms.
@@ -297,12 +654,155 @@ class program_t : public noncopyable_t
     /**
      * Deactive the vertex attributes activated by attrib_pointer and
      * attrib_divisor, and reset the active OpenGL program.
+     *
+     * This also resets the state tracked by the GL state cache, so raw GL
+     * state changes between use() and deactivate() are safe.
      */
     void deactivate();
 
   private:
     class impl;
     std::unique_ptr<impl> priv;
+
+    /* Gives the core rendering functions access to priv */
+    friend class program_access_t;
+};
+}
+
+namespace OpenGL
+{
+/**
+ * A textured quad, with the same meaning of the fields as the arguments of
+ * render_transformed_texture().
+ */
+struct textured_quad_t
+{
+    wf::texture_t texture;
+    gl_geometry geometry;
+    /* Texture coordinates of the quad's corners, as with
+     * TEXTURE_USE_TEX_GEOMETRY. Unlike render_transformed_texture(), they are
+     * always used, and the default maps the whole texture the same way as
+     * render_transformed_texture() without that bit. */
+    gl_geometry tex_geometry = {0.0f, 1.0f, 1.0f, 0.0f};
+    glm::mat4 transform = glm::mat4(1.0);
+    glm::vec4 color = glm::vec4(1.f);
+    /* TEXTURE_TRANSFORM_INVERT_X and TEXTURE_TRANSFORM_INVERT_Y */
+    uint32_t bits = 0;
+};
+
+/**
+ * @return Whether the quad is drawn at less than half of the size of its
+ *   texture, so that sampling it without mipmaps aliases. The size on the
+ *   target is estimated from the area of the transformed quad, so that
+ *   rotated and perspective transforms are handled as well.
+ *
+ * @param target_size The viewport of the target framebuffer, in pixels.
+ * @param texture_size The size of the quad's texture, in pixels.
+ */
+bool is_minified(const textured_quad_t& quad, wf::dimensions_t target_size,
+    wf::dimensions_t texture_size);
+
+/**
+ * Collects textured quads and draws them with the default program, using as
+ * few state changes and draw calls as possible.
+ *
+ * Quads are drawn in the order they were added. Consecutive quads with the
+ * same texture, transform and color are merged into a single draw call, and
+ * GL state is only changed between draws when it actually differs.
+ */
+class render_batch_t : public noncopyable_t
+{
+  public:
+    render_batch_t();
+    ~render_batch_t();
+
+    /**
+     * Set the scissor boxes for the quads added after this call. Each quad
+     * is then drawn once for each box. The boxes are in framebuffer
+     * coordinates, as for framebuffer_base_t::scissor(), and must not overlap.
+     *
+     * An empty list (the default) means the quads are drawn with scissoring
+     * disabled.
+     */
+    void set_scissor(const wf::framebuffer_base_t& fb,
+        const std::vector<wlr_box>& boxes);
+
+    /** Add a quad to the batch. */
+    void add(const textured_quad_t& quad);
+
+    /**
+     * Add only the part of the quad inside @clip, which is in the same
+     * coordinate system as quad.geometry. Since the clipping is done on the
+     * CPU, the pieces of a quad clipped to different boxes can still be drawn
+     * with a single draw call, unlike scissor boxes.
+     */
+    void add_clipped(const textured_quad_t& quad, const gl_geometry& clip);
+
+    /**
+     * Draw all quads and clear the batch. Has to be called between
+     * render_begin() and render_end().
+     */
+    void flush();
+
+  private:
+    class impl;
+    std::unique_ptr<impl> priv;
+};
+
+/**
+ * Draw quads which may all have different textures, transforms and colors,
+ * with as few draw calls as possible. The corners are transformed on the CPU
+ * and the textures of consecutive quads are bound to separate texture units,
+ * so that up to 8 quads share a single draw call, without state changes
+ * between them.
+ *
+ * The textures have to be GL_TEXTURE_2D textures of TEXTURE_TYPE_RGBA, like
+ * the ones of framebuffers. Has to be called between render_begin() and
+ * render_end(), the scissor box is left as it is.
+ */
+void render_textured_quads(const std::vector<textured_quad_t>& quads);
+
+/**
+ * A shared texture with copies of small textures, so that many small surfaces
+ * like tooltips, menus and decoration buttons are drawn from one texture, and
+ * consecutive ones with a single draw call of a render_batch_t.
+ *
+ * Textures up to core/texture_atlas_max_size pixels wide and high are copied
+ * into the atlas on the GPU. Textures which are larger, or which don't fit
+ * because the atlas is full, are drawn from their own texture as usual.
+ */
+class texture_atlas_t : public noncopyable_t
+{
+  public:
+    static texture_atlas_t& get();
+    ~texture_atlas_t();
+
+    /**
+     * Copy the texture into the atlas, replacing the last copy for the key.
+     * Has to be called outside of render_begin() and render_end().
+     *
+     * @return Whether the texture is in the atlas.
+     */
+    bool update(const void *key, wf::texture_t texture, wf::dimensions_t size);
+
+    /** Remove the copy for the key, no-op if there is none */
+    void remove(const void *key);
+
+    /** @return Whether the key has a copy in the atlas */
+    bool contains(const void *key) const;
+
+    /**
+     * Make the quad draw the copy for the key, by setting its texture and
+     * texture coordinates.
+     *
+     * @return false if there is no copy for the key, the quad is unchanged.
+     */
+    bool apply(const void *key, textured_quad_t& quad) const;
+
+  private:
+    texture_atlas_t();
+    class impl;
+    std::unique_ptr<impl> priv;
 };
 }
 
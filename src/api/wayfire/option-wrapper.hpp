@@ -5,10 +5,16 @@
 #include <wayfire/config/option-wrapper.hpp>
 #include <wayfire/core.hpp>
 
+#include <functional>
+
 namespace wf
 {
 /**
  * A simple wrapper around a config option.
+ *
+ * The value of the option is cached, so that reading it in hot paths (for
+ * ex. every frame) is only a copy of the value. The cache is updated when the
+ * option changes, before the callback set with set_callback() is called.
  */
 template<class Type>
 class option_wrapper_t : public base_option_wrapper_t<Type>
@@ -25,11 +31,64 @@ class option_wrapper_t : public base_option_wrapper_t<Type>
 
     option_wrapper_t() : wf::base_option_wrapper_t<Type> () {}
 
+    ~option_wrapper_t()
+    {
+        if (typed_option)
+            typed_option->rem_updated_handler(&cache_updater);
+    }
+
+    /**
+     * Load the given option and start caching its value.
+     * Throws the same errors as base_option_wrapper_t::load_option().
+     */
+    void load_option(const std::string& name)
+    {
+        base_option_wrapper_t<Type>::load_option(name);
+
+        typed_option = std::dynamic_pointer_cast<config::option_t<Type>>(
+            load_raw_option(name));
+        cached_value = typed_option->get_value();
+        typed_option->add_updated_handler(&cache_updater);
+    }
+
+    /**
+     * Set the callback called when the option changes. The option wrapper
+     * already has the new value when it is called.
+     */
+    void set_callback(std::function<void()> callback)
+    {
+        this->on_updated = callback;
+    }
+
+    /** @return The cached value of the option */
+    operator Type() const
+    {
+        return cached_value;
+    }
+
   protected:
     std::shared_ptr<config::option_base_t>
         load_raw_option(const std::string& name)
     {
         return wf::get_core().config.get_option(name);
     }
+
+  private:
+    std::shared_ptr<config::option_t<Type>> typed_option;
+    Type cached_value{};
+    std::function<void()> on_updated;
+
+    config::option_base_t::updated_callback_t cache_updater = [=] ()
+    {
+        Type value = typed_option->get_value();
+        /* Options are notified on reload even if only their string changed,
+         * for ex. whitespace, so don't wake the plugin up for nothing */
+        if (value == cached_value)
+            return;
+
+        cached_value = std::move(value);
+        if (on_updated)
+            on_updated();
+    };
 };
 }
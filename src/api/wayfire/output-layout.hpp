@@ -106,6 +106,14 @@ namespace wf
          */
         std::vector<wf::output_t*> get_outputs();
 
+        /**
+         * Call the callback for each active output, in the same order as
+         * get_outputs(), without copying the outputs to a list.
+         *
+         * The callback must not change the output configuration.
+         */
+        void for_each_output(const std::function<void(wf::output_t*)>& callback);
+
         /**
          * @return the "next" output in the layout. It is guaranteed that starting
          * with any output in the layout, and successively calling this function
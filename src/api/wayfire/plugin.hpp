@@ -150,10 +150,29 @@ class plugin_interface_t
      */
     virtual bool is_unloadable() { return true; }
 
+    /**
+     * Plugins which need expensive resources only while they are active, for
+     * ex. shaders or textures, can create them here instead of in init().
+     *
+     * By default, the plugin loader calls it right after init(). With the
+     * core/lazy_plugin_init option, it is instead called when the event loop
+     * goes idle after startup, or earlier if the plugin calls
+     * ensure_resources() when it is activated.
+     */
+    virtual void init_resources() {}
+
+    /** Call init_resources(), unless it has already been called */
+    void ensure_resources();
+    /** @return Whether init_resources() has been called */
+    bool has_resources() const { return resources_initialized; }
+
     virtual ~plugin_interface_t();
 
     /** Handle to the plugin's .so file, used by the plugin loader */
     void *handle = NULL;
+
+  private:
+    bool resources_initialized = false;
 };
 }
 
@@ -167,7 +186,7 @@ class plugin_interface_t
 using wayfire_plugin_load_func = wf::plugin_interface_t* (*)();
 
 /** The version of Wayfire's API/ABI */
-constexpr uint32_t WAYFIRE_API_ABI_VERSION = 2020'03'21;
+constexpr uint32_t WAYFIRE_API_ABI_VERSION = 2020'04'10;
 
 /**
  * Each plugin must also provide a function which returns the Wayfire API/ABI
@@ -178,13 +197,33 @@ constexpr uint32_t WAYFIRE_API_ABI_VERSION = 2020'03'21;
  */
 using wayfire_plugin_version_func = uint32_t (*)();
 
+namespace wf
+{
+/**
+ * Register a plugin which is compiled into the wayfire binary, so that it is
+ * loaded from the binary instead of from its .so file when it is listed by
+ * name in core/plugins.
+ *
+ * Built-in plugins are selected with the builtin_plugins meson option, they
+ * are registered by DECLARE_WAYFIRE_PLUGIN before main() runs.
+ */
+void register_builtin_plugin(const char *name, wayfire_plugin_load_func load);
+}
+
 /** A macro to declare the necessary functions, given the plugin class name */
 
+#ifdef WAYFIRE_BUILTIN_PLUGIN
+#define DECLARE_WAYFIRE_PLUGIN(PluginClass) \
+[[maybe_unused]] static const bool wayfire_builtin_plugin_registered = \
+    (wf::register_builtin_plugin(WAYFIRE_BUILTIN_PLUGIN, \
+        [] () -> wf::plugin_interface_t* { return new PluginClass; }), true);
+#else
 #define DECLARE_WAYFIRE_PLUGIN(PluginClass) \
 extern "C" \
 {\
     wf::plugin_interface_t* newInstance() { return new PluginClass; } \
     uint32_t getWayfireVersion() { return WAYFIRE_API_ABI_VERSION; } \
 }
+#endif
 
 #endif
@@ -3,6 +3,9 @@
 
 #include "wayfire/output.hpp"
 #include "wayfire/object.hpp"
+#include <memory>
+#include <vector>
+#include <glm/mat4x4.hpp>
 
 namespace wf
 {
@@ -10,6 +13,8 @@ struct framebuffer_base_t;
 struct framebuffer_t;
 struct region_t;
 struct workspace_stream_t;
+struct workspace_stream_instance_t;
+class frame_stats_t;
 /** Render hooks can be used to override Wayfire's built-in rendering. The
  * plugin which sets the hook gains full control over what and how is drawn
  * to the screen. Workspace streams however are not affected.
@@ -17,6 +22,18 @@ struct workspace_stream_t;
  * @param fb Indicates the framebuffer that the custom renderer should draw to */
 using render_hook_t = std::function<void(const wf::framebuffer_t& fb)>;
 
+/** A render hook which repaints only what changed. The output then commits
+ * only the returned region instead of the whole output.
+ *
+ * @param fb Indicates the framebuffer that the custom renderer should draw to
+ * @param damage The damage scheduled for the frame, see get_scheduled_damage()
+ *
+ * @return The region of the output, in damage coordinates, whose contents
+ *   differ from the previous frame. The rest of the framebuffer still has to
+ *   be drawn, or the frame is dropped if the region is empty. */
+using damage_render_hook_t = std::function<wf::region_t(
+    const wf::framebuffer_t& fb, const wf::region_t& damage)>;
+
 /* Effect hooks provide the plugins with a way to execute custom code
  * at certain parts of the repaint cycle */
 using effect_hook_t = std::function<void()>;
@@ -35,6 +52,24 @@ enum output_effect_type_t
     OUTPUT_EFFECT_TOTAL = 3,
 };
 
+/**
+ * Animation hooks are called once per frame, before the pre hooks, while they
+ * are active. The output keeps repainting while any animation hook is active,
+ * so animations don't need set_redraw_always().
+ *
+ * @param frame_time The time of the frame from wf::get_current_time(),
+ *   sampled once per frame, so that all animations on the output advance by
+ *   the same time.
+ * @param damage The region which the animation needs repainted, in
+ *   output-local coordinates. The damage of all animations is added to the
+ *   output at once, after all of them have run.
+ *
+ * @return Whether the animation continues. The hook is removed once it
+ *   returns false.
+ */
+using animation_hook_t = std::function<bool(uint32_t frame_time,
+    wf::region_t& damage)>;
+
 /** Post hooks are called just before swapping buffers. In contrast to
  * render hooks, post hooks operate on the whole output image, i.e they
  * are suitable for different postprocessing effects.
@@ -51,6 +86,34 @@ enum output_effect_type_t
 using post_hook_t = std::function<void(const wf::framebuffer_base_t& source,
     const wf::framebuffer_base_t& destination)>;
 
+/**
+ * Views with this data enable adaptive sync on their output while they are
+ * focused, if the vrr option of the output is "auto", the same as fullscreen
+ * views do. Emit view-adaptive-sync on the output of the view after storing
+ * or erasing it.
+ */
+struct adaptive_sync_hint_t : public wf::custom_data_t {};
+
+/**
+ * Views with this data present their frames as soon as they are committed,
+ * without waiting for the repaint delay of max_render_time, while they are
+ * scanned out directly and the allow_tearing option of their output is
+ * enabled. It is checked on each frame.
+ */
+struct tearing_hint_t : public wf::custom_data_t {};
+
+/**
+ * A workspace which a custom renderer slides over the output, for ex. during
+ * a workspace switch, see render_manager::get_sliding_damage().
+ */
+struct sliding_workspace_t
+{
+    wf::point_t ws;
+    /* Where the top left corner of the workspace is drawn, in damage
+     * coordinates relative to the output */
+    wf::pointf_t position;
+};
+
 /** Render manager
  *
  * Each output has a render manager, which is responsible for all rendering
@@ -65,11 +128,32 @@ class render_manager : public wf::signal_provider_t
     ~render_manager();
 
     /**
-     * Set the render hook to be used for rendering.
+     * Set the render hook to be used for rendering. While a render hook is
+     * set, the output is repainted when any workspace is damaged, not only
+     * the current one.
+     *
      * @param rh The render hook to use, or nullptr for default renderer
      */
     void set_renderer(render_hook_t rh = nullptr);
 
+    /**
+     * Set a damage-aware render hook, see damage_render_hook_t. It replaces
+     * the render hook set with set_renderer(), and is removed with
+     * set_renderer(nullptr) as well.
+     */
+    void set_damage_renderer(damage_render_hook_t rh);
+
+    /**
+     * Set a matrix which is applied to the premultiplied RGBA color of
+     * everything drawn to the output, from the default shaders while they
+     * draw, so that color filters like inverting the colors need no extra
+     * pass over the output. Post hooks, overlay hooks, software cursors and
+     * plugins which draw with their own shaders are not affected.
+     *
+     * @param matrix The color matrix, or the identity to disable it.
+     */
+    void set_color_matrix(const glm::mat4& matrix);
+
     /**
      * Rendering an output is done on demand, that is, when the output is
      * damaged. Some plugins however need to redraw the output as often as
@@ -83,12 +167,31 @@ class render_manager : public wf::signal_provider_t
      */
     void set_redraw_always(bool always = true);
 
+    /**
+     * Emit frame-dmabuf after each repaint with damage, with the committed
+     * buffer of the output exported as a dmabuf, see
+     * wayfire/dmabuf-export.hpp. Consumers should call it only while they
+     * need frames, because the export has a cost on every frame.
+     *
+     * @param enable Call set_export_frames(false) once for each
+     *  set_export_frames(true).
+     */
+    void set_export_frames(bool enable = true);
+
     /**
      * Schedule a frame for the output. Note that if there is no damage for
      * the next frame, nothing will be redrawn
      */
     void schedule_redraw();
 
+    /**
+     * Make sure the surfaces on the output get a frame event soon, without
+     * repainting the output. Used for commits which didn't damage anything,
+     * whose clients still wait for a frame event. The events are sent with
+     * the next repaint, or after about a refresh period if there is none.
+     */
+    void schedule_frame_done();
+
     /**
      * Inhibit rendering to the output. An inhibited output will show a
      * fully black image. Used mainly for compositor fade in/out on startup.
@@ -107,12 +210,34 @@ class render_manager : public wf::signal_provider_t
      */
     void rem_effect(effect_hook_t* hook);
 
+    /**
+     * Start calling the given animation hook on each frame, starting with
+     * the next one.
+     */
+    void add_animation(animation_hook_t *hook);
+    /**
+     * Stop calling an animation hook. No-op if the hook isn't active.
+     */
+    void rem_animation(animation_hook_t *hook);
+    /**
+     * @return The frame time passed to the animation hooks in the current
+     *   or the last frame.
+     */
+    uint32_t get_frame_time() const;
+
     /**
      * Add a new post hook.
      *
      * @param hook The hook callack
+     * @param local Whether each pixel of the hook's output depends only on
+     *        the same pixel of its input, like color filters. Local hooks are
+     *        run only on the damaged parts of the output, once for each
+     *        damaged box with the scissor box already set, so they must not
+     *        change the scissor state. Non-local hooks always redraw the
+     *        whole output, which means the whole output is repainted on each
+     *        frame while they are active.
      */
-    void add_post(post_hook_t* hook);
+    void add_post(post_hook_t* hook, bool local = false);
 
     /**
      * Remove a post hook. No-op if hook isn't active.
@@ -176,6 +301,23 @@ class render_manager : public wf::signal_provider_t
      */
     wlr_box get_ws_box(wf::point_t ws) const;
 
+    /**
+     * Find what a damage-aware custom renderer which slides workspaces over
+     * the output repainted, see damage_render_hook_t.
+     *
+     * @param damage The damage passed to the render hook.
+     * @param shown The workspaces shown in this frame.
+     * @param last_shown The workspaces shown in the previous frame, updated
+     *   to shown.
+     *
+     * @return The whole output if any workspace moved, or the damage of each
+     *   workspace moved to where it is shown. While a transition is paused,
+     *   only what changed on the workspaces is committed, or nothing.
+     */
+    wf::region_t get_sliding_damage(const wf::region_t& damage,
+        const std::vector<sliding_workspace_t>& shown,
+        std::vector<sliding_workspace_t>& last_shown) const;
+
     /**
      * @return The framebuffer on which all rendering operations except post
      * effects happen.
@@ -196,11 +338,40 @@ class render_manager : public wf::signal_provider_t
      * render or an overlay hook.
      *
      * @param stream The workspace stream to update
-     * @param scale_x Unused for now
-     * @param scale_y Unused for now
+     * @param scale_x The horizontal size of the stream buffer relative to the
+     *   output, in (0, 1].
+     * @param scale_y The vertical size of the stream buffer relative to the
+     *   output, in (0, 1].
+     *
+     * Buffers have a single scale, so the larger of scale_x and scale_y is
+     * used for both directions. Changing the scale redraws the whole
+     * workspace, so it should not be changed every frame. The damage and
+     * framebuffer in the workspace-stream-pre/post signals are relative to
+     * the scaled buffer. The default streams are never scaled.
      */
     void workspace_stream_update(workspace_stream_t& stream,
         float scale_x = 1, float scale_y = 1);
+
+    /**
+     * Update only a part of the workspace in the stream buffer, for ex. to
+     * magnify it.
+     *
+     * @param stream The workspace stream to update. It must not be a shared
+     *   or a default stream.
+     * @param crop The part of the workspace to render, in output-local
+     *   coordinates. The stream buffer contains only this part.
+     * @param scale The size of the buffer relative to the crop at the output
+     *   resolution. Unlike with the whole workspace, it may be larger than 1.
+     *
+     * Views outside of the crop are not rendered at all. Changing the crop
+     * or the scale redraws the whole buffer, otherwise only the damage inside
+     * the crop is repainted. The framebuffer in the workspace-stream-pre/post
+     * signals has the geometry of the crop, and the damage is relative to it.
+     * Updating the stream with the other overload renders the whole
+     * workspace again.
+     */
+    void workspace_stream_update(workspace_stream_t& stream,
+        wf::geometry_t crop, float scale);
     /**
      * Stop the workspace stream. You can change the stream's workspace
      * after this call (but before the next stream start).
@@ -208,6 +379,51 @@ class render_manager : public wf::signal_provider_t
      * @param stream The stream to be stopped
      */
     void workspace_stream_stop(workspace_stream_t& stream);
+
+    /**
+     * Get a workspace stream which is shared with all other plugins that
+     * request the same workspace and scale, so that the workspace is rendered
+     * only once per frame even if several plugins show it.
+     *
+     * The stream is used with workspace_stream_update() like other streams,
+     * and is started on its first update. Updates after the first one in the
+     * same frame do nothing, and the scale given when updating is ignored.
+     * workspace_stream_stop() has no effect on shared streams, instead they
+     * are stopped and their buffer is freed when the last handle is dropped.
+     * Plugins must not change the stream's workspace, scale or background.
+     *
+     * @param ws The workspace to stream.
+     * @param scale_x The horizontal scale of the stream buffer.
+     * @param scale_y The vertical scale of the stream buffer.
+     */
+    std::shared_ptr<workspace_stream_t> get_shared_workspace_stream(
+        wf::point_t ws, float scale_x = 1, float scale_y = 1);
+
+    /**
+     * Draw the buffers of several workspace streams, each on its own quad and
+     * with its own transform, with blending.
+     *
+     * The streams are drawn with OpenGL::render_textured_quads(), so that
+     * several of them (usually all) share a single draw call. Has to be
+     * called between OpenGL::render_begin() and render_end(), the scissor
+     * box is left as it is. Streams drawn at less than half of their size are
+     * sampled from mipmaps, see framebuffer_base_t::get_minified_texture().
+     */
+    void render_workspace_streams(
+        const std::vector<workspace_stream_instance_t>& instances);
+
+    /**
+     * @return The accumulated repaint statistics of the output: per-phase
+     * timing histograms and frame counts, and presentation latency and
+     * pacing. Each repaint which is not skipped additionally emits the
+     * frame-timings signal on the render manager, and each presented frame
+     * emits frame-presented.
+     */
+    const wf::frame_stats_t& get_frame_stats() const;
+
+    /** Drop the accumulated repaint statistics of the output. */
+    void reset_frame_stats();
+
   private:
     class impl;
     std::unique_ptr<impl> pimpl;
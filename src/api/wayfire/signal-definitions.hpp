@@ -4,6 +4,8 @@
 #include "wayfire/view.hpp"
 #include "wayfire/output.hpp"
 
+#include <set>
+
 /* signal definitions */
 /* convenience functions are provided to get some basic info from the signal */
 struct _view_signal : public wf::signal_data_t
@@ -33,6 +35,8 @@ using detach_view_signal    = _view_signal;
 using unmap_view_signal      = _view_signal;
 using pre_unmap_view_signal  = _view_signal;
 
+/* Emitted as map-view on the output, as map on the view, and as view-mapped
+ * on the core */
 struct map_view_signal : public _view_signal
 {
     /* Indicates whether the position already has its initial posittion */
@@ -43,6 +47,13 @@ struct map_view_signal : public _view_signal
  * or unmapped */
 using view_disappeared_signal = _view_signal;
 
+/**
+ * view-restacked is a signal emitted by an output. It is emitted whenever a
+ * view changes its position in the stacking order of its layer, or its
+ * position among the children of its parent.
+ */
+using view_restacked_signal = _view_signal;
+
 using focus_view_signal      = _view_signal;
 using view_set_parent_signal = _view_signal;
 using move_request_signal    = _view_signal;
@@ -54,6 +65,36 @@ struct resize_request_signal : public _view_signal
     uint32_t edges;
 };
 
+/**
+ * view-damaged is a signal emitted by an output. It is emitted whenever a part
+ * of a view on the output is damaged.
+ */
+struct view_damaged_signal : public _view_signal
+{
+    /* The bounding box of the damage, in the damage coordinates of the
+     * output's target framebuffer */
+    wlr_box box;
+    /* The damaged region, in the same coordinates. Valid only during the
+     * signal */
+    const wf::region_t *region = nullptr;
+};
+
+/**
+ * configure-committed is emitted on an xdg-shell view when it commits the
+ * first surface state after acking a configure event. Several state changes
+ * in one event loop iteration (for ex. tiling and resizing) are sent in a
+ * single configure, so plugins can wait for latest to know that the client
+ * has applied all of them.
+ */
+struct view_configure_committed_signal : public _view_signal
+{
+    /* The serial of the acked configure */
+    uint32_t serial;
+    /* Whether it is the last configure sent to the view, with no newer
+     * changes waiting to be sent */
+    bool latest;
+};
+
 /* sent when the view geometry changes */
 struct view_geometry_changed_signal : public _view_signal
 {
@@ -180,6 +221,32 @@ namespace wf
      * decoration-state-updated-view is emitted on the output of the view.
      */
     using decoration_state_updated_signal = _view_signal;
+
+    /**
+     * reload-config is emitted on core after the config file was reloaded, if
+     * any option changed. The callbacks of the changed option wrappers have
+     * already been called, this signal is for state which depends on whole
+     * sections, like the bindings of the command plugin.
+     */
+    struct reload_config_signal : public wf::signal_data_t
+    {
+        /* The full names of the changed options, like "core/plugins" */
+        std::set<std::string> changed_options;
+        /* The sections which contain changed options */
+        std::set<std::string> changed_sections;
+
+        void add_changed(const std::string& name)
+        {
+            changed_options.insert(name);
+            changed_sections.insert(name.substr(0, name.find('/')));
+        }
+
+        /** @return Whether an option of the given section changed */
+        bool section_changed(const std::string& section) const
+        {
+            return changed_sections.count(section);
+        }
+    };
 }
 
 #endif
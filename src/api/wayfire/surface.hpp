@@ -2,6 +2,7 @@
 #define WF_SURFACE_HPP
 
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
@@ -18,6 +19,45 @@ class surface_interface_t;
 struct framebuffer_t;
 struct region_t;
 
+/**
+ * Statistics of the commits of a surface and of the frame events it was sent,
+ * so that clients which commit too often or too rarely can be found. Only
+ * surfaces backed by a wlr_surface collect them.
+ */
+struct surface_commit_stats_t
+{
+    /** The number of commits */
+    uint64_t commits = 0;
+    /**
+     * Commits which didn't follow a frame event the surface was waiting for,
+     * i.e. which weren't paced by the compositor.
+     */
+    uint64_t unthrottled_commits = 0;
+    /**
+     * Commits which followed a frame event after more than 100ms, i.e. the
+     * client was idle rather than late. They don't count as missed frames
+     * and aren't part of frame_to_commit_usec.
+     */
+    uint64_t idle_commits = 0;
+    /** The damaged area of all commits, in surface-local pixels */
+    uint64_t damage_area = 0;
+    /** Frame events sent while the surface was waiting for one */
+    uint64_t frame_events = 0;
+    /**
+     * The refresh cycles of the output which passed between a frame event and
+     * the next commit, not counting the first one, for the paced commits.
+     */
+    uint64_t missed_frames = 0;
+    /**
+     * The sum of the times from a frame event until the next commit, in
+     * microseconds, for the (commits - unthrottled_commits - idle_commits)
+     * paced commits.
+     */
+    int64_t frame_to_commit_usec = 0;
+    /** Commits per second, over about the last second */
+    double commit_rate = 0;
+};
+
 /**
  * A surface and its position on the screen.
  */
@@ -85,6 +125,23 @@ class surface_interface_t
     virtual std::vector<surface_iterator_t> enumerate_surfaces(
         wf::point_t surface_origin = {0, 0});
 
+    /**
+     * Call the callback for each mapped surface in the surface tree, in the
+     * same order as the default enumerate_surfaces(), without building a list.
+     *
+     * @param callback Called with each surface and its position relative to
+     *   the topmost surface in the tree, which is at surface_origin.
+     */
+    void for_each_surface(
+        const std::function<void(surface_interface_t*, wf::point_t)>& callback,
+        wf::point_t surface_origin = {0, 0});
+
+    /**
+     * @return true if the surface is mapped and none of its children are, i.e
+     *   if enumerate_surfaces() would return only the surface itself.
+     */
+    bool has_single_surface() const;
+
     /**
      * @return The output the surface is currently attached to. Note this
      * doesn't necessarily mean that it is visible.
@@ -124,6 +181,9 @@ class surface_interface_t
      */
     virtual void send_frame_done(const timespec& frame_end);
 
+    /** @return The commit statistics of the surface, see surface_commit_stats_t */
+    surface_commit_stats_t get_commit_stats();
+
     /**
      * Subtract the opaque region of the surface from region.
      *
@@ -188,7 +248,11 @@ class surface_interface_t
 
     /** Damage the given box, in surface-local coordinates */
     virtual void damage_surface_box(const wlr_box& box);
-    /** Damage the given region, in surface-local coordinates */
+    /**
+     * Damage the given region, in surface-local coordinates. The region is
+     * passed to the parent surface as a whole, so that fragmented damage is
+     * translated once per level of the surface tree and not once per box.
+     */
     virtual void damage_surface_region(const wf::region_t& region);
 
     /**
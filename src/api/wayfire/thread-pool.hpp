@@ -0,0 +1,49 @@
+#ifndef WF_THREAD_POOL_HPP
+#define WF_THREAD_POOL_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace wf
+{
+/**
+ * A pool of worker threads shared by the core and all plugins, for splitting
+ * CPU-heavy work done in a frame, like updating particles or meshes.
+ *
+ * The threads are started on the first use and stay alive until the
+ * compositor exits, so that work isn't delayed by creating threads.
+ */
+class thread_pool_t
+{
+  public:
+    static thread_pool_t& get();
+
+    /** @return The number of threads which run work, including the caller */
+    int get_concurrency();
+
+    /**
+     * Call func(start, end) for consecutive ranges which cover [0, size),
+     * each of them at most grain long, and wait until all calls are done.
+     *
+     * The ranges are taken one by one by the worker threads and the calling
+     * thread, so uneven work is balanced between the threads. If size is at
+     * most grain, func is called directly on the calling thread.
+     *
+     * func must be safe to call from several threads at once, and it must
+     * not call parallel_for() itself.
+     */
+    void parallel_for(size_t size, size_t grain,
+        const std::function<void(size_t, size_t)>& func);
+
+    ~thread_pool_t();
+
+  private:
+    thread_pool_t();
+
+    class impl;
+    std::unique_ptr<impl> priv;
+};
+}
+
+#endif /* end of include guard: WF_THREAD_POOL_HPP */
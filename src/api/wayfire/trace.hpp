@@ -0,0 +1,86 @@
+#ifndef WF_TRACE_HPP
+#define WF_TRACE_HPP
+
+#include <string>
+
+namespace wf
+{
+/**
+ * Timeline tracing of compositor events.
+ *
+ * When started with wayfire --trace <file>, events are written in the Chrome
+ * trace event format, which can be opened in chrome://tracing or in the
+ * Perfetto UI. When tracing isn't enabled, trace points only check a global
+ * flag.
+ */
+namespace trace
+{
+/** Whether tracing has been started. Checked by the trace macros. */
+extern bool enabled;
+
+/**
+ * Start writing trace events to the given file.
+ * @return true on success, false if the file can't be opened.
+ */
+bool start(const std::string& filename);
+
+/** Finish the trace file and stop tracing */
+void stop();
+
+/** Begin a duration event. Must be paired with end() on the same name. */
+void begin(const char *category, const std::string& name);
+/** End a duration event */
+void end(const char *category, const std::string& name);
+/** Add an event which has no duration */
+void instant(const char *category, const std::string& name);
+
+/**
+ * A duration event which lasts from the construction until the destruction
+ * of the scope object.
+ */
+class scope_t
+{
+  public:
+    scope_t(const char *category, std::string name)
+        : category(category), name(std::move(name)), active(enabled)
+    {
+        if (active)
+            begin(this->category, this->name);
+    }
+
+    ~scope_t()
+    {
+        if (active)
+            end(category, name);
+    }
+
+    scope_t(const scope_t&) = delete;
+    scope_t& operator =(const scope_t&) = delete;
+
+  private:
+    const char *category;
+    std::string name;
+    bool active;
+};
+}
+}
+
+#define WF_TRACE_CONCAT_(a, b) a ## b
+#define WF_TRACE_CONCAT(a, b) WF_TRACE_CONCAT_(a, b)
+
+/**
+ * Trace the rest of the current scope. The name expression is evaluated only
+ * when tracing is enabled.
+ */
+#define WF_TRACE_SCOPE(category, name) \
+    wf::trace::scope_t WF_TRACE_CONCAT(wf_trace_scope_, __LINE__)((category), \
+        wf::trace::enabled ? std::string(name) : std::string())
+
+/** Add an instant event. The name is evaluated only when tracing is enabled. */
+#define WF_TRACE_INSTANT(category, name) \
+    do { \
+        if (wf::trace::enabled) \
+            wf::trace::instant((category), (name)); \
+    } while (0)
+
+#endif /* end of include guard: WF_TRACE_HPP */
@@ -33,28 +33,42 @@ struct region_t
     bool contains_point(const point_t& point) const;
     bool contains_pointf(const pointf_t& point) const;
 
+    /*
+     * The binary operators have overloads for temporaries, which reuse the
+     * temporary for the result instead of copying it, so that chains like
+     * (a & b) + offset don't allocate for each step.
+     */
+
     /* Translate the region */
-    region_t operator + (const point_t& vector) const;
+    region_t operator + (const point_t& vector) const &;
+    region_t operator + (const point_t& vector) &&;
     region_t& operator += (const point_t& vector);
 
-    region_t operator * (float scale) const;
+    region_t operator * (float scale) const &;
+    region_t operator * (float scale) &&;
     region_t& operator *= (float scale);
 
     /* Region intersection */
-    region_t operator & (const wlr_box& box) const;
-    region_t operator & (const region_t& other) const;
+    region_t operator & (const wlr_box& box) const &;
+    region_t operator & (const wlr_box& box) &&;
+    region_t operator & (const region_t& other) const &;
+    region_t operator & (const region_t& other) &&;
     region_t& operator &= (const wlr_box& box);
     region_t& operator &= (const region_t& other);
 
     /* Region union */
-    region_t operator | (const wlr_box& other) const;
-    region_t operator | (const region_t& other) const;
+    region_t operator | (const wlr_box& other) const &;
+    region_t operator | (const wlr_box& other) &&;
+    region_t operator | (const region_t& other) const &;
+    region_t operator | (const region_t& other) &&;
     region_t& operator |= (const wlr_box& other);
     region_t& operator |= (const region_t& other);
 
     /* Subtract the box/region from the current region */
-    region_t operator ^ (const wlr_box& box) const;
-    region_t operator ^ (const region_t& other) const;
+    region_t operator ^ (const wlr_box& box) const &;
+    region_t operator ^ (const wlr_box& box) &&;
+    region_t operator ^ (const region_t& other) const &;
+    region_t operator ^ (const region_t& other) &&;
     region_t& operator ^= (const wlr_box& box);
     region_t& operator ^= (const region_t& other);
 
@@ -64,7 +78,13 @@ struct region_t
     const pixman_box32_t* end() const;
 
   private:
+    /* pixman stores empty and single-box regions without allocating, a
+     * single box is kept in the extents only. The operators handle those
+     * cases inline and call pixman only for regions with several boxes. */
     pixman_region32_t _region;
+
+    /** @return Whether the region is exactly one box, its extents */
+    bool is_single_box() const;
     /* Returns a const-casted pixman_region32_t*, useful in const operators
      * where we use this->_region as only source for calculations, but pixman
      * won't let us pass a const pixman_region32_t* */
@@ -133,8 +153,92 @@ namespace wf
         wrapper _wrap;
     };
 
+    namespace detail
+    {
+        template<class Method>
+        struct listener_method_traits;
+
+        template<class Owner, class Event>
+        struct listener_method_traits<void (Owner::*)(Event*)>
+        {
+            using owner_t = Owner;
+            using event_t = Event;
+        };
+
+        /** The wl_listener and the object it calls, the listener comes first */
+        struct owned_listener_t
+        {
+            wl_listener listener;
+            void *owner;
+        };
+
+        /** The part of wl_listener_member which doesn't depend on the method */
+        class wl_listener_member_base : public noncopyable_t
+        {
+            public:
+            /** Disconnect from the wl_signal. No-op if not connected */
+            void disconnect();
+            /** @return true if connected to a wl_signal */
+            bool is_connected() const;
+
+            protected:
+            wl_listener_member_base(wl_notify_func_t notify);
+            ~wl_listener_member_base();
+            bool connect(void *owner, wl_signal *signal);
+
+            owned_listener_t _link;
+        };
+    }
+
+    /**
+     * A wl_listener which calls a member function of its owner with the
+     * event data cast to the type of the function's argument. Unlike
+     * wl_listener_wrapper, the call isn't type-erased and nothing is
+     * allocated, so it is meant for events which are emitted very often:
+     *
+     * struct foo_t
+     * {
+     *     void handle_commit(wlr_surface *surface);
+     *     wf::wl_listener_member<&foo_t::handle_commit> on_commit;
+     * };
+     *
+     * on_commit.connect(this, &surface->events.commit);
+     */
+    template<auto Method>
+    class wl_listener_member : public detail::wl_listener_member_base
+    {
+        using traits = detail::listener_method_traits<decltype(Method)>;
+
+        public:
+        using owner_t = typename traits::owner_t;
+        using event_t = typename traits::event_t;
+
+        wl_listener_member() : wl_listener_member_base(&notify) {}
+
+        /** Connect to the signal, calling Method on owner when it is emitted.
+         * Calling this on an already connected listener has no effect.
+         * @return true if connection was successful */
+        bool connect(owner_t *owner, wl_signal *signal)
+        {
+            return wl_listener_member_base::connect(owner, signal);
+        }
+
+        private:
+        static void notify(wl_listener *listener, void *data)
+        {
+            auto link = reinterpret_cast<detail::owned_listener_t*>(listener);
+            (static_cast<owner_t*>(link->owner)->*Method)(
+                static_cast<event_t*>(data));
+        }
+    };
+
+    class event_dispatcher_t;
+
     /**
-     * A wrapper for adding idle callbacks to the event loop
+     * A wrapper for adding idle callbacks to the event loop.
+     *
+     * Idle calls on the default loop are queued in a single idle source, which
+     * runs all of them, instead of each one adding and removing its own.
      */
     class wl_idle_call : public noncopyable_t
     {
@@ -165,22 +269,30 @@ namespace wf
 
         /** Stop waiting for idle, no-op if not connected */
         void disconnect();
-        /** @return true if the event source is active */
+        /** @return true if waiting for the loop to go idle */
         bool is_connected();
 
         /** execute the callback now. do not use manually! */
         void execute();
 
         private:
+        friend class event_dispatcher_t;
         callback_t call;
         wl_event_loop *loop = NULL;
+        /* Set only for idle calls on a custom loop */
         wl_event_source *source = NULL;
+        /* The link in the queue of the default loop, if queued there */
+        wl_list link;
+        bool queued = false;
     };
 
     /**
-     * A wrapper for wl_event_loop_add_timer / wl_event_loop_timer_update
+     * A timer on the default event loop.
+     *
+     * All timers share a single timer source, which is armed for the earliest
+     * timeout, so that they don't need a timerfd each.
      */
-    class wl_timer
+    class wl_timer : public noncopyable_t
     {
         public:
         using callback_t = std::function<void()>;
@@ -194,7 +306,9 @@ namespace wf
         /** If a timeout has been registered, but not fired yet, remove the
          * timeout. Otherwise no-op */
         void disconnect();
-        /** @return true if the event source is active */
+        /** @return true if the timeout is registered and hasn't fired yet. The
+         * timer is disconnected before its callback runs, so the callback can
+         * register a new timeout. */
         bool is_connected();
 
         /* Run the stored call now, regardless of the timeout. No-op if not
@@ -202,8 +316,15 @@ namespace wf
         void execute();
 
         private:
+        friend class event_dispatcher_t;
+        void run();
+
         callback_t call;
-        wl_event_source *source = NULL;
+        bool queued = false;
+        /* The position in the dispatcher's queue, ordered by the deadline in
+         * milliseconds and then by the order of registration */
+        int64_t deadline = 0;
+        uint64_t sequence = 0;
     };
 }
 
@@ -85,6 +85,24 @@ class view_transformer_t
      */
     virtual wlr_box get_bounding_box(wf::geometry_t view, wlr_box region);
 
+    /**
+     * Compute which parts of the view are damaged after transforming the
+     * damaged region.
+     *
+     * The default implementation transforms the bounding box of each
+     * rectangle of the damage with get_bounding_box(). Transformers which
+     * can't map parts of the view, like wobbly, return the whole bounding
+     * box from get_bounding_box(), so they damage the whole view.
+     *
+     * @param view The bounding box of the view up to this transformer.
+     * @param damage The damaged region, in output-local coordinates.
+     *
+     * @return A region containing the damage after transforming it, in
+     *   output-local coordinates.
+     */
+    virtual wf::region_t transform_damage(wf::geometry_t view,
+        const wf::region_t& damage);
+
     /**
      * Render the indicated parts of the view.
      *
@@ -107,6 +125,28 @@ class view_transformer_t
     virtual void render_box(wf::texture_t src_tex, wlr_box src_box,
         wlr_box scissor_box, const wf::framebuffer_t& target_fb) {}
 
+    /**
+     * Express the transformer as a matrix, if possible.
+     *
+     * Consecutive transformers which can be expressed as a matrix are drawn
+     * together in a single pass, instead of each one rendering to its own
+     * offscreen buffer. In that case, render_with_damage() isn't called for
+     * them. The default implementation returns false.
+     *
+     * @param view The bounding box of the view up to this transformer.
+     * @param matrix Set to the matrix which maps output-local coordinates
+     *   before the transformer to output-local coordinates after it.
+     * @param color Set to the color the view's pixels are multiplied with.
+     *
+     * @return Whether the transformer is equivalent to drawing the view with
+     *   the returned matrix and color.
+     */
+    virtual bool get_composable_transform(wf::geometry_t view,
+        glm::mat4& matrix, glm::vec4& color)
+    {
+        return false;
+    }
+
     virtual ~view_transformer_t() {}
 };
 
@@ -116,6 +156,30 @@ class view_2D : public view_transformer_t
 {
   protected:
     wayfire_view view;
+
+    /** @return The quad to draw for the given view texture */
+    OpenGL::textured_quad_t get_quad(wf::texture_t src_tex, wlr_box src_box,
+        const wf::framebuffer_t& target_fb);
+
+  private:
+    /* The parameters are set directly by plugins, so the cached matrices are
+     * checked against the parameters they were computed with on each use. */
+    struct
+    {
+        bool valid = false;
+        float angle, scale_x, scale_y, translation_x, translation_y;
+        wf::geometry_t wm_geometry;
+        /* Map output-local points before the transform to points after it */
+        glm::mat4 forward, inverse;
+
+        /* The result of the last get_bounding_box() */
+        bool has_box = false;
+        wf::geometry_t box_view, box_region, box;
+    } cache;
+
+    /** Recompute the cached matrices if the parameters have changed */
+    void update_cache();
+
   public:
     float angle = 0.0f;
     float scale_x = 1.0f, scale_y = 1.0f;
@@ -130,8 +194,18 @@ class view_2D : public view_transformer_t
         wf::geometry_t view, wf::pointf_t point) override;
     wf::pointf_t untransform_point(
         wf::geometry_t view, wf::pointf_t point) override;
+    wlr_box get_bounding_box(wf::geometry_t view, wlr_box region) override;
+    /* Without rotation, damage is scaled and moved directly */
+    wf::region_t transform_damage(wf::geometry_t view,
+        const wf::region_t& damage) override;
+    void render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+        const wf::region_t& damage, const wf::framebuffer_t& target_fb) override;
     void render_box(wf::texture_t src_tex, wlr_box src_box,
         wlr_box scissor_box, const wf::framebuffer_t& target_fb) override;
+    /* Subclasses which change how the view is rendered should override this
+     * and return false */
+    bool get_composable_transform(wf::geometry_t view,
+        glm::mat4& matrix, glm::vec4& color) override;
 };
 
 /* Those are centered relative to the view's bounding box */
@@ -140,12 +214,34 @@ class view_3D : public view_transformer_t
   protected:
     wayfire_view view;
 
+  private:
+    /* Same as for view_2D, the matrices are set directly by plugins */
+    struct
+    {
+        bool valid = false;
+        glm::mat4 view_proj, translation, rotation, scaling;
+        wf::geometry_t output_geometry;
+        glm::mat4 total;
+
+        bool has_box = false;
+        wf::geometry_t box_view, box_region, box;
+    } cache;
+
   public:
     glm::mat4 view_proj{1.0}, translation{1.0}, rotation{1.0}, scaling{1.0};
     glm::vec4 color{1, 1, 1, 1};
 
+    /** @return The combined matrix, recomputed only if a matrix changed */
     glm::mat4 calculate_total_transform();
 
+    /**
+     * @return The quad to draw for the given view texture. Plugins which keep
+     *   their own snapshots of the view can draw them with it, for example
+     *   with OpenGL::render_textured_quads().
+     */
+    OpenGL::textured_quad_t get_quad(wf::texture_t src_tex, wlr_box src_box,
+        const wf::framebuffer_t& target_fb);
+
   public:
     view_3D(wayfire_view view);
 
@@ -154,6 +250,9 @@ class view_3D : public view_transformer_t
         wf::geometry_t view, wf::pointf_t point) override;
     wf::pointf_t untransform_point(
         wf::geometry_t view, wf::pointf_t point) override;
+    wlr_box get_bounding_box(wf::geometry_t view, wlr_box region) override;
+    void render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+        const wf::region_t& damage, const wf::framebuffer_t& target_fb) override;
     void render_box(wf::texture_t src_tex, wlr_box src_box,
         wlr_box scissor_box, const wf::framebuffer_t& target_fb) override;
 
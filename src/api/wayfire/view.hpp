@@ -7,6 +7,11 @@
 #include "wayfire/object.hpp"
 #include "wayfire/surface.hpp"
 #include "wayfire/geometry.hpp"
+#include "wayfire/util.hpp"
+
+#include <limits>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
 
 extern "C"
 {
@@ -78,6 +83,13 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
      */
     std::vector<wayfire_view> enumerate_views(bool mapped_only = true);
 
+    /**
+     * Call the callback for each view in the view's tree, in the same order
+     * as enumerate_views(), without building a list.
+     */
+    void for_each_view(const std::function<void(wayfire_view)>& callback,
+        bool mapped_only = true);
+
     /**
      * Set the toplevel parent of the view, and adjust the children's list of
      * the parent.
@@ -326,6 +338,18 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
     /** @return true if the view has active transformers */
     bool has_transformer();
 
+    /**
+     * Set the opacity of the view. It is applied to each surface of the view
+     * while drawing, so unlike a transformer it doesn't need a snapshot of
+     * the view. Surfaces of the view are not considered opaque while the
+     * opacity is below 1.
+     *
+     * @param alpha The opacity, in [0, 1].
+     */
+    void set_alpha(float alpha);
+    /** @return The opacity set with set_alpha() */
+    float get_alpha();
+
     /** @return the bounding box of the view up to the given transformer */
     wlr_box get_bounding_box(std::string transformer);
     /** @return the bounding box of the view up to the given transformer */
@@ -392,6 +416,32 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
     bool render_transformed(const framebuffer_t& framebuffer,
         const region_t& damage);
 
+    /**
+     * Render the view directly with the combined transformation of its
+     * transformers, without a snapshot. render_transformed() uses it when
+     * all transformers can be expressed as a matrix (see
+     * view_transformer_t::get_composable_transform()), so that views whose
+     * contents are cheap to draw, like solid color compositor views, never
+     * need offscreen buffers.
+     *
+     * @param framebuffer The framebuffer to render to.
+     * @param matrix Maps output-local coordinates of the untransformed view
+     *   to output-local coordinates after the transformers.
+     * @param color The color which the view's (premultiplied) pixels are
+     *   multiplied with.
+     * @param damage The damaged region, in the framebuffer's damage
+     *   coordinate system.
+     *
+     * @return Whether the view was rendered. The default implementation
+     *   doesn't render and returns false.
+     */
+    virtual bool render_with_transform(const framebuffer_t& framebuffer,
+        const glm::mat4& matrix, const glm::vec4& color,
+        const region_t& damage)
+    {
+        return false;
+    }
+
     /**
      * A snapshot of the view is a copy of the view's contents into a
      * framebuffer. It is used to get an image of the view while it is mapped,
@@ -399,6 +449,21 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
      */
     virtual void take_snapshot();
 
+    /**
+     * Take a snapshot which stays the contents of the view until it is
+     * destroyed, for ex. for an unmap animation. The snapshot isn't redone
+     * afterwards, even if the view is damaged before it is unmapped, and
+     * it isn't released when offscreen buffers are evicted. Mapping the view
+     * again unfreezes it.
+     *
+     * @param max_scale The maximal scale of the snapshot. By default, it has
+     *   the scale of the view's contents. Animations which don't need the
+     *   full detail of the view can use a smaller scale, so that the snapshot
+     *   and the buffers of the view's transformers are smaller.
+     */
+    void take_final_snapshot(
+        float max_scale = std::numeric_limits<float>::max());
+
     virtual ~view_interface_t();
 
     class view_priv_impl;
@@ -423,8 +488,8 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
     /** get_offset() is not valid for views */
     virtual wf::point_t get_offset() override { return {0, 0}; }
 
-    /** Damage the given box, in surface-local coordinates */
-    virtual void damage_surface_box(const wlr_box& box) override;
+    /** Damage the given region, in surface-local coordinates */
+    virtual void damage_surface_region(const wf::region_t& region) override;
 
     /**
      * @return the bounding box of the view before transformers,
@@ -462,6 +527,21 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
 };
 
 wayfire_view wl_surface_to_wayfire_view(wl_resource *surface);
+
+/**
+ * The part of a view behind which its client wants the background blurred,
+ * set with the org_kde_kwin_blur protocol. The core stores it on the view
+ * when the client commits it, erases it when the client unsets it, and emits
+ * blur-region-changed on the view in both cases.
+ */
+struct blur_region_hint_t : public wf::custom_data_t
+{
+    /* Whether the whole view is blurred */
+    bool whole_view = true;
+    /* Otherwise, the blurred region, in the surface-local coordinates of the
+     * main surface of the view */
+    wf::region_t region;
+};
 }
 
 #endif
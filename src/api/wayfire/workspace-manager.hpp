@@ -135,6 +135,20 @@ class workspace_manager
      */
     void remove_view(wayfire_view view);
 
+    /**
+     * Move the views to this output and to its current workspace, in one step.
+     *
+     * The views are removed from the layers of their old outputs and added to
+     * the workspace layer, or to the minimized layer if they are minimized, in
+     * the order of the list, so that the last one ends up on top. Unlike
+     * moving them one by one, the fullscreen layer and the panels of each
+     * output are updated only once, and this output is damaged once at the
+     * end. Focus isn't changed, the caller may focus one of the views after.
+     *
+     * @param views The views to move, from the bottom to the top.
+     */
+    void transfer_views(const std::vector<wayfire_view>& views);
+
     /**
      * @return The layer in which the view is, or 0 if it can't be found
      */
@@ -145,6 +159,15 @@ class workspace_manager
      */
     std::vector<wayfire_view> get_views_in_layer(uint32_t layers_mask);
 
+    /**
+     * Call the callback for each view in the given layers, in the same order
+     * as get_views_in_layer(), without copying the views to a list.
+     *
+     * The callback must not add, remove or restack views.
+     */
+    void for_each_view(uint32_t layers_mask,
+        const std::function<void(wayfire_view)>& callback);
+
     /**
      * @return The current workspace implementation
      */
@@ -226,7 +249,10 @@ class workspace_manager
     void remove_reserved_area(anchored_area *area);
 
     /**
-     * Recalculate reserved area for each anchored area
+     * Recalculate reserved area for each anchored area. The recalculation
+     * happens in the next idle callback, or earlier when the workarea is
+     * requested, so several calls in a row reflow only once.
+     * reserved-workarea is emitted only if the workarea changed.
      */
     void reflow_reserved_areas();
 
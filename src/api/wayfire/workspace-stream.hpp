@@ -3,9 +3,12 @@
 
 #include "wayfire/opengl.hpp"
 #include "wayfire/object.hpp"
+#include <memory>
 
 namespace wf
 {
+class dmabuf_export_t;
+
 /** A workspace stream is a way for plugins to obtain the contents of a
  * given workspace.  */
 struct workspace_stream_t
@@ -14,9 +17,16 @@ struct workspace_stream_t
     wf::framebuffer_base_t buffer;
     bool running = false;
 
+    /* The scale last requested with workspace_stream_update(). It is kept
+     * when the stream is restarted. */
     float scale_x = 1.0;
     float scale_y = 1.0;
 
+    /* The part of the workspace last requested with workspace_stream_update(),
+     * in output-local coordinates. An empty box means the whole workspace.
+     * Like the scale, it is kept when the stream is restarted. */
+    wf::geometry_t crop = {0, 0, 0, 0};
+
     /* The background color of the stream, when there is no view above it.
      * All streams start with -1.0 alpha to indicate that the color is
      * invalid. In this case, we use the default color, which can
@@ -26,6 +36,24 @@ struct workspace_stream_t
      * it is not set (alpha = -1.0) it will fallback to the default
      * user configurable color. */
     wf::color_t background = {0.0f, 0.0f, 0.0f, -1.0f};
+
+    /* Whether the stream buffer is shared as a dmabuf after each update with
+     * damage, see workspace-stream-dmabuf in wayfire/dmabuf-export.hpp.
+     * Shared streams can't be exported, because they don't belong to one
+     * plugin. */
+    bool export_dmabuf = false;
+    /* The export of the buffer, created by the render manager */
+    std::shared_ptr<wf::dmabuf_export_t> dmabuf;
+};
+
+/** A workspace stream drawn by render_manager::render_workspace_streams() */
+struct workspace_stream_instance_t
+{
+    const workspace_stream_t *stream;
+    /* The quad on which the stream buffer is drawn, with the same meaning
+     * as in OpenGL::render_transformed_texture() */
+    gl_geometry geometry;
+    glm::mat4 transform;
 };
 
 /** Emitted whenever a workspace stream is being started or stopped */
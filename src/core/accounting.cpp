@@ -0,0 +1,200 @@
+#include "wayfire/accounting.hpp"
+#include <wayfire/core.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include "../output/plugin-loader.hpp"
+#include "../view/view-impl.hpp"
+#include "../view/offscreen-buffers.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+
+namespace wf
+{
+namespace accounting
+{
+bool enabled = false;
+
+namespace
+{
+/* Callbacks are identified by the address of their type_info, which is
+ * resolved to a plugin only when the results are read */
+struct raw_key_t
+{
+    const void *callback;
+    signal_id_t source;
+
+    bool operator ==(const raw_key_t& other) const
+    {
+        return callback == other.callback && source == other.source;
+    }
+};
+
+struct raw_key_hash_t
+{
+    size_t operator ()(const raw_key_t& key) const
+    {
+        return std::hash<const void*>{}(key.callback) ^
+               (std::hash<uint32_t>{}(key.source.get()) * 0x9e3779b9);
+    }
+};
+
+std::unordered_map<raw_key_t, cpu_time_t, raw_key_hash_t> raw_times;
+std::map<std::pair<std::string, std::string>, cpu_time_t> resolved_times;
+
+/* The callbacks running at the moment, innermost last */
+struct frame_t
+{
+    raw_key_t key;
+    int64_t start;
+    /* Total time of the callbacks run by this one */
+    int64_t children = 0;
+};
+
+std::vector<frame_t> stack;
+
+wf::option_wrapper_t<bool> accounting_opt;
+
+int64_t now_nsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+void add(cpu_time_t& to, const cpu_time_t& from)
+{
+    to.self_nsec += from.self_nsec;
+    to.max_nsec = std::max(to.max_nsec, from.max_nsec);
+    to.count += from.count;
+}
+
+/* The reported memory, by object, subsystem and kind */
+std::map<wf::object_base_t*,
+    std::map<std::pair<std::string, memory_kind_t>, size_t>> memory_usage;
+
+std::string describe(wf::object_base_t *object)
+{
+    if (auto view = dynamic_cast<wf::view_interface_t*>(object))
+    {
+        return "view " + std::to_string(view->get_id()) + " (" +
+               view->get_app_id() + ")";
+    }
+
+    if (auto output = dynamic_cast<wf::output_t*>(object))
+        return output->to_string();
+
+    return object->to_string();
+}
+}
+
+void init()
+{
+    accounting_opt.load_option("core/plugin_accounting");
+    enabled = accounting_opt;
+    accounting_opt.set_callback([] () { enabled = accounting_opt; });
+}
+
+void scope_t::begin(const void *callback, signal_id_t source)
+{
+    active = true;
+    stack.push_back({{callback, source}, now_nsec()});
+}
+
+void scope_t::end()
+{
+    auto frame = stack.back();
+    stack.pop_back();
+
+    int64_t total = now_nsec() - frame.start;
+    auto& time = raw_times[frame.key];
+    time.self_nsec += std::max<int64_t>(total - frame.children, 0);
+    time.max_nsec = std::max<uint64_t>(time.max_nsec, total);
+    ++time.count;
+
+    if (!stack.empty())
+        stack.back().children += total;
+}
+
+void resolve_owners()
+{
+    for (auto& [key, time] : raw_times)
+    {
+        add(resolved_times[{get_plugin_name_at(key.callback),
+            key.source.get_name()}], time);
+    }
+
+    raw_times.clear();
+}
+
+std::map<std::pair<std::string, std::string>, cpu_time_t> get_cpu_times()
+{
+    resolve_owners();
+    return resolved_times;
+}
+
+void reset_cpu_times()
+{
+    raw_times.clear();
+    resolved_times.clear();
+}
+
+void set_memory_usage(wf::object_base_t *object, const std::string& subsystem,
+    memory_kind_t kind, size_t bytes)
+{
+    if (bytes > 0)
+    {
+        memory_usage[object][{subsystem, kind}] = bytes;
+        return;
+    }
+
+    auto it = memory_usage.find(object);
+    if (it == memory_usage.end())
+        return;
+
+    it->second.erase({subsystem, kind});
+    if (it->second.empty())
+        memory_usage.erase(it);
+}
+
+void forget_memory_usage(wf::object_base_t *object)
+{
+    memory_usage.erase(object);
+}
+
+void memory_report_signal::add(wf::object_base_t *object,
+    const std::string& subsystem, memory_kind_t kind, size_t bytes)
+{
+    usage.push_back({describe(object), subsystem, kind, bytes});
+}
+
+std::vector<memory_usage_t> get_memory_usage()
+{
+    memory_report_signal report;
+    for (auto& [object, entries] : memory_usage)
+    {
+        for (auto& [key, bytes] : entries)
+            report.add(object, key.first, key.second, bytes);
+    }
+
+    for (auto& [object, owners] :
+         wf::offscreen_buffer_registry_t::get().get_usage_by_object())
+    {
+        for (auto& [owner, bytes] : owners)
+            report.add(object, owner, MEMORY_GPU, bytes);
+    }
+
+    for (auto& view : wf::get_core().get_all_views())
+    {
+        report.add(view.get(), "view state", MEMORY_CPU,
+            sizeof(wf::view_interface_t) +
+            sizeof(wf::view_interface_t::view_priv_impl));
+    }
+
+    wf::get_core().emit_signal("memory-report", &report);
+    return std::move(report.usage);
+}
+}
+}
@@ -0,0 +1,290 @@
+#include "async-log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wf
+{
+namespace async_log
+{
+namespace
+{
+/* Must be a power of two */
+constexpr size_t RING_SIZE = 4 << 20;
+
+/**
+ * A ring buffer with a single consumer, the writer thread. Most messages come
+ * from the compositor thread, but worker threads log too, so producers take
+ * a short lock. head and tail only grow, their difference is the number of
+ * queued bytes.
+ */
+struct ring_t
+{
+    std::vector<char> data = std::vector<char>(RING_SIZE);
+    std::atomic<size_t> head{0}, tail{0};
+    std::atomic<size_t> dropped{0};
+    /* Serializes the producers */
+    std::mutex push_mutex;
+
+    /** @return false if there was no space for the data */
+    bool push(const char *buf, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(push_mutex);
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if (RING_SIZE - (h - t) < size)
+            return false;
+
+        size_t start = h & (RING_SIZE - 1);
+        size_t first = std::min(size, RING_SIZE - start);
+        std::memcpy(&data[start], buf, first);
+        std::memcpy(&data[0], buf + first, size - first);
+        head.store(h + size, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+
+    /** Pass the queued data to func in at most two parts, and remove it */
+    template<class Func>
+    void pop(Func func)
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t != h)
+        {
+            size_t start = t & (RING_SIZE - 1);
+            size_t size = std::min(h - t, RING_SIZE - start);
+            func(&data[start], size);
+            t += size;
+        }
+
+        tail.store(t, std::memory_order_release);
+    }
+};
+
+/** Keeps the last bytes written to it, overwriting the oldest */
+struct recorder_t
+{
+    std::vector<char> data;
+    /* Total number of bytes written */
+    size_t written = 0;
+
+    void add(const char *buf, size_t size)
+    {
+        if (data.empty())
+            return;
+
+        /* Only the last data.size() bytes are kept */
+        size_t skip = size > data.size() ? size - data.size() : 0;
+        written += skip;
+        buf += skip;
+        size -= skip;
+
+        size_t start = written % data.size();
+        size_t first = std::min(size, data.size() - start);
+        std::memcpy(&data[start], buf, first);
+        std::memcpy(&data[0], buf + first, size - first);
+        written += size;
+    }
+
+    void dump(std::ostream& out)
+    {
+        if (written <= data.size())
+        {
+            out.write(data.data(), written);
+            return;
+        }
+
+        /* Start with the first complete line */
+        size_t start = written % data.size();
+        std::string contents(data.begin() + start, data.end());
+        contents.append(data.begin(), data.begin() + start);
+        out << contents.substr(contents.find('\n') + 1);
+    }
+};
+
+struct state_t
+{
+    ring_t ring;
+    recorder_t recorder;
+    std::ostream *output = nullptr;
+    bool forward = true;
+
+    /* Once set, messages are written directly by the compositor thread */
+    std::atomic<bool> synchronous{false};
+
+    std::thread writer;
+    /* Held by the writer thread except while it waits */
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit = false;
+
+    void write_queued()
+    {
+        ring.pop([&] (const char *buf, size_t size)
+        {
+            if (forward)
+                output->write(buf, size);
+
+            recorder.add(buf, size);
+        });
+
+        size_t dropped = ring.dropped.exchange(0);
+        if (dropped > 0)
+        {
+            std::string note = "[" + std::to_string(dropped) +
+                " bytes of log dropped, the log buffer was full]\n";
+            if (forward)
+                *output << note;
+
+            recorder.add(note.data(), note.size());
+        }
+
+        if (forward)
+            output->flush();
+    }
+
+    void writer_main()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!quit)
+        {
+            /* Wakeups are sent without the lock, so they can be missed, but
+             * then the next timeout picks up the messages */
+            wake.wait_for(lock, std::chrono::milliseconds(50),
+                [&] () { return quit || !ring.empty(); });
+            if (quit)
+                break;
+
+            /* With the lock, so that handle_crash() can wait for the write
+             * to finish */
+            write_queued();
+        }
+    }
+
+    /** Wait until the writer has written everything queued so far */
+    void wait_written(std::chrono::milliseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!ring.empty() && (std::chrono::steady_clock::now() < deadline))
+        {
+            wake.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+};
+
+/* Never freed, so that the writer thread and the stream outlive the static
+ * destructors, which may still log */
+state_t& state = *new state_t;
+
+class ring_streambuf_t : public std::streambuf
+{
+  protected:
+    std::streamsize xsputn(const char *buf, std::streamsize size) override
+    {
+        if (state.synchronous)
+        {
+            std::lock_guard<std::mutex> lock(state.ring.push_mutex);
+            state.output->write(buf, size);
+            state.output->flush();
+            return size;
+        }
+
+        bool was_empty = state.ring.empty();
+        if (!state.ring.push(buf, size))
+            state.ring.dropped += size;
+        else if (was_empty)
+            state.wake.notify_one();
+
+        return size;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        char ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+};
+}
+
+std::ostream& start(std::ostream& output, bool forward, size_t recorder_bytes)
+{
+    state.output = &output;
+    state.forward = forward;
+    state.recorder.data.resize(recorder_bytes);
+    state.writer = std::thread([] () { state.writer_main(); });
+    return *new std::ostream(new ring_streambuf_t);
+}
+
+void handle_crash()
+{
+    if (!state.output || state.synchronous)
+        return;
+
+    state.wait_written(std::chrono::milliseconds(100));
+
+    /* Stop the writer, unless it is stuck, for ex. because it crashed */
+    std::unique_lock<std::mutex> lock(state.mutex, std::defer_lock);
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(100);
+    while (!lock.try_lock())
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            state.synchronous = true;
+            return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    state.quit = true;
+    state.write_queued();
+    if (!state.forward && (state.recorder.written > 0))
+    {
+        *state.output << "---- flight recorder: the last " <<
+            std::min(state.recorder.written, state.recorder.data.size()) / 1024 <<
+            " KiB of the log ----\n";
+        state.recorder.dump(*state.output);
+        *state.output << "---- end of the flight recorder ----" << std::endl;
+    }
+
+    state.synchronous = true;
+}
+
+void stop()
+{
+    if (!state.writer.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.quit = true;
+    }
+
+    state.wake.notify_one();
+    state.writer.join();
+    /* Anything logged from now on, for ex. by destructors */
+    state.synchronous = true;
+    state.write_queued();
+}
+}
+}
@@ -0,0 +1,49 @@
+#ifndef WF_ASYNC_LOG_HPP
+#define WF_ASYNC_LOG_HPP
+
+#include <cstddef>
+#include <ostream>
+
+namespace wf
+{
+/**
+ * Writes the log from a background thread.
+ *
+ * The stream returned by start() is passed to wf::log::initialize_logging().
+ * Writing to it only copies the formatted message into a lock-free ring
+ * buffer, and a background thread writes the buffer to the real output, so
+ * the compositor thread doesn't wait for the terminal or the disk. If the
+ * buffer is full, messages are dropped rather than blocking, and the number
+ * of dropped bytes is noted in the output.
+ *
+ * In the flight recorder mode, the background thread also keeps the last
+ * part of the log in memory. If the log isn't written out continuously, for
+ * ex. to keep debug messages without their cost, the recorded part is
+ * written out only on a crash.
+ */
+namespace async_log
+{
+/**
+ * Start the background thread.
+ *
+ * @param output The stream to which the log is written.
+ * @param forward Whether to write the log to output continuously.
+ * @param recorder_bytes The size of the flight recorder, 0 disables it.
+ *
+ * @return The stream to pass to wf::log::initialize_logging().
+ */
+std::ostream& start(std::ostream& output, bool forward, size_t recorder_bytes);
+
+/**
+ * Called when the compositor crashes, before the backtrace is printed: wait
+ * a little for the queued messages, write out the flight recorder, and write
+ * the following messages synchronously.
+ */
+void handle_crash();
+
+/** Write out the queued messages and stop the background thread */
+void stop();
+}
+}
+
+#endif /* end of include guard: WF_ASYNC_LOG_HPP */
@@ -17,6 +17,7 @@ extern "C"
 class input_manager;
 struct wayfire_shell;
 struct wf_gtk_shell;
+struct wf_kde_blur;
 
 namespace wf
 {
@@ -41,6 +42,7 @@ class compositor_core_impl_t : public compositor_core_t
     void init();
     wayfire_shell *wf_shell;
     wf_gtk_shell *gtk_shell;
+    wf_kde_blur *kde_blur;
 
     /**
      * Remove a view from the compositor list. This is called when the view's
@@ -66,6 +68,8 @@ class compositor_core_impl_t : public compositor_core_t
     virtual wlr_cursor* get_wlr_cursor() override;
 
     void add_view(std::unique_ptr<wf::view_interface_t> view) override;
+    wayfire_view find_view(uint32_t id) override;
+    std::vector<wayfire_view> get_all_views() override;
     void set_active_view(wayfire_view v) override;
     void focus_view(wayfire_view win) override;
     void move_view_to_output(wayfire_view v, wf::output_t *new_output) override;
@@ -77,6 +81,13 @@ class compositor_core_impl_t : public compositor_core_t
     uint32_t get_focused_layer() override;
     int get_xwayland_display() override;
     pid_t run(std::string command) override;
+    void shutdown() override;
+
+    /** Run the event loop until shutdown() or wl_display_terminate() is
+     * called */
+    void run_event_loop();
+    /** Stop run_event_loop(), called when the display is terminated */
+    void handle_display_terminate(wl_display *terminated);
 
   private:
     wf::wl_listener_wrapper output_layout_changed;
@@ -89,13 +100,21 @@ class compositor_core_impl_t : public compositor_core_t
     wf::wl_listener_wrapper pointer_constraint_added;
 
     wf::output_t *active_output = nullptr;
-    std::vector<std::unique_ptr<wf::view_interface_t>> views;
+    bool running = true;
+    /* All views, by their object id */
+    std::unordered_map<uint32_t, std::unique_ptr<wf::view_interface_t>> views;
 
     /* pairs (layer, request_id) */
     std::set<std::pair<uint32_t, int>> layer_focus_requests;
 
     wayfire_view last_active_toplevel;
 
+    /* Processes started with run() which haven't exited yet. They are
+     * reaped on SIGCHLD, so that run() doesn't wait for anything. */
+    std::set<pid_t> running_children;
+    wl_event_source *sigchld_source = nullptr;
+    static int handle_sigchld(int signal, void *data);
+
     compositor_core_impl_t();
     virtual ~compositor_core_impl_t();
 };
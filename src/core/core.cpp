@@ -20,6 +20,7 @@ extern "C"
 #include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_pointer_constraints_v1.h>
 #include <wlr/types/wlr_tablet_v2.h>
+#include <wlr/types/wlr_presentation_time.h>
 
 #define static
 #include <wlr/render/wlr_renderer.h>
@@ -33,11 +34,19 @@ extern "C"
 #endif
 
 #include <sys/wait.h>
+#include <spawn.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <cstring>
+#include <ctime>
+#include <map>
 #include <unistd.h>
 #include <fcntl.h>
 
 #include <wayfire/util/log.hpp>
 #include "opengl-priv.hpp"
+#include "wayfire/accounting.hpp"
+#include "wayfire/frame-stats.hpp"
 #include "wayfire/output.hpp"
 #include "wayfire/workspace-manager.hpp"
 #include "seat/input-manager.hpp"
@@ -46,6 +55,7 @@ extern "C"
 #include "../output/wayfire-shell.hpp"
 #include "../output/output-impl.hpp"
 #include "../output/gtk-shell.hpp"
+#include "../output/kde-blur.hpp"
 #include "wayfire/img.hpp"
 #include "wayfire/output-layout.hpp"
 
@@ -164,6 +174,10 @@ struct wf_pointer_constraint
 
 void wf::compositor_core_impl_t::init()
 {
+    /* SIGCHLD is blocked in main(), before any thread is started */
+    sigchld_source = wl_event_loop_add_signal(ev_loop, SIGCHLD,
+        handle_sigchld, this);
+
     protocols.data_device = wlr_data_device_manager_create(display);
     protocols.data_control = wlr_data_control_manager_v1_create(display);
     wlr_renderer_init_wl_display(renderer, display);
@@ -187,6 +201,7 @@ void wf::compositor_core_impl_t::init()
     protocols.gamma_v1 = wlr_gamma_control_manager_v1_create(display);
     protocols.linux_dmabuf = wlr_linux_dmabuf_v1_create(display, renderer);
     protocols.export_dmabuf = wlr_export_dmabuf_manager_v1_create(display);
+    protocols.presentation = wlr_presentation_create(display, backend);
     protocols.output_manager = wlr_xdg_output_manager_v1_create(display,
         output_layout->get_handle());
 
@@ -253,9 +268,11 @@ void wf::compositor_core_impl_t::init()
 
     wf_shell = wayfire_shell_create(display);
     gtk_shell = wf_gtk_shell_create(display);
+    kde_blur = wf_kde_blur_create(display);
 
     image_io::init();
     OpenGL::init();
+    wf::accounting::init();
 }
 
 wlr_seat* wf::compositor_core_impl_t::get_current_seat()
@@ -455,7 +472,7 @@ void wf::compositor_core_impl_t::add_view(
     std::unique_ptr<wf::view_interface_t> view)
 {
     auto v = view->self(); /* non-owning copy */
-    views.push_back(std::move(view));
+    views[v->get_id()] = std::move(view);
 
     assert(active_output);
     if (!v->get_output())
@@ -536,64 +553,166 @@ void wf::compositor_core_impl_t::erase_view(wayfire_view v)
     if (v->get_output())
         v->set_output(nullptr);
 
-    auto it = std::find_if(views.begin(), views.end(),
-        [&v] (const auto& view) { return view.get() == v.get(); });
+    auto it = views.find(v->get_id());
+    if (it == views.end())
+        return;
 
+    /* The view is destroyed after it is no longer in the list */
+    auto view = std::move(it->second);
     views.erase(it);
 }
 
-pid_t wf::compositor_core_impl_t::run(std::string command)
+wayfire_view wf::compositor_core_impl_t::find_view(uint32_t id)
 {
-    static constexpr size_t READ_END = 0;
-    static constexpr size_t WRITE_END = 1;
-    pid_t pid;
-    int pipe_fd[2];
-    pipe2(pipe_fd, O_CLOEXEC);
+    auto it = views.find(id);
+    return it == views.end() ? nullptr : it->second->self();
+}
+
+std::vector<wayfire_view> wf::compositor_core_impl_t::get_all_views()
+{
+    std::vector<wayfire_view> result;
+    result.reserve(views.size());
+    for (auto& [id, view] : views)
+        result.push_back(view->self());
+
+    return result;
+}
+
+int wf::compositor_core_impl_t::handle_sigchld(int, void *data)
+{
+    auto core = static_cast<compositor_core_impl_t*> (data);
 
-    /* The following is a "hack" for disowning the child processes,
-     * otherwise they will simply stay as zombie processes */
-    pid = fork();
-    if (!pid)
+    /* Signals are coalesced, check all of our children. Other children of
+     * the compositor, like Xwayland, are left to whoever started them. */
+    for (auto it = core->running_children.begin();
+         it != core->running_children.end();)
     {
-        pid = fork();
-        if (!pid)
-        {
-            close(pipe_fd[READ_END]);
-            close(pipe_fd[WRITE_END]);
+        int status;
+        if (waitpid(*it, &status, WNOHANG) != 0)
+            it = core->running_children.erase(it);
+        else
+            ++it;
+    }
+
+    return 0;
+}
+
+void wf::compositor_core_impl_t::shutdown()
+{
+    emit_signal("shutdown", nullptr);
+    /* Stops run_event_loop(), see handle_display_terminate() */
+    wl_display_terminate(display);
+}
+
+void wf::compositor_core_impl_t::handle_display_terminate(
+    wl_display *terminated)
+{
+    if (terminated == display)
+        running = false;
+}
 
-            setenv("_JAVA_AWT_WM_NONREPARENTING", "1", 1);
-            setenv("WAYLAND_DISPLAY", wayland_display.c_str(), 1);
+/**
+ * wl_display_terminate() isn't only called by shutdown(), but also by wlroots,
+ * for ex. when the parent display of the nested backends goes away, and by
+ * plugins. There is no way to query whether the display was terminated, so
+ * the function is wrapped, and run_event_loop() stops for all of them the
+ * same way as wl_display_run() does.
+ */
+extern "C" void wl_display_terminate(wl_display *display)
+{
+    using terminate_func_t = void (*)(wl_display*);
+    static auto real_terminate =
+        (terminate_func_t)dlsym(RTLD_NEXT, "wl_display_terminate");
+
+    wf::get_core_impl().handle_display_terminate(display);
+    real_terminate(display);
+}
+
+void wf::compositor_core_impl_t::run_event_loop()
+{
+    /* Like wl_display_run(), but measured. The handlers of one iteration
+     * only buffer their events, so that each client is written to at most
+     * once per iteration. */
+    auto& stats = wf::get_event_loop_stats();
+    while (running)
+    {
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        wl_display_flush_clients(display);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        stats.flush_nsec += (end.tv_sec - start.tv_sec) * 1000000000ll +
+            (end.tv_nsec - start.tv_nsec);
+        ++stats.iterations;
+        wl_event_loop_dispatch(ev_loop, -1);
+    }
+}
+
+pid_t wf::compositor_core_impl_t::run(std::string command)
+{
+    /* The environment of the compositor with the variables for clients */
+    std::map<std::string, std::string> overrides = {
+        {"_JAVA_AWT_WM_NONREPARENTING", "1"},
+        {"WAYLAND_DISPLAY", wayland_display},
+    };
 #if WLR_HAS_XWAYLAND
-            if (xwayland_get_display() >= 0) {
-                auto xdisp = ":" + std::to_string(xwayland_get_display());
-                setenv("DISPLAY", xdisp.c_str(), 1);
-            }
+    if (xwayland_get_display() >= 0)
+        overrides["DISPLAY"] = ":" + std::to_string(xwayland_get_display());
 #endif
-            int dev_null = open("/dev/null", O_WRONLY);
-            dup2(dev_null, 1);
-            dup2(dev_null, 2);
 
-            _exit(execl("/bin/bash", "/bin/bash", "-c", command.c_str(), NULL));
-        } else
-        {
-            close(pipe_fd[READ_END]);
-            write(pipe_fd[WRITE_END], (void*) (&pid), sizeof(pid));
-            close(pipe_fd[WRITE_END]);
-            _exit(0);
-        }
-    } else
+    std::vector<std::string> env_strings;
+    for (char **var = environ; *var; var++)
     {
-        close(pipe_fd[WRITE_END]);
+        std::string entry = *var;
+        if (!overrides.count(entry.substr(0, entry.find('='))))
+            env_strings.push_back(entry);
+    }
 
-        int status;
-        waitpid(pid, &status, 0);
+    for (auto& var : overrides)
+        env_strings.push_back(var.first + "=" + var.second);
+
+    std::vector<char*> envp;
+    for (auto& var : env_strings)
+        envp.push_back(&var[0]);
+    envp.push_back(nullptr);
+
+    /* The child must not inherit the signals blocked by the event loop,
+     * nor the handlers of the compositor */
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+        POSIX_SPAWN_SETSIGDEF);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, 1, 2);
+
+    /* posix_spawn() doesn't copy the address space of the compositor, so
+     * starting a client is cheap even with large GL mappings */
+    pid_t pid;
+    std::string shell = "/bin/bash";
+    std::string flag = "-c";
+    char *argv[] = {&shell[0], &flag[0], &command[0], nullptr};
+    int err = posix_spawn(&pid, shell.c_str(), &actions, &attr, argv,
+        envp.data());
 
-        pid_t child_pid;
-        read(pipe_fd[READ_END], &child_pid, sizeof(child_pid));
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
 
-        close(pipe_fd[READ_END]);
-        return child_pid;
+    if (err != 0)
+    {
+        LOGE("Failed to run \"", command, "\": ", strerror(err));
+        return -1;
     }
+
+    running_children.insert(pid);
+    return pid;
 }
 
 int wf::compositor_core_impl_t::get_xwayland_display()
@@ -0,0 +1,154 @@
+#include <wayfire/dmabuf-export.hpp>
+#include <wayfire/util/log.hpp>
+#include "core-impl.hpp"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <unistd.h>
+
+extern "C"
+{
+#define static
+#include <wlr/render/egl.h>
+#undef static
+}
+
+namespace
+{
+struct egl_export_funcs_t
+{
+    PFNEGLCREATEIMAGEKHRPROC create_image = nullptr;
+    PFNEGLDESTROYIMAGEKHRPROC destroy_image = nullptr;
+    PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC export_query = nullptr;
+    PFNEGLEXPORTDMABUFIMAGEMESAPROC export_image = nullptr;
+    EGLDisplay display = EGL_NO_DISPLAY;
+    bool supported = false;
+};
+
+/* Resolved once, the EGL display doesn't change */
+const egl_export_funcs_t& get_funcs()
+{
+    static egl_export_funcs_t funcs;
+    static bool initialized = false;
+    if (initialized)
+        return funcs;
+
+    initialized = true;
+    funcs.display = wf::get_core_impl().egl->display;
+
+    auto ext = eglQueryString(funcs.display, EGL_EXTENSIONS);
+    auto has_ext = [&] (const char *name)
+    {
+        return ext && std::strstr(ext, name);
+    };
+
+    if (!has_ext("EGL_MESA_image_dma_buf_export") ||
+        !has_ext("EGL_KHR_gl_texture_2D_image"))
+    {
+        LOGI("EGL can't export textures as dmabufs");
+        return funcs;
+    }
+
+    funcs.create_image = (PFNEGLCREATEIMAGEKHRPROC)
+        eglGetProcAddress("eglCreateImageKHR");
+    funcs.destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+        eglGetProcAddress("eglDestroyImageKHR");
+    funcs.export_query = (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)
+        eglGetProcAddress("eglExportDMABUFImageQueryMESA");
+    funcs.export_image = (PFNEGLEXPORTDMABUFIMAGEMESAPROC)
+        eglGetProcAddress("eglExportDMABUFImageMESA");
+
+    funcs.supported = funcs.create_image && funcs.destroy_image &&
+        funcs.export_query && funcs.export_image;
+    return funcs;
+}
+}
+
+bool wf::dmabuf_export_t::is_supported()
+{
+    return get_funcs().supported;
+}
+
+wf::dmabuf_export_t::~dmabuf_export_t()
+{
+    release();
+}
+
+bool wf::dmabuf_export_t::export_buffer(const wf::framebuffer_base_t& buffer)
+{
+    if (image && (exported_tex == buffer.tex) &&
+        (attributes.width == buffer.viewport_width) &&
+        (attributes.height == buffer.viewport_height))
+    {
+        return true;
+    }
+
+    release();
+    auto& funcs = get_funcs();
+    if (!funcs.supported || (buffer.tex == 0) || (buffer.tex == (GLuint)-1))
+        return false;
+
+    EGLImageKHR egl_image = funcs.create_image(funcs.display,
+        eglGetCurrentContext(), EGL_GL_TEXTURE_2D_KHR,
+        (EGLClientBuffer)(uintptr_t)buffer.tex, nullptr);
+    if (egl_image == EGL_NO_IMAGE_KHR)
+    {
+        LOGE("Failed to create an EGL image for the dmabuf export");
+        return false;
+    }
+
+    int fourcc = 0, n_planes = 0;
+    EGLuint64KHR modifiers[WLR_DMABUF_MAX_PLANES] = {0};
+    if (!funcs.export_query(funcs.display, egl_image, &fourcc, &n_planes,
+        nullptr) || (n_planes <= 0) || (n_planes > WLR_DMABUF_MAX_PLANES) ||
+        !funcs.export_query(funcs.display, egl_image, &fourcc, &n_planes,
+            modifiers))
+    {
+        LOGE("Failed to query the dmabuf format of the export");
+        funcs.destroy_image(funcs.display, egl_image);
+        return false;
+    }
+
+    int fds[WLR_DMABUF_MAX_PLANES];
+    EGLint strides[WLR_DMABUF_MAX_PLANES], offsets[WLR_DMABUF_MAX_PLANES];
+    if (!funcs.export_image(funcs.display, egl_image, fds, strides, offsets))
+    {
+        LOGE("Failed to export the texture as a dmabuf");
+        funcs.destroy_image(funcs.display, egl_image);
+        return false;
+    }
+
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.width = buffer.viewport_width;
+    attributes.height = buffer.viewport_height;
+    attributes.format = fourcc;
+    attributes.modifier = modifiers[0];
+    attributes.n_planes = n_planes;
+    for (int i = 0; i < n_planes; i++)
+    {
+        attributes.fd[i] = fds[i];
+        attributes.stride[i] = strides[i];
+        attributes.offset[i] = offsets[i];
+    }
+
+    image = egl_image;
+    exported_tex = buffer.tex;
+    return true;
+}
+
+const wlr_dmabuf_attributes *wf::dmabuf_export_t::get_attributes() const
+{
+    return image ? &attributes : nullptr;
+}
+
+void wf::dmabuf_export_t::release()
+{
+    if (!image)
+        return;
+
+    wlr_dmabuf_attributes_finish(&attributes);
+    get_funcs().destroy_image(get_funcs().display, (EGLImageKHR)image);
+    image = nullptr;
+    exported_tex = 0;
+}
@@ -0,0 +1,239 @@
+#include <wayfire/util/log.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include "opengl-priv.hpp"
+#include "core-impl.hpp"
+
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <cstring>
+#include <deque>
+
+extern "C"
+{
+#define static
+#include <wlr/render/egl.h>
+#undef static
+}
+
+namespace OpenGL
+{
+namespace
+{
+wf::option_wrapper_t<bool> gpu_timing_opt;
+
+/* Queries in flight are bounded, so that a stalled GPU doesn't make the list
+ * grow. Blocks are simply not measured while all queries are in use. */
+constexpr size_t MAX_PENDING_QUERIES = 1024;
+
+enum support_t
+{
+    SUPPORT_UNKNOWN,
+    SUPPORT_YES,
+    SUPPORT_NO,
+};
+
+support_t support = SUPPORT_UNKNOWN;
+PFNGLQUERYCOUNTEREXTPROC query_counter;
+PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_result;
+PFNGLGETQUERYIVEXTPROC get_query_iv;
+
+struct pending_timer_t
+{
+    std::string owner;
+    GLuint start, end;
+    bool ended = false;
+};
+
+/* Timers in the order in which they were started, so that the GPU finishes
+ * them in order too */
+std::deque<pending_timer_t> pending;
+/* Ids of started timers are their index plus the number of timers which
+ * were removed from the front of pending */
+int64_t first_pending_id = 0;
+/* Timers with lower ids were in flight during a disjoint operation */
+int64_t discard_before_id = 0;
+std::vector<GLuint> free_queries;
+
+std::map<std::string, gpu_time_t> gpu_times;
+
+void ensure_context()
+{
+    auto egl = wf::get_core_impl().egl;
+    if (!wlr_egl_is_current(egl))
+        wlr_egl_make_current(egl, EGL_NO_SURFACE, NULL);
+}
+
+bool check_support()
+{
+    if (support != SUPPORT_UNKNOWN)
+        return support == SUPPORT_YES;
+
+    support = SUPPORT_NO;
+    auto ext = reinterpret_cast<const char*> (glGetString(GL_EXTENSIONS));
+    if (!ext || !std::strstr(ext, "GL_EXT_disjoint_timer_query"))
+    {
+        LOGI("GPU timing is not available: missing GL_EXT_disjoint_timer_query");
+        return false;
+    }
+
+    query_counter = reinterpret_cast<PFNGLQUERYCOUNTEREXTPROC> (
+        eglGetProcAddress("glQueryCounterEXT"));
+    get_query_result = reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC> (
+        eglGetProcAddress("glGetQueryObjectui64vEXT"));
+    get_query_iv = reinterpret_cast<PFNGLGETQUERYIVEXTPROC> (
+        eglGetProcAddress("glGetQueryivEXT"));
+    if (!query_counter || !get_query_result || !get_query_iv)
+        return false;
+
+    /* Timestamps are optional in the extension, but elapsed time queries
+     * can't be nested, and hooks run inside of the render pass */
+    GLint bits = 0;
+    get_query_iv(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &bits);
+    if (bits == 0)
+    {
+        LOGI("GPU timing is not available: the driver has no timestamps");
+        return false;
+    }
+
+    support = SUPPORT_YES;
+    return true;
+}
+
+GLuint get_query()
+{
+    if (free_queries.empty())
+    {
+        free_queries.resize(64);
+        GL_CALL(glGenQueries(free_queries.size(), free_queries.data()));
+    }
+
+    GLuint query = free_queries.back();
+    free_queries.pop_back();
+    return query;
+}
+}
+
+void init_gpu_timers()
+{
+    gpu_timing_opt.load_option("core/gpu_timing");
+}
+
+void fini_gpu_timers()
+{
+    for (auto& timer : pending)
+    {
+        free_queries.push_back(timer.start);
+        free_queries.push_back(timer.end);
+    }
+
+    if (free_queries.size())
+        GL_CALL(glDeleteQueries(free_queries.size(), free_queries.data()));
+
+    first_pending_id += pending.size();
+    pending.clear();
+    free_queries.clear();
+}
+
+bool gpu_timing_active()
+{
+    return gpu_timing_opt && (support != SUPPORT_NO);
+}
+
+static int64_t begin_gpu_timer(const std::string& owner)
+{
+    if (!gpu_timing_active() || (pending.size() >= MAX_PENDING_QUERIES / 2))
+        return -1;
+
+    ensure_context();
+    if (!check_support())
+        return -1;
+
+    pending_timer_t timer;
+    timer.owner = owner;
+    timer.start = get_query();
+    timer.end = get_query();
+    query_counter(timer.start, GL_TIMESTAMP_EXT);
+    pending.push_back(timer);
+
+    return first_pending_id + pending.size() - 1;
+}
+
+static void end_gpu_timer(int64_t id)
+{
+    if ((id < first_pending_id) ||
+        (id >= first_pending_id + (int64_t)pending.size()))
+    {
+        return;
+    }
+
+    auto& timer = pending[id - first_pending_id];
+    ensure_context();
+    query_counter(timer.end, GL_TIMESTAMP_EXT);
+    timer.ended = true;
+}
+
+void collect_gpu_timers()
+{
+    if (pending.empty())
+        return;
+
+    ensure_context();
+
+    /* Reading the flag also resets it. If it is set, the timestamps of all
+     * queries in flight may be wrong. */
+    GLint disjoint = 0;
+    GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+    if (disjoint)
+        discard_before_id = first_pending_id + pending.size();
+
+    while (!pending.empty() && pending.front().ended)
+    {
+        auto& timer = pending.front();
+        GLuint available = 0;
+        GL_CALL(glGetQueryObjectuiv(timer.end, GL_QUERY_RESULT_AVAILABLE,
+            &available));
+        if (!available)
+            break;
+
+        if (first_pending_id >= discard_before_id)
+        {
+            GLuint64 start = 0, end = 0;
+            get_query_result(timer.start, GL_QUERY_RESULT_EXT, &start);
+            get_query_result(timer.end, GL_QUERY_RESULT_EXT, &end);
+
+            auto& time = gpu_times[timer.owner];
+            uint64_t nsec = end > start ? end - start : 0;
+            time.total_nsec += nsec;
+            time.max_nsec = std::max(time.max_nsec, nsec);
+            ++time.count;
+        }
+
+        free_queries.push_back(timer.start);
+        free_queries.push_back(timer.end);
+        pending.pop_front();
+        ++first_pending_id;
+    }
+}
+
+std::map<std::string, gpu_time_t> get_gpu_times()
+{
+    return gpu_times;
+}
+
+void reset_gpu_times()
+{
+    gpu_times.clear();
+}
+
+gpu_timer_scope_t::gpu_timer_scope_t(const std::string& owner)
+{
+    if (!owner.empty())
+        id = begin_gpu_timer(owner);
+}
+
+gpu_timer_scope_t::~gpu_timer_scope_t()
+{
+    if (id >= 0)
+        end_gpu_timer(id);
+}
+}
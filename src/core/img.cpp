@@ -8,17 +8,27 @@
 #include <jerror.h>
 #endif
 
+#include <wayfire/core.hpp>
+#include <wayfire/util.hpp>
+
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <functional>
 
 #define TEXTURE_LOAD_ERROR 0
 
 namespace image_io {
-    using Loader = std::function<bool(const char *, GLuint)>;
-    using Writer = std::function<void(const char *name, uint8_t *pixels, unsigned long, unsigned long)>;
+    using Loader = std::function<bool(const char *, image_t&)>;
+    using Writer = std::function<bool(const char *name, uint8_t *pixels, unsigned long, unsigned long)>;
     namespace {
         std::unordered_map<std::string, Loader> loaders;
         std::unordered_map<std::string, Writer> writers;
@@ -27,9 +37,15 @@ namespace image_io {
 #ifdef BUILD_WITH_IMAGEIO
     /* All backend functions are taken from the internet.
      * If you want to be credited, contact me */
-    bool texture_from_png(const char *filename, GLuint target)
+    bool texture_from_png(const char *filename, image_t& image)
     {
         FILE *fp = fopen(filename, "rb");
+        if (!fp)
+        {
+            LOGE("failed to read PNG file ", filename);
+            return false;
+        }
+
         int width, height;
         png_byte color_type;
         png_byte bit_depth;
@@ -79,71 +95,74 @@ namespace image_io {
 
         png_read_update_info(png, infos);
 
-        row_pointers = new png_bytep[height];
-        png_byte *data = new png_byte[height * png_get_rowbytes(png, infos)];
+        image.width = width;
+        image.height = height;
+        image.format = GL_RGBA;
+        image.pixels.resize(height * png_get_rowbytes(png, infos));
 
+        row_pointers = new png_bytep[height];
         for(int i = 0; i < height; i++)
         {
-            row_pointers[i] = data + i * png_get_rowbytes(png, infos);
+            row_pointers[i] = image.pixels.data() + i * png_get_rowbytes(png, infos);
         }
 
         png_read_image(png, row_pointers);
-        GL_CALL(glTexImage2D(target, 0, GL_RGBA, width, height, 0,
-                             GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *) data));
 
         png_destroy_read_struct(&png, &infos, NULL);
         delete[] row_pointers;
-        delete[] data;
 
         fclose(fp);
         return true;
     }
 
-    void texture_to_png(const char *name, uint8_t *pixels, int w, int h)
+    bool texture_to_png(const char *name, uint8_t *pixels, int w, int h)
     {
         png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
         if (!png)
-            return;
+            return false;
 
         png_infop infot = png_create_info_struct(png);
         if (!infot) {
             png_destroy_write_struct(&png, &infot);
-            return;
+            return false;
         }
 
         FILE *fp = fopen(name, "wb");
         if (!fp) {
             png_destroy_write_struct(&png, &infot);
-            return;
+            return false;
         }
 
-        png_init_io(png, fp);
-        png_set_IHDR(png, infot, w, h, 8 /* depth */, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
-                     PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-        png_colorp palette = (png_colorp)png_malloc(png, PNG_MAX_PALETTE_LENGTH * sizeof(png_color));
-        if (!palette) {
+        if (setjmp(png_jmpbuf(png))) {
             fclose(fp);
             png_destroy_write_struct(&png, &infot);
-            return;
+            return false;
         }
-        png_set_PLTE(png, infot, palette, PNG_MAX_PALETTE_LENGTH);
+
+        png_init_io(png, fp);
+        /* Screenshots are mostly written once and never read by wayfire, so
+         * encoding fast matters more than the size */
+        png_set_compression_level(png, 1);
+        png_set_IHDR(png, infot, w, h, 8 /* depth */, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
         png_write_info(png, infot);
         png_set_packing(png);
 
+        /* The pixels are read back from GL, with the bottom row first */
         png_bytepp rows = (png_bytepp)png_malloc(png, h * sizeof(png_bytep));
         for (int i = 0; i < h; ++i)
-            rows[i] = (png_bytep)(pixels + (h - i) * w * 4);
+            rows[i] = (png_bytep)(pixels + (h - 1 - i) * w * 4);
 
         png_write_image(png, rows);
         png_write_end(png, infot);
-        png_free(png, palette);
+        png_free(png, rows);
         png_destroy_write_struct(&png, &infot);
 
         fclose(fp);
-        delete[] rows;
+        return true;
     }
 
-    bool texture_from_jpeg(const char *FileName, GLuint target)
+    bool texture_from_jpeg(const char *FileName, image_t& image)
     {
         unsigned long data_size;
         unsigned char *rowptr[1];
@@ -163,30 +182,50 @@ namespace image_io {
 
         jpeg_stdio_src(&infot, file);
         jpeg_read_header(&infot, TRUE);
+        /* Grayscale images are expanded too */
+        infot.out_color_space = JCS_RGB;
         jpeg_start_decompress(&infot);
 
         data_size = infot.output_width * infot.output_height * 3;
 
-        jdata = new unsigned char[data_size];
+        image.width = infot.output_width;
+        image.height = infot.output_height;
+        image.format = GL_RGB;
+        image.pixels.resize(data_size);
+
+        jdata = image.pixels.data();
         while (infot.output_scanline < infot.output_height) {
             rowptr[0] = (unsigned char *)jdata +  3* infot.output_width * infot.output_scanline;
             jpeg_read_scanlines(&infot, rowptr, 1);
         }
 
         jpeg_finish_decompress(&infot);
-
-        GL_CALL(glTexImage2D(target, 0, GL_RGB,
-                infot.output_width, infot.output_height,
-                0, GL_RGB, GL_UNSIGNED_BYTE, jdata));
+        jpeg_destroy_decompress(&infot);
 
         fclose(file);
-        delete[] jdata;
-
         return true;
     }
 #endif
 
-    bool load_from_file(std::string name, GLuint target)
+    /* Uncompressed RGBA in the netpbm PAM format, for when even fast PNG
+     * compression takes too long */
+    bool texture_to_pam(const char *name, uint8_t *pixels, int w, int h)
+    {
+        FILE *fp = fopen(name, "wb");
+        if (!fp)
+            return false;
+
+        fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+            "TUPLTYPE RGB_ALPHA\nENDHDR\n", w, h);
+
+        bool ok = true;
+        for (int i = h - 1; i >= 0 && ok; i--)
+            ok = fwrite(pixels + i * w * 4, 4, w, fp) == (size_t)w;
+
+        return (fclose(fp) == 0) && ok;
+    }
+
+    bool decode_from_file(std::string name, image_t& image)
     {
         if (access(name.c_str(), F_OK) == -1) {
             if (!name.empty())
@@ -209,10 +248,297 @@ namespace image_io {
             LOGE("load_from_file() called with unsupported extension ", ext);
             return false;
         } else {
-            return it->second(name.c_str(), target);
+            return it->second(name.c_str(), image);
+        }
+    }
+
+    /* Rows have no padding, and RGB rows aren't a multiple of 4 bytes */
+    static void upload_rows(GLenum target, const image_t& image, int start,
+        int count, bool allocate)
+    {
+        size_t row_bytes = image.width * (image.format == GL_RGBA ? 4 : 3);
+        const uint8_t *data = image.pixels.data() + start * row_bytes;
+
+        GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        if (allocate)
+        {
+            GL_CALL(glTexImage2D(target, 0, image.format, image.width,
+                image.height, 0, image.format, GL_UNSIGNED_BYTE, data));
+        } else
+        {
+            GL_CALL(glTexSubImage2D(target, 0, 0, start, image.width, count,
+                image.format, GL_UNSIGNED_BYTE, data));
         }
+
+        GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
     }
 
+    bool load_from_file(std::string name, GLuint target)
+    {
+        image_t image;
+        if (!decode_from_file(name, image))
+            return false;
+
+        upload_rows(target, image, 0, image.height, true);
+        return true;
+    }
+
+    struct async_decode_t::state_t
+    {
+        std::string name;
+        callback_t callback;
+        std::atomic<bool> cancelled{false};
+        std::shared_ptr<image_t> image;
+    };
+
+    namespace
+    {
+    /**
+     * A single thread which decodes and encodes images one after another, in
+     * the order they are submitted. It wakes up the main loop through a pipe
+     * when a job is done, and the job's finish callback runs from there.
+     */
+    class image_worker_t
+    {
+      public:
+        struct job_t
+        {
+            /* Runs on the worker thread */
+            std::function<void()> run;
+            /* Runs on the main thread afterwards */
+            std::function<void()> finish;
+        };
+
+        static image_worker_t& get()
+        {
+            static image_worker_t worker;
+            return worker;
+        }
+
+        void submit(job_t job)
+        {
+            if (!thread.joinable())
+                start();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(job));
+            }
+
+            wake.notify_one();
+        }
+
+        ~image_worker_t()
+        {
+            if (!thread.joinable())
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+
+            wake.notify_one();
+            thread.join();
+        }
+
+      private:
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool quit = false;
+        std::deque<job_t> queue, finished;
+        int notify_fd[2] = {-1, -1};
+
+        void start()
+        {
+            if (pipe2(notify_fd, O_CLOEXEC | O_NONBLOCK) == 0)
+            {
+                wl_event_loop_add_fd(wf::get_core().ev_loop, notify_fd[0],
+                    WL_EVENT_READABLE, handle_finished, this);
+            } else
+            {
+                LOGE("Failed to create the image worker pipe");
+            }
+
+            thread = std::thread([=] () { worker_main(); });
+        }
+
+        void worker_main()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [&] () { return quit || !queue.empty(); });
+                if (quit)
+                    return;
+
+                auto job = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+
+                if (job.run)
+                    job.run();
+
+                lock.lock();
+                finished.push_back(std::move(job));
+                char byte = 0;
+                (void)!write(notify_fd[1], &byte, 1);
+            }
+        }
+
+        static int handle_finished(int fd, uint32_t mask, void *data)
+        {
+            auto self = (image_worker_t*)data;
+
+            char buf[64];
+            while (read(fd, buf, sizeof(buf)) > 0) {}
+
+            std::deque<job_t> done;
+            {
+                std::lock_guard<std::mutex> lock(self->mutex);
+                std::swap(done, self->finished);
+            }
+
+            for (auto& job : done)
+            {
+                if (job.finish)
+                    job.finish();
+            }
+
+            return 0;
+        }
+    };
+    }
+
+    async_decode_t::async_decode_t(std::string name, callback_t callback)
+    {
+        state = std::make_shared<state_t>();
+        state->name = name;
+        state->callback = callback;
+
+        /* The worker may still hold the state after the request is destroyed,
+         * but only the main thread ever uses the callback */
+        auto request = state;
+        image_worker_t::job_t job;
+        job.run = [request] ()
+        {
+            if (request->cancelled)
+                return;
+
+            auto image = std::make_shared<image_t>();
+            if (decode_from_file(request->name, *image))
+                request->image = std::move(image);
+        };
+
+        job.finish = [request] ()
+        {
+            if (!request->cancelled && request->callback)
+                request->callback(std::move(request->image));
+        };
+
+        image_worker_t::get().submit(std::move(job));
+    }
+
+    async_decode_t::~async_decode_t()
+    {
+        state->cancelled = true;
+        state->callback = nullptr;
+    }
+
+    class chunked_upload_t::impl
+    {
+      public:
+        /* About 4 MiB per iteration takes a few milliseconds to copy */
+        static constexpr size_t max_chunk_bytes = 4 << 20;
+
+        std::shared_ptr<image_t> image;
+        GLuint tex;
+        GLenum target;
+        std::function<void()> done;
+
+        int face = 0, row = 0;
+        wf::wl_idle_call idle_upload;
+
+        int get_face_count() const
+        {
+            return target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+        }
+
+        GLenum get_face_target(int face) const
+        {
+            return target == GL_TEXTURE_CUBE_MAP ?
+                   GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+        }
+
+        void allocate()
+        {
+            OpenGL::render_begin();
+            GL_CALL(glBindTexture(target, tex));
+            for (int i = 0; i < get_face_count(); i++)
+            {
+                GL_CALL(glTexImage2D(get_face_target(i), 0, image->format,
+                    image->width, image->height, 0, image->format,
+                    GL_UNSIGNED_BYTE, nullptr));
+            }
+
+            GL_CALL(glBindTexture(target, 0));
+            OpenGL::render_end();
+        }
+
+        void upload_next_chunk()
+        {
+            size_t row_bytes = image->width * (image->format == GL_RGBA ? 4 : 3);
+            int rows = std::max<size_t>(1, max_chunk_bytes / std::max<size_t>(row_bytes, 1));
+            rows = std::min(rows, image->height - row);
+
+            OpenGL::render_begin();
+            GL_CALL(glBindTexture(target, tex));
+            upload_rows(get_face_target(face), *image, row, rows, false);
+            GL_CALL(glBindTexture(target, 0));
+            OpenGL::render_end();
+
+            row += rows;
+            if (row >= image->height)
+            {
+                row = 0;
+                ++face;
+            }
+
+            if (face < get_face_count())
+            {
+                idle_upload.run_once();
+                return;
+            }
+
+            /* done may destroy the upload, so nothing is used after it */
+            auto callback = done;
+            callback();
+        }
+    };
+
+    chunked_upload_t::chunked_upload_t(std::shared_ptr<image_t> image,
+        GLuint tex, GLenum target, std::function<void()> done)
+        : priv(new impl())
+    {
+        priv->image = image;
+        priv->tex = tex;
+        priv->target = target;
+        priv->done = done;
+
+        priv->allocate();
+        if (image->height <= 0)
+        {
+            priv->face = priv->get_face_count();
+            priv->idle_upload.run_once([=] () { priv->done(); });
+            return;
+        }
+
+        priv->idle_upload.run_once([=] () { priv->upload_next_chunk(); });
+    }
+
+    chunked_upload_t::~chunked_upload_t() = default;
+
     void write_to_file(std::string name, uint8_t *pixels, int w, int h, std::string type)
     {
         auto it = writers.find(type);
@@ -226,6 +552,178 @@ namespace image_io {
         }
     }
 
+    void write_to_file_async(std::string name, std::vector<uint8_t> pixels,
+        int w, int h, std::string type, write_callback_t callback)
+    {
+        auto it = writers.find(type);
+        if (it == writers.end())
+        {
+            LOGE("unsupported image_writer backend ", type);
+            if (callback)
+                callback(false);
+            return;
+        }
+
+        auto writer = it->second;
+        auto data = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
+        auto result = std::make_shared<bool>(false);
+
+        image_worker_t::job_t job;
+        job.run = [=] ()
+        {
+            *result = (data->size() >= (size_t)w * h * 4) &&
+                writer(name.c_str(), data->data(), w, h);
+        };
+
+        job.finish = [=] ()
+        {
+            if (!*result)
+                LOGE("failed to write image ", name);
+            if (callback)
+                callback(*result);
+        };
+
+        image_worker_t::get().submit(std::move(job));
+    }
+
+    namespace
+    {
+    /**
+     * Framebuffer contents being copied to a pixel pack buffer by the GPU.
+     * The fences are polled with a timer, so the main thread never waits for
+     * the GPU to finish the frame.
+     */
+    struct pending_readback_t
+    {
+        GLuint pbo;
+        GLsync fence;
+        int width, height;
+        readback_callback_t callback;
+        readback_process_t process;
+    };
+
+    std::vector<pending_readback_t> pending_readbacks;
+    wl_event_source *readback_timer = nullptr;
+
+    /* Check the fences again after this many milliseconds */
+    const int readback_poll_interval = 2;
+
+    /** Pass the pixels to the callback, after processing them if needed */
+    void finish_readback(pending_readback_t readback,
+        std::vector<uint8_t> pixels)
+    {
+        if (pixels.empty() || !readback.process)
+            return readback.callback(std::move(pixels));
+
+        auto data = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
+        image_worker_t::job_t job;
+        job.run = [=, process = readback.process] () { process(*data); };
+        job.finish = [=, callback = readback.callback] ()
+        {
+            callback(std::move(*data));
+        };
+
+        image_worker_t::get().submit(std::move(job));
+    }
+
+    int poll_readbacks(void*)
+    {
+        OpenGL::render_begin();
+        std::vector<std::pair<pending_readback_t, std::vector<uint8_t>>> done;
+        auto it = pending_readbacks.begin();
+        while (it != pending_readbacks.end())
+        {
+            auto status = GL_CALL(glClientWaitSync(it->fence, 0, 0));
+            if ((status != GL_ALREADY_SIGNALED) &&
+                (status != GL_CONDITION_SATISFIED) && (status != GL_WAIT_FAILED))
+            {
+                ++it;
+                continue;
+            }
+
+            std::vector<uint8_t> pixels;
+            size_t size = (size_t)it->width * it->height * 4;
+            GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, it->pbo));
+            auto mapped = GL_CALL(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                size, GL_MAP_READ_BIT));
+            if ((status != GL_WAIT_FAILED) && mapped)
+            {
+                pixels.assign((uint8_t*)mapped, (uint8_t*)mapped + size);
+                GL_CALL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+            }
+
+            GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+            GL_CALL(glDeleteBuffers(1, &it->pbo));
+            GL_CALL(glDeleteSync(it->fence));
+
+            done.emplace_back(std::move(*it), std::move(pixels));
+            it = pending_readbacks.erase(it);
+        }
+
+        OpenGL::render_end();
+
+        /* The callbacks may start new readbacks */
+        for (auto& [readback, pixels] : done)
+            finish_readback(std::move(readback), std::move(pixels));
+
+        if (!pending_readbacks.empty())
+            wl_event_source_timer_update(readback_timer, readback_poll_interval);
+
+        return 0;
+    }
+    }
+
+    void read_framebuffer_async(GLuint fb, int x, int y, int w, int h,
+        readback_callback_t callback, readback_process_t process)
+    {
+        pending_readback_t readback;
+        readback.width = w;
+        readback.height = h;
+        readback.callback = callback;
+        readback.process = process;
+
+        OpenGL::get_state_cache().bind_framebuffer(GL_READ_FRAMEBUFFER, fb);
+        GL_CALL(glGenBuffers(1, &readback.pbo));
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo));
+        GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)w * h * 4, nullptr,
+            GL_STREAM_READ));
+        GL_CALL(glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+        readback.fence = GL_CALL(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+        /* Without a flush, the fence might never be signaled */
+        GL_CALL(glFlush());
+
+        pending_readbacks.push_back(std::move(readback));
+        if (!readback_timer)
+        {
+            readback_timer = wl_event_loop_add_timer(wf::get_core().ev_loop,
+                poll_readbacks, nullptr);
+        }
+
+        wl_event_source_timer_update(readback_timer, readback_poll_interval);
+    }
+
+    void write_framebuffer_async(GLuint fb, int x, int y, int w, int h,
+        std::string name, std::string type, write_callback_t callback)
+    {
+        OpenGL::render_begin();
+        read_framebuffer_async(fb, x, y, w, h,
+            [=] (std::vector<uint8_t> pixels)
+        {
+            if (pixels.empty())
+            {
+                LOGE("failed to read back the pixels for ", name);
+                if (callback)
+                    callback(false);
+                return;
+            }
+
+            write_to_file_async(name, std::move(pixels), w, h, type, callback);
+        });
+        OpenGL::render_end();
+    }
+
     void init()
     {
         LOGD("init ImageIO");
@@ -234,5 +732,6 @@ namespace image_io {
         loaders["jpg"] = Loader(texture_from_jpeg);
         writers["png"] = Writer(texture_to_png);
 #endif
+        writers["pam"] = Writer(texture_to_pam);
     }
 }
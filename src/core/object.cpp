@@ -1,7 +1,10 @@
 #include "wayfire/object.hpp"
 #include "wayfire/nonstd/safe-list.hpp"
+#include "wayfire/trace.hpp"
+#include "wayfire/accounting.hpp"
 #include <unordered_map>
 #include <set>
+#include <vector>
 
 /* Implementation note: because of circular dependencies between
  * signal_connection_t and signal_provider_t, the chosen way to resolve
@@ -58,13 +61,48 @@ void wf::signal_connection_t::disconnect()
         provider->disconnect_signal(this);
 }
 
+/* The table of interned signal names. IDs are indices in names. */
+namespace
+{
+struct signal_id_table_t
+{
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> names;
+
+    static signal_id_table_t& get()
+    {
+        static signal_id_table_t table;
+        return table;
+    }
+};
+}
+
+wf::signal_id_t::signal_id_t(const std::string& name)
+{
+    auto& table = signal_id_table_t::get();
+    auto it = table.ids.find(name);
+    if (it == table.ids.end())
+    {
+        it = table.ids.emplace(name, table.names.size()).first;
+        table.names.push_back(name);
+    }
+
+    this->id = it->second;
+}
+
+const std::string& wf::signal_id_t::get_name() const
+{
+    return signal_id_table_t::get().names[id];
+}
+
 class wf::signal_provider_t::sprovider_impl
 {
   public:
-    std::unordered_map<std::string,
+    /* Keyed by the signal ID, the hash of an integer is the integer itself */
+    std::unordered_map<uint32_t,
         wf::safe_list_t<signal_connection_t*>> signals;
 
-    std::unordered_map<std::string,
+    std::unordered_map<uint32_t,
         wf::safe_list_t<signal_callback_t*>> deprecated_signals;
 };
 
@@ -86,7 +124,13 @@ wf::signal_provider_t::~signal_provider_t()
 void wf::signal_provider_t::connect_signal(std::string name,
     signal_connection_t* callback)
 {
-    sprovider_priv->signals[name].push_back(callback);
+    connect_signal(signal_id_t{name}, callback);
+}
+
+void wf::signal_provider_t::connect_signal(signal_id_t signal,
+    signal_connection_t* callback)
+{
+    sprovider_priv->signals[signal.get()].push_back(callback);
     callback->priv->add(this);
 }
 
@@ -110,27 +154,60 @@ void wf::signal_provider_t::disconnect_signal(signal_connection_t* connection)
 void wf::signal_provider_t::connect_signal(std::string name,
     signal_callback_t* callback)
 {
-    sprovider_priv->deprecated_signals[name].push_back(callback);
+    connect_signal(signal_id_t{name}, callback);
+}
+
+void wf::signal_provider_t::connect_signal(signal_id_t signal,
+    signal_callback_t* callback)
+{
+    sprovider_priv->deprecated_signals[signal.get()].push_back(callback);
 }
 
 /* Deprecated: */
 void wf::signal_provider_t::disconnect_signal(std::string name,
     signal_callback_t* callback)
 {
-    sprovider_priv->deprecated_signals[name].remove_all(callback);
+    disconnect_signal(signal_id_t{name}, callback);
+}
+
+void wf::signal_provider_t::disconnect_signal(signal_id_t signal,
+    signal_callback_t* callback)
+{
+    auto it = sprovider_priv->deprecated_signals.find(signal.get());
+    if (it != sprovider_priv->deprecated_signals.end())
+        it->second.remove_all(callback);
 }
 
 /* Emit the given signal. No type checking for data is required */
 void wf::signal_provider_t::emit_signal(std::string name, wf::signal_data_t *data)
 {
-    sprovider_priv->signals[name].for_each([data] (auto call) {
-        call->emit(data);
-    });
+    emit_signal(signal_id_t{name}, data);
+}
+
+void wf::signal_provider_t::emit_signal(signal_id_t signal,
+    wf::signal_data_t *data)
+{
+    WF_TRACE_SCOPE("signal", signal.get_name());
+
+    /* Don't create empty lists for signals nobody listens to */
+    auto it = sprovider_priv->signals.find(signal.get());
+    if (it != sprovider_priv->signals.end())
+    {
+        it->second.for_each([data, signal] (auto call) {
+            accounting::scope_t scope{call->priv->callback.target_type(), signal};
+            call->emit(data);
+        });
+    }
 
     /* Deprecated: */
-    sprovider_priv->deprecated_signals[name].for_each([data] (auto call) {
-        (*call)(data);
-    });
+    auto dit = sprovider_priv->deprecated_signals.find(signal.get());
+    if (dit != sprovider_priv->deprecated_signals.end())
+    {
+        dit->second.for_each([data, signal] (auto call) {
+            accounting::scope_t scope{call->target_type(), signal};
+            (*call)(data);
+        });
+    }
 }
 
 class wf::object_base_t::obase_impl
@@ -150,6 +227,65 @@ wf::object_base_t::object_base_t()
 
 wf::object_base_t::~object_base_t()
 {
+    /* Destructors of the data may look up other data, which may be freed
+     * already, so empty the store before destroying the data. */
+    auto data = std::move(obase_priv->data);
+    obase_priv->data.clear();
+    typed_data.clear();
+}
+
+/* The names of custom data with an index, i.e used with a typed get_data. */
+namespace
+{
+struct data_name_table_t
+{
+    std::unordered_map<std::string, uint32_t> indices;
+    std::vector<std::string> names;
+
+    static data_name_table_t& get()
+    {
+        static data_name_table_t table;
+        return table;
+    }
+};
+}
+
+uint32_t wf::object_base_t::_register_data_name(const std::string& name)
+{
+    auto& table = data_name_table_t::get();
+    auto it = table.indices.find(name);
+    if (it == table.indices.end())
+    {
+        it = table.indices.emplace(name, table.names.size()).first;
+        table.names.push_back(name);
+    }
+
+    return it->second;
+}
+
+wf::custom_data_t *wf::object_base_t::_fill_typed_data(uint32_t index)
+{
+    auto& table = data_name_table_t::get();
+    while (typed_data.size() <= index)
+    {
+        auto& data = obase_priv->data;
+        auto it = data.find(table.names[typed_data.size()]);
+        typed_data.push_back(it == data.end() ? nullptr : it->second.get());
+    }
+
+    return typed_data[index];
+}
+
+void wf::object_base_t::_update_typed_data(const std::string& name)
+{
+    auto& table = data_name_table_t::get();
+    auto index = table.indices.find(name);
+    if (index == table.indices.end() || index->second >= typed_data.size())
+        return;
+
+    auto it = obase_priv->data.find(name);
+    typed_data[index->second] =
+        (it == obase_priv->data.end() ? nullptr : it->second.get());
 }
 
 std::string wf::object_base_t::to_string() const
@@ -169,18 +305,27 @@ bool wf::object_base_t::has_data(std::string name)
 
 void wf::object_base_t::erase_data(std::string name)
 {
-    obase_priv->data.erase(name);
+    /* Remove the entry before destroying the data, so that it can't be found
+     * from the destructor of the data */
+    auto data = _fetch_erase(name);
+    delete data;
 }
 
 wf::custom_data_t *wf::object_base_t::_fetch_data(std::string name)
 {
-    return obase_priv->data[name].get();
+    auto it = obase_priv->data.find(name);
+    return it == obase_priv->data.end() ? nullptr : it->second.get();
 }
 
 wf::custom_data_t *wf::object_base_t::_fetch_erase(std::string name)
 {
-    auto data = obase_priv->data[name].release();
-    erase_data(name);
+    auto it = obase_priv->data.find(name);
+    if (it == obase_priv->data.end())
+        return nullptr;
+
+    auto data = it->second.release();
+    obase_priv->data.erase(it);
+    _update_typed_data(name);
 
     return data;
 }
@@ -188,5 +333,8 @@ wf::custom_data_t *wf::object_base_t::_fetch_erase(std::string name)
 void wf::object_base_t::_store_data(std::unique_ptr<wf::custom_data_t> data,
     std::string name)
 {
+    /* Replace the old data only after it can't be found anymore */
+    auto old = std::unique_ptr<custom_data_t>(_fetch_erase(name));
     obase_priv->data[name] = std::move(data);
+    _update_typed_data(name);
 }
@@ -14,6 +14,14 @@ void fini();
 void bind_output(wf::output_t *output);
 /** Indicate the output frame has been finished */
 void unbind_output(wf::output_t *output);
+
+/** Load the options of GPU timing */
+void init_gpu_timers();
+/** Destroy the timer queries */
+void fini_gpu_timers();
+/** Read back the GPU timers which have finished, without waiting for the
+ * others */
+void collect_gpu_timers();
 }
 
 #endif /* end of include guard: WF_OPENGL_PRIV_HPP */
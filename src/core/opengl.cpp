@@ -1,9 +1,21 @@
 #include <wayfire/util/log.hpp>
+#include <wayfire/debug.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "opengl-priv.hpp"
+#include "wayfire/img.hpp"
 #include "wayfire/output.hpp"
 #include "core-impl.hpp"
 #include "config.h"
+#include <wayfire/option-wrapper.hpp>
 
 extern "C"
 {
@@ -15,7 +27,9 @@ extern "C"
 #include <wlr/types/wlr_output.h>
 }
 
+#include <EGL/egl.h>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/vec2.hpp>
 
 #include "shaders.tpp"
 
@@ -46,50 +60,557 @@ namespace OpenGL
 {
     /* Different Context is kept for each output */
     /* Each of the following functions uses the currently bound context */
-    program_t program, color_program;
-    GLuint compile_shader(std::string source, GLuint type)
+    /**
+     * The core draw functions only disable their attributes when done, and
+     * keep the program bound. If the next draw uses the same program, use()
+     * is then a no-op.
+     */
+    class program_access_t
+    {
+      public:
+        static void finish_draw(program_t& program);
+    };
+
+    program_t program, color_program, multitexture_program;
+    gl_state_cache_t state_cache;
+
+    /* How many textures render_textured_quads() binds per draw */
+    static constexpr int MAX_MULTITEXTURE_UNITS = 8;
+    int multitexture_units = 1;
+
+    gl_state_cache_t& get_state_cache()
+    {
+        return state_cache;
+    }
+
+    /**
+     * Keeps the framebuffers released by framebuffer_base_t, so that render
+     * targets which are destroyed and created again, or which switch between
+     * a few sizes, don't need a new texture each time.
+     *
+     * Framebuffers are bucketed by their exact size, because users sample
+     * the whole texture. When the pool grows above core/render_target_pool_size,
+     * the least recently released framebuffers are destroyed.
+     */
+    class render_target_pool_t
+    {
+      public:
+        wf::option_wrapper_t<int> max_size_mib;
+        render_target_pool_stats_t stats;
+
+        /**
+         * Take a framebuffer with the given size out of the pool.
+         * @return false if there is none.
+         */
+        bool acquire(int width, int height, GLuint& fb, GLuint& tex)
+        {
+            auto it = buckets.find({width, height});
+            if (it == buckets.end())
+            {
+                ++stats.misses;
+                return false;
+            }
+
+            /* Reuse the most recently released one */
+            auto entry = it->second.back();
+            it->second.pop_back();
+            if (it->second.empty())
+                buckets.erase(it);
+
+            stats.cached_bytes -= get_size(width, height);
+            ++stats.hits;
+            fb = entry.fb;
+            tex = entry.tex;
+            return true;
+        }
+
+        /** Put a framebuffer back into the pool */
+        void release(GLuint fb, GLuint tex, int width, int height)
+        {
+            buckets[{width, height}].push_back({fb, tex, ++release_counter});
+            stats.cached_bytes += get_size(width, height);
+            trim();
+        }
+
+        /** Destroy framebuffers until the pool fits in its memory cap */
+        void trim()
+        {
+            size_t max_bytes =
+                std::max(int(max_size_mib), 0) * (size_t(1) << 20);
+            while (stats.cached_bytes > max_bytes)
+            {
+                auto oldest = buckets.begin();
+                for (auto it = buckets.begin(); it != buckets.end(); ++it)
+                {
+                    if (it->second.front().released <
+                        oldest->second.front().released)
+                    {
+                        oldest = it;
+                    }
+                }
+
+                auto entry = oldest->second.front();
+                oldest->second.erase(oldest->second.begin());
+                stats.cached_bytes -=
+                    get_size(oldest->first.first, oldest->first.second);
+                if (oldest->second.empty())
+                    buckets.erase(oldest);
+
+                GL_CALL(glDeleteFramebuffers(1, &entry.fb));
+                GL_CALL(glDeleteTextures(1, &entry.tex));
+                ++stats.evictions;
+            }
+        }
+
+        /** Destroy all framebuffers in the pool */
+        void clear()
+        {
+            for (auto& bucket : buckets)
+            {
+                for (auto& entry : bucket.second)
+                {
+                    GL_CALL(glDeleteFramebuffers(1, &entry.fb));
+                    GL_CALL(glDeleteTextures(1, &entry.tex));
+                }
+            }
+
+            buckets.clear();
+            stats.cached_bytes = 0;
+        }
+
+      private:
+        struct entry_t
+        {
+            GLuint fb, tex;
+            uint64_t released;
+        };
+
+        static size_t get_size(int width, int height)
+        {
+            /* RGBA8 */
+            return size_t(width) * height * 4;
+        }
+
+        /* Ordered by release time, oldest first */
+        std::map<std::pair<int, int>, std::vector<entry_t>> buckets;
+        uint64_t release_counter = 0;
+    } render_target_pool;
+
+    render_target_pool_stats_t get_render_target_pool_stats()
+    {
+        return render_target_pool.stats;
+    }
+
+    static std::map<std::string, size_t> texture_memory_usage;
+
+    void set_texture_memory_usage(const std::string& owner, size_t bytes)
+    {
+        if (bytes == 0)
+            texture_memory_usage.erase(owner);
+        else
+            texture_memory_usage[owner] = bytes;
+    }
+
+    std::map<std::string, size_t> get_texture_memory_usage()
+    {
+        return texture_memory_usage;
+    }
+
+    /* The framebuffer bound with render_begin() or framebuffer_base_t::bind(),
+     * to know whether the color matrix applies */
+    GLuint bound_fb = 0;
+
+    /* core/minified_mipmaps, see framebuffer_base_t::get_minified_texture() */
+    wf::option_wrapper_t<bool> minified_mipmaps;
+
+    /* GLES2 allows mipmaps only for power of two sizes without the extension */
+    bool npot_mipmaps_supported()
+    {
+        static int supported = -1;
+        if (supported < 0)
+        {
+            auto version = (const char*)glGetString(GL_VERSION);
+            auto ext = (const char*)glGetString(GL_EXTENSIONS);
+            supported = (version && strstr(version, "OpenGL ES 3")) ||
+                (ext && strstr(ext, "GL_OES_texture_npot"));
+        }
+
+        return supported;
+    }
+
+    GLuint color_matrix_fb = 0;
+    glm::mat4 color_matrix{1.0};
+    float alpha_modifier = 1.0;
+
+    void set_color_matrix(GLuint target_fb, const glm::mat4& matrix)
+    {
+        color_matrix_fb = target_fb;
+        color_matrix = matrix;
+    }
+
+    void set_alpha_modifier(float alpha)
+    {
+        alpha_modifier = alpha;
+    }
+
+    float get_alpha_modifier()
+    {
+        return alpha_modifier;
+    }
+
+    /**
+     * The textured shaders premultiply the texture with the alpha of the
+     * color, so the alpha modifier goes only there.
+     */
+    static glm::vec4 modify_alpha(glm::vec4 color)
+    {
+        color.a *= alpha_modifier;
+        return color;
+    }
+
+    /** @return The color matrix for drawing to the bound framebuffer */
+    static glm::mat4 get_bound_color_matrix()
+    {
+        return bound_fb == color_matrix_fb ? color_matrix : glm::mat4(1.0);
+    }
+
+    /* Locations in the default programs, resolved once in init() */
+    struct default_handles_t
+    {
+        uniform_handle_t mvp, color, color_matrix;
+        attrib_handle_t position, uv_position;
+
+        void resolve(program_t& program)
+        {
+            mvp = program.get_uniform("MVP");
+            color = program.get_uniform("color");
+            color_matrix = program.get_uniform("color_matrix");
+            position = program.get_attrib("position");
+            uv_position = program.get_attrib("uvPosition");
+        }
+    } program_handles, color_program_handles;
+
+    /** Start compiling the shader, without waiting for the result */
+    static GLuint start_compile_shader(const std::string& source, GLuint type)
     {
         GLuint shader = GL_CALL(glCreateShader(type));
 
         const char *c_src = source.c_str();
         GL_CALL(glShaderSource(shader, 1, &c_src, NULL));
+        GL_CALL(glCompileShader(shader));
+        return shader;
+    }
 
+    /** Check the result of compiling the shader, waiting for it if needed */
+    static bool check_shader(GLuint shader, const std::string& source)
+    {
         int s;
 #define LENGTH 1024 * 128
-        char b1[LENGTH];
-        GL_CALL(glCompileShader(shader));
+        static char b1[LENGTH];
         GL_CALL(glGetShaderiv(shader, GL_COMPILE_STATUS, &s));
-        GL_CALL(glGetShaderInfoLog(shader, LENGTH, NULL, b1));
-
         if (s == GL_FALSE)
         {
+            GL_CALL(glGetShaderInfoLog(shader, LENGTH, NULL, b1));
             LOGE("Failed to load shader:\n", source,
                 "\nCompiler output:\n", b1);
-            return -1;
+            return false;
         }
 
+        return true;
+    }
+
+    GLuint compile_shader(std::string source, GLuint type)
+    {
+        auto shader = start_compile_shader(source, type);
+        if (!check_shader(shader, source))
+            return -1;
+
         return shader;
     }
 
+    /**
+     * Linked programs are stored on disk with glGetProgramBinary(), because
+     * compiling them takes long on some drivers. The files are named after a
+     * hash of the shader sources and of the driver and GPU strings, so that
+     * updating either of them doesn't load stale binaries. Drivers may still
+     * reject a binary, for ex. after an update which didn't change the
+     * version string, and then the program is compiled again.
+     */
+    namespace program_cache
+    {
+        wf::option_wrapper_t<bool> enabled;
+        const uint32_t magic = 0x42504657; // "WFPB"
+
+        bool is_supported()
+        {
+            static int formats = -1;
+            if (formats < 0)
+                GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+
+            return formats > 0 && enabled;
+        }
+
+        std::string get_directory()
+        {
+            std::string base = nonull(getenv("XDG_CACHE_HOME"));
+            if (base == "nil")
+                base = std::string(nonull(getenv("HOME"))) + "/.cache";
+
+            return base + "/wayfire/programs";
+        }
+
+        /* Create the directory and its missing parents */
+        bool create_directory(const std::string& path)
+        {
+            for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+            {
+                auto part = path.substr(0, pos);
+                if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+                    return false;
+
+                if (pos == std::string::npos)
+                    return true;
+            }
+        }
+
+        std::string get_path(const std::string& vertex_source,
+            const std::string& frag_source)
+        {
+            auto gl_string = [] (GLenum name)
+            {
+                auto str = GL_CALL(glGetString(name));
+                return std::string(str ? (const char*)str : "");
+            };
+
+            static const std::string driver = gl_string(GL_VENDOR) + '\n' +
+                gl_string(GL_RENDERER) + '\n' + gl_string(GL_VERSION);
+
+            size_t hash = std::hash<std::string>{}(
+                driver + '\0' + vertex_source + '\0' + frag_source);
+
+            std::ostringstream name;
+            name << get_directory() << "/" << std::hex << std::setfill('0')
+                 << std::setw(16) << hash << ".bin";
+            return name.str();
+        }
+
+        /** @return The loaded program, or 0 if it isn't in the cache */
+        GLuint load(const std::string& path)
+        {
+            std::ifstream file{path, std::ios::binary};
+            uint32_t file_magic = 0, format = 0;
+            if (!file.read((char*)&file_magic, sizeof(file_magic)) ||
+                !file.read((char*)&format, sizeof(format)) ||
+                (file_magic != magic))
+            {
+                return 0;
+            }
+
+            std::vector<char> binary{std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>()};
+            if (binary.empty())
+                return 0;
+
+            auto program = GL_CALL(glCreateProgram());
+            GL_CALL(glProgramBinary(program, format, binary.data(), binary.size()));
+
+            GLint status = GL_FALSE;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+            if (status != GL_TRUE)
+            {
+                LOGD("Program binary ", path, " was rejected by the driver");
+                GL_CALL(glDeleteProgram(program));
+                unlink(path.c_str());
+                return 0;
+            }
+
+            return program;
+        }
+
+        void store(GLuint program, const std::string& path)
+        {
+            GLint status = GL_FALSE, length = 0;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+            GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+            if ((status != GL_TRUE) || (length <= 0))
+                return;
+
+            std::vector<char> binary(length);
+            GLenum format;
+            GL_CALL(glGetProgramBinary(program, length, &length, &format,
+                binary.data()));
+
+            if (!create_directory(get_directory()))
+            {
+                LOGE("Failed to create the program cache at ", get_directory());
+                return;
+            }
+
+            /* Write to a temporary file first, so that other instances never
+             * read a partially written binary */
+            auto tmp_path = path + "." + std::to_string(getpid());
+            std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+            uint32_t file_format = format;
+            file.write((const char*)&magic, sizeof(magic));
+            file.write((const char*)&file_format, sizeof(file_format));
+            file.write(binary.data(), length);
+            file.close();
+
+            if (!file || (rename(tmp_path.c_str(), path.c_str()) != 0))
+                unlink(tmp_path.c_str());
+        }
+    }
+
+    /**
+     * With KHR_parallel_shader_compile, the driver compiles and links shaders
+     * in background threads until their status is queried. The status of a
+     * program is therefore checked only when it is first used, or in
+     * render_begin() once the driver reports it as complete, so that the programs
+     * of the core and of all plugins are compiled at the same time.
+     */
+    namespace parallel_compile
+    {
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+        typedef void (GL_APIENTRYP max_threads_proc_t)(GLuint count);
+
+        /* Linked programs whose status hasn't been checked yet */
+        struct pending_program_t
+        {
+            GLuint vertex_shader, fragment_shader;
+            std::string vertex_source, frag_source;
+            std::string cache_path;
+        };
+
+        std::map<GLuint, pending_program_t> pending;
+
+        bool is_supported()
+        {
+            static int supported = -1;
+            if (supported < 0)
+            {
+                auto ext = (const char*)glGetString(GL_EXTENSIONS);
+                supported = ext &&
+                    strstr(ext, "GL_KHR_parallel_shader_compile");
+
+                auto max_threads = reinterpret_cast<max_threads_proc_t> (
+                    eglGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+                if (supported && max_threads)
+                {
+                    /* Let the driver choose the number of threads */
+                    max_threads(0xffffffff);
+                }
+            }
+
+            return supported;
+        }
+
+        /** Check the result of linking the program, waiting for it if needed */
+        void finish(GLuint program)
+        {
+            auto it = pending.find(program);
+            if (it == pending.end())
+                return;
+
+            auto job = std::move(it->second);
+            pending.erase(it);
+
+            check_shader(job.vertex_shader, job.vertex_source);
+            check_shader(job.fragment_shader, job.frag_source);
+
+            GLint status = GL_FALSE;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+            if (status != GL_TRUE)
+            {
+                static char log[LENGTH];
+                GL_CALL(glGetProgramInfoLog(program, LENGTH, NULL, log));
+                LOGE("Failed to link program:\n", log);
+            }
+
+            /* won't be really deleted until program is deleted as well */
+            GL_CALL(glDeleteShader(job.vertex_shader));
+            GL_CALL(glDeleteShader(job.fragment_shader));
+
+            if ((status == GL_TRUE) && !job.cache_path.empty())
+                program_cache::store(program, job.cache_path);
+        }
+
+        /** Check the programs which the driver has finished */
+        void finish_completed()
+        {
+            if (pending.empty())
+                return;
+
+            std::vector<GLuint> completed;
+            for (auto& [program, job] : pending)
+            {
+                GLint done = GL_TRUE;
+                if (is_supported())
+                {
+                    GL_CALL(glGetProgramiv(program, GL_COMPLETION_STATUS_KHR,
+                        &done));
+                }
+
+                if (done)
+                    completed.push_back(program);
+            }
+
+            for (auto program : completed)
+                finish(program);
+        }
+
+        /** Forget the program, which is about to be deleted */
+        void discard(GLuint program)
+        {
+            auto it = pending.find(program);
+            if (it == pending.end())
+                return;
+
+            GL_CALL(glDeleteShader(it->second.vertex_shader));
+            GL_CALL(glDeleteShader(it->second.fragment_shader));
+            pending.erase(it);
+        }
+    }
+
     /* Create a very simple gl program from the given shader sources */
     GLuint compile_program(std::string vertex_source, std::string frag_source)
     {
-        auto vertex_shader = compile_shader(vertex_source, GL_VERTEX_SHADER);
-        auto fragment_shader = compile_shader(frag_source, GL_FRAGMENT_SHADER);
+        std::string cache_path;
+        if (program_cache::is_supported())
+        {
+            cache_path = program_cache::get_path(vertex_source, frag_source);
+            if (auto cached = program_cache::load(cache_path))
+                return cached;
+        }
+
+        auto vertex_shader = start_compile_shader(vertex_source, GL_VERTEX_SHADER);
+        auto fragment_shader = start_compile_shader(frag_source, GL_FRAGMENT_SHADER);
         auto result_program = GL_CALL(glCreateProgram());
         GL_CALL(glAttachShader(result_program, vertex_shader));
         GL_CALL(glAttachShader(result_program, fragment_shader));
+        if (!cache_path.empty())
+        {
+            GL_CALL(glProgramParameteri(result_program,
+                GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+        }
+
         GL_CALL(glLinkProgram(result_program));
 
-        /* won't be really deleted until program is deleted as well */
-        GL_CALL(glDeleteShader(vertex_shader));
-        GL_CALL(glDeleteShader(fragment_shader));
+        parallel_compile::pending[result_program] = {vertex_shader,
+            fragment_shader, vertex_source, frag_source, cache_path};
+        if (!parallel_compile::is_supported())
+            parallel_compile::finish(result_program);
 
         return result_program;
     }
 
     void init()
     {
+        program_cache::enabled.load_option("core/program_cache");
+        minified_mipmaps.load_option("core/minified_mipmaps");
+        init_gpu_timers();
+
         render_begin();
         // enable_gl_synchronuous_debug()
         program.compile(default_vertex_shader_source,
@@ -98,7 +619,115 @@ namespace OpenGL
         color_program.set_simple(compile_program(default_vertex_shader_source,
                 color_rect_fragment_source));
 
+        program_handles.resolve(program);
+        color_program_handles.resolve(color_program);
+
+        multitexture_program.set_simple(compile_program(
+            multitexture_vertex_source, multitexture_fragment_source));
+        multitexture_program.use(wf::TEXTURE_TYPE_RGBA);
+        for (int i = 0; i < MAX_MULTITEXTURE_UNITS; i++)
+        {
+            multitexture_program.uniform1i(
+                "textures[" + std::to_string(i) + "]", i);
+        }
+
+        multitexture_program.deactivate();
+
+        GLint units;
+        GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units));
+        multitexture_units = std::clamp(units, 1, MAX_MULTITEXTURE_UNITS);
+
         render_end();
+
+        render_target_pool.max_size_mib.load_option(
+            "core/render_target_pool_size");
+        render_target_pool.max_size_mib.set_callback([] ()
+        {
+            render_begin();
+            render_target_pool.trim();
+            render_end();
+        });
+    }
+
+    namespace
+    {
+        wf::output_t *current_output = NULL;
+
+        /**
+         * The streaming vertex buffer: data is appended to the current
+         * buffer object until it is full, then the next one is orphaned and
+         * filled from the start. Since the old buffer objects are kept,
+         * ranges stay valid even if the data of a single draw crosses buffers.
+         */
+        struct stream_buffer_t
+        {
+            static constexpr size_t DEFAULT_CAPACITY = 1 << 20;
+            static constexpr int NUM_BUFFERS = 4;
+
+            GLuint buffers[NUM_BUFFERS] = {0};
+            size_t capacity[NUM_BUFFERS] = {0};
+            int current = 0;
+            size_t offset = 0;
+
+            wf::buffer_range_t push(const void *data, size_t size)
+            {
+                if (!buffers[0])
+                {
+                    GL_CALL(glGenBuffers(NUM_BUFFERS, buffers));
+                }
+
+                GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, buffers[current]));
+                if (offset + size > capacity[current])
+                {
+                    current = (current + 1) % NUM_BUFFERS;
+                    offset = 0;
+
+                    /* Orphan the old storage, the driver keeps it alive until
+                     * pending draws are done with it */
+                    capacity[current] = std::max(DEFAULT_CAPACITY, size);
+                    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, buffers[current]));
+                    GL_CALL(glBufferData(GL_ARRAY_BUFFER, capacity[current],
+                        NULL, GL_STREAM_DRAW));
+                }
+
+                /* Nothing has used this range since the buffer was orphaned,
+                 * so there is no need to synchronize */
+                void *dst = GL_CALL(glMapBufferRange(GL_ARRAY_BUFFER, offset,
+                    size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                    GL_MAP_UNSYNCHRONIZED_BIT));
+                if (dst)
+                {
+                    std::memcpy(dst, data, size);
+                    GL_CALL(glUnmapBuffer(GL_ARRAY_BUFFER));
+                } else
+                {
+                    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, offset, size, data));
+                }
+
+                /* wlroots uses client-side arrays */
+                GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+                wf::buffer_range_t range{buffers[current], offset};
+                /* Keep the next range aligned for any vertex type */
+                offset += (size + 15) & ~(size_t)15;
+                return range;
+            }
+
+            void release()
+            {
+                if (buffers[0])
+                {
+                    GL_CALL(glDeleteBuffers(NUM_BUFFERS, buffers));
+                }
+
+                *this = stream_buffer_t{};
+            }
+        } stream_buffer;
+    }
+
+    wf::buffer_range_t stream_vertex_data(const void *data, size_t size)
+    {
+        return stream_buffer.push(data, size);
     }
 
     void fini()
@@ -106,14 +735,13 @@ namespace OpenGL
         render_begin();
         program.free_resources();
         color_program.free_resources();
+        multitexture_program.free_resources();
+        stream_buffer.release();
+        render_target_pool.clear();
+        fini_gpu_timers();
         render_end();
     }
 
-    namespace
-    {
-        wf::output_t *current_output = NULL;
-    }
-
     void bind_output(wf::output_t *output)
     {
         current_output = output;
@@ -158,16 +786,20 @@ namespace OpenGL
         }
 
         program.set_active_texture(tex);
-        program.attrib_pointer("position", 2, 0, vertexData);
-        program.attrib_pointer("uvPosition", 2, 0, coordData);
-        program.uniformMatrix4f("MVP", model);
-        program.uniform4f("color", color);
-
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        program.attrib_buffer(program_handles.position, 2, 0,
+            stream_vertex_data(vertexData, sizeof(vertexData)));
+        program.attrib_buffer(program_handles.uv_position, 2, 0,
+            stream_vertex_data(coordData, sizeof(coordData)));
+        program.uniformMatrix4f(program_handles.mvp, model);
+        program.uniform4f(program_handles.color, modify_alpha(color));
+        program.uniformMatrix4f(program_handles.color_matrix,
+            get_bound_color_matrix());
+
+        state_cache.set_blend(true);
+        state_cache.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
 
-        program.deactivate();
+        program_access_t::finish_draw(program);
     }
 
     void render_rectangle(wf::geometry_t geometry, wf::color_t color,
@@ -184,15 +816,139 @@ namespace OpenGL
             x, y,
         };
 
-        color_program.attrib_pointer("position", 2, 0, vertexData);
-        color_program.uniformMatrix4f("MVP", matrix);
-        color_program.uniform4f("color", {color.r, color.g, color.b, color.a});
+        color_program.attrib_buffer(color_program_handles.position, 2, 0,
+            stream_vertex_data(vertexData, sizeof(vertexData)));
+        color_program.uniformMatrix4f(color_program_handles.mvp, matrix);
+        color_program.uniform4f(color_program_handles.color,
+            glm::vec4(color.r, color.g, color.b, color.a) * alpha_modifier);
+        color_program.uniformMatrix4f(color_program_handles.color_matrix,
+            get_bound_color_matrix());
 
-        GL_CALL(glEnable(GL_BLEND));
-        GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        state_cache.set_blend(true);
+        state_cache.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
 
-        color_program.deactivate();
+        program_access_t::finish_draw(color_program);
+    }
+
+    bool is_minified(const textured_quad_t& quad, wf::dimensions_t target_size,
+        wf::dimensions_t texture_size)
+    {
+        auto project = [&] (float x, float y)
+        {
+            auto p = quad.transform * glm::vec4{x, y, 0.0f, 1.0f};
+            return glm::vec2{p.x, p.y} / p.w;
+        };
+
+        const auto& g = quad.geometry;
+        auto p = project(g.x1, g.y1);
+        auto u = project(g.x2, g.y1) - p;
+        auto v = project(g.x1, g.y2) - p;
+
+        /* Normalized device coordinates span 2 units for the whole viewport */
+        float drawn_area = std::abs(u.x * v.y - u.y * v.x) *
+            target_size.width * target_size.height / 4.0f;
+
+        const auto& t = quad.tex_geometry;
+        float texture_area = std::abs((t.x2 - t.x1) * (t.y2 - t.y1)) *
+            texture_size.width * texture_size.height;
+
+        /* Half of the size in each direction is a quarter of the area */
+        return std::isfinite(drawn_area) && (drawn_area * 4 < texture_area);
+    }
+
+    void render_textured_quads(const std::vector<textured_quad_t>& quads)
+    {
+        if (quads.empty())
+            return;
+
+        /* x, y, z, w, u, v, unit, r, g, b, a */
+        static constexpr int VERTEX_SIZE = 11;
+        std::vector<GLfloat> vertices;
+        vertices.reserve(quads.size() * 6 * VERTEX_SIZE);
+        for (size_t i = 0; i < quads.size(); i++)
+        {
+            const auto& quad = quads[i];
+            gl_geometry g = quad.geometry;
+            if (quad.bits & TEXTURE_TRANSFORM_INVERT_Y)
+                std::swap(g.y1, g.y2);
+            if (quad.bits & TEXTURE_TRANSFORM_INVERT_X)
+                std::swap(g.x1, g.x2);
+
+            gl_geometry texg = quad.tex_geometry;
+            if (quad.texture.invert_y)
+            {
+                texg.y1 = 1.0f - texg.y1;
+                texg.y2 = 1.0f - texg.y2;
+            }
+
+            /* The same triangles as render_batch_t */
+            const GLfloat corners[][4] = {
+                {g.x1, g.y2, texg.x1, texg.y2},
+                {g.x2, g.y2, texg.x2, texg.y2},
+                {g.x2, g.y1, texg.x2, texg.y1},
+                {g.x1, g.y2, texg.x1, texg.y2},
+                {g.x2, g.y1, texg.x2, texg.y1},
+                {g.x1, g.y1, texg.x1, texg.y1},
+            };
+
+            float unit = i % multitexture_units;
+            for (const auto& corner : corners)
+            {
+                auto pos = quad.transform *
+                    glm::vec4{corner[0], corner[1], 0.0f, 1.0f};
+                auto color = modify_alpha(quad.color);
+                vertices.insert(vertices.end(), {pos.x, pos.y, pos.z, pos.w,
+                    corner[2], corner[3], unit, color.r, color.g, color.b,
+                    color.a});
+            }
+        }
+
+        auto range = stream_vertex_data(vertices.data(),
+            vertices.size() * sizeof(GLfloat));
+        auto attrib_at = [&] (const std::string& name, int size, int offset)
+        {
+            auto attrib_range = range;
+            attrib_range.offset += offset * sizeof(GLfloat);
+            multitexture_program.attrib_buffer(name, size,
+                VERTEX_SIZE * sizeof(GLfloat), attrib_range);
+        };
+
+        multitexture_program.use(wf::TEXTURE_TYPE_RGBA);
+        attrib_at("position", 4, 0);
+        attrib_at("uvPosition", 2, 4);
+        attrib_at("unitIndex", 1, 6);
+        attrib_at("vertexColor", 4, 7);
+        multitexture_program.uniformMatrix4f("color_matrix",
+            get_bound_color_matrix());
+
+        state_cache.set_blend(true);
+        state_cache.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+        for (size_t first = 0; first < quads.size(); first += multitexture_units)
+        {
+            size_t count = std::min<size_t>(multitexture_units,
+                quads.size() - first);
+            for (size_t i = 0; i < count; i++)
+            {
+                state_cache.active_texture(GL_TEXTURE0 + i);
+                const auto& texture = quads[first + i].texture;
+                GL_CALL(glBindTexture(GL_TEXTURE_2D, texture.tex_id));
+                GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    texture.mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+            }
+
+            GL_CALL(glDrawArrays(GL_TRIANGLES, first * 6, count * 6));
+        }
+
+        int used_units = std::min<size_t>(multitexture_units, quads.size());
+        for (int i = used_units - 1; i >= 0; i--)
+        {
+            state_cache.active_texture(GL_TEXTURE0 + i);
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        }
+
+        program_access_t::finish_draw(multitexture_program);
     }
 
     void render_begin()
@@ -203,6 +959,7 @@ namespace OpenGL
 
     void render_begin(const wf::framebuffer_base_t& fb)
     {
+        fb.contents_changed();
         render_begin(fb.viewport_width, fb.viewport_height, fb.fb);
     }
 
@@ -213,25 +970,83 @@ namespace OpenGL
 
         wlr_renderer_begin(wf::get_core_impl().renderer,
             viewport_width, viewport_height);
-        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+        state_cache.invalidate();
+        state_cache.bind_framebuffer(GL_FRAMEBUFFER, fb);
+        bound_fb = fb;
+        parallel_compile::finish_completed();
     }
 
     void clear(wf::color_t col, uint32_t mask)
     {
-        GL_CALL(glClearColor(col.r, col.g, col.b, col.a));
+        auto c = get_bound_color_matrix() * glm::vec4(col.r, col.g, col.b, col.a);
+        GL_CALL(glClearColor(c.r, c.g, c.b, c.a));
         GL_CALL(glClear(mask));
     }
 
     void render_end()
     {
-        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+        state_cache.bind_framebuffer(GL_FRAMEBUFFER, 0);
+        bound_fb = 0;
         wlr_renderer_scissor(wf::get_core().renderer, NULL);
         wlr_renderer_end(wf::get_core().renderer);
+        state_cache.invalidate();
+    }
+}
+
+/* Formats which the driver can't render to, they are replaced by RGBA8 */
+static bool format_unsupported[3] = {false, false, false};
+
+/* Allocate the storage of the currently bound texture */
+static void allocate_storage(wf::framebuffer_format_t format,
+    int width, int height)
+{
+    switch (format)
+    {
+      case wf::FRAMEBUFFER_FORMAT_RGB8:
+        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
+            0, GL_RGB, GL_UNSIGNED_BYTE, 0));
+        break;
+
+      case wf::FRAMEBUFFER_FORMAT_RGB565:
+        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
+            0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 0));
+        break;
+
+      default:
+        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+        break;
     }
 }
 
 bool wf::framebuffer_base_t::allocate(int width, int height)
 {
+    if (format_unsupported[format])
+        format = FRAMEBUFFER_FORMAT_RGBA8;
+
+    auto& pool = OpenGL::render_target_pool;
+    bool format_changed = (tex != (uint32_t)-1) && (format != allocated_format);
+    if (pooled && (width != viewport_width || height != viewport_height ||
+        format_changed))
+    {
+        /* Swap for a framebuffer of the new size instead of resizing */
+        pool.release(fb, tex, viewport_width, viewport_height);
+        reset();
+    }
+
+    /* The pool only has RGBA8 buffers */
+    bool from_pool = (fb == (uint32_t)-1) && (tex == (uint32_t)-1) &&
+        (format == FRAMEBUFFER_FORMAT_RGBA8);
+    if (from_pool && pool.acquire(width, height, fb, tex))
+    {
+        pooled = true;
+        allocated_format = FRAMEBUFFER_FORMAT_RGBA8;
+        mipmaps_valid = false;
+        viewport_width = width;
+        viewport_height = height;
+        return true;
+    }
+
     bool first_allocate = false;
     if (fb == (uint32_t)-1)
     {
@@ -255,18 +1070,20 @@ bool wf::framebuffer_base_t::allocate(int width, int height)
     /* Special case: fb = 0. This occurs in the default workspace streams, we don't resize anything */
     if (fb != 0)
     {
-        if (first_allocate || width != viewport_width || height != viewport_height)
+        if (first_allocate || width != viewport_width ||
+            height != viewport_height || format_changed)
         {
             is_resize = true;
+            mipmaps_valid = false;
             GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
-            GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-                    0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+            allocate_storage(format, width, height);
+            allocated_format = format;
         }
     }
 
     if (first_allocate)
     {
-        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+        OpenGL::get_state_cache().bind_framebuffer(GL_FRAMEBUFFER, fb);
         GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
         GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
                 GL_TEXTURE_2D, tex, 0));
@@ -274,7 +1091,21 @@ bool wf::framebuffer_base_t::allocate(int width, int height)
 
     if (is_resize || first_allocate)
     {
+        OpenGL::get_state_cache().bind_framebuffer(GL_FRAMEBUFFER, fb);
         auto status = GL_CALL(glCheckFramebufferStatus(GL_FRAMEBUFFER));
+        if (status != GL_FRAMEBUFFER_COMPLETE &&
+            allocated_format != FRAMEBUFFER_FORMAT_RGBA8)
+        {
+            /* Rendering to the other formats is optional on GLES2 */
+            LOGI("Framebuffer format ", allocated_format,
+                " is not supported, using RGBA8 instead");
+            format_unsupported[allocated_format] = true;
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+            allocate_storage(FRAMEBUFFER_FORMAT_RGBA8, width, height);
+            allocated_format = format = FRAMEBUFFER_FORMAT_RGBA8;
+            status = GL_CALL(glCheckFramebufferStatus(GL_FRAMEBUFFER));
+        }
+
         if (status != GL_FRAMEBUFFER_COMPLETE)
         {
             LOGE("Failed to initialize framebuffer");
@@ -282,11 +1113,12 @@ bool wf::framebuffer_base_t::allocate(int width, int height)
         }
     }
 
+    pooled |= from_pool;
     viewport_width = width;
     viewport_height = height;
 
     GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    OpenGL::get_state_cache().bind_framebuffer(GL_FRAMEBUFFER, 0);
 
     return is_resize || first_allocate;
 }
@@ -298,6 +1130,10 @@ void wf::framebuffer_base_t::copy_state(wf::framebuffer_base_t&& other)
 
     this->fb = other.fb;
     this->tex = other.tex;
+    this->pooled = other.pooled;
+    this->format = other.format;
+    this->allocated_format = other.allocated_format;
+    this->mipmaps_valid = other.mipmaps_valid;
 
     other.reset();
 }
@@ -320,19 +1156,108 @@ wf::framebuffer_base_t& wf::framebuffer_base_t::operator = (wf::framebuffer_base
 
 void wf::framebuffer_base_t::bind() const
 {
-    GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fb));
-    GL_CALL(glViewport(0, 0, viewport_width, viewport_height));
+    auto& state = OpenGL::get_state_cache();
+    state.bind_framebuffer(GL_DRAW_FRAMEBUFFER, fb);
+    state.viewport(0, 0, viewport_width, viewport_height);
+    OpenGL::bound_fb = fb;
+    mipmaps_valid = false;
+}
+
+wf::texture_t wf::framebuffer_base_t::get_minified_texture() const
+{
+    wf::texture_t texture{tex};
+    /* fb = 0 is the output itself, see allocate() */
+    if (!OpenGL::minified_mipmaps || (tex == (uint32_t)-1) || (fb == 0) ||
+        !OpenGL::npot_mipmaps_supported())
+    {
+        return texture;
+    }
+
+    if (!mipmaps_valid)
+    {
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+        GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        mipmaps_valid = true;
+    }
+
+    texture.mipmapped = true;
+    return texture;
+}
+
+void wf::framebuffer_base_t::contents_changed() const
+{
+    mipmaps_valid = false;
+}
+
+namespace
+{
+/** Convert pixels read with glReadPixels() to the given format, in place */
+void convert_readback(std::vector<uint8_t>& pixels, int width, int height,
+    wf::readback_format_t format)
+{
+    if (format == wf::READBACK_FORMAT_RGBA_GL)
+        return;
+
+    size_t stride = (size_t)width * 4;
+    for (int i = 0; i < height / 2; i++)
+    {
+        std::swap_ranges(pixels.begin() + i * stride,
+            pixels.begin() + (i + 1) * stride,
+            pixels.begin() + (height - i - 1) * stride);
+    }
+
+    if (format == wf::READBACK_FORMAT_ARGB8888)
+    {
+        for (size_t i = 0; i < pixels.size(); i += 4)
+            std::swap(pixels[i], pixels[i + 2]);
+    }
+}
+}
+
+void wf::framebuffer_base_t::read_pixels_async(readback_callback_t callback,
+    readback_format_t format, wlr_box box) const
+{
+    if ((box.width <= 0) || (box.height <= 0))
+        box = {0, 0, viewport_width, viewport_height};
+
+    image_io::read_framebuffer_async(fb, box.x,
+        viewport_height - box.y - box.height, box.width, box.height,
+        [=] (std::vector<uint8_t> pixels)
+    {
+        if (pixels.empty())
+            return callback(nullptr);
+
+        auto result = std::make_shared<readback_t>();
+        result->width = box.width;
+        result->height = box.height;
+        result->format = format;
+        result->pixels = std::move(pixels);
+        callback(result);
+    }, [=] (std::vector<uint8_t>& pixels)
+    {
+        convert_readback(pixels, box.width, box.height, format);
+    });
 }
 
 void wf::framebuffer_base_t::scissor(wlr_box box) const
 {
-    GL_CALL(glEnable(GL_SCISSOR_TEST));
-    GL_CALL(glScissor(box.x, viewport_height - box.y - box.height,
-                      box.width, box.height));
+    auto& state = OpenGL::get_state_cache();
+    state.set_scissor_test(true);
+    state.scissor(box.x, viewport_height - box.y - box.height,
+        box.width, box.height);
 }
 
 void wf::framebuffer_base_t::release()
 {
+    if (pooled)
+    {
+        OpenGL::render_target_pool.release(fb, tex,
+            viewport_width, viewport_height);
+        reset();
+        return;
+    }
+
     if (fb != uint32_t(-1) && fb != 0)
     {
         GL_CALL(glDeleteFramebuffers(1, &fb));
@@ -346,11 +1271,44 @@ void wf::framebuffer_base_t::release()
     reset();
 }
 
+void wf::vertex_buffer_t::upload(const void *data, size_t size, GLenum target)
+{
+    if (!buffer)
+    {
+        GL_CALL(glGenBuffers(1, &buffer));
+    }
+
+    GL_CALL(glBindBuffer(target, buffer));
+    if (size > this->size)
+    {
+        GL_CALL(glBufferData(target, size, data, GL_STATIC_DRAW));
+        this->size = size;
+    } else
+    {
+        GL_CALL(glBufferSubData(target, 0, size, data));
+    }
+
+    GL_CALL(glBindBuffer(target, 0));
+}
+
+void wf::vertex_buffer_t::release()
+{
+    if (buffer)
+    {
+        GL_CALL(glDeleteBuffers(1, &buffer));
+    }
+
+    buffer = 0;
+    size = 0;
+}
+
 void wf::framebuffer_base_t::reset()
 {
     fb = -1;
     tex = -1;
     viewport_width = viewport_height = 0;
+    pooled = false;
+    mipmaps_valid = false;
 }
 
 wlr_box wf::framebuffer_t::framebuffer_box_from_damage_box(wlr_box box) const
@@ -387,6 +1345,16 @@ wlr_box wf::framebuffer_t::damage_box_from_geometry_box(wlr_box box) const
     return box;
 }
 
+wf::region_t wf::framebuffer_t::damage_region_from_geometry_region(
+    const wf::region_t& region) const
+{
+    if (scale == 1.0)
+        return region;
+
+    /* Rounds outwards, like damage_box_from_geometry_box() */
+    return region * scale;
+}
+
 wlr_box wf::framebuffer_t::framebuffer_box_from_geometry_box(wlr_box box) const
 {
     return framebuffer_box_from_damage_box(damage_box_from_geometry_box(box));
@@ -471,6 +1439,62 @@ class program_t::impl
     int id[wf::TEXTURE_TYPE_ALL];
     std::map<std::string, int> uniforms[wf::TEXTURE_TYPE_ALL];
 
+    /* The sources given to compile(). The program for each texture type is
+     * compiled from them when it is first needed. */
+    std::string vertex_source, fragment_source;
+    void compile_variant(int type);
+
+    /* The names resolved with get_uniform() and get_attrib(). Handles are
+     * indices in these lists, so that they stay valid when a program for
+     * another texture type is compiled later. */
+    std::vector<std::string> uniform_names, attrib_names;
+    std::vector<int> uniform_locs[wf::TEXTURE_TYPE_ALL];
+    std::vector<int> attrib_locs[wf::TEXTURE_TYPE_ALL];
+
+    static int register_name(std::vector<std::string>& names,
+        const std::string& name)
+    {
+        auto it = std::find(names.begin(), names.end(), name);
+        if (it != names.end())
+            return it - names.begin();
+
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    /** Resolve the locations of the names which aren't resolved yet for the
+     * program of the given type */
+    void resolve_names(int type)
+    {
+        if (!id[type])
+            return;
+
+        while (uniform_locs[type].size() < uniform_names.size())
+        {
+            auto& name = uniform_names[uniform_locs[type].size()];
+            uniform_locs[type].push_back(
+                GL_CALL(glGetUniformLocation(id[type], name.c_str())));
+        }
+
+        while (attrib_locs[type].size() < attrib_names.size())
+        {
+            auto& name = attrib_names[attrib_locs[type].size()];
+            attrib_locs[type].push_back(
+                GL_CALL(glGetAttribLocation(id[type], name.c_str())));
+        }
+    }
+
+    /** @return The location of the handle in the bound program */
+    int find_loc(const program_location_t& handle,
+        const std::vector<int> *locs)
+    {
+        auto& active = locs[active_program_idx];
+        if ((handle.index < 0) || (handle.index >= (int)active.size()))
+            return -1;
+
+        return active[handle.index];
+    }
+
     /** Find the uniform location for the currently bound program */
     int find_uniform_loc(const std::string& name)
     {
@@ -495,6 +1519,50 @@ class program_t::impl
             GL_CALL(glGetAttribLocation(id[active_program_idx], name.c_str()));
         return attribs[active_program_idx][name];
     }
+
+    /* The builtin Y-inversion uniforms, resolved after compiling */
+    uniform_handle_t y_base, y_mult;
+
+    void attrib_pointer(int loc, int size, int stride, const void *ptr,
+        GLenum type)
+    {
+        active_attrs.insert(loc);
+        GL_CALL(glEnableVertexAttribArray(loc));
+        GL_CALL(glVertexAttribPointer(loc, size, type, GL_FALSE, stride, ptr));
+    }
+
+    void attrib_buffer(int loc, int size, int stride,
+        const wf::buffer_range_t& range, GLenum type)
+    {
+        active_attrs.insert(loc);
+        GL_CALL(glEnableVertexAttribArray(loc));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, range.buffer));
+        GL_CALL(glVertexAttribPointer(loc, size, type, GL_FALSE, stride,
+            reinterpret_cast<const void*>(range.offset)));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
+
+    void attrib_divisor(int loc, int divisor)
+    {
+        active_attrs_divisors.insert(loc);
+        GL_CALL(glVertexAttribDivisor(loc, divisor));
+    }
+
+    void deactivate_attribs()
+    {
+        for (int loc : active_attrs_divisors)
+        {
+            GL_CALL(glVertexAttribDivisor(loc, 0));
+        }
+
+        for (int loc : active_attrs)
+        {
+            GL_CALL(glDisableVertexAttribArray(loc));
+        }
+
+        active_attrs_divisors.clear();
+        active_attrs.clear();
+    }
 };
 
 program_t::program_t()
@@ -509,6 +1577,8 @@ void program_t::set_simple(GLuint program_id, wf::texture_type_t type)
     free_resources();
     assert(type < wf::TEXTURE_TYPE_ALL);
     this->priv->id[type] = program_id;
+    priv->y_base = get_uniform("_wayfire_y_base");
+    priv->y_mult = get_uniform("_wayfire_y_mult");
 }
 
 program_t::~program_t() {}
@@ -538,20 +1608,35 @@ std::map<wf::texture_type_t, texture_type_builtins> builtins = {
                                     builtin_ext_external_source}},
 };
 
+void program_t::impl::compile_variant(int type)
+{
+    auto it = builtins.find((wf::texture_type_t)type);
+    if (vertex_source.empty() || (it == builtins.end()))
+        return;
+
+    auto fragment = replace_builtin_with(fragment_source,
+        builtin, it->second.builtin);
+    fragment = replace_builtin_with(fragment,
+        builtin_ext, it->second.builtin_ext);
+    id[type] = compile_program(vertex_source, fragment);
+}
+
 void program_t::compile(const std::string& vertex_source,
     const std::string& fragment_source)
 {
     free_resources();
 
-    for (const auto& program_type : builtins)
-    {
-        auto fragment = replace_builtin_with(fragment_source,
-            builtin, program_type.second.builtin);
-        fragment =  replace_builtin_with(fragment,
-            builtin_ext, program_type.second.builtin_ext);
-        this->priv->id[program_type.first] =
-            compile_program(vertex_source, fragment);
-    }
+    /* Most programs are used with only one or two texture types, so they
+     * are compiled on their first use() */
+    priv->vertex_source = vertex_source;
+    priv->fragment_source = fragment_source;
+    priv->y_base = get_uniform("_wayfire_y_base");
+    priv->y_mult = get_uniform("_wayfire_y_mult");
+
+    /* Almost all programs are used with RGBA textures. If the driver
+     * compiles in parallel, start right away instead of on the first use. */
+    if (parallel_compile::is_supported())
+        priv->compile_variant(wf::TEXTURE_TYPE_RGBA);
 }
 
 void program_t::free_resources()
@@ -560,29 +1645,68 @@ void program_t::free_resources()
     {
         if (this->priv->id[i])
         {
+            parallel_compile::discard(priv->id[i]);
             GL_CALL(glDeleteProgram(priv->id[i]));
             this->priv->id[i] = 0;
         }
+
+        /* Locations are only valid for the deleted programs */
+        priv->uniforms[i].clear();
+        priv->attribs[i].clear();
+        priv->uniform_locs[i].clear();
+        priv->attrib_locs[i].clear();
     }
+
+    priv->vertex_source.clear();
+    priv->fragment_source.clear();
+    priv->uniform_names.clear();
+    priv->attrib_names.clear();
+    priv->y_base = {};
+    priv->y_mult = {};
 }
 
 void program_t::use(wf::texture_type_t type)
 {
+    if (priv->id[type] == 0)
+        priv->compile_variant(type);
+
     if (priv->id[type] == 0)
     {
         throw std::runtime_error("program_t has no program for type "
             + std::to_string(type));
     }
 
-    GL_CALL(glUseProgram(priv->id[type]));
+    /* Names are resolved only now, because querying a program which is
+     * still being compiled waits for it */
+    parallel_compile::finish(priv->id[type]);
+    priv->resolve_names(type);
+    OpenGL::get_state_cache().use_program(priv->id[type]);
     priv->active_program_idx = type;
 }
 
 int program_t::get_program_id(wf::texture_type_t type)
 {
+    if (priv->id[type] == 0)
+        priv->compile_variant(type);
+
+    parallel_compile::finish(priv->id[type]);
     return priv->id[type];
 }
 
+uniform_handle_t program_t::get_uniform(const std::string& name)
+{
+    uniform_handle_t handle;
+    handle.index = impl::register_name(priv->uniform_names, name);
+    return handle;
+}
+
+attrib_handle_t program_t::get_attrib(const std::string& name)
+{
+    attrib_handle_t handle;
+    handle.index = impl::register_name(priv->attrib_names, name);
+    return handle;
+}
+
 void program_t::uniform1i(const std::string& name, int value)
 {
     int loc = priv->find_uniform_loc(name);
@@ -593,7 +1717,6 @@ void program_t::uniform1f(const std::string& name, float value)
 {
     int loc = priv->find_uniform_loc(name);
     GL_CALL(glUniform1f(loc, value));
-
 }
 
 void program_t::uniform2f(const std::string& name, float x, float y)
@@ -614,48 +1737,451 @@ void program_t::uniformMatrix4f(const std::string& name, const glm::mat4& value)
     GL_CALL(glUniformMatrix4fv(loc, 1, GL_FALSE, &value[0][0]));
 }
 
+void program_t::uniform1i(const uniform_handle_t& uniform, int value)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniform1i(loc, value));
+}
+
+void program_t::uniform1f(const uniform_handle_t& uniform, float value)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniform1f(loc, value));
+}
+
+void program_t::uniform2f(const uniform_handle_t& uniform, float x, float y)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniform2f(loc, x, y));
+}
+
+void program_t::uniform2fv(const uniform_handle_t& uniform,
+    const float *values, int count)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniform2fv(loc, count, values));
+}
+
+void program_t::uniform4f(const uniform_handle_t& uniform,
+    const glm::vec4& value)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniform4f(loc, value.r, value.g, value.b, value.a));
+}
+
+void program_t::uniformMatrix4f(const uniform_handle_t& uniform,
+    const glm::mat4& value)
+{
+    int loc = priv->find_loc(uniform, priv->uniform_locs);
+    GL_CALL(glUniformMatrix4fv(loc, 1, GL_FALSE, &value[0][0]));
+}
+
 void program_t::attrib_pointer(const std::string& attrib,
     int size, int stride, const void *ptr, GLenum type)
 {
-    int loc = priv->find_attrib_loc(attrib);
-    priv->active_attrs.insert(loc);
+    priv->attrib_pointer(priv->find_attrib_loc(attrib), size, stride, ptr, type);
+}
+
+void program_t::attrib_pointer(const attrib_handle_t& attrib,
+    int size, int stride, const void *ptr, GLenum type)
+{
+    priv->attrib_pointer(priv->find_loc(attrib, priv->attrib_locs),
+        size, stride, ptr, type);
+}
 
-    GL_CALL(glEnableVertexAttribArray(loc));
-    GL_CALL(glVertexAttribPointer(loc, size, type, GL_FALSE, stride, ptr));
+void program_t::attrib_buffer(const std::string& attrib, int size, int stride,
+    const wf::buffer_range_t& range, GLenum type)
+{
+    priv->attrib_buffer(priv->find_attrib_loc(attrib), size, stride, range, type);
+}
+
+void program_t::attrib_buffer(const attrib_handle_t& attrib, int size,
+    int stride, const wf::buffer_range_t& range, GLenum type)
+{
+    priv->attrib_buffer(priv->find_loc(attrib, priv->attrib_locs),
+        size, stride, range, type);
 }
 
 void program_t::attrib_divisor(const std::string& attrib, int divisor)
 {
-    int loc = priv->find_attrib_loc(attrib);
-    priv->active_attrs_divisors.insert(loc);
-    GL_CALL(glVertexAttribDivisor(loc, divisor));
+    priv->attrib_divisor(priv->find_attrib_loc(attrib), divisor);
+}
+
+void program_t::attrib_divisor(const attrib_handle_t& attrib, int divisor)
+{
+    priv->attrib_divisor(priv->find_loc(attrib, priv->attrib_locs), divisor);
 }
 
 void program_t::set_active_texture(const wf::texture_t& texture)
 {
-    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    OpenGL::get_state_cache().active_texture(GL_TEXTURE0);
     GL_CALL(glBindTexture(texture.target, texture.tex_id));
-    GL_CALL(glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER,
+        texture.mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
 
-    uniform1f("_wayfire_y_base", texture.invert_y ? 1 : 0);
-    uniform1f("_wayfire_y_mult", texture.invert_y ? -1 : 1);
+    uniform1f(priv->y_base, texture.invert_y ? 1 : 0);
+    uniform1f(priv->y_mult, texture.invert_y ? -1 : 1);
 }
 
 void program_t::deactivate()
 {
-    for (int loc : priv->active_attrs_divisors)
+    priv->deactivate_attribs();
+    auto& state = OpenGL::get_state_cache();
+    state.use_program(0);
+    state.invalidate();
+}
+
+void program_access_t::finish_draw(program_t& program)
+{
+    program.priv->deactivate_attribs();
+}
+
+}
+
+namespace OpenGL
+{
+class render_batch_t::impl
+{
+  public:
+    /** A range of vertices drawn with the same state */
+    struct draw_t
     {
-        GL_CALL(glVertexAttribDivisor(loc, 0));
+        wf::texture_t texture;
+        glm::mat4 transform;
+        glm::vec4 color;
+
+        bool scissored;
+        wlr_box scissor;
+
+        /* Interleaved x, y, u, v */
+        std::vector<GLfloat> vertices;
+    };
+
+    std::vector<draw_t> draws;
+    /* Index in draws of the first draw with the current state */
+    size_t run_start = 0;
+
+    /* Scissor boxes in GL coordinates */
+    std::vector<wlr_box> scissors;
+
+    static bool same_texture(const wf::texture_t& a, const wf::texture_t& b)
+    {
+        return a.tex_id == b.tex_id && a.target == b.target &&
+            a.type == b.type && a.invert_y == b.invert_y &&
+            a.mipmapped == b.mipmapped;
+    }
+
+    static bool same_state(const draw_t& draw, const textured_quad_t& quad)
+    {
+        return same_texture(draw.texture, quad.texture) &&
+            draw.transform == quad.transform && draw.color == quad.color;
+    }
+
+    static bool same_box(const wlr_box& a, const wlr_box& b)
+    {
+        return a.x == b.x && a.y == b.y &&
+            a.width == b.width && a.height == b.height;
+    }
+
+    /**
+     * Find the draw for the given state and scissor box, or create it.
+     *
+     * Draws with the same state which were added one after another, with the
+     * same set of scissor boxes, are looked up by their scissor box only. The
+     * boxes don't overlap, so reordering the quads inside them doesn't change
+     * the result.
+     */
+    draw_t& get_draw(const textured_quad_t& quad, const wlr_box *scissor)
+    {
+        if (run_start < draws.size() && !same_state(draws[run_start], quad))
+            run_start = draws.size();
+
+        for (size_t i = run_start; i < draws.size(); i++)
+        {
+            if (scissor ? (draws[i].scissored &&
+                same_box(draws[i].scissor, *scissor)) : !draws[i].scissored)
+            {
+                return draws[i];
+            }
+        }
+
+        draw_t draw;
+        draw.texture = quad.texture;
+        draw.transform = quad.transform;
+        draw.color = quad.color;
+        draw.scissored = scissor;
+        draw.scissor = scissor ? *scissor : wlr_box{0, 0, 0, 0};
+        draws.push_back(std::move(draw));
+
+        return draws.back();
+    }
+
+    /** Add the two triangles of the quad, g and texg are its final corners */
+    void push(const textured_quad_t& quad,
+        const gl_geometry& g, const gl_geometry& texg)
+    {
+        const GLfloat corners[] = {
+            g.x1, g.y2, texg.x1, texg.y2,
+            g.x2, g.y2, texg.x2, texg.y2,
+            g.x2, g.y1, texg.x2, texg.y1,
+            g.x1, g.y2, texg.x1, texg.y2,
+            g.x2, g.y1, texg.x2, texg.y1,
+            g.x1, g.y1, texg.x1, texg.y1,
+        };
+
+        auto add_to = [&] (draw_t& draw)
+        {
+            draw.vertices.insert(draw.vertices.end(),
+                std::begin(corners), std::end(corners));
+        };
+
+        if (scissors.empty())
+        {
+            add_to(get_draw(quad, nullptr));
+            return;
+        }
+
+        for (const auto& box : scissors)
+            add_to(get_draw(quad, &box));
+    }
+
+    /** Apply the inversion bits to the quad geometry */
+    static gl_geometry get_final_geometry(const textured_quad_t& quad)
+    {
+        gl_geometry g = quad.geometry;
+        if (quad.bits & TEXTURE_TRANSFORM_INVERT_Y)
+            std::swap(g.y1, g.y2);
+        if (quad.bits & TEXTURE_TRANSFORM_INVERT_X)
+            std::swap(g.x1, g.x2);
+
+        return g;
+    }
+};
+
+render_batch_t::render_batch_t()
+{
+    this->priv = std::make_unique<impl> ();
+}
+
+render_batch_t::~render_batch_t() { }
+
+void render_batch_t::set_scissor(const wf::framebuffer_base_t& fb,
+    const std::vector<wlr_box>& boxes)
+{
+    /* Quads added from now on can't be merged with the previous ones */
+    priv->run_start = priv->draws.size();
+    priv->scissors.clear();
+    for (auto box : boxes)
+    {
+        box.y = fb.viewport_height - box.y - box.height;
+        priv->scissors.push_back(box);
+    }
+}
+
+void render_batch_t::add(const textured_quad_t& quad)
+{
+    priv->push(quad, impl::get_final_geometry(quad), quad.tex_geometry);
+}
+
+/**
+ * Clip the segment [p1, p2] (in any order) to [c1, c2], and interpolate the
+ * texture coordinates t1, t2 at its ends accordingly.
+ *
+ * @return false if nothing is left after clipping.
+ */
+static bool clip_axis(float& p1, float& p2, float& t1, float& t2,
+    float c1, float c2)
+{
+    float lo = std::max(std::min(p1, p2), std::min(c1, c2));
+    float hi = std::min(std::max(p1, p2), std::max(c1, c2));
+    if (lo >= hi)
+        return false;
+
+    auto tex_at = [&] (float p)
+    { return t1 + (p - p1) / (p2 - p1) * (t2 - t1); };
+
+    float n1 = (p1 <= p2 ? lo : hi);
+    float n2 = (p1 <= p2 ? hi : lo);
+    float nt1 = tex_at(n1), nt2 = tex_at(n2);
+
+    p1 = n1; p2 = n2;
+    t1 = nt1; t2 = nt2;
+    return true;
+}
+
+void render_batch_t::add_clipped(const textured_quad_t& quad,
+    const gl_geometry& clip)
+{
+    auto g = impl::get_final_geometry(quad);
+    auto texg = quad.tex_geometry;
+
+    if (!clip_axis(g.x1, g.x2, texg.x1, texg.x2, clip.x1, clip.x2) ||
+        !clip_axis(g.y1, g.y2, texg.y1, texg.y2, clip.y1, clip.y2))
+    {
+        return;
+    }
+
+    priv->push(quad, g, texg);
+}
+
+void render_batch_t::flush()
+{
+    if (priv->draws.empty())
+        return;
+
+    /* Upload all vertices at once, then draw the ranges */
+    std::vector<GLfloat> vertices;
+    std::vector<GLint> first;
+    for (auto& draw : priv->draws)
+    {
+        first.push_back(vertices.size() / 4);
+        vertices.insert(vertices.end(),
+            draw.vertices.begin(), draw.vertices.end());
     }
 
-    for (int loc : priv->active_attrs)
+    auto range = stream_vertex_data(vertices.data(),
+        vertices.size() * sizeof(GLfloat));
+    auto uv_range = range;
+    uv_range.offset += 2 * sizeof(GLfloat);
+
+    auto& state = get_state_cache();
+    state.set_blend(true);
+    state.blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    const auto matrix = get_bound_color_matrix();
+    const impl::draw_t *prev = nullptr;
+    for (size_t i = 0; i < priv->draws.size(); i++)
     {
-        GL_CALL(glDisableVertexAttribArray(loc));
+        const auto& draw = priv->draws[i];
+        if (!prev || prev->texture.type != draw.texture.type)
+        {
+            /* Locations are different for each program */
+            program.use(draw.texture.type);
+            program.attrib_buffer(program_handles.position, 2,
+                4 * sizeof(GLfloat), range);
+            program.attrib_buffer(program_handles.uv_position, 2,
+                4 * sizeof(GLfloat), uv_range);
+            program.uniformMatrix4f(program_handles.color_matrix, matrix);
+            prev = nullptr;
+        }
+
+        if (!prev || !impl::same_texture(prev->texture, draw.texture))
+            program.set_active_texture(draw.texture);
+
+        if (!prev || prev->transform != draw.transform)
+            program.uniformMatrix4f(program_handles.mvp, draw.transform);
+        if (!prev || prev->color != draw.color)
+            program.uniform4f(program_handles.color, modify_alpha(draw.color));
+
+        state.set_scissor_test(draw.scissored);
+        if (draw.scissored)
+        {
+            state.scissor(draw.scissor.x, draw.scissor.y,
+                draw.scissor.width, draw.scissor.height);
+        }
+
+        GL_CALL(glDrawArrays(GL_TRIANGLES, first[i], draw.vertices.size() / 4));
+        prev = &draw;
     }
 
-    priv->active_attrs_divisors.clear();
-    priv->active_attrs.clear();
-    GL_CALL(glUseProgram(0));
+    program_access_t::finish_draw(program);
+    priv->draws.clear();
+    priv->run_start = 0;
+}
+}
+
+namespace OpenGL
+{
+void gl_state_cache_t::use_program(GLuint id)
+{
+    if (update(program, id))
+        GL_CALL(glUseProgram(id));
+}
+
+void gl_state_cache_t::set_blend(bool enabled)
+{
+    if (!update(blend, enabled))
+        return;
+
+    if (enabled)
+    {
+        GL_CALL(glEnable(GL_BLEND));
+    } else
+    {
+        GL_CALL(glDisable(GL_BLEND));
+    }
+}
+
+void gl_state_cache_t::blend_func(GLenum sfactor, GLenum dfactor)
+{
+    if (update(blend_factors, {sfactor, dfactor}))
+        GL_CALL(glBlendFunc(sfactor, dfactor));
 }
 
+void gl_state_cache_t::set_scissor_test(bool enabled)
+{
+    if (!update(scissor_test, enabled))
+        return;
+
+    if (enabled)
+    {
+        GL_CALL(glEnable(GL_SCISSOR_TEST));
+    } else
+    {
+        GL_CALL(glDisable(GL_SCISSOR_TEST));
+    }
+}
+
+void gl_state_cache_t::scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (update(scissor_box, {x, y, width, height}))
+        GL_CALL(glScissor(x, y, width, height));
+}
+
+void gl_state_cache_t::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (update(viewport_box, {x, y, width, height}))
+        GL_CALL(glViewport(x, y, width, height));
+}
+
+void gl_state_cache_t::bind_framebuffer(GLenum target, GLuint fb)
+{
+    if (target == GL_FRAMEBUFFER)
+    {
+        /* Counted as a single state change */
+        if (draw_fb == fb && read_fb == fb)
+        {
+            ++calls_skipped;
+            return;
+        }
+
+        ++calls_issued;
+        draw_fb = read_fb = fb;
+        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+        return;
+    }
+
+    auto& cached = (target == GL_READ_FRAMEBUFFER) ? read_fb : draw_fb;
+    if (update(cached, fb))
+        GL_CALL(glBindFramebuffer(target, fb));
+}
+
+void gl_state_cache_t::active_texture(GLenum unit)
+{
+    if (update(texture_unit, unit))
+        GL_CALL(glActiveTexture(unit));
+}
+
+void gl_state_cache_t::invalidate()
+{
+    program.reset();
+    blend.reset();
+    blend_factors.reset();
+    scissor_test.reset();
+    scissor_box.reset();
+    viewport_box.reset();
+    draw_fb.reset();
+    read_fb.reset();
+    texture_unit.reset();
+}
 }
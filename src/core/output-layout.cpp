@@ -10,8 +10,13 @@
 #include <sstream>
 #include <cstring>
 #include <unordered_set>
+#include <map>
+#include <tuple>
+#include <cfloat>
+#include <cmath>
 
 #include <wayfire/util/log.hpp>
+#include <wayfire/nonstd/reverse.hpp>
 
 extern "C"
 {
@@ -26,6 +31,9 @@ extern "C"
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/region.h>
 #include <wlr/types/wlr_output_management_v1.h>
 #include <wlr/render/wlr_renderer.h>
 #undef static
@@ -162,21 +170,23 @@ namespace wf
             std::reverse(views.begin(), views.end());
         }
 
-        for (auto& view : views)
-            from->workspace->remove_view(view);
-
         /* views would be empty if !to, but clang-analyzer detects null deref */
         if (to)
         {
-            for (auto& view : views)
+            /* Moving all views at once avoids updating the layers, the panels
+             * and the focus for each of them */
+            to->workspace->transfer_views(views);
+            for (auto& view : wf::reverse(views))
             {
-                view->set_output(to);
-                to->workspace->add_view(view, view->minimized ?
-                    wf::LAYER_MINIMIZED : wf::LAYER_WORKSPACE);
-                to->workspace->move_to_workspace(view,
-                    to->workspace->get_current_workspace());
-                to->focus_view(view);
+                if (!view->minimized)
+                {
+                    to->focus_view(view);
+                    break;
+                }
+            }
 
+            for (auto& view : views)
+            {
                 if (view->tiled_edges)
                     view->tile_request(view->tiled_edges);
 
@@ -231,7 +241,9 @@ namespace wf
         std::unique_ptr<wf::output_t> output;
         wl_listener_wrapper on_destroy, on_mode;
         std::shared_ptr<wf::config::option_base_t>
-            mode_opt, position_opt, scale_opt, transform_opt;
+            mode_opt, position_opt, scale_opt, transform_opt,
+            max_render_time_opt, vrr_opt, tearing_opt, max_render_fps_opt,
+            low_power_fps_opt, low_power_timeout_opt;
         const std::string default_value = "default";
 
 
@@ -263,6 +275,12 @@ namespace wf
             scale_opt = add_if_missing("scale", "1.0");
             position_opt = add_if_missing("layout", default_value);
             transform_opt = add_if_missing("transform", "normal");
+            max_render_time_opt = add_if_missing("max_render_time", "off");
+            vrr_opt = add_if_missing("vrr", "off");
+            tearing_opt = add_if_missing("allow_tearing", "false");
+            max_render_fps_opt = add_if_missing("max_render_fps", "0");
+            low_power_fps_opt = add_if_missing("low_power_fps", "0");
+            low_power_timeout_opt = add_if_missing("low_power_timeout", "60");
         }
 
         output_layout_output_t(wlr_output *handle)
@@ -271,6 +289,13 @@ namespace wf
             on_destroy.connect(&handle->events.destroy);
             initialize_config_options();
 
+            on_config_reload.set_callback([=] (wf::signal_data_t*)
+            {
+                /* The custom modes may have changed */
+                tested_states.clear();
+            });
+            get_core().connect_signal("reload-config", &on_config_reload);
+
             bool is_nested_compositor = wlr_output_is_wl(handle);
 
 #if WLR_HAS_X11_BACKEND
@@ -531,6 +556,15 @@ namespace wf
             }
         }
 
+        /**
+         * The results of test_state(), by source and mode. Only the mode can
+         * be rejected, any scale and transform is accepted. Configuration
+         * clients test the same few states over and over, for ex. on each
+         * hotplug, so the custom modes aren't reloaded each time.
+         */
+        std::map<std::tuple<int, int32_t, int32_t, int32_t>, bool> tested_states;
+        wf::signal_connection_t on_config_reload;
+
         /** Check whether the given state can be applied */
         bool test_state(const output_state_t& state)
         {
@@ -540,12 +574,21 @@ namespace wf
             if (state.source == OUTPUT_IMAGE_SOURCE_MIRROR)
                 return true;
 
+            auto key = std::make_tuple((int)state.source, state.mode.width,
+                state.mode.height, state.mode.refresh);
+            auto it = tested_states.find(key);
+            if (it != tested_states.end())
+                return it->second;
+
             /* XXX: are there more things to check? */
             refresh_custom_modes();
-            return is_mode_supported(state.mode);
+            return tested_states[key] = is_mode_supported(state.mode);
         }
 
-        /** Change the output mode */
+        /**
+         * Set the pending mode of the output. It is committed together with
+         * the rest of the state by apply_state().
+         */
         void apply_mode(const wlr_output_mode& mode)
         {
             if (handle->current_mode)
@@ -555,8 +598,6 @@ namespace wf
                     handle->current_mode->height == mode.height &&
                     handle->current_mode->refresh == mode.refresh)
                 {
-                    /* Commit the enabling of the output */
-                    wlr_output_commit(handle);
                     return;
                 }
             }
@@ -576,20 +617,171 @@ namespace wf
                 wlr_output_set_custom_mode(handle, mode.width, mode.height,
                     mode.refresh);
             }
+        }
 
-            wlr_output_commit(handle);
+        /**
+         * @return Whether applying the state would leave the output as it is,
+         *   so that a configuration which only changes the other outputs
+         *   doesn't modeset or repaint this one.
+         */
+        bool is_current_state(const output_state_t& state)
+        {
+            if ((state.source != OUTPUT_IMAGE_SOURCE_SELF) ||
+                (current_state.source != OUTPUT_IMAGE_SOURCE_SELF) ||
+                !output || !handle->enabled || !handle->current_mode)
+            {
+                return false;
+            }
+
+            return handle->current_mode->width == state.mode.width &&
+                handle->current_mode->height == state.mode.height &&
+                handle->current_mode->refresh == state.mode.refresh &&
+                handle->transform == state.transform &&
+                handle->scale == state.scale;
         }
 
         /* Mirroring implementation */
         wl_listener_wrapper on_mirrored_frame;
-        wl_listener_wrapper on_frame;
+        wl_listener_wrapper on_frame, on_mirror_damage_destroy;
         wlr_output *locked_cursors_on = NULL;
+        /* The parts of the mirror which need repainting, updated with the
+         * damage of each buffer presented by the mirrored output */
+        wlr_output_damage *mirror_damage = NULL;
+
+        /* Set while the mirror draws the cursor of the mirrored output itself,
+         * so that the mirrored output can keep its hardware cursor plane */
+        bool mirror_draws_cursor = false;
+        /* The cursor box which was last damaged, in our buffer coordinates */
+        wlr_box mirror_cursor_box = {0, 0, 0, 0};
+        wlr_texture *mirror_cursor_texture = NULL;
+        wf::signal_connection_t on_mirrored_cursor_motion;
+        wf::wl_idle_call idle_update_mirrored_cursor;
+
+        /** Damage a box of the mirror, in its buffer coordinates */
+        void damage_mirror_box(const wlr_box& box)
+        {
+            if ((box.width <= 0) || (box.height <= 0))
+                return;
+
+            wf::region_t damage{box};
+            damage.expand_edges(1);
+            wlr_region_transform(damage.to_pixman(), damage.to_pixman(),
+                handle->transform, handle->width, handle->height);
+            wlr_output_damage_add(mirror_damage, damage.to_pixman());
+        }
 
-        /** Render the output using texture as source */
-        void render_output(wlr_texture *texture)
+        /**
+         * Find the visible cursor of the mirrored output.
+         *
+         * @param box Set to the box of the cursor in our buffer coordinates.
+         * @return The texture of the cursor, or NULL if none is visible.
+         */
+        wlr_texture *get_mirrored_cursor(wlr_output *source, wlr_box& box)
         {
+            box = {0, 0, 0, 0};
+            if ((source->width <= 0) || (source->height <= 0))
+                return NULL;
+
+            wlr_output_cursor *cursor;
+            wl_list_for_each(cursor, &source->cursors, link)
+            {
+                if (!cursor->enabled || !cursor->visible)
+                    continue;
+
+                wlr_texture *texture = cursor->texture;
+                if (!texture && cursor->surface)
+                    texture = wlr_surface_get_texture(cursor->surface);
+                if (!texture)
+                    continue;
+
+                /* With a normal transform, the cursor position is in the
+                 * coordinates of the buffer we copy */
+                double sx = 1.0 * handle->width / source->width;
+                double sy = 1.0 * handle->height / source->height;
+                int x1 = std::floor((cursor->x - cursor->hotspot_x) * sx);
+                int y1 = std::floor((cursor->y - cursor->hotspot_y) * sy);
+                int x2 = std::ceil(
+                    (cursor->x - cursor->hotspot_x + cursor->width) * sx);
+                int y2 = std::ceil(
+                    (cursor->y - cursor->hotspot_y + cursor->height) * sy);
+                box = {x1, y1, x2 - x1, y2 - y1};
+                return texture;
+            }
+
+            return NULL;
+        }
+
+        /** Damage the old and the new cursor box if the cursor changed */
+        void update_mirrored_cursor()
+        {
+            auto wo = get_core().output_layout->find_output(
+                current_state.mirror_from);
+            if (!wo || !mirror_damage)
+                return;
+
+            wlr_box box;
+            auto texture = get_mirrored_cursor(wo->handle, box);
+            if ((texture == mirror_cursor_texture) && (box == mirror_cursor_box))
+                return;
+
+            damage_mirror_box(mirror_cursor_box);
+            damage_mirror_box(box);
+            mirror_cursor_box = box;
+            mirror_cursor_texture = texture;
+        }
+
+        /** Damage the mirror with the damage of a commit of the source */
+        void damage_from_mirrored(wlr_output *source)
+        {
+            if (!(source->pending.committed & WLR_OUTPUT_STATE_BUFFER))
+                return;
+
+            if (!(source->pending.committed & WLR_OUTPUT_STATE_DAMAGE) ||
+                (source->width <= 0) || (source->height <= 0))
+            {
+                wlr_output_damage_add_whole(mirror_damage);
+                return;
+            }
+
+            /* The source buffer is stretched over our buffer, so scale the
+             * damage, rounding outwards */
+            double sx = 1.0 * handle->width / source->width;
+            double sy = 1.0 * handle->height / source->height;
+            wf::region_t source_damage{&source->pending.damage};
+            wf::region_t damage;
+            for (const auto& box : source_damage)
+            {
+                int x1 = std::floor(box.x1 * sx);
+                int y1 = std::floor(box.y1 * sy);
+                int x2 = std::ceil(box.x2 * sx);
+                int y2 = std::ceil(box.y2 * sy);
+                damage |= wlr_box{x1, y1, x2 - x1, y2 - y1};
+            }
+
+            /* Filtering reads the pixels next to the damaged ones */
+            damage.expand_edges(1);
+
+            /* wlr_output_damage uses transformed coordinates */
+            wlr_region_transform(damage.to_pixman(), damage.to_pixman(),
+                handle->transform, handle->width, handle->height);
+            wlr_output_damage_add(mirror_damage, damage.to_pixman());
+        }
+
+        /**
+         * Render the damaged parts of the output using texture as source.
+         * The output must have been made current.
+         *
+         * @param damage The damage in transformed coordinates
+         */
+        void render_output(wlr_texture *texture, wlr_output *source,
+            wf::region_t& damage)
+        {
+            int w, h;
+            wlr_output_transformed_resolution(handle, &w, &h);
+            wlr_region_transform(damage.to_pixman(), damage.to_pixman(),
+                wlr_output_transform_invert(handle->transform), w, h);
+
             auto renderer = get_core().renderer;
-            wlr_output_attach_render(handle, NULL);
             wlr_renderer_begin(renderer, handle->width, handle->height);
 
             /* Project a box filling the whole screen */
@@ -601,8 +793,34 @@ namespace wf
             wlr_matrix_project_box(box, &geometry, WL_OUTPUT_TRANSFORM_NORMAL,
                 0.0, projection);
 
-            wlr_render_texture_with_matrix(renderer, texture, box, 1.0);
+            for (const auto& rect : damage)
+            {
+                wlr_box scissor = wlr_box_from_pixman_box(rect);
+                wlr_renderer_scissor(renderer, &scissor);
+                wlr_render_texture_with_matrix(renderer, texture, box, 1.0);
+            }
+
+            wlr_box cursor_box;
+            auto cursor_texture = mirror_draws_cursor ?
+                get_mirrored_cursor(source, cursor_box) : NULL;
+            if (cursor_texture)
+            {
+                float cursor_matrix[9];
+                wlr_matrix_project_box(cursor_matrix, &cursor_box,
+                    WL_OUTPUT_TRANSFORM_NORMAL, 0.0, projection);
+                for (const auto& rect : damage)
+                {
+                    wlr_box scissor = wlr_box_from_pixman_box(rect);
+                    wlr_renderer_scissor(renderer, &scissor);
+                    wlr_render_texture_with_matrix(renderer, cursor_texture,
+                        cursor_matrix, 1.0);
+                }
+            }
+
+            wlr_renderer_scissor(renderer, NULL);
             wlr_renderer_end(renderer);
+
+            wlr_output_set_damage(handle, damage.to_pixman());
             wlr_output_commit(handle);
         }
 
@@ -617,10 +835,26 @@ namespace wf
                 return;
             }
 
+            bool needs_frame;
+            wf::region_t damage;
+            if (!wlr_output_damage_attach_render(mirror_damage, &needs_frame,
+                damage.to_pixman()))
+            {
+                return;
+            }
+
+            /* The mirrored output didn't present anything new */
+            if (!needs_frame)
+            {
+                wlr_output_rollback(handle);
+                return;
+            }
+
             wlr_dmabuf_attributes attributes;
             if (!wlr_output_export_dmabuf(wo->handle, &attributes))
             {
                 LOGE("Failed reading mirrored output contents");
+                wlr_output_rollback(handle);
                 return;
             }
 
@@ -628,7 +862,7 @@ namespace wf
              * a texture from this and use it to render "our" output */
             auto texture = wlr_texture_from_dmabuf(
                 get_core().renderer, &attributes);
-            render_output(texture);
+            render_output(texture, wo->handle, damage);
 
             wlr_texture_destroy(texture);
             wlr_dmabuf_attributes_finish(&attributes);
@@ -671,22 +905,61 @@ namespace wf
                 return;
             }
 
-            /* Force software cursors on the mirrored from output.
-             * This ensures that they will be copied when reading pixels
-             * from the main plane */
-            wlr_output_lock_software_cursors(wo->handle, true);
-            locked_cursors_on = wo->handle;
+            /* The cursor is not on the main plane of the mirrored output
+             * when it is a hardware cursor. Without a transform, its position
+             * maps directly to our buffer and we draw it ourselves. Otherwise,
+             * force software cursors on the mirrored output, so that they are
+             * copied when reading pixels from the main plane. */
+            mirror_draws_cursor =
+                (wo->handle->transform == WL_OUTPUT_TRANSFORM_NORMAL);
+            if (!mirror_draws_cursor)
+            {
+                wlr_output_lock_software_cursors(wo->handle, true);
+                locked_cursors_on = wo->handle;
+            }
 
-            wlr_output_schedule_frame(handle);
+            mirror_damage = wlr_output_damage_create(handle);
+            on_mirror_damage_destroy.set_callback([=] (void*) {
+                /* Destroyed together with our output */
+                mirror_damage = NULL;
+                teardown_mirror();
+            });
+            on_mirror_damage_destroy.connect(&mirror_damage->events.destroy);
+            wlr_output_damage_add_whole(mirror_damage);
+
+            auto source = wo->handle;
             on_mirrored_frame.set_callback([=] (void*) {
-                /* The mirrored output was repainted, schedule repaint
-                 * for us as well */
-                wlr_output_schedule_frame(handle);
+                /* The mirrored output is being repainted, repaint the same
+                 * parts of our output as well */
+                damage_from_mirrored(source);
+                if (mirror_draws_cursor)
+                    update_mirrored_cursor();
             });
-            on_mirrored_frame.connect(&wo->handle->events.precommit);
+            on_mirrored_frame.connect(&source->events.precommit);
+
+            if (mirror_draws_cursor)
+            {
+                /* The hardware cursor moves without a commit of the mirrored
+                 * output. The motion signals come before the cursor is moved,
+                 * so its new position is read once the event is handled. */
+                idle_update_mirrored_cursor.set_callback([=] ()
+                {
+                    update_mirrored_cursor();
+                });
+                on_mirrored_cursor_motion.set_callback([=] (wf::signal_data_t*)
+                {
+                    idle_update_mirrored_cursor.run_once();
+                });
+
+                for (auto signal : {"pointer_motion", "pointer_motion_absolute",
+                    "tablet_axis"})
+                {
+                    get_core().connect_signal(signal, &on_mirrored_cursor_motion);
+                }
+            }
 
             on_frame.set_callback([=] (void*) { handle_frame(); });
-            on_frame.connect(&handle->events.frame);
+            on_frame.connect(&mirror_damage->events.frame);
         }
 
         void teardown_mirror()
@@ -699,6 +972,17 @@ namespace wf
 
             on_mirrored_frame.disconnect();
             on_frame.disconnect();
+            on_mirror_damage_destroy.disconnect();
+            on_mirrored_cursor_motion.disconnect();
+            idle_update_mirrored_cursor.disconnect();
+            mirror_draws_cursor = false;
+            mirror_cursor_box = {0, 0, 0, 0};
+            mirror_cursor_texture = NULL;
+            if (mirror_damage)
+            {
+                wlr_output_damage_destroy(mirror_damage);
+                mirror_damage = NULL;
+            }
         }
 
         /** Apply the given state to the output, ignoring position.
@@ -710,6 +994,13 @@ namespace wf
             if (!test_state(state))
                 return;
 
+            if (is_current_state(state))
+            {
+                /* Only the position may have changed */
+                this->current_state = state;
+                return;
+            }
+
             this->current_state = state;
 
             /* Even if output will remain mirrored, we can tear it down and set
@@ -740,9 +1031,14 @@ namespace wf
 
                 if (handle->scale != state.scale)
                     wlr_output_set_scale(handle, state.scale);
+            }
 
-                wlr_output_commit(handle);
+            /* The mode, transform and scale are committed at once, so the
+             * output is modeset only once */
+            wlr_output_commit(handle);
 
+            if (state.source & OUTPUT_IMAGE_SOURCE_SELF)
+            {
                 ensure_wayfire_output();
                 output->render->damage_whole();
                 if (!wlr_output_is_noop(handle))
@@ -781,6 +1077,25 @@ namespace wf
         bool shutdown_received = false;
         signal_callback_t on_config_reload, on_shutdown;
 
+        /* The boxes of the outputs in the layout, in the order of
+         * wlr_output_layout, rebuilt lazily after the layout changes, so that
+         * finding the output under the cursor doesn't go through wlroots */
+        struct layout_box_t
+        {
+            wlr_output *handle;
+            wlr_box box;
+        };
+
+        std::vector<layout_box_t> layout_boxes;
+        bool layout_boxes_dirty = true;
+        /* Index of the box found by the last lookup. The cursor is usually on
+         * the same output as in the last event, so it is checked first. */
+        size_t last_hit = 0;
+        /* Whether some of the boxes overlap. In that case the first box in
+         * wlroots order wins, so last_hit can't be used as a shortcut. */
+        bool layout_boxes_overlap = false;
+        wl_listener_wrapper on_layout_change;
+
         public:
         impl(wlr_backend *backend)
         {
@@ -790,6 +1105,10 @@ namespace wf
             on_new_output.connect(&backend->events.new_output);
 
             output_layout = wlr_output_layout_create();
+            on_layout_change.set_callback([=] (void*) {
+                layout_boxes_dirty = true;
+            });
+            on_layout_change.connect(&output_layout->events.change);
 
             on_config_reload = [=] (void*) { reconfigure_from_config(); };
             get_core().connect_signal("reload-config", &on_config_reload);
@@ -1131,7 +1450,12 @@ namespace wf
 
         /* Public API functions */
         wlr_output_layout *get_handle() { return output_layout; }
-        size_t get_num_outputs() { return get_outputs().size(); }
+        size_t get_num_outputs()
+        {
+            size_t count = 0;
+            for_each_output([&] (wf::output_t*) { ++count; });
+            return count;
+        }
 
         wf::output_t *find_output(wlr_output *output)
         {
@@ -1161,19 +1485,27 @@ namespace wf
         std::vector<wf::output_t*> get_outputs()
         {
             std::vector<wf::output_t*> result;
+            for_each_output([&] (wf::output_t *output) {
+                result.push_back(output);
+            });
+
+            return result;
+        }
+
+        void for_each_output(const std::function<void(wf::output_t*)>& callback)
+        {
+            bool found = false;
             for (auto& entry : outputs)
             {
                 if (entry.second->current_state.source & OUTPUT_IMAGE_SOURCE_SELF)
-                    result.push_back(entry.second->output.get());
-            }
-
-            if (result.empty())
-            {
-                if (noop_output && noop_output->output)
-                    result.push_back(noop_output->output.get());
+                {
+                    found = true;
+                    callback(entry.second->output.get());
+                }
             }
 
-            return result;
+            if (!found && noop_output && noop_output->output)
+                callback(noop_output->output.get());
         }
 
         wf::output_t *get_next_output(wf::output_t *output)
@@ -1188,21 +1520,98 @@ namespace wf
             }
         }
 
+        void update_layout_boxes()
+        {
+            if (!layout_boxes_dirty)
+                return;
+
+            layout_boxes.clear();
+            wlr_output_layout_output *l_output;
+            wl_list_for_each(l_output, &output_layout->outputs, link)
+            {
+                auto box = wlr_output_layout_get_box(output_layout,
+                    l_output->output);
+                if (box)
+                    layout_boxes.push_back({l_output->output, *box});
+            }
+
+            layout_boxes_overlap = false;
+            for (size_t i = 0; i < layout_boxes.size(); i++)
+            {
+                for (size_t j = i + 1; j < layout_boxes.size(); j++)
+                {
+                    if (layout_boxes[i].box & layout_boxes[j].box)
+                        layout_boxes_overlap = true;
+                }
+            }
+
+            last_hit = 0;
+            layout_boxes_dirty = false;
+        }
+
+        /** @return The index of the first box containing the point, or
+         * layout_boxes.size() if there is no such box. Like
+         * wlr_output_layout_output_at(), overlapping boxes are resolved in
+         * wlroots order. */
+        size_t find_layout_box(const wf::pointf_t& point)
+        {
+            if (!layout_boxes_overlap && last_hit < layout_boxes.size() &&
+                wlr_box_contains_point(&layout_boxes[last_hit].box,
+                    point.x, point.y))
+            {
+                return last_hit;
+            }
+
+            for (size_t i = 0; i < layout_boxes.size(); i++)
+            {
+                if (wlr_box_contains_point(&layout_boxes[i].box,
+                    point.x, point.y))
+                {
+                    last_hit = i;
+                    return i;
+                }
+            }
+
+            return layout_boxes.size();
+        }
+
         wf::output_t *get_output_coords_at(const wf::pointf_t& origin, wf::pointf_t& closest)
         {
-            wlr_output_layout_closest_point(output_layout, NULL,
-                origin.x, origin.y, &closest.x, &closest.y);
+            update_layout_boxes();
+
+            closest = origin;
+            size_t index = find_layout_box(origin);
+            if (index == layout_boxes.size())
+            {
+                /* Same as wlr_output_layout_closest_point() */
+                double min_distance = DBL_MAX;
+                for (auto& entry : layout_boxes)
+                {
+                    wf::pointf_t point;
+                    wlr_box_closest_point(&entry.box, origin.x, origin.y,
+                        &point.x, &point.y);
+                    double distance = (point.x - origin.x) * (point.x - origin.x) +
+                        (point.y - origin.y) * (point.y - origin.y);
+                    if (distance < min_distance)
+                    {
+                        min_distance = distance;
+                        closest = point;
+                    }
+                }
 
-            auto handle = wlr_output_layout_output_at(output_layout, closest.x, closest.y);
-            assert(handle || shutdown_received);
-            if (!handle)
+                index = find_layout_box(closest);
+            }
+
+            assert(index < layout_boxes.size() || shutdown_received);
+            if (index == layout_boxes.size())
                 return nullptr;
 
-            if (noop_output && handle == noop_output->handle) {
+            auto handle = layout_boxes[index].handle;
+            if (noop_output && handle == noop_output->handle)
                 return noop_output->output.get();
-            } else {
-                return outputs[handle]->output.get();
-            }
+
+            auto it = outputs.find(handle);
+            return it == outputs.end() ? nullptr : it->second->output.get();
         }
 
         wf::output_t *get_output_at(int x, int y)
@@ -1235,6 +1644,9 @@ namespace wf
     { return pimpl->get_num_outputs(); }
     std::vector<wf::output_t*> output_layout_t::get_outputs()
     { return pimpl->get_outputs(); }
+    void output_layout_t::for_each_output(
+        const std::function<void(wf::output_t*)>& callback)
+    { pimpl->for_each_output(callback); }
     wf::output_t *output_layout_t::get_next_output(wf::output_t *output)
     { return pimpl->get_next_output(output); }
     wf::output_t *output_layout_t::find_output(wlr_output *output)
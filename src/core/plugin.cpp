@@ -45,6 +45,18 @@ bool wf::plugin_grab_interface_t::is_grabbed()
 }
 
 void wf::plugin_interface_t::fini() {}
+
+void wf::plugin_interface_t::ensure_resources()
+{
+    if (resources_initialized)
+        return;
+
+    /* Set first, so that activating the plugin from init_resources() doesn't
+     * recurse */
+    resources_initialized = true;
+    init_resources();
+}
+
 wf::plugin_interface_t::~plugin_interface_t() {}
 
 wayfire_view get_signaled_view(wf::signal_data_t *data)
@@ -0,0 +1,220 @@
+#include "binding-index.hpp"
+#include <algorithm>
+#include <cassert>
+#include <unordered_set>
+
+wf::binding_index_t::binding_index_t(const binding_container_t& bindings) :
+    bindings(bindings)
+{
+    on_option_updated = [=] ()
+    {
+        dirty = true;
+    };
+}
+
+wf::binding_index_t::~binding_index_t()
+{
+    unwatch_options();
+}
+
+void wf::binding_index_t::set_dirty()
+{
+    dirty = true;
+}
+
+uint64_t wf::binding_index_t::get_key(wf_binding_type type,
+    uint32_t mods, uint32_t code)
+{
+    return ((uint64_t)type << 56) | ((uint64_t)(mods & 0xffffff) << 32) | code;
+}
+
+void wf::binding_index_t::unwatch_options()
+{
+    for (auto& option : watched_options)
+        option->rem_updated_handler(&on_option_updated);
+
+    watched_options.clear();
+}
+
+void wf::binding_index_t::update()
+{
+    if (!dirty)
+        return;
+
+    by_key.clear();
+    activators.clear();
+    gestures.clear();
+    gesture_fingers.clear();
+    key_filters.clear();
+
+    /* Several bindings may share an option, watch each option once */
+    unwatch_options();
+    std::unordered_set<wf::config::option_base_t*> watched;
+
+    for (auto& [type, container] : bindings)
+    {
+        for (auto& binding : container)
+        {
+            if (watched.insert(binding->value.get()).second)
+            {
+                binding->value->add_updated_handler(&on_option_updated);
+                watched_options.push_back(binding->value);
+            }
+
+            switch (type)
+            {
+                case WF_BINDING_KEY:
+                case WF_BINDING_AXIS:
+                case WF_BINDING_TOUCH:
+                {
+                    auto as_key = std::dynamic_pointer_cast<
+                        wf::config::option_t<wf::keybinding_t>> (binding->value);
+                    assert(as_key);
+
+                    auto value = as_key->get_value();
+                    auto key =
+                        get_key(type, value.get_modifiers(), value.get_key());
+                    by_key[key].push_back(binding.get());
+                    break;
+                }
+
+                case WF_BINDING_BUTTON:
+                {
+                    auto as_button = std::dynamic_pointer_cast<
+                        wf::config::option_t<wf::buttonbinding_t>> (
+                        binding->value);
+                    assert(as_button);
+
+                    auto value = as_button->get_value();
+                    auto key =
+                        get_key(type, value.get_modifiers(), value.get_button());
+                    by_key[key].push_back(binding.get());
+                    break;
+                }
+
+                case WF_BINDING_GESTURE:
+                {
+                    auto as_gesture = std::dynamic_pointer_cast<
+                        wf::config::option_t<wf::touchgesture_t>> (
+                        binding->value);
+                    assert(as_gesture);
+
+                    gestures.push_back({binding.get(), as_gesture->get_value()});
+                    break;
+                }
+
+                case WF_BINDING_ACTIVATOR:
+                {
+                    auto as_activator = std::dynamic_pointer_cast<
+                        wf::config::option_t<wf::activatorbinding_t>> (
+                        binding->value);
+                    assert(as_activator);
+
+                    activators.push_back(
+                        {binding.get(), as_activator->get_value()});
+                    break;
+                }
+            }
+        }
+    }
+
+    dirty = false;
+}
+
+void wf::binding_index_t::find_bindings(wf_binding_type type, uint32_t mods,
+    uint32_t code, wf::output_t *output, binding_matches_t& result)
+{
+    update();
+    auto it = by_key.find(get_key(type, mods, code));
+    if (it == by_key.end())
+        return;
+
+    for (auto binding : it->second)
+    {
+        if (binding->output == output)
+            result.push_back({type, binding->call});
+    }
+}
+
+bool wf::binding_index_t::has_key_bindings(uint32_t mods, uint32_t key)
+{
+    update();
+    if (key >= KEY_CNT)
+        return true;
+
+    auto& filter = key_filters[mods];
+    if (!filter.known[key])
+    {
+        wf::keybinding_t binding{mods, key};
+        bool found = by_key.count(get_key(WF_BINDING_KEY, mods, key)) ||
+            std::any_of(activators.begin(), activators.end(),
+                [&] (const activator_entry_t& entry)
+        {
+            return entry.value.has_match(binding);
+        });
+
+        filter.known[key] = true;
+        filter.found[key] = found;
+    }
+
+    return filter.found[key];
+}
+
+void wf::binding_index_t::find_gestures(const wf::touchgesture_t& gesture,
+    wf::output_t *output, binding_matches_t& result)
+{
+    update();
+    for (auto& entry : gestures)
+    {
+        if (entry.binding->output == output && entry.value == gesture)
+            result.push_back({WF_BINDING_GESTURE, entry.binding->call});
+    }
+}
+
+bool wf::binding_index_t::has_gesture_bindings(int fingers)
+{
+    update();
+    auto it = gesture_fingers.find(fingers);
+    if (it != gesture_fingers.end())
+        return it->second;
+
+    bool found = std::any_of(gestures.begin(), gestures.end(),
+        [=] (const gesture_entry_t& entry)
+    {
+        return entry.value.get_finger_count() == fingers;
+    });
+
+    /* The gestures of activators can't be listed, so try all gestures
+     * the recognizer can emit */
+    static const uint32_t swipe_directions[] = {
+        wf::GESTURE_DIRECTION_LEFT, wf::GESTURE_DIRECTION_RIGHT,
+        wf::GESTURE_DIRECTION_UP, wf::GESTURE_DIRECTION_DOWN,
+        wf::GESTURE_DIRECTION_LEFT | wf::GESTURE_DIRECTION_UP,
+        wf::GESTURE_DIRECTION_LEFT | wf::GESTURE_DIRECTION_DOWN,
+        wf::GESTURE_DIRECTION_RIGHT | wf::GESTURE_DIRECTION_UP,
+        wf::GESTURE_DIRECTION_RIGHT | wf::GESTURE_DIRECTION_DOWN,
+    };
+
+    std::vector<wf::touchgesture_t> candidates = {
+        {wf::GESTURE_TYPE_PINCH, wf::GESTURE_DIRECTION_IN, fingers},
+        {wf::GESTURE_TYPE_PINCH, wf::GESTURE_DIRECTION_OUT, fingers},
+    };
+
+    for (auto direction : swipe_directions)
+    {
+        candidates.push_back({wf::GESTURE_TYPE_SWIPE, direction, fingers});
+        candidates.push_back({wf::GESTURE_TYPE_EDGE_SWIPE, direction, fingers});
+    }
+
+    for (auto& entry : activators)
+    {
+        for (auto& gesture : candidates)
+            found |= entry.value.has_match(gesture);
+
+        if (found)
+            break;
+    }
+
+    gesture_fingers[fingers] = found;
+    return found;
+}
@@ -0,0 +1,206 @@
+#ifndef WF_SEAT_BINDING_INDEX_HPP
+#define WF_SEAT_BINDING_INDEX_HPP
+
+#include <wayfire/bindings.hpp>
+#include <wayfire/option-wrapper.hpp>
+
+#include <linux/input-event-codes.h>
+
+#include <array>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace wf
+{
+class output_t;
+}
+
+enum wf_binding_type
+{
+    WF_BINDING_KEY,
+    WF_BINDING_BUTTON,
+    WF_BINDING_AXIS,
+    WF_BINDING_TOUCH,
+    WF_BINDING_GESTURE,
+    WF_BINDING_ACTIVATOR
+};
+
+struct wf::binding_t
+{
+    std::shared_ptr<wf::config::option_base_t> value;
+    wf_binding_type type;
+    wf::output_t *output;
+
+    union {
+        void *raw;
+        wf::key_callback *key;
+        wf::axis_callback *axis;
+        wf::touch_callback *touch;
+        wf::button_callback *button;
+        wf::gesture_callback *gesture;
+        wf::activator_callback *activator;
+    } call;
+};
+
+using wf_binding_ptr = std::unique_ptr<wf::binding_t>;
+
+namespace wf
+{
+/**
+ * A binding which matched an input event.
+ *
+ * The callback is copied out of the binding, because the binding may be
+ * removed by the callback of another binding matching the same event.
+ */
+struct binding_match_t
+{
+    wf_binding_type type;
+    decltype(wf::binding_t::call) call;
+};
+
+/**
+ * The bindings matching an input event. The first few are stored inline,
+ * so that handling an event doesn't allocate.
+ */
+class binding_matches_t
+{
+  public:
+    void push_back(const binding_match_t& match)
+    {
+        if (count < inline_matches.size())
+            inline_matches[count] = match;
+        else
+            overflow.push_back(match);
+
+        ++count;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const binding_match_t& operator [](size_t i) const
+    {
+        return i < inline_matches.size() ?
+               inline_matches[i] : overflow[i - inline_matches.size()];
+    }
+
+  private:
+    std::array<binding_match_t, 8> inline_matches;
+    std::vector<binding_match_t> overflow;
+    size_t count = 0;
+};
+
+/**
+ * An index of all bindings by the modifiers and key, button or gesture which
+ * trigger them, so that input events don't need to look at every binding.
+ *
+ * The values of the options are read when the index is built, and it is
+ * rebuilt whenever a binding is added or removed, or one of the options
+ * changes, for ex. after the config file is reloaded.
+ */
+class binding_index_t
+{
+  public:
+    using binding_container_t =
+        std::map<wf_binding_type, std::vector<std::unique_ptr<wf::binding_t>>>;
+
+    binding_index_t(const binding_container_t& bindings);
+    ~binding_index_t();
+
+    binding_index_t(const binding_index_t&) = delete;
+    binding_index_t& operator =(const binding_index_t&) = delete;
+
+    /** Rebuild the index before the next lookup */
+    void set_dirty();
+
+    /**
+     * Find the key, button, axis or touch bindings of the output for the given
+     * modifiers and key or button. Axis and touch bindings have no key, so
+     * code should be 0 for them.
+     */
+    void find_bindings(wf_binding_type type, uint32_t mods, uint32_t code,
+        wf::output_t *output, binding_matches_t& result);
+
+    /**
+     * @return Whether any key or activator binding of any output may match
+     *   the given modifiers and key. The result is cached until the index is
+     *   rebuilt, so that keys without bindings, i.e. ordinary typing, don't
+     *   have to look at the activators.
+     */
+    bool has_key_bindings(uint32_t mods, uint32_t key);
+
+    /** Find the gesture bindings of the output for the given gesture */
+    void find_gestures(const wf::touchgesture_t& gesture,
+        wf::output_t *output, binding_matches_t& result);
+
+    /**
+     * @return Whether any gesture with the given number of fingers matches
+     *   a gesture or activator binding of any output.
+     */
+    bool has_gesture_bindings(int fingers);
+
+    /** Find the activator bindings of the output which match the binding. */
+    template<class Binding>
+    void find_activators(const Binding& binding, wf::output_t *output,
+        binding_matches_t& result)
+    {
+        update();
+        for (auto& entry : activators)
+        {
+            if (entry.binding->output == output && entry.value.has_match(binding))
+                result.push_back({WF_BINDING_ACTIVATOR, entry.binding->call});
+        }
+    }
+
+  private:
+    const binding_container_t& bindings;
+    bool dirty = true;
+
+    /* Key, button, axis and touch bindings by their type and key */
+    std::unordered_map<uint64_t, std::vector<wf::binding_t*>> by_key;
+
+    /* Activators can't be split into their keys, so they are only stored
+     * with a copy of their value, to avoid re-reading the option */
+    struct activator_entry_t
+    {
+        wf::binding_t *binding;
+        wf::activatorbinding_t value;
+    };
+
+    std::vector<activator_entry_t> activators;
+
+    struct gesture_entry_t
+    {
+        wf::binding_t *binding;
+        wf::touchgesture_t value;
+    };
+
+    std::vector<gesture_entry_t> gestures;
+
+    /* Results of has_gesture_bindings(), by number of fingers */
+    std::unordered_map<int, bool> gesture_fingers;
+
+    /* Results of has_key_bindings(), by modifiers, for the keys which have
+     * been looked up so far */
+    struct key_filter_t
+    {
+        std::bitset<KEY_CNT> known;
+        std::bitset<KEY_CNT> found;
+    };
+
+    std::unordered_map<uint32_t, key_filter_t> key_filters;
+
+    /* The options whose updated handler is on_option_updated */
+    std::vector<std::shared_ptr<wf::config::option_base_t>> watched_options;
+    wf::config::option_base_t::updated_callback_t on_option_updated;
+
+    static uint64_t get_key(wf_binding_type type, uint32_t mods, uint32_t code);
+    void update();
+    void unwatch_options();
+};
+}
+
+#endif /* end of include guard: WF_SEAT_BINDING_INDEX_HPP */
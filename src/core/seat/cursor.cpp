@@ -2,12 +2,16 @@
 #include "touch.hpp"
 #include "../core-impl.hpp"
 #include "input-manager.hpp"
+#include "input-latency.hpp"
 #include "wayfire/workspace-manager.hpp"
 #include "wayfire/debug.hpp"
 #include "wayfire/compositor-surface.hpp"
 #include "wayfire/output-layout.hpp"
 #include "tablet.hpp"
 #include "wayfire/signal-definitions.hpp"
+#include "wayfire/trace.hpp"
+
+#include <algorithm>
 
 extern "C" {
 #include <wlr/util/region.h>
@@ -28,45 +32,73 @@ wf_cursor::wf_cursor()
     setup_listeners();
     init_xcursor();
 
-    config_reloaded = [=] (wf::signal_data_t*) {
-        init_xcursor();
+    config_reloaded = [=] (wf::signal_data_t *data) {
+        auto ev = static_cast<wf::reload_config_signal*>(data);
+        if (ev->section_changed("input"))
+            init_xcursor();
     };
 
     wf::get_core().connect_signal("reload-config", &config_reloaded);
-}
-
-void wf_cursor::setup_listeners()
-{
-    auto& core = wf::get_core_impl();
 
-    /* Dispatch pointer events to the LogicalPointer */
-    on_frame.set_callback([&] (void *) {
-        core.input->lpointer->handle_pointer_frame();
-        wlr_idle_notify_activity(core.protocols.idle,
-            core.get_current_seat());
+    /* New outputs or new scales likely need the theme at another scale,
+     * it is loaded before the cursor enters them */
+    idle_load_scales.set_callback([=] () { load_output_scales(); });
+    on_layout_changed.set_callback([=] (wf::signal_data_t*)
+    {
+        idle_load_scales.run_once();
     });
-    on_frame.connect(&cursor->events.frame);
+    wf::get_core().output_layout->connect_signal("configuration-changed",
+        &on_layout_changed);
+    idle_load_scales.run_once();
+}
 
-#define setup_passthrough_callback(evname) \
-    on_##evname.set_callback([&] (void *data) { \
-        auto ev = static_cast<wlr_event_pointer_##evname *> (data); \
-        emit_device_event_signal("pointer_" #evname, ev); \
+#define define_passthrough_handler(evname) \
+    void wf_cursor::handle_##evname(wlr_event_pointer_##evname *ev) \
+    { \
+        WF_TRACE_SCOPE("input", "pointer_" #evname); \
+        static const wf::signal_id_t signal{"pointer_" #evname}; \
+        auto& core = wf::get_core_impl(); \
+        wf::input_latency_tracker_t::get().add_event(ev->device, \
+            ev->time_msec); \
+        emit_device_event_signal(signal, ev); \
         core.input->lpointer->handle_pointer_##evname (ev); \
         wlr_idle_notify_activity(core.protocols.idle, core.get_current_seat()); \
-    }); \
-    on_##evname.connect(&cursor->events.evname);
-
-    setup_passthrough_callback(button);
-    setup_passthrough_callback(motion);
-    setup_passthrough_callback(motion_absolute);
-    setup_passthrough_callback(axis);
-    setup_passthrough_callback(swipe_begin);
-    setup_passthrough_callback(swipe_update);
-    setup_passthrough_callback(swipe_end);
-    setup_passthrough_callback(pinch_begin);
-    setup_passthrough_callback(pinch_update);
-    setup_passthrough_callback(pinch_end);
-#undef setup_passthrough_callback
+    }
+
+define_passthrough_handler(button);
+define_passthrough_handler(motion);
+define_passthrough_handler(motion_absolute);
+define_passthrough_handler(axis);
+define_passthrough_handler(swipe_begin);
+define_passthrough_handler(swipe_update);
+define_passthrough_handler(swipe_end);
+define_passthrough_handler(pinch_begin);
+define_passthrough_handler(pinch_update);
+define_passthrough_handler(pinch_end);
+#undef define_passthrough_handler
+
+void wf_cursor::handle_frame(wlr_cursor*)
+{
+    auto& core = wf::get_core_impl();
+    core.input->lpointer->handle_pointer_frame();
+    wlr_idle_notify_activity(core.protocols.idle, core.get_current_seat());
+}
+
+void wf_cursor::setup_listeners()
+{
+    /* The pointer events are emitted for every motion of the pointer, so
+     * they are bound directly to their handlers */
+    on_frame.connect(this, &cursor->events.frame);
+    on_button.connect(this, &cursor->events.button);
+    on_motion.connect(this, &cursor->events.motion);
+    on_motion_absolute.connect(this, &cursor->events.motion_absolute);
+    on_axis.connect(this, &cursor->events.axis);
+    on_swipe_begin.connect(this, &cursor->events.swipe_begin);
+    on_swipe_update.connect(this, &cursor->events.swipe_update);
+    on_swipe_end.connect(this, &cursor->events.swipe_end);
+    on_pinch_begin.connect(this, &cursor->events.pinch_begin);
+    on_pinch_update.connect(this, &cursor->events.pinch_update);
+    on_pinch_end.connect(this, &cursor->events.pinch_end);
 
     /**
      * All tablet events are directly sent to the tablet device, it should
@@ -74,8 +106,9 @@ void wf_cursor::setup_listeners()
      */
 #define setup_tablet_callback(evname) \
     on_tablet_##evname.set_callback([&] (void *data) { \
+        static const wf::signal_id_t signal{"tablet_" #evname}; \
         auto ev = static_cast<wlr_event_tablet_tool_##evname *> (data); \
-        emit_device_event_signal("tablet_" #evname, ev); \
+        emit_device_event_signal(signal, ev); \
         if (ev->device->tablet->data) { \
             auto tablet = \
                 static_cast<wf::tablet_t*> (ev->device->tablet->data); \
@@ -99,15 +132,73 @@ void wf_cursor::init_xcursor()
     int size = wf::option_wrapper_t<int> ("input/cursor_size");
     auto theme_ptr = (theme == "default") ? NULL : theme.c_str();
 
+    if (xcursor && (theme == xcursor_theme) && (size == xcursor_size))
+        return;
+
     if (xcursor)
         wlr_xcursor_manager_destroy(xcursor);
 
     xcursor = wlr_xcursor_manager_create(theme_ptr, size);
+    xcursor_theme = theme;
+    xcursor_size = size;
+    xcursor_scales.clear();
+    named_cursors.clear();
+
     wlr_xcursor_manager_load(xcursor, 1);
+    xcursor_scales.insert(1);
+    load_output_scales();
 
+    current_cursor.clear();
     set_cursor("default");
 }
 
+void wf_cursor::load_output_scales()
+{
+    bool loaded = false;
+    for (auto& wo : wf::get_core().output_layout->get_outputs())
+    {
+        float scale = wo->handle->scale;
+        if (xcursor_scales.count(scale))
+            continue;
+
+        wlr_xcursor_manager_load(xcursor, scale);
+        xcursor_scales.insert(scale);
+        loaded = true;
+    }
+
+    if (!loaded)
+        return;
+
+    named_cursors.clear();
+    if (!current_cursor.empty())
+    {
+        /* Add the images of the new scales to the cursor */
+        auto name = current_cursor;
+        current_cursor.clear();
+        set_cursor(name);
+    }
+}
+
+const wf_cursor::cursor_images_t& wf_cursor::get_named_cursor(
+    const std::string& name)
+{
+    auto it = named_cursors.find(name);
+    if (it != named_cursors.end())
+        return it->second;
+
+    /* Same lookup as wlr_xcursor_manager_set_cursor_image() */
+    auto& images = named_cursors[name];
+    wlr_xcursor_manager_theme *theme;
+    wl_list_for_each(theme, &xcursor->scaled_themes, link)
+    {
+        auto xc = wlr_xcursor_theme_get_cursor(theme->theme, name.c_str());
+        if (xc && (xc->image_count > 0))
+            images.push_back({theme->scale, xc->images[0]});
+    }
+
+    return images;
+}
+
 void wf_cursor::attach_device(wlr_input_device *device)
 {
     wlr_cursor_attach_input_device(cursor, device);
@@ -123,12 +214,153 @@ void wf_cursor::set_cursor(std::string name)
     if (name == "default")
         name = "left_ptr";
 
-    wlr_xcursor_manager_set_cursor_image(xcursor, name.c_str(), cursor);
+    /* Plugins set the same cursor on each motion event, for ex. while
+     * resizing, and setting an image uploads it again to each output */
+    if (name == current_cursor)
+        return;
+
+    apply_named_cursor(name);
+    current_cursor = name;
+    if (drag_icon_scale || wf::get_core_impl().input->drag_icon)
+        update_drag_icon_image();
+}
+
+void wf_cursor::apply_named_cursor(const std::string& name)
+{
+    for (auto& [scale, image] : get_named_cursor(name))
+    {
+        wlr_cursor_set_image(cursor, image->buffer, image->width * 4,
+            image->width, image->height, image->hotspot_x, image->hotspot_y,
+            scale);
+    }
+}
+
+/* The cursor plane size of most DRM drivers. Bigger images are drawn as
+ * software cursors by wlroots, which is no cheaper than drawing the icon. */
+static constexpr int DRAG_ICON_MAX_CURSOR_SIZE = 64;
+
+float wf_cursor::compose_drag_icon_image(wlr_drag_icon *icon)
+{
+    /* Only a single shm buffer following the pointer can be read back */
+    auto surface = icon->surface;
+    if ((icon->drag->grab_type == WLR_DRAG_GRAB_KEYBOARD_TOUCH) ||
+        !wl_list_empty(&surface->subsurfaces) ||
+        !surface->buffer || !surface->buffer->resource)
+    {
+        return 0;
+    }
+
+    auto shm = wl_shm_buffer_get(surface->buffer->resource);
+    if (!shm)
+        return 0;
+
+    auto format = wl_shm_buffer_get_format(shm);
+    if ((format != WL_SHM_FORMAT_ARGB8888) && (format != WL_SHM_FORMAT_XRGB8888))
+        return 0;
+
+    float scale = surface->current.scale;
+    wlr_xcursor_image *image = NULL;
+    for (auto& [image_scale, scaled_image] : get_named_cursor(current_cursor))
+    {
+        if (image_scale == scale)
+            image = scaled_image;
+    }
+
+    if (!image)
+        return 0;
+
+    /* In buffer pixels, relative to the hotspot */
+    wlr_box cursor_box = {-(int)image->hotspot_x, -(int)image->hotspot_y,
+        (int)image->width, (int)image->height};
+    wlr_box icon_box = {(int)(surface->sx * scale), (int)(surface->sy * scale),
+        wl_shm_buffer_get_width(shm), wl_shm_buffer_get_height(shm)};
+
+    int x1 = std::min(cursor_box.x, icon_box.x);
+    int y1 = std::min(cursor_box.y, icon_box.y);
+    int x2 = std::max(cursor_box.x + cursor_box.width, icon_box.x + icon_box.width);
+    int y2 = std::max(cursor_box.y + cursor_box.height,
+        icon_box.y + icon_box.height);
+    int width = x2 - x1, height = y2 - y1;
+    if ((width > DRAG_ICON_MAX_CURSOR_SIZE) ||
+        (height > DRAG_ICON_MAX_CURSOR_SIZE))
+    {
+        return 0;
+    }
+
+    /* Both are premultiplied 32-bit ARGB, like the cursor plane */
+    drag_icon_image.assign(width * height, 0);
+    wl_shm_buffer_begin_access(shm);
+    auto data = static_cast<const uint8_t*>(wl_shm_buffer_get_data(shm));
+    int stride = wl_shm_buffer_get_stride(shm);
+    uint32_t opaque = (format == WL_SHM_FORMAT_XRGB8888) ? 0xff000000 : 0;
+    for (int y = 0; y < icon_box.height; y++)
+    {
+        auto row = reinterpret_cast<const uint32_t*>(data + y * stride);
+        auto dst = &drag_icon_image[(icon_box.y - y1 + y) * width +
+            icon_box.x - x1];
+        for (int x = 0; x < icon_box.width; x++)
+            dst[x] = row[x] | opaque;
+    }
+
+    wl_shm_buffer_end_access(shm);
+
+    /* The cursor goes on top of the icon */
+    auto pixels = reinterpret_cast<const uint32_t*>(image->buffer);
+    for (int y = 0; y < cursor_box.height; y++)
+    {
+        auto dst = &drag_icon_image[(cursor_box.y - y1 + y) * width +
+            cursor_box.x - x1];
+        for (int x = 0; x < cursor_box.width; x++)
+        {
+            uint32_t src = pixels[y * cursor_box.width + x];
+            uint32_t keep = 255 - (src >> 24);
+            uint32_t result = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                uint32_t channel = ((src >> shift) & 0xff) +
+                    ((dst[x] >> shift) & 0xff) * keep / 255;
+                result |= std::min(channel, 255u) << shift;
+            }
+
+            dst[x] = result;
+        }
+    }
+
+    wlr_cursor_set_image(cursor,
+        reinterpret_cast<const uint8_t*>(drag_icon_image.data()), width * 4,
+        width, height, -x1, -y1, scale);
+
+    return scale;
+}
+
+void wf_cursor::update_drag_icon_image()
+{
+    auto& drag_icon = wf::get_core_impl().input->drag_icon;
+    float scale = 0;
+    if (drag_icon && drag_icon->is_mapped() && !current_cursor.empty())
+        scale = compose_drag_icon_image(drag_icon->icon);
+
+    if (scale == drag_icon_scale)
+        return;
+
+    if (!scale && !current_cursor.empty())
+        apply_named_cursor(current_cursor);
+
+    /* Repaint the icon on the outputs which start or stop drawing it */
+    drag_icon_scale = 0;
+    if (drag_icon && drag_icon->is_mapped())
+        drag_icon->damage();
+
+    drag_icon_scale = scale;
+    if (!scale)
+        drag_icon_image.clear();
 }
 
 void wf_cursor::hide_cursor()
 {
     wlr_cursor_set_surface(cursor, NULL, 0, 0);
+    current_cursor.clear();
+    update_drag_icon_image();
 }
 
 void wf_cursor::warp_cursor(wf::pointf_t point)
@@ -156,6 +388,8 @@ void wf_cursor::set_cursor(wlr_seat_pointer_request_set_cursor_event *ev,
     {
         wlr_cursor_set_surface(cursor, ev->surface,
             ev->hotspot_x, ev->hotspot_y);
+        current_cursor.clear();
+        update_drag_icon_image();
     }
 }
 
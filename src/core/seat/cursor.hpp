@@ -4,10 +4,17 @@
 #include "seat.hpp"
 #include "wayfire/plugin.hpp"
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 extern "C"
 {
 #include <wlr/types/wlr_xcursor_manager.h>
+#include <wlr/xcursor.h>
 #include <wlr/types/wlr_pointer_gestures_v1.h>
+#include <wlr/types/wlr_pointer.h>
 }
 
 
@@ -37,19 +44,82 @@ struct wf_cursor
 
     void setup_listeners();
 
-    wf::wl_listener_wrapper on_button, on_motion, on_motion_absolute, on_axis,
+    /**
+     * Load the cursor theme at the scales of all enabled outputs which it
+     * isn't loaded at yet.
+     */
+    void load_output_scales();
+
+    /* Pointer events are dispatched to the LogicalPointer */
+    void handle_button(wlr_event_pointer_button *ev);
+    void handle_motion(wlr_event_pointer_motion *ev);
+    void handle_motion_absolute(wlr_event_pointer_motion_absolute *ev);
+    void handle_axis(wlr_event_pointer_axis *ev);
+    void handle_swipe_begin(wlr_event_pointer_swipe_begin *ev);
+    void handle_swipe_update(wlr_event_pointer_swipe_update *ev);
+    void handle_swipe_end(wlr_event_pointer_swipe_end *ev);
+    void handle_pinch_begin(wlr_event_pointer_pinch_begin *ev);
+    void handle_pinch_update(wlr_event_pointer_pinch_update *ev);
+    void handle_pinch_end(wlr_event_pointer_pinch_end *ev);
+    void handle_frame(wlr_cursor *cursor);
 
-                            on_swipe_begin, on_swipe_update, on_swipe_end,
-                            on_pinch_begin, on_pinch_update, on_pinch_end,
+    wf::wl_listener_member<&wf_cursor::handle_button> on_button;
+    wf::wl_listener_member<&wf_cursor::handle_motion> on_motion;
+    wf::wl_listener_member<&wf_cursor::handle_motion_absolute>
+    on_motion_absolute;
+    wf::wl_listener_member<&wf_cursor::handle_axis> on_axis;
+    wf::wl_listener_member<&wf_cursor::handle_swipe_begin> on_swipe_begin;
+    wf::wl_listener_member<&wf_cursor::handle_swipe_update> on_swipe_update;
+    wf::wl_listener_member<&wf_cursor::handle_swipe_end> on_swipe_end;
+    wf::wl_listener_member<&wf_cursor::handle_pinch_begin> on_pinch_begin;
+    wf::wl_listener_member<&wf_cursor::handle_pinch_update> on_pinch_update;
+    wf::wl_listener_member<&wf_cursor::handle_pinch_end> on_pinch_end;
+    wf::wl_listener_member<&wf_cursor::handle_frame> on_frame;
 
-                            on_tablet_tip, on_tablet_axis,
-                            on_tablet_button, on_tablet_proximity,
-                            on_frame;
+    wf::wl_listener_wrapper on_tablet_tip, on_tablet_axis,
+                            on_tablet_button, on_tablet_proximity;
 
     wf::signal_callback_t config_reloaded;
+    wf::signal_connection_t on_layout_changed;
+    wf::wl_idle_call idle_load_scales;
 
     wlr_cursor *cursor = NULL;
     wlr_xcursor_manager *xcursor = NULL;
+
+    /* The theme and size which xcursor was created with, it is recreated
+     * only when they change */
+    std::string xcursor_theme;
+    int xcursor_size = 0;
+    std::set<float> xcursor_scales;
+
+    /* The images of a named cursor at each loaded scale */
+    using cursor_images_t = std::vector<std::pair<float, wlr_xcursor_image*>>;
+    /* Filled on demand, cleared when the loaded scales change */
+    std::map<std::string, cursor_images_t> named_cursors;
+
+    /* The named cursor which is shown, empty if a client surface or nothing
+     * is shown instead */
+    std::string current_cursor;
+
+    const cursor_images_t& get_named_cursor(const std::string& name);
+    /** Set the images of the named cursor, without the drag icon */
+    void apply_named_cursor(const std::string& name);
+
+    /* The scale of the outputs whose cursor image also shows the drag icon,
+     * 0 if the drag icon is drawn by the outputs */
+    float drag_icon_scale = 0;
+    /* The cursor image together with the drag icon */
+    std::vector<uint32_t> drag_icon_image;
+
+    /**
+     * Put the drag icon into the image of the named cursor, so that the
+     * outputs can keep it on the cursor plane instead of drawing it, or take
+     * it out again. Called when the cursor or the drag icon change.
+     */
+    void update_drag_icon_image();
+
+    /** @return The scale of the composed image, or 0 if it can't be */
+    float compose_drag_icon_image(wlr_drag_icon *icon);
 };
 
 #endif /* end of include guard: CURSOR_HPP */
@@ -0,0 +1,103 @@
+#include "input-index.hpp"
+#include "../../view/view-impl.hpp"
+#include <wayfire/output.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/util.hpp>
+#include <algorithm>
+#include <cmath>
+
+static const char *stacking_signals[] = {
+    "map-view", "unmap-view", "view-disappeared", "view-restacked",
+    "layer-attach-view", "layer-detach-view", "viewport-changed",
+    "output-configuration-changed",
+};
+
+wf::input_index_t::input_index_t(wf::output_t *output)
+{
+    this->output = output;
+    on_stacking_changed = [=] (wf::signal_data_t*)
+    {
+        dirty = true;
+    };
+
+    for (auto signal : stacking_signals)
+        output->connect_signal(signal, &on_stacking_changed);
+}
+
+wf::input_index_t::~input_index_t()
+{
+    for (auto signal : stacking_signals)
+        output->disconnect_signal(signal, &on_stacking_changed);
+}
+
+int wf::input_index_t::get_cell_index(int x, int y) const
+{
+    int cx = (int64_t)(x - grid_box.x) * GRID_SIZE / grid_box.width;
+    int cy = (int64_t)(y - grid_box.y) * GRID_SIZE / grid_box.height;
+    cx = wf::clamp(cx, 0, GRID_SIZE - 1);
+    cy = wf::clamp(cy, 0, GRID_SIZE - 1);
+
+    return cy * GRID_SIZE + cx;
+}
+
+void wf::input_index_t::rebuild()
+{
+    entries.clear();
+    for (auto& cell : cells)
+        cell.clear();
+
+    grid_box = output->get_relative_geometry();
+    if (grid_box.width <= 0 || grid_box.height <= 0)
+        return;
+
+    output->workspace->for_each_view(wf::VISIBLE_LAYERS, [&] (wayfire_view v)
+    {
+        v->for_each_view([&] (wayfire_view view)
+        {
+            if (!view->is_mapped())
+                return;
+
+            auto bbox = view->get_bounding_box();
+            auto visible = wf::geometry_intersection(bbox, grid_box);
+            if (visible.width <= 0 || visible.height <= 0)
+                return;
+
+            uint32_t index = entries.size();
+            entries.push_back({view, bbox});
+
+            int first = get_cell_index(visible.x, visible.y);
+            int last = get_cell_index(visible.x + visible.width - 1,
+                visible.y + visible.height - 1);
+            for (int y = first / GRID_SIZE; y <= last / GRID_SIZE; y++)
+            {
+                for (int x = first % GRID_SIZE; x <= last % GRID_SIZE; x++)
+                    cells[y * GRID_SIZE + x].push_back(index);
+            }
+        });
+    });
+
+    dirty = false;
+}
+
+void wf::input_index_t::find_views_at(wf::pointf_t point,
+    const std::function<bool(wayfire_view)>& callback)
+{
+    /* Views move, resize and get transformed without telling the output, but
+     * all of these changes advance the view scene epoch */
+    uint64_t epoch = wf::get_view_scene_epoch();
+    if (dirty || epoch != built_at_epoch)
+    {
+        rebuild();
+        built_at_epoch = epoch;
+    }
+
+    if (entries.empty())
+        return;
+
+    auto& cell = cells[get_cell_index(std::floor(point.x), std::floor(point.y))];
+    for (auto index : cell)
+    {
+        if ((entries[index].bbox & point) && callback(entries[index].view))
+            return;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef WF_SEAT_INPUT_INDEX_HPP
+#define WF_SEAT_INPUT_INDEX_HPP
+
+#include <wayfire/object.hpp>
+#include <wayfire/view.hpp>
+#include <functional>
+#include <vector>
+
+namespace wf
+{
+/**
+ * A uniform grid over an output, which stores for each cell the views whose
+ * bounding box intersects the cell, in stacking order. It is used to find the
+ * candidates for input hit testing without visiting every view.
+ *
+ * The index is rebuilt lazily when views are restacked, mapped or unmapped,
+ * and when the view scene epoch changes, i.e. when views moved, resized or
+ * got transformed, even if the output wasn't repainted since then.
+ */
+class input_index_t : public wf::custom_data_t
+{
+  public:
+    input_index_t(wf::output_t *output);
+    ~input_index_t();
+
+    /**
+     * Call the callback for each view whose bounding box contains the given
+     * point in output-local coordinates, from the topmost to the bottommost,
+     * until the callback returns true.
+     */
+    void find_views_at(wf::pointf_t point,
+        const std::function<bool(wayfire_view)>& callback);
+
+  private:
+    /* The grid has GRID_SIZE x GRID_SIZE cells covering the output */
+    static constexpr int GRID_SIZE = 8;
+
+    struct entry_t
+    {
+        wayfire_view view;
+        wf::geometry_t bbox;
+    };
+
+    wf::output_t *output;
+    std::vector<entry_t> entries;
+    /* Indices into entries, ascending, i.e in stacking order */
+    std::vector<uint32_t> cells[GRID_SIZE * GRID_SIZE];
+    wf::geometry_t grid_box;
+
+    bool dirty = true;
+    uint64_t built_at_epoch = 0;
+
+    wf::signal_callback_t on_stacking_changed;
+
+    void rebuild();
+    int get_cell_index(int x, int y) const;
+};
+}
+
+#endif /* end of include guard: WF_SEAT_INPUT_INDEX_HPP */
@@ -0,0 +1,68 @@
+#include "input-latency.hpp"
+#include <wayfire/util.hpp>
+
+extern "C"
+{
+#include <wlr/types/wlr_input_device.h>
+}
+
+/* Events which weren't followed by damage for this long most likely didn't
+ * cause any, for ex. pointer motion shown only by a hardware cursor */
+static constexpr uint32_t MAX_PENDING_MSEC = 1000;
+
+wf::input_latency_tracker_t& wf::input_latency_tracker_t::get()
+{
+    static input_latency_tracker_t tracker;
+    return tracker;
+}
+
+void wf::input_latency_tracker_t::add_event(wlr_input_device *device,
+    uint32_t time_msec)
+{
+    /* The event times come from the devices, so they aren't used for this */
+    last_event_time = wf::get_current_time();
+
+    auto it = pending.find(device);
+    if (it != pending.end())
+    {
+        /* Keep the oldest event, unless it has expired */
+        if (time_msec - it->second.time_msec > MAX_PENDING_MSEC)
+            it->second.time_msec = time_msec;
+
+        return;
+    }
+
+    pending.emplace(device,
+        event_t{device->name ? device->name : "unknown", time_msec});
+}
+
+void wf::input_latency_tracker_t::take_events(uint32_t until_msec,
+    std::vector<event_t>& result)
+{
+    auto it = pending.begin();
+    while (it != pending.end())
+    {
+        /* The times wrap around, so compare the difference */
+        int32_t age = until_msec - it->second.time_msec;
+        if (age < 0)
+        {
+            ++it;
+            continue;
+        }
+
+        if (age <= (int32_t)MAX_PENDING_MSEC)
+            result.push_back(std::move(it->second));
+
+        it = pending.erase(it);
+    }
+}
+
+uint32_t wf::input_latency_tracker_t::get_last_event_time() const
+{
+    return last_event_time;
+}
+
+void wf::input_latency_tracker_t::remove_device(wlr_input_device *device)
+{
+    pending.erase(device);
+}
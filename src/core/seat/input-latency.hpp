@@ -0,0 +1,63 @@
+#ifndef WF_SEAT_INPUT_LATENCY_HPP
+#define WF_SEAT_INPUT_LATENCY_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C"
+{
+struct wlr_input_device;
+}
+
+namespace wf
+{
+/**
+ * Keeps the input events which are not shown on screen yet, for measuring
+ * the latency from input to presentation.
+ *
+ * For each device, only the oldest event since the last repaint which
+ * claimed events is kept. A repaint claims the events which happened before
+ * the last damage of its output, and reports their latency when its frame is
+ * presented. Whether the damage was caused by the event is not known, so this
+ * is an estimate of how long input takes to show up on screen.
+ */
+class input_latency_tracker_t
+{
+  public:
+    struct event_t
+    {
+        std::string device;
+        /* The time of the event, CLOCK_MONOTONIC in milliseconds */
+        uint32_t time_msec;
+    };
+
+    static input_latency_tracker_t& get();
+
+    /** Record an event from the given device */
+    void add_event(wlr_input_device *device, uint32_t time_msec);
+
+    /**
+     * Move the events which happened at or before the given time to result.
+     * Events which are too old are dropped.
+     */
+    void take_events(uint32_t until_msec, std::vector<event_t>& result);
+
+    /**
+     * @return The time of the last event from any device, from
+     *   wf::get_current_time(), or 0 if there was none yet.
+     */
+    uint32_t get_last_event_time() const;
+
+    /** Drop the events of a device which is being destroyed */
+    void remove_device(wlr_input_device *device);
+
+  private:
+    input_latency_tracker_t() = default;
+    std::unordered_map<wlr_input_device*, event_t> pending;
+    uint32_t last_event_time = 0;
+};
+}
+
+#endif /* end of include guard: WF_SEAT_INPUT_LATENCY_HPP */
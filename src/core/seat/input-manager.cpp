@@ -9,6 +9,7 @@ extern "C"
 
 #include "wayfire/signal-definitions.hpp"
 #include "../core-impl.hpp"
+#include "input-latency.hpp"
 #include "../../output/output-impl.hpp"
 #include "touch.hpp"
 #include "keyboard.hpp"
@@ -22,6 +23,8 @@ extern "C"
 #include "switch.hpp"
 #include "tablet.hpp"
 #include "pointing-device.hpp"
+#include "input-index.hpp"
+#include "../../view/view-impl.hpp"
 
 bool input_manager::is_touch_enabled()
 {
@@ -41,6 +44,18 @@ void input_manager::update_capabilities()
     wlr_seat_set_capabilities(seat, cap);
 }
 
+void input_manager::schedule_seat_update()
+{
+    idle_update_seat.run_once([=] ()
+    {
+        update_capabilities();
+        if (added_keyboard)
+            wlr_seat_set_keyboard(seat, added_keyboard);
+
+        added_keyboard = nullptr;
+    });
+}
+
 static std::unique_ptr<wf_input_device_internal> create_wf_device_for_device(
     wlr_input_device *device)
 {
@@ -65,7 +80,10 @@ void input_manager::handle_new_input(wlr_input_device *dev)
     input_devices.push_back(create_wf_device_for_device(dev));
 
     if (dev->type == WLR_INPUT_DEVICE_KEYBOARD)
+    {
         keyboards.push_back(std::make_unique<wf_keyboard> (dev));
+        added_keyboard = dev;
+    }
 
     if (dev->type == WLR_INPUT_DEVICE_POINTER)
     {
@@ -91,7 +109,7 @@ void input_manager::handle_new_input(wlr_input_device *dev)
     if (wo)
         wlr_cursor_map_input_to_output(cursor->cursor, dev, wo->handle);
 
-    update_capabilities();
+    schedule_seat_update();
 
     wf::input_device_signal data;
     data.device = nonstd::make_observer(input_devices.back().get());
@@ -101,6 +119,7 @@ void input_manager::handle_new_input(wlr_input_device *dev)
 void input_manager::handle_input_destroyed(wlr_input_device *dev)
 {
     LOGI("remove input: ", dev->name);
+    wf::input_latency_tracker_t::get().remove_device(dev);
 
     auto it = std::remove_if(input_devices.begin(), input_devices.end(),
         [=] (const std::unique_ptr<wf_input_device_internal>& idev) {
@@ -131,7 +150,10 @@ void input_manager::handle_input_destroyed(wlr_input_device *dev)
     if (dev->type == WLR_INPUT_DEVICE_TOUCH)
         touch_count--;
 
-    update_capabilities();
+    if (added_keyboard == dev)
+        added_keyboard = nullptr;
+
+    schedule_seat_update();
 }
 
 input_manager::input_manager()
@@ -171,6 +193,8 @@ input_manager::input_manager()
             dev->update_options();
         for (auto& kbd : keyboards)
             kbd->reload_input_options();
+
+        binding_index.set_dirty();
     };
 
     wf::get_core().connect_signal("reload-config", &config_updated);
@@ -281,20 +305,119 @@ wf::surface_interface_t* input_manager::input_surface_at(wf::pointf_t global,
     global.x -= og.x;
     global.y -= og.y;
 
-    for (auto& v : output->workspace->get_views_in_layer(wf::VISIBLE_LAYERS))
+    auto index = output->get_data<wf::input_index_t>();
+    if (!index)
+    {
+        output->store_data(std::make_unique<wf::input_index_t>(output));
+        index = output->get_data<wf::input_index_t>();
+    }
+
+    wf::surface_interface_t *surface = nullptr;
+    index->find_views_at(global, [&] (wayfire_view view)
+    {
+        if (can_focus_surface(view.get()))
+            surface = view->map_input_coordinates(global, local);
+
+        return surface != nullptr;
+    });
+
+    return surface;
+}
+
+wf::surface_interface_t* input_manager::input_surface_at(wf::pointf_t global,
+    wf::pointf_t& local, wf::surface_hit_cache_t& cache,
+    wf::surface_interface_t *focus)
+{
+    uint64_t epoch = wf::get_view_scene_epoch();
+    if (cache.surface && cache.surface == focus &&
+        cache.epoch == epoch && cache.exclusive_client == exclusive_client &&
+        cache.region.contains_pointf(global))
+    {
+        local = get_surface_relative_coords(cache.surface, global);
+        return cache.surface;
+    }
+
+    auto surface = input_surface_at(global, local);
+    cache.surface = nullptr;
+    if (surface && epoch == cache.last_lookup_epoch)
     {
-        for (auto& view : v->enumerate_views())
+        cache.region = get_surface_hit_region(surface);
+        if (cache.region.contains_pointf(global))
         {
-            if (can_focus_surface(view.get()))
-            {
-                auto surface = view->map_input_coordinates(global, local);
-                if (surface)
-                    return surface;
-            }
+            cache.surface = surface;
+            cache.epoch = epoch;
+            cache.exclusive_client = exclusive_client;
         }
     }
 
-    return nullptr;
+    cache.last_lookup_epoch = epoch;
+    return surface;
+}
+
+wf::region_t input_manager::get_surface_hit_region(
+    wf::surface_interface_t *surface)
+{
+    auto view =
+        dynamic_cast<wf::view_interface_t*> (surface->get_main_surface());
+    auto output = surface->get_output();
+    auto wlr_surface = surface->get_wlr_surface();
+    if (!view || !output || !wlr_surface || view->has_transformer())
+        return {};
+
+    /* Surfaces of the view above the surface, and the part of the surface
+     * accepting input, relative to the output */
+    wf::region_t above, result;
+    bool found = false;
+    auto vg = view->get_output_geometry();
+    view->for_each_surface([&] (wf::surface_interface_t *s, wf::point_t origin)
+    {
+        if (found)
+            return;
+
+        auto size = s->get_size();
+        wf::geometry_t box = {vg.x + origin.x, vg.y + origin.y,
+            size.width, size.height};
+        if (s != surface)
+        {
+            above |= box;
+            return;
+        }
+
+        found = true;
+        result = wf::region_t{&wlr_surface->input_region};
+        result &= wf::geometry_t{0, 0, size.width, size.height};
+        result += wf::point_t{box.x, box.y};
+    });
+
+    if (!found)
+        return {};
+
+    /* Views above the view. Children are visited before their parent, and are
+     * above it. */
+    bool reached = false;
+    output->workspace->for_each_view(wf::VISIBLE_LAYERS, [&] (wayfire_view v)
+    {
+        v->for_each_view([&] (wayfire_view child)
+        {
+            if (reached)
+                return;
+
+            if (child.get() == view)
+                reached = true;
+            else
+                above |= child->get_bounding_box();
+        });
+    });
+
+    if (!reached)
+        return {};
+
+    result ^= above;
+    result &= output->get_relative_geometry();
+
+    auto og = output->get_layout_geometry();
+    result += wf::point_t{og.x, og.y};
+    return result;
 }
 
 void input_manager::set_exclusive_focus(wl_client *client)
@@ -333,6 +456,7 @@ wf::binding_t* input_manager::new_binding(wf_binding_type type,
 
     auto raw = binding.get();
     bindings[type].push_back(std::move(binding));
+    binding_index.set_dirty();
 
     return raw;
 }
@@ -352,6 +476,8 @@ void input_manager::rem_binding(binding_criteria criteria)
             }
         }
     }
+
+    binding_index.set_dirty();
 }
 
 void input_manager::rem_binding(wf::binding_t *binding)
@@ -373,75 +499,42 @@ void input_manager::free_output_bindings(wf::output_t *output)
 
 bool input_manager::check_button_bindings(uint32_t button)
 {
-    std::vector<std::function<bool()>> callbacks;
+    wf::binding_matches_t callbacks;
 
-    auto oc = wf::get_core().get_active_output()->get_cursor_position();
+    auto output = wf::get_core().get_active_output();
+    auto oc = output->get_cursor_position();
     auto mod_state = get_modifiers();
 
-    for (auto& binding : bindings[WF_BINDING_BUTTON])
-    {
-        auto as_button = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::buttonbinding_t>> (binding->value);
-        assert(as_button);
-
-        if (binding->output == wf::get_core().get_active_output() &&
-            wf::buttonbinding_t{mod_state, button} == as_button->get_value())
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto callback = binding->call.button;
-            callbacks.push_back([=] () {
-                return (*callback) (button, oc.x, oc.y);
-            });
-        }
-    }
+    binding_index.find_bindings(WF_BINDING_BUTTON, mod_state, button,
+        output, callbacks);
+    binding_index.find_activators(wf::buttonbinding_t{mod_state, button},
+        output, callbacks);
 
-    for (auto& binding : bindings[WF_BINDING_ACTIVATOR])
+    bool binding_handled = false;
+    for (size_t i = 0; i < callbacks.size(); i++)
     {
-        auto as_activator = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::activatorbinding_t>> (binding->value);
-        assert(as_activator);
-
-        if (binding->output == wf::get_core().get_active_output() &&
-            as_activator->get_value().has_match(
-                wf::buttonbinding_t{mod_state, button}))
+        auto& call = callbacks[i].call;
+        if (callbacks[i].type == WF_BINDING_BUTTON)
         {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto callback = binding->call.activator;
-            callbacks.push_back([=] () {
-                return (*callback) (wf::ACTIVATOR_SOURCE_BUTTONBINDING, button);
-            });
+            binding_handled |= (*call.button) (button, oc.x, oc.y);
+        } else
+        {
+            binding_handled |= (*call.activator) (
+                wf::ACTIVATOR_SOURCE_BUTTONBINDING, button);
         }
     }
 
-    bool binding_handled = false;
-    for (auto call : callbacks)
-        binding_handled |= call();
-
     return !callbacks.empty() && binding_handled;
 }
 
 bool input_manager::check_axis_bindings(wlr_event_pointer_axis *ev)
 {
-    std::vector<wf::axis_callback*> callbacks;
-    auto mod_state = get_modifiers();
-
-    for (auto& binding : bindings[WF_BINDING_AXIS])
-    {
-        auto as_key = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::keybinding_t>> (binding->value);
-        assert(as_key);
-
-        if (binding->output == wf::get_core().get_active_output() &&
-            as_key->get_value() == wf::keybinding_t{mod_state, 0})
-        {
-            callbacks.push_back(binding->call.axis);
-        }
-    }
+    wf::binding_matches_t callbacks;
+    binding_index.find_bindings(WF_BINDING_AXIS, get_modifiers(), 0,
+        wf::get_core().get_active_output(), callbacks);
 
-    for (auto call : callbacks)
-        (*call) (ev);
+    for (size_t i = 0; i < callbacks.size(); i++)
+        (*callbacks[i].call.axis) (ev);
 
     return !callbacks.empty();
 }
@@ -8,6 +8,7 @@
 #include "seat.hpp"
 #include "cursor.hpp"
 #include "pointer.hpp"
+#include "binding-index.hpp"
 #include "wayfire/plugin.hpp"
 #include "wayfire/view.hpp"
 #include "wayfire/core.hpp"
@@ -28,35 +29,6 @@ struct wlr_seat;
 struct wf_touch;
 struct wf_keyboard;
 
-enum wf_binding_type
-{
-    WF_BINDING_KEY,
-    WF_BINDING_BUTTON,
-    WF_BINDING_AXIS,
-    WF_BINDING_TOUCH,
-    WF_BINDING_GESTURE,
-    WF_BINDING_ACTIVATOR
-};
-
-struct wf::binding_t
-{
-    std::shared_ptr<wf::config::option_base_t> value;
-    wf_binding_type type;
-    wf::output_t *output;
-
-    union {
-        void *raw;
-        wf::key_callback *key;
-        wf::axis_callback *axis;
-        wf::touch_callback *touch;
-        wf::button_callback *button;
-        wf::gesture_callback *gesture;
-        wf::activator_callback *activator;
-    } call;
-};
-
-using wf_binding_ptr = std::unique_ptr<wf::binding_t>;
-
 /* TODO: most probably we want to split even more of input_manager's functionality into
  * wf_keyboard, wf_cursor and wf_touch */
 class input_manager
@@ -67,11 +39,20 @@ class input_manager
                                 request_set_primary_selection;
         wf::wl_idle_call idle_update_cursor;
 
+        /* Devices are often added or removed in bursts, for ex. when a dock
+         * is connected, so the seat is updated once the event loop goes idle
+         * instead of after each device */
+        wf::wl_idle_call idle_update_seat;
+        /* The last keyboard added since the seat was updated */
+        wlr_input_device *added_keyboard = nullptr;
+        void schedule_seat_update();
+
         wf::signal_callback_t config_updated;
 
         int gesture_id;
 
         std::map<wf_binding_type, std::vector<std::unique_ptr<wf::binding_t>>> bindings;
+        wf::binding_index_t binding_index{bindings};
         using binding_criteria = std::function<bool(wf::binding_t*)>;
         void rem_binding(binding_criteria criteria);
 
@@ -81,7 +62,8 @@ class input_manager
 
         void validate_drag_request(wlr_seat_request_start_drag_event *ev);
         std::chrono::steady_clock::time_point mod_binding_start;
-        std::vector<std::function<bool()>> match_keys(uint32_t mods, uint32_t key, uint32_t mod_binding_key = 0);
+        void match_keys(uint32_t mods, uint32_t key,
+            wf::binding_matches_t& result);
 
         wf::signal_callback_t surface_map_state_changed;
         wf::signal_callback_t output_added;
@@ -132,6 +114,25 @@ class input_manager
         // if no such surface (return NULL), lx and ly are undefined
         wf::surface_interface_t* input_surface_at(wf::pointf_t global, wf::pointf_t& local);
 
+        /**
+         * Same as input_surface_at(), but the lookup is skipped if the point
+         * is in the cached hit region of the current focus of the device.
+         *
+         * @param cache The hit cache of the input device.
+         * @param focus The surface currently focused by the device.
+         */
+        wf::surface_interface_t* input_surface_at(wf::pointf_t global,
+            wf::pointf_t& local, wf::surface_hit_cache_t& cache,
+            wf::surface_interface_t *focus);
+
+        /**
+         * Find a region in global coordinates where input_surface_at() returns
+         * the given surface, as long as the view scene epoch stays the same.
+         * The region may be smaller than the actual one, and is empty for
+         * surfaces of transformed views.
+         */
+        wf::region_t get_surface_hit_region(wf::surface_interface_t *surface);
+
         uint32_t get_modifiers();
 
         void free_output_bindings(wf::output_t *output);
@@ -144,6 +145,9 @@ class input_manager
         void handle_touch_up    (uint32_t time, int32_t id);
 
         void handle_gesture(wf::touchgesture_t g);
+        /** @return Whether any gesture with the given number of fingers may
+         * trigger a binding on some output */
+        bool has_gesture_bindings(int fingers);
 
         bool check_button_bindings(uint32_t button);
         bool check_axis_bindings(wlr_event_pointer_axis *ev);
@@ -161,11 +165,17 @@ class input_manager
 };
 
 template<class EventType>
-void emit_device_event_signal(std::string event_name, EventType *event)
+void emit_device_event_signal(wf::signal_id_t event_name, EventType *event)
 {
     wf::input_event_signal<EventType> data;
     data.event = event;
     wf::get_core().emit_signal(event_name, &data);
 }
 
+template<class EventType>
+void emit_device_event_signal(std::string event_name, EventType *event)
+{
+    emit_device_event_signal(wf::signal_id_t{event_name}, event);
+}
+
 #endif /* end of include guard: INPUT_MANAGER_HPP */
@@ -1,5 +1,7 @@
 #include <string.h>
 #include <linux/input-event-codes.h>
+#include <array>
+#include <vector>
 
 extern "C"
 {
@@ -13,40 +15,44 @@ extern "C"
 #include "cursor.hpp"
 #include "touch.hpp"
 #include "input-manager.hpp"
+#include "input-latency.hpp"
 #include "wayfire/compositor-view.hpp"
 #include "wayfire/signal-definitions.hpp"
+#include "wayfire/trace.hpp"
+#include <wayfire/util/log.hpp>
 
-void wf_keyboard::setup_listeners()
+void wf_keyboard::handle_key(wlr_event_keyboard_key *ev)
 {
-    on_key.set_callback([&] (void *data)
-    {
-        auto ev = static_cast<wlr_event_keyboard_key*> (data);
-        emit_device_event_signal("keyboard_key", ev);
+    WF_TRACE_SCOPE("input", "keyboard_key");
+    static const wf::signal_id_t signal{"keyboard_key"};
+    wf::input_latency_tracker_t::get().add_event(device, ev->time_msec);
+    emit_device_event_signal(signal, ev);
 
-        auto seat = wf::get_core().get_current_seat();
-        wlr_seat_set_keyboard(seat, this->device);
+    auto seat = wf::get_core().get_current_seat();
+    wlr_seat_set_keyboard(seat, this->device);
 
-        if (!wf::get_core_impl().input->handle_keyboard_key(ev->keycode, ev->state))
-        {
-            wlr_seat_keyboard_notify_key(wf::get_core_impl().input->seat,
-                ev->time_msec, ev->keycode, ev->state);
-        }
+    if (!wf::get_core_impl().input->handle_keyboard_key(ev->keycode, ev->state))
+    {
+        wlr_seat_keyboard_notify_key(wf::get_core_impl().input->seat,
+            ev->time_msec, ev->keycode, ev->state);
+    }
 
-        wlr_idle_notify_activity(wf::get_core().protocols.idle, seat);
-    });
+    wlr_idle_notify_activity(wf::get_core().protocols.idle, seat);
+}
 
-    on_modifier.set_callback([&] (void *data)
-    {
-        auto kbd = static_cast<wlr_keyboard*> (data);
-        auto seat = wf::get_core().get_current_seat();
+void wf_keyboard::handle_modifiers(wlr_keyboard *kbd)
+{
+    auto seat = wf::get_core().get_current_seat();
 
-        wlr_seat_set_keyboard(seat, this->device);
-        wlr_seat_keyboard_send_modifiers(seat, &kbd->modifiers);
-        wlr_idle_notify_activity(wf::get_core().protocols.idle, seat);
-    });
+    wlr_seat_set_keyboard(seat, this->device);
+    wlr_seat_keyboard_send_modifiers(seat, &kbd->modifiers);
+    wlr_idle_notify_activity(wf::get_core().protocols.idle, seat);
+}
 
-    on_key.connect(&handle->events.key);
-    on_modifier.connect(&handle->events.modifiers);
+void wf_keyboard::setup_listeners()
+{
+    on_key.connect(this, &handle->events.key);
+    on_modifier.connect(this, &handle->events.modifiers);
 }
 
 wf_keyboard::wf_keyboard(wlr_input_device *dev)
@@ -63,33 +69,99 @@ wf_keyboard::wf_keyboard(wlr_input_device *dev)
 
     setup_listeners();
     reload_input_options();
-    wlr_seat_set_keyboard(wf::get_core().get_current_seat(), dev);
 }
 
-void wf_keyboard::reload_input_options()
+namespace
+{
+/**
+ * Compiling a keymap takes tens of milliseconds, so the keymaps are shared
+ * between all keyboards with the same rule names, and kept across config
+ * reloads.
+ */
+class keymap_cache_t
 {
-    auto ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  public:
+    static keymap_cache_t& get()
+    {
+        static keymap_cache_t cache;
+        return cache;
+    }
+
+    /**
+     * Get the keymap for the given names, compiling it if needed.
+     * @return The keymap, owned by the cache, or NULL if it can't be compiled
+     */
+    xkb_keymap *get_keymap(const std::array<std::string, 5>& names)
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.names == names)
+                return entry.keymap;
+        }
+
+        xkb_rule_names rule_names;
+        rule_names.rules   = names[0].c_str();
+        rule_names.model   = names[1].c_str();
+        rule_names.layout  = names[2].c_str();
+        rule_names.variant = names[3].c_str();
+        rule_names.options = names[4].c_str();
+        auto keymap = xkb_map_new_from_names(context, &rule_names,
+            XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if (!keymap)
+            return nullptr;
+
+        /* Keymaps of old configurations are rarely needed again */
+        if (entries.size() >= MAX_ENTRIES)
+        {
+            xkb_keymap_unref(entries.front().keymap);
+            entries.erase(entries.begin());
+        }
+
+        entries.push_back({names, keymap});
+        return keymap;
+    }
+
+  private:
+    static constexpr size_t MAX_ENTRIES = 4;
+
+    keymap_cache_t()
+    {
+        context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    }
+
+    ~keymap_cache_t()
+    {
+        for (auto& entry : entries)
+            xkb_keymap_unref(entry.keymap);
 
-    /* Copy memory to stack, so that .c_str() is valid */
-    std::string rules   = this->rules;
-    std::string model   = this->model;
-    std::string layout  = this->layout;
-    std::string variant = this->variant;
-    std::string options = this->options;
+        xkb_context_unref(context);
+    }
 
+    struct entry_t
+    {
+        std::array<std::string, 5> names;
+        xkb_keymap *keymap;
+    };
 
-    xkb_rule_names names;
-    names.rules   = rules.c_str();
-    names.model   = model.c_str();
-    names.layout  = layout.c_str();
-    names.variant = variant.c_str();
-    names.options = options.c_str();
-    auto keymap = xkb_map_new_from_names(ctx, &names,
-        XKB_KEYMAP_COMPILE_NO_FLAGS);
+    xkb_context *context;
+    std::vector<entry_t> entries;
+};
+}
 
-    wlr_keyboard_set_keymap(handle, keymap);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(ctx);
+void wf_keyboard::reload_input_options()
+{
+    auto keymap = keymap_cache_t::get().get_keymap({
+        rules, model, layout, variant, options});
+
+    /* Setting the keymap resets the keyboard state, so skip it if the
+     * names didn't change */
+    if (!keymap)
+    {
+        LOGE("Failed to compile keymap for layout ", (std::string)layout);
+    } else if (handle->keymap != keymap)
+    {
+        wlr_keyboard_set_keymap(handle, keymap);
+    }
 
     wlr_keyboard_set_repeat_info(handle, repeat_rate, repeat_delay);
 }
@@ -173,53 +245,17 @@ static uint32_t mod_from_key(wlr_seat *seat, uint32_t key)
     return 0;
 }
 
-std::vector<std::function<bool()>> input_manager::match_keys(uint32_t mod_state,
-    uint32_t key, uint32_t mod_binding_key)
+void input_manager::match_keys(uint32_t mod_state, uint32_t key,
+    wf::binding_matches_t& result)
 {
-    std::vector<std::function<bool()>> callbacks;
-
-    uint32_t actual_key = key == 0 ? mod_binding_key : key;
-
-    for (auto& binding : bindings[WF_BINDING_KEY])
-    {
-        auto as_key = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::keybinding_t>> (binding->value);
-        assert(as_key);
-
-        if (as_key->get_value() == wf::keybinding_t{mod_state, key} &&
-            binding->output == wf::get_core().get_active_output())
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto callback = binding->call.key;
-            callbacks.push_back([actual_key, callback] () {
-                return (*callback) (actual_key);
-            });
-        }
-    }
-
-    for (auto& binding : bindings[WF_BINDING_ACTIVATOR])
-    {
-        auto as_activator = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::activatorbinding_t>> (binding->value);
-        assert(as_activator);
-
-        if (as_activator->get_value().has_match(wf::keybinding_t{mod_state, key}) &&
-            binding->output == wf::get_core().get_active_output())
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda
-             *
-             * Also, do not send keys for modifier bindings */
-            auto callback = binding->call.activator;
-            callbacks.push_back([=] () {
-                return (*callback) (wf::ACTIVATOR_SOURCE_KEYBINDING,
-                    mod_from_key(seat, actual_key) ? 0 : actual_key);
-            });
-        }
-    }
-
-    return callbacks;
+    /* Most keys don't trigger any binding */
+    if (!binding_index.has_key_bindings(mod_state, key))
+        return;
+
+    auto output = wf::get_core().get_active_output();
+    binding_index.find_bindings(WF_BINDING_KEY, mod_state, key, output, result);
+    binding_index.find_activators(wf::keybinding_t{mod_state, key},
+        output, result);
 }
 
 bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
@@ -233,7 +269,10 @@ bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
     if (mod)
         handle_keyboard_mod(mod, state);
 
-    std::vector<std::function<bool()>> callbacks;
+    wf::binding_matches_t callbacks;
+    /* The key passed to the bindings, the key which was pressed with the
+     * modifiers for modifier bindings */
+    uint32_t actual_key = key;
     auto kbd = wlr_seat_get_keyboard(seat);
 
     if (state == WLR_KEY_PRESSED)
@@ -262,7 +301,7 @@ bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
             mod_binding_key = 0;
         }
 
-        callbacks = match_keys(get_modifiers(), key);
+        match_keys(get_modifiers(), key, callbacks);
     } else
     {
         if (mod_binding_key != 0)
@@ -273,7 +312,8 @@ bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
                 duration_cast<milliseconds>(steady_clock::now() - mod_binding_start)
                     <= milliseconds(timeout))
             {
-                callbacks = match_keys(get_modifiers() | mod, 0, mod_binding_key);
+                match_keys(get_modifiers() | mod, 0, callbacks);
+                actual_key = mod_binding_key;
             }
         }
 
@@ -281,8 +321,20 @@ bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
     }
 
     bool keybinding_handled = false;
-    for (auto call : callbacks)
-        keybinding_handled |= call();
+    for (size_t i = 0; i < callbacks.size(); i++)
+    {
+        auto& call = callbacks[i].call;
+        if (callbacks[i].type == WF_BINDING_KEY)
+        {
+            keybinding_handled |= (*call.key) (actual_key);
+        } else
+        {
+            /* Do not send keys for modifier bindings */
+            keybinding_handled |= (*call.activator) (
+                wf::ACTIVATOR_SOURCE_KEYBINDING,
+                mod_from_key(seat, actual_key) ? 0 : actual_key);
+        }
+    }
 
     auto iv = interactive_view_from_view(keyboard_focus.get());
     if (iv) iv->handle_key(key, state);
@@ -7,7 +7,11 @@
 
 struct wf_keyboard
 {
-    wf::wl_listener_wrapper on_key, on_modifier;
+    void handle_key(wlr_event_keyboard_key *ev);
+    void handle_modifiers(wlr_keyboard *kbd);
+
+    wf::wl_listener_member<&wf_keyboard::handle_key> on_key;
+    wf::wl_listener_member<&wf_keyboard::handle_modifiers> on_modifier;
     void setup_listeners();
 
     wlr_keyboard *handle;
@@ -80,7 +80,7 @@ void wf::LogicalPointer::update_cursor_position(uint32_t time_msec,
     }
     else if (this->focus_enabled())
     {
-        new_focus = input->input_surface_at(gc, local);
+        new_focus = input->input_surface_at(gc, local, hit_cache, cursor_focus);
         update_cursor_focus(new_focus, local);
 
         /* We switched focus, so send motion event in any case, so that the
@@ -280,8 +280,31 @@ void wf::LogicalPointer::grab_surface(wf::surface_interface_t *surface)
 }
 
 /* ----------------------- Input event processing --------------------------- */
+void wf::LogicalPointer::handle_motion(uint32_t time_msec)
+{
+    if (!coalesce_motion)
+    {
+        update_cursor_position(time_msec);
+        return;
+    }
+
+    pending_motion = true;
+    pending_motion_time = time_msec;
+}
+
+void wf::LogicalPointer::flush_pending_motion()
+{
+    if (!pending_motion)
+        return;
+
+    pending_motion = false;
+    update_cursor_position(pending_motion_time);
+}
+
 void wf::LogicalPointer::handle_pointer_button(wlr_event_pointer_button *ev)
 {
+    /* The button goes to the surface under the current cursor position */
+    flush_pending_motion();
     input->mod_binding_key = 0;
     bool handled_in_binding = false;
 
@@ -375,6 +398,19 @@ void wf::LogicalPointer::send_motion(uint32_t time_msec, wf::pointf_t local)
 
 void wf::LogicalPointer::handle_pointer_motion(wlr_event_pointer_motion *ev)
 {
+    /* The cursor doesn't move while the pointer is locked, so the focus and
+     * the cursor image stay the same and only the relative motion matters */
+    auto constraint = this->active_pointer_constraint;
+    if (constraint && this->cursor_focus && !input->input_grabbed() &&
+        (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED))
+    {
+        wlr_relative_pointer_manager_v1_send_relative_motion(
+            wf::get_core().protocols.relative_pointer, input->seat,
+            (uint64_t)ev->time_msec * 1000, ev->delta_x, ev->delta_y,
+            ev->unaccel_dx, ev->unaccel_dy);
+        return;
+    }
+
     if (input->input_grabbed() &&
         input->active_grab->callbacks.pointer.relative_motion)
     {
@@ -410,7 +446,7 @@ void wf::LogicalPointer::handle_pointer_motion(wlr_event_pointer_motion *ev)
 
     /* XXX: maybe warp directly? */
     wlr_cursor_move(input->cursor->cursor, ev->device, dx, dy);
-    update_cursor_position(ev->time_msec);
+    handle_motion(ev->time_msec);
 }
 
 void wf::LogicalPointer::handle_pointer_motion_absolute(
@@ -438,11 +474,12 @@ void wf::LogicalPointer::handle_pointer_motion_absolute(
 
     // TODO: indirection via wf_cursor
     wlr_cursor_warp_absolute(input->cursor->cursor, ev->device, ev->x, ev->y);
-    update_cursor_position(ev->time_msec);
+    handle_motion(ev->time_msec);
 }
 
 void wf::LogicalPointer::handle_pointer_axis(wlr_event_pointer_axis *ev)
 {
+    flush_pending_motion();
     bool handled_by_binding = input->check_axis_bindings(ev);
     /* reset modifier bindings */
     input->mod_binding_key = 0;
@@ -519,5 +556,6 @@ void wf::LogicalPointer::handle_pointer_pinch_end(
 
 void wf::LogicalPointer::handle_pointer_frame()
 {
+    flush_pending_motion();
     wlr_seat_pointer_notify_frame(input->seat);
 }
@@ -7,6 +7,7 @@
 #include <wayfire/util.hpp>
 #include <wayfire/option-wrapper.hpp>
 #include "surface-map-state.hpp"
+#include "surface-hit-cache.hpp"
 
 extern "C"
 {
@@ -112,6 +113,26 @@ class LogicalPointer
      */
     void update_cursor_position(uint32_t time_msec, bool real_update = true);
 
+    /**
+     * When coalescing motion, the cursor is moved for each motion event, but
+     * the focus is updated and motion is sent only on the frame event which
+     * ends a batch of events, or before a button or axis event.
+     */
+    wf::option_wrapper_t<bool> coalesce_motion{"input/coalesce_pointer_motion"};
+    /** Whether there is motion which hasn't been processed yet */
+    bool pending_motion = false;
+    /** The time of the last motion event which hasn't been processed */
+    uint32_t pending_motion_time = 0;
+
+    /** Move the cursor after a motion event, or record the motion if
+     * coalescing is enabled */
+    void handle_motion(uint32_t time_msec);
+    /** Process the motion recorded since the last frame, if any */
+    void flush_pending_motion();
+
+    /** The region where the cursor focus stays the same */
+    wf::surface_hit_cache_t hit_cache;
+
     /** Number of currently-pressed mouse buttons */
     int count_pressed_buttons = 0;
     wf::region_t constraint_region;
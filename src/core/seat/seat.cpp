@@ -2,6 +2,7 @@
 #include "wayfire/opengl.hpp"
 #include "../core-impl.hpp"
 #include "input-manager.hpp"
+#include "cursor.hpp"
 #include "wayfire/render-manager.hpp"
 #include "wayfire/output-layout.hpp"
 #include <wayfire/util/log.hpp>
@@ -15,18 +16,36 @@ extern "C"
 wf_drag_icon::wf_drag_icon(wlr_drag_icon *ic)
     : wf::wlr_child_surface_base_t(nullptr, this), icon(ic)
 {
-    on_map.set_callback([&] (void*) { this->map(icon->surface); });
-    on_unmap.set_callback([&] (void*) { this->unmap(); });
+    on_map.set_callback([&] (void*) {
+        this->map(icon->surface);
+        wf::get_core_impl().input->cursor->update_drag_icon_image();
+    });
+    on_unmap.set_callback([&] (void*) {
+        this->unmap();
+        wf::get_core_impl().input->cursor->update_drag_icon_image();
+    });
     on_destroy.set_callback([&] (void*) {
         /* we don't dec_keep_count() because the surface memory is
          * managed by the unique_ptr */
         wf::get_core_impl().input->drag_icon = nullptr;
+        wf::get_core_impl().input->cursor->update_drag_icon_image();
         wf::get_core().emit_signal("drag-stopped", nullptr);
     });
+    on_commit.set_callback([&] (void*) {
+        if (is_mapped())
+            wf::get_core_impl().input->cursor->update_drag_icon_image();
+    });
 
     on_map.connect(&icon->events.map);
     on_unmap.connect(&icon->events.unmap);
     on_destroy.connect(&icon->events.destroy);
+    on_commit.connect(&icon->surface->events.commit);
+}
+
+bool wf_drag_icon::is_on_cursor_plane(wf::output_t *output) const
+{
+    auto scale = wf::get_core_impl().input->cursor->drag_icon_scale;
+    return scale && (output->handle->scale == scale);
 }
 
 wf::point_t wf_drag_icon::get_offset()
@@ -50,28 +69,26 @@ void wf_drag_icon::damage()
     damage_surface_box(box);
 }
 
-void wf_drag_icon::damage_surface_box(const wlr_box& box)
+void wf_drag_icon::damage_surface_region(const wf::region_t& region)
 {
-    if (!is_mapped())
+    if (!is_mapped() || region.empty())
         return;
 
-    wlr_box damage = box;
-    damage.x += get_offset().x;
-    damage.y += get_offset().y;
-
-    for (auto& output : wf::get_core().output_layout->get_outputs())
+    auto damage = region + get_offset();
+    wf::get_core().output_layout->for_each_output([&] (wf::output_t *output)
     {
+        if (is_on_cursor_plane(output))
+            return;
+
         auto output_geometry = output->get_layout_geometry();
-        if (output_geometry & damage)
-        {
-            auto local = damage;
-            local.x -= output_geometry.x;
-            local.y -= output_geometry.y;
-
-            const auto& fb = output->render->get_target_framebuffer();
-            output->render->damage(fb.damage_box_from_geometry_box(local));
-        }
-    }
+        auto local = (damage & output_geometry) +
+            wf::point_t{-output_geometry.x, -output_geometry.y};
+        if (local.empty())
+            return;
+
+        const auto& fb = output->render->get_target_framebuffer();
+        output->render->damage(fb.damage_region_from_geometry_region(local));
+    });
 }
 
 void input_manager::validate_drag_request(wlr_seat_request_start_drag_event *ev)
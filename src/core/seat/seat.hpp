@@ -16,13 +16,19 @@ extern "C"
 struct wf_drag_icon : public wf::wlr_child_surface_base_t
 {
     wlr_drag_icon *icon;
-    wf::wl_listener_wrapper on_map, on_unmap, on_destroy;
+    wf::wl_listener_wrapper on_map, on_unmap, on_destroy, on_commit;
 
     wf_drag_icon(wlr_drag_icon *icon);
     wf::point_t get_offset() override;
 
+    /**
+     * @return Whether the icon is part of the cursor image on the output, so
+     * the output doesn't need to draw it, see wf_cursor::update_drag_icon_image()
+     */
+    bool is_on_cursor_plane(wf::output_t *output) const;
+
     void damage();
-    void damage_surface_box(const wlr_box& rect) override;
+    void damage_surface_region(const wf::region_t& region) override;
 };
 
 class wf_input_device_internal : public wf::input_device_t
@@ -0,0 +1,35 @@
+#ifndef WF_SEAT_SURFACE_HIT_CACHE_HPP
+#define WF_SEAT_SURFACE_HIT_CACHE_HPP
+
+#include <wayfire/surface.hpp>
+#include <wayfire/util.hpp>
+
+extern "C"
+{
+struct wl_client;
+}
+
+namespace wf
+{
+/**
+ * The region in global coordinates where the focus of an input device stays
+ * the same, valid while the view scene epoch stays the same. When the device
+ * moves inside it, the lookup of the surface under it is skipped.
+ *
+ * See input_manager::input_surface_at().
+ */
+struct surface_hit_cache_t
+{
+    wf::surface_interface_t *surface = nullptr;
+    wf::region_t region;
+    uint64_t epoch = 0;
+    wl_client *exclusive_client = nullptr;
+
+    /* The epoch at the last lookup. The region is computed only when a
+     * lookup is needed while the scene doesn't change, so that it isn't
+     * computed for each event when a view is animating */
+    uint64_t last_lookup_epoch = 0;
+};
+}
+
+#endif /* end of include guard: WF_SEAT_SURFACE_HIT_CACHE_HPP */
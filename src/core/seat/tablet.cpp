@@ -74,6 +74,9 @@ wf::tablet_tool_t::tablet_tool_t(wlr_tablet_tool *tool,
         input->cursor->set_cursor(&pev, false);
     });
     on_set_cursor.connect(&tool_v2->events.set_cursor);
+
+    pending_axis.updated_axes = 0;
+    idle_flush_axis.set_callback([=] () { flush_pending_axis(); });
 }
 
 wf::tablet_tool_t::~tablet_tool_t()
@@ -109,7 +112,8 @@ void wf::tablet_tool_t::update_tool_position()
         local = get_surface_relative_coords(surface, gc);
     } else
     {
-        surface = input->input_surface_at(gc, local);
+        surface = input->input_surface_at(gc, local, hit_cache,
+            this->proximity_surface);
     }
 
     set_focus(surface);
@@ -122,6 +126,9 @@ void wf::tablet_tool_t::update_tool_position()
 
 void wf::tablet_tool_t::set_focus(wf::surface_interface_t *surface)
 {
+    if (surface == this->proximity_surface)
+        return;
+
     /* Unfocus old surface */
     if (surface != this->proximity_surface && this->proximity_surface)
     {
@@ -170,8 +177,57 @@ void wf::tablet_tool_t::passthrough_axis(wlr_event_tablet_tool_axis *ev)
 	}
 }
 
+void wf::tablet_tool_t::handle_axis(wlr_event_tablet_tool_axis *ev)
+{
+    if (!coalesce_motion)
+    {
+        update_tool_position();
+        passthrough_axis(ev);
+        return;
+    }
+
+    /* Keep the latest value of each axis, wheel motion accumulates */
+    auto& p = pending_axis;
+    uint32_t axes = ev->updated_axes;
+    if (axes & WLR_TABLET_TOOL_AXIS_PRESSURE)
+        p.pressure = ev->pressure;
+    if (axes & WLR_TABLET_TOOL_AXIS_DISTANCE)
+        p.distance = ev->distance;
+    if (axes & WLR_TABLET_TOOL_AXIS_ROTATION)
+        p.rotation = ev->rotation;
+    if (axes & WLR_TABLET_TOOL_AXIS_SLIDER)
+        p.slider = ev->slider;
+    if (axes & WLR_TABLET_TOOL_AXIS_TILT_X)
+        p.tilt_x = ev->tilt_x;
+    if (axes & WLR_TABLET_TOOL_AXIS_TILT_Y)
+        p.tilt_y = ev->tilt_y;
+
+    if (axes & WLR_TABLET_TOOL_AXIS_WHEEL)
+    {
+        p.wheel_delta = (p.updated_axes & WLR_TABLET_TOOL_AXIS_WHEEL) ?
+            p.wheel_delta + ev->wheel_delta : ev->wheel_delta;
+    }
+
+    /* Position is always sent, as the cursor has moved */
+    p.updated_axes |= axes | WLR_TABLET_TOOL_AXIS_X;
+    idle_flush_axis.run_once();
+}
+
+void wf::tablet_tool_t::flush_pending_axis()
+{
+    idle_flush_axis.disconnect();
+    if (!pending_axis.updated_axes)
+        return;
+
+    update_tool_position();
+    passthrough_axis(&pending_axis);
+    pending_axis.updated_axes = 0;
+}
+
 void wf::tablet_tool_t::handle_tip(wlr_event_tablet_tool_tip *ev)
 {
+    flush_pending_axis();
+
     /* Nothing to do without a proximity surface */
     if (!this->proximity_surface)
         return;
@@ -202,6 +258,7 @@ void wf::tablet_tool_t::handle_tip(wlr_event_tablet_tool_tip *ev)
 
 void wf::tablet_tool_t::handle_button(wlr_event_tablet_tool_button *ev)
 {
+    flush_pending_axis();
     wlr_tablet_v2_tablet_tool_notify_button(tool_v2,
         (zwp_tablet_pad_v2_button_state)ev->button,
         (zwp_tablet_pad_v2_button_state)ev->state);
@@ -209,6 +266,7 @@ void wf::tablet_tool_t::handle_button(wlr_event_tablet_tool_button *ev)
 
 void wf::tablet_tool_t::handle_proximity(wlr_event_tablet_tool_proximity *ev)
 {
+    flush_pending_axis();
     if (ev->state == WLR_TABLET_TOOL_PROXIMITY_OUT)
     {
         set_focus(nullptr);
@@ -295,10 +353,8 @@ void wf::tablet_t::handle_axis(wlr_event_tablet_tool_axis *ev)
         return;
     }
 
-    /* Update focus */
-    auto tool = ensure_tool(ev->tool);
-    tool->update_tool_position();
-    tool->passthrough_axis(ev);
+    /* Update focus and send the axis values */
+    ensure_tool(ev->tool)->handle_axis(ev);
 }
 
 void wf::tablet_t::handle_button(wlr_event_tablet_tool_button *ev)
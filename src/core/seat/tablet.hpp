@@ -6,7 +6,9 @@ extern "C" {
 #include <wlr/types/wlr_tablet_v2.h>
 }
 #include <wayfire/util.hpp>
+#include <wayfire/option-wrapper.hpp>
 #include "seat.hpp"
+#include "surface-hit-cache.hpp"
 
 namespace wf
 {
@@ -36,6 +38,17 @@ struct tablet_tool_t
      */
     void passthrough_axis(wlr_event_tablet_tool_axis *ev);
 
+    /**
+     * Handle an axis event after the cursor has been moved. When coalescing,
+     * the axis values are only recorded, and sent together with the focus
+     * update once the event loop goes idle, or before the next tip, button
+     * or proximity event.
+     */
+    void handle_axis(wlr_event_tablet_tool_axis *ev);
+
+    /** Send the axis updates recorded since the last batch, if any */
+    void flush_pending_axis();
+
     /**
      * Called whenever a tip occurs for this tool
      */
@@ -63,6 +76,15 @@ struct tablet_tool_t
     double tilt_x = 0.0;
     double tilt_y = 0.0;
 
+    /** The region where the proximity surface stays the same */
+    wf::surface_hit_cache_t hit_cache;
+
+    wf::option_wrapper_t<bool> coalesce_motion{"input/coalesce_tablet_motion"};
+    /** The axis updates which haven't been sent yet. updated_axes is 0 if
+     * there are none. */
+    wlr_event_tablet_tool_axis pending_axis;
+    wf::wl_idle_call idle_flush_axis;
+
     /* A tablet tool is active if it has a proximity_in
      * event but no proximity_out */
     bool is_active = false;
@@ -3,6 +3,7 @@
 #include "wayfire/debug.hpp"
 #include "touch.hpp"
 #include "input-manager.hpp"
+#include "input-latency.hpp"
 #include "../core-impl.hpp"
 #include "wayfire/output.hpp"
 #include "wayfire/workspace-manager.hpp"
@@ -13,30 +14,57 @@ constexpr static int MIN_FINGERS = 3;
 constexpr static int MIN_SWIPE_DISTANCE = 100;
 constexpr static float MIN_PINCH_DISTANCE = 70;
 constexpr static int EDGE_SWIPE_THRESHOLD = 50;
+constexpr static int MAX_FINGERS = 10;
+
+/**
+ * @return Whether a gesture with at least the given number of fingers is
+ *   bound. Otherwise, adding fingers can't lead to a gesture, so the touch
+ *   points are sent to clients right away.
+ */
+static bool may_become_gesture(int fingers)
+{
+    for (int i = fingers; i <= MAX_FINGERS; i++)
+    {
+        if (wf::get_core_impl().input->has_gesture_bindings(i))
+            return true;
+    }
 
-void wf_gesture_recognizer::reset_gesture()
+    return false;
+}
+
+wf::pointf_t wf_gesture_recognizer::get_centroid() const
 {
-    gesture_emitted = false;
+    return {position_sum.x / current.size(), position_sum.y / current.size()};
+}
 
-    double cx = 0, cy = 0;
-    for (auto f : current)
+double wf_gesture_recognizer::get_spread(wf::pointf_t center) const
+{
+    double sum_dist = 0;
+    for (auto& f : current)
     {
-        cx += f.second.current.x;
-        cy += f.second.current.y;
+        double dx = center.x - f.second.current.x;
+        double dy = center.y - f.second.current.y;
+        sum_dist += std::sqrt(dx * dx + dy * dy);
     }
 
-    cx /= current.size();
-    cy /= current.size();
+    return sum_dist;
+}
 
-    start_sum_dist = 0;
-    for (auto &f : current)
-    {
-        start_sum_dist +=
-            std::sqrt((cx - f.second.current.x) * (cx - f.second.current.x)
-                    + (cy - f.second.current.y) * (cy - f.second.current.y));
+void wf_gesture_recognizer::reset_gesture()
+{
+    gesture_emitted = false;
 
+    /* Recompute the sum from scratch, so that rounding errors from the
+     * incremental updates don't add up */
+    position_sum = {0, 0};
+    for (auto& f : current)
+    {
+        position_sum.x += f.second.current.x;
+        position_sum.y += f.second.current.y;
         f.second.start = f.second.current;
     }
+
+    start_sum_dist = get_spread(get_centroid());
 }
 
 void wf_gesture_recognizer::start_new_gesture()
@@ -66,12 +94,23 @@ void wf_gesture_recognizer::continue_gesture()
     if (gesture_emitted)
         return;
 
+    /* Nothing to do if no gesture with this many fingers is bound */
+    int fingers = current.size();
+    if (!wf::get_core_impl().input->has_gesture_bindings(fingers))
+        return;
+
     /* first case - consider swipe, we go through each
-     * of the directions and check whether such swipe has occured */
+     * of the directions and check whether such swipe has occured.
+     *
+     * In the same pass, measure the sum of distances to the center of the
+     * fingers for the second case. */
     bool is_left_swipe = true, is_right_swipe = true,
          is_up_swipe = true, is_down_swipe = true;
 
-    for (auto f : current) {
+    auto center = get_centroid();
+    double sum_dist = 0;
+    for (auto& f : current)
+    {
         int dx = f.second.current.x - f.second.start.x;
         int dy = f.second.current.y - f.second.start.y;
 
@@ -84,6 +123,10 @@ void wf_gesture_recognizer::continue_gesture()
             is_up_swipe = false;
         if (dy < MIN_SWIPE_DISTANCE)
             is_down_swipe = false;
+
+        double cdx = center.x - f.second.current.x;
+        double cdy = center.y - f.second.current.y;
+        sum_dist += std::sqrt(cdx * cdx + cdy * cdy);
     }
 
     uint32_t swipe_dir = 0;
@@ -99,7 +142,7 @@ void wf_gesture_recognizer::continue_gesture()
     if (swipe_dir)
     {
         wf::touchgesture_t gesture {
-            wf::GESTURE_TYPE_SWIPE, swipe_dir, (int)current.size()
+            wf::GESTURE_TYPE_SWIPE, swipe_dir, fingers
         };
 
         bool bottom_edge = false, upper_edge = false,
@@ -107,7 +150,7 @@ void wf_gesture_recognizer::continue_gesture()
 
         auto og = wf::get_core().get_active_output()->get_layout_geometry();
 
-        for (auto f : current)
+        for (auto& f : current)
         {
             bottom_edge |=
                 (f.second.start.y >= og.y + og.height - EDGE_SWIPE_THRESHOLD);
@@ -132,7 +175,7 @@ void wf_gesture_recognizer::continue_gesture()
         if ((edge_swipe_dir & swipe_dir) == swipe_dir)
         {
             gesture =  {
-                wf::GESTURE_TYPE_EDGE_SWIPE, swipe_dir, (int)current.size()
+                wf::GESTURE_TYPE_EDGE_SWIPE, swipe_dir, fingers
             };
         }
 
@@ -142,25 +185,9 @@ void wf_gesture_recognizer::continue_gesture()
     }
 
     /* second case - this has been a pinch.
-     * We calculate the central point of the fingers (cx, cy),
-     * then we measure the average distance to the center. If it
-     * is bigger/smaller above/below some threshold, then we emit the gesture */
-    int cx = 0, cy = 0;
-    for (auto f : current) {
-        cx += f.second.current.x;
-        cy += f.second.current.y;
-    }
-
-    cx /= current.size();
-    cy /= current.size();
-
-    int sum_dist = 0;
-    for (auto f : current) {
-        sum_dist +=
-            std::sqrt((cx - f.second.current.x) * (cx - f.second.current.x)
-                    + (cy - f.second.current.y) * (cy - f.second.current.y));
-    }
-
+     * We take the central point of the fingers, kept up to date on each
+     * motion, and the sum of distances to it. If it is bigger/smaller
+     * above/below some threshold, then we emit the gesture */
     bool inward_pinch  = (start_sum_dist - sum_dist >= MIN_PINCH_DISTANCE);
     bool outward_pinch = (start_sum_dist - sum_dist <= -MIN_PINCH_DISTANCE);
 
@@ -168,7 +195,7 @@ void wf_gesture_recognizer::continue_gesture()
         wf::touchgesture_t gesture {
             wf::GESTURE_TYPE_PINCH,
             (inward_pinch ? wf::GESTURE_DIRECTION_IN : wf::GESTURE_DIRECTION_OUT),
-            (int)current.size(),
+            fingers,
         };
 
         wf::get_core_impl().input->handle_gesture(gesture);
@@ -179,11 +206,19 @@ void wf_gesture_recognizer::continue_gesture()
 void wf_gesture_recognizer::update_touch(int32_t time, int id,
     wf::pointf_t point, bool real_update)
 {
-    current[id].current = point;
+    auto it = current.find(id);
+    if (it == current.end())
+        return;
+
+    auto& finger = it->second;
+    position_sum.x += point.x - finger.current.x;
+    position_sum.y += point.y - finger.current.y;
+    finger.current = point;
+
     if (in_gesture)
     {
         continue_gesture();
-    } else if (current[id].sent_to_client)
+    } else if (finger.sent_to_client)
     {
         wf::get_core_impl().input->handle_touch_motion(time, id,
             point, real_update);
@@ -192,12 +227,24 @@ void wf_gesture_recognizer::update_touch(int32_t time, int id,
 
 void wf_gesture_recognizer::register_touch(int time, int id, wf::pointf_t point)
 {
+    auto it = current.find(id);
+    if (it != current.end())
+    {
+        position_sum.x -= it->second.current.x;
+        position_sum.y -= it->second.current.y;
+    }
+
     current[id] = {id, point, point};
+    position_sum.x += point.x;
+    position_sum.y += point.y;
     if (in_gesture)
         reset_gesture();
 
-    if (current.size() >= MIN_FINGERS && !in_gesture)
+    if (current.size() >= MIN_FINGERS && !in_gesture &&
+        may_become_gesture(current.size()))
+    {
         start_new_gesture();
+    }
 
     if (!in_gesture)
     {
@@ -215,6 +262,8 @@ void wf_gesture_recognizer::unregister_touch(int32_t time, int32_t id)
     /* We need to erase the touch point state, because then reset_gesture() can
      * properly calculate the starting parameters for the next gesture */
     bool was_sent_to_client = current[id].sent_to_client;
+    position_sum.x -= current[id].current.x;
+    position_sum.y -= current[id].current.y;
     current.erase(id);
 
     if (in_gesture)
@@ -238,6 +287,7 @@ wf_touch::wf_touch(wlr_cursor *cursor)
     on_down.set_callback([&] (void *data)
     {
         auto ev = static_cast<wlr_event_touch_down*> (data);
+        wf::input_latency_tracker_t::get().add_event(ev->device, ev->time_msec);
         emit_device_event_signal("touch_down", &ev);
 
         double lx, ly;
@@ -256,6 +306,7 @@ wf_touch::wf_touch(wlr_cursor *cursor)
     on_up.set_callback([&] (void *data)
     {
         auto ev = static_cast<wlr_event_touch_up*> (data);
+        wf::input_latency_tracker_t::get().add_event(ev->device, ev->time_msec);
         emit_device_event_signal("touch_up", ev);
         gesture_recognizer.unregister_touch(ev->time_msec, ev->touch_id);
 
@@ -265,8 +316,10 @@ wf_touch::wf_touch(wlr_cursor *cursor)
 
     on_motion.set_callback([&] (void *data)
     {
+        static const wf::signal_id_t signal{"touch_motion"};
         auto ev = static_cast<wlr_event_touch_motion*> (data);
-        emit_device_event_signal("touch_motion", &ev);
+        wf::input_latency_tracker_t::get().add_event(ev->device, ev->time_msec);
+        emit_device_event_signal(signal, &ev);
 
         auto touch = static_cast<wf_touch*> (ev->device->data);
 
@@ -432,6 +485,14 @@ void input_manager::handle_touch_motion(uint32_t time, int32_t id,
     {
         surface = our_touch->grabbed_surface;
         local = get_surface_relative_coords(surface, point);
+    } else if (!drag_icon && real_update &&
+        !wlr_seat_touch_get_point(seat, id))
+    {
+        /* The touch point went down outside of any surface. Touch points
+         * stay on the surface they went down on, so the motion doesn't need
+         * hit testing. The focus is only updated after the surfaces change,
+         * with synthetic motion. */
+        return;
     } else
     {
         surface = input_surface_at(point, local);
@@ -448,67 +509,35 @@ void input_manager::handle_touch_motion(uint32_t time, int32_t id,
 
 void input_manager::check_touch_bindings(int x, int y)
 {
-    uint32_t mods = get_modifiers();
-    std::vector<wf::touch_callback*> calls;
-    for (auto& binding : bindings[WF_BINDING_TOUCH])
-    {
-        auto as_key = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::keybinding_t>> (binding->value);
-        assert(as_key);
+    wf::binding_matches_t calls;
+    binding_index.find_bindings(WF_BINDING_TOUCH, get_modifiers(), 0,
+        wf::get_core().get_active_output(), calls);
 
-        if (as_key->get_value() == wf::keybinding_t{mods, 0} &&
-            binding->output == wf::get_core().get_active_output())
-        {
-            calls.push_back(binding->call.touch);
-        }
-    }
+    for (size_t i = 0; i < calls.size(); i++)
+        (*calls[i].call.touch)(x, y);
+}
 
-    for (auto call : calls)
-        (*call)(x, y);
+bool input_manager::has_gesture_bindings(int fingers)
+{
+    return binding_index.has_gesture_bindings(fingers);
 }
 
 void input_manager::handle_gesture(wf::touchgesture_t g)
 {
-    std::vector<std::function<void()>> callbacks;
+    wf::binding_matches_t callbacks;
 
-    for (auto& binding : bindings[WF_BINDING_GESTURE])
-    {
-        auto as_gesture = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::touchgesture_t>> (binding->value);
-        assert(as_gesture);
+    auto output = wf::get_core().get_active_output();
+    binding_index.find_gestures(g, output, callbacks);
+    binding_index.find_activators(g, output, callbacks);
 
-        if (binding->output == wf::get_core().get_active_output() &&
-            as_gesture->get_value() == g)
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto call = binding->call.gesture;
-            callbacks.push_back([=, &g] () {
-                (*call) (&g);
-            });
-        }
-    }
-
-    for (auto& binding : bindings[WF_BINDING_ACTIVATOR])
+    for (size_t i = 0; i < callbacks.size(); i++)
     {
-        auto as_activator = std::dynamic_pointer_cast<
-            wf::config::option_t<wf::activatorbinding_t>> (binding->value);
-        assert(as_activator);
-
-        if (binding->output == wf::get_core().get_active_output() &&
-            as_activator->get_value().has_match(g))
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto call = binding->call.activator;
-            callbacks.push_back([=] () {
-                (*call) (wf::ACTIVATOR_SOURCE_GESTURE, 0);
-            });
-        }
+        auto& call = callbacks[i].call;
+        if (callbacks[i].type == WF_BINDING_GESTURE)
+            (*call.gesture) (&g);
+        else
+            (*call.activator) (wf::ACTIVATOR_SOURCE_GESTURE, 0);
     }
-
-    for (auto call : callbacks)
-        call();
 }
 
 void wf_touch::input_grabbed()
@@ -31,7 +31,16 @@ struct wf_gesture_recognizer
 private:
 
     bool in_gesture = false, gesture_emitted = false;
-    int start_sum_dist;
+    double start_sum_dist;
+
+    /* The sum of the current positions of all fingers, updated on each
+     * motion, so that their center is known without going through them */
+    wf::pointf_t position_sum = {0, 0};
+
+    /** @return The center of the current positions of the fingers */
+    wf::pointf_t get_centroid() const;
+    /** @return The sum of distances of the fingers to the given point */
+    double get_spread(wf::pointf_t center) const;
 
     void start_new_gesture();
     void continue_gesture();
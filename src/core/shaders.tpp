@@ -19,25 +19,75 @@ R"(#version 100
 
 varying highp vec2 uvpos;
 uniform mediump vec4 color;
+uniform mediump mat4 color_matrix;
 
 void main()
 {
     mediump vec4 tex_color = get_pixel(uvpos);
     tex_color.rgb = tex_color.rgb * color.a;
-    gl_FragColor = tex_color * color;
+    gl_FragColor = color_matrix * (tex_color * color);
 })";
 
 static const char *color_rect_fragment_source =
 R"(#version 100
 varying highp vec2 uvpos;
 uniform mediump vec4 color;
+uniform mediump mat4 color_matrix;
 
 void main()
 {
-    gl_FragColor = color;
+    gl_FragColor = color_matrix * color;
 })";
 
 
+/* Used by render_textured_quads(): each vertex is already transformed, and
+ * says from which texture unit it samples. */
+static const char *multitexture_vertex_source =
+R"(#version 100
+
+attribute highp vec4 position;
+attribute highp vec2 uvPosition;
+attribute mediump float unitIndex;
+attribute mediump vec4 vertexColor;
+
+varying highp vec2 uvpos;
+varying mediump float unit;
+varying mediump vec4 color;
+
+void main() {
+    gl_Position = position;
+    uvpos = uvPosition;
+    unit = unitIndex;
+    color = vertexColor;
+})";
+
+/* Samplers can be indexed only with constants */
+static const char *multitexture_fragment_source =
+R"(#version 100
+
+uniform sampler2D textures[8];
+uniform mediump mat4 color_matrix;
+
+varying highp vec2 uvpos;
+varying mediump float unit;
+varying mediump vec4 color;
+
+void main()
+{
+    int i = int(unit + 0.5);
+    mediump vec4 tex_color;
+    if (i == 0) tex_color = texture2D(textures[0], uvpos);
+    else if (i == 1) tex_color = texture2D(textures[1], uvpos);
+    else if (i == 2) tex_color = texture2D(textures[2], uvpos);
+    else if (i == 3) tex_color = texture2D(textures[3], uvpos);
+    else if (i == 4) tex_color = texture2D(textures[4], uvpos);
+    else if (i == 5) tex_color = texture2D(textures[5], uvpos);
+    else if (i == 6) tex_color = texture2D(textures[6], uvpos);
+    else tex_color = texture2D(textures[7], uvpos);
+
+    tex_color.rgb = tex_color.rgb * color.a;
+    gl_FragColor = color_matrix * (tex_color * color);
+})";
 
 static const char *builtin_rgba_source =
 R"(
@@ -0,0 +1,246 @@
+#include <wayfire/opengl.hpp>
+#include <wayfire/option-wrapper.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The atlas is packed in shelves: rows of slots with about the same height,
+ * which are filled from the left. Slots which are freed are reused for
+ * textures of a size which fits in them, and a shelf whose slots are all free
+ * is emptied.
+ */
+class OpenGL::texture_atlas_t::impl
+{
+  public:
+    static constexpr int atlas_size = 1024;
+    /* Transparent pixels around each slot, so that filtering at the edges of
+     * a slot doesn't sample its neighbours */
+    static constexpr int padding = 1;
+
+    wf::option_wrapper_t<int> max_size{"core/texture_atlas_max_size"};
+
+    wf::framebuffer_t buffer;
+
+    struct shelf_t
+    {
+        int y, height;
+        int used_width = 0;
+        int slots = 0;
+        /* Slots which were freed, with their padding */
+        std::vector<wf::geometry_t> free_boxes;
+    };
+
+    std::vector<shelf_t> shelves;
+
+    struct slot_t
+    {
+        /* The slot with its padding */
+        wf::geometry_t box;
+        size_t shelf;
+        /* The size of the texture in the slot */
+        wf::dimensions_t size;
+    };
+
+    std::unordered_map<const void*, slot_t> slots;
+
+    /** @return Whether the buffer exists, creating it on first use */
+    bool ensure_buffer()
+    {
+        if (buffer.tex != (GLuint)-1)
+            return true;
+
+        OpenGL::render_begin();
+        buffer.allocate(atlas_size, atlas_size);
+        buffer.bind();
+        OpenGL::clear({0, 0, 0, 0});
+        OpenGL::render_end();
+        buffer.geometry = {0, 0, atlas_size, atlas_size};
+        OpenGL::set_texture_memory_usage("texture atlas",
+            (size_t)atlas_size * atlas_size * 4);
+
+        return buffer.tex != (GLuint)-1;
+    }
+
+    bool allocate(wf::dimensions_t size, slot_t& slot)
+    {
+        int width  = size.width + 2 * padding;
+        int height = size.height + 2 * padding;
+
+        /* Reuse the smallest free slot the texture fits in */
+        int best_area = -1;
+        for (size_t i = 0; i < shelves.size(); i++)
+        {
+            auto& boxes = shelves[i].free_boxes;
+            for (size_t j = 0; j < boxes.size(); j++)
+            {
+                auto& box = boxes[j];
+                int area = box.width * box.height;
+                if (box.width >= width && box.height >= height &&
+                    (best_area < 0 || area < best_area))
+                {
+                    best_area = area;
+                    slot.box = box;
+                    slot.shelf = i;
+                }
+            }
+        }
+
+        if (best_area >= 0)
+        {
+            auto& boxes = shelves[slot.shelf].free_boxes;
+            boxes.erase(std::find(boxes.begin(), boxes.end(), slot.box));
+            ++shelves[slot.shelf].slots;
+            slot.size = size;
+            return true;
+        }
+
+        /* Shelves much higher than the texture would waste space */
+        for (size_t i = 0; i < shelves.size(); i++)
+        {
+            auto& shelf = shelves[i];
+            if (shelf.height >= height && shelf.height <= height * 3 / 2 &&
+                shelf.used_width + width <= atlas_size)
+            {
+                slot.box = {shelf.used_width, shelf.y, width, shelf.height};
+                slot.shelf = i;
+                slot.size = size;
+                shelf.used_width += width;
+                ++shelf.slots;
+                return true;
+            }
+        }
+
+        int y = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+        if ((y + height > atlas_size) || (width > atlas_size))
+            return false;
+
+        shelf_t shelf;
+        shelf.y = y;
+        shelf.height = height;
+        shelf.used_width = width;
+        shelf.slots = 1;
+        shelves.push_back(shelf);
+
+        slot.box = {0, y, width, height};
+        slot.shelf = shelves.size() - 1;
+        slot.size = size;
+        return true;
+    }
+
+    void free(const slot_t& slot)
+    {
+        auto& shelf = shelves[slot.shelf];
+        shelf.free_boxes.push_back(slot.box);
+        if (--shelf.slots > 0)
+            return;
+
+        shelf.free_boxes.clear();
+        shelf.used_width = 0;
+        while (!shelves.empty() && shelves.back().slots == 0)
+            shelves.pop_back();
+    }
+
+    /** Draw the texture into its slot, replacing the previous contents */
+    void copy(const slot_t& slot, wf::texture_t texture)
+    {
+        OpenGL::render_begin(buffer);
+        buffer.scissor(buffer.framebuffer_box_from_geometry_box(slot.box));
+        OpenGL::clear({0, 0, 0, 0});
+
+        float alpha = OpenGL::get_alpha_modifier();
+        OpenGL::set_alpha_modifier(1.0);
+        gl_geometry geometry = {
+            (float)slot.box.x + padding, (float)slot.box.y + padding,
+            (float)slot.box.x + padding + slot.size.width,
+            (float)slot.box.y + padding + slot.size.height,
+        };
+        OpenGL::render_transformed_texture(texture, geometry, {},
+            buffer.get_orthographic_projection());
+        OpenGL::set_alpha_modifier(alpha);
+        OpenGL::render_end();
+    }
+};
+
+OpenGL::texture_atlas_t::texture_atlas_t() : priv(new impl) { }
+OpenGL::texture_atlas_t::~texture_atlas_t() = default;
+
+OpenGL::texture_atlas_t& OpenGL::texture_atlas_t::get()
+{
+    /* Never destroyed, surfaces may be destroyed after it otherwise */
+    static auto atlas = new texture_atlas_t();
+    return *atlas;
+}
+
+bool OpenGL::texture_atlas_t::update(const void *key, wf::texture_t texture,
+    wf::dimensions_t size)
+{
+    int max_size = std::min((int)priv->max_size,
+        impl::atlas_size - 2 * impl::padding);
+    if ((size.width <= 0) || (size.height <= 0) ||
+        (size.width > max_size) || (size.height > max_size) ||
+        !priv->ensure_buffer())
+    {
+        remove(key);
+        return false;
+    }
+
+    auto it = priv->slots.find(key);
+    if ((it != priv->slots.end()) &&
+        ((it->second.size.width != size.width) ||
+         (it->second.size.height != size.height)))
+    {
+        priv->free(it->second);
+        priv->slots.erase(it);
+        it = priv->slots.end();
+    }
+
+    if (it == priv->slots.end())
+    {
+        impl::slot_t slot;
+        if (!priv->allocate(size, slot))
+            return false;
+
+        it = priv->slots.emplace(key, slot).first;
+    }
+
+    priv->copy(it->second, texture);
+    return true;
+}
+
+void OpenGL::texture_atlas_t::remove(const void *key)
+{
+    auto it = priv->slots.find(key);
+    if (it == priv->slots.end())
+        return;
+
+    priv->free(it->second);
+    priv->slots.erase(it);
+}
+
+bool OpenGL::texture_atlas_t::contains(const void *key) const
+{
+    return priv->slots.count(key);
+}
+
+bool OpenGL::texture_atlas_t::apply(const void *key, textured_quad_t& quad) const
+{
+    auto it = priv->slots.find(key);
+    if (it == priv->slots.end())
+        return false;
+
+    /* The atlas is sampled like other offscreen buffers: its top edge is at
+     * v = 1 with the default texture coordinates */
+    const float size = impl::atlas_size;
+    const auto& slot = it->second;
+    float x1 = slot.box.x + impl::padding;
+    float y1 = slot.box.y + impl::padding;
+    quad.texture = wf::texture_t{priv->buffer.tex};
+    quad.tex_geometry = {
+        x1 / size, 1.0f - y1 / size,
+        (x1 + slot.size.width) / size, 1.0f - (y1 + slot.size.height) / size,
+    };
+
+    return true;
+}
@@ -0,0 +1,143 @@
+#include <wayfire/thread-pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class wf::thread_pool_t::impl
+{
+  public:
+    std::vector<std::thread> workers;
+    bool started = false;
+
+    /* Only one parallel_for() runs at a time */
+    std::mutex job_mutex;
+
+    /* Protects the fields below */
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    bool quit = false;
+    uint64_t generation = 0;
+
+    /* The current job, func is nullptr when there is none. Workers join a
+     * job only while it is set, and the caller waits until busy is 0 before
+     * clearing it, so no worker uses func after parallel_for() returns. */
+    const std::function<void(size_t, size_t)> *func = nullptr;
+    size_t size = 0, grain = 1;
+    std::atomic<size_t> next{0};
+    int busy = 0;
+
+    void run_ranges(const std::function<void(size_t, size_t)>& f,
+        size_t total, size_t step)
+    {
+        while (true)
+        {
+            size_t start = next.fetch_add(step);
+            if (start >= total)
+                break;
+
+            f(start, std::min(start + step, total));
+        }
+    }
+
+    void worker_main()
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&] () { return quit || generation != seen; });
+            if (quit)
+                return;
+
+            seen = generation;
+            if (!func)
+                continue;
+
+            auto f = func;
+            size_t total = size, step = grain;
+            ++busy;
+
+            lock.unlock();
+            run_ranges(*f, total, step);
+            lock.lock();
+
+            if (--busy == 0)
+                finished.notify_all();
+        }
+    }
+
+    void start()
+    {
+        started = true;
+        /* The calling thread takes work too */
+        int count = (int)std::thread::hardware_concurrency() - 1;
+        for (int i = 0; i < count; i++)
+            workers.emplace_back([=] () { worker_main(); });
+    }
+
+    ~impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+
+        wake.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+};
+
+wf::thread_pool_t::thread_pool_t() : priv(new impl()) {}
+wf::thread_pool_t::~thread_pool_t() = default;
+
+wf::thread_pool_t& wf::thread_pool_t::get()
+{
+    static thread_pool_t pool;
+    return pool;
+}
+
+int wf::thread_pool_t::get_concurrency()
+{
+    std::lock_guard<std::mutex> lock(priv->job_mutex);
+    if (!priv->started)
+        priv->start();
+
+    return priv->workers.size() + 1;
+}
+
+void wf::thread_pool_t::parallel_for(size_t size, size_t grain,
+    const std::function<void(size_t, size_t)>& func)
+{
+    grain = std::max(grain, (size_t)1);
+    if (size == 0)
+        return;
+
+    if (size <= grain)
+        return func(0, size);
+
+    std::lock_guard<std::mutex> job_lock(priv->job_mutex);
+    if (!priv->started)
+        priv->start();
+
+    if (priv->workers.empty())
+        return func(0, size);
+
+    std::unique_lock<std::mutex> lock(priv->mutex);
+    priv->func  = &func;
+    priv->size  = size;
+    priv->grain = grain;
+    priv->next  = 0;
+    ++priv->generation;
+    lock.unlock();
+    priv->wake.notify_all();
+
+    priv->run_ranges(func, size, grain);
+
+    lock.lock();
+    priv->finished.wait(lock, [&] () { return priv->busy == 0; });
+    priv->func = nullptr;
+}
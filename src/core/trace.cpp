@@ -0,0 +1,110 @@
+#include "wayfire/trace.hpp"
+#include <wayfire/util/log.hpp>
+
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+namespace wf
+{
+namespace trace
+{
+bool enabled = false;
+
+static FILE *trace_file = nullptr;
+static bool first_event = true;
+static int trace_pid = 0;
+
+bool start(const std::string& filename)
+{
+    stop();
+
+    trace_file = std::fopen(filename.c_str(), "w");
+    if (!trace_file)
+    {
+        LOGE("Failed to open trace file ", filename);
+        return false;
+    }
+
+    std::fputs("{\"traceEvents\":[\n", trace_file);
+    first_event = true;
+    trace_pid = getpid();
+    enabled = true;
+
+    LOGI("Writing trace to ", filename);
+    return true;
+}
+
+void stop()
+{
+    if (!trace_file)
+        return;
+
+    std::fputs("\n]}\n", trace_file);
+    std::fclose(trace_file);
+    trace_file = nullptr;
+    enabled = false;
+}
+
+/** Write the string as a JSON string literal */
+static void write_escaped(const std::string& str)
+{
+    std::fputc('"', trace_file);
+    for (unsigned char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            std::fputc('\\', trace_file);
+            std::fputc(c, trace_file);
+        } else if (c < 0x20)
+        {
+            std::fprintf(trace_file, "\\u%04x", c);
+        } else
+        {
+            std::fputc(c, trace_file);
+        }
+    }
+
+    std::fputc('"', trace_file);
+}
+
+static void write_event(char phase, const char *category,
+    const std::string& name)
+{
+    if (!trace_file)
+        return;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long usec = now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+
+    std::fputs(first_event ? "{\"name\":" : ",\n{\"name\":", trace_file);
+    first_event = false;
+
+    write_escaped(name);
+    std::fprintf(trace_file, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,"
+        "\"pid\":%d,\"tid\":%d", category, phase, usec, trace_pid, trace_pid);
+
+    /* Instant events are shown on the thread's track */
+    if (phase == 'i')
+        std::fputs(",\"s\":\"t\"", trace_file);
+
+    std::fputc('}', trace_file);
+}
+
+void begin(const char *category, const std::string& name)
+{
+    write_event('B', category, name);
+}
+
+void end(const char *category, const std::string& name)
+{
+    write_event('E', category, name);
+}
+
+void instant(const char *category, const std::string& name)
+{
+    write_event('i', category, name);
+}
+}
+}
@@ -17,8 +17,7 @@ void wayfire_exit::init()
         if (output_impl->is_inhibited())
             return false;
 
-        wf::get_core().emit_signal("shutdown", nullptr);
-        wl_display_terminate(wf::get_core().display);
+        wf::get_core().shutdown();
 
         return true;
     };
@@ -1,5 +1,6 @@
 #include <wayfire/util/log.hpp>
 #include <wayfire/debug.hpp>
+#include "core/async-log.hpp"
 #include <sstream>
 #include <iomanip>
 #include <execinfo.h>
@@ -189,6 +190,9 @@ addr2line_result locate_source_file(const demangling_result& dr)
 
 void wf::print_trace()
 {
+    /* Write out the log until the crash first */
+    wf::async_log::handle_crash();
+
     void* addrlist[MAX_FRAMES];
     int addrlen = backtrace(addrlist, MAX_FRAMES);
     if (addrlen == 0)
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -9,8 +10,10 @@
 #include <unistd.h>
 
 #include "debug-func.hpp"
+#include "core/async-log.hpp"
 #include "main.hpp"
-#include "wayfire/nonstd/safe-list.hpp"
+#include "wayfire/trace.hpp"
+#include "wayfire/accounting.hpp"
 #include <wayfire/config/file.hpp>
 
 extern "C"
@@ -27,7 +30,12 @@ extern "C"
 
 #include "core/core-impl.hpp"
 #include "view/view-impl.hpp"
+#include "view/offscreen-buffers.hpp"
 #include "wayfire/output.hpp"
+#include "wayfire/output-layout.hpp"
+#include "wayfire/render-manager.hpp"
+#include "wayfire/frame-stats.hpp"
+#include "wayfire/signal-definitions.hpp"
 
 wf_runtime_config runtime_config;
 
@@ -35,11 +43,45 @@ wf_runtime_config runtime_config;
 char buf[INOT_BUF_SIZE];
 
 static std::string config_file;
-static void reload_config(int fd)
+
+/** The string values of all options, by their full name */
+static std::map<std::string, std::string> snapshot_config()
 {
+    std::map<std::string, std::string> values;
+    for (auto& section : wf::get_core().config.get_all_sections())
+    {
+        for (auto& option : section->get_registered_options())
+        {
+            values[section->get_name() + "/" + option->get_name()] =
+                option->get_value_str();
+        }
+    }
+
+    return values;
+}
+
+static void reload_config(int fd, wf::reload_config_signal& diff)
+{
+    auto old_values = snapshot_config();
     wf::config::load_configuration_options_from_file(
         wf::get_core().config, config_file);
     inotify_add_watch(fd, config_file.c_str(), IN_MODIFY);
+
+    for (auto& [name, value] : snapshot_config())
+    {
+        auto it = old_values.find(name);
+        if ((it == old_values.end()) || (it->second != value))
+            diff.add_changed(name);
+    }
+
+    /* Removed options were reset to their defaults, or removed with their
+     * section */
+    for (auto& [name, value] : old_values)
+    {
+        auto opt = wf::get_core().config.get_option(name);
+        if (!opt || (opt->get_value_str() != value))
+            diff.add_changed(name);
+    }
 }
 
 static int handle_config_updated(int fd, uint32_t mask, void *data)
@@ -48,12 +90,88 @@ static int handle_config_updated(int fd, uint32_t mask, void *data)
 
     /* read, but don't use */
     read(fd, buf, INOT_BUF_SIZE);
-    reload_config(fd);
 
-    wf::get_core().emit_signal("reload-config", nullptr);
+    wf::reload_config_signal diff;
+    reload_config(fd, diff);
+
+    /* Editors often write the file several times per save */
+    if (diff.changed_options.empty())
+    {
+        LOGD("Configuration file reloaded without changes");
+        return 1;
+    }
+
+    wf::get_core().emit_signal("reload-config", &diff);
     return 1;
 }
 
+/* Print the repaint statistics of all outputs on SIGUSR1 */
+static int handle_dump_frame_stats(int signal, void *data)
+{
+    for (auto& output : wf::get_core().output_layout->get_outputs())
+    {
+        LOGI("Frame statistics for ", output->to_string(), ":\n",
+            output->render->get_frame_stats().to_string());
+    }
+
+    auto& loop_stats = wf::get_event_loop_stats();
+    LOGI("event loop: ", loop_stats.iterations, " iterations, ",
+        loop_stats.flush_nsec / 1000000.0, " ms flushing clients");
+
+    LOGI(wf::offscreen_buffer_registry_t::get().to_string());
+    for (auto& [owner, bytes] : OpenGL::get_texture_memory_usage())
+        LOGI("textures of ", owner, ": ", bytes / 1024, " KiB");
+
+    /* The most expensive first */
+    auto gpu_times = OpenGL::get_gpu_times();
+    std::vector<std::pair<std::string, OpenGL::gpu_time_t>> ranked(
+        gpu_times.begin(), gpu_times.end());
+    std::sort(ranked.begin(), ranked.end(), [] (auto& a, auto& b)
+    {
+        return a.second.total_nsec > b.second.total_nsec;
+    });
+
+    for (auto& [owner, time] : ranked)
+    {
+        LOGI("GPU time of ", owner, ": ", time.total_nsec / 1000000.0, " ms in ",
+            time.count, " blocks, average ",
+            time.total_nsec / 1000.0 / std::max<uint64_t>(time.count, 1),
+            " us, max ", time.max_nsec / 1000.0, " us");
+    }
+
+    auto cpu_times = wf::accounting::get_cpu_times();
+    std::vector<std::pair<std::pair<std::string, std::string>,
+        wf::accounting::cpu_time_t>> ranked_cpu(cpu_times.begin(), cpu_times.end());
+    std::sort(ranked_cpu.begin(), ranked_cpu.end(), [] (auto& a, auto& b)
+    {
+        return a.second.self_nsec > b.second.self_nsec;
+    });
+
+    for (auto& [owner, time] : ranked_cpu)
+    {
+        LOGI("CPU time of ", owner.first, " in ", owner.second, ": ",
+            time.self_nsec / 1000000.0, " ms in ", time.count,
+            " calls, max ", time.max_nsec / 1000.0, " us");
+    }
+
+    /* The views and outputs which hold the most memory first */
+    std::map<std::string, size_t> object_bytes;
+    for (auto& usage : wf::accounting::get_memory_usage())
+        object_bytes[usage.owner] += usage.bytes;
+
+    std::vector<std::pair<std::string, size_t>> ranked_memory(
+        object_bytes.begin(), object_bytes.end());
+    std::sort(ranked_memory.begin(), ranked_memory.end(), [] (auto& a, auto& b)
+    {
+        return a.second > b.second;
+    });
+
+    for (auto& [owner, bytes] : ranked_memory)
+        LOGI("memory of ", owner, ": ", bytes / 1024, " KiB");
+
+    return 0;
+}
+
 std::map<EGLint, EGLint> default_attribs = {
     {EGL_RED_SIZE, 1},
     {EGL_GREEN_SIZE, 1},
@@ -119,19 +237,6 @@ wlr_renderer *add_egl_depth_renderer(wlr_egl *egl, EGLenum platform,
     return renderer;
 }
 
-namespace wf
-{
-    namespace _safe_list_detail
-    {
-        wl_event_loop* event_loop;
-        void idle_cleanup_func(void *data)
-        {
-            auto priv = reinterpret_cast<std::function<void()>*> (data);
-            (*priv)();
-        }
-    }
-}
-
 static bool drop_permissions(void)
 {
     if (getuid() != geteuid() || getgid() != getegid())
@@ -208,22 +313,36 @@ static void signal_handler(int signal)
 
 int main(int argc, char *argv[])
 {
+    /* Child exits are handled with a signalfd, which only works if no thread
+     * can take SIGCHLD, so it is blocked before any thread is started and
+     * inherited by all of them */
+    sigset_t sigchld_mask;
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &sigchld_mask, nullptr);
+
     std::string config_dir = nonull(getenv("XDG_CONFIG_HOME"));
     if (!config_dir.compare("nil"))
         config_dir = std::string(nonull(getenv("HOME"))) + "/.config/";
     config_file = config_dir + "wayfire.ini";
 
     wf::log::log_level_t log_level = wf::log::LOG_LEVEL_INFO;
+    std::string trace_file;
+    bool async_log = false;
+    size_t flight_recorder_mib = 0;
     struct option opts[] = {
         { "config",          required_argument, NULL, 'c' },
         { "damage-debug",    no_argument,       NULL, 'd' },
         { "damage-rerender", no_argument,       NULL, 'R' },
         { "verbose",         no_argument,       NULL, 'v' },
+        { "trace",           required_argument, NULL, 't' },
+        { "async-log",       no_argument,       NULL, 'a' },
+        { "flight-recorder", required_argument, NULL, 'f' },
         { 0,                 0,                 NULL,  0  }
     };
 
     int c, i;
-    while((c = getopt_long(argc, argv, "c:dRv", opts, &i)) != -1)
+    while((c = getopt_long(argc, argv, "c:dRvt:af:", opts, &i)) != -1)
     {
         switch(c)
         {
@@ -239,6 +358,15 @@ int main(int argc, char *argv[])
             case 'v':
                 log_level = wf::log::LOG_LEVEL_DEBUG;
                 break;
+            case 't':
+                trace_file = optarg;
+                break;
+            case 'a':
+                async_log = true;
+                break;
+            case 'f':
+                flight_recorder_mib = std::strtoul(optarg, NULL, 10);
+                break;
             default:
                 std::cerr << "Unrecognized command line argument " << optarg << std::endl;
         }
@@ -247,7 +375,19 @@ int main(int argc, char *argv[])
     auto wlr_log_level =
         (log_level == wf::log::LOG_LEVEL_DEBUG ? WLR_DEBUG : WLR_ERROR);
     wlr_log_init(wlr_log_level, wlr_log_handler);
-    wf::log::initialize_logging(std::cout, log_level, detect_color_mode());
+    if (async_log || flight_recorder_mib)
+    {
+        /* Without --async-log, the flight recorder is written only on crash */
+        auto& stream = wf::async_log::start(std::cout, async_log,
+            flight_recorder_mib << 20);
+        wf::log::initialize_logging(stream, log_level, detect_color_mode());
+    } else
+    {
+        wf::log::initialize_logging(std::cout, log_level, detect_color_mode());
+    }
+
+    if (!trace_file.empty())
+        wf::trace::start(trace_file);
 
 #ifndef ASAN_ENABLED
     /* In case of crash, print the stacktrace for debugging.
@@ -258,10 +398,7 @@ int main(int argc, char *argv[])
 #endif
 
     LOGI("Starting wayfire");
-    /* First create display and initialize safe-list's event loop, so that
-     * wf objects (which depend on safe-list) can work */
     auto display = wl_display_create();
-    wf::_safe_list_detail::event_loop = wl_display_get_event_loop(display);
 
     auto& core = wf::get_core_impl();
 
@@ -284,13 +421,17 @@ int main(int argc, char *argv[])
     core.config = wf::config::build_configuration(
         PLUGIN_XML_DIR, SYSCONFDIR "/wayfire/defaults.ini", config_file);
 
+    /* build_configuration() has already read the file */
     int inotify_fd = inotify_init1(IN_CLOEXEC);
-    reload_config(inotify_fd);
+    inotify_add_watch(inotify_fd, config_file.c_str(), IN_MODIFY);
 
     wl_event_loop_add_fd(core.ev_loop, inotify_fd, WL_EVENT_READABLE,
         handle_config_updated, NULL);
     core.init();
 
+    wl_event_loop_add_signal(core.ev_loop, SIGUSR1,
+        handle_dump_frame_stats, NULL);
+
     auto server_name = wl_display_add_socket_auto(core.display);
     if (!server_name)
     {
@@ -312,11 +453,13 @@ int main(int argc, char *argv[])
     LOGI("running at server ", server_name);
     setenv("WAYLAND_DISPLAY", server_name, 1);
     wf::xwayland_set_seat(core.get_current_seat());
-    wl_display_run(core.display);
+    core.run_event_loop();
+    wf::trace::stop();
 
     /* Teardown */
     wl_display_destroy_clients(core.display);
     wl_display_destroy(core.display);
+    wf::async_log::stop();
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,199 @@
+#include "wayfire/frame-stats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+const char *wf::frame_phase_name(frame_phase_t phase)
+{
+    switch (phase)
+    {
+        case FRAME_PHASE_PRE_HOOKS:
+            return "pre-hooks";
+        case FRAME_PHASE_MAKE_CURRENT:
+            return "make-current";
+        case FRAME_PHASE_RENDER:
+            return "render";
+        case FRAME_PHASE_OVERLAY:
+            return "overlay";
+        case FRAME_PHASE_SW_CURSORS:
+            return "sw-cursors";
+        case FRAME_PHASE_POSTPROCESS:
+            return "postprocess";
+        case FRAME_PHASE_SWAP:
+            return "swap";
+        case FRAME_PHASE_FRAME_DONE:
+            return "frame-done";
+        case FRAME_PHASE_TOTAL:
+            return "total";
+        default:
+            return "invalid";
+    }
+}
+
+int wf::duration_histogram_t::get_bucket_index(int64_t usec)
+{
+    if (usec < LINEAR_BUCKETS)
+        return std::max(usec, (int64_t)0);
+
+    int msb = 63 - __builtin_clzll(usec);
+    int sub = (usec >> (msb - 3)) & (SUB_BUCKETS - 1);
+    int idx = LINEAR_BUCKETS + (msb - 4) * SUB_BUCKETS + sub;
+
+    return std::min(idx, NUM_BUCKETS - 1);
+}
+
+int64_t wf::duration_histogram_t::get_bucket_start(int bucket)
+{
+    if (bucket < LINEAR_BUCKETS)
+        return bucket;
+
+    int k = bucket - LINEAR_BUCKETS;
+    int msb = 4 + k / SUB_BUCKETS;
+    int64_t sub = k % SUB_BUCKETS;
+
+    return (SUB_BUCKETS + sub) << (msb - 3);
+}
+
+void wf::duration_histogram_t::add_sample(int64_t usec)
+{
+    usec = std::max(usec, (int64_t)0);
+    ++buckets[get_bucket_index(usec)];
+    ++count;
+    sum += usec;
+    max = std::max(max, usec);
+}
+
+void wf::duration_histogram_t::reset()
+{
+    *this = duration_histogram_t{};
+}
+
+int64_t wf::duration_histogram_t::get_mean() const
+{
+    return count ? sum / (int64_t)count : 0;
+}
+
+int64_t wf::duration_histogram_t::get_percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * count);
+    rank = std::max(rank, (uint64_t)1);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS - 1; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(get_bucket_start(i + 1) - 1, max);
+    }
+
+    return max;
+}
+
+void wf::frame_stats_t::add_frame(const frame_timings_t& timings)
+{
+    /* Skipped repaints send frame events too */
+    total_frame_done_sent += timings.frame_done_sent;
+    total_frame_done_throttled += timings.frame_done_throttled;
+    total_frame_done_deferred += timings.frame_done_deferred;
+    if (timings.skipped)
+    {
+        ++skipped_frames;
+        return;
+    }
+
+    ++rendered_frames;
+    scanout_frames += timings.direct_scanout;
+    last_frame = timings;
+    total_surfaces_rendered += timings.surfaces_rendered;
+    total_views_culled += timings.views_culled;
+    total_damage_rects += timings.damage_rects;
+    total_damage_rects_simplified += timings.damage_rects_simplified;
+    total_damage_area += timings.damage_area;
+    total_damage_area_inflated += timings.damage_area_inflated;
+    total_gl_state_changes += timings.gl_state_changes;
+    total_gl_state_changes_skipped += timings.gl_state_changes_skipped;
+    total_render_target_hits += timings.render_target_hits;
+    total_render_target_misses += timings.render_target_misses;
+    total_repaint_allocations += timings.repaint_allocations;
+    for (int i = 0; i < FRAME_PHASE_COUNT; i++)
+        phases[i].add_sample(timings.phase_usec[i]);
+}
+
+void wf::frame_stats_t::add_presentation(
+    const frame_presentation_t& presentation)
+{
+    ++presented_frames;
+    missed_vblanks += presentation.missed_vblanks;
+    present_latency.add_sample(presentation.latency_usec);
+    if (presentation.interval_usec > 0)
+        present_interval.add_sample(presentation.interval_usec);
+}
+
+void wf::frame_stats_t::add_input_latency(const std::string& device,
+    int64_t usec)
+{
+    input_latency[device].add_sample(usec);
+}
+
+void wf::frame_stats_t::reset()
+{
+    *this = frame_stats_t{};
+}
+
+std::string wf::frame_stats_t::to_string() const
+{
+    auto ms = [] (int64_t usec) { return usec / 1000.0; };
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "frames: " << rendered_frames << " rendered, "
+        << skipped_frames << " skipped, "
+        << scanout_frames << " scanned out\n";
+    out << "surfaces: " << total_surfaces_rendered << " rendered, "
+        << total_views_culled << " views culled\n";
+    out << "damage rectangles: " << total_damage_rects << " simplified to "
+        << total_damage_rects_simplified << "\n";
+    out << "damage area: " << total_damage_area << " px, "
+        << total_damage_area_inflated << " px added by effects\n";
+    out << "GL state changes: " << total_gl_state_changes << " issued, "
+        << total_gl_state_changes_skipped << " skipped\n";
+    out << "render targets: " << total_render_target_hits << " reused, "
+        << total_render_target_misses << " created\n";
+    out << "repaint lists: " << total_repaint_allocations << " allocations\n";
+    out << "frame events: " << total_frame_done_sent << " sent, "
+        << total_frame_done_throttled << " throttled, "
+        << total_frame_done_deferred << " deferred\n";
+
+    out << "presented: " << presented_frames << " frames, "
+        << missed_vblanks << " missed vblanks\n";
+
+    auto print_histogram = [&] (const char *name, const duration_histogram_t& h)
+    {
+        out << std::setw(16) << name << ": "
+            << "mean " << ms(h.get_mean())
+            << " p50 " << ms(h.get_percentile(50))
+            << " p99 " << ms(h.get_percentile(99))
+            << " max " << ms(h.get_max()) << " ms\n";
+    };
+
+    for (int i = 0; i < FRAME_PHASE_COUNT; i++)
+        print_histogram(frame_phase_name((frame_phase_t)i), phases[i]);
+    print_histogram("present-latency", present_latency);
+    print_histogram("present-interval", present_interval);
+    if (!input_latency.empty())
+        out << "input latency:\n";
+    for (auto& [device, histogram] : input_latency)
+        print_histogram(device.c_str(), histogram);
+
+    return out.str();
+}
+
+wf::event_loop_stats_t& wf::get_event_loop_stats()
+{
+    static event_loop_stats_t stats;
+    return stats;
+}
@@ -0,0 +1,177 @@
+#include "kde-blur.hpp"
+#include "kde-blur-protocol.h"
+
+#include <wayfire/util/log.hpp>
+#include "wayfire/view.hpp"
+#include "wayfire/signal-definitions.hpp"
+#include "../core/core-impl.hpp"
+#include "wayfire/core.hpp"
+#include <map>
+#include <memory>
+
+extern "C"
+{
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_region.h>
+}
+
+/** The committed blur of a surface */
+struct wf_kde_blur_state
+{
+    wf::blur_region_hint_t hint;
+    wf::wl_listener_wrapper on_surface_destroy;
+};
+
+struct wf_kde_blur
+{
+    /* Clients usually commit the blur before their surface is mapped, so the
+     * state is kept by surface and picked up by the view when it is mapped */
+    std::map<wlr_surface*, std::unique_ptr<wf_kde_blur_state>> surfaces;
+    wf::signal_connection_t on_view_mapped;
+};
+
+/** An org_kde_kwin_blur object, with its not yet committed state */
+struct wf_kde_blur_object
+{
+    wlr_surface *surface;
+    bool whole_view = true;
+    wf::region_t region;
+    wf::wl_listener_wrapper on_surface_destroy;
+};
+
+/** Update the hint of the view whose main surface is the given surface */
+static void update_view_hint(wlr_surface *surface)
+{
+    auto view = wf::wl_surface_to_wayfire_view(surface->resource);
+    if (!view || (view->get_wlr_surface() != surface))
+        return;
+
+    auto& surfaces = wf::get_core_impl().kde_blur->surfaces;
+    auto it = surfaces.find(surface);
+    if (it != surfaces.end())
+    {
+        view->store_data(
+            std::make_unique<wf::blur_region_hint_t>(it->second->hint));
+    } else if (view->has_data<wf::blur_region_hint_t>())
+    {
+        view->erase_data<wf::blur_region_hint_t>();
+    } else
+    {
+        return;
+    }
+
+    wf::_view_signal data;
+    data.view = view;
+    view->emit_signal("blur-region-changed", &data);
+    view->damage();
+}
+
+static void handle_blur_commit(wl_client *, wl_resource *resource)
+{
+    auto object = (wf_kde_blur_object*)wl_resource_get_user_data(resource);
+    if (!object->surface)
+        return;
+
+    auto surface = object->surface;
+    auto& state = wf::get_core_impl().kde_blur->surfaces[surface];
+    if (!state)
+    {
+        state = std::make_unique<wf_kde_blur_state>();
+        state->on_surface_destroy.set_callback([surface] (void*)
+        {
+            wf::get_core_impl().kde_blur->surfaces.erase(surface);
+        });
+        state->on_surface_destroy.connect(&surface->events.destroy);
+    }
+
+    state->hint.whole_view = object->whole_view;
+    state->hint.region = object->region;
+    update_view_hint(surface);
+}
+
+static void handle_blur_set_region(wl_client *, wl_resource *resource,
+    wl_resource *region)
+{
+    auto object = (wf_kde_blur_object*)wl_resource_get_user_data(resource);
+    object->whole_view = (region == NULL);
+    object->region.clear();
+    if (region)
+        object->region = wf::region_t{wlr_region_from_resource(region)};
+}
+
+static void handle_blur_release(wl_client *, wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static void handle_blur_destroy(wl_resource *resource)
+{
+    delete (wf_kde_blur_object*)wl_resource_get_user_data(resource);
+}
+
+static const struct org_kde_kwin_blur_interface kde_blur_impl = {
+    .commit     = handle_blur_commit,
+    .set_region = handle_blur_set_region,
+    .release    = handle_blur_release,
+};
+
+static void handle_blur_manager_create(wl_client *client, wl_resource *resource,
+    uint32_t id, wl_resource *surface)
+{
+    auto object = new wf_kde_blur_object;
+    object->surface = wlr_surface_from_resource(surface);
+    object->on_surface_destroy.set_callback([object] (void*)
+    {
+        object->surface = nullptr;
+        object->on_surface_destroy.disconnect();
+    });
+    object->on_surface_destroy.connect(&object->surface->events.destroy);
+
+    auto res = wl_resource_create(client, &org_kde_kwin_blur_interface,
+        wl_resource_get_version(resource), id);
+    wl_resource_set_implementation(res, &kde_blur_impl,
+        object, handle_blur_destroy);
+}
+
+static void handle_blur_manager_unset(wl_client *, wl_resource *,
+    wl_resource *surface)
+{
+    auto wlr_surface = wlr_surface_from_resource(surface);
+    wf::get_core_impl().kde_blur->surfaces.erase(wlr_surface);
+    update_view_hint(wlr_surface);
+}
+
+static const struct org_kde_kwin_blur_manager_interface kde_blur_manager_impl = {
+    .create = handle_blur_manager_create,
+    .unset  = handle_blur_manager_unset,
+};
+
+static void bind_kde_blur_manager(wl_client *client, void *data,
+    uint32_t version, uint32_t id)
+{
+    auto resource = wl_resource_create(client,
+        &org_kde_kwin_blur_manager_interface, 1, id);
+    wl_resource_set_implementation(resource, &kde_blur_manager_impl,
+        NULL, NULL);
+}
+
+wf_kde_blur *wf_kde_blur_create(wl_display *display)
+{
+    if (wl_global_create(display, &org_kde_kwin_blur_manager_interface, 1,
+            NULL, bind_kde_blur_manager) == NULL)
+    {
+        LOGE("Failed to create org_kde_kwin_blur_manager");
+        return nullptr;
+    }
+
+    auto blur = new wf_kde_blur;
+    blur->on_view_mapped.set_callback([] (wf::signal_data_t *data)
+    {
+        auto surface = get_signaled_view(data)->get_wlr_surface();
+        if (surface)
+            update_view_hint(surface);
+    });
+    wf::get_core().connect_signal("view-mapped", &blur->on_view_mapped);
+
+    return blur;
+}
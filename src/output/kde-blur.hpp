@@ -0,0 +1,14 @@
+#ifndef WF_KDE_BLUR_HPP
+#define WF_KDE_BLUR_HPP
+
+#include <wayland-server.h>
+
+struct wf_kde_blur;
+
+/**
+ * Create the org_kde_kwin_blur_manager global. The regions committed by the
+ * clients are stored on their views as wf::blur_region_hint_t.
+ */
+wf_kde_blur *wf_kde_blur_create(wl_display *display);
+
+#endif /* end of include guard: WF_KDE_BLUR_HPP */
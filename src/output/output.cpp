@@ -6,6 +6,7 @@
 #include "wayfire/render-manager.hpp"
 #include "wayfire/output-layout.hpp"
 #include "wayfire/workspace-manager.hpp"
+#include "wayfire/accounting.hpp"
 #include "wayfire/compositor-view.hpp"
 #include "wayfire-shell.hpp"
 #include "../core/seat/input-manager.hpp"
@@ -92,7 +93,10 @@ wf::output_t::~output_t()
 {
     wf::get_core_impl().input->free_output_bindings(this);
 }
-wf::output_impl_t::~output_impl_t() { }
+wf::output_impl_t::~output_impl_t()
+{
+    wf::accounting::forget_memory_usage(this);
+}
 
 wf::dimensions_t wf::output_t::get_screen_size() const
 {
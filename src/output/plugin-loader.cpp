@@ -1,4 +1,6 @@
 #include <sstream>
+#include <iomanip>
+#include <chrono>
 #include <algorithm>
 #include <set>
 #include <memory>
@@ -9,6 +11,7 @@
 #include "wayfire/output.hpp"
 #include "../core/wm.hpp"
 #include "wayfire/core.hpp"
+#include "wayfire/accounting.hpp"
 #include <wayfire/util/log.hpp>
 
 namespace
@@ -22,12 +25,40 @@ namespace
         helper.x = object;
         return helper.y;
     }
+
+    /* Cache of get_plugin_name_at(), cleared when a plugin is unloaded, as
+     * its addresses may then be reused by another plugin */
+    std::unordered_map<const void*, std::string> plugin_name_cache;
+
+    /** The plugins compiled into the binary, by name */
+    std::unordered_map<std::string, wayfire_plugin_load_func>& get_builtin_plugins()
+    {
+        static std::unordered_map<std::string, wayfire_plugin_load_func> plugins;
+        return plugins;
+    }
+
+    /** Measures the wall-clock time since its creation */
+    class stopwatch_t
+    {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+      public:
+        /** @return The elapsed time in milliseconds */
+        double elapsed() const
+        {
+            return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    };
 }
 
 plugin_manager::plugin_manager(wf::output_t *o)
 {
     this->output = o;
     this->plugins_opt.load_option("core/plugins");
+    this->lazy_init_opt.load_option("core/lazy_plugin_init");
+    idle_init_resources.set_callback([=] () { init_next_resources(); });
 
     reload_dynamic_plugins();
     load_static_plugins();
@@ -77,13 +108,51 @@ void plugin_manager::destroy_plugin(wayfire_plugin& p)
     auto handle = p->handle;
     p.reset();
 
+    /* While the addresses of its code still belong to the plugin */
+    wf::accounting::resolve_owners();
+
     /* dlopen()/dlclose() do reference counting, so we should close the plugin
      * as many times as we opened it.
      *
      * We also need to close the handle after deallocating the plugin, otherwise
      * we unload its destructor before calling it. */
     if (handle)
+    {
         dlclose(handle);
+        plugin_name_cache.clear();
+    }
+}
+
+std::string get_plugin_name_at(const void *address)
+{
+    auto it = plugin_name_cache.find(address);
+    if (it != plugin_name_cache.end())
+        return it->second;
+
+    static Dl_info core_info;
+    static bool core_resolved = dladdr((void*)&get_plugin_name_at, &core_info);
+
+    Dl_info info;
+    std::string name = "unknown";
+    if (dladdr(address, &info) && info.dli_fname)
+    {
+        if (core_resolved && (info.dli_fbase == core_info.dli_fbase))
+        {
+            name = "core";
+        } else
+        {
+            /* /usr/lib/wayfire/libblur.so -> blur */
+            name = info.dli_fname;
+            name = name.substr(name.find_last_of('/') + 1);
+            if (name.compare(0, 3, "lib") == 0)
+                name = name.substr(3);
+
+            name = name.substr(0, name.find(".so"));
+        }
+    }
+
+    plugin_name_cache[address] = name;
+    return name;
 }
 
 wayfire_plugin plugin_manager::load_plugin_from_file(std::string path)
@@ -133,6 +202,17 @@ wayfire_plugin plugin_manager::load_plugin_from_file(std::string path)
     return ptr;
 }
 
+void wf::register_builtin_plugin(const char *name, wayfire_plugin_load_func load)
+{
+    get_builtin_plugins()[name] = load;
+}
+
+wayfire_plugin plugin_manager::load_builtin_plugin(std::string name)
+{
+    LOGD("Loading built-in plugin ", name);
+    return wayfire_plugin(get_builtin_plugins().at(name)());
+}
+
 void plugin_manager::reload_dynamic_plugins()
 {
     std::string plugin_list = plugins_opt;
@@ -153,13 +233,35 @@ void plugin_manager::reload_dynamic_plugins()
     {
         if (plugin_name.size())
         {
-            if (plugin_name.at(0) == '/')
+            /* Built-in plugins are kept by their name, other plugins are
+             * loaded from the plugin directory unless a path is given */
+            if ((plugin_name.at(0) != '/') &&
+                !get_builtin_plugins().count(plugin_name))
+            {
+                plugin_name = plugin_prefix + "lib" + plugin_name + ".so";
+            }
+
+            /* A plugin listed twice is loaded only once */
+            if (std::find(next_plugins.begin(), next_plugins.end(),
+                plugin_name) == next_plugins.end())
+            {
                 next_plugins.push_back(plugin_name);
-            else
-                next_plugins.push_back(plugin_prefix + "lib" + plugin_name + ".so");
+            }
         }
     }
 
+    /* The option is also set when the config file is reloaded because of
+     * another section. Nothing to do then, unless some plugin failed to
+     * load last time, in which case it is retried. */
+    auto sorted_plugins = next_plugins;
+    std::sort(sorted_plugins.begin(), sorted_plugins.end());
+    bool all_loaded = std::all_of(next_plugins.begin(), next_plugins.end(),
+        [&] (const std::string& plugin) { return loaded_plugins.count(plugin); });
+    if ((sorted_plugins == current_plugins) && all_loaded)
+        return;
+
+    current_plugins = std::move(sorted_plugins);
+
     /* erase plugins that have been removed from the config */
     auto it = loaded_plugins.begin();
     while(it != loaded_plugins.end())
@@ -186,18 +288,93 @@ void plugin_manager::reload_dynamic_plugins()
 
 
     /* load new plugins */
+    std::vector<plugin_timing_t> timings;
     for (auto plugin : next_plugins)
     {
         if (loaded_plugins.count(plugin))
             continue;
 
-        auto ptr = load_plugin_from_file(plugin);
+        plugin_timing_t timing;
+        timing.name = plugin.substr(plugin.find_last_of('/') + 1);
+
+        stopwatch_t load_watch;
+        auto ptr = (plugin.at(0) == '/') ?
+            load_plugin_from_file(plugin) : load_builtin_plugin(plugin);
+        timing.load = load_watch.elapsed();
         if (ptr)
         {
+            stopwatch_t init_watch;
             init_plugin(ptr);
+            timing.init = init_watch.elapsed();
+
+            if (!lazy_init_opt)
+            {
+                stopwatch_t resources_watch;
+                ptr->ensure_resources();
+                timing.resources = resources_watch.elapsed();
+            }
+
             loaded_plugins[plugin] = std::move(ptr);
+            timings.push_back(timing);
         }
     }
+
+    report_timings(std::move(timings));
+    if (lazy_init_opt)
+        idle_init_resources.run_once();
+}
+
+void plugin_manager::report_timings(std::vector<plugin_timing_t> timings)
+{
+    if (timings.empty())
+        return;
+
+    auto total = [] (const plugin_timing_t& t)
+    {
+        return t.load + t.init + t.resources;
+    };
+
+    std::sort(timings.begin(), timings.end(),
+        [&] (const plugin_timing_t& a, const plugin_timing_t& b)
+    {
+        return total(a) > total(b);
+    });
+
+    double sum = 0;
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2);
+    report << std::setw(32) << "plugin" << std::setw(10) << "load ms"
+           << std::setw(10) << "init ms" << std::setw(14) << "resources ms"
+           << "\n";
+    for (auto& t : timings)
+    {
+        report << std::setw(32) << t.name << std::setw(10) << t.load
+               << std::setw(10) << t.init << std::setw(14) << t.resources
+               << "\n";
+        sum += total(t);
+    }
+
+    LOGI("Loaded ", timings.size(), " plugins on ", output->to_string(),
+        " in ", sum, "ms:\n", report.str());
+}
+
+void plugin_manager::init_next_resources()
+{
+    for (auto& [name, plugin] : loaded_plugins)
+    {
+        if (!plugin || plugin->has_resources())
+            continue;
+
+        stopwatch_t watch;
+        plugin->ensure_resources();
+        LOGD("Initialized the resources of ", name, " on ", output->to_string(),
+            " in ", watch.elapsed(), "ms");
+
+        /* One plugin per iteration, so that input and frames are handled in
+         * between */
+        idle_init_resources.run_once();
+        return;
+    }
 }
 
 template<class T> static wayfire_plugin create_plugin()
@@ -214,4 +391,7 @@ void plugin_manager::load_static_plugins()
     init_plugin(loaded_plugins["_exit"]);
     init_plugin(loaded_plugins["_focus"]);
     init_plugin(loaded_plugins["_close"]);
+
+    for (auto& name : {"_exit", "_focus", "_close"})
+        loaded_plugins[name]->ensure_resources();
 }
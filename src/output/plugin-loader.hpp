@@ -26,15 +26,45 @@ struct plugin_manager
 private:
     wf::output_t *output;
     wf::option_wrapper_t<std::string> plugins_opt;
+    wf::option_wrapper_t<bool> lazy_init_opt;
     std::unordered_map<std::string, wayfire_plugin> loaded_plugins;
+    /* The sorted paths of the plugins in core/plugins at the last reload.
+     * Only plugins added or removed since then are loaded or unloaded. */
+    std::vector<std::string> current_plugins;
+
+    /** How long loading and initializing a plugin took, in milliseconds */
+    struct plugin_timing_t
+    {
+        std::string name;
+        double load = 0, init = 0, resources = 0;
+    };
+
+    void report_timings(std::vector<plugin_timing_t> timings);
+
+    /* Initializes the resources of one plugin per idle iteration, with
+     * core/lazy_plugin_init */
+    wf::wl_idle_call idle_init_resources;
+    void init_next_resources();
 
     void deinit_plugins(bool unloadable);
 
     wayfire_plugin load_plugin_from_file(std::string path);
+    /** Create a plugin compiled into the binary, see register_builtin_plugin() */
+    wayfire_plugin load_builtin_plugin(std::string name);
     void load_static_plugins();
 
     void init_plugin(wayfire_plugin& plugin);
     void destroy_plugin(wayfire_plugin& plugin);
 };
 
+/**
+ * Find the plugin whose code defines the given address, for ex. the type_info
+ * of a lambda or of a polymorphic class, so that work done by hooks and
+ * transformers can be attributed to the plugins which added them.
+ *
+ * @return The name of the plugin, "core" for the compositor itself, or the
+ *   name of the library which contains the address.
+ */
+std::string get_plugin_name_at(const void *address);
+
 #endif /* end of include guard: PLUGIN_LOADER_HPP */
@@ -1,14 +1,28 @@
 #include "wayfire/render-manager.hpp"
 #include "wayfire/workspace-stream.hpp"
+#include "wayfire/dmabuf-export.hpp"
+#include "wayfire/frame-stats.hpp"
+#include "wayfire/trace.hpp"
+#include "wayfire/accounting.hpp"
 #include "wayfire/output.hpp"
 #include "../core/core-impl.hpp"
 #include "wayfire/util.hpp"
 #include "wayfire/workspace-manager.hpp"
 #include "../core/seat/input-manager.hpp"
+#include "../core/seat/input-latency.hpp"
 #include "../core/opengl-priv.hpp"
+#include "../view/surface-impl.hpp"
+#include "../view/view-impl.hpp"
 #include "wayfire/debug.hpp"
 #include "../main.hpp"
+#include "plugin-loader.hpp"
 #include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <tuple>
 #include <wayfire/nonstd/reverse.hpp>
 #include <wayfire/nonstd/safe-list.hpp>
 #include <wayfire/util/log.hpp>
@@ -19,12 +33,29 @@ extern "C"
 #define static
 #include <wlr/render/wlr_renderer.h>
 #undef static
+#include <wlr/backend/noop.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/util/region.h>
 }
 
 namespace wf
 {
+/**
+ * @return The owner under which the GPU time of the given hook is reported:
+ *   the plugin which defines it and the kind of the hook, or an empty string
+ *   if GPU timing is disabled.
+ */
+template<class Hook>
+static std::string get_gpu_timer_owner(const Hook& hook, const char *kind)
+{
+    if (!OpenGL::gpu_timing_active())
+        return "";
+
+    return get_plugin_name_at(&hook.target_type()) + ":" + kind;
+}
+
 /**
  * output_damage_t is responsible for tracking the damage on a given output.
  */
@@ -37,6 +68,25 @@ struct output_damage_t
     wlr_output_damage *damage_manager;
     output_t *wo;
 
+    wf::option_wrapper_t<int> damage_max_rects{"core/damage_max_rects"};
+    wf::option_wrapper_t<double> damage_merge_ratio{"core/damage_merge_ratio"};
+
+    /* Number of rectangles in the visible damage of the current frame,
+     * before and after simplify_damage() */
+    uint32_t rects_before_simplify = 0;
+    uint32_t rects_after_simplify = 0;
+
+    /* Whether damage outside of the visible part of the output needs a
+     * repaint, set while a custom renderer may show other workspaces */
+    bool repaint_offscreen = false;
+
+    /* Set by damage_whole() until the end of the frame. frame_damage then
+     * holds only the visible part of the output, the other workspaces are
+     * added by get_ws_damage() and get_scheduled_damage() on demand, so that
+     * only the workspace streams which are rendered pay for them, and any
+     * further damage in the frame is free. */
+    bool whole_damaged = false;
+
     output_damage_t(output_t *output)
     {
         this->output = output->handle;
@@ -48,18 +98,30 @@ struct output_damage_t
         on_damage_destroy.connect(&damage_manager->events.destroy);
     }
 
+    /* The time of the last damage, see wf::get_current_time() */
+    uint32_t last_damage_msec = 0;
+
     /**
      * Damage the given box
      */
     void damage(const wlr_box& box)
     {
+        wf::invalidate_view_bounding_boxes();
+        last_damage_msec = wf::get_current_time();
+        if (whole_damaged)
+        {
+            schedule_repaint();
+            return;
+        }
+
         frame_damage |= box;
 
         auto sbox = box;
         if (damage_manager)
             wlr_output_damage_add_box(damage_manager, &sbox);
 
-        schedule_repaint();
+        if (is_shown(box))
+            schedule_repaint();
     }
 
     /**
@@ -67,6 +129,14 @@ struct output_damage_t
      */
     void damage(const wf::region_t& region)
     {
+        wf::invalidate_view_bounding_boxes();
+        last_damage_msec = wf::get_current_time();
+        if (whole_damaged)
+        {
+            schedule_repaint();
+            return;
+        }
+
         frame_damage |= region;
         if (damage_manager)
         {
@@ -74,7 +144,49 @@ struct output_damage_t
                 const_cast<wf::region_t&> (region).to_pixman());
         }
 
-        schedule_repaint();
+        if (is_shown(region))
+            schedule_repaint();
+    }
+
+    /* The workspaces other than the current one whose streams were rendered
+     * in this or the last frame. Plugins may be showing them, so their damage
+     * needs a repaint too. */
+    std::vector<wf::point_t> streamed_workspaces;
+
+    /**
+     * @return Whether the damage may be visible in the next frame. Other
+     *   damage is only accumulated in frame_damage, for the workspace streams
+     *   which are started later.
+     */
+    bool is_shown(const wlr_box& box) const
+    {
+        if (repaint_offscreen || (box & get_damage_box()))
+            return true;
+
+        return std::any_of(streamed_workspaces.begin(),
+            streamed_workspaces.end(),
+            [&] (const wf::point_t& ws) { return box & get_ws_box(ws); });
+    }
+
+    bool is_shown(const wf::region_t& region) const
+    {
+        if (repaint_offscreen)
+            return true;
+
+        /* Most damage is far from any shown workspace or inside of one, the
+         * extents tell both cheaply */
+        auto extents = wlr_box_from_pixman_box(region.get_extents());
+        if (!is_shown(extents))
+            return false;
+
+        if (!(region & get_damage_box()).empty())
+            return true;
+
+        return std::any_of(streamed_workspaces.begin(),
+            streamed_workspaces.end(), [&] (const wf::point_t& ws)
+        {
+            return !(region & get_ws_box(ws)).empty();
+        });
     }
 
     /**
@@ -97,18 +209,153 @@ struct output_damage_t
         if (runtime_config.no_damage_track)
             frame_damage |= get_damage_box();
 
+        simplify_damage();
         return true;
     }
 
+    static int64_t box_area(const pixman_box32_t& box)
+    {
+        return int64_t(box.x2 - box.x1) * (box.y2 - box.y1);
+    }
+
+    static int64_t region_area(const wf::region_t& region)
+    {
+        int64_t area = 0;
+        for (const auto& rect : region)
+            area += box_area(rect);
+
+        return area;
+    }
+
+    static pixman_box32_t box_union(const pixman_box32_t& a,
+        const pixman_box32_t& b)
+    {
+        return {
+            std::min(a.x1, b.x1), std::min(a.y1, b.y1),
+            std::max(a.x2, b.x2), std::max(a.y2, b.y2),
+        };
+    }
+
+    /**
+     * Merge the boxes until at most max_boxes are left. Each step merges the
+     * two boxes whose bounding box adds the least area which wasn't damaged.
+     */
+    static void merge_boxes(std::vector<pixman_box32_t>& boxes, size_t max_boxes)
+    {
+        /* The greedy merge is quadratic in each step, so first cheaply reduce
+         * the number of boxes by merging neighbours. Pixman sorts boxes in
+         * y-x bands, so neighbours in the list are close on the screen. */
+        while (boxes.size() > 8 * max_boxes)
+        {
+            size_t j = 0;
+            for (size_t i = 0; i < boxes.size(); i += 2, j++)
+            {
+                boxes[j] = (i + 1 < boxes.size()) ?
+                    box_union(boxes[i], boxes[i + 1]) : boxes[i];
+            }
+
+            boxes.resize(j);
+        }
+
+        while (boxes.size() > max_boxes)
+        {
+            size_t best_i = 0, best_j = 1;
+            int64_t best_cost = std::numeric_limits<int64_t>::max();
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                for (size_t j = i + 1; j < boxes.size(); j++)
+                {
+                    int64_t cost = box_area(box_union(boxes[i], boxes[j])) -
+                        box_area(boxes[i]) - box_area(boxes[j]);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_i = i;
+                        best_j = j;
+                    }
+                }
+            }
+
+            boxes[best_i] = box_union(boxes[best_i], boxes[best_j]);
+            boxes.erase(boxes.begin() + best_j);
+        }
+    }
+
+    /**
+     * Reduce the number of rectangles in the visible part of the frame damage.
+     * Each rectangle is a separate scissor and draw call for every surface, so
+     * repainting a few more pixels is usually cheaper than having a fragmented
+     * region.
+     *
+     * If the damaged area covers at least core/damage_merge_ratio of its
+     * bounding box, the bounding box is used. Otherwise, rectangles are merged
+     * until there are at most core/damage_max_rects of them.
+     */
+    void simplify_damage()
+    {
+        auto box = get_damage_box();
+        wf::region_t visible = frame_damage & box;
+
+        rects_before_simplify = visible.end() - visible.begin();
+        rects_after_simplify = rects_before_simplify;
+        if (rects_before_simplify <= 1)
+            return;
+
+        int64_t damaged_area = 0;
+        for (const auto& rect : visible)
+            damaged_area += box_area(rect);
+
+        auto extents = visible.get_extents();
+        if (damaged_area >= damage_merge_ratio * box_area(extents))
+        {
+            frame_damage |= wlr_box_from_pixman_box(extents);
+            rects_after_simplify = 1;
+            return;
+        }
+
+        size_t max_rects = std::max((int)damage_max_rects, 0);
+        if (max_rects == 0 || rects_before_simplify <= max_rects)
+            return;
+
+        std::vector<pixman_box32_t> boxes(visible.begin(), visible.end());
+        merge_boxes(boxes, max_rects);
+
+        wf::region_t merged;
+        for (auto& merged_box : boxes)
+            merged |= wlr_box_from_pixman_box(merged_box);
+
+        /* Pixman splits overlapping and unaligned boxes into y-x bands, so the
+         * merged region may still have too many rectangles. In this case, the
+         * bounding box is the only way to honor the limit. */
+        rects_after_simplify = merged.end() - merged.begin();
+        if (rects_after_simplify > max_rects)
+        {
+            merged = wlr_box_from_pixman_box(extents);
+            rects_after_simplify = 1;
+        }
+
+        frame_damage |= merged;
+    }
+
     /**
      * Return the damage that has been scheduled for the next frame up to now,
      * or, if in a repaint, the damage for the current frame
      */
     wf::region_t get_scheduled_damage()
     {
+        if (whole_damaged)
+            return frame_damage | get_grid_box();
+
         return frame_damage;
     }
 
+    /** Forget the damage of the current frame */
+    void clear_damage()
+    {
+        frame_damage.clear();
+        whole_damaged = false;
+    }
+
     /**
      * Swap the output buffers. Also clears the scheduled damage.
      */
@@ -129,15 +376,22 @@ struct output_damage_t
         wlr_output_set_damage(output,
             const_cast<wf::region_t&> (swap_damage).to_pixman());
         wlr_output_commit(output);
-        frame_damage.clear();
+        clear_damage();
     }
 
+    /* Set while the output is disabled, for ex. by DPMS, and for the noop
+     * output. Damage is still accumulated, but no frames are scheduled. */
+    bool suspended = false;
+
     /**
      * Schedule a frame for the output
      */
     wf::wl_idle_call idle_redraw;
     void schedule_repaint()
     {
+        if (suspended)
+            return;
+
         wlr_output_schedule_frame(output);
         if (!idle_redraw.is_connected())
         {
@@ -176,22 +430,52 @@ struct output_damage_t
      * relative to the workspace itself
      */
     wf::region_t get_ws_damage(wf::point_t ws)
+    {
+        wf::region_t damage;
+        get_ws_damage(ws, damage);
+        return damage;
+    }
+
+    /** Same as get_ws_damage(), but reuses the memory of the given region */
+    void get_ws_damage(wf::point_t ws, wf::region_t& damage)
     {
         auto ws_box = get_ws_box(ws);
-        return (frame_damage & ws_box) + wf::point_t{-ws_box.x, -ws_box.y};
+        if (whole_damaged)
+        {
+            damage = wlr_box{0, 0, ws_box.width, ws_box.height};
+            return;
+        }
+
+        pixman_region32_intersect_rect(damage.to_pixman(),
+            frame_damage.to_pixman(),
+            ws_box.x, ws_box.y, ws_box.width, ws_box.height);
+        damage += wf::point_t{-ws_box.x, -ws_box.y};
     }
 
-    /**
-     * Same as render_manager::damage_whole()
-     */
-    void damage_whole()
+    /** The box of all workspaces, relative to the current one */
+    wlr_box get_grid_box() const
     {
         auto vsize = wo->workspace->get_workspace_grid_size();
         auto vp = wo->workspace->get_current_workspace();
 
         int sw, sh;
         wlr_output_transformed_resolution(output, &sw, &sh);
-        damage({-vp.x * sw, -vp.y * sh, vsize.width * sw, vsize.height * sh});
+        return {-vp.x * sw, -vp.y * sh, vsize.width * sw, vsize.height * sh};
+    }
+
+    /**
+     * Same as render_manager::damage_whole()
+     */
+    void damage_whole()
+    {
+        if (whole_damaged)
+        {
+            schedule_repaint();
+            return;
+        }
+
+        damage(get_damage_box());
+        whole_damaged = true;
     }
 
     wf::wl_idle_call idle_damage;
@@ -227,8 +511,67 @@ struct effect_hook_manager_t
 
     void run_effects(output_effect_type_t type)
     {
-        effects[type].for_each([] (auto effect)
-            { (*effect)(); });
+        static const char *names[] = {"pre-hook", "overlay-hook", "post-hook"};
+        static const signal_id_t sources[] = {
+            signal_id_t{"effect pre-hook"},
+            signal_id_t{"effect overlay-hook"},
+            signal_id_t{"effect post-hook"},
+        };
+
+        effects[type].for_each([type] (auto effect)
+        {
+            WF_TRACE_SCOPE("effect", names[type]);
+            accounting::scope_t accounting{effect->target_type(), sources[type]};
+            OpenGL::gpu_timer_scope_t gpu_timer{
+                get_gpu_timer_owner(*effect, names[type])};
+            (*effect)();
+        });
+    }
+};
+
+/**
+ * Runs the animation hooks of an output in one pass per frame
+ */
+struct animation_manager_t
+{
+    wf::safe_list_t<animation_hook_t*> animations;
+    uint32_t frame_time = 0;
+
+    void add_animation(animation_hook_t *hook)
+    {
+        animations.push_back(hook);
+    }
+
+    void rem_animation(animation_hook_t *hook)
+    {
+        animations.remove_all(hook);
+    }
+
+    bool active() const
+    {
+        return animations.size() > 0;
+    }
+
+    /** Run all animations with the same frame time, and damage the union
+     * of their damage */
+    void tick(output_damage_t& output_damage)
+    {
+        if (!active())
+            return;
+
+        WF_TRACE_SCOPE("effect", "animations");
+        static const signal_id_t source{"animation hook"};
+        frame_time = wf::get_current_time();
+        wf::region_t damage;
+        animations.for_each([&] (auto hook)
+        {
+            accounting::scope_t accounting{hook->target_type(), source};
+            if (!(*hook)(frame_time, damage))
+                animations.remove_all(hook);
+        });
+
+        if (!damage.empty())
+            output_damage.damage(damage);
     }
 };
 
@@ -237,17 +580,48 @@ struct effect_hook_manager_t
  */
 struct postprocessing_manager_t
 {
-    using post_container_t = wf::safe_list_t<post_hook_t*>;
+    struct post_effect_t
+    {
+        post_hook_t *hook;
+        /* Whether each output pixel depends only on the same input pixel */
+        bool local;
+    };
+
+    using post_container_t = wf::safe_list_t<post_effect_t>;
     post_container_t post_effects;
-    wf::framebuffer_base_t post_buffers[3];
+
+    /* The output of the renderer, followed by the output of each post hook
+     * except the last one, which renders to the screen.
+     *
+     * Each post hook has its own buffer, so that a buffer still contains the
+     * result of the same hook from the last frame. Local hooks then need to
+     * process only the damaged parts of their input. */
+    std::vector<wf::framebuffer_base_t> post_buffers;
     /* Buffer to which other operations render to */
     static constexpr uint32_t default_out_buffer = 0;
 
     output_t *output;
     uint32_t output_width, output_height;
+    /* The buffers are reallocated as needed, so their size is only computed
+     * for reports */
+    wf::signal_connection_t on_memory_report = [=] (wf::signal_data_t *data)
+    {
+        size_t bytes = 0;
+        for (auto& buffer : post_buffers)
+        {
+            if (buffer.fb != (uint32_t)-1)
+                bytes += (size_t)buffer.viewport_width * buffer.viewport_height * 4;
+        }
+
+        static_cast<accounting::memory_report_signal*>(data)->add(output,
+            "postprocessing", accounting::MEMORY_GPU, bytes);
+    };
+
     postprocessing_manager_t(output_t *output)
     {
         this->output = output;
+        post_buffers.resize(1);
+        wf::get_core().connect_signal("memory-report", &on_memory_report);
     }
 
     void allocate(int width, int height)
@@ -263,49 +637,96 @@ struct postprocessing_manager_t
         OpenGL::render_end();
     }
 
-    void add_post(post_hook_t* hook)
+    void add_post(post_hook_t* hook, bool local)
     {
-        post_effects.push_back(hook);
+        post_effects.push_back({hook, local});
+        update_buffer_count();
         output->render->damage_whole_idle();
     }
 
     void rem_post(post_hook_t *hook)
     {
-        post_effects.remove_all(hook);
+        post_effects.remove_if([=] (const post_effect_t& effect)
+        {
+            return effect.hook == hook;
+        });
+        update_buffer_count();
         output->render->damage_whole_idle();
     }
 
-    /* Run all postprocessing effects, rendering to alternating buffers and
-     * finally to the screen.
+    void update_buffer_count()
+    {
+        size_t count = std::max(post_effects.size(), (size_t)1);
+
+        OpenGL::render_begin();
+        for (size_t i = count; i < post_buffers.size(); i++)
+            post_buffers[i].release();
+        OpenGL::render_end();
+
+        post_buffers.resize(count);
+    }
+
+    /** @return Whether any post hook can change pixels outside of the damage */
+    bool needs_full_damage()
+    {
+        bool full = false;
+        post_effects.for_each([&] (const post_effect_t& effect)
+        {
+            full |= !effect.local;
+        });
+
+        return full;
+    }
+
+    /**
+     * Run all postprocessing effects, each rendering to its own buffer and
+     * the last one to the screen.
      *
-     * NB: 2 buffers just aren't enough. We render to the zero buffer, and then
-     * we alternately render to the second and the third. The reason: We track
-     * damage. So, we need to keep the whole buffer each frame. */
-    void run_post_effects()
+     * @param damage The boxes of the output which have changed since the last
+     *   frame (or since the screen buffer was last used), in framebuffer
+     *   coordinates. Local hooks are run with the scissor box set to each of
+     *   them in turn, non-local hooks redraw their whole output.
+     */
+    void run_post_effects(const std::vector<wlr_box>& damage)
     {
         static wf::framebuffer_base_t default_framebuffer;
         default_framebuffer.tex = default_framebuffer.fb = 0;
 
-        int last_buffer_idx = default_out_buffer;
-        int next_buffer_idx = 1;
-
-        post_effects.for_each([&] (auto post) -> void
+        int buffer_idx = default_out_buffer;
+        post_effects.for_each([&] (const post_effect_t& effect) -> void
         {
             /* The last postprocessing hook renders directly to the screen, others to
-             * the currently free buffer */
-            wf::framebuffer_base_t& next_buffer =
-                (post == post_effects.back() ? default_framebuffer :
-                 post_buffers[next_buffer_idx]);
+             * their own buffer */
+            bool is_last = (effect.hook == post_effects.back().hook);
+            wf::framebuffer_base_t& next_buffer = (is_last ?
+                default_framebuffer : post_buffers[buffer_idx + 1]);
 
             OpenGL::render_begin();
             /* Make sure we have the correct resolution */
-            next_buffer.allocate(output_width, output_height);
+            bool reallocated = next_buffer.allocate(output_width, output_height);
             OpenGL::render_end();
 
-            (*post) (post_buffers[last_buffer_idx], next_buffer);
+            auto& hook = *effect.hook;
+            static const signal_id_t source{"postprocess hook"};
+            accounting::scope_t accounting{hook.target_type(), source};
+            OpenGL::gpu_timer_scope_t gpu_timer{
+                get_gpu_timer_owner(hook, "postprocess")};
+            if (!effect.local || (reallocated && !is_last))
+            {
+                hook(post_buffers[buffer_idx], next_buffer);
+            } else
+            {
+                /* The hook calls render_begin(), which leaves the scissor
+                 * box as it is, and render_end() disables it again. */
+                for (auto& box : damage)
+                {
+                    next_buffer.scissor(box);
+                    hook(post_buffers[buffer_idx], next_buffer);
+                }
+            }
 
-            last_buffer_idx = next_buffer_idx;
-            next_buffer_idx ^= 0b11; // alternate 1 and 2
+            if (!is_last)
+                ++buffer_idx;
         });
     }
 
@@ -326,18 +747,162 @@ struct postprocessing_manager_t
     }
 };
 
+/**
+ * Measures the duration of the different repaint phases
+ */
+struct frame_phase_timer_t
+{
+    timespec repaint_started;
+    timespec phase_started;
+    frame_timings_t timings;
+    /* Counters of the GL state cache when the repaint started */
+    uint64_t gl_issued_at_start;
+    uint64_t gl_skipped_at_start;
+    OpenGL::render_target_pool_stats_t pool_at_start;
+
+    static int64_t usec_between(const timespec& a, const timespec& b)
+    {
+        return (b.tv_sec - a.tv_sec) * 1000000ll +
+            (b.tv_nsec - a.tv_nsec) / 1000ll;
+    }
+
+    /** Start measuring a new repaint */
+    void start(uint64_t frame_id)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &repaint_started);
+        phase_started = repaint_started;
+
+        timings = frame_timings_t{};
+        timings.frame_id = frame_id;
+
+        auto& state = OpenGL::get_state_cache();
+        gl_issued_at_start = state.calls_issued;
+        gl_skipped_at_start = state.calls_skipped;
+        pool_at_start = OpenGL::get_render_target_pool_stats();
+    }
+
+    /** Finish the given phase, the next phase starts immediately after it */
+    void end_phase(frame_phase_t phase)
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timings.phase_usec[phase] += usec_between(phase_started, now);
+        phase_started = now;
+    }
+
+    /** Finish the repaint and calculate its total duration */
+    void finish()
+    {
+        timings.phase_usec[FRAME_PHASE_TOTAL] =
+            usec_between(repaint_started, phase_started);
+
+        auto& state = OpenGL::get_state_cache();
+        timings.gl_state_changes = state.calls_issued - gl_issued_at_start;
+        timings.gl_state_changes_skipped =
+            state.calls_skipped - gl_skipped_at_start;
+
+        auto pool = OpenGL::get_render_target_pool_stats();
+        timings.render_target_hits = pool.hits - pool_at_start.hits;
+        timings.render_target_misses = pool.misses - pool_at_start.misses;
+    }
+};
+
+/**
+ * Predicts the next vblank of an output and how long repaints take, so that
+ * repaints can be started as late as possible while still finishing before
+ * the vblank. This shortens the time between reading input and presenting the
+ * frame which shows it.
+ */
+struct repaint_delay_t
+{
+    /* The time of the last presentation and the refresh period of the output,
+     * 0 if unknown */
+    timespec last_present = {0, 0};
+    int64_t refresh_nsec = 0;
+
+    /* Durations of the last repaints, in microseconds */
+    static constexpr int NUM_SAMPLES = 32;
+    int64_t samples[NUM_SAMPLES] = {0};
+    int next_sample = 0;
+
+    /** Record the duration of a repaint */
+    void add_render_time(int64_t usec)
+    {
+        samples[next_sample] = usec;
+        next_sample = (next_sample + 1) % NUM_SAMPLES;
+    }
+
+    /**
+     * @return The time of the next vblank, CLOCK_MONOTONIC in microseconds,
+     *   or 0 if the vblanks of the output are unknown.
+     */
+    int64_t get_next_vblank_usec() const
+    {
+        if (refresh_nsec <= 0 || last_present.tv_sec == 0)
+            return 0;
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t since_present = (now.tv_sec - last_present.tv_sec) * 1000000000ll +
+            (now.tv_nsec - last_present.tv_nsec);
+        int64_t until_vblank = refresh_nsec - since_present % refresh_nsec;
+
+        return (now.tv_sec * 1000000000ll + now.tv_nsec + until_vblank) / 1000;
+    }
+
+    /** @return The longest of the last repaints, in microseconds */
+    int64_t get_measured_render_time() const
+    {
+        return *std::max_element(samples, samples + NUM_SAMPLES);
+    }
+
+    /**
+     * @param render_usec How long the repaint is expected to take.
+     * @return How many milliseconds the repaint can be delayed, so that it
+     *   still finishes before the next vblank. 0 if the vblanks of the
+     *   output are unknown.
+     */
+    int64_t get_delay_msec(int64_t render_usec) const
+    {
+        if (refresh_nsec <= 0 || last_present.tv_sec == 0)
+            return 0;
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t since_present = (now.tv_sec - last_present.tv_sec) * 1000000000ll +
+            (now.tv_nsec - last_present.tv_nsec);
+
+        /* Vblanks keep coming even if we haven't committed for a while */
+        int64_t until_vblank = refresh_nsec - since_present % refresh_nsec;
+        int64_t delay = until_vblank - render_usec * 1000ll;
+
+        return std::max(delay / 1000000ll, (int64_t)0);
+    }
+};
+
 class wf::render_manager::impl
 {
   public:
-    wf::wl_listener_wrapper on_frame;
+    wf::wl_listener_wrapper on_enable;
 
     output_t *output;
     wf::region_t swap_damage;
     std::unique_ptr<output_damage_t> output_damage;
     std::unique_ptr<effect_hook_manager_t> effects;
+    animation_manager_t animations;
     std::unique_ptr<postprocessing_manager_t> postprocessing;
 
     wf::option_wrapper_t<wf::color_t> background_color_opt;
+    wf::option_wrapper_t<int> occluded_frame_interval{"core/occluded_frame_interval"};
+    wf::option_wrapper_t<int> thumbnail_frame_interval{"core/thumbnail_frame_interval"};
+    wf::option_wrapper_t<int> suspended_frame_interval{"core/suspended_frame_interval"};
+    wf::option_wrapper_t<bool> direct_scanout{"core/direct_scanout"};
+    wf::option_wrapper_t<bool> frame_callback_pacing{"core/frame_callback_pacing"};
+    wf::option_wrapper_t<int> frame_callback_margin{"core/frame_callback_margin"};
+
+    frame_stats_t frame_stats;
+    frame_phase_timer_t frame_timer;
+    uint64_t frame_counter = 0;
 
     impl(output_t *o)
         : output(o)
@@ -348,8 +913,20 @@ class wf::render_manager::impl
         effects = std::make_unique<effect_hook_manager_t> ();
         postprocessing = std::make_unique<postprocessing_manager_t>(o);
 
-        on_frame.set_callback([&] (void*) { paint(); });
-        on_frame.connect(&output_damage->damage_manager->events.frame);
+        on_frame.connect(this, &output_damage->damage_manager->events.frame);
+        on_present.connect(this, &output->handle->events.present);
+        on_enable.set_callback([&] (void*) { update_suspended(); });
+        on_enable.connect(&output->handle->events.enable);
+        load_max_render_time();
+        load_vrr();
+        load_allow_tearing();
+        load_render_fps();
+
+        for (auto& signal : stacking_signals)
+            output->connect_signal(signal, &on_stacking_changed);
+        for (auto& signal : adaptive_sync_signals)
+            output->connect_signal(signal, &on_adaptive_sync_changed);
+        output->connect_signal("view-damaged", &on_view_damaged);
 
         init_default_streams();
 
@@ -358,9 +935,85 @@ class wf::render_manager::impl
             output_damage->damage_whole_idle();
         });
 
+        update_suspended();
         output_damage->schedule_repaint();
     }
 
+    ~impl()
+    {
+        output->disconnect_signal("view-damaged", &on_view_damaged);
+        release_below_cache();
+        for (auto& signal : stacking_signals)
+            output->disconnect_signal(signal, &on_stacking_changed);
+        for (auto& signal : adaptive_sync_signals)
+            output->disconnect_signal(signal, &on_adaptive_sync_changed);
+    }
+
+    /**
+     * Workspace streams shared between plugins. They are kept alive by the
+     * handles given to plugins, and removed when the last one is dropped.
+     * The registry itself is shared, so that handles which outlive the
+     * output don't access it.
+     */
+    struct shared_stream_registry_t
+    {
+        struct entry_t
+        {
+            workspace_stream_t stream;
+            /* The last repaint in which the stream was updated */
+            uint64_t last_update = std::numeric_limits<uint64_t>::max();
+        };
+
+        using stream_key_t = std::tuple<int, int, float, float>;
+        std::map<stream_key_t, std::weak_ptr<entry_t>> streams;
+
+        /** @return The entry of the given stream, or null if not shared */
+        entry_t *find(const workspace_stream_t& stream)
+        {
+            for (auto& it : streams)
+            {
+                auto entry = it.second.lock();
+                if (entry && &entry->stream == &stream)
+                    return entry.get();
+            }
+
+            return nullptr;
+        }
+    };
+
+    std::shared_ptr<shared_stream_registry_t> shared_streams =
+        std::make_shared<shared_stream_registry_t>();
+
+    std::shared_ptr<workspace_stream_t> get_shared_workspace_stream(
+        wf::point_t ws, float scale_x, float scale_y)
+    {
+        shared_stream_registry_t::stream_key_t key{ws.x, ws.y, scale_x, scale_y};
+        auto entry = shared_streams->streams[key].lock();
+        if (!entry)
+        {
+            std::weak_ptr<shared_stream_registry_t> registry = shared_streams;
+            entry = std::shared_ptr<shared_stream_registry_t::entry_t>(
+                new shared_stream_registry_t::entry_t,
+                [registry, key] (shared_stream_registry_t::entry_t *entry)
+            {
+                if (auto alive = registry.lock())
+                    alive->streams.erase(key);
+
+                OpenGL::render_begin();
+                entry->stream.buffer.release();
+                OpenGL::render_end();
+                delete entry;
+            });
+
+            entry->stream.ws = ws;
+            entry->stream.scale_x = scale_x;
+            entry->stream.scale_y = scale_y;
+            shared_streams->streams[key] = entry;
+        }
+
+        return std::shared_ptr<workspace_stream_t>(entry, &entry->stream);
+    }
+
     /* A stream for each workspace */
     std::vector<std::vector<workspace_stream_t>> default_streams;
     /* The stream pointing to the current workspace */
@@ -381,15 +1034,68 @@ class wf::render_manager::impl
         }
     }
 
+    /* At most one of them is set */
     render_hook_t renderer;
+    damage_render_hook_t damage_renderer;
     void set_renderer(render_hook_t rh)
     {
         renderer = rh;
+        damage_renderer = nullptr;
+        output_damage->repaint_offscreen = (bool)rh;
         output_damage->damage_whole_idle();
     }
 
-    int constant_redraw_counter = 0;
-    void set_redraw_always(bool always)
+    void set_damage_renderer(damage_render_hook_t rh)
+    {
+        renderer = nullptr;
+        damage_renderer = rh;
+        output_damage->repaint_offscreen = (bool)rh;
+        output_damage->damage_whole_idle();
+    }
+
+    /** @return Whether a plugin renders the output instead of the default
+     * renderer */
+    bool has_custom_renderer() const
+    {
+        return renderer || damage_renderer;
+    }
+
+    glm::mat4 color_matrix{1.0};
+    void set_color_matrix(const glm::mat4& matrix)
+    {
+        color_matrix = matrix;
+        output_damage->damage_whole_idle();
+    }
+
+    int export_frames_counter = 0;
+    void set_export_frames(bool enable)
+    {
+        export_frames_counter += (enable ? 1 : -1);
+        if (export_frames_counter < 0)
+        {
+            LOGE("export_frames_counter got below 0!");
+            export_frames_counter = 0;
+        }
+    }
+
+    /** Emit frame-dmabuf with the buffer committed to the output */
+    void export_frame(const wf::region_t& buffer_damage)
+    {
+        if (!export_frames_counter || buffer_damage.empty())
+            return;
+
+        wlr_dmabuf_attributes attributes;
+        if (!wlr_output_export_dmabuf(output->handle, &attributes))
+            return;
+
+        dmabuf_frame_signal data(output, {0, 0}, attributes, buffer_damage);
+        static const wf::signal_id_t signal{"frame-dmabuf"};
+        output->render->emit_signal(signal, &data);
+        wlr_dmabuf_attributes_finish(&attributes);
+    }
+
+    int constant_redraw_counter = 0;
+    void set_redraw_always(bool always)
     {
         constant_redraw_counter += (always ? 1 : -1);
         if (constant_redraw_counter > 1) /* no change, exit */
@@ -405,6 +1111,59 @@ class wf::render_manager::impl
         output_damage->schedule_repaint();
     }
 
+    wf::wl_timer suspended_frame_timer;
+
+    /**
+     * While the output is disabled, nothing is repainted: frames, effect and
+     * animation hooks are not run at all. Clients still get a frame event
+     * every suspended_frame_interval milliseconds, so that they don't stall,
+     * but they draw rarely.
+     *
+     * The noop output, which holds the views while there are no real
+     * outputs, is never shown, so it stays suspended for all of its lifetime
+     * and does no GL work at all.
+     */
+    void update_suspended()
+    {
+        bool suspend = !output->handle->enabled ||
+            wlr_output_is_noop(output->handle);
+        if (suspend == output_damage->suspended)
+            return;
+
+        output_damage->suspended = suspend;
+        if (suspend)
+        {
+            LOGD("Suspending repaints on ", output->handle->name);
+            delayed_repaint.disconnect();
+            repaint_pending = false;
+            throttled_repaint_timer.disconnect();
+            throttled_repaint_pending = false;
+            /* Held back frame events go out with the suspended frames */
+            deferred_frame_done_timer.disconnect();
+            frame_callback_deadline = 0;
+            schedule_suspended_frame();
+        } else
+        {
+            LOGD("Resuming repaints on ", output->handle->name);
+            suspended_frame_timer.disconnect();
+            output_damage->damage(output_damage->get_damage_box());
+        }
+    }
+
+    void schedule_suspended_frame()
+    {
+        if (suspended_frame_interval <= 0)
+            return;
+
+        suspended_frame_timer.set_timeout(suspended_frame_interval, [=] ()
+        {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            send_frame_done_unthrottled(now, true);
+            schedule_suspended_frame();
+        });
+    }
+
     int output_inhibit_counter = 0;
     void add_inhibit(bool add)
     {
@@ -478,6 +1237,26 @@ class wf::render_manager::impl
         }
     }
 
+    /**
+     * Run the post hooks on the swap damage, converted to framebuffer
+     * coordinates.
+     */
+    void run_post_effects()
+    {
+        if (postprocessing->post_effects.size() == 0)
+            return;
+
+        auto fb = get_target_framebuffer();
+        std::vector<wlr_box> boxes;
+        for (const auto& rect : swap_damage)
+        {
+            boxes.push_back(fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+        }
+
+        postprocessing->run_post_effects(boxes);
+    }
+
     /**
      * Return the swap damage if called from overlay or postprocessing
      * effect callbacks or empty region otherwise.
@@ -495,27 +1274,662 @@ class wf::render_manager::impl
     {
         if (renderer)
         {
+            static const signal_id_t source{"renderer"};
+            accounting::scope_t accounting{renderer.target_type(), source};
+            OpenGL::gpu_timer_scope_t gpu_timer{
+                get_gpu_timer_owner(renderer, "renderer")};
             renderer(get_target_framebuffer());
-            /* TODO: let custom renderers specify what they want to repaint... */
+            /* What changed is unknown */
             swap_damage |= output_damage->get_damage_box();
+        } else if (damage_renderer)
+        {
+            static const signal_id_t source{"renderer"};
+            accounting::scope_t accounting{damage_renderer.target_type(), source};
+            OpenGL::gpu_timer_scope_t gpu_timer{
+                get_gpu_timer_owner(damage_renderer, "renderer")};
+            /* The hook may remove itself, for ex. at the end of a transition */
+            auto hook = damage_renderer;
+            swap_damage |= hook(get_target_framebuffer(),
+                output_damage->get_scheduled_damage());
+            swap_damage &= output_damage->get_damage_box();
+
+            /* Software cursors and overlays draw at the damage of the output
+             * itself, which the renderer may have moved elsewhere */
+            if (has_software_cursors() ||
+                effects->effects[OUTPUT_EFFECT_OVERLAY].size())
+            {
+                swap_damage |= output_damage->get_scheduled_damage() &
+                    output_damage->get_damage_box();
+            }
         } else
         {
             swap_damage = output_damage->get_scheduled_damage();
             swap_damage &= output_damage->get_damage_box();
+            OpenGL::gpu_timer_scope_t gpu_timer{
+                OpenGL::gpu_timing_active() ? "core:render" : ""};
             default_renderer();
         }
     }
 
+    /** @return Whether wlroots will draw a software cursor on the output */
+    bool has_software_cursors()
+    {
+        wlr_output_cursor *cursor;
+        wl_list_for_each(cursor, &output->handle->cursors, link)
+        {
+            if (cursor->enabled && cursor->visible &&
+                cursor != output->handle->hardware_cursor)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Find a view whose buffer can be put directly on the primary plane.
+     *
+     * That is the case when nothing besides the default renderer would touch
+     * the frame, and the topmost view on the current workspace is a single
+     * untransformed fullscreen surface covering the whole output.
+     */
+    wayfire_view find_direct_scanout_view()
+    {
+        if (!direct_scanout || has_custom_renderer() || output_inhibit_counter ||
+            runtime_config.damage_debug || color_matrix != glm::mat4(1.0) ||
+            effects->effects[OUTPUT_EFFECT_OVERLAY].size() ||
+            postprocessing->post_effects.size() || has_software_cursors())
+        {
+            return nullptr;
+        }
+
+        auto& drag_icon = wf::get_core_impl().input->drag_icon;
+        if (drag_icon && drag_icon->is_mapped() &&
+            !drag_icon->is_on_cursor_plane(output))
+        {
+            return nullptr;
+        }
+
+        auto views = output->workspace->get_views_on_workspace(
+            output->workspace->get_current_workspace(), wf::VISIBLE_LAYERS, false);
+        if (views.empty())
+            return nullptr;
+
+        auto view = views.front();
+        if (!view->fullscreen || !view->is_mapped() || !view->is_visible() ||
+            view->has_transformer() || view->get_alpha() < 1.0 ||
+            view->get_output_geometry() != output->get_relative_geometry() ||
+            view->enumerate_views().size() != 1 ||
+            !view->has_single_surface())
+        {
+            return nullptr;
+        }
+
+        return view;
+    }
+
+    /** Whether the last repaint was done via direct scanout */
+    bool scanout_active = false;
+
+    /**
+     * Try to present the current frame by attaching the client buffer of a
+     * fullscreen view directly to the output, skipping composition.
+     *
+     * @return true if the frame was committed, false if the output needs to
+     *   be composited as usual.
+     */
+    bool try_direct_scanout()
+    {
+        auto view = find_direct_scanout_view();
+        auto surface = view ? view->get_wlr_surface() : nullptr;
+        if (!surface || !wlr_surface_has_buffer(surface))
+            return false;
+
+        auto handle = output->handle;
+        if ((float)surface->current.scale != handle->scale ||
+            surface->current.transform != handle->transform ||
+            surface->current.buffer_width != handle->width ||
+            surface->current.buffer_height != handle->height)
+        {
+            return false;
+        }
+
+        /* With an alpha channel, composition would blend the surface with the
+         * background color, so the buffer has to be known to be opaque */
+        wf::region_t opaque{&surface->opaque_region};
+        wf::region_t full{wlr_box{0, 0,
+            surface->current.width, surface->current.height}};
+        if (!(full ^ opaque).empty() &&
+            wf::texture_t{surface->buffer->texture}.type != TEXTURE_TYPE_RGBX)
+        {
+            return false;
+        }
+
+        /* Nothing changed since the buffer was last scanned out */
+        if (scanout_active && output_damage->frame_damage.empty())
+            return true;
+
+        if (!wlr_output_attach_buffer(handle, &surface->buffer->base))
+            return false;
+
+        if (!wlr_output_commit(handle))
+        {
+            wlr_output_rollback(handle);
+            return false;
+        }
+
+        return true;
+    }
+
+    /* The max_render_time option of the output, parsed to milliseconds,
+     * 0 for automatic and -1 if repaints should not be delayed */
+    wf::option_wrapper_t<std::string> max_render_time_opt;
+    int max_render_time = -1;
+
+    repaint_delay_t repaint_delay;
+    wf::wl_timer delayed_repaint;
+    bool repaint_pending = false;
+
+    void load_max_render_time()
+    {
+        std::string name = output->handle->name + std::string("/max_render_time");
+        if (!wf::get_core().config.get_option(name))
+            return;
+
+        max_render_time_opt.load_option(name);
+        max_render_time_opt.set_callback([=] () { parse_max_render_time(); });
+        parse_max_render_time();
+    }
+
+    void parse_max_render_time()
+    {
+        std::string value = max_render_time_opt;
+        if (value == "off")
+        {
+            max_render_time = -1;
+        } else if (value == "auto")
+        {
+            max_render_time = 0;
+        } else
+        {
+            auto msec = wf::option_type::from_string<int>(value);
+            if (!msec || msec.value() <= 0)
+            {
+                LOGE("Invalid max_render_time ", value, " for output ",
+                    output->handle->name);
+                max_render_time = -1;
+            } else
+            {
+                max_render_time = msec.value();
+            }
+        }
+    }
+
+    enum vrr_mode_t
+    {
+        VRR_OFF,
+        VRR_ON,
+        /* Only while a fullscreen or hinted view is focused */
+        VRR_AUTO,
+    };
+
+    /* The vrr option of the output */
+    wf::option_wrapper_t<std::string> vrr_opt;
+    vrr_mode_t vrr_mode = VRR_OFF;
+    /* Whether adaptive sync was enabled on the output */
+    bool adaptive_sync = false;
+
+    void load_vrr()
+    {
+        std::string name = output->handle->name + std::string("/vrr");
+        if (!wf::get_core().config.get_option(name))
+            return;
+
+        vrr_opt.load_option(name);
+        vrr_opt.set_callback([=] () { parse_vrr(); });
+        parse_vrr();
+    }
+
+    void parse_vrr()
+    {
+        std::string value = vrr_opt;
+        if (value == "on")
+        {
+            vrr_mode = VRR_ON;
+        } else if (value == "auto")
+        {
+            vrr_mode = VRR_AUTO;
+        } else
+        {
+            if (value != "off")
+            {
+                LOGE("Invalid vrr mode ", value, " for output ",
+                    output->handle->name);
+            }
+
+            vrr_mode = VRR_OFF;
+        }
+
+        update_adaptive_sync();
+    }
+
+    /** @return Whether the focused view asks for adaptive sync */
+    bool wants_adaptive_sync()
+    {
+        if (vrr_mode != VRR_AUTO)
+            return vrr_mode == VRR_ON;
+
+        auto view = output->get_active_view();
+        return view && view->is_mapped() &&
+            (view->fullscreen || view->get_data<adaptive_sync_hint_t>());
+    }
+
+    void update_adaptive_sync()
+    {
+        bool enable = wants_adaptive_sync();
+        if (enable == adaptive_sync)
+            return;
+
+        adaptive_sync = enable;
+        wlr_output_enable_adaptive_sync(output->handle, enable);
+        /* The state is applied with the next commit */
+        output_damage->damage_whole_idle();
+
+        LOGD(enable ? "Enabling" : "Disabling", " adaptive sync on ",
+            output->handle->name);
+    }
+
+    /** @return Whether the output refreshes when a frame is committed */
+    bool adaptive_sync_active()
+    {
+        return adaptive_sync && output->handle->adaptive_sync_status ==
+            WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+    }
+
+    const std::vector<std::string> adaptive_sync_signals = {
+        "focus-view", "view-fullscreen", "view-adaptive-sync",
+    };
+
+    wf::signal_callback_t on_adaptive_sync_changed = [=] (wf::signal_data_t*)
+    {
+        update_adaptive_sync();
+    };
+
+    /* The allow_tearing option of the output */
+    wf::option_wrapper_t<std::string> allow_tearing_opt;
+    bool allow_tearing = false;
+
+    void load_allow_tearing()
+    {
+        std::string name = output->handle->name + std::string("/allow_tearing");
+        if (!wf::get_core().config.get_option(name))
+            return;
+
+        allow_tearing_opt.load_option(name);
+        allow_tearing_opt.set_callback([=] () { parse_allow_tearing(); });
+        parse_allow_tearing();
+    }
+
+    void parse_allow_tearing()
+    {
+        auto value = wf::option_type::from_string<bool>(allow_tearing_opt);
+        if (!value)
+        {
+            LOGE("Invalid allow_tearing ", (std::string)allow_tearing_opt,
+                " for output ", output->handle->name);
+        }
+
+        allow_tearing = value.value_or(false);
+    }
+
+    /**
+     * @return Whether the frames of the scanned out view should be presented
+     *   immediately. Whenever the output is composited, it is synced to the
+     *   vblank as usual.
+     */
+    bool immediate_present_active()
+    {
+        if (!allow_tearing || !scanout_active)
+            return false;
+
+        auto view = find_direct_scanout_view();
+        return view && view->get_data<tearing_hint_t>();
+    }
+
+    /* The max_render_fps, low_power_fps and low_power_timeout options of
+     * the output. 0 fps means that the rate isn't limited. */
+    wf::option_wrapper_t<std::string> max_render_fps_opt, low_power_fps_opt,
+        low_power_timeout_opt;
+    int max_render_fps = 0, low_power_fps = 0;
+    /* In milliseconds */
+    int64_t low_power_timeout = 0;
+    /* When the last repaint started, from wf::get_current_time() */
+    uint32_t last_paint_time = 0;
+
+    void load_render_fps()
+    {
+        std::string prefix = output->handle->name + std::string("/");
+        if (!wf::get_core().config.get_option(prefix + "max_render_fps"))
+            return;
+
+        max_render_fps_opt.load_option(prefix + "max_render_fps");
+        low_power_fps_opt.load_option(prefix + "low_power_fps");
+        low_power_timeout_opt.load_option(prefix + "low_power_timeout");
+        for (auto opt : {&max_render_fps_opt, &low_power_fps_opt,
+                         &low_power_timeout_opt})
+        {
+            opt->set_callback([=] () { parse_render_fps(); });
+        }
+
+        parse_render_fps();
+    }
+
+    int parse_non_negative(const std::string& option_name, std::string value)
+    {
+        auto number = wf::option_type::from_string<int>(value);
+        if (!number || number.value() < 0)
+        {
+            LOGE("Invalid ", option_name, " ", value, " for output ",
+                output->handle->name);
+            return 0;
+        }
+
+        return number.value();
+    }
+
+    void parse_render_fps()
+    {
+        max_render_fps = parse_non_negative("max_render_fps", max_render_fps_opt);
+        low_power_fps = parse_non_negative("low_power_fps", low_power_fps_opt);
+        low_power_timeout = 1000ll *
+            parse_non_negative("low_power_timeout", low_power_timeout_opt);
+    }
+
+    /**
+     * @return The shortest interval between repaints in milliseconds, 0 if
+     *   the rate isn't limited. Without input on any device for
+     *   low_power_timeout, the output drops to low_power_fps.
+     */
+    int64_t get_min_frame_interval()
+    {
+        int fps = max_render_fps;
+        uint32_t last_input =
+            wf::input_latency_tracker_t::get().get_last_event_time();
+        if (low_power_fps > 0 &&
+            (int64_t)(wf::get_current_time() - last_input) >= low_power_timeout)
+        {
+            fps = fps > 0 ? std::min(fps, low_power_fps) : low_power_fps;
+        }
+
+        return fps > 0 ? (1000 + fps - 1) / fps : 0;
+    }
+
+    /**
+     * @return How long the repaint has to wait so that the output doesn't
+     *   repaint faster than its rate limit, in milliseconds.
+     */
+    int64_t get_fps_limit_delay()
+    {
+        int64_t interval = get_min_frame_interval();
+        if (interval <= 0)
+            return 0;
+
+        int64_t elapsed = (uint32_t)(wf::get_current_time() - last_paint_time);
+        return std::max(interval - elapsed, (int64_t)0);
+    }
+
+    /**
+     * Start the repaint after a frame event, or wait until just enough time
+     * is left before the next vblank if max_render_time is set.
+     *
+     * With adaptive sync active, the output refreshes when a frame is
+     * committed, so the repaint isn't delayed and the frames follow the
+     * commits of the clients. The same goes for views which may tear.
+     */
+    void schedule_paint()
+    {
+        /* A delayed repaint is already pending, it will pick up any new
+         * damage, so frame events scheduled in the meantime are ignored. */
+        if (repaint_pending || output_damage->suspended)
+            return;
+
+        int64_t delay = 0;
+        if (adaptive_sync_active() || immediate_present_active())
+        {
+            delay = 0;
+        } else if (max_render_time > 0)
+        {
+            delay = repaint_delay.get_delay_msec(max_render_time * 1000ll);
+        } else if (max_render_time == 0)
+        {
+            /* Leave a millisecond for variations in the render time */
+            delay = repaint_delay.get_delay_msec(
+                repaint_delay.get_measured_render_time() + 1000);
+        }
+
+        delay = std::max(delay, get_fps_limit_delay());
+        if (delay <= 0)
+            return paint();
+
+        repaint_pending = true;
+        delayed_repaint.set_timeout(delay, [=] ()
+        {
+            repaint_pending = false;
+            paint();
+        });
+    }
+
+    /** A frame which was committed but not presented yet */
+    struct pending_present_t
+    {
+        uint32_t commit_seq;
+        uint64_t frame_id;
+        timespec committed;
+        /* Input events which happened before the damage of the frame */
+        std::vector<wf::input_latency_tracker_t::event_t> input_events;
+    };
+
+    /* At most a few frames are queued, unless the backend doesn't send
+     * present events at all */
+    static constexpr size_t MAX_PENDING_PRESENTS = 16;
+    std::deque<pending_present_t> pending_presents;
+    timespec last_present_time = {0, 0};
+
+    /**
+     * Called after the output was committed. Records how long the repaint
+     * took, and remembers the commit so that its presentation can be tied to
+     * the repaint.
+     */
+    void record_commit()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        repaint_delay.add_render_time(frame_phase_timer_t::usec_between(
+            frame_timer.repaint_started, now));
+
+        pending_presents.push_back({output->handle->commit_seq,
+            frame_counter, now, {}});
+        wf::input_latency_tracker_t::get().take_events(
+            output_damage->last_damage_msec,
+            pending_presents.back().input_events);
+        if (pending_presents.size() > MAX_PENDING_PRESENTS)
+            pending_presents.pop_front();
+    }
+
+    void handle_present(wlr_output_event_present *ev)
+    {
+        repaint_delay.last_present = *ev->when;
+        repaint_delay.refresh_nsec = ev->refresh;
+        send_presentation_feedback(ev);
+
+        /* Commits before this one were never presented */
+        while (!pending_presents.empty() &&
+            pending_presents.front().commit_seq < ev->commit_seq)
+        {
+            pending_presents.pop_front();
+        }
+
+        if (pending_presents.empty() ||
+            pending_presents.front().commit_seq != ev->commit_seq)
+        {
+            last_present_time = *ev->when;
+            return;
+        }
+
+        auto commit = std::move(pending_presents.front());
+        pending_presents.pop_front();
+
+        frame_presentation_t presentation;
+        presentation.frame_id = commit.frame_id;
+        presentation.latency_usec =
+            frame_phase_timer_t::usec_between(commit.committed, *ev->when);
+        if (last_present_time.tv_sec > 0)
+        {
+            presentation.interval_usec =
+                frame_phase_timer_t::usec_between(last_present_time, *ev->when);
+        }
+
+        presentation.refresh_nsec = ev->refresh;
+        if (ev->refresh > 0)
+        {
+            presentation.missed_vblanks = std::max<int64_t>(
+                presentation.latency_usec * 1000 / ev->refresh, 0);
+        }
+
+        last_present_time = *ev->when;
+        frame_stats.add_presentation(presentation);
+
+        /* Event times are in milliseconds, so the latency is accurate only
+         * to a millisecond */
+        uint32_t present_msec = wf::timespec_to_msec(*ev->when);
+        for (auto& event : commit.input_events)
+        {
+            int32_t latency_msec = present_msec - event.time_msec;
+            if (latency_msec >= 0)
+            {
+                frame_stats.add_input_latency(event.device,
+                    latency_msec * 1000ll);
+            }
+        }
+
+        frame_presented_signal data(output, presentation);
+        static const wf::signal_id_t signal{"frame-presented"};
+        output->render->emit_signal(signal, &data);
+    }
+
+    void handle_frame(wlr_output_damage*)
+    {
+        schedule_paint();
+    }
+
+    /* Emitted on every frame, so bound directly to the handlers */
+    wf::wl_listener_member<&impl::handle_frame> on_frame;
+    wf::wl_listener_member<&impl::handle_present> on_present;
+
+    /**
+     * Send wp_presentation feedback to the surfaces which are visible on the
+     * output. Surfaces without pending feedback requests are skipped by
+     * wlroots.
+     */
+    void send_presentation_feedback(wlr_output_event_present *ev)
+    {
+        auto presentation = wf::get_core().protocols.presentation;
+        if (!presentation)
+            return;
+
+        wlr_presentation_event event;
+        event.output = output->handle;
+        event.tv_sec = ev->when->tv_sec;
+        event.tv_nsec = ev->when->tv_nsec;
+        event.refresh = ev->refresh;
+        event.seq = ev->seq;
+        event.flags = ev->flags;
+
+        auto views = output->workspace->get_views_on_workspace(
+            output->workspace->get_current_workspace(), wf::MIDDLE_LAYERS, false);
+        auto additional_views = output->workspace->get_views_in_layer(
+            wf::BELOW_LAYERS | wf::ABOVE_LAYERS);
+        views.insert(views.end(),
+            additional_views.begin(), additional_views.end());
+
+        auto send_presented = [&] (wf::surface_interface_t *surface, wf::point_t)
+        {
+            auto wsurface = surface->priv->wsurface;
+            if (wsurface)
+            {
+                wlr_presentation_send_surface_presented(presentation,
+                    wsurface, &event);
+            }
+        };
+
+        for (auto& v : views)
+        {
+            v->for_each_view([&] (wayfire_view view)
+            {
+                if (view->is_mapped())
+                    view->for_each_surface(send_presented);
+            });
+        }
+    }
+
     /**
      * Repaints the whole output, includes all effects and hooks
+     *
+     * Repaints of all outputs run on the main thread, one after another.
+     * They can't be moved to per-output threads: wlroots has a single EGL
+     * context and renderer which it makes current on the calling thread,
+     * client buffers are imported into that context when they are committed,
+     * and effect hooks, transformers and workspace streams access views and
+     * other compositor state from the plugins while rendering.
      */
     void paint()
     {
-        /* Part 1: frame setup: query damage, etc. */
-        timespec repaint_started;
-        clock_gettime(CLOCK_MONOTONIC, &repaint_started);
+        WF_TRACE_SCOPE("render", "paint " + output->to_string());
 
+        /* Part 1: frame setup: query damage, etc. */
+        frame_timer.start(++frame_counter);
+        last_paint_time = wf::get_current_time();
+        last_streamed_workspaces = std::move(streamed_workspaces);
+        streamed_workspaces.clear();
+        update_shown_workspaces();
+        OpenGL::collect_gpu_timers();
+
+        /* Animations run first with the time of this frame, their damage
+         * is part of the scheduled damage */
+        animations.tick(*output_damage);
+
+        /* Pre hooks may expand the damage, for ex. blur pads it */
+        int64_t damage_area =
+            output_damage_t::region_area(output_damage->frame_damage);
         effects->run_effects(OUTPUT_EFFECT_PRE);
+        frame_timer.timings.damage_area = damage_area;
+        frame_timer.timings.damage_area_inflated += std::max<int64_t>(0,
+            output_damage_t::region_area(output_damage->frame_damage) -
+            damage_area);
+        frame_timer.end_phase(FRAME_PHASE_PRE_HOOKS);
+
+        if (try_direct_scanout())
+        {
+            if (!scanout_active)
+                LOGD("Starting direct scanout on ", output->handle->name);
+
+            scanout_active = true;
+            output_damage->clear_damage();
+            frame_timer.timings.direct_scanout = true;
+            frame_timer.end_phase(FRAME_PHASE_SWAP);
+            record_commit();
+            post_paint();
+            return;
+        }
+
+        if (scanout_active)
+        {
+            /* The back buffers have stale contents, repaint everything */
+            LOGD("Stopping direct scanout on ", output->handle->name);
+            scanout_active = false;
+            output_damage->damage(output_damage->get_damage_box());
+        }
 
         bool needs_swap;
         if (!output_damage->make_current(needs_swap))
@@ -524,11 +1938,23 @@ class wf::render_manager::impl
             return;
         }
 
+        frame_timer.end_phase(FRAME_PHASE_MAKE_CURRENT);
+        frame_timer.timings.damage_rects = output_damage->rects_before_simplify;
+        frame_timer.timings.damage_rects_simplified =
+            output_damage->rects_after_simplify;
+
+        /* A custom renderer may show workspaces other than the current one,
+         * so damage on any of them needs a repaint */
+        if (has_custom_renderer() &&
+            !output_damage->get_scheduled_damage().empty())
+            needs_swap = true;
+
         if (!needs_swap && !constant_redraw_counter)
         {
             /* Optimization: the output doesn't need a swap (so isn't damaged),
              * and no plugin wants custom redrawing - we can just skip the whole
              * repaint */
+            frame_timer.timings.skipped = true;
             post_paint();
             wlr_output_rollback(output->handle);
             return;
@@ -538,20 +1964,40 @@ class wf::render_manager::impl
 
         /* Part 2: call the renderer, which sets swap_damage and
          * draws the scenegraph */
+        auto target_fb = get_target_framebuffer();
+        OpenGL::set_color_matrix(target_fb.fb, color_matrix);
         render_output();
+        frame_timer.end_phase(FRAME_PHASE_RENDER);
+
+        if (damage_renderer && swap_damage.empty() &&
+            !postprocessing->needs_full_damage())
+        {
+            /* Nothing changed, the damage was all on parts which the renderer
+             * doesn't show */
+            OpenGL::set_color_matrix(target_fb.fb, glm::mat4(1.0));
+            OpenGL::unbind_output(output);
+            output_damage->clear_damage();
+            frame_timer.timings.skipped = true;
+            post_paint();
+            wlr_output_rollback(output->handle);
+            return;
+        }
 
         /* Part 3: finalize the scene: overlay effects and sw cursors */
         effects->run_effects(OUTPUT_EFFECT_OVERLAY);
+        OpenGL::set_color_matrix(target_fb.fb, glm::mat4(1.0));
+        frame_timer.end_phase(FRAME_PHASE_OVERLAY);
 
-        if (postprocessing->post_effects.size())
+        if (postprocessing->needs_full_damage())
             swap_damage |= output_damage->get_damage_box();
 
         OpenGL::render_begin(get_target_framebuffer());
         wlr_output_render_software_cursors(output->handle, swap_damage.to_pixman());
         OpenGL::render_end();
+        frame_timer.end_phase(FRAME_PHASE_SW_CURSORS);
 
         /* Part 4: postprocessing effects */
-        postprocessing->run_post_effects();
+        run_post_effects();
         if (output_inhibit_counter)
         {
             OpenGL::render_begin(output->handle->width, output->handle->height, 0);
@@ -559,10 +2005,17 @@ class wf::render_manager::impl
             OpenGL::render_end();
         }
 
+        frame_timer.end_phase(FRAME_PHASE_POSTPROCESS);
+
         /* Part 5: finalize frame: swap buffers, send frame_done, etc */
         OpenGL::unbind_output(output);
         output_damage->swap_buffers(swap_damage);
+        /* swap_buffers() leaves the damage in buffer coordinates */
+        export_frame(swap_damage);
         swap_damage.clear();
+        frame_timer.end_phase(FRAME_PHASE_SWAP);
+        record_commit();
+
         post_paint();
     }
 
@@ -573,12 +2026,199 @@ class wf::render_manager::impl
     {
         effects->run_effects(OUTPUT_EFFECT_POST);
 
-        if (constant_redraw_counter)
+        if (constant_redraw_counter || animations.active())
             output_damage->schedule_repaint();
 
-        /* TODO: do this only if the view isn't fully occluded by another */
+        timespec repaint_ended;
+        clock_gettime(CLOCK_MONOTONIC, &repaint_ended);
+        send_frame_done(repaint_ended);
+
+        frame_timer.end_phase(FRAME_PHASE_FRAME_DONE);
+        finish_frame_timings();
+    }
+
+    void send_frame_done(const timespec& frame_end)
+    {
+        /* This frame delivers the events requested with schedule_frame_done() */
+        frame_done_timer.disconnect();
+        frame_callback_deadline = get_frame_callback_deadline();
+        earliest_deferred_frame_done = 0;
+        if (occluded_frame_interval <= 0)
+        {
+            send_frame_done_unthrottled(frame_end);
+        } else if (has_custom_renderer())
+        {
+            send_frame_done_streamed(frame_end);
+        } else
+        {
+            send_frame_done_throttled(frame_end);
+        }
+
+        schedule_deferred_frame_done();
+    }
+
+    /* When the next repaint starts, CLOCK_MONOTONIC in microseconds, or 0 if
+     * frame events are sent right away */
+    int64_t frame_callback_deadline = 0;
+    int64_t earliest_deferred_frame_done = 0;
+    wf::wl_timer deferred_frame_done_timer;
+
+    static int64_t get_time_usec()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+    }
+
+    /** @return When the repaint after the current one is expected to start */
+    int64_t get_frame_callback_deadline()
+    {
+        if (!frame_callback_pacing || adaptive_sync_active() ||
+            immediate_present_active() || get_min_frame_interval() > 0)
+        {
+            return 0;
+        }
+
+        int64_t vblank = repaint_delay.get_next_vblank_usec();
+        if (vblank == 0)
+            return 0;
+
+        /* Without a delay, the repaint starts with the frame event at the
+         * next vblank, otherwise just before the vblank after it */
+        if (max_render_time > 0)
+        {
+            return vblank + repaint_delay.refresh_nsec / 1000 -
+                max_render_time * 1000ll;
+        } else if (max_render_time == 0)
+        {
+            return vblank + repaint_delay.refresh_nsec / 1000 -
+                repaint_delay.get_measured_render_time() - 1000;
+        }
+
+        return vblank;
+    }
+
+    /**
+     * Send a frame event to the surface, or hold it back until its client
+     * needs it to commit before frame_callback_deadline.
+     */
+    void deliver_frame_done(wf::surface_interface_t *surface,
+        const timespec& time)
+    {
+        auto& priv = surface->priv;
+        if (frame_callback_deadline > 0 && priv->commit_latency_usec > 0)
+        {
+            int64_t send_at = frame_callback_deadline -
+                priv->commit_latency_usec - frame_callback_margin * 1000ll;
+            /* Not worth a timer for less than a millisecond */
+            if (send_at - get_time_usec() >= 1000)
+            {
+                priv->frame_done_deferred = true;
+                priv->frame_done_deadline_usec = send_at;
+                ++frame_timer.timings.frame_done_deferred;
+                if (earliest_deferred_frame_done == 0 ||
+                    send_at < earliest_deferred_frame_done)
+                {
+                    earliest_deferred_frame_done = send_at;
+                }
+
+                return;
+            }
+        }
+
+        priv->frame_done_deferred = false;
+        surface->send_frame_done(time);
+        ++frame_timer.timings.frame_done_sent;
+    }
+
+    void schedule_deferred_frame_done()
+    {
+        deferred_frame_done_timer.disconnect();
+        if (earliest_deferred_frame_done == 0)
+            return;
+
+        int64_t delay = (earliest_deferred_frame_done - get_time_usec()) / 1000;
+        deferred_frame_done_timer.set_timeout(std::max(delay, (int64_t)1),
+            [=] () { send_deferred_frame_done(); });
+    }
+
+    /** Send the held back frame events whose time has come */
+    void send_deferred_frame_done()
+    {
+        const int64_t now = get_time_usec();
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+
+        earliest_deferred_frame_done = 0;
+        for (auto& v : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
+        {
+            v->for_each_view([&] (wayfire_view view)
+            {
+                if (!view->is_mapped())
+                    return;
+
+                view->for_each_surface([&] (wf::surface_interface_t *surface,
+                                            wf::point_t)
+                {
+                    auto& priv = surface->priv;
+                    if (!priv->frame_done_deferred)
+                        return;
+
+                    if (priv->frame_done_deadline_usec - now < 1000)
+                    {
+                        priv->frame_done_deferred = false;
+                        surface->send_frame_done(time);
+                    } else if (earliest_deferred_frame_done == 0 ||
+                        priv->frame_done_deadline_usec <
+                        earliest_deferred_frame_done)
+                    {
+                        earliest_deferred_frame_done =
+                            priv->frame_done_deadline_usec;
+                    }
+                });
+            });
+        }
+
+        schedule_deferred_frame_done();
+    }
+
+    wf::wl_timer frame_done_timer;
+
+    /**
+     * Same as render_manager::schedule_frame_done()
+     */
+    void schedule_frame_done()
+    {
+        if (output_damage->suspended || frame_done_timer.is_connected())
+            return;
+
+        /* Without a repaint, there is no vblank to wait for, so send the
+         * events after about a refresh period, which is when the repaint
+         * would have sent them */
+        int64_t interval = repaint_delay.refresh_nsec > 0 ?
+            repaint_delay.refresh_nsec / 1000000ll : 16;
+        interval = std::max(interval, get_min_frame_interval());
+        frame_done_timer.set_timeout(std::max(interval, (int64_t)1), [=] ()
+        {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            send_frame_done(now);
+        });
+    }
+
+    /**
+     * Send frame done to all views which might be visible, without checking
+     * whether they are occluded. Used with custom renderers, because we don't
+     * know what they draw.
+     *
+     * @param all_views Whether to send frame done to the views on all
+     *   workspaces, regardless of the renderer.
+     */
+    void send_frame_done_unthrottled(const timespec& repaint_ended,
+        bool all_views = false)
+    {
         std::vector<wayfire_view> visible_views;
-        if (renderer)
+        if (has_custom_renderer() || all_views)
         {
             visible_views = output->workspace->get_views_in_layer(
                 wf::VISIBLE_LAYERS);
@@ -596,31 +2236,261 @@ class wf::render_manager::impl
                 additional_views.begin(), additional_views.end());
         }
 
-        timespec repaint_ended;
-        clock_gettime(CLOCK_MONOTONIC, &repaint_ended);
-        for (auto& v : visible_views)
-        {
-            for (auto& view : v->enumerate_views())
+        auto send_frame = [&] (wf::surface_interface_t *surface, wf::point_t)
+        {
+            deliver_frame_done(surface, repaint_ended);
+        };
+
+        for (auto& v : visible_views)
+        {
+            v->for_each_view([&] (wayfire_view view)
+            {
+                if (view->is_mapped())
+                    view->for_each_surface(send_frame);
+            });
+        }
+    }
+
+    /* Whether a repaint has been scheduled for throttled surfaces */
+    bool throttled_repaint_pending = false;
+    wf::wl_timer throttled_repaint_timer;
+
+    /**
+     * Send frame done to all views on the output, walking them from the top
+     * to the bottom. Surfaces which are visible get a frame event on each
+     * repaint. Surfaces which are completely covered by opaque surfaces above
+     * them, or which are on another workspace, get a frame event at most once
+     * per occluded_frame_interval milliseconds, so that they don't stall.
+     */
+    void send_frame_done_throttled(const timespec& repaint_ended)
+    {
+        const int64_t now = timespec_to_msec(repaint_ended);
+        const auto cws = output->workspace->get_current_workspace();
+        const auto fb = get_target_framebuffer();
+
+        /* The part of the output which isn't covered yet, in damage coords */
+        wf::region_t uncovered = output_damage->get_damage_box();
+        bool throttled_any = false;
+
+        auto send_frame = [&] (wf::surface_interface_t *surface, bool visible)
+        {
+            if (visible ||
+                now - surface->priv->last_frame_done >= occluded_frame_interval)
+            {
+                surface->priv->last_frame_done = now;
+                deliver_frame_done(surface, repaint_ended);
+            } else
+            {
+                throttled_any = true;
+                ++frame_timer.timings.frame_done_throttled;
+            }
+        };
+
+        output->workspace->for_each_view(wf::VISIBLE_LAYERS, [&] (wayfire_view v)
+        {
+            bool on_current_ws =
+                !(output->workspace->get_view_layer(v) & wf::MIDDLE_LAYERS) ||
+                output->workspace->view_visible_on(v, cws);
+
+            v->for_each_view([&] (wayfire_view view)
+            {
+                if (!view->is_mapped())
+                    return;
+
+                auto og = view->get_output_geometry();
+                bool transformed = view->has_transformer();
+                /* Translucent views don't hide the views below them */
+                bool covers = view->get_alpha() >= 1.0;
+                auto bbox = fb.damage_box_from_geometry_box(
+                    view->get_bounding_box());
+
+                view->for_each_surface([&] (wf::surface_interface_t *surface,
+                                            wf::point_t position)
+                {
+                    bool visible = false;
+                    if (on_current_ws && transformed)
+                    {
+                        visible = !(uncovered & bbox).empty();
+                    } else if (on_current_ws)
+                    {
+                        auto size = surface->get_size();
+                        auto box = fb.damage_box_from_geometry_box({
+                            position.x, position.y, size.width, size.height});
+
+                        visible = !(uncovered & box).empty();
+                        if (covers)
+                        {
+                            surface->subtract_opaque(uncovered,
+                                position.x, position.y);
+                        }
+                    }
+
+                    send_frame(surface, visible);
+                }, {og.x, og.y});
+
+                if (on_current_ws && transformed && covers)
+                    view->subtract_transformed_opaque(uncovered, 0, 0);
+            });
+        });
+
+        if (throttled_any)
+            schedule_throttled_repaint(occluded_frame_interval);
+    }
+
+    /**
+     * Make sure throttled surfaces get their frame event even if nothing
+     * else causes a repaint
+     */
+    void schedule_throttled_repaint(int interval)
+    {
+        if (throttled_repaint_pending)
+            return;
+
+        throttled_repaint_pending = true;
+        throttled_repaint_timer.set_timeout(std::max(interval, 1), [=] ()
+        {
+            throttled_repaint_pending = false;
+            output_damage->schedule_repaint();
+        });
+    }
+
+    /* The workspaces whose streams were rendered in this and the last frame */
+    std::vector<wf::point_t> streamed_workspaces, last_streamed_workspaces;
+
+    bool was_streamed(wf::point_t ws) const
+    {
+        auto has = [&] (const std::vector<wf::point_t>& list) {
+            return std::any_of(list.begin(), list.end(),
+                [&] (const wf::point_t& p) { return p == ws; });
+        };
+
+        return has(streamed_workspaces) || has(last_streamed_workspaces);
+    }
+
+    /** Let damage on the streamed workspaces schedule frames */
+    void update_shown_workspaces()
+    {
+        auto& shown = output_damage->streamed_workspaces;
+        auto current = output->workspace->get_current_workspace();
+        shown.clear();
+        for (auto list : {&streamed_workspaces, &last_streamed_workspaces})
+        {
+            for (auto& ws : *list)
+            {
+                if ((ws != current) &&
+                    (std::find(shown.begin(), shown.end(), ws) == shown.end()))
+                {
+                    shown.push_back(ws);
+                }
+            }
+        }
+    }
+
+    /**
+     * Send frame done while a plugin renderer is active. What it draws is
+     * unknown, but usually made of workspace streams, for ex. the thumbnails
+     * of expo or the faces of the cube. The rate depends on where a view is:
+     *
+     * - views in the layers outside of workspaces, like panels, get a frame
+     *   event on each repaint
+     * - views on a workspace which was streamed recently get one at most
+     *   once per thumbnail_frame_interval milliseconds
+     * - views on other workspaces are throttled like occluded views
+     * - minimized views get none
+     */
+    void send_frame_done_streamed(const timespec& repaint_ended)
+    {
+        const int64_t now = timespec_to_msec(repaint_ended);
+        int shortest_throttled = 0;
+
+        auto send_frame = [&] (wf::surface_interface_t *surface, int interval)
+        {
+            if (interval <= 0 ||
+                now - surface->priv->last_frame_done >= interval)
+            {
+                surface->priv->last_frame_done = now;
+                deliver_frame_done(surface, repaint_ended);
+            } else
+            {
+                ++frame_timer.timings.frame_done_throttled;
+                if (shortest_throttled == 0 || interval < shortest_throttled)
+                    shortest_throttled = interval;
+            }
+        };
+
+        const auto grid = output->workspace->get_workspace_grid_size();
+        output->workspace->for_each_view(wf::VISIBLE_LAYERS, [&] (wayfire_view v)
+        {
+            int interval = 0;
+            if (output->workspace->get_view_layer(v) & wf::MIDDLE_LAYERS)
+            {
+                interval = occluded_frame_interval;
+                for (int x = 0; x < grid.width && interval > 0; x++)
+                {
+                    for (int y = 0; y < grid.height; y++)
+                    {
+                        if (was_streamed({x, y}) &&
+                            output->workspace->view_visible_on(v, {x, y}))
+                        {
+                            interval = std::min<int>(interval,
+                                thumbnail_frame_interval);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            v->for_each_view([&] (wayfire_view view)
             {
-                if (!view->is_mapped())
-                    continue;
+                if (!view->is_mapped() || view->minimized)
+                    return;
 
-                for (auto& child : view->enumerate_surfaces())
-                    child.surface->send_frame_done(repaint_ended);
-            }
-        }
+                view->for_each_surface([&] (wf::surface_interface_t *surface,
+                                            wf::point_t)
+                {
+                    send_frame(surface, interval);
+                });
+            });
+        });
+
+        if (shortest_throttled > 0)
+            schedule_throttled_repaint(shortest_throttled);
+    }
+
+    /**
+     * Record the timings of the current repaint and notify plugins about them
+     */
+    void finish_frame_timings()
+    {
+        frame_timer.finish();
+        frame_stats.add_frame(frame_timer.timings);
+        if (frame_timer.timings.skipped)
+            return;
+
+        frame_timings_signal data(output, frame_timer.timings);
+        static const wf::signal_id_t signal{"frame-timings"};
+        output->render->emit_signal(signal, &data);
     }
 
     /* Workspace stream implementation */
     void workspace_stream_start(workspace_stream_t& stream)
     {
+        auto shared = shared_streams->find(stream);
+        if (shared)
+        {
+            /* Already started by another plugin */
+            if (stream.running)
+                return workspace_stream_update(stream);
+
+            shared->last_update = frame_counter;
+        }
+
         stream.running = true;
-        stream.scale_x = stream.scale_y = 1;
 
         /* damage the whole workspace region, so that we get a full repaint
          * when updating the workspace */
         output_damage->damage(output_damage->get_ws_box(stream.ws));
-        workspace_stream_update(stream, 1, 1);
+        render_stream(stream, stream.scale_x, stream.scale_y, stream.crop);
     }
 
     /**
@@ -636,8 +2506,9 @@ class wf::render_manager::impl
          * framebuffer */
         wf::point_t pos;
         wf::region_t damage;
+        /* The opacity of the view the surface belongs to */
+        float alpha = 1.0;
     };
-    using damaged_surface = std::unique_ptr<damaged_surface_t>;
 
     /**
      * Represents the state while calculating what parts of the output
@@ -645,14 +2516,131 @@ class wf::render_manager::impl
      */
     struct workspace_stream_repaint_t
     {
-        std::vector<damaged_surface> to_render;
+        /* The first num_render entries are scheduled for this repaint. The
+         * entries after them are left from earlier frames, and are kept only
+         * so that their damage regions can be reused. */
+        std::vector<damaged_surface_t> to_render;
+        size_t num_render = 0;
         wf::region_t ws_damage;
+        /* The damage before subtracting opaque regions */
+        wf::region_t full_damage;
         wf::framebuffer_t fb;
+        /* Size of the stream buffer relative to the output, or to the crop
+         * in cropped streams */
+        float buffer_scale = 1.0;
 
         int ws_dx;
         int ws_dy;
+
+        /* The origin of the crop, the offset of views which are not on a
+         * workspace */
+        wf::point_t crop_origin = {0, 0};
+        bool cropped = false;
     };
 
+    /**
+     * The repaint states of the workspace streams. They are kept between
+     * frames together with their render lists and damage regions, so that
+     * once they have grown to the size of the scene, repaints reuse their
+     * memory instead of allocating it again. Streams can be rendered while
+     * another stream is being rendered, for ex. from its signals, so there
+     * is one state for each level of nesting.
+     */
+    std::vector<std::unique_ptr<workspace_stream_repaint_t>> repaint_pool;
+    size_t repaints_in_use = 0;
+
+    workspace_stream_repaint_t& acquire_repaint()
+    {
+        if (repaints_in_use == repaint_pool.size())
+        {
+            repaint_pool.push_back(std::make_unique<workspace_stream_repaint_t>());
+            ++frame_timer.timings.repaint_allocations;
+        }
+
+        return *repaint_pool[repaints_in_use++];
+    }
+
+    void release_repaint()
+    {
+        --repaints_in_use;
+    }
+
+    /**
+     * @return The next free entry of the render list, which is added to the
+     *   list with commit_render_entry(). Its damage has the contents of an
+     *   earlier frame, and should be overwritten.
+     */
+    damaged_surface_t& get_render_entry(workspace_stream_repaint_t& repaint)
+    {
+        if (repaint.num_render == repaint.to_render.size())
+        {
+            if (repaint.to_render.size() == repaint.to_render.capacity())
+                ++frame_timer.timings.repaint_allocations;
+            repaint.to_render.emplace_back();
+        }
+
+        auto& ds = repaint.to_render[repaint.num_render];
+        ds.surface = nullptr;
+        ds.view = nullptr;
+        ds.alpha = 1.0;
+        return ds;
+    }
+
+    void commit_render_entry(workspace_stream_repaint_t& repaint)
+    {
+        ++repaint.num_render;
+    }
+
+    /** Set damage to the intersection of the workspace damage and the box,
+     * reusing the memory of damage */
+    static void intersect_ws_damage(workspace_stream_repaint_t& repaint,
+        wlr_box box, wf::region_t& damage)
+    {
+        pixman_region32_intersect_rect(damage.to_pixman(),
+            repaint.ws_damage.to_pixman(), box.x, box.y, box.width, box.height);
+    }
+
+    /** @return Whether the region and the box intersect, without computing
+     * their intersection */
+    static bool intersects(wf::region_t& region, wlr_box box)
+    {
+        if ((box.width <= 0) || (box.height <= 0))
+            return false;
+
+        auto pbox = pixman_box_from_wlr_box(box);
+        return pixman_region32_contains_rectangle(region.to_pixman(), &pbox) !=
+               PIXMAN_REGION_OUT;
+    }
+
+    /**
+     * Subtract an opaque region from the workspace damage.
+     *
+     * @param geometry The bounding box of the surface or view, relative to the
+     *   workspace.
+     * @param subtract Subtracts the opaque region from a region in damage
+     *   coordinates at the output scale.
+     *
+     * In downscaled streams, the opaque region is scaled down to the buffer
+     * first, and pixels which are only partially covered are kept.
+     */
+    void subtract_opaque(workspace_stream_repaint_t& repaint, wlr_box geometry,
+        const std::function<void(wf::region_t&)>& subtract)
+    {
+        if (repaint.buffer_scale == 1.0f)
+        {
+            subtract(repaint.ws_damage);
+            return;
+        }
+
+        wf::region_t full = wf::region_t{geometry} * output->handle->scale;
+        wf::region_t transparent = full;
+        subtract(transparent);
+
+        wf::region_t opaque = (full ^ transparent) * repaint.buffer_scale;
+        opaque.expand_edges(-1);
+        repaint.ws_damage ^= opaque;
+    }
+
     /**
      * Calculate the damaged region of a view which renders with its snapshot
      * and add it to the render list
@@ -663,28 +2651,40 @@ class wf::render_manager::impl
     void schedule_snapshotted_view(workspace_stream_repaint_t& repaint,
         wayfire_view view, wf::point_t view_delta)
     {
-        auto ds = damaged_surface(new damaged_surface_t);
+        auto& ds = get_render_entry(repaint);
 
         auto bbox = view->get_bounding_box() + (-view_delta);
         bbox = repaint.fb.damage_box_from_geometry_box(bbox);
 
-        ds->damage = repaint.ws_damage & bbox;
-        if (!ds->damage.empty())
+        intersect_ws_damage(repaint, bbox, ds.damage);
+        if (!ds.damage.empty())
         {
-            ds->pos = view_delta;
-            ds->view = view.get();
-            view->subtract_transformed_opaque(repaint.ws_damage,
-                view_delta.x, view_delta.y);
-            repaint.to_render.push_back(std::move(ds));
+            ds.pos = view_delta;
+            ds.view = view.get();
+            ds.alpha = view->get_alpha();
+            if (ds.alpha >= 1.0)
+            {
+                subtract_opaque(repaint,
+                    view->get_bounding_box() + (-view_delta),
+                    [&] (wf::region_t& region)
+                {
+                    view->subtract_transformed_opaque(region,
+                        view_delta.x, view_delta.y);
+                });
+            }
+
+            commit_render_entry(repaint);
         }
     }
 
     /**
      * Calculate the damaged region of a simple wayfire_surface_t and
      * push it in the repaint list if needed.
+     *
+     * @param alpha The opacity of the view the surface belongs to.
      */
     void schedule_surface(workspace_stream_repaint_t& repaint,
-        wf::surface_interface_t *surface, wf::point_t pos)
+        wf::surface_interface_t *surface, wf::point_t pos, float alpha = 1.0)
     {
         if (!surface->is_mapped())
             return;
@@ -692,26 +2692,34 @@ class wf::render_manager::impl
         if (repaint.ws_damage.empty())
             return;
 
-        auto ds = damaged_surface(new damaged_surface_t);
+        auto& ds = get_render_entry(repaint);
 
-        wlr_box obox = {
+        wlr_box geometry = {
             .x = pos.x,
             .y = pos.y,
             .width = surface->get_size().width,
             .height = surface->get_size().height
         };
-        obox = repaint.fb.damage_box_from_geometry_box(obox);
+        auto obox = repaint.fb.damage_box_from_geometry_box(geometry);
 
-        ds->damage = repaint.ws_damage & obox;
-        if (!ds->damage.empty())
+        intersect_ws_damage(repaint, obox, ds.damage);
+        if (!ds.damage.empty())
         {
-            ds->pos = pos;
-            ds->surface = surface;
+            ds.pos = pos;
+            ds.surface = surface;
+            ds.alpha = alpha;
 
             /* Subtract opaque region from workspace damage. The views below
              * won't be visible, so no need to damage them */
-            ds->surface->subtract_opaque(repaint.ws_damage, pos.x, pos.y);
-            repaint.to_render.push_back(std::move(ds));
+            if (alpha >= 1.0)
+            {
+                subtract_opaque(repaint, geometry, [&] (wf::region_t& region)
+                {
+                    surface->subtract_opaque(region, pos.x, pos.y);
+                });
+            }
+
+            commit_render_entry(repaint);
         }
     }
 
@@ -721,19 +2729,27 @@ class wf::render_manager::impl
      */
     void schedule_drag_icon(workspace_stream_repaint_t& repaint)
     {
+        /* Custom renderers may show several workspaces, so the drag icon is
+         * drawn only in cropped streams, which show the output itself */
         auto& drag_icon = wf::get_core_impl().input->drag_icon;
-        if (renderer || !drag_icon || !drag_icon->is_mapped())
+        if ((has_custom_renderer() && !repaint.cropped) || !drag_icon ||
+            !drag_icon->is_mapped() || drag_icon->is_on_cursor_plane(output))
+        {
             return;
+        }
 
         drag_icon->set_output(output);
 
         auto offset = drag_icon->get_offset();
         auto og = output->get_layout_geometry();
-        offset.x -= og.x;
-        offset.y -= og.y;
+        offset.x -= og.x + repaint.crop_origin.x;
+        offset.y -= og.y + repaint.crop_origin.y;
 
-        for (auto& child : drag_icon->enumerate_surfaces(offset))
-            schedule_surface(repaint, child.surface, child.position);
+        drag_icon->for_each_surface(
+            [&] (wf::surface_interface_t *surface, wf::point_t position)
+        {
+            schedule_surface(repaint, surface, position);
+        }, offset);
     }
 
     /**
@@ -746,99 +2762,249 @@ class wf::render_manager::impl
             drag_icon->set_output(nullptr);
     }
 
+    /**
+     * All views in the visible layers together with their children, from the
+     * top to the bottom. The list doesn't depend on the workspace or on the
+     * view geometry, so it is rebuilt only when views are added, removed or
+     * restacked.
+     */
+    std::vector<wayfire_view> stacked_views;
+    /* The layer of each view in stacked_views, the one of its parent for
+     * child views */
+    std::vector<uint32_t> stacked_layers;
+    bool stacked_views_dirty = true;
+
+    wf::signal_callback_t on_stacking_changed = [=] (wf::signal_data_t*)
+    {
+        stacked_views_dirty = true;
+    };
+
+    const std::vector<std::string> stacking_signals = {
+        "attach-view", "detach-view", "layer-attach-view", "layer-detach-view",
+        "map-view", "unmap-view", "view-disappeared", "view-restacked",
+    };
+
+    const std::vector<wayfire_view>& get_stacked_views()
+    {
+        if (stacked_views_dirty)
+        {
+            stacked_views.clear();
+            stacked_layers.clear();
+            output->workspace->for_each_view(wf::VISIBLE_LAYERS,
+                [&] (wayfire_view v)
+            {
+                auto views = v->enumerate_views(false);
+                stacked_views.insert(stacked_views.end(),
+                    views.begin(), views.end());
+                stacked_layers.resize(stacked_views.size(),
+                    output->workspace->get_view_layer(v));
+            });
+
+            stacked_views_dirty = false;
+        }
+
+        return stacked_views;
+    }
+
     /**
      * Iterate all visible surfaces on the workspace, and check whether
      * they need repaint.
+     *
+     * Views which are not on the workspace are rejected by the damage test,
+     * because their bounding box doesn't intersect the workspace damage.
+     *
+     * @param layers The layers whose views are scheduled. The drag icon is
+     *   scheduled only if the workspace layers are included.
      */
     void check_schedule_surfaces(workspace_stream_repaint_t& repaint,
-        workspace_stream_t& stream)
+        uint32_t layers = wf::VISIBLE_LAYERS)
     {
-        auto views = output->workspace->get_views_on_workspace(stream.ws,
-            wf::VISIBLE_LAYERS, false);
+        const auto& views = get_stacked_views();
+        if (views.size() > repaint.to_render.capacity())
+        {
+            repaint.to_render.reserve(views.size());
+            ++frame_timer.timings.repaint_allocations;
+        }
 
-        schedule_drag_icon(repaint);
+        if (layers & wf::MIDDLE_LAYERS)
+            schedule_drag_icon(repaint);
 
-        for (auto& v : views)
+        /* The damage before subtracting opaque regions, used to tell apart
+         * views which are not damaged from views which are covered */
+        repaint.full_damage = repaint.ws_damage;
+
+        /* Views are sorted from the top to the bottom, so each opaque region
+         * we subtract from ws_damage hides whatever is below it. */
+        for (size_t i = 0; i < views.size(); i++)
         {
-            for (auto& view : v->enumerate_views(false))
+            auto& view = views[i];
+            wf::point_t view_delta = repaint.crop_origin;
+            if (!(stacked_layers[i] & layers) || !view->is_visible())
+                continue;
+
+            if (view->role != VIEW_ROLE_DESKTOP_ENVIRONMENT)
+                view_delta = {repaint.ws_dx, repaint.ws_dy};
+
+            /* Cheap rejection test before looking at individual surfaces:
+             * if nothing of the view's bounding box is left, either it is
+             * not damaged at all, or it is covered by opaque surfaces */
+            auto bbox = repaint.fb.damage_box_from_geometry_box(
+                view->get_bounding_box() + (-view_delta));
+            if (!intersects(repaint.ws_damage, bbox))
             {
-                wf::point_t view_delta{0, 0};
-                if (!view->is_visible() || repaint.ws_damage.empty())
-                    continue;
-
-                if (view->role != VIEW_ROLE_DESKTOP_ENVIRONMENT)
-                    view_delta = {repaint.ws_dx, repaint.ws_dy};
+                if (intersects(repaint.full_damage, bbox))
+                    ++frame_timer.timings.views_culled;
+                continue;
+            }
 
-                /* We use the snapshot of a view on either of the following
-                 * conditions:
-                 *
-                 * 1. The view has a transform
-                 * 2. The view is visible, but not mapped
-                 *    => it is snapshotted and kept alive by some plugin
-                 */
-                if (view->has_transformer() || !view->is_mapped())
-                {
-                    /* Snapshotted views include all of their subsurfaces, so we
-                     * don't recursively go into subsurfaces. */
-                    schedule_snapshotted_view(repaint, view, view_delta);
-                }
-                else
+            /* We use the snapshot of a view on either of the following
+             * conditions:
+             *
+             * 1. The view has a transform
+             * 2. The view is visible, but not mapped
+             *    => it is snapshotted and kept alive by some plugin
+             */
+            if (view->has_transformer() || !view->is_mapped())
+            {
+                /* Snapshotted views include all of their subsurfaces, so we
+                 * don't recursively go into subsurfaces. */
+                schedule_snapshotted_view(repaint, view, view_delta);
+            }
+            else
+            {
+                /* Make sure view position is relative to the workspace
+                 * being rendered */
+                auto obox = view->get_output_geometry();
+                obox.x -= view_delta.x;
+                obox.y -= view_delta.y;
+
+                float alpha = view->get_alpha();
+                view->for_each_surface([&] (wf::surface_interface_t *surface,
+                                            wf::point_t position)
                 {
-                    /* Make sure view position is relative to the workspace
-                     * being rendered */
-                    auto obox = view->get_output_geometry();
-                    obox.x -= view_delta.x;
-                    obox.y -= view_delta.y;
-
-                    for (auto& child : view->enumerate_surfaces({obox.x, obox.y}))
-                        schedule_surface(repaint, child.surface, child.position);
-                }
+                    schedule_surface(repaint, surface, position, alpha);
+                }, {obox.x, obox.y});
             }
         }
     }
 
+    /**
+     * @return The scale of the stream buffer relative to the output.
+     *
+     * Framebuffers have a single scale, so the larger of the requested scales
+     * is used. The default streams render directly to the output and are
+     * never scaled. Cropped streams may also be scaled up.
+     */
+    float get_buffer_scale(const workspace_stream_t& stream)
+    {
+        if (stream.buffer.fb == 0)
+            return 1.0;
+
+        float scale = std::max(stream.scale_x, stream.scale_y);
+        if (is_cropped(stream))
+            return scale > 0 ? scale : 1.0;
+
+        return (scale > 0 && scale < 1) ? scale : 1.0;
+    }
+
+    static bool is_cropped(const workspace_stream_t& stream)
+    {
+        return stream.crop.width > 0 && stream.crop.height > 0;
+    }
+
     /**
      * Setup the stream, calculate damaged region, etc.
      */
-    workspace_stream_repaint_t calculate_repaint_for_stream(
-        workspace_stream_t& stream, float scale_x, float scale_y)
+    void calculate_repaint_for_stream(workspace_stream_repaint_t& repaint,
+        workspace_stream_t& stream, float scale_x, float scale_y,
+        wf::geometry_t crop)
     {
-        workspace_stream_repaint_t repaint;
-        repaint.ws_damage = output_damage->get_ws_damage(stream.ws);
+        repaint.num_render = 0;
+        repaint.buffer_scale = 1.0;
+        repaint.crop_origin = {0, 0};
+        repaint.cropped = false;
+        output_damage->get_ws_damage(stream.ws, repaint.ws_damage);
+
+        if (scale_x != stream.scale_x || scale_y != stream.scale_y ||
+            !(crop == stream.crop))
+        {
+            stream.scale_x = scale_x;
+            stream.scale_y = scale_y;
+            stream.crop = crop;
+
+            /* The buffer is resized or shows another part of the workspace,
+             * so all of it needs to be redrawn */
+            repaint.ws_damage |= output_damage->get_damage_box();
+        }
 
         /* we don't have to update anything */
         if (repaint.ws_damage.empty())
-            return repaint;
+            return;
 
-        if (scale_x != stream.scale_x || scale_y != stream.scale_y)
-        {
-            /* FIXME: enable scaled rendering */
-            //        stream->scale_x = scale_x;
-            //        stream->scale_y = scale_y;
+        repaint.buffer_scale = get_buffer_scale(stream);
+        repaint.cropped = is_cropped(stream) && stream.buffer.fb != 0;
+        repaint.fb = get_target_framebuffer();
 
-            //   ws_damage |= get_damage_box();
+        int width  = std::ceil(output->handle->width * repaint.buffer_scale);
+        int height = std::ceil(output->handle->height * repaint.buffer_scale);
+        if (repaint.cropped)
+        {
+            float scale = output->handle->scale * repaint.buffer_scale;
+            width  = std::ceil(stream.crop.width * scale);
+            height = std::ceil(stream.crop.height * scale);
+            if (repaint.fb.wl_transform & 1)
+                std::swap(width, height);
         }
 
         OpenGL::render_begin();
-        stream.buffer.allocate(output->handle->width, output->handle->height);
+        stream.buffer.allocate(width, height);
         OpenGL::render_end();
 
-        repaint.fb = get_target_framebuffer();
         if (stream.buffer.fb != 0 && stream.buffer.tex != 0)
         {
             /* Use the workspace buffers */
             repaint.fb.fb = stream.buffer.fb;
             repaint.fb.tex = stream.buffer.tex;
+            repaint.fb.viewport_width = stream.buffer.viewport_width;
+            repaint.fb.viewport_height = stream.buffer.viewport_height;
+            repaint.fb.scale *= repaint.buffer_scale;
+        }
+
+        /* From now on, damage is relative to the stream buffer */
+        if (repaint.cropped)
+        {
+            auto crop_box = get_target_framebuffer().
+                damage_box_from_geometry_box(stream.crop);
+            repaint.ws_damage &= crop_box;
+            repaint.ws_damage += wf::point_t{-crop_box.x, -crop_box.y};
+            repaint.ws_damage *= repaint.buffer_scale;
+
+            /* With fractional output scales, the crop doesn't start at a whole
+             * pixel, so the damage is padded by the rounding error */
+            float output_scale = output->handle->scale;
+            if (output_scale != std::floor(output_scale))
+                repaint.ws_damage.expand_edges(std::ceil(repaint.buffer_scale));
+
+            repaint.fb.geometry = {0, 0, stream.crop.width, stream.crop.height};
+            repaint.ws_damage &= repaint.fb.get_damage_region();
+            repaint.crop_origin = {stream.crop.x, stream.crop.y};
+        } else if (repaint.buffer_scale != 1.0f)
+        {
+            repaint.ws_damage *= repaint.buffer_scale;
         }
 
         auto g = output->get_relative_geometry();
         auto cws = output->workspace->get_current_workspace();;
-        repaint.ws_dx = (stream.ws.x - cws.x) * g.width,
-        repaint.ws_dy = (stream.ws.y - cws.y) * g.height;
-
-        return repaint;
+        repaint.ws_dx = (stream.ws.x - cws.x) * g.width + repaint.crop_origin.x,
+        repaint.ws_dy = (stream.ws.y - cws.y) * g.height + repaint.crop_origin.y;
     }
 
+    /**
+     * Clear the parts of the damage which no opaque surface covers. The opaque
+     * regions were already subtracted from ws_damage while scheduling the
+     * surfaces. Views are drawn without depth testing, so only the color
+     * is cleared. Renderers which use depth, like cube, clear it themselves.
+     */
     void clear_empty_areas(workspace_stream_repaint_t& repaint, wf::color_t color)
     {
         OpenGL::render_begin(repaint.fb);
@@ -848,8 +3014,7 @@ class wf::render_manager::impl
             repaint.fb.scissor(
                 repaint.fb.framebuffer_box_from_damage_box(damage));
 
-            OpenGL::clear(color,
-                GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            OpenGL::clear(color, GL_COLOR_BUFFER_BIT);
         }
         OpenGL::render_end();
     }
@@ -858,38 +3023,253 @@ class wf::render_manager::impl
     {
         wf::geometry_t fb_geometry = repaint.fb.geometry;
 
-        for (auto& ds : wf::reverse(repaint.to_render))
+        frame_timer.timings.surfaces_rendered += repaint.num_render;
+
+        /* Consecutive surfaces in the texture atlas with the same opacity
+         * are drawn together */
+        OpenGL::render_batch_t atlas_batch;
+        bool batch_pending = false;
+        float batch_alpha = 1.0;
+        auto flush_atlas_batch = [&] ()
+        {
+            if (!batch_pending)
+                return;
+
+            OpenGL::set_alpha_modifier(batch_alpha);
+            OpenGL::render_begin(repaint.fb);
+            atlas_batch.flush();
+            OpenGL::render_end();
+            batch_pending = false;
+        };
+
+        for (size_t i = repaint.num_render; i-- > 0;)
         {
-            if (ds->view)
+            auto& ds = repaint.to_render[i];
+            auto wlr_surface = (ds.surface && ds.surface->priv->wsurface) ?
+                dynamic_cast<wf::wlr_surface_base_t*>(ds.surface) : nullptr;
+            if (wlr_surface && wlr_surface->is_in_atlas())
+            {
+                if (batch_alpha != ds.alpha)
+                    flush_atlas_batch();
+
+                repaint.fb.geometry = fb_geometry;
+                wlr_surface->add_to_batch(atlas_batch, repaint.fb,
+                    ds.pos.x, ds.pos.y, ds.damage);
+                batch_alpha = ds.alpha;
+                batch_pending = true;
+                continue;
+            }
+
+            flush_atlas_batch();
+            OpenGL::set_alpha_modifier(ds.alpha);
+            if (ds.view)
             {
-                repaint.fb.geometry.x = ds->pos.x;
-                repaint.fb.geometry.y = ds->pos.y;
-                ds->view->render_transformed(repaint.fb, ds->damage);
+                repaint.fb.geometry.x = ds.pos.x;
+                repaint.fb.geometry.y = ds.pos.y;
+                ds.view->render_transformed(repaint.fb, ds.damage);
             }
             else
             {
                 repaint.fb.geometry = fb_geometry;
-                ds->surface->simple_render(repaint.fb,
-                    ds->pos.x, ds->pos.y, ds->damage);
+                ds.surface->simple_render(repaint.fb,
+                    ds.pos.x, ds.pos.y, ds.damage);
             }
         }
+
+        flush_atlas_batch();
+        OpenGL::set_alpha_modifier(1.0);
     }
 
     void workspace_stream_update(workspace_stream_t& stream,
-        float scale_x = 1, float scale_y = 1)
+        float scale_x = 1, float scale_y = 1, wf::geometry_t crop = {0, 0, 0, 0})
+    {
+        if (auto shared = shared_streams->find(stream))
+        {
+            if (!stream.running)
+                return workspace_stream_start(stream);
+
+            if (shared->last_update == frame_counter)
+                return;
+
+            shared->last_update = frame_counter;
+            scale_x = stream.scale_x;
+            scale_y = stream.scale_y;
+            crop = stream.crop;
+        }
+
+        render_stream(stream, scale_x, scale_y, crop);
+    }
+
+    /**
+     * With core/cache_below_layers, the views of the background and bottom
+     * layers, like wallpapers and desktop widgets, are rendered to a buffer
+     * of the output's size only when they are damaged, and workspace streams
+     * draw that buffer instead of the views. The views of these layers are
+     * drawn at the same place on all workspaces, so a single buffer serves
+     * the current workspace as well as all streams of expo or cube.
+     *
+     * The buffer has the layout of the output's framebuffer, so it can be
+     * copied to the stream buffers as it is, except to cropped streams,
+     * which draw the views as usual.
+     */
+    struct below_cache_t
+    {
+        wf::framebuffer_t fb;
+        /* In the damage coordinates of the output */
+        wf::region_t damage;
+        /* The below views the buffer was last rendered with */
+        std::vector<wayfire_view> views;
+    } below_cache;
+
+    wf::option_wrapper_t<bool> cache_below_layers{"core/cache_below_layers"};
+
+    wf::signal_callback_t on_view_damaged = [=] (wf::signal_data_t *data)
+    {
+        auto ev = static_cast<view_damaged_signal*> (data);
+        if (output->workspace->get_view_layer(ev->view) & wf::BELOW_LAYERS)
+            below_cache.damage |= *ev->region;
+    };
+
+    void release_below_cache()
+    {
+        OpenGL::render_begin();
+        below_cache.fb.release();
+        OpenGL::render_end();
+        below_cache.views.clear();
+    }
+
+    /**
+     * Bring the buffer of the below layers up to date.
+     *
+     * @return false if the buffer can't be used, because it is disabled or
+     *   because some of the views aren't drawn the same on all workspaces.
+     */
+    bool update_below_cache()
     {
-        workspace_stream_repaint_t repaint =
-            calculate_repaint_for_stream(stream, scale_x, scale_y);
+        if (!cache_below_layers)
+        {
+            if (below_cache.fb.fb != (uint32_t)-1)
+                release_below_cache();
+
+            return false;
+        }
+
+        const auto& views = get_stacked_views();
+        std::vector<wayfire_view> below_views;
+        for (size_t i = 0; i < views.size(); i++)
+        {
+            if (!(stacked_layers[i] & wf::BELOW_LAYERS))
+                continue;
+
+            if (views[i]->role != VIEW_ROLE_DESKTOP_ENVIRONMENT)
+                return false;
+
+            below_views.push_back(views[i]);
+        }
+
+        auto target = get_target_framebuffer();
+        OpenGL::render_begin();
+        bool resized = below_cache.fb.allocate(target.viewport_width,
+            target.viewport_height);
+        OpenGL::render_end();
+
+        if (resized || (below_views != below_cache.views))
+        {
+            below_cache.damage |= output_damage->get_damage_box();
+            below_cache.views = std::move(below_views);
+        }
+
+        if (below_cache.damage.empty())
+            return true;
+
+        auto& repaint = acquire_repaint();
+        repaint.num_render = 0;
+        repaint.buffer_scale = 1.0;
+        repaint.crop_origin = {0, 0};
+        repaint.cropped = false;
+        repaint.ws_dx = repaint.ws_dy = 0;
+        repaint.ws_damage = below_cache.damage & output_damage->get_damage_box();
+        repaint.fb = target;
+        repaint.fb.fb = below_cache.fb.fb;
+        repaint.fb.tex = below_cache.fb.tex;
+
+        check_schedule_surfaces(repaint, wf::BELOW_LAYERS);
+        clear_empty_areas(repaint, {0, 0, 0, 0});
+        render_views(repaint);
+        below_cache.fb.contents_changed();
+        below_cache.damage.clear();
 
+        release_repaint();
+        return true;
+    }
+
+    /** Draw the buffer of the below layers in the remaining damage */
+    void render_below_cache(workspace_stream_repaint_t& repaint)
+    {
         if (repaint.ws_damage.empty())
             return;
 
+        /* The buffer covers the whole stream buffer, pixel for pixel unless
+         * the stream is scaled */
+        OpenGL::textured_quad_t quad;
+        quad.texture = wf::texture_t{below_cache.fb.tex};
+        quad.geometry = {-1.0f, -1.0f, 1.0f, 1.0f};
+        quad.tex_geometry = {0.0f, 0.0f, 1.0f, 1.0f};
+
+        std::vector<wlr_box> scissor_boxes;
+        for (const auto& rect : repaint.ws_damage)
+        {
+            scissor_boxes.push_back(repaint.fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+        }
+
+        OpenGL::render_batch_t batch;
+        batch.set_scissor(repaint.fb, scissor_boxes);
+        batch.add(quad);
+
+        OpenGL::render_begin(repaint.fb);
+        batch.flush();
+        OpenGL::render_end();
+    }
+
+    /** Render the damaged parts of the stream */
+    void render_stream(workspace_stream_t& stream, float scale_x, float scale_y,
+        wf::geometry_t crop)
+    {
+        if (std::none_of(streamed_workspaces.begin(), streamed_workspaces.end(),
+            [&] (const wf::point_t& ws) { return ws == stream.ws; }))
+        {
+            streamed_workspaces.push_back(stream.ws);
+            update_shown_workspaces();
+        }
+
+        auto& repaint = acquire_repaint();
+        calculate_repaint_for_stream(repaint, stream, scale_x, scale_y, crop);
+        if (!repaint.ws_damage.empty())
+        {
+            render_stream_damage(stream, repaint);
+            /* Drawn through repaint.fb, which only shares the buffer's fb */
+            stream.buffer.contents_changed();
+        }
+
+        release_repaint();
+    }
+
+    void render_stream_damage(workspace_stream_t& stream,
+        workspace_stream_repaint_t& repaint)
+    {
         {
+            int64_t damage_area = output_damage_t::region_area(repaint.ws_damage);
             stream_signal_t data(stream.ws, repaint.ws_damage, repaint.fb);
-            output->render->emit_signal("workspace-stream-pre", &data);
+            static const wf::signal_id_t signal{"workspace-stream-pre"};
+            output->render->emit_signal(signal, &data);
+            frame_timer.timings.damage_area_inflated += std::max<int64_t>(0,
+                output_damage_t::region_area(repaint.ws_damage) - damage_area);
         }
 
-        check_schedule_surfaces(repaint, stream);
+        bool use_below_cache = !repaint.cropped && update_below_cache();
+        check_schedule_surfaces(repaint, use_below_cache ?
+            (wf::VISIBLE_LAYERS & ~wf::BELOW_LAYERS) : wf::VISIBLE_LAYERS);
 
         if (stream.background.a < 0)
         {
@@ -898,17 +3278,50 @@ class wf::render_manager::impl
             clear_empty_areas(repaint, stream.background);
         }
 
+        if (use_below_cache)
+            render_below_cache(repaint);
+
         render_views(repaint);
 
         unschedule_drag_icon();
         {
             stream_signal_t data(stream.ws, repaint.ws_damage, repaint.fb);
-            output->render->emit_signal("workspace-stream-post", &data);
+            static const wf::signal_id_t signal{"workspace-stream-post"};
+            output->render->emit_signal(signal, &data);
         }
+
+        if (stream.export_dmabuf && !shared_streams->find(stream))
+            export_stream(stream, repaint.ws_damage);
+    }
+
+    /** Emit workspace-stream-dmabuf with the updated stream buffer */
+    void export_stream(workspace_stream_t& stream, const wf::region_t& damage)
+    {
+        if (!stream.dmabuf)
+            stream.dmabuf = std::make_shared<wf::dmabuf_export_t>();
+
+        OpenGL::render_begin();
+        bool exported = stream.dmabuf->export_buffer(stream.buffer);
+        /* The consumers rely on implicit synchronization, which needs the
+         * rendering to be submitted */
+        GL_CALL(glFlush());
+        OpenGL::render_end();
+
+        if (!exported)
+            return;
+
+        dmabuf_frame_signal data(output, stream.ws,
+            *stream.dmabuf->get_attributes(), damage);
+        static const wf::signal_id_t signal{"workspace-stream-dmabuf"};
+        output->render->emit_signal(signal, &data);
     }
 
     void workspace_stream_stop(workspace_stream_t& stream)
     {
+        /* Shared streams run until their last handle is dropped */
+        if (shared_streams->find(stream))
+            return;
+
         stream.running = false;
     }
 };
@@ -917,13 +3330,25 @@ render_manager::render_manager(output_t *o)
     : pimpl(new impl(o)) { }
 render_manager::~render_manager() = default;
 void render_manager::set_renderer(render_hook_t rh) { pimpl->set_renderer(rh); }
+void render_manager::set_damage_renderer(damage_render_hook_t rh) { pimpl->set_damage_renderer(rh); }
+void render_manager::set_color_matrix(const glm::mat4& matrix) { pimpl->set_color_matrix(matrix); }
 void render_manager::set_redraw_always(bool always) { pimpl->set_redraw_always(always); }
+void render_manager::set_export_frames(bool enable) { pimpl->set_export_frames(enable); }
 wf::region_t render_manager::get_swap_damage() { return pimpl->get_swap_damage(); }
 void render_manager::schedule_redraw() { pimpl->output_damage->schedule_repaint(); }
+void render_manager::schedule_frame_done() { pimpl->schedule_frame_done(); }
 void render_manager::add_inhibit(bool add) { pimpl->add_inhibit(add); }
 void render_manager::add_effect(effect_hook_t* hook, output_effect_type_t type) {pimpl->effects->add_effect(hook, type); }
 void render_manager::rem_effect(effect_hook_t* hook) { pimpl->effects->rem_effect(hook); }
-void render_manager::add_post(post_hook_t* hook) { pimpl->postprocessing->add_post(hook); }
+void render_manager::add_animation(animation_hook_t *hook)
+{
+    pimpl->animations.add_animation(hook);
+    pimpl->output_damage->schedule_repaint();
+}
+
+void render_manager::rem_animation(animation_hook_t *hook) { pimpl->animations.rem_animation(hook); }
+uint32_t render_manager::get_frame_time() const { return pimpl->animations.frame_time; }
+void render_manager::add_post(post_hook_t* hook, bool local) { pimpl->postprocessing->add_post(hook, local); }
 void render_manager::rem_post(post_hook_t* hook) { pimpl->postprocessing->rem_post(hook); }
 wf::region_t render_manager::get_scheduled_damage() { return pimpl->output_damage->get_scheduled_damage(); }
 void render_manager::damage_whole() { pimpl->output_damage->damage_whole(); }
@@ -932,11 +3357,82 @@ void render_manager::damage(const wlr_box& box) { pimpl->output_damage->damage(b
 void render_manager::damage(const wf::region_t& region) { pimpl->output_damage->damage(region); }
 wlr_box render_manager::get_damage_box() const { return pimpl->output_damage->get_damage_box(); }
 wlr_box render_manager::get_ws_box(wf::point_t ws) const { return pimpl->output_damage->get_ws_box(ws); }
+
+wf::region_t render_manager::get_sliding_damage(const wf::region_t& damage,
+    const std::vector<sliding_workspace_t>& shown,
+    std::vector<sliding_workspace_t>& last_shown) const
+{
+    bool moved = (shown.size() != last_shown.size());
+    for (size_t i = 0; !moved && (i < shown.size()); i++)
+    {
+        moved = (shown[i].ws != last_shown[i].ws) ||
+            (shown[i].position.x != last_shown[i].position.x) ||
+            (shown[i].position.y != last_shown[i].position.y);
+    }
+
+    last_shown = shown;
+    auto output_box = get_damage_box();
+    if (moved)
+        return output_box;
+
+    wf::region_t result;
+    for (auto& workspace : shown)
+    {
+        auto ws_box = get_ws_box(workspace.ws);
+        wf::point_t shift = {
+            (int)std::round(workspace.position.x) - ws_box.x,
+            (int)std::round(workspace.position.y) - ws_box.y,
+        };
+
+        result |= (damage & ws_box) + shift;
+    }
+
+    /* The positions may be fractional, then the filtering blends the
+     * neighbouring pixels */
+    result.expand_edges(1);
+    return result & output_box;
+}
+
 wf::framebuffer_t render_manager::get_target_framebuffer() const { return pimpl->get_target_framebuffer(); }
 void render_manager::workspace_stream_start(workspace_stream_t& stream) { pimpl->workspace_stream_start(stream); }
 void render_manager::workspace_stream_update(workspace_stream_t& stream,
-    float scale_x, float scale_y){ pimpl->workspace_stream_update(stream); }
+    float scale_x, float scale_y){ pimpl->workspace_stream_update(stream, scale_x, scale_y); }
+void render_manager::workspace_stream_update(workspace_stream_t& stream,
+    wf::geometry_t crop, float scale) { pimpl->workspace_stream_update(stream, scale, scale, crop); }
 void render_manager::workspace_stream_stop(workspace_stream_t& stream) { pimpl->workspace_stream_stop(stream); }
+std::shared_ptr<workspace_stream_t> render_manager::get_shared_workspace_stream(
+    wf::point_t ws, float scale_x, float scale_y)
+{
+    return pimpl->get_shared_workspace_stream(ws, scale_x, scale_y);
+}
+void render_manager::render_workspace_streams(
+    const std::vector<workspace_stream_instance_t>& instances)
+{
+    auto target = pimpl->get_target_framebuffer();
+    std::vector<OpenGL::textured_quad_t> quads;
+    for (const auto& instance : instances)
+    {
+        const auto& buffer = instance.stream->buffer;
+        OpenGL::textured_quad_t quad;
+        quad.texture = wf::texture_t{buffer.tex};
+        quad.geometry = instance.geometry;
+        quad.transform = instance.transform;
+
+        /* Small previews, for ex. in expo with many workspaces */
+        if (OpenGL::is_minified(quad,
+            {target.viewport_width, target.viewport_height},
+            {buffer.viewport_width, buffer.viewport_height}))
+        {
+            quad.texture = buffer.get_minified_texture();
+        }
+
+        quads.push_back(quad);
+    }
+
+    OpenGL::render_textured_quads(quads);
+}
+const frame_stats_t& render_manager::get_frame_stats() const { return pimpl->frame_stats; }
+void render_manager::reset_frame_stats() { pimpl->frame_stats.reset(); }
 
 } // namespace wf
 
@@ -12,8 +12,13 @@
 #include "../view/view-impl.hpp"
 #include <wayfire/util/log.hpp>
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 /* ----------------------------- wfs_hotspot -------------------------------- */
 static void handle_hotspot_destroy(wl_resource *resource);
+class wfs_hotspot_manager_t;
 
 /**
  * Represents a zwf_shell_hotspot_v2.
@@ -23,33 +28,66 @@ class wfs_hotspot : public noncopyable_t
 {
   private:
     wf::geometry_t hotspot_geometry;
+    uint32_t edge_mask;
 
     bool hotspot_triggered = false;
-    wf::wl_idle_call idle_check_input;
     wf::wl_timer timer;
 
     uint32_t timeout_ms;
     wl_resource *hotspot_resource;
+    wfs_hotspot_manager_t *manager;
 
-    wf::signal_callback_t on_motion_event = [=] (wf::signal_data_t *data)
+    wf::signal_callback_t on_output_removed;
+
+    wf::geometry_t calculate_hotspot_geometry(wf::output_t *output,
+        uint32_t edge_mask, uint32_t distance) const
     {
-        idle_check_input.run_once([=] () {
-            auto gcf = wf::get_core().get_cursor_position();
-            wf::point_t gc{(int)gcf.x, (int)gcf.y};
-            process_input_motion(gc);
-        });
-    };
+        wf::geometry_t slot = output->get_layout_geometry();
+        if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_TOP)
+        {
+            slot.height = distance;
+        } else if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_BOTTOM)
+        {
+            slot.y += slot.height - distance;
+            slot.height = distance;
+        }
 
-    wf::signal_callback_t on_touch_motion_event = [=] (wf::signal_data_t *data)
+        if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_LEFT)
+        {
+            slot.width = distance;
+        } else if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_RIGHT)
+        {
+            slot.x += slot.width - distance;
+            slot.width = distance;
+        }
+
+        return slot;
+    }
+
+  public:
+    /**
+     * Create a new hotspot.
+     * It is guaranteedd that edge_mask contains at most 2 non-opposing edges.
+     */
+    wfs_hotspot(wf::output_t *output, uint32_t edge_mask,
+        uint32_t distance, uint32_t timeout, wl_client *client, uint32_t id);
+    ~wfs_hotspot();
+
+    wf::geometry_t get_geometry() const
     {
-        idle_check_input.run_once([=] () {
-            auto gcf = wf::get_core().get_touch_position(0);
-            wf::point_t gc{(int)gcf.x, (int)gcf.y};
-            process_input_motion(gc);
-        });
-    };
+        return hotspot_geometry;
+    }
 
-    wf::signal_callback_t on_output_removed;
+    uint32_t get_edges() const
+    {
+        return edge_mask;
+    }
+
+    /** @return Whether the hotspot waits for its timeout or was entered */
+    bool is_active()
+    {
+        return hotspot_triggered || timer.is_connected();
+    }
 
     void process_input_motion(wf::point_t gc)
     {
@@ -79,79 +117,179 @@ class wfs_hotspot : public noncopyable_t
             });
         }
     }
+};
 
-    wf::geometry_t calculate_hotspot_geometry(wf::output_t *output,
-        uint32_t edge_mask, uint32_t distance) const
+/**
+ * Tracks the input for all hotspots of an output, so that a motion event
+ * doesn't run every hotspot. The hotspots are grouped by the edges they are
+ * on, and a group is checked only when the cursor is inside the union of its
+ * hotspots, i.e near its edges. Hotspots which are armed or entered are
+ * checked on every motion, so that they notice when the cursor leaves.
+ */
+class wfs_hotspot_manager_t : public wf::custom_data_t
+{
+    struct edge_group_t
     {
-        wf::geometry_t slot = output->get_layout_geometry();
-        if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_TOP)
-        {
-            slot.height = distance;
-        } else if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_BOTTOM)
-        {
-            slot.y += slot.height - distance;
-            slot.height = distance;
-        }
+        std::vector<wfs_hotspot*> hotspots;
+        /* The union of the hotspots, they all touch the same edges */
+        wf::geometry_t bounds = {0, 0, 0, 0};
+    };
 
-        if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_LEFT)
+    std::map<uint32_t, edge_group_t> groups;
+    std::set<wfs_hotspot*> active;
+    wf::wl_idle_call idle_check_input;
+
+    wf::signal_callback_t on_motion_event = [=] (wf::signal_data_t *data)
+    {
+        idle_check_input.run_once([=] () {
+            auto gcf = wf::get_core().get_cursor_position();
+            process_input_motion({(int)gcf.x, (int)gcf.y});
+        });
+    };
+
+    wf::signal_callback_t on_touch_motion_event = [=] (wf::signal_data_t *data)
+    {
+        idle_check_input.run_once([=] () {
+            auto gcf = wf::get_core().get_touch_position(0);
+            process_input_motion({(int)gcf.x, (int)gcf.y});
+        });
+    };
+
+    void update_active(wfs_hotspot *hotspot)
+    {
+        if (hotspot->is_active())
+            active.insert(hotspot);
+        else
+            active.erase(hotspot);
+    }
+
+    void set_listening(bool listen)
+    {
+        if (listen)
         {
-            slot.width = distance;
-        } else if (edge_mask & ZWF_OUTPUT_V2_HOTSPOT_EDGE_RIGHT)
+            wf::get_core().connect_signal("pointer_motion", &on_motion_event);
+            wf::get_core().connect_signal("tablet_axis", &on_motion_event);
+            wf::get_core().connect_signal("touch_motion", &on_touch_motion_event);
+        } else
         {
-            slot.x += slot.width - distance;
-            slot.width = distance;
+            wf::get_core().disconnect_signal("pointer_motion", &on_motion_event);
+            wf::get_core().disconnect_signal("tablet_axis", &on_motion_event);
+            wf::get_core().disconnect_signal("touch_motion",
+                &on_touch_motion_event);
+            idle_check_input.disconnect();
         }
-
-        return slot;
     }
 
   public:
-    /**
-     * Create a new hotspot.
-     * It is guaranteedd that edge_mask contains at most 2 non-opposing edges.
-     */
-    wfs_hotspot(wf::output_t *output, uint32_t edge_mask,
-        uint32_t distance, uint32_t timeout, wl_client *client, uint32_t id)
+    ~wfs_hotspot_manager_t()
+    {
+        if (!groups.empty())
+            set_listening(false);
+    }
+
+    void add_hotspot(wfs_hotspot *hotspot)
     {
-        this->timeout_ms = timeout;
-        this->hotspot_geometry =
-            calculate_hotspot_geometry(output, edge_mask, distance);
+        if (groups.empty())
+            set_listening(true);
+
+        auto& group = groups[hotspot->get_edges()];
+        auto geometry = hotspot->get_geometry();
+        group.bounds = group.hotspots.empty() ?
+            geometry : wf::geometry_t{
+                std::min(group.bounds.x, geometry.x),
+                std::min(group.bounds.y, geometry.y),
+                std::max(group.bounds.width, geometry.width),
+                std::max(group.bounds.height, geometry.height),
+            };
+        group.hotspots.push_back(hotspot);
+    }
 
-        hotspot_resource =
-            wl_resource_create(client, &zwf_hotspot_v2_interface, 1, id);
-        wl_resource_set_implementation(hotspot_resource, NULL, this,
-            handle_hotspot_destroy);
+    void remove_hotspot(wfs_hotspot *hotspot)
+    {
+        active.erase(hotspot);
+        auto it = groups.find(hotspot->get_edges());
+        if (it == groups.end())
+            return;
 
-        // setup output destroy listener
-        on_output_removed = [this, output] (wf::signal_data_t* data)
+        auto& hotspots = it->second.hotspots;
+        hotspots.erase(std::remove(hotspots.begin(), hotspots.end(), hotspot),
+            hotspots.end());
+        if (hotspots.empty())
+            groups.erase(it);
+
+        if (groups.empty())
+            set_listening(false);
+    }
+
+    void process_input_motion(wf::point_t gc)
+    {
+        /* Copy, because processing changes the set */
+        auto was_active = active;
+        for (auto hotspot : was_active)
         {
-            auto ev = static_cast<output_removed_signal*> (data);
-            if (ev->output == output)
+            hotspot->process_input_motion(gc);
+            update_active(hotspot);
+        }
+
+        for (auto& [edges, group] : groups)
+        {
+            if (!(group.bounds & gc))
+                continue;
+
+            for (auto hotspot : group.hotspots)
             {
-                /* Make hotspot inactive by setting the region to empty */
-                hotspot_geometry = {0, 0, 0, 0};
-                process_input_motion({0, 0});
+                if (was_active.count(hotspot))
+                    continue;
+
+                hotspot->process_input_motion(gc);
+                update_active(hotspot);
             }
-        };
+        }
+    }
+};
+
+wfs_hotspot::wfs_hotspot(wf::output_t *output, uint32_t edge_mask,
+    uint32_t distance, uint32_t timeout, wl_client *client, uint32_t id)
+{
+    this->edge_mask  = edge_mask;
+    this->timeout_ms = timeout;
+    this->hotspot_geometry =
+        calculate_hotspot_geometry(output, edge_mask, distance);
 
-        wf::get_core().connect_signal("pointer_motion", &on_motion_event);
-        wf::get_core().connect_signal("tablet_axis", &on_motion_event);
-        wf::get_core().connect_signal("touch_motion", &on_touch_motion_event);
+    hotspot_resource =
+        wl_resource_create(client, &zwf_hotspot_v2_interface, 1, id);
+    wl_resource_set_implementation(hotspot_resource, NULL, this,
+        handle_hotspot_destroy);
 
-        wf::get_core().output_layout->connect_signal("output-removed",
-            &on_output_removed);
-    }
+    manager = output->get_data_safe<wfs_hotspot_manager_t>().get();
+    manager->add_hotspot(this);
 
-    ~wfs_hotspot()
+    // setup output destroy listener
+    on_output_removed = [this, output] (wf::signal_data_t* data)
     {
-        wf::get_core().disconnect_signal("pointer_motion", &on_motion_event);
-        wf::get_core().disconnect_signal("tablet_axis", &on_motion_event);
-        wf::get_core().disconnect_signal("touch_motion", &on_touch_motion_event);
+        auto ev = static_cast<output_removed_signal*> (data);
+        if (ev->output == output && manager)
+        {
+            /* Make hotspot inactive by setting the region to empty */
+            manager->remove_hotspot(this);
+            manager = nullptr;
+            hotspot_geometry = {0, 0, 0, 0};
+            process_input_motion({0, 0});
+        }
+    };
 
-        wf::get_core().output_layout->disconnect_signal("output-removed",
-            &on_output_removed);
-    }
-};
+    wf::get_core().output_layout->connect_signal("output-removed",
+        &on_output_removed);
+}
+
+wfs_hotspot::~wfs_hotspot()
+{
+    if (manager)
+        manager->remove_hotspot(this);
+
+    wf::get_core().output_layout->disconnect_signal("output-removed",
+        &on_output_removed);
+}
 
 static void handle_hotspot_destroy(wl_resource *resource)
 {
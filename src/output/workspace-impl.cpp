@@ -6,10 +6,13 @@
 #include <wayfire/render-manager.hpp>
 #include <wayfire/signal-definitions.hpp>
 #include <wayfire/opengl.hpp>
+#include <climits>
 #include <list>
+#include <functional>
 #include <algorithm>
 #include <wayfire/nonstd/reverse.hpp>
 #include <wayfire/util/log.hpp>
+#include "../view/view-impl.hpp"
 
 namespace wf
 {
@@ -19,39 +22,85 @@ namespace wf
  */
 class output_layer_manager_t
 {
+    using layer_container = std::list<wayfire_view>;
+    layer_container layers[TOTAL_LAYERS];
+
     struct view_layer_data_t : public wf::custom_data_t
     {
         uint32_t layer = 0;
+        /* Position of the view in its layer, valid only if layer != 0 */
+        layer_container::iterator position;
     };
 
-    using layer_container = std::list<wayfire_view>;
-    layer_container layers[TOTAL_LAYERS];
+    wf::signal_callback_t on_view_geometry_changed = [=] (wf::signal_data_t*)
+    {
+        ++serial;
+    };
+
+    void unlink_view(view_layer_data_t& data)
+    {
+        layers[layer_index_from_mask(data.layer)].erase(data.position);
+        data.layer = 0;
+        ++serial;
+        /* Restacking doesn't change the bounding boxes, but it changes the
+         * scene, see get_view_scene_epoch() */
+        wf::invalidate_view_bounding_boxes();
+    }
 
   public:
+    /**
+     * Incremented each time a view is added, removed or restacked, and each
+     * time the geometry of a view in a layer changes.
+     */
+    uint64_t serial = 0;
+
     constexpr int layer_index_from_mask(uint32_t layer_mask) const
     {
         return __builtin_ctz(layer_mask);
     }
 
+    view_layer_data_t& get_layer_data(wayfire_view view)
+    {
+        return *view->get_data_safe<view_layer_data_t>();
+    }
+
     uint32_t& get_view_layer(wayfire_view view)
     {
-        return view->get_data_safe<view_layer_data_t>()->layer;
+        return get_layer_data(view).layer;
     }
 
     void remove_view(wayfire_view view)
     {
-        auto& view_layer = get_view_layer(view);
-        if (!view_layer)
+        auto& data = get_layer_data(view);
+        if (!data.layer)
             return;
 
         view->damage();
-        auto& layer_container = layers[layer_index_from_mask(view_layer)];
+        unlink_view(data);
+        view->disconnect_signal("geometry-changed", &on_view_geometry_changed);
+    }
 
-        auto it = std::remove(
-            layer_container.begin(), layer_container.end(), view);
-        layer_container.erase(it, layer_container.end());
+    /**
+     * Insert the view in the given layer before the given position, removing
+     * it from its current position first.
+     */
+    void insert_view(wayfire_view view, uint32_t layer,
+        layer_container::iterator position)
+    {
+        auto& data = get_layer_data(view);
+        if (data.layer)
+        {
+            unlink_view(data);
+        } else
+        {
+            view->connect_signal("geometry-changed", &on_view_geometry_changed);
+        }
 
-        view_layer = 0;
+        data.position =
+            layers[layer_index_from_mask(layer)].insert(position, view);
+        data.layer = layer;
+        ++serial;
+        wf::invalidate_view_bounding_boxes();
     }
 
     /**
@@ -60,14 +109,7 @@ class output_layer_manager_t
     void add_view_to_layer(wayfire_view view, layer_t layer)
     {
         view->damage();
-        auto& current_layer = get_view_layer(view);
-
-        if (current_layer)
-            remove_view(view);
-
-        auto& layer_container = layers[layer_index_from_mask(layer)];
-        layer_container.push_front(view);
-        current_layer = layer;
+        insert_view(view, layer, layers[layer_index_from_mask(layer)].begin());
         view->damage();
     }
 
@@ -76,7 +118,6 @@ class output_layer_manager_t
         uint32_t view_layer = get_view_layer(view);
         assert(view_layer > 0); // checked in workspace_manager::impl
 
-        remove_view(view);
         add_view_to_layer(view, static_cast<layer_t>(view_layer));
     }
 
@@ -90,38 +131,45 @@ class output_layer_manager_t
 
     void restack_above(wayfire_view view, wayfire_view below)
     {
-        remove_view(view);
-        auto layer = get_view_layer(below);
-        auto& container = layers[layer_index_from_mask(layer)];
-        auto it = std::find(container.begin(), container.end(), below);
-
-        container.insert(it, view);
-        get_view_layer(view) = layer;
+        view->damage();
+        auto& data = get_layer_data(below);
+        insert_view(view, data.layer, data.position);
     }
 
     void restack_below(wayfire_view view, wayfire_view above)
     {
-        remove_view(view);
-        auto layer = get_view_layer(above);
-        auto& container = layers[layer_index_from_mask(layer)];
-        auto it = std::find(container.begin(), container.end(), above);
-        assert(it != container.end());
-
-        container.insert(std::next(it), view);
-        get_view_layer(view) = layer;
+        view->damage();
+        auto& data = get_layer_data(above);
+        assert(data.layer);
+        insert_view(view, data.layer, std::next(data.position));
     }
 
-    std::vector<wayfire_view> get_views_in_layer(uint32_t layers_mask)
+    void for_each_view(uint32_t layers_mask,
+        const std::function<void(wayfire_view)>& callback)
     {
-        std::vector<wayfire_view> views;
         for (int i = TOTAL_LAYERS - 1; i >= 0; i--)
         {
             if ((1 << i) & layers_mask)
             {
-                views.insert(views.end(),
-                    layers[i].begin(), layers[i].end());
+                for (auto& view : layers[i])
+                    callback(view);
             }
         }
+    }
+
+    std::vector<wayfire_view> get_views_in_layer(uint32_t layers_mask)
+    {
+        size_t count = 0;
+        for (int i = 0; i < TOTAL_LAYERS; i++)
+        {
+            if ((1 << i) & layers_mask)
+                count += layers[i].size();
+        }
+
+        std::vector<wayfire_view> views;
+        views.reserve(count);
+        for_each_view(layers_mask, [&] (wayfire_view view)
+            { views.push_back(view); });
 
         return views;
     }
@@ -147,9 +195,83 @@ class output_viewport_manager_t
     int current_vy;
 
     output_t *output;
+    output_layer_manager_t& layer_manager;
+
+    /**
+     * A view in stacking order, together with the range of workspaces which
+     * its wm geometry intersects.
+     */
+    struct workspace_view_entry_t
+    {
+        wayfire_view view;
+        uint32_t layer;
+        /* Inclusive, first > last if the view is on no workspace */
+        wf::point_t first;
+        wf::point_t last;
+    };
+
+    std::vector<workspace_view_entry_t> workspace_views;
+    bool workspace_views_dirty = true;
+    uint64_t workspace_views_serial = 0;
+
+    static int floor_div(int a, int b)
+    {
+        return (a >= 0) ? a / b : -((-a + b - 1) / b);
+    }
+
+    /** Compute the workspaces which the wm geometry of the view intersects */
+    workspace_view_entry_t make_workspace_entry(wayfire_view view,
+        uint32_t layer)
+    {
+        workspace_view_entry_t entry{view, layer, {1, 1}, {0, 0}};
+
+        auto g = output->get_relative_geometry();
+        auto box = view->get_wm_geometry();
+        if (g.width <= 0 || g.height <= 0 || box.width <= 0 || box.height <= 0)
+            return entry;
+
+        if (view->role == VIEW_ROLE_DESKTOP_ENVIRONMENT)
+        {
+            /* Such views are on all workspaces or on none of them */
+            if (g & box)
+            {
+                entry.first = {INT_MIN, INT_MIN};
+                entry.last = {INT_MAX, INT_MAX};
+            }
+
+            return entry;
+        }
+
+        entry.first.x = current_vx + floor_div(box.x, g.width);
+        entry.first.y = current_vy + floor_div(box.y, g.height);
+        entry.last.x = current_vx + floor_div(box.x + box.width - 1, g.width);
+        entry.last.y = current_vy + floor_div(box.y + box.height - 1, g.height);
+
+        return entry;
+    }
+
+    void update_workspace_views()
+    {
+        if (!workspace_views_dirty &&
+            workspace_views_serial == layer_manager.serial)
+        {
+            return;
+        }
+
+        workspace_views.clear();
+        layer_manager.for_each_view(ALL_LAYERS, [&] (wayfire_view view)
+        {
+            workspace_views.push_back(make_workspace_entry(view,
+                layer_manager.get_view_layer(view)));
+        });
+
+        workspace_views_dirty = false;
+        workspace_views_serial = layer_manager.serial;
+    }
 
   public:
-    output_viewport_manager_t(output_t *output)
+    output_viewport_manager_t(output_t *output,
+        output_layer_manager_t& layer_manager) : layer_manager(layer_manager)
     {
         this->output = output;
         vwidth = wf::option_wrapper_t<int> ("core/vwidth");
@@ -219,19 +341,39 @@ class output_viewport_manager_t
         }
     }
 
+    /** Mark the cached workspace of each view as out of date */
+    void invalidate_workspace_views()
+    {
+        workspace_views_dirty = true;
+    }
+
     std::vector<wayfire_view> get_views_on_workspace(wf::point_t vp,
         uint32_t layers_mask, bool wm_only)
     {
-        /* get all views in the given layers */
-        std::vector<wayfire_view> views =
-            output->workspace->get_views_in_layer(layers_mask);
+        update_workspace_views();
 
-        /* remove those which aren't visible on the workspace */
-        auto it = std::remove_if(views.begin(), views.end(), [&] (wayfire_view view) {
-            return !view_visible_on(view, vp, !wm_only);
-        });
+        std::vector<wayfire_view> views;
+        for (auto& entry : workspace_views)
+        {
+            if (!(entry.layer & layers_mask))
+                continue;
+
+            /* The bounding box of transformed views changes without notice,
+             * so it has to be checked each time */
+            bool visible;
+            if (!wm_only && entry.view->has_transformer())
+            {
+                visible = view_visible_on(entry.view, vp, true);
+            } else
+            {
+                visible = entry.first.x <= vp.x && vp.x <= entry.last.x &&
+                    entry.first.y <= vp.y && vp.y <= entry.last.y;
+            }
+
+            if (visible)
+                views.push_back(entry.view);
+        }
 
-        views.erase(it, views.end());
         return views;
     }
 
@@ -272,6 +414,7 @@ class output_viewport_manager_t
          * views. */
         current_vx = nws.x;
         current_vy = nws.y;
+        invalidate_workspace_views();
 
         auto screen = output->get_screen_size();
         auto dx = (data.old_viewport.x - nws.x) * screen.width;
@@ -306,6 +449,11 @@ class output_viewport_manager_t
 /**
  * output_workarea_manager_t provides workarea-related functionality from the
  * workspace_manager module
+ *
+ * Reflows are batched: reflow_reserved_areas() only schedules an idle
+ * callback, so that many anchored areas changing together (for ex. panels
+ * mapping at startup) recompute the workarea and notify plugins once.
+ * Reading the workarea before that applies the pending reflow.
  */
 class output_workarea_manager_t
 {
@@ -313,6 +461,9 @@ class output_workarea_manager_t
     std::vector<workspace_manager::anchored_area*> anchors;
 
     output_t *output;
+    wf::wl_idle_call idle_reflow;
+    bool reflow_pending = false;
+
   public:
     output_workarea_manager_t(output_t *output)
     {
@@ -322,12 +473,13 @@ class output_workarea_manager_t
 
     wf::geometry_t get_workarea()
     {
+        flush_reflow();
         return current_workarea;
     }
 
-    wf::geometry_t calculate_anchored_geometry(const workspace_manager::anchored_area& area)
+    static wf::geometry_t calculate_anchored_geometry(wf::geometry_t wa,
+        const workspace_manager::anchored_area& area)
     {
-        auto wa = get_workarea();
         wf::geometry_t target;
 
         if (area.edge <= workspace_manager::ANCHORED_EDGE_BOTTOM)
@@ -364,13 +516,32 @@ class output_workarea_manager_t
     }
 
     void reflow_reserved_areas()
+    {
+        reflow_pending = true;
+        if (!idle_reflow.is_connected())
+            idle_reflow.run_once([=] () { flush_reflow(); });
+    }
+
+    /** Apply the pending reflow, if any */
+    void flush_reflow()
+    {
+        if (!reflow_pending)
+            return;
+
+        reflow_pending = false;
+        idle_reflow.disconnect();
+        reflow_now();
+    }
+
+  private:
+    void reflow_now()
     {
         auto old_workarea = current_workarea;
 
         current_workarea = output->get_relative_geometry();
         for (auto a : anchors)
         {
-            auto anchor_area = calculate_anchored_geometry(*a);
+            auto anchor_area = calculate_anchored_geometry(current_workarea, *a);
 
             if (a->reflowed)
                 a->reflowed(anchor_area, current_workarea);
@@ -430,6 +601,7 @@ class workspace_manager::impl
         }
 
         output_geometry = output->get_relative_geometry();
+        viewport_manager.invalidate_workspace_views();
         workarea_manager.reflow_reserved_areas();
     };
 
@@ -449,7 +621,7 @@ class workspace_manager::impl
 
     impl(output_t *o) :
         layer_manager(),
-        viewport_manager(o),
+        viewport_manager(o, layer_manager),
         workarea_manager(o)
     {
         output = o;
@@ -541,6 +713,9 @@ class workspace_manager::impl
             attach_view_signal data;
             data.view = view;
             output->emit_signal("layer-attach-view", &data);
+        } else
+        {
+            emit_restacked(view);
         }
 
         check_autohide_panels();
@@ -568,9 +743,17 @@ class workspace_manager::impl
                 static_cast<layer_t>(target_layer));
         }
 
+        emit_restacked(view);
         check_autohide_panels();
     }
 
+    void emit_restacked(wayfire_view view)
+    {
+        view_restacked_signal data;
+        data.view = view;
+        output->emit_signal("view-restacked", &data);
+    }
+
     void restack_above(wayfire_view view, wayfire_view below)
     {
         if (!view || !below || view == below)
@@ -599,6 +782,7 @@ class workspace_manager::impl
             bring_to_front(view);
         } else {
             layer_manager.restack_above(view, below);
+            emit_restacked(view);
         }
     }
 
@@ -620,30 +804,110 @@ class workspace_manager::impl
         }
 
         layer_manager.restack_below(view, above);
+        emit_restacked(view);
     }
 
-    void remove_view(wayfire_view view)
+    /** @return The layer the view was in, or 0 if it wasn't in any */
+    uint32_t detach_view(wayfire_view view)
     {
         uint32_t view_layer = layer_manager.get_view_layer(view);
+        if (!view_layer)
+            return 0;
+
         layer_manager.remove_view(view);
 
         detach_view_signal data;
         data.view = view;
         output->emit_signal("layer-detach-view", &data);
+        return view_layer;
+    }
+
+    /* Check if the next focused view is fullscreen. If so, then we need
+     * to make sure it is in the fullscreen layer */
+    void check_raise_fullscreen_layer()
+    {
+        auto views = viewport_manager.get_views_on_workspace(
+            viewport_manager.get_current_workspace(),
+            LAYER_WORKSPACE | LAYER_FULLSCREEN, true);
+
+        if (views.size() && views[0]->fullscreen)
+            layer_manager.add_view_to_layer(views[0], LAYER_FULLSCREEN);
+    }
 
-        /* Check if the next focused view is fullscreen. If so, then we need
-         * to make sure it is in the fullscreen layer */
-        if (view_layer & MIDDLE_LAYERS)
+    void remove_view(wayfire_view view)
+    {
+        if (detach_view(view) & MIDDLE_LAYERS)
+            check_raise_fullscreen_layer();
+
+        check_autohide_panels();
+    }
+
+    void transfer_views(const std::vector<wayfire_view>& views)
+    {
+        /* Detach the views from their outputs first, and update each of the
+         * old outputs once */
+        std::vector<wf::output_t*> old_outputs;
+        std::vector<bool> had_middle;
+        for (auto& view : views)
         {
-            auto views = viewport_manager.get_views_on_workspace(
-                viewport_manager.get_current_workspace(),
-                LAYER_WORKSPACE | LAYER_FULLSCREEN, true);
+            auto old = view->get_output();
+            if (!old || old == output)
+                continue;
 
-            if (views.size() && views[0]->fullscreen)
-                layer_manager.add_view_to_layer(views[0], LAYER_FULLSCREEN);
+            auto it = std::find(old_outputs.begin(), old_outputs.end(), old);
+            if (it == old_outputs.end())
+            {
+                old_outputs.push_back(old);
+                had_middle.push_back(false);
+                it = old_outputs.end() - 1;
+            }
+
+            uint32_t layer = old->workspace->pimpl->detach_view(view);
+            if (layer & MIDDLE_LAYERS)
+                had_middle[it - old_outputs.begin()] = true;
+        }
+
+        for (size_t i = 0; i < old_outputs.size(); i++)
+        {
+            auto& old = old_outputs[i]->workspace->pimpl;
+            if (had_middle[i])
+                old->check_raise_fullscreen_layer();
+
+            old->check_autohide_panels();
+        }
+
+        auto ws = viewport_manager.get_current_workspace();
+        wayfire_view top_view;
+        for (auto& view : views)
+        {
+            view->set_output(output);
+            layer_t layer = view->minimized ? LAYER_MINIMIZED : LAYER_WORKSPACE;
+            bool attached = !layer_manager.get_view_layer(view);
+            layer_manager.add_view_to_layer(view, get_target_layer(view, layer));
+            if (attached)
+            {
+                attach_view_signal data;
+                data.view = view;
+                output->emit_signal("layer-attach-view", &data);
+            } else
+            {
+                emit_restacked(view);
+            }
+
+            viewport_manager.move_to_workspace(view, ws);
+            if (layer == LAYER_WORKSPACE)
+                top_view = view;
+        }
+
+        /* As if the top view had been added last, after all the others */
+        if (top_view)
+        {
+            check_lower_fullscreen_layer(top_view,
+                get_target_layer(top_view, LAYER_WORKSPACE));
         }
 
         check_autohide_panels();
+        output->render->damage_whole();
     }
 };
 
@@ -662,8 +926,11 @@ void workspace_manager::bring_to_front(wayfire_view view) { return pimpl->bring_
 void workspace_manager::restack_above(wayfire_view view, wayfire_view below) { return pimpl->restack_above(view, below); }
 void workspace_manager::restack_below(wayfire_view view, wayfire_view below) { return pimpl->restack_below(view, below); }
 void workspace_manager::remove_view(wayfire_view view) { return pimpl->remove_view(view); }
+void workspace_manager::transfer_views(const std::vector<wayfire_view>& views) { return pimpl->transfer_views(views); }
 uint32_t workspace_manager::get_view_layer(wayfire_view view) { return pimpl->layer_manager.get_view_layer(view); }
 std::vector<wayfire_view> workspace_manager::get_views_in_layer(uint32_t layers_mask) { return pimpl->layer_manager.get_views_in_layer(layers_mask); }
+void workspace_manager::for_each_view(uint32_t layers_mask, const std::function<void(wayfire_view)>& callback)
+{ return pimpl->layer_manager.for_each_view(layers_mask, callback); }
 
 workspace_implementation_t* workspace_manager::get_workspace_implementation() { return pimpl->get_implementation(); }
 bool workspace_manager::set_workspace_implementation(std::unique_ptr<workspace_implementation_t> impl, bool overwrite)
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <ctime>
 #include <cmath>
+#include <map>
 
 extern "C"
 {
@@ -222,27 +223,60 @@ bool wf::region_t::contains_pointf(const wf::pointf_t& point) const
     return false;
 }
 
+bool wf::region_t::is_single_box() const
+{
+    return _region.data == nullptr;
+}
+
+/** Intersect the box with another one, @return Whether the result is empty */
+static bool intersect_box(pixman_box32_t& box, const pixman_box32_t& other)
+{
+    box.x1 = std::max(box.x1, other.x1);
+    box.y1 = std::max(box.y1, other.y1);
+    box.x2 = std::min(box.x2, other.x2);
+    box.y2 = std::min(box.y2, other.y2);
+    return box.x1 >= box.x2 || box.y1 >= box.y2;
+}
+
+static bool box_contains(const pixman_box32_t& outer, const pixman_box32_t& inner)
+{
+    return outer.x1 <= inner.x1 && outer.y1 <= inner.y1 &&
+           outer.x2 >= inner.x2 && outer.y2 >= inner.y2;
+}
+
 /* Translate the region */
-wf::region_t wf::region_t::operator + (const wf::point_t& vector) const
+wf::region_t wf::region_t::operator + (const wf::point_t& vector) const &
 {
     wf::region_t result{*this};
     pixman_region32_translate(&result._region, vector.x, vector.y);
     return result;
 }
 
+wf::region_t wf::region_t::operator + (const wf::point_t& vector) &&
+{
+    *this += vector;
+    return std::move(*this);
+}
+
 wf::region_t& wf::region_t::operator += (const wf::point_t& vector)
 {
     pixman_region32_translate(&_region, vector.x, vector.y);
     return *this;
 }
 
-wf::region_t wf::region_t::operator * (float scale) const
+wf::region_t wf::region_t::operator * (float scale) const &
 {
     wf::region_t result;
     wlr_region_scale(result.to_pixman(), this->unconst(), scale);
     return result;
 }
 
+wf::region_t wf::region_t::operator * (float scale) &&
+{
+    *this *= scale;
+    return std::move(*this);
+}
+
 wf::region_t& wf::region_t::operator *= (float scale)
 {
     wlr_region_scale(this->to_pixman(), this->to_pixman(), scale);
@@ -250,8 +284,15 @@ wf::region_t& wf::region_t::operator *= (float scale)
 }
 
 /* Region intersection */
-wf::region_t wf::region_t::operator & (const wlr_box& box) const
+wf::region_t wf::region_t::operator & (const wlr_box& box) const &
 {
+    if (is_single_box())
+    {
+        wf::region_t result{*this};
+        result &= box;
+        return result;
+    }
+
     wf::region_t result;
     pixman_region32_intersect_rect(result.to_pixman(), this->unconst(),
         box.x, box.y, box.width, box.height);
@@ -259,8 +300,21 @@ wf::region_t wf::region_t::operator & (const wlr_box& box) const
     return result;
 }
 
-wf::region_t wf::region_t::operator & (const wf::region_t& other) const
+wf::region_t wf::region_t::operator & (const wlr_box& box) &&
 {
+    *this &= box;
+    return std::move(*this);
+}
+
+wf::region_t wf::region_t::operator & (const wf::region_t& other) const &
+{
+    if (is_single_box() && other.is_single_box())
+    {
+        wf::region_t result{*this};
+        result &= other;
+        return result;
+    }
+
     wf::region_t result;
     pixman_region32_intersect(result.to_pixman(),
         this->unconst(), other.unconst());
@@ -268,8 +322,22 @@ wf::region_t wf::region_t::operator & (const wf::region_t& other) const
     return result;
 }
 
+wf::region_t wf::region_t::operator & (const wf::region_t& other) &&
+{
+    *this &= other;
+    return std::move(*this);
+}
+
 wf::region_t& wf::region_t::operator &= (const wlr_box& box)
 {
+    if (is_single_box())
+    {
+        if (intersect_box(_region.extents, pixman_box_from_wlr_box(box)))
+            clear();
+
+        return *this;
+    }
+
     pixman_region32_intersect_rect(this->to_pixman(), this->to_pixman(),
         box.x, box.y, box.width, box.height);
     return *this;
@@ -277,13 +345,21 @@ wf::region_t& wf::region_t::operator &= (const wlr_box& box)
 
 wf::region_t& wf::region_t::operator &= (const wf::region_t& other)
 {
+    if (is_single_box() && other.is_single_box())
+    {
+        if (intersect_box(_region.extents, other._region.extents))
+            clear();
+
+        return *this;
+    }
+
     pixman_region32_intersect(this->to_pixman(),
         this->to_pixman(), other.unconst());
     return *this;
 }
 
 /* Region union */
-wf::region_t wf::region_t::operator | (const wlr_box& other) const
+wf::region_t wf::region_t::operator | (const wlr_box& other) const &
 {
     wf::region_t result;
     pixman_region32_union_rect(result.to_pixman(), this->unconst(),
@@ -291,15 +367,42 @@ wf::region_t wf::region_t::operator | (const wlr_box& other) const
     return result;
 }
 
-wf::region_t wf::region_t::operator | (const wf::region_t& other) const
+wf::region_t wf::region_t::operator | (const wlr_box& other) &&
+{
+    *this |= other;
+    return std::move(*this);
+}
+
+wf::region_t wf::region_t::operator | (const wf::region_t& other) const &
 {
     wf::region_t result;
     pixman_region32_union(result.to_pixman(), this->unconst(), other.unconst());
     return result;
 }
 
+wf::region_t wf::region_t::operator | (const wf::region_t& other) &&
+{
+    *this |= other;
+    return std::move(*this);
+}
+
 wf::region_t& wf::region_t::operator |= (const wlr_box& other)
 {
+    if ((other.width <= 0) || (other.height <= 0))
+        return *this;
+
+    /* The common case of accumulating damage into an empty region, or
+     * adding a box which is already covered */
+    auto box = pixman_box_from_wlr_box(other);
+    if (empty())
+    {
+        pixman_region32_reset(&_region, &box);
+        return *this;
+    }
+
+    if (is_single_box() && box_contains(_region.extents, box))
+        return *this;
+
     pixman_region32_union_rect(this->to_pixman(), this->to_pixman(),
         other.x, other.y, other.width, other.height);
     return *this;
@@ -312,7 +415,7 @@ wf::region_t& wf::region_t::operator |= (const wf::region_t& other)
 }
 
 /* Subtract the box/region from the current region */
-wf::region_t wf::region_t::operator ^ (const wlr_box& box) const
+wf::region_t wf::region_t::operator ^ (const wlr_box& box) const &
 {
     wf::region_t result;
     wf::region_t sub{box};
@@ -320,7 +423,13 @@ wf::region_t wf::region_t::operator ^ (const wlr_box& box) const
     return result;
 }
 
-wf::region_t wf::region_t::operator ^ (const wf::region_t& other) const
+wf::region_t wf::region_t::operator ^ (const wlr_box& box) &&
+{
+    *this ^= box;
+    return std::move(*this);
+}
+
+wf::region_t wf::region_t::operator ^ (const wf::region_t& other) const &
 {
     wf::region_t result;
     pixman_region32_subtract(result.to_pixman(),
@@ -328,8 +437,29 @@ wf::region_t wf::region_t::operator ^ (const wf::region_t& other) const
     return result;
 }
 
+wf::region_t wf::region_t::operator ^ (const wf::region_t& other) &&
+{
+    *this ^= other;
+    return std::move(*this);
+}
+
 wf::region_t& wf::region_t::operator ^= (const wlr_box& box)
 {
+    if (is_single_box())
+    {
+        /* Nothing to subtract, or nothing left */
+        auto sub = pixman_box_from_wlr_box(box);
+        auto overlap = _region.extents;
+        if (intersect_box(overlap, sub))
+            return *this;
+
+        if (box_contains(sub, _region.extents))
+        {
+            clear();
+            return *this;
+        }
+    }
+
     wf::region_t sub{box};
     pixman_region32_subtract(this->to_pixman(),
         this->to_pixman(), sub.to_pixman());
@@ -405,11 +535,156 @@ static void handle_idle_listener(void *data)
     call->execute();
 }
 
-static int handle_timeout(void *data)
+namespace wf
 {
-    auto timer = (wf::wl_timer*) (data);
-    timer->execute();
-    return 0;
+/**
+ * Multiplexes the timers and idle calls of the default event loop on a single
+ * timer source and a single idle source, which are added to the loop on
+ * first use.
+ */
+class event_dispatcher_t
+{
+    wl_event_source *timer_source = nullptr;
+    /* The deadline the timer source is armed for, -1 if disarmed, so that
+     * the source isn't re-armed for timers which don't change the earliest
+     * deadline */
+    int64_t armed_deadline = -1;
+    /* Re-arming is postponed while timers are dispatched */
+    bool dispatching_timers = false;
+    uint64_t next_sequence = 0;
+    std::map<std::pair<int64_t, uint64_t>, wl_timer*> timers;
+
+    wl_event_source *idle_source = nullptr;
+    wl_list idle_calls;
+
+    static int64_t now_msec()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return timespec_to_msec(ts);
+    }
+
+    static int handle_timers(void *data)
+    {
+        ((event_dispatcher_t*)data)->dispatch_timers();
+        return 0;
+    }
+
+    static void handle_idle(void *data)
+    {
+        ((event_dispatcher_t*)data)->dispatch_idle();
+    }
+
+    void rearm()
+    {
+        if (dispatching_timers)
+            return;
+
+        int64_t earliest = timers.empty() ? -1 : timers.begin()->first.first;
+        if (earliest == armed_deadline)
+            return;
+
+        if (!timer_source)
+        {
+            timer_source = wl_event_loop_add_timer(get_core().ev_loop,
+                handle_timers, this);
+        }
+
+        armed_deadline = earliest;
+        /* A delay of 0 disarms the source */
+        int64_t delay = (earliest < 0) ? 0 :
+            std::max<int64_t>(earliest - now_msec(), 1);
+        wl_event_source_timer_update(timer_source, delay);
+    }
+
+    void dispatch_timers()
+    {
+        armed_deadline = -1;
+        dispatching_timers = true;
+        int64_t now = now_msec();
+        while (!timers.empty() && (timers.begin()->first.first <= now))
+        {
+            auto timer = timers.begin()->second;
+            remove_timer(timer);
+            timer->run();
+        }
+
+        dispatching_timers = false;
+        rearm();
+    }
+
+    void dispatch_idle()
+    {
+        idle_source = nullptr;
+        /* Calls queued by the callbacks run in the same pass, like with
+         * separate idle sources */
+        while (!wl_list_empty(&idle_calls))
+        {
+            wl_idle_call *call = wl_container_of(idle_calls.next, call, link);
+            remove_idle(call);
+            call->execute();
+        }
+    }
+
+  public:
+    event_dispatcher_t()
+    {
+        wl_list_init(&idle_calls);
+    }
+
+    static event_dispatcher_t& get()
+    {
+        /* Never destroyed, timers and idle calls in static objects may be
+         * destroyed after it otherwise */
+        static auto dispatcher = new event_dispatcher_t();
+        return *dispatcher;
+    }
+
+    void add_timer(wl_timer *timer, uint32_t timeout_ms)
+    {
+        remove_timer(timer);
+        timer->deadline = now_msec() + timeout_ms;
+        timer->sequence = next_sequence++;
+        timer->queued = true;
+        timers[{timer->deadline, timer->sequence}] = timer;
+        rearm();
+    }
+
+    void remove_timer(wl_timer *timer)
+    {
+        if (!timer->queued)
+            return;
+
+        timers.erase({timer->deadline, timer->sequence});
+        timer->queued = false;
+        rearm();
+    }
+
+    void add_idle(wl_idle_call *call)
+    {
+        wl_list_insert(idle_calls.prev, &call->link);
+        call->queued = true;
+        if (!idle_source)
+        {
+            idle_source = wl_event_loop_add_idle(get_core().ev_loop,
+                handle_idle, this);
+        }
+    }
+
+    void remove_idle(wl_idle_call *call)
+    {
+        if (!call->queued)
+            return;
+
+        wl_list_remove(&call->link);
+        call->queued = false;
+        if (wl_list_empty(&idle_calls) && idle_source)
+        {
+            wl_event_source_remove(idle_source);
+            idle_source = nullptr;
+        }
+    }
+};
 }
 
 namespace wf
@@ -457,6 +732,42 @@ namespace wf
             this->call(data);
     }
 
+    namespace detail
+    {
+        wl_listener_member_base::wl_listener_member_base(wl_notify_func_t notify)
+        {
+            _link.listener.notify = notify;
+            _link.owner = nullptr;
+            wl_list_init(&_link.listener.link);
+        }
+
+        wl_listener_member_base::~wl_listener_member_base()
+        {
+            disconnect();
+        }
+
+        bool wl_listener_member_base::connect(void *owner, wl_signal *signal)
+        {
+            if (is_connected())
+                return false;
+
+            _link.owner = owner;
+            wl_signal_add(signal, &_link.listener);
+            return true;
+        }
+
+        void wl_listener_member_base::disconnect()
+        {
+            wl_list_remove(&_link.listener.link);
+            wl_list_init(&_link.listener.link);
+        }
+
+        bool wl_listener_member_base::is_connected() const
+        {
+            return !wl_list_empty(&_link.listener.link);
+        }
+    }
+
     wl_idle_call::wl_idle_call() = default;
     wl_idle_call::~wl_idle_call()
     {
@@ -477,11 +788,13 @@ namespace wf
 
     void wl_idle_call::run_once()
     {
-        if (!call || source)
+        if (!call || is_connected())
             return;
 
-        auto use_loop = loop ?: get_core().ev_loop;
-        source = wl_event_loop_add_idle(use_loop, handle_idle_listener, this);
+        if (loop && (loop != get_core().ev_loop))
+            source = wl_event_loop_add_idle(loop, handle_idle_listener, this);
+        else
+            event_dispatcher_t::get().add_idle(this);
     }
 
     void wl_idle_call::run_once(callback_t cb)
@@ -492,6 +805,7 @@ namespace wf
 
     void wl_idle_call::disconnect()
     {
+        event_dispatcher_t::get().remove_idle(this);
         if (!source)
             return;
 
@@ -501,7 +815,7 @@ namespace wf
 
     bool wl_idle_call::is_connected()
     {
-        return source;
+        return source || queued;
     }
 
     void wl_idle_call::execute()
@@ -513,8 +827,7 @@ namespace wf
 
     wl_timer::~wl_timer()
     {
-        if (source)
-            wl_event_source_remove(source);
+        disconnect();
     }
 
     void wl_timer::set_timeout(uint32_t timeout_ms, callback_t call)
@@ -527,27 +840,33 @@ namespace wf
         }
 
         this->call = call;
-        if (!source)
-            source = wl_event_loop_add_timer(get_core().ev_loop, handle_timeout, this);
-
-        wl_event_source_timer_update(source, timeout_ms);
+        event_dispatcher_t::get().add_timer(this, timeout_ms);
     }
 
     void wl_timer::disconnect()
     {
-        if (source)
-            wl_event_source_remove(source);
-        source = NULL;
+        event_dispatcher_t::get().remove_timer(this);
     }
 
     bool wl_timer::is_connected()
     {
-      return source != NULL;
+        return queued;
     }
 
     void wl_timer::execute()
     {
-        if (call)
-            call();
+        if (!queued)
+            return;
+
+        disconnect();
+        run();
+    }
+
+    void wl_timer::run()
+    {
+        /* The callback may destroy the timer or set a new callback */
+        auto cb = call;
+        if (cb)
+            cb();
     }
 }
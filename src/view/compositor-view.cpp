@@ -176,20 +176,21 @@ wf::dimensions_t wf::color_rect_view_t::get_size() const
     };
 }
 
-static void render_colored_rect(const wf::framebuffer_t& fb,
-    int x, int y, int w, int h, const wf::color_t& color)
+static void render_colored_rect(const glm::mat4& projection,
+    int x, int y, int w, int h, const wf::color_t& color,
+    const glm::vec4& multiply)
 {
     wf::color_t premultiply{
-        color.r * color.a,
-        color.g * color.a,
-        color.b * color.a,
-        color.a};
+        color.r * color.a * multiply.r,
+        color.g * color.a * multiply.g,
+        color.b * color.a * multiply.b,
+        color.a * multiply.a};
 
-    OpenGL::render_rectangle({x, y, w, h}, premultiply,
-        fb.get_orthographic_projection());
+    OpenGL::render_rectangle({x, y, w, h}, premultiply, projection);
 }
 
-void wf::color_rect_view_t::simple_render(const wf::framebuffer_t& fb, int x, int y,
+void wf::color_rect_view_t::render_rect(const wf::framebuffer_t& fb, int x, int y,
+    const glm::mat4& projection, const glm::vec4& multiply,
     const wf::region_t& damage)
 {
     OpenGL::render_begin(fb);
@@ -198,31 +199,49 @@ void wf::color_rect_view_t::simple_render(const wf::framebuffer_t& fb, int x, in
         auto sbox =
             fb.framebuffer_box_from_damage_box(wlr_box_from_pixman_box(box));
         wlr_renderer_scissor(wf::get_core().renderer, &sbox);
+        OpenGL::get_state_cache().invalidate();
 
         /* Draw the border, making sure border parts don't overlap, otherwise
          * we will get wrong corners if border has alpha != 1.0 */
         // top
-        render_colored_rect(fb, x, y, geometry.width, border,
-            _border_color);
+        render_colored_rect(projection, x, y, geometry.width, border,
+            _border_color, multiply);
         // bottom
-        render_colored_rect(fb, x, y + geometry.height - border,
-            geometry.width, border, _border_color);
+        render_colored_rect(projection, x, y + geometry.height - border,
+            geometry.width, border, _border_color, multiply);
         // left
-        render_colored_rect(fb, x, y + border, border,
-            geometry.height - 2 * border, _border_color);
+        render_colored_rect(projection, x, y + border, border,
+            geometry.height - 2 * border, _border_color, multiply);
         // right
-        render_colored_rect(fb, x + geometry.width - border,
-            y + border, border, geometry.height - 2 * border, _border_color);
+        render_colored_rect(projection, x + geometry.width - border,
+            y + border, border, geometry.height - 2 * border, _border_color,
+            multiply);
 
         /* Draw the inside of the rect */
-        render_colored_rect(fb, x + border, y + border,
+        render_colored_rect(projection, x + border, y + border,
             geometry.width - 2 * border, geometry.height - 2 * border,
-            _color);
+            _color, multiply);
     }
 
     OpenGL::render_end();
 }
 
+void wf::color_rect_view_t::simple_render(const wf::framebuffer_t& fb, int x, int y,
+    const wf::region_t& damage)
+{
+    render_rect(fb, x, y, fb.get_orthographic_projection(), glm::vec4{1.0},
+        damage);
+}
+
+bool wf::color_rect_view_t::render_with_transform(const wf::framebuffer_t& fb,
+    const glm::mat4& matrix, const glm::vec4& color, const wf::region_t& damage)
+{
+    /* The matrix works with output-local coordinates, like the geometry */
+    render_rect(fb, geometry.x, geometry.y,
+        fb.get_orthographic_projection() * matrix, color, damage);
+    return true;
+}
+
 void wf::color_rect_view_t::move(int x, int y)
 {
     damage();
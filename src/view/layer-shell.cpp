@@ -64,6 +64,20 @@ wf::workspace_manager::anchored_edge anchor_to_edge(uint32_t edges)
     assert(false);
 }
 
+/**
+ * The changes to the layer surfaces of an output which haven't been arranged
+ * yet. They are arranged together in an idle callback, so that several
+ * surfaces changing at once reflow the reserved areas only once.
+ */
+struct layer_shell_pending_arrange_t : public wf::custom_data_t
+{
+    /* Bitmask with (1 << layer) for the layers to arrange */
+    uint32_t dirty_layers = 0;
+    /* Whether the exclusive zones changed, which changes the workarea */
+    bool reflow = false;
+    wf::wl_idle_call idle_arrange;
+};
+
 struct wf_layer_shell_manager
 {
   private:
@@ -93,10 +107,14 @@ struct wf_layer_shell_manager
     static constexpr int COUNT_LAYERS = 4;
     layer_t layers[COUNT_LAYERS];
 
+    static constexpr uint32_t ALL_LAYERS = (1 << COUNT_LAYERS) - 1;
+
     void handle_map(wayfire_layer_shell_view *view)
     {
-        layers[view->lsurface->current.layer].push_back(view);
-        arrange_layers(view->get_output());
+        uint32_t layer = view->lsurface->current.layer;
+        layers[layer].push_back(view);
+        schedule_arrange(view->get_output(), 1 << layer,
+            view->lsurface->client_pending.exclusive_zone > 0);
     }
 
     void remove_view_from_layer(wayfire_layer_shell_view *view, uint32_t layer)
@@ -107,18 +125,59 @@ struct wf_layer_shell_manager
             cont.erase(it);
     }
 
-    void handle_move_layer(wayfire_layer_shell_view *view)
+    void handle_move_layer(wayfire_layer_shell_view *view, uint32_t old_layer)
     {
         for (int i = 0; i < COUNT_LAYERS; i++)
             remove_view_from_layer(view, i);
+
+        /* The old layer may have a free spot now */
+        schedule_arrange(view->get_output(), 1 << old_layer, false);
         handle_map(view);
     }
 
     void handle_unmap(wayfire_layer_shell_view *view)
     {
+        bool had_exclusive_zone = (view->anchored_area != nullptr);
         view->remove_anchored(false);
         remove_view_from_layer(view, view->lsurface->current.layer);
-        arrange_layers(view->get_output());
+        schedule_arrange(view->get_output(),
+            1 << view->lsurface->current.layer, had_exclusive_zone);
+    }
+
+    /**
+     * Handle a commit which changed the state of the layer surface. Only the
+     * layer of the view is arranged again, and the reserved areas are
+     * reflowed only if the view has or had an exclusive zone.
+     */
+    void handle_state_changed(wayfire_layer_shell_view *view,
+        const wlr_layer_surface_v1_state& old_state)
+    {
+        auto& state = view->lsurface->current;
+        if (old_state.layer != state.layer)
+        {
+            handle_move_layer(view, old_state.layer);
+            return;
+        }
+
+        bool placement_changed = (old_state.anchor != state.anchor) ||
+            (old_state.exclusive_zone != state.exclusive_zone) ||
+            (old_state.desired_width != state.desired_width) ||
+            (old_state.desired_height != state.desired_height) ||
+            std::memcmp(&old_state.margin, &state.margin, sizeof(state.margin));
+
+        if (placement_changed)
+        {
+            bool reflow = (state.exclusive_zone > 0) ||
+                (old_state.exclusive_zone > 0) || view->anchored_area;
+            schedule_arrange(view->get_output(), 1 << state.layer, reflow);
+        } else if (old_state.keyboard_interactive != state.keyboard_interactive)
+        {
+            /* Only the focus may need an update */
+            schedule_arrange(view->get_output(), 0, false);
+        }
+
+        /* Other changes, like the size acked after a configure, don't need
+         * an arrangement */
     }
 
     layer_t filter_views(wf::output_t *output, int layer)
@@ -230,18 +289,11 @@ struct wf_layer_shell_manager
         v->configure(box);
     }
 
-    uint32_t arrange_layer(wf::output_t *output, int layer)
+    /** Update the reserved areas of the views in the given layer */
+    void update_exclusive_zones(wf::output_t *output, int layer)
     {
-        uint32_t focus_mask = 0;
-        auto views = filter_views(output, layer);
-
-        /* First we need to put all views that have exclusive zone set.
-         * The rest are then placed into the free area */
-        for (auto v : views)
+        for (auto v : filter_views(output, layer))
         {
-            if (v->lsurface->client_pending.keyboard_interactive && v->is_mapped())
-                focus_mask = v->get_layer();
-
             if (v->lsurface->client_pending.exclusive_zone > 0) {
                 set_exclusive_zone(v);
             } else {
@@ -249,15 +301,30 @@ struct wf_layer_shell_manager
                 v->remove_anchored(false);
             }
         }
+    }
 
+    /** Place the views of the layer which don't have an exclusive zone */
+    void pin_views(wf::output_t *output, int layer)
+    {
         auto usable_workarea = output->workspace->get_workarea();
-        for (auto v : views)
+        for (auto v : filter_views(output, layer))
         {
             /* The protocol dictates that the values -1 and 0 for exclusive zone
              * mean that it doesn't have one */
             if (v->lsurface->client_pending.exclusive_zone < 1)
                 pin_view(v, usable_workarea);
         }
+    }
+
+    /** @return The layer which requests keyboard focus on the output */
+    uint32_t get_focus_mask(wf::output_t *output)
+    {
+        uint32_t focus_mask = 0;
+        for (auto v : filter_views(output))
+        {
+            if (v->lsurface->client_pending.keyboard_interactive && v->is_mapped())
+                focus_mask = std::max(focus_mask, (uint32_t)v->get_layer());
+        }
 
         return focus_mask;
     }
@@ -271,20 +338,52 @@ struct wf_layer_shell_manager
         view->get_output()->workspace->reflow_reserved_areas();
     }
 
-    uint32_t focused_layer_request_uid = -1;
+    /** Arrange all layers of the output in the next idle callback */
     void arrange_layers(wf::output_t *output)
     {
-        auto views = filter_views(output);
+        schedule_arrange(output, ALL_LAYERS, true);
+    }
 
-        uint32_t focus1 = arrange_layer(output, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY);
-        uint32_t focus2 = arrange_layer(output, ZWLR_LAYER_SHELL_V1_LAYER_TOP);
-        uint32_t focus3 = arrange_layer(output, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM);
-        uint32_t focus4 = arrange_layer(output, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND);
+    void schedule_arrange(wf::output_t *output, uint32_t layers, bool reflow)
+    {
+        auto pending = output->get_data_safe<layer_shell_pending_arrange_t>();
+        pending->dirty_layers |= layers;
+        pending->reflow |= reflow;
+        if (!pending->idle_arrange.is_connected())
+        {
+            /* The idle call is destroyed with the output */
+            pending->idle_arrange.run_once([=] () { apply_arrange(output); });
+        }
+    }
+
+    uint32_t focused_layer_request_uid = -1;
+    void apply_arrange(wf::output_t *output)
+    {
+        auto pending = output->get_data_safe<layer_shell_pending_arrange_t>();
+        uint32_t dirty_layers = pending->dirty_layers;
+        bool reflow = pending->reflow;
+        pending->dirty_layers = 0;
+        pending->reflow = false;
 
-        auto focus_mask = std::max({focus1, focus2, focus3, focus4});
-        focused_layer_request_uid = wf::get_core().focus_layer(focus_mask,
-            focused_layer_request_uid);
-        output->workspace->reflow_reserved_areas();
+        if (reflow)
+        {
+            /* Views with an exclusive zone are placed together with the
+             * reserved areas, and all other views depend on the workarea */
+            for (int i = 0; i < COUNT_LAYERS; i++)
+                update_exclusive_zones(output, i);
+
+            output->workspace->reflow_reserved_areas();
+            dirty_layers = ALL_LAYERS;
+        }
+
+        for (int i = 0; i < COUNT_LAYERS; i++)
+        {
+            if (dirty_layers & (1 << i))
+                pin_views(output, i);
+        }
+
+        focused_layer_request_uid = wf::get_core().focus_layer(
+            get_focus_mask(output), focused_layer_request_uid);
     }
 };
 
@@ -402,17 +501,12 @@ void wayfire_layer_shell_view::commit()
     {
         /* Update layer manualy */
         if (prev_state.layer != state->layer)
-        {
             get_output()->workspace->add_view(self(), get_layer());
-            /* Will also trigger reflowing */
-            wf_layer_shell_manager::get_instance().handle_move_layer(this);
-        } else
-        {
-            /* Reflow reserved areas and positions */
-            wf_layer_shell_manager::get_instance().arrange_layers(get_output());
-        }
 
+        auto old_state = prev_state;
         prev_state = *state;
+        wf_layer_shell_manager::get_instance().handle_state_changed(this,
+            old_state);
     }
 }
 
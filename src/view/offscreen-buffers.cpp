@@ -0,0 +1,129 @@
+#include "offscreen-buffers.hpp"
+#include <wayfire/util/log.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+/* Buffers used more recently than this are never evicted, so that buffers
+ * which are needed for the current frames don't get released and recreated
+ * repeatedly if the budget is too small */
+static constexpr uint32_t MIN_EVICTION_AGE_MSEC = 1000;
+
+wf::offscreen_buffer_registry_t& wf::offscreen_buffer_registry_t::get()
+{
+    static offscreen_buffer_registry_t registry;
+    return registry;
+}
+
+void wf::offscreen_buffer_registry_t::touch(wf::framebuffer_base_t *buffer,
+    const std::string& owner, evict_callback_t evict, wf::object_base_t *object)
+{
+    auto& entry = entries[buffer];
+    entry.owner = owner;
+    entry.object = object;
+
+    total_bytes -= entry.bytes;
+    entry.bytes = (size_t)buffer->viewport_width * buffer->viewport_height * 4;
+    total_bytes += entry.bytes;
+
+    entry.last_used = wf::get_current_time();
+    entry.evict = std::move(evict);
+
+    int64_t budget = (int64_t)budget_mib * 1024 * 1024;
+    if (budget > 0 && (int64_t)total_bytes > budget)
+        idle_trim.run_once([=] () { trim(); });
+}
+
+void wf::offscreen_buffer_registry_t::remove(wf::framebuffer_base_t *buffer)
+{
+    auto it = entries.find(buffer);
+    if (it == entries.end())
+        return;
+
+    total_bytes -= it->second.bytes;
+    entries.erase(it);
+}
+
+void wf::offscreen_buffer_registry_t::trim()
+{
+    int64_t budget = (int64_t)budget_mib * 1024 * 1024;
+    if (budget <= 0 || (int64_t)total_bytes <= budget)
+        return;
+
+    uint32_t now = wf::get_current_time();
+    std::vector<std::pair<uint32_t, wf::framebuffer_base_t*>> candidates;
+    for (auto& [buffer, entry] : entries)
+    {
+        if (now - entry.last_used >= MIN_EVICTION_AGE_MSEC)
+            candidates.push_back({entry.last_used, buffer});
+    }
+
+    /* Oldest first */
+    std::sort(candidates.begin(), candidates.end());
+
+    size_t evicted = 0;
+    OpenGL::render_begin();
+    for (auto& candidate : candidates)
+    {
+        if ((int64_t)total_bytes <= budget)
+            break;
+
+        auto it = entries.find(candidate.second);
+        if (!it->second.evict())
+            continue;
+
+        evicted += it->second.bytes;
+        remove(candidate.second);
+    }
+
+    OpenGL::render_end();
+
+    LOGD("Released ", evicted / 1024, " KiB of offscreen buffers, ",
+        total_bytes / 1024, " KiB remain");
+}
+
+std::map<std::string, size_t> wf::offscreen_buffer_registry_t::get_usage() const
+{
+    std::map<std::string, size_t> usage;
+    for (auto& [buffer, entry] : entries)
+        usage[entry.owner] += entry.bytes;
+
+    return usage;
+}
+
+std::map<wf::object_base_t*, std::map<std::string, size_t>>
+wf::offscreen_buffer_registry_t::get_usage_by_object() const
+{
+    std::map<wf::object_base_t*, std::map<std::string, size_t>> usage;
+    for (auto& [buffer, entry] : entries)
+    {
+        if (entry.object)
+            usage[entry.object][entry.owner] += entry.bytes;
+    }
+
+    return usage;
+}
+
+void wf::offscreen_buffer_registry_t::forget_object(wf::object_base_t *object)
+{
+    for (auto& [buffer, entry] : entries)
+    {
+        if (entry.object == object)
+            entry.object = nullptr;
+    }
+}
+
+std::string wf::offscreen_buffer_registry_t::to_string() const
+{
+    auto mib = [] (size_t bytes) { return bytes / (1024.0 * 1024.0); };
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "offscreen buffers: " << mib(total_bytes) << " MiB in "
+        << entries.size() << " buffers, budget " << (int)budget_mib << " MiB\n";
+    for (auto& [owner, bytes] : get_usage())
+        out << std::setw(16) << owner << ": " << mib(bytes) << " MiB\n";
+
+    return out.str();
+}
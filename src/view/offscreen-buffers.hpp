@@ -0,0 +1,90 @@
+#ifndef WF_OFFSCREEN_BUFFERS_HPP
+#define WF_OFFSCREEN_BUFFERS_HPP
+
+#include <wayfire/opengl.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace wf
+{
+/**
+ * Keeps track of the memory used by the offscreen buffers of views, i.e
+ * snapshots and the buffers of transformers, and keeps it below the budget
+ * in core/offscreen_buffer_budget.
+ *
+ * When the budget is exceeded, the least recently used buffers which were
+ * not used in the last second are released. Their owners recreate them on
+ * next use, so only buffers which can be redrawn from their view may be
+ * evicted.
+ */
+class offscreen_buffer_registry_t
+{
+  public:
+    /**
+     * Called to release a buffer. It must not call remove() for the buffer.
+     * @return false if the buffer can't be released right now, for ex. because
+     *   it holds the last contents of an unmapped view.
+     */
+    using evict_callback_t = std::function<bool()>;
+
+    static offscreen_buffer_registry_t& get();
+
+    /**
+     * Record that the buffer was used for rendering. Must be called each time
+     * the buffer is used, after it is (re)allocated.
+     *
+     * @param owner The name under which the used memory is reported, for ex.
+     *   the name of the plugin which added the transformer.
+     * @param object The view for which the buffer is used, if any.
+     */
+    void touch(wf::framebuffer_base_t *buffer, const std::string& owner,
+        evict_callback_t evict, wf::object_base_t *object = nullptr);
+
+    /** Stop tracking the buffer, must be called before it is destroyed */
+    void remove(wf::framebuffer_base_t *buffer);
+
+    /** @return The memory used by all tracked buffers, in bytes */
+    size_t get_total_bytes() const { return total_bytes; }
+
+    /** @return The memory used by the tracked buffers of each owner, in bytes */
+    std::map<std::string, size_t> get_usage() const;
+
+    /** @return The memory used by the tracked buffers of each object and
+     *   owner, in bytes. Buffers without an object are left out. */
+    std::map<wf::object_base_t*, std::map<std::string, size_t>>
+    get_usage_by_object() const;
+
+    /** Stop attributing buffers to the object, which is being destroyed */
+    void forget_object(wf::object_base_t *object);
+
+    /** @return A multi-line summary of the memory used by each owner */
+    std::string to_string() const;
+
+  private:
+    offscreen_buffer_registry_t() = default;
+
+    struct entry_t
+    {
+        std::string owner;
+        wf::object_base_t *object = nullptr;
+        size_t bytes = 0;
+        uint32_t last_used = 0;
+        evict_callback_t evict;
+    };
+
+    std::unordered_map<wf::framebuffer_base_t*, entry_t> entries;
+    size_t total_bytes = 0;
+
+    wf::option_wrapper_t<int> budget_mib{"core/offscreen_buffer_budget"};
+    wf::wl_idle_call idle_trim;
+
+    /** Release old buffers until the budget is respected */
+    void trim();
+};
+}
+
+#endif /* end of include guard: WF_OFFSCREEN_BUFFERS_HPP */
@@ -19,6 +19,24 @@ class surface_interface_t::impl
     surface_interface_t* parent_surface;
     std::vector<surface_interface_t*> surface_children;
 
+    /**
+     * The mapped surfaces of the tree rooted at this surface, in the order of
+     * for_each_surface() and with positions relative to this surface, so
+     * that walking deep subsurface trees doesn't recurse each time.
+     *
+     * Subsurface offsets and map states change only with a commit or a map
+     * state change, which both bump the view scene epoch, so the list is
+     * rebuilt from the tree when the epoch changes. Walks hold a reference
+     * to the list, so a rebuild during a walk doesn't affect them.
+     */
+    std::shared_ptr<const std::vector<surface_iterator_t>> flat_tree;
+    uint64_t flat_tree_epoch = 0;
+
+    /** Rebuild flat_tree, if it is out of date */
+    void update_flat_tree(surface_interface_t *self);
+    static void flatten_tree(surface_interface_t *surface, wf::point_t origin,
+        std::vector<surface_iterator_t>& result);
+
     wf::output_t *output = nullptr;
     int ref_cnt = 0;
 
@@ -32,6 +50,46 @@ class surface_interface_t::impl
      */
     wlr_surface *wsurface = nullptr;
 
+    /**
+     * The time (in milliseconds) the last frame event was sent by the render
+     * manager. Used for throttling frame events to hidden surfaces.
+     */
+    int64_t last_frame_done = 0;
+
+    /**
+     * When the last frame event was sent, CLOCK_MONOTONIC in microseconds,
+     * or 0 if the surface committed since then.
+     */
+    int64_t frame_done_sent_usec = 0;
+    /**
+     * How long the client usually takes from a frame event to its commit, in
+     * microseconds, 0 if unknown. Used by the render manager to send frame
+     * events only as early as the client needs them.
+     */
+    int64_t commit_latency_usec = 0;
+    /* Whether the render manager holds back a frame event until deadline */
+    bool frame_done_deferred = false;
+    int64_t frame_done_deadline_usec = 0;
+
+    /** Update commit_latency_usec on a commit */
+    void record_commit_latency();
+
+    /** See get_commit_stats() */
+    surface_commit_stats_t commit_stats;
+    /**
+     * When the surface was sent a frame event it was waiting for,
+     * CLOCK_MONOTONIC in microseconds, or 0 if it committed since then.
+     */
+    int64_t stats_frame_sent_usec = 0;
+    /* The commits since rate_window_start_usec, for commit_stats.commit_rate */
+    int64_t rate_window_start_usec = 0;
+    uint64_t rate_window_commits = 0;
+
+    /** Update commit_stats on a commit which damaged the given area */
+    void record_commit_stats(uint64_t damage_area);
+    /** Update commit_stats.commit_rate if the current window is over */
+    void update_commit_rate(int64_t now_usec);
+
     /** Scale the region by the output's scale and then shrink it by @shrink. */
     void scale_opaque_region(wf::region_t& region, int shrink);
 };
@@ -45,9 +103,18 @@ class wlr_surface_base_t
 {
   protected:
     wf::wl_listener_wrapper::callback_t handle_new_subsurface;
-    wf::wl_listener_wrapper on_commit, on_destroy, on_new_subsurface;
+    wf::wl_listener_wrapper on_destroy, on_new_subsurface;
+
+    void handle_commit(wlr_surface*)
+    {
+        commit();
+    }
 
-    void apply_surface_damage();
+    wf::wl_listener_member<&wlr_surface_base_t::handle_commit> on_commit;
+
+    /** Damage the committed damage of the surface.
+     * @return The damaged area in surface-local pixels */
+    uint64_t apply_surface_damage();
     wlr_surface_base_t(wf::surface_interface_t *self);
     /* Pointer to this as surface_interface, see requirement above */
     wf::surface_interface_t *_as_si = nullptr;
@@ -74,12 +141,26 @@ class wlr_surface_base_t
     virtual void _simple_render(const wf::framebuffer_t& fb, int x, int y,
         const wf::region_t& damage);
 
+    /**
+     * Add the damaged parts of the surface to the batch, the same way as
+     * _simple_render() draws them. The batch can be shared by several
+     * surfaces, so that surfaces in the texture atlas are drawn together.
+     */
+    void add_to_batch(OpenGL::render_batch_t& batch,
+        const wf::framebuffer_t& fb, int x, int y, const wf::region_t& damage);
+
+    /** @return Whether the surface is drawn from the texture atlas */
+    bool is_in_atlas() const;
+
   protected:
     virtual void map(wlr_surface *surface);
     virtual void unmap();
     virtual void commit();
 
     virtual wlr_buffer *get_buffer();
+
+    /** Copy small shm buffers into the texture atlas, on each commit */
+    void update_atlas();
 };
 
 /**
@@ -17,7 +17,9 @@ extern "C"
 
 #include "surface-impl.hpp"
 #include "subsurface.hpp"
+#include "view-impl.hpp"
 #include "wayfire/opengl.hpp"
+#include "wayfire/trace.hpp"
 #include "../core/core-impl.hpp"
 #include "wayfire/output.hpp"
 #include <wayfire/util/log.hpp>
@@ -38,11 +40,14 @@ wf::surface_interface_t::surface_interface_t(surface_interface_t *parent)
         set_output(parent->get_output());
         parent->priv->surface_children.insert(
             parent->priv->surface_children.begin(), this);
+        /* The flattened trees of the parents are out of date */
+        wf::invalidate_view_bounding_boxes();
     }
 }
 
 wf::surface_interface_t::~surface_interface_t()
 {
+    wf::invalidate_view_bounding_boxes();
     if (priv->parent_surface)
     {
         auto& container = priv->parent_surface->priv->surface_children;
@@ -78,22 +83,60 @@ std::vector<wf::surface_iterator_t> wf::surface_interface_t::enumerate_surfaces(
     wf::point_t surface_origin)
 {
     std::vector<wf::surface_iterator_t> result;
-    for (auto& child : priv->surface_children)
+    for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t position)
     {
-        if (child->is_mapped())
-        {
-            auto child_surfaces = child->enumerate_surfaces(
-                child->get_offset() + surface_origin);
+        result.push_back({surface, position});
+    }, surface_origin);
 
-            result.insert(result.end(),
-                child_surfaces.begin(), child_surfaces.end());
-        }
+    return result;
+}
+
+void wf::surface_interface_t::impl::update_flat_tree(surface_interface_t *self)
+{
+    auto epoch = wf::get_view_scene_epoch();
+    if (flat_tree && (flat_tree_epoch == epoch))
+        return;
+
+    auto tree = std::make_shared<std::vector<surface_iterator_t>>();
+    flatten_tree(self, {0, 0}, *tree);
+    flat_tree = std::move(tree);
+    flat_tree_epoch = epoch;
+}
+
+void wf::surface_interface_t::impl::flatten_tree(surface_interface_t *surface,
+    wf::point_t origin, std::vector<surface_iterator_t>& result)
+{
+    for (auto& child : surface->priv->surface_children)
+    {
+        if (child->is_mapped())
+            flatten_tree(child, child->get_offset() + origin, result);
     }
 
-    if (is_mapped())
-        result.push_back({this, surface_origin});
+    if (surface->is_mapped())
+        result.push_back({surface, origin});
+}
 
-    return result;
+void wf::surface_interface_t::for_each_surface(
+    const std::function<void(surface_interface_t*, wf::point_t)>& callback,
+    wf::point_t surface_origin)
+{
+    priv->update_flat_tree(this);
+
+    /* The callback may change the tree, for ex. by damaging a surface, which
+     * rebuilds the list on the next walk. This walk keeps the old list. */
+    auto tree = priv->flat_tree;
+    for (const auto& entry : *tree)
+        callback(entry.surface, entry.position + surface_origin);
+}
+
+bool wf::surface_interface_t::has_single_surface() const
+{
+    if (!is_mapped())
+        return false;
+
+    return std::none_of(priv->surface_children.begin(),
+        priv->surface_children.end(),
+        [] (surface_interface_t *child) { return child->is_mapped(); });
 }
 
 wf::output_t *wf::surface_interface_t::get_output()
@@ -142,8 +185,102 @@ void wf::surface_interface_t::destruct()
  ****************************/
 void wf::surface_interface_t::send_frame_done(const timespec& time)
 {
-    if (priv->wsurface)
-        wlr_surface_send_frame_done(priv->wsurface, &time);
+    if (!priv->wsurface)
+        return;
+
+    bool waiting = !wl_list_empty(&priv->wsurface->current.frame_callback_list);
+    wlr_surface_send_frame_done(priv->wsurface, &time);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    priv->frame_done_sent_usec = now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+    if (waiting)
+    {
+        ++priv->commit_stats.frame_events;
+        priv->stats_frame_sent_usec = priv->frame_done_sent_usec;
+    }
+}
+
+wf::surface_commit_stats_t wf::surface_interface_t::get_commit_stats()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    priv->update_commit_rate(now.tv_sec * 1000000ll + now.tv_nsec / 1000);
+    return priv->commit_stats;
+}
+
+void wf::surface_interface_t::impl::update_commit_rate(int64_t now_usec)
+{
+    static constexpr int64_t RATE_WINDOW_USEC = 1000000;
+    int64_t elapsed = now_usec - rate_window_start_usec;
+    if (elapsed < RATE_WINDOW_USEC)
+        return;
+
+    /* The first window starts with the first commit */
+    if (rate_window_start_usec > 0)
+        commit_stats.commit_rate = rate_window_commits * 1e6 / elapsed;
+
+    rate_window_start_usec = now_usec;
+    rate_window_commits = 0;
+}
+
+void wf::surface_interface_t::impl::record_commit_stats(uint64_t damage_area)
+{
+    /* Same as in record_commit_latency() */
+    static constexpr int64_t MAX_LATENCY_USEC = 100000;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_usec = now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+
+    update_commit_rate(now_usec);
+    ++rate_window_commits;
+    ++commit_stats.commits;
+    commit_stats.damage_area += damage_area;
+    if (stats_frame_sent_usec == 0)
+    {
+        ++commit_stats.unthrottled_commits;
+        return;
+    }
+
+    int64_t latency = now_usec - stats_frame_sent_usec;
+    stats_frame_sent_usec = 0;
+    if (latency > MAX_LATENCY_USEC)
+    {
+        ++commit_stats.idle_commits;
+        return;
+    }
+
+    commit_stats.frame_to_commit_usec += latency;
+    if (output && (output->handle->refresh > 0))
+    {
+        /* The refresh rate is in mHz */
+        int64_t refresh_usec = 1000000000ll / output->handle->refresh;
+        commit_stats.missed_frames += latency / refresh_usec;
+    }
+}
+
+void wf::surface_interface_t::impl::record_commit_latency()
+{
+    /* Longer gaps mean that the client wasn't rendering continuously */
+    static constexpr int64_t MAX_LATENCY_USEC = 100000;
+    if (frame_done_sent_usec == 0)
+        return;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t latency = now.tv_sec * 1000000ll + now.tv_nsec / 1000 -
+        frame_done_sent_usec;
+    frame_done_sent_usec = 0;
+    if (latency > MAX_LATENCY_USEC)
+        return;
+
+    /* Slower frames are taken into account right away, so that the client
+     * doesn't miss the next one, faster frames only gradually */
+    if (latency > commit_latency_usec)
+        commit_latency_usec = latency;
+    else
+        commit_latency_usec += (latency - commit_latency_usec) / 8;
 }
 
 bool wf::surface_interface_t::accepts_input(int32_t sx, int32_t sy)
@@ -200,20 +337,18 @@ wlr_surface *wf::surface_interface_t::get_wlr_surface()
 void wf::surface_interface_t::damage_surface_region(
     const wf::region_t& dmg)
 {
-    for (const auto& rect : dmg)
-        damage_surface_box(wlr_box_from_pixman_box(rect));
+    /* view_interface_t overrides damage_surface_region and applies it to the
+     * output */
+    if (priv->parent_surface && priv->parent_surface->is_mapped() &&
+        !dmg.empty())
+    {
+        priv->parent_surface->damage_surface_region(dmg + get_offset());
+    }
 }
 
 void wf::surface_interface_t::damage_surface_box(const wlr_box& box)
 {
-    /* wlr_view_t overrides damage_surface_box and applies it to the output */
-    if (priv->parent_surface && priv->parent_surface->is_mapped())
-    {
-        wlr_box parent_box = box;
-        parent_box.x += get_offset().x;
-        parent_box.y += get_offset().y;
-        priv->parent_surface->damage_surface_box(parent_box);
-    }
+    damage_surface_region(box);
 }
 
 wf::wlr_surface_base_t::wlr_surface_base_t(surface_interface_t *self)
@@ -239,10 +374,12 @@ wf::wlr_surface_base_t::wlr_surface_base_t(surface_interface_t *self)
     };
 
     on_new_subsurface.set_callback(handle_new_subsurface);
-    on_commit.set_callback([&] (void*) { commit(); });
 }
 
-wf::wlr_surface_base_t::~wlr_surface_base_t() {}
+wf::wlr_surface_base_t::~wlr_surface_base_t()
+{
+    OpenGL::texture_atlas_t::get().remove(this);
+}
 
 
 
@@ -269,6 +406,7 @@ wf::dimensions_t wf::wlr_surface_base_t::_get_size() const
 
 void wf::emit_map_state_change(wf::surface_interface_t *surface)
 {
+    wf::invalidate_view_bounding_boxes();
     std::string state = surface->is_mapped() ? "_surface_mapped" : "_surface_unmapped";
 
     _surface_map_state_changed_signal data;
@@ -290,7 +428,7 @@ void wf::wlr_surface_base_t::map(wlr_surface *surface)
     _as_si->set_output(output);
 
     on_new_subsurface.connect(&surface->events.new_subsurface);
-    on_commit.connect(&surface->events.commit);
+    on_commit.connect(this, &surface->events.commit);
 
     surface->data = _as_si;
 
@@ -309,6 +447,7 @@ void wf::wlr_surface_base_t::unmap()
     _as_si->damage_surface_box({.x = 0, .y = 0,
         .width = _get_size().width, .height = _get_size().height});
 
+    OpenGL::texture_atlas_t::get().remove(this);
     this->surface->data = NULL;
     this->surface = nullptr;
     this->_as_si->priv->wsurface = nullptr;
@@ -327,29 +466,40 @@ wlr_buffer* wf::wlr_surface_base_t::get_buffer()
     return nullptr;
 }
 
-void wf::wlr_surface_base_t::apply_surface_damage()
+uint64_t wf::wlr_surface_base_t::apply_surface_damage()
 {
     if (!_as_si->get_output() || !_is_mapped())
-        return;
+        return 0;
 
     wf::region_t dmg;
     wlr_surface_get_effective_damage(surface, dmg.to_pixman());
 
+    uint64_t area = 0;
+    for (const auto& box : dmg)
+        area += (uint64_t)(box.x2 - box.x1) * (box.y2 - box.y1);
+
     if (surface->current.scale != 1 ||
         surface->current.scale != _as_si->get_output()->handle->scale)
         dmg.expand_edges(1);
 
     _as_si->damage_surface_region(dmg);
+    return area;
 }
 
 void wf::wlr_surface_base_t::commit()
 {
-    apply_surface_damage();
+    WF_TRACE_INSTANT("surface", "commit");
+    wf::invalidate_view_bounding_boxes();
+    auto damage_area = apply_surface_damage();
+    update_atlas();
+    _as_si->priv->record_commit_latency();
+    _as_si->priv->record_commit_stats(damage_area);
     if (_as_si->get_output())
     {
-        /* we schedule redraw, because the surface might expect
-         * a frame callback */
-        _as_si->get_output()->render->schedule_redraw();
+        /* The surface might expect a frame callback. Visible damage has
+         * already scheduled a repaint, which sends it, otherwise it is sent
+         * without repainting the output. */
+        _as_si->get_output()->render->schedule_frame_done();
     }
 }
 
@@ -364,29 +514,80 @@ void wf::wlr_surface_base_t::update_output(wf::output_t *old_output,
         wlr_surface_send_enter(surface, new_output->handle);
 }
 
+void wf::wlr_surface_base_t::update_atlas()
+{
+    auto& atlas = OpenGL::texture_atlas_t::get();
+    /* Clients which render with the GPU usually update their buffers too
+     * often for a copy to pay off */
+    auto buffer = surface->buffer;
+    if (!buffer || !buffer->texture || !buffer->resource ||
+        !wl_shm_buffer_get(buffer->resource))
+    {
+        atlas.remove(this);
+        return;
+    }
+
+    int width, height;
+    wlr_texture_get_size(buffer->texture, &width, &height);
+    if ((width != surface->current.width) || (height != surface->current.height))
+    {
+        /* Scaled or cropped buffers are drawn from their own texture */
+        atlas.remove(this);
+        return;
+    }
+
+    atlas.update(this, wf::texture_t{buffer->texture}, {width, height});
+}
+
+bool wf::wlr_surface_base_t::is_in_atlas() const
+{
+    return OpenGL::texture_atlas_t::get().contains(this);
+}
+
 void wf::wlr_surface_base_t::_simple_render(const wf::framebuffer_t& fb,
     int x, int y, const wf::region_t& damage)
 {
     if (!get_buffer())
         return;
 
+    OpenGL::render_batch_t batch;
+    add_to_batch(batch, fb, x, y, damage);
+
+    OpenGL::render_begin(fb);
+    batch.flush();
+    OpenGL::render_end();
+}
+
+void wf::wlr_surface_base_t::add_to_batch(OpenGL::render_batch_t& batch,
+    const wf::framebuffer_t& fb, int x, int y, const wf::region_t& damage)
+{
+    if (!get_buffer())
+        return;
+
     float rx = x + fb.geometry.x;
     float ry = y + fb.geometry.y;
     gl_geometry geometry {
         rx, ry,
         rx + surface->current.width, ry + surface->current.height,
     };
-    wf::texture_t texture{surface->buffer->texture};
-    auto matrix = fb.get_orthographic_projection();
-
-    OpenGL::render_begin(fb);
+    OpenGL::textured_quad_t quad;
+    quad.texture = wf::texture_t{surface->buffer->texture};
+    quad.geometry = geometry;
+    quad.transform = fb.get_orthographic_projection();
+    OpenGL::texture_atlas_t::get().apply(this, quad);
+
+    /* Clip the surface to each damaged rectangle instead of scissoring, so
+     * that all of them are drawn with a single draw call */
     for (const auto& rect : damage)
     {
-        auto box = wlr_box_from_pixman_box(rect);
-        fb.scissor(fb.framebuffer_box_from_damage_box(box));
-        OpenGL::render_transformed_texture(texture, geometry, {}, matrix);
+        gl_geometry clip {
+            rect.x1 / fb.scale + fb.geometry.x,
+            rect.y1 / fb.scale + fb.geometry.y,
+            rect.x2 / fb.scale + fb.geometry.x,
+            rect.y2 / fb.scale + fb.geometry.y,
+        };
+        batch.add_clipped(quad, clip);
     }
-    OpenGL::render_end();
 }
 
 wf::wlr_child_surface_base_t::wlr_child_surface_base_t(
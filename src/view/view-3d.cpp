@@ -25,6 +25,16 @@ wlr_box wf::view_transformer_t::get_bounding_box(wf::geometry_t view, wlr_box re
     return wlr_box{x1, y1, x2 - x1, y2 - y1};
 }
 
+wf::region_t wf::view_transformer_t::transform_damage(wf::geometry_t view,
+    const wf::region_t& damage)
+{
+    wf::region_t result;
+    for (const auto& rect : damage)
+        result |= get_bounding_box(view, wlr_box_from_pixman_box(rect));
+
+    return result;
+}
+
 wf::region_t wf::view_transformer_t::transform_opaque_region(
     wf::geometry_t box, wf::region_t region)
 {
@@ -101,47 +111,130 @@ wf::view_2D::view_2D(wayfire_view view)
     this->view = view;
 }
 
-static void rotate_xy(float& x, float& y, float angle)
+static wf::pointf_t apply_matrix(const glm::mat4& matrix, wf::pointf_t point)
 {
-    auto v = glm::vec4{x, y, 0, 1};
-    auto rot = glm::rotate(glm::mat4(1.0), angle, {0, 0, 1});
-    v = rot * v;
-    x = v.x;
-    y = v.y;
+    auto v = matrix * glm::vec4{point.x, point.y, 0, 1};
+    return {v.x, v.y};
+}
+
+void wf::view_2D::update_cache()
+{
+    auto wm_geometry = view->get_wm_geometry();
+    if (cache.valid && (cache.angle == angle) && (cache.scale_x == scale_x) &&
+        (cache.scale_y == scale_y) && (cache.translation_x == translation_x) &&
+        (cache.translation_y == translation_y) &&
+        (cache.wm_geometry == wm_geometry))
+    {
+        return;
+    }
+
+    cache.valid = true;
+    cache.angle = angle;
+    cache.scale_x = scale_x;
+    cache.scale_y = scale_y;
+    cache.translation_x = translation_x;
+    cache.translation_y = translation_y;
+    cache.wm_geometry = wm_geometry;
+    cache.has_box = false;
+
+    /* Scale and rotate around the exact center of the view. Output-local
+     * coordinates have y pointing down, so the rotation is reversed. */
+    float cx = wm_geometry.x + wm_geometry.width / 2.0;
+    float cy = wm_geometry.y + wm_geometry.height / 2.0;
+    cache.forward =
+        glm::translate(glm::mat4(1.0), {cx + translation_x, cy + translation_y, 0}) *
+        glm::rotate(glm::mat4(1.0), -angle, {0, 0, 1}) *
+        glm::scale(glm::mat4(1.0), {scale_x, scale_y, 1}) *
+        glm::translate(glm::mat4(1.0), {-cx, -cy, 0});
+    cache.inverse = glm::inverse(cache.forward);
 }
 
 wf::pointf_t wf::view_2D::transform_point(
     wf::geometry_t geometry, wf::pointf_t point)
 {
+    update_cache();
+    return apply_matrix(cache.forward, point);
+}
 
-    auto p2 = get_center_relative_coords(view->get_wm_geometry(), point);
-    float x = p2.x, y = p2.y;
+wf::region_t wf::view_2D::transform_damage(wf::geometry_t view,
+    const wf::region_t& damage)
+{
+    if (angle != 0.0f)
+        return view_transformer_t::transform_damage(view, damage);
 
-    x *= scale_x; y *= scale_y;
-    rotate_xy(x, y, angle);
-    x += translation_x;
-    y -= translation_y;
+    /* Map the opposite corners of each box. Partially covered pixels are
+     * included, so that scaled damage is never too small. */
+    update_cache();
+    wf::region_t result;
+    for (const auto& rect : damage)
+    {
+        auto p1 = apply_matrix(cache.forward, {1.0 * rect.x1, 1.0 * rect.y1});
+        auto p2 = apply_matrix(cache.forward, {1.0 * rect.x2, 1.0 * rect.y2});
+        int x1 = std::floor(std::min(p1.x, p2.x));
+        int y1 = std::floor(std::min(p1.y, p2.y));
+        int x2 = std::ceil(std::max(p1.x, p2.x));
+        int y2 = std::ceil(std::max(p1.y, p2.y));
+        result |= wlr_box{x1, y1, x2 - x1, y2 - y1};
+    }
 
-    auto r = get_absolute_coords_from_relative(view->get_wm_geometry(), {x, y});
-    return r;
+    return result;
 }
 
 wf::pointf_t wf::view_2D::untransform_point(
     wf::geometry_t geometry, wf::pointf_t point)
 {
-    point = get_center_relative_coords(view->get_wm_geometry(), point);
-    float x = point.x, y = point.y;
+    update_cache();
+    return apply_matrix(cache.inverse, point);
+}
+
+wlr_box wf::view_2D::get_bounding_box(wf::geometry_t view, wlr_box region)
+{
+    update_cache();
+    if (!cache.has_box || !(cache.box_view == view) ||
+        !(cache.box_region == region))
+    {
+        cache.box = view_transformer_t::get_bounding_box(view, region);
+        cache.box_view = view;
+        cache.box_region = region;
+        cache.has_box = true;
+    }
 
-    x -= translation_x;
-    y += translation_y;
-    rotate_xy(x, y, -angle);
-    x /= scale_x; y /= scale_y;
+    return cache.box;
+}
 
-    return get_absolute_coords_from_relative(view->get_wm_geometry(), {x, y});
+/** Draw the quad once for each of the given scissor boxes */
+static void render_quad_scissored(const OpenGL::textured_quad_t& quad,
+    const std::vector<wlr_box>& scissor_boxes, const wf::framebuffer_t& fb)
+{
+    /* No scissor boxes would mean no scissoring at all */
+    if (scissor_boxes.empty())
+        return;
+
+    OpenGL::render_batch_t batch;
+    batch.set_scissor(fb, scissor_boxes);
+    batch.add(quad);
+
+    OpenGL::render_begin(fb);
+    batch.flush();
+    OpenGL::render_end();
 }
 
-void wf::view_2D::render_box(wf::texture_t src_tex, wlr_box src_box,
-    wlr_box scissor_box, const wf::framebuffer_t& fb)
+/** @return The damage rectangles in framebuffer coordinates */
+static std::vector<wlr_box> get_scissor_boxes(const wf::region_t& damage,
+    const wf::framebuffer_t& fb)
+{
+    std::vector<wlr_box> boxes;
+    for (const auto& rect : damage)
+    {
+        boxes.push_back(fb.framebuffer_box_from_damage_box(
+            wlr_box_from_pixman_box(rect)));
+    }
+
+    return boxes;
+}
+
+OpenGL::textured_quad_t wf::view_2D::get_quad(wf::texture_t src_tex,
+    wlr_box src_box, const wf::framebuffer_t& fb)
 {
     auto quad = center_geometry(fb.geometry, src_box, get_center(view->get_wm_geometry()));
 
@@ -159,12 +252,40 @@ void wf::view_2D::render_box(wf::texture_t src_tex, wlr_box src_box,
                             -fb.geometry.height / 2.0f, fb.geometry.height / 2.0f);
 
     auto transform = fb.transform * ortho * translate * rotate;
+    return {src_tex, quad.geometry, {0.0f, 1.0f, 1.0f, 0.0f},
+        transform, {1.0f, 1.0f, 1.0f, alpha}};
+}
 
-    OpenGL::render_begin(fb);
-    fb.scissor(scissor_box);
-    OpenGL::render_transformed_texture(src_tex, quad.geometry, {},
-                                       transform, {1.0f, 1.0f, 1.0f, alpha});
-    OpenGL::render_end();
+void wf::view_2D::render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+    const wf::region_t& damage, const wf::framebuffer_t& fb)
+{
+    render_quad_scissored(get_quad(src_tex, src_box, fb),
+        get_scissor_boxes(damage, fb), fb);
+}
+
+void wf::view_2D::render_box(wf::texture_t src_tex, wlr_box src_box,
+    wlr_box scissor_box, const wf::framebuffer_t& fb)
+{
+    render_quad_scissored(get_quad(src_tex, src_box, fb), {scissor_box}, fb);
+}
+
+bool wf::view_2D::get_composable_transform(wf::geometry_t,
+    glm::mat4& matrix, glm::vec4& color)
+{
+    /* Same center as get_quad() */
+    auto center = get_center(view->get_wm_geometry());
+    auto to_center = glm::translate(glm::mat4(1.0),
+        {-1.0f * center.x, -1.0f * center.y, 0});
+    auto scale = glm::scale(glm::mat4(1.0), {scale_x, scale_y, 1});
+    /* Output-local coordinates have y pointing down, so the rotation is
+     * reversed compared to get_quad() */
+    auto rotate = glm::rotate(glm::mat4(1.0), -angle, {0, 0, 1});
+    auto from_center = glm::translate(glm::mat4(1.0),
+        {center.x + translation_x, center.y + translation_y, 0});
+
+    matrix = from_center * rotate * scale * to_center;
+    color = {1.0f, 1.0f, 1.0f, alpha};
+    return true;
 }
 
 const float wf::view_3D::fov = PI/4;
@@ -187,12 +308,26 @@ wf::view_3D::view_3D(wayfire_view view)
     view_proj = default_proj_matrix() * default_view_matrix();
 }
 
-/* TODO: cache total_transform, because it is often unnecessarily recomputed */
 glm::mat4 wf::view_3D::calculate_total_transform()
 {
     auto og = view->get_output()->get_relative_geometry();
+    if (cache.valid && (cache.view_proj == view_proj) &&
+        (cache.translation == translation) && (cache.rotation == rotation) &&
+        (cache.scaling == scaling) && (cache.output_geometry == og))
+    {
+        return cache.total;
+    }
+
     glm::mat4 depth_scale = glm::scale(glm::mat4(1.0), {1, 1, 2.0 / std::min(og.width, og.height)});
-    return translation * view_proj * depth_scale * rotation * scaling;
+    cache.valid = true;
+    cache.view_proj = view_proj;
+    cache.translation = translation;
+    cache.rotation = rotation;
+    cache.scaling = scaling;
+    cache.output_geometry = og;
+    cache.total = translation * view_proj * depth_scale * rotation * scaling;
+    cache.has_box = false;
+    return cache.total;
 }
 
 wf::pointf_t wf::view_3D::transform_point(
@@ -208,6 +343,22 @@ wf::pointf_t wf::view_3D::transform_point(
     return get_absolute_coords_from_relative(geometry, {v.x, v.y});
 }
 
+wlr_box wf::view_3D::get_bounding_box(wf::geometry_t view, wlr_box region)
+{
+    /* Invalidates the box if a matrix changed */
+    calculate_total_transform();
+    if (!cache.has_box || !(cache.box_view == view) ||
+        !(cache.box_region == region))
+    {
+        cache.box = view_transformer_t::get_bounding_box(view, region);
+        cache.box_view = view;
+        cache.box_region = region;
+        cache.has_box = true;
+    }
+
+    return cache.box;
+}
+
 /* TODO: is there a way to realiably reverse projective transformations? */
 wf::pointf_t wf::view_3D::untransform_point(wf::geometry_t geometry, wf::pointf_t point)
 {
@@ -215,8 +366,8 @@ wf::pointf_t wf::view_3D::untransform_point(wf::geometry_t geometry, wf::pointf_
         wf::compositor_core_t::invalid_coordinate};
 }
 
-void wf::view_3D::render_box(wf::texture_t src_tex, wlr_box src_box,
-    wlr_box scissor_box, const wf::framebuffer_t& fb)
+OpenGL::textured_quad_t wf::view_3D::get_quad(wf::texture_t src_tex,
+    wlr_box src_box, const wf::framebuffer_t& fb)
 {
     auto quad = center_geometry(fb.geometry, src_box, get_center(src_box));
 
@@ -229,10 +380,18 @@ void wf::view_3D::render_box(wf::texture_t src_tex, wlr_box src_box,
                             });
 
     transform = fb.transform * scale * translate * transform;
+    return {src_tex, quad.geometry, {0.0f, 1.0f, 1.0f, 0.0f}, transform, color};
+}
 
-    OpenGL::render_begin(fb);
-    fb.scissor(scissor_box);
-    OpenGL::render_transformed_texture(src_tex, quad.geometry, {},
-                                       transform, color);
-    OpenGL::render_end();
+void wf::view_3D::render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+    const wf::region_t& damage, const wf::framebuffer_t& fb)
+{
+    render_quad_scissored(get_quad(src_tex, src_box, fb),
+        get_scissor_boxes(damage, fb), fb);
+}
+
+void wf::view_3D::render_box(wf::texture_t src_tex, wlr_box src_box,
+    wlr_box scissor_box, const wf::framebuffer_t& fb)
+{
+    render_quad_scissored(get_quad(src_tex, src_box, fb), {scissor_box}, fb);
 }
@@ -296,11 +296,16 @@ void wf::wlr_view_t::unmap()
 
 void wf::emit_view_map_signal(wayfire_view view, bool has_position)
 {
+    /* The contents of the view are live again */
+    view->view_impl->snapshot_frozen = false;
+    view->view_impl->snapshot_max_scale = std::numeric_limits<float>::max();
+
     map_view_signal data;
     data.view = view;
     data.is_positioned = has_position;
     view->get_output()->emit_signal("map-view", &data);
     view->emit_signal("map", &data);
+    wf::get_core().emit_signal("view-mapped", &data);
 }
 
 void wf::view_interface_t::emit_view_map()
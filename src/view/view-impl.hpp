@@ -1,6 +1,7 @@
 #ifndef VIEW_IMPL_HPP
 #define VIEW_IMPL_HPP
 
+#include <optional>
 #include <wayfire/nonstd/safe-list.hpp>
 #include <wayfire/view.hpp>
 #include <wayfire/opengl.hpp>
@@ -24,6 +25,9 @@ struct view_transform_block_t : public noncopyable_t
     std::string plugin_name = "";
     std::unique_ptr<wf::view_transformer_t> transform;
     wf::framebuffer_t fb;
+    /* Parts of fb which are out of date, in output-local coordinates after
+     * the transform */
+    wf::region_t cached_damage;
 
     view_transform_block_t();
     ~view_transform_block_t();
@@ -59,11 +63,46 @@ class view_interface_t::view_priv_impl
 
     wf::safe_list_t<std::shared_ptr<view_transform_block_t>> transforms;
 
+    /* See view_interface_t::set_alpha() */
+    float alpha = 1.0;
+
+    /**
+     * Add damage to the buffers of the transformers.
+     *
+     * @param view The untransformed bounding box of the view.
+     * @param box The damaged box, in output-local coordinates before the
+     *   transformers.
+     */
+    void damage_transforms(wf::geometry_t view, wlr_box box);
+
     struct offscreen_buffer_t : public wf::framebuffer_t
     {
         wf::region_t cached_damage;
         bool valid() { return this->fb != (uint32_t)-1; }
     } offscreen_buffer;
+
+    /* Set by take_final_snapshot(), the snapshot is kept as it is */
+    bool snapshot_frozen = false;
+    float snapshot_max_scale = std::numeric_limits<float>::max();
+
+    /**
+     * The results of get_untransformed_bounding_box() and get_bounding_box().
+     * They are valid while the epoch, the mapped state and the output geometry
+     * of the view stay the same.
+     */
+    struct bounding_box_cache_t
+    {
+        uint64_t epoch = 0;
+        bool mapped = false;
+        wf::geometry_t output_geometry;
+        std::optional<wf::geometry_t> untransformed;
+        std::optional<wf::geometry_t> transformed;
+    } bounding_box_cache;
+
+    /** Drop the cached bounding boxes if they may be out of date */
+    void validate_bounding_box_cache(bool mapped, wf::geometry_t output_geometry);
+
+    ~view_priv_impl();
 };
 
 /**
@@ -76,6 +115,24 @@ class view_interface_t::view_priv_impl
  * views.
  */
 void view_damage_raw(wayfire_view view, const wlr_box& box);
+/** Same as above, but damages a whole region with one call to the output */
+void view_damage_raw(wayfire_view view, const wf::region_t& region);
+
+/**
+ * Mark the cached bounding boxes of all views as out of date.
+ *
+ * Transformers change without notice, but a change is visible only after the
+ * view or the output is damaged. So the cache is invalidated on each damage,
+ * as well as on surface commits, map state changes and transformer changes.
+ */
+void invalidate_view_bounding_boxes();
+
+/**
+ * @return A counter incremented each time the cached bounding boxes are
+ *   invalidated, and when views are restacked. If it is unchanged, what is
+ *   shown on the outputs and where is unchanged, too.
+ */
+uint64_t get_view_scene_epoch();
 
 /**
  * Implementation of a view backed by a wlr_* shell struct.
@@ -1,6 +1,7 @@
 #include <wayfire/util/log.hpp>
 #include "../core/core-impl.hpp"
 #include "view-impl.hpp"
+#include "offscreen-buffers.hpp"
 #include "wayfire/opengl.hpp"
 #include "wayfire/output.hpp"
 #include "wayfire/view.hpp"
@@ -8,8 +9,11 @@
 #include "wayfire/decorator.hpp"
 #include "wayfire/workspace-manager.hpp"
 #include "wayfire/render-manager.hpp"
+#include "wayfire/trace.hpp"
+#include "wayfire/accounting.hpp"
 #include "xdg-shell.hpp"
 #include "../output/gtk-shell.hpp"
+#include "../output/plugin-loader.hpp"
 
 #include <algorithm>
 #include <glm/glm.hpp>
@@ -26,6 +30,45 @@ extern "C"
 #undef static
 }
 
+/**
+ * @return The owner under which the GPU time of the transformer is reported,
+ *   or an empty string if GPU timing is disabled. Transformers from the core,
+ *   like view_2D, are reported under the name they were added with.
+ */
+static std::string get_gpu_timer_owner(const wf::view_transform_block_t& block)
+{
+    if (!OpenGL::gpu_timing_active())
+        return "";
+
+    auto& transformer = *block.transform;
+    auto plugin = get_plugin_name_at(&typeid(transformer));
+    if ((plugin == "core") && !block.plugin_name.empty())
+        plugin = block.plugin_name;
+
+    return plugin + ":transformer";
+}
+
+/**
+ * @return The scale at which the contents of the view are sharp: the largest
+ *   buffer scale of its surfaces, but not more than the output's scale, so
+ *   that low-DPI clients on HiDPI outputs are scaled up only when the view is
+ *   drawn. Surfaces without a client buffer, like decorations, are drawn at
+ *   the output's scale.
+ */
+static float get_content_scale(wf::view_interface_t *view)
+{
+    float output_scale = view->get_output()->handle->scale;
+    float scale = 0;
+    view->for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t)
+    {
+        auto wlr_surface = surface->get_wlr_surface();
+        scale = std::max(scale,
+            wlr_surface ? wlr_surface->current.scale : output_scale);
+    });
+
+    return scale > 0 ? std::min(scale, output_scale) : output_scale;
+}
+
 static void reposition_relative_to_parent(wayfire_view view)
 {
     if (!view->parent)
@@ -103,6 +146,12 @@ void wf::view_interface_t::set_toplevel_parent(wayfire_view new_parent)
             new_parent->children.insert(new_parent->children.begin(), self());
 
         parent = new_parent;
+        if (this->get_output())
+        {
+            view_restacked_signal data;
+            data.view = self();
+            this->get_output()->emit_signal("view-restacked", &data);
+        }
     }
 
     if (parent)
@@ -135,19 +184,24 @@ void wf::view_interface_t::set_toplevel_parent(wayfire_view new_parent)
 
 std::vector<wayfire_view> wf::view_interface_t::enumerate_views(
     bool mapped_only)
+{
+    std::vector<wayfire_view> result;
+    for_each_view([&] (wayfire_view view) { result.push_back(view); },
+        mapped_only);
+
+    return result;
+}
+
+void wf::view_interface_t::for_each_view(
+    const std::function<void(wayfire_view)>& callback, bool mapped_only)
 {
     if (!this->is_mapped() && mapped_only)
-        return {};
+        return;
 
-    std::vector<wayfire_view> result;
     for (auto& v : this->children)
-    {
-        auto cdr = v->enumerate_views();
-        result.insert(result.end(), cdr.begin(), cdr.end());
-    }
+        v->for_each_view(callback);
 
-    result.push_back(self());
-    return result;
+    callback(self());
 }
 
 void wf::view_interface_t::set_role(view_role_t new_role)
@@ -247,7 +301,12 @@ wf::geometry_t wf::view_interface_t::get_wm_geometry()
 
 wlr_box wf::view_interface_t::get_bounding_box()
 {
-    return transform_region(get_untransformed_bounding_box());
+    auto& cache = view_impl->bounding_box_cache;
+    view_impl->validate_bounding_box_cache(is_mapped(), get_output_geometry());
+    if (!cache.transformed)
+        cache.transformed = transform_region(get_untransformed_bounding_box());
+
+    return *cache.transformed;
 }
 
 #define INVALID_COORDS(p) (std::isnan(p.x) || std::isnan(p.y))
@@ -307,19 +366,20 @@ wf::surface_interface_t *wf::view_interface_t::map_input_coordinates(
     auto view_relative_coordinates =
         global_to_local_point(cursor, nullptr);
 
-    for (auto& child : enumerate_surfaces({0, 0}))
+    wf::surface_interface_t *result = nullptr;
+    for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t position)
     {
-        local.x = view_relative_coordinates.x - child.position.x;
-        local.y = view_relative_coordinates.y - child.position.y;
+        if (result)
+            return;
 
-        if (child.surface->accepts_input(
-                std::floor(local.x), std::floor(local.y)))
-        {
-            return child.surface;
-        }
-    }
+        local.x = view_relative_coordinates.x - position.x;
+        local.y = view_relative_coordinates.y - position.y;
+
+        if (surface->accepts_input(std::floor(local.x), std::floor(local.y)))
+            result = surface;
+    });
 
-    return nullptr;
+    return result;
 }
 
 bool wf::view_interface_t::is_focuseable() const
@@ -561,6 +621,7 @@ void wf::view_interface_t::damage()
 {
     auto bbox = get_untransformed_bounding_box();
     view_impl->offscreen_buffer.cached_damage |= bbox;
+    view_impl->damage_transforms(bbox, bbox);
     view_damage_raw(self(), transform_region(bbox));
 }
 
@@ -656,6 +717,7 @@ void wf::view_interface_t::add_transformer(
     std::unique_ptr<wf::view_transformer_t> transformer, std::string name)
 {
     damage();
+    wf::invalidate_view_bounding_boxes();
 
     auto tr = std::make_shared<wf::view_transform_block_t> ();
     tr->transform = std::move(transformer);
@@ -691,6 +753,7 @@ void wf::view_interface_t::pop_transformer(
     {
         return tr->transform.get() == transformer.get();
     });
+    wf::invalidate_view_bounding_boxes();
 
     /* Since we can remove transformers while rendering the output, damaging it
      * won't help at this stage (damage is already calculated).
@@ -709,22 +772,42 @@ bool wf::view_interface_t::has_transformer()
     return view_impl->transforms.size();
 }
 
+void wf::view_interface_t::set_alpha(float alpha)
+{
+    alpha = wf::clamp(alpha, 0.0f, 1.0f);
+    if (alpha == view_impl->alpha)
+        return;
+
+    view_impl->alpha = alpha;
+    damage();
+}
+
+float wf::view_interface_t::get_alpha()
+{
+    return view_impl->alpha;
+}
+
 wf::geometry_t wf::view_interface_t::get_untransformed_bounding_box()
 {
     if (!is_mapped())
         return view_impl->offscreen_buffer.geometry;
 
     auto bbox = get_output_geometry();
+    auto& cache = view_impl->bounding_box_cache;
+    view_impl->validate_bounding_box_cache(true, bbox);
+    if (cache.untransformed)
+        return *cache.untransformed;
+
     wf::region_t bounding_region = bbox;
 
-    for (auto& child : enumerate_surfaces({bbox.x, bbox.y}))
+    for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t position)
     {
-        auto dim = child.surface->get_size();
-        bounding_region |= {child.position.x, child.position.y,
-            dim.width, dim.height};
-    };
+        auto dim = surface->get_size();
+        bounding_region |= {position.x, position.y, dim.width, dim.height};
+    }, {bbox.x, bbox.y});
 
-    return wlr_box_from_pixman_box(bounding_region.get_extents());
+    cache.untransformed = wlr_box_from_pixman_box(bounding_region.get_extents());
+    return *cache.untransformed;
 }
 
 wlr_box wf::view_interface_t::get_bounding_box(std::string transformer)
@@ -793,17 +876,18 @@ bool wf::view_interface_t::intersects_region(const wlr_box& region)
         return region & get_bounding_box();
 
     auto origin = get_output_geometry();
-    for (auto& child : enumerate_surfaces({origin.x, origin.y}))
+    bool intersects = false;
+    for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t position)
     {
-        wlr_box box = {child.position.x, child.position.y,
-            child.surface->get_size().width, child.surface->get_size().height};
-        box = transform_region(box);
+        if (intersects)
+            return;
 
-        if (region & box)
-            return true;
-    }
+        wlr_box box = {position.x, position.y,
+            surface->get_size().width, surface->get_size().height};
+        intersects = region & transform_region(box);
+    }, {origin.x, origin.y});
 
-    return false;
+    return intersects;
 }
 
 void wf::view_interface_t::subtract_transformed_opaque(
@@ -826,8 +910,10 @@ void wf::view_interface_t::subtract_transformed_opaque(
     wf::region_t full = obox;
     full *= scale;
     wf::region_t opaque = full;
-    for (auto& surf : enumerate_surfaces({og.x, og.y}))
-        surf.surface->subtract_opaque(opaque, surf.position.x, surf.position.y);
+    for_each_surface([&] (wf::surface_interface_t *surface, wf::point_t position)
+    {
+        surface->subtract_opaque(opaque, position.x, position.y);
+    }, {og.x, og.y});
 
     opaque = full ^ opaque;
     opaque *= 1.0 / scale;
@@ -849,22 +935,63 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
     if (!is_mapped() && !view_impl->offscreen_buffer.valid())
         return false;
 
+    WF_TRACE_SCOPE("render", "transformed " + to_string());
+
     wf::geometry_t obox = get_untransformed_bounding_box();
+    if (is_mapped())
+    {
+        /* Views which can draw themselves with a matrix don't need buffers
+         * if all of their transformers are matrices */
+        bool composable = true;
+        glm::mat4 total_matrix{1.0};
+        glm::vec4 total_color{1.0};
+        auto box = obox;
+        view_impl->transforms.for_each([&] (auto& transform)
+        {
+            glm::mat4 matrix;
+            glm::vec4 color;
+            if (!composable || !transform->transform->get_composable_transform(
+                box, matrix, color))
+            {
+                composable = false;
+                return;
+            }
+
+            total_matrix = matrix * total_matrix;
+            total_color *= color;
+            box = transform->transform->get_bounding_box(box, box);
+        });
+
+        if (composable && render_with_transform(framebuffer, total_matrix,
+            total_color, damage))
+        {
+            view_impl->transforms.for_each([&] (auto& transform) {
+                transform->cached_damage.clear();
+            });
+
+            return true;
+        }
+    }
+
     wf::texture_t previous_texture;
     float texture_scale;
+    /* The buffer of previous_texture, unless it is the surface's texture */
+    const wf::framebuffer_base_t *previous_buffer = nullptr;
 
-    if (is_mapped() && enumerate_surfaces().size() == 1 && get_wlr_surface())
+    if (has_single_surface() && get_wlr_surface())
     {
         /* Optimized case: there is a single mapped surface.
          * We can directly start with its texture */
         previous_texture =
             wf::texture_t{this->get_wlr_surface()->buffer->texture};
-        texture_scale = this->get_wlr_surface()->current.scale;
+        texture_scale = std::min<float>(this->get_wlr_surface()->current.scale,
+            get_output()->handle->scale);
     } else
     {
         take_snapshot();
         previous_texture = wf::texture_t{view_impl->offscreen_buffer.tex};
         texture_scale = view_impl->offscreen_buffer.scale;
+        previous_buffer = &view_impl->offscreen_buffer;
     }
 
     /* We keep a shared_ptr to the previous transform which we executed, so that
@@ -878,44 +1005,211 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
     /* final_transform is the one that should render to the screen */
     std::shared_ptr<view_transform_block_t> final_transform = nullptr;
 
+    /* Consecutive transformers which can be expressed as a matrix are fused
+     * into a single draw of previous_texture. The run is drawn when a
+     * transformer which can't be fused follows it, or at the end. */
+    struct
+    {
+        bool active = false;
+        /* Bounding box of the view at the start of the run */
+        wf::geometry_t box;
+        glm::mat4 matrix{1.0};
+        glm::vec4 color{1.0};
+        /* The last transform of the run, its buffer receives the result */
+        std::shared_ptr<view_transform_block_t> last;
+    } run;
+
+    /* Transformers may change without the view being damaged, for example
+     * when a plugin damages the whole output instead. If all of the view is
+     * repainted anyway, the intermediate buffers are redone as well. Once a
+     * buffer is redone, the ones after it have to be redone too. */
+    auto visible_damage = framebuffer.get_damage_region() &
+        framebuffer.damage_box_from_geometry_box(get_bounding_box());
+    bool repaint_all = (visible_damage ^ damage).empty();
+
+    /* Prepare the buffer of the given transform to hold the view after it.
+     * Only the parts which were damaged since it was last rendered are
+     * cleared and returned, unless the buffer has to be redone. */
+    auto prepare_buffer = [&] (view_transform_block_t& transform,
+                                  wf::geometry_t transformed_box)
+    {
+        int scaled_width = transformed_box.width * texture_scale;
+        int scaled_height = transformed_box.height * texture_scale;
+
+        bool redo = repaint_all || !(transform.fb.geometry == transformed_box) ||
+            transform.fb.scale != texture_scale;
+
+        OpenGL::render_begin();
+        redo |= transform.fb.allocate(scaled_width, scaled_height);
+        transform.fb.scale = texture_scale;
+        transform.fb.geometry = transformed_box;
+
+        /* A released buffer is reallocated and redone on next use */
+        auto block = &transform;
+        wf::offscreen_buffer_registry_t::get().touch(&transform.fb,
+            transform.plugin_name.empty() ? "transformer" : transform.plugin_name,
+            [block] () { block->fb.release(); return true; }, this);
+
+        wf::region_t buffer_damage;
+        if (redo)
+        {
+            buffer_damage |= wlr_box{0, 0, scaled_width, scaled_height};
+        } else
+        {
+            transform.cached_damage &= transformed_box;
+            for (const auto& rect : transform.cached_damage)
+            {
+                buffer_damage |= transform.fb.damage_box_from_geometry_box(
+                    wlr_box_from_pixman_box(rect));
+            }
+        }
+
+        transform.cached_damage.clear();
+        repaint_all |= redo;
+
+        transform.fb.bind(); // bind buffer to clear it
+        for (const auto& rect : buffer_damage)
+        {
+            transform.fb.scissor(transform.fb.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+            OpenGL::clear({0, 0, 0, 0});
+        }
+
+        OpenGL::render_end();
+
+        return buffer_damage;
+    };
+
+    /* Draw previous_texture with the combined matrix and color of the run */
+    auto render_run = [&] (const wf::framebuffer_t& target,
+                              const wf::region_t& target_damage)
+    {
+        if (target_damage.empty())
+            return;
+
+        OpenGL::textured_quad_t quad;
+        quad.texture = previous_texture;
+        quad.geometry = {
+            1.0f * run.box.x, 1.0f * run.box.y,
+            1.0f * run.box.x + 1.0f * run.box.width,
+            1.0f * run.box.y + 1.0f * run.box.height,
+        };
+        quad.transform = target.get_orthographic_projection() * run.matrix;
+        quad.color = run.color;
+
+        /* For ex. the scale transformer of a small window preview. Surface
+         * textures belong to the client and aren't mipmapped. */
+        if (previous_buffer && OpenGL::is_minified(quad,
+            {target.viewport_width, target.viewport_height},
+            {previous_buffer->viewport_width, previous_buffer->viewport_height}))
+        {
+            OpenGL::render_begin();
+            quad.texture = previous_buffer->get_minified_texture();
+            OpenGL::render_end();
+        }
+
+        std::vector<wlr_box> scissor_boxes;
+        for (const auto& rect : target_damage)
+        {
+            scissor_boxes.push_back(target.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+        }
+
+        OpenGL::render_batch_t batch;
+        batch.set_scissor(target, scissor_boxes);
+        batch.add(quad);
+
+        OpenGL::render_begin(target);
+        batch.flush();
+        OpenGL::render_end();
+    };
+
+    /* Render the pending run to the buffer of its last transform */
+    auto flush_run = [&] ()
+    {
+        if (!run.active)
+            return;
+
+        render_run(run.last->fb, prepare_buffer(*run.last, obox));
+        previous_transform = run.last;
+        previous_texture = previous_transform->fb.tex;
+        previous_buffer = &previous_transform->fb;
+        run = {};
+    };
+
     /* Render the view passing its snapshot through the transformers.
      * For each transformer except the last we render on offscreen buffers,
      * and the last one is rendered to the real fb. */
     auto& transforms = view_impl->transforms;
     transforms.for_each([&] (auto& transform) -> void
     {
+        glm::mat4 matrix;
+        glm::vec4 color;
+        if (transform->transform->get_composable_transform(obox, matrix, color))
+        {
+            if (!run.active)
+            {
+                run.active = true;
+                run.box = obox;
+            }
+
+            /* Only the buffer of the last transform in the run is used */
+            if (run.last)
+                run.last->cached_damage.clear();
+
+            run.matrix = matrix * run.matrix;
+            run.color *= color;
+            run.last = transform;
+            obox = transform->transform->get_bounding_box(obox, obox);
+
+            /* Drawn to the real fb after the loop */
+            if (transform == transforms.back())
+            {
+                final_transform = transform;
+                transform->cached_damage.clear();
+            }
+
+            return;
+        }
+
+        flush_run();
+
         /* Last transform is handled separately */
         if (transform == transforms.back())
         {
             final_transform = transform;
+            transform->cached_damage.clear();
             return;
         }
 
         /* Calculate size after this transform */
         auto transformed_box =
             transform->transform->get_bounding_box(obox, obox);
-        int scaled_width = transformed_box.width * texture_scale;
-        int scaled_height = transformed_box.height * texture_scale;
-
-        /* Prepare buffer to store result after the transform */
-        OpenGL::render_begin();
-        transform->fb.allocate(scaled_width, scaled_height);
-        transform->fb.scale = texture_scale;
-        transform->fb.geometry = transformed_box;
-        transform->fb.bind(); // bind buffer to clear it
-        OpenGL::clear({0, 0, 0, 0});
-        OpenGL::render_end();
 
         /* Actually render the transform to the next framebuffer */
-        wf::region_t whole_region{wlr_box{0, 0, scaled_width, scaled_height}};
+        WF_TRACE_SCOPE("render", "transformer " + transform->plugin_name);
+        auto buffer_damage = prepare_buffer(*transform, transformed_box);
+        OpenGL::gpu_timer_scope_t gpu_timer{get_gpu_timer_owner(*transform)};
         transform->transform->render_with_damage(previous_texture, obox,
-            whole_region, transform->fb);
+            buffer_damage, transform->fb);
 
         previous_transform = transform;
         previous_texture = previous_transform->fb.tex;
+        previous_buffer = &previous_transform->fb;
         obox = transformed_box;
     });
 
+    if (final_transform && run.active)
+    {
+        /* The final transform is part of a run, so the run goes directly to
+         * the target framebuffer */
+        render_run(framebuffer, damage);
+        return true;
+    }
+
+    /* The last transform of the run was removed while iterating */
+    flush_run();
+
     /* This can happen in two ways:
      * 1. The view is unmapped, and no snapshot
      * 2. The last transform was deleted while iterating, so now the last
@@ -925,26 +1219,36 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
      * framebuffer. */
     if (final_transform == nullptr)
     {
-        OpenGL::render_begin(framebuffer);
-        auto matrix = framebuffer.get_orthographic_projection();
-        gl_geometry src_geometry = {
+        if (damage.empty())
+            return true;
+
+        OpenGL::textured_quad_t quad;
+        quad.texture = previous_texture;
+        quad.geometry = {
             1.0f * obox.x, 1.0f * obox.y,
             1.0f * obox.x + 1.0f * obox.width,
             1.0f * obox.y + 1.0f * obox.height,
         };
+        quad.transform = framebuffer.get_orthographic_projection();
 
+        std::vector<wlr_box> scissor_boxes;
         for (const auto& rect : damage)
-        {
-            framebuffer.scissor(wlr_box_from_pixman_box(rect));
-            OpenGL::render_transformed_texture(previous_texture, src_geometry,
-                {}, matrix);
-        }
+            scissor_boxes.push_back(wlr_box_from_pixman_box(rect));
+
+        OpenGL::render_batch_t batch;
+        batch.set_scissor(framebuffer, scissor_boxes);
+        batch.add(quad);
 
+        OpenGL::render_begin(framebuffer);
+        batch.flush();
         OpenGL::render_end();
     } else
     {
         /* Regular case, just call the last transformer, but render directly
          * to the target framebuffer */
+        WF_TRACE_SCOPE("render", "transformer " + final_transform->plugin_name);
+        OpenGL::gpu_timer_scope_t gpu_timer{
+            get_gpu_timer_owner(*final_transform)};
         final_transform->transform->render_with_damage(previous_texture, obox,
             damage, framebuffer);
     }
@@ -955,6 +1259,7 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
 wf::view_transform_block_t::view_transform_block_t() {}
 wf::view_transform_block_t::~view_transform_block_t()
 {
+    wf::offscreen_buffer_registry_t::get().remove(&this->fb);
     OpenGL::render_begin();
     this->fb.release();
     OpenGL::render_end();
@@ -966,30 +1271,83 @@ void wf::view_interface_t::take_snapshot()
         return;
 
     auto& offscreen_buffer = view_impl->offscreen_buffer;
+    if (view_impl->snapshot_frozen && offscreen_buffer.valid())
+        return;
 
     auto buffer_geometry = get_untransformed_bounding_box();
     offscreen_buffer.geometry = buffer_geometry;
 
-    float scale = get_output()->handle->scale;
+    float scale = std::min(get_content_scale(this),
+        view_impl->snapshot_max_scale);
 
-    offscreen_buffer.cached_damage &= buffer_geometry;
-    /* Nothing has changed, the last buffer is still valid */
-    if (offscreen_buffer.cached_damage.empty())
-        return;
+    /* The snapshot can always be redone while the view is mapped. After the
+     * view is unmapped or the snapshot is frozen, it holds the last contents
+     * and has to stay. */
+    auto track_snapshot = [&] ()
+    {
+        wf::offscreen_buffer_registry_t::get().touch(&offscreen_buffer,
+            "snapshot", [this] ()
+        {
+            if (!is_mapped() || view_impl->snapshot_frozen)
+                return false;
+
+            auto& buffer = view_impl->offscreen_buffer;
+            buffer.release();
+            buffer.cached_damage |= buffer.geometry;
+            return true;
+        }, this);
+    };
 
+    offscreen_buffer.cached_damage &= buffer_geometry;
     int scaled_width = buffer_geometry.width * scale;
     int scaled_height = buffer_geometry.height * scale;
     if (scaled_width != offscreen_buffer.viewport_width ||
-        scaled_height != offscreen_buffer.viewport_height)
+        scaled_height != offscreen_buffer.viewport_height ||
+        scale != offscreen_buffer.scale)
     {
         offscreen_buffer.cached_damage |= buffer_geometry;
     }
 
+    /* Nothing has changed, the last buffer is still valid */
+    if (offscreen_buffer.cached_damage.empty())
+    {
+        track_snapshot();
+        return;
+    }
+
     offscreen_buffer.cached_damage +=
         -wf::point_t{buffer_geometry.x, buffer_geometry.y};
 
+    auto output_geometry = get_output_geometry();
+    int ox = output_geometry.x - buffer_geometry.x;
+    int oy = output_geometry.y - buffer_geometry.y;
+    auto children = enumerate_surfaces({ox, oy});
+
+    /* Views which are opaque everywhere, which is the common case for
+     * windows without client-side shadows, don't need the alpha channel */
+    wf::region_t translucent{{0, 0, buffer_geometry.width, buffer_geometry.height}};
+    if (get_output())
+    {
+        /* Opaque regions are in the scale of the output */
+        translucent *= get_output()->handle->scale;
+        for (auto& child : children)
+        {
+            child.surface->subtract_opaque(translucent,
+                child.position.x, child.position.y);
+        }
+    }
+
+    offscreen_buffer.format = translucent.empty() ?
+        wf::FRAMEBUFFER_FORMAT_RGB8 : wf::FRAMEBUFFER_FORMAT_RGBA8;
+
     OpenGL::render_begin();
-    offscreen_buffer.allocate(scaled_width, scaled_height);
+    if (offscreen_buffer.allocate(scaled_width, scaled_height))
+    {
+        /* Reallocated, for ex. because the format changed */
+        offscreen_buffer.cached_damage |=
+            wlr_box{0, 0, buffer_geometry.width, buffer_geometry.height};
+    }
+
     offscreen_buffer.scale = scale;
     offscreen_buffer.bind();
     for (auto& box : offscreen_buffer.cached_damage)
@@ -1009,18 +1367,27 @@ void wf::view_interface_t::take_snapshot()
         damage_region |= offscreen_buffer.damage_box_from_geometry_box(box);
     }
 
-    auto output_geometry = get_output_geometry();
-    int ox = output_geometry.x - buffer_geometry.x;
-    int oy = output_geometry.y - buffer_geometry.y;
+    /* The opacity of the view is applied when the snapshot is drawn */
+    float alpha = OpenGL::get_alpha_modifier();
+    OpenGL::set_alpha_modifier(1.0);
 
-    auto children = enumerate_surfaces({ox, oy});
     for (auto& child : wf::reverse(children))
     {
         child.surface->simple_render(offscreen_buffer,
             child.position.x, child.position.y, damage_region);
     }
 
+    OpenGL::set_alpha_modifier(alpha);
     offscreen_buffer.cached_damage.clear();
+    track_snapshot();
+}
+
+void wf::view_interface_t::take_final_snapshot(float max_scale)
+{
+    view_impl->snapshot_frozen = false;
+    view_impl->snapshot_max_scale = max_scale;
+    take_snapshot();
+    view_impl->snapshot_frozen = is_mapped();
 }
 
 wf::view_interface_t::view_interface_t() : surface_interface_t(nullptr)
@@ -1038,31 +1405,107 @@ void wf::view_interface_t::initialize()
     }
 }
 
+/* Incremented each time the cached bounding boxes of the views may have
+ * become out of date */
+static uint64_t bounding_box_epoch = 1;
+
+void wf::invalidate_view_bounding_boxes()
+{
+    ++bounding_box_epoch;
+}
+
+uint64_t wf::get_view_scene_epoch()
+{
+    return bounding_box_epoch;
+}
+
+void wf::view_interface_t::view_priv_impl::validate_bounding_box_cache(
+    bool mapped, wf::geometry_t output_geometry)
+{
+    auto& cache = bounding_box_cache;
+    if (cache.epoch == bounding_box_epoch && cache.mapped == mapped &&
+        cache.output_geometry == output_geometry)
+    {
+        return;
+    }
+
+    cache.epoch = bounding_box_epoch;
+    cache.mapped = mapped;
+    cache.output_geometry = output_geometry;
+    cache.untransformed.reset();
+    cache.transformed.reset();
+}
+
+wf::view_interface_t::view_priv_impl::~view_priv_impl()
+{
+    wf::offscreen_buffer_registry_t::get().remove(&offscreen_buffer);
+    OpenGL::render_begin();
+    offscreen_buffer.release();
+    OpenGL::render_end();
+}
+
 wf::view_interface_t::~view_interface_t()
 {
     /* Note: at this point, it is invalid to call most functions */
     unset_toplevel_parent(self());
+    wf::offscreen_buffer_registry_t::get().forget_object(this);
+    wf::accounting::forget_memory_usage(this);
 }
 
-void wf::view_interface_t::damage_surface_box(const wlr_box& box)
+void wf::view_interface_t::damage_surface_region(const wf::region_t& region)
 {
+    if (region.empty())
+        return;
+
+    /* Whatever changed may have changed the bounding box as well */
+    wf::invalidate_view_bounding_boxes();
     auto obox = get_output_geometry();
 
-    auto damaged = box;
-    damaged.x += obox.x;
-    damaged.y += obox.y;
+    auto damaged = region + wf::point_t{obox.x, obox.y};
     view_impl->offscreen_buffer.cached_damage |= damaged;
-    view_damage_raw(self(), transform_region(damaged));
+    if (!has_transformer())
+    {
+        view_damage_raw(self(), damaged);
+        return;
+    }
+
+    /* Pass the damage through the transformers, each of them keeps the
+     * damage of its buffer */
+    auto view_box = get_untransformed_bounding_box();
+    view_impl->transforms.for_each([&] (auto& tr)
+    {
+        damaged = tr->transform->transform_damage(view_box, damaged);
+        view_box = tr->transform->get_bounding_box(view_box, view_box);
+        tr->cached_damage |= damaged;
+    });
+
+    view_damage_raw(self(), damaged);
+}
+
+void wf::view_interface_t::view_priv_impl::damage_transforms(
+    wf::geometry_t view, wlr_box box)
+{
+    transforms.for_each([&] (auto& tr)
+    {
+        box = tr->transform->get_bounding_box(view, box);
+        view = tr->transform->get_bounding_box(view, view);
+        tr->cached_damage |= box;
+    });
 }
 
 void wf::view_damage_raw(wayfire_view view, const wlr_box& box)
+{
+    view_damage_raw(view, wf::region_t{box});
+}
+
+void wf::view_damage_raw(wayfire_view view, const wf::region_t& region)
 {
     auto output = view->get_output();
     if (!output)
         return;
 
-    auto damage_box = output->render->get_target_framebuffer().
-        damage_box_from_geometry_box(box);
+    auto damage = output->render->get_target_framebuffer().
+        damage_region_from_geometry_region(region);
 
     /* shell views are visible in all workspaces. That's why we must apply
      * their damage to all workspaces as well */
@@ -1074,7 +1517,7 @@ void wf::view_damage_raw(wayfire_view view, const wlr_box& box)
         /* Damage only the visible region of the shell view.
          * This prevents hidden panels from spilling damage onto other workspaces */
         wlr_box ws_box = output->render->get_damage_box();
-        wlr_box visible_damage = geometry_intersection(damage_box, ws_box);
+        auto visible_damage = damage & ws_box;
         for (int i = 0; i < wsize.width; i++)
         {
             for (int j = 0; j < wsize.height; j++)
@@ -1086,9 +1529,16 @@ void wf::view_damage_raw(wayfire_view view, const wlr_box& box)
         }
     } else
     {
-        output->render->damage(damage_box);
+        output->render->damage(damage);
     }
 
+    static const wf::signal_id_t view_damaged{"view-damaged"};
+    view_damaged_signal data;
+    data.view = view;
+    data.box  = wlr_box_from_pixman_box(damage.get_extents());
+    data.region = &damage;
+    output->emit_signal(view_damaged, &data);
+
     view->emit_signal("damaged-region", nullptr);
 }
 
@@ -302,6 +302,18 @@ void wayfire_xdg_view<XdgToplevelVersion>::commit()
 {
     wlr_view_t::commit();
 
+    uint32_t acked = _get_acked_serial();
+    if (acked != last_committed_serial)
+    {
+        last_committed_serial = acked;
+        view_configure_committed_signal data;
+        data.view = self();
+        data.serial = acked;
+        data.latest = (acked == last_configure_serial) &&
+            !idle_configure.is_connected();
+        emit_signal("configure-committed", &data);
+    }
+
     /* On each commit, check whether the window geometry of the xdg_surface
      * changed. In those cases, we need to adjust the view's output geometry,
      * so that the apparent wm geometry doesn't change */
@@ -346,6 +358,38 @@ wf::geometry_t wayfire_xdg_view<XdgToplevelVersion>::get_wm_geometry()
     return wm;
 }
 
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::schedule_configure()
+{
+    if (!idle_configure.is_connected())
+        idle_configure.run_once([=] () { send_configure(); });
+}
+
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::send_configure()
+{
+    auto pending = pending_configure;
+    pending_configure = {};
+    if (!xdg_toplevel)
+        return;
+
+    /* wlroots sends all changes made before it gets idle in one configure,
+     * so the serials are all the same unless a change was a no-op (0) */
+    uint32_t serial = 0;
+    auto update_serial = [&] (uint32_t s) { serial = s ? s : serial; };
+    if (pending.activated)
+        update_serial(_set_activated(*pending.activated));
+    if (pending.tiled_edges)
+        update_serial(_set_tiled(*pending.tiled_edges));
+    if (pending.fullscreen)
+        update_serial(_set_fullscreen(*pending.fullscreen));
+    if (pending.size)
+        update_serial(_set_size(pending.size->width, pending.size->height));
+
+    if (serial)
+        last_configure_serial = serial;
+}
+
 template<class XdgToplevelVersion>
 void wayfire_xdg_view<XdgToplevelVersion>::set_activated(bool act)
 {
@@ -354,73 +398,96 @@ void wayfire_xdg_view<XdgToplevelVersion>::set_activated(bool act)
     if (this->role == wf::VIEW_ROLE_DESKTOP_ENVIRONMENT)
         act = true;
 
-    _set_activated(act);
+    pending_configure.activated = act;
+    schedule_configure();
     wf::wlr_view_t::set_activated(act);
 }
 
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::set_tiled(uint32_t edges)
+{
+    pending_configure.tiled_edges = edges;
+    schedule_configure();
+    wlr_view_t::set_tiled(edges);
+}
+
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::set_fullscreen(bool full)
+{
+    wf::wlr_view_t::set_fullscreen(full);
+    pending_configure.fullscreen = full;
+    schedule_configure();
+}
+
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::resize(int w, int h)
+{
+    if (view_impl->frame)
+        view_impl->frame->calculate_resize_size(w, h);
+
+    pending_configure.size = wf::dimensions_t{w, h};
+    schedule_configure();
+}
+
+template<class XdgToplevelVersion>
+void wayfire_xdg_view<XdgToplevelVersion>::request_native_size()
+{
+    pending_configure.size = wf::dimensions_t{0, 0};
+    schedule_configure();
+}
+
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel>::_set_activated(bool act) {
-    wlr_xdg_toplevel_set_activated(xdg_toplevel->base, act);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel>::_set_activated(bool act) {
+    return wlr_xdg_toplevel_set_activated(xdg_toplevel->base, act);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel_v6>::_set_activated(bool act) {
-    wlr_xdg_toplevel_v6_set_activated(xdg_toplevel->base, act);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel_v6>::_set_activated(bool act) {
+    return wlr_xdg_toplevel_v6_set_activated(xdg_toplevel->base, act);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel>::set_tiled(uint32_t edges)
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel>::_set_tiled(uint32_t edges)
 {
-    wlr_xdg_toplevel_set_tiled(xdg_toplevel->base, edges);
-    wlr_xdg_toplevel_set_maximized(xdg_toplevel->base,
+    uint32_t serial = wlr_xdg_toplevel_set_tiled(xdg_toplevel->base, edges);
+    uint32_t max_serial = wlr_xdg_toplevel_set_maximized(xdg_toplevel->base,
         (edges == wf::TILED_EDGES_ALL));
-    wlr_view_t::set_tiled(edges);
+    return max_serial ? max_serial : serial;
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel_v6>::set_tiled(uint32_t edges) {
-    wlr_xdg_toplevel_v6_set_maximized(xdg_toplevel->base, !!edges);
-    wlr_view_t::set_tiled(edges);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel_v6>::_set_tiled(uint32_t edges) {
+    return wlr_xdg_toplevel_v6_set_maximized(xdg_toplevel->base, !!edges);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel>::set_fullscreen(bool full)
-{
-    wf::wlr_view_t::set_fullscreen(full);
-    wlr_xdg_toplevel_set_fullscreen(xdg_toplevel->base, full);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel>::_set_fullscreen(bool full) {
+    return wlr_xdg_toplevel_set_fullscreen(xdg_toplevel->base, full);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel_v6>::set_fullscreen(bool full)
-{
-    wf::wlr_view_t::set_fullscreen(full);
-    wlr_xdg_toplevel_v6_set_fullscreen(xdg_toplevel->base, full);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel_v6>::_set_fullscreen(bool full) {
+    return wlr_xdg_toplevel_v6_set_fullscreen(xdg_toplevel->base, full);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel>::resize(int w, int h)
-{
-    if (view_impl->frame)
-        view_impl->frame->calculate_resize_size(w, h);
-    wlr_xdg_toplevel_set_size(xdg_toplevel->base, w, h);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel>::_set_size(int w, int h) {
+    return wlr_xdg_toplevel_set_size(xdg_toplevel->base, w, h);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel_v6>::resize(int w, int h)
-{
-    if (view_impl->frame)
-        view_impl->frame->calculate_resize_size(w, h);
-    wlr_xdg_toplevel_v6_set_size(xdg_toplevel->base, w, h);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel_v6>::_set_size(int w, int h) {
+    return wlr_xdg_toplevel_v6_set_size(xdg_toplevel->base, w, h);
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel>::request_native_size() {
-    wlr_xdg_toplevel_set_size(xdg_toplevel->base, 0, 0);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel>::_get_acked_serial() {
+    return xdg_toplevel->base->configure_serial;
 }
 
 template<>
-void wayfire_xdg_view<wlr_xdg_toplevel_v6>::request_native_size() {
-    wlr_xdg_toplevel_v6_set_size(xdg_toplevel->base, 0, 0);
+uint32_t wayfire_xdg_view<wlr_xdg_toplevel_v6>::_get_acked_serial() {
+    return xdg_toplevel->base->configure_serial;
 }
 
 template<>
@@ -450,6 +517,7 @@ void wayfire_xdg_view<XdgToplevelVersion>::destroy()
     on_request_maximize.disconnect();
     on_request_minimize.disconnect();
     on_request_fullscreen.disconnect();
+    idle_configure.disconnect();
 
     xdg_toplevel = nullptr;
     wf::wlr_view_t::destroy();
@@ -2,6 +2,8 @@
 #define XDG_SHELL_HPP
 
 #include "view-impl.hpp"
+#include <optional>
+
 extern "C"
 {
 #include <wlr/types/wlr_xdg_shell.h>
@@ -57,6 +59,34 @@ class wayfire_xdg_view : public wf::wlr_view_t
     wf::point_t xdg_surface_offset = {0, 0};
     XdgToplevelVersion *xdg_toplevel;
 
+    /**
+     * The toplevel state changes made in the current event loop iteration.
+     * They are sent together from an idle callback, so that for ex. tiling
+     * and resizing a view results in a single configure.
+     */
+    struct pending_configure_t
+    {
+        std::optional<bool> activated;
+        std::optional<uint32_t> tiled_edges;
+        std::optional<bool> fullscreen;
+        std::optional<wf::dimensions_t> size;
+    };
+
+    pending_configure_t pending_configure;
+    wf::wl_idle_call idle_configure;
+
+    /* The serial of the last configure sent, and of the last one which was
+     * acked and committed by the client */
+    uint32_t last_configure_serial = 0;
+    uint32_t last_committed_serial = 0;
+
+    void schedule_configure();
+    void send_configure();
+    uint32_t _set_tiled(uint32_t edges);
+    uint32_t _set_fullscreen(bool full);
+    uint32_t _set_size(int w, int h);
+    uint32_t _get_acked_serial();
+
   protected:
     void initialize() override final;
 
@@ -72,7 +102,7 @@ class wayfire_xdg_view : public wf::wlr_view_t
 
     void set_tiled(uint32_t edges) final;
     void set_activated(bool act) final;
-    void _set_activated(bool act);
+    uint32_t _set_activated(bool act);
     void set_fullscreen(bool full) final;
 
     void resize(int w, int h) final;
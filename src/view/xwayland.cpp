@@ -7,6 +7,11 @@
 #include "wayfire/output-layout.hpp"
 #include "../core/core-impl.hpp"
 #include "view-impl.hpp"
+#include <wayfire/option-wrapper.hpp>
+
+#include <algorithm>
+#include <optional>
+#include <signal.h>
 
 extern "C"
 {
@@ -23,6 +28,8 @@ extern "C"
 
 #if WLR_HAS_XWAYLAND
 
+static void xwayland_surface_count_changed(int delta);
+
 class wayfire_xwayland_view_base : public wf::wlr_view_t
 {
     protected:
@@ -36,6 +43,20 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
     /** The geometry requested by the client */
     bool self_positioned = false;
 
+    /**
+     * Configures are sent at most once per configure_interval_ms, so that
+     * interactive moves and resizes don't flood the X server. The last
+     * configure is kept, in global coordinates, to skip configures which
+     * don't change anything.
+     */
+    static constexpr uint32_t configure_interval_ms = 16;
+    std::optional<wf::geometry_t> last_configure;
+    std::optional<wf::dimensions_t> pending_configure;
+    /* Whether the client asked for a configure, so it must get one */
+    bool force_configure = false;
+    uint32_t last_configure_time = 0;
+    wf::wl_timer configure_timer;
+
     wf::signal_connection_t output_geometry_changed{[this] (wf::signal_data_t*)
     {
         if (is_mapped())
@@ -46,6 +67,7 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
     wayfire_xwayland_view_base(wlr_xwayland_surface *xww)
         : wlr_view_t(), xw(xww)
     {
+        xwayland_surface_count_changed(1);
     }
 
     virtual void initialize() override
@@ -95,6 +117,8 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
     virtual void destroy() override
     {
         this->xw = nullptr;
+        xwayland_surface_count_changed(-1);
+        configure_timer.disconnect();
         output_geometry_changed.disconnect();
 
         on_map.disconnect();
@@ -126,7 +150,7 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
                 get_output()->get_relative_geometry());
         }
 
-        send_configure(configure_geometry.width, configure_geometry.height);
+        send_configure(configure_geometry.width, configure_geometry.height, true);
 
         if (view_impl->frame)
         {
@@ -144,7 +168,7 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
         wf::wlr_view_t::close();
     }
 
-    void send_configure(int width, int height)
+    void send_configure(int width, int height, bool force = false)
     {
         if (!xw)
             return;
@@ -157,6 +181,30 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
             return;
         }
 
+        pending_configure = wf::dimensions_t{width, height};
+        force_configure |= force;
+        if (configure_timer.is_connected())
+            return;
+
+        uint32_t elapsed = wf::get_current_time() - last_configure_time;
+        if (elapsed >= configure_interval_ms)
+        {
+            flush_configure();
+        } else
+        {
+            configure_timer.set_timeout(configure_interval_ms - elapsed,
+                [=] () { flush_configure(); });
+        }
+    }
+
+    /** Send the pending configure, with the current position of the view */
+    void flush_configure()
+    {
+        if (!xw || !pending_configure)
+            return;
+
+        auto size = *pending_configure;
+        pending_configure.reset();
         auto output_geometry = get_output_geometry();
 
         int configure_x = output_geometry.x;
@@ -169,8 +217,17 @@ class wayfire_xwayland_view_base : public wf::wlr_view_t
             configure_y += real_output.y;
         }
 
+        wf::geometry_t configure = {configure_x, configure_y,
+            size.width, size.height};
+        bool forced = force_configure;
+        force_configure = false;
+        if (!forced && last_configure && (*last_configure == configure))
+            return;
+
+        last_configure = configure;
+        last_configure_time = wf::get_current_time();
         wlr_xwayland_surface_configure(xw,
-            configure_x, configure_y, width, height);
+            configure_x, configure_y, size.width, size.height);
     }
 
     void send_configure()
@@ -522,6 +579,37 @@ void wayfire_unmanaged_xwayland_view::map(wlr_surface *surface)
 }
 
 static wlr_xwayland *xwayland_handle = nullptr;
+
+/**
+ * With core/xwayland_lazy, Xwayland is started by wlroots when the first X
+ * client connects. With core/xwayland_idle_timeout, it is also stopped when
+ * it had no windows for that many seconds, and wlroots starts it again
+ * lazily on the next connection. Every X client creates at least one window
+ * (possibly unmapped), so no windows means no clients worth keeping.
+ */
+static void xwayland_surface_count_changed(int delta)
+{
+    static int surface_count = 0;
+    static wf::wl_timer idle_timer;
+    static wf::option_wrapper_t<bool> lazy{"core/xwayland_lazy"};
+    static wf::option_wrapper_t<int> idle_timeout{"core/xwayland_idle_timeout"};
+
+    surface_count += delta;
+    idle_timer.disconnect();
+    if (surface_count > 0 || !lazy || idle_timeout <= 0)
+        return;
+
+    /* wlroots doesn't restart an Xwayland which exits sooner than 5 seconds
+     * after being started, since it might be crashing in a loop */
+    idle_timer.set_timeout(std::max((int)idle_timeout, 10) * 1000, [] ()
+    {
+        if (!xwayland_handle || xwayland_handle->pid <= 0)
+            return;
+
+        LOGI("Stopping Xwayland, it has had no windows for a while");
+        kill(xwayland_handle->pid, SIGTERM);
+    });
+}
 #endif
 
 void wf::init_xwayland()
@@ -546,8 +634,9 @@ void wf::init_xwayland()
         }
     });
 
+    wf::option_wrapper_t<bool> lazy{"core/xwayland_lazy"};
     xwayland_handle = wlr_xwayland_create(wf::get_core().display,
-        wf::get_core_impl().compositor, false);
+        wf::get_core_impl().compositor, lazy);
     if (xwayland_handle)
     {
         on_created.connect(&xwayland_handle->events.new_surface);